@@ -215,6 +215,12 @@ abstract class AppLocalizations {
   /// **'AdGuard'**
   String get adguard;
 
+  /// No description provided for @dnsAuto.
+  ///
+  /// In en, this message translates to:
+  /// **'Auto'**
+  String get dnsAuto;
+
   /// No description provided for @perAppProxy.
   ///
   /// In en, this message translates to:
@@ -245,6 +251,12 @@ abstract class AppLocalizations {
   /// **'Select apps'**
   String get selectApps;
 
+  /// No description provided for @splitTunnelAppsDescription.
+  ///
+  /// In en, this message translates to:
+  /// **'Comma-separated program names or paths, e.g., apt, restic'**
+  String get splitTunnelAppsDescription;
+
   /// No description provided for @account.
   ///
   /// In en, this message translates to:
@@ -701,6 +713,48 @@ abstract class AppLocalizations {
   /// **'Clear logs'**
   String get clearLogsTooltip;
 
+  /// No description provided for @loadEarlierLogsTooltip.
+  ///
+  /// In en, this message translates to:
+  /// **'Load earlier logs'**
+  String get loadEarlierLogsTooltip;
+
+  /// No description provided for @logLevelFilterTooltip.
+  ///
+  /// In en, this message translates to:
+  /// **'Filter by level'**
+  String get logLevelFilterTooltip;
+
+  /// No description provided for @logLevelAll.
+  ///
+  /// In en, this message translates to:
+  /// **'All levels'**
+  String get logLevelAll;
+
+  /// No description provided for @logLevelWarnings.
+  ///
+  /// In en, this message translates to:
+  /// **'Warnings and errors'**
+  String get logLevelWarnings;
+
+  /// No description provided for @logLevelErrors.
+  ///
+  /// In en, this message translates to:
+  /// **'Errors only'**
+  String get logLevelErrors;
+
+  /// No description provided for @searchLogsTooltip.
+  ///
+  /// In en, this message translates to:
+  /// **'Search logs'**
+  String get searchLogsTooltip;
+
+  /// No description provided for @searchLogsHint.
+  ///
+  /// In en, this message translates to:
+  /// **'Search…'**
+  String get searchLogsHint;
+
   /// No description provided for @noLogsToShow.
   ///
   /// In en, this message translates to:
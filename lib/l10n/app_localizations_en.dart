@@ -68,6 +68,9 @@ class AppLocalizationsEn extends AppLocalizations {
   @override
   String get adguard => 'AdGuard';
 
+  @override
+  String get dnsAuto => 'Auto';
+
   @override
   String get perAppProxy => 'Per-app proxy';
 
@@ -83,6 +86,9 @@ class AppLocalizationsEn extends AppLocalizations {
   @override
   String get selectApps => 'Select apps';
 
+  @override
+  String get splitTunnelAppsDescription => 'Comma-separated program names or paths, e.g., apt, restic';
+
   @override
   String get account => 'Account';
 
@@ -311,6 +317,27 @@ class AppLocalizationsEn extends AppLocalizations {
   @override
   String get clearLogsTooltip => 'Clear logs';
 
+  @override
+  String get loadEarlierLogsTooltip => 'Load earlier logs';
+
+  @override
+  String get logLevelFilterTooltip => 'Filter by level';
+
+  @override
+  String get logLevelAll => 'All levels';
+
+  @override
+  String get logLevelWarnings => 'Warnings and errors';
+
+  @override
+  String get logLevelErrors => 'Errors only';
+
+  @override
+  String get searchLogsTooltip => 'Search logs';
+
+  @override
+  String get searchLogsHint => 'Search…';
+
   @override
   String get noLogsToShow => 'No logs to display.';
 
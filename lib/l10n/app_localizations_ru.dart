@@ -68,6 +68,9 @@ class AppLocalizationsRu extends AppLocalizations {
   @override
   String get adguard => 'AdGuard';
 
+  @override
+  String get dnsAuto => 'Авто';
+
   @override
   String get perAppProxy => 'Прокси для приложений';
 
@@ -83,6 +86,9 @@ class AppLocalizationsRu extends AppLocalizations {
   @override
   String get selectApps => 'Выбрать приложения';
 
+  @override
+  String get splitTunnelAppsDescription => 'Имена или пути программ через запятую, например: apt, restic';
+
   @override
   String get account => 'Аккаунт';
 
@@ -311,6 +317,27 @@ class AppLocalizationsRu extends AppLocalizations {
   @override
   String get clearLogsTooltip => 'Очистить логи';
 
+  @override
+  String get loadEarlierLogsTooltip => 'Загрузить более ранние логи';
+
+  @override
+  String get logLevelFilterTooltip => 'Фильтр по уровню';
+
+  @override
+  String get logLevelAll => 'Все уровни';
+
+  @override
+  String get logLevelWarnings => 'Предупреждения и ошибки';
+
+  @override
+  String get logLevelErrors => 'Только ошибки';
+
+  @override
+  String get searchLogsTooltip => 'Поиск по логам';
+
+  @override
+  String get searchLogsHint => 'Поиск…';
+
   @override
   String get noLogsToShow => 'Нет логов для отображения.';
 
@@ -0,0 +1,138 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// An open connection through sing-box, as tracked by the desktop runners.
+class ActiveConnection {
+  /// Stands for the connection in the runner's diffs.
+  final int handle;
+  final String id;
+  final DateTime? start;
+  final String network;
+  final String inbound;
+  final String source;
+  final String destination;
+
+  /// The sniffed or requested domain, if any.
+  final String host;
+  final String process;
+
+  /// The route rule that matched and the outbound chain it led to.
+  final String rule;
+  final String chain;
+
+  int upload;
+  int download;
+
+  /// Bytes moved since the previous diff, about a second.
+  int uploadRate = 0;
+  int downloadRate = 0;
+
+  ActiveConnection({
+    required this.handle,
+    required this.id,
+    required this.start,
+    required this.network,
+    required this.inbound,
+    required this.source,
+    required this.destination,
+    required this.host,
+    required this.process,
+    required this.rule,
+    required this.chain,
+    required this.upload,
+    required this.download,
+  });
+}
+
+/// The open connections, kept up to date from the kConnectionDiff frames
+/// of `watchConnections` (see native/event_frame.h) without the runner ever
+/// re-sending the whole list.
+class ActiveConnections {
+  static const _headerSize = 32;
+  static const _openedFixedSize = 24;
+  static const _changedSize = 24;
+
+  final Map<int, ActiveConnection> byHandle = {};
+  int _seq = 0;
+
+  /// Applies the diff in [size] bytes of [data] from [offset]. Returns
+  /// false when it does not follow the previous one, leaving the list as
+  /// it was until the next reset.
+  bool apply(ByteData data, int offset, int size) {
+    if (size < _headerSize) return false;
+    final seq = data.getUint64(offset, Endian.little);
+    final reset = data.getUint8(offset + 8) != 0;
+    if (!reset && (_seq == 0 || seq != _seq + 1)) return false;
+    final opened = data.getUint32(offset + 16, Endian.little);
+    final closed = data.getUint32(offset + 20, Endian.little);
+    final changed = data.getUint32(offset + 24, Endian.little);
+    final end = offset + size;
+    var at = offset + _headerSize;
+
+    if (reset) byHandle.clear();
+    for (var i = 0; i < opened; i++) {
+      if (at + 8 > end) return false;
+      final handle = data.getUint32(at, Endian.little);
+      final recordEnd = at + 8 + data.getUint32(at + 4, Endian.little);
+      if (recordEnd > end || recordEnd < at + _openedFixedSize) return false;
+      final upload = data.getInt64(at + 8, Endian.little);
+      final download = data.getInt64(at + 16, Endian.little);
+      var field = at + _openedFixedSize;
+      String next() {
+        if (field + 2 > recordEnd) return '';
+        final length = data.getUint16(field, Endian.little);
+        final text = utf8.decode(
+            data.buffer.asUint8List(data.offsetInBytes + field + 2, length),
+            allowMalformed: true);
+        field += 2 + length;
+        return text;
+      }
+
+      final id = next();
+      final start = next();
+      byHandle[handle] = ActiveConnection(
+        handle: handle,
+        id: id,
+        start: DateTime.tryParse(start),
+        network: next(),
+        inbound: next(),
+        source: next(),
+        destination: next(),
+        host: next(),
+        process: next(),
+        rule: next(),
+        chain: next(),
+        upload: upload,
+        download: download,
+      );
+      // Fields a newer runner adds are skipped by the record size.
+      at = recordEnd;
+    }
+    if (at + closed * 4 + changed * _changedSize > end) return false;
+    for (var i = 0; i < closed; i++) {
+      byHandle.remove(data.getUint32(at, Endian.little));
+      at += 4;
+    }
+    for (final connection in byHandle.values) {
+      connection.uploadRate = 0;
+      connection.downloadRate = 0;
+    }
+    for (var i = 0; i < changed; i++) {
+      final connection = byHandle[data.getUint32(at, Endian.little)];
+      if (connection != null) {
+        connection.uploadRate = data.getInt64(at + 8, Endian.little);
+        connection.downloadRate = data.getInt64(at + 16, Endian.little);
+        connection.upload += connection.uploadRate;
+        connection.download += connection.downloadRate;
+      }
+      at += _changedSize;
+    }
+    _seq = seq;
+    return true;
+  }
+
+  void clear() {
+    byHandle.clear();
+    _seq = 0;
+  }
+}
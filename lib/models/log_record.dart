@@ -0,0 +1,107 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// sing-box log levels, in the order used by the native log parser.
+enum LogLevel { trace, debug, info, warn, error, fatal, panic, unknown }
+
+extension LogLevelMask on LogLevel {
+  int get bit => 1 << index;
+
+  /// Mask selecting this level and every more severe one.
+  int get andAbove {
+    var mask = 0;
+    for (final level in LogLevel.values) {
+      if (level.index >= index && level != LogLevel.unknown) {
+        mask |= level.bit;
+      }
+    }
+    return mask;
+  }
+}
+
+class LogRecord {
+  final int line;
+  final DateTime? time;
+  final LogLevel level;
+  final String module;
+  final int connectionId;
+  final String message;
+
+  LogRecord({
+    required this.line,
+    required this.time,
+    required this.level,
+    required this.module,
+    required this.connectionId,
+    required this.message,
+  });
+}
+
+/// A line returned by the native `searchLogs` method.
+class LogSearchMatch {
+  final int line;
+  final String text;
+
+  LogSearchMatch(this.line, this.text);
+}
+
+/// A page of records returned by the native `getLogRecords` method.
+class LogRecordPage {
+  static const _magic = 0x31524C48; // "HLR1"
+
+  /// First line id the native side scanned.
+  final int first;
+
+  /// Line id after the last one scanned.
+  final int next;
+  final List<LogRecord> records;
+
+  LogRecordPage(this.first, this.next, this.records);
+
+  /// Decodes the little-endian layout written by LogStore::ReadRecords.
+  factory LogRecordPage.decode(Uint8List bytes) {
+    final data = ByteData.sublistView(bytes);
+    if (bytes.length < 32 || data.getUint32(0, Endian.little) != _magic) {
+      throw const FormatException('Unknown log record format');
+    }
+    final count = data.getUint32(4, Endian.little);
+    final first = data.getUint64(8, Endian.little);
+    final next = data.getUint64(16, Endian.little);
+    final moduleCount = data.getUint32(24, Endian.little);
+    final recordSize = data.getUint32(28, Endian.little);
+
+    var position = 32;
+    final modules = <String>[];
+    for (var i = 0; i < moduleCount; i++) {
+      final length = data.getUint16(position, Endian.little);
+      position += 2;
+      modules.add(utf8.decode(bytes.sublist(position, position + length),
+          allowMalformed: true));
+      position += length;
+    }
+
+    final textStart = position + count * recordSize;
+    final records = <LogRecord>[];
+    for (var i = 0; i < count; i++, position += recordSize) {
+      final timestamp = data.getInt64(position, Endian.little);
+      final offset = textStart + data.getUint32(position + 16, Endian.little);
+      final length = data.getUint32(position + 20, Endian.little);
+      final module = data.getUint16(position + 28, Endian.little);
+      final level = data.getUint8(position + 30);
+      records.add(LogRecord(
+        line: data.getUint64(position + 8, Endian.little),
+        time: timestamp == 0
+            ? null
+            : DateTime.fromMillisecondsSinceEpoch(timestamp),
+        level: level < LogLevel.values.length
+            ? LogLevel.values[level]
+            : LogLevel.unknown,
+        module: module < modules.length ? modules[module] : '',
+        connectionId: data.getUint32(position + 24, Endian.little),
+        message: utf8.decode(bytes.sublist(offset, offset + length),
+            allowMalformed: true),
+      ));
+    }
+    return LogRecordPage(first, next, records);
+  }
+}
@@ -8,9 +8,11 @@ import 'package:flutter/foundation.dart';
 import 'package:hwl_vpn/api/api_service.dart';
 import 'package:country_flags/country_flags.dart';
 import 'package:hwl_vpn/l10n/app_localizations.dart';
+import 'package:hwl_vpn/models/server_info.dart';
 import 'package:hwl_vpn/screens/account_screen.dart';
 import 'package:hwl_vpn/services/ad_service.dart';
 import 'package:hwl_vpn/services/preferences_service.dart';
+import 'package:hwl_vpn/services/native_events.dart';
 import 'package:hwl_vpn/services/server_service.dart';
 import 'package:hwl_vpn/services/vpn_service.dart';
 import 'package:provider/provider.dart';
@@ -121,11 +123,30 @@ class _HomeScreenState extends State<HomeScreen>
     });
 
     VpnService.platform.setMethodCallHandler(_handleMethod);
+    if (Platform.isLinux || Platform.isWindows) {
+      final serverService = Provider.of<ServerService>(context, listen: false);
+      NativeEvents.onProbeResult = serverService.handleProbeResult;
+      NativeEvents.onTrafficSample = VpnService().handleTrafficSample;
+      NativeEvents.onConnectionDiff = VpnService().handleConnectionDiff;
+      NativeEvents.listen();
+    }
+    if (Platform.isLinux) {
+      _restoreServiceState();
+    }
     if (Platform.isIOS || Platform.isMacOS) {
       _listenToIosVpnStatus();
     }
   }
 
+  /// Picks up a tunnel the Linux tunnel helper kept up while the app was
+  /// closed.
+  Future<void> _restoreServiceState() async {
+    final state = await VpnService().getServiceState();
+    if (!mounted || state?['running'] != true) return;
+    Provider.of<ServerService>(context, listen: false)
+        .setConnectionStatus(ConnectionStatus.connected);
+  }
+
   void _listenToIosVpnStatus() {
     final serverService = Provider.of<ServerService>(context, listen: false);
     _iosVpnStatusSubscription =
@@ -203,6 +224,32 @@ class _HomeScreenState extends State<HomeScreen>
         if (!mounted) return;
         serverService.setConnectionStatus(ConnectionStatus.disconnected);
         break;
+      case 'onVpnRestart':
+        final event = call.arguments as Map;
+        VpnService().handleRestartEvent(event);
+        if (!mounted) return;
+        if (event['kind'] == 'scheduled') {
+          serverService.setConnectionStatus(ConnectionStatus.connecting);
+        } else if (event['kind'] == 'gaveUp') {
+          _showTopNotification(Text(
+              'sing-box crashed ${event['crashes']} times, last '
+              '${event['exitStatus']}',
+              style: const TextStyle(
+                  color: accentColor1, fontWeight: FontWeight.bold),
+              textAlign: TextAlign.center));
+        }
+        break;
+      case 'onNetworkChanged':
+        final event = call.arguments as Map;
+        VpnService().handleNetworkChanged(event);
+        serverService.handleNetworkChange(event);
+        break;
+      case 'onSpeedTestProgress':
+        VpnService().handleSpeedTestProgress(call.arguments as Map);
+        break;
+      case 'onResourcePressure':
+        VpnService().handleResourcePressure(call.arguments as Map);
+        break;
       default:
         if (kDebugMode) {
           print('Unknown method ${call.method}');
@@ -244,6 +291,47 @@ class _HomeScreenState extends State<HomeScreen>
     return accentColor1;
   }
 
+  /// The key the connect button uses for [server], or null when a personal
+  /// key overrides the server list.
+  Future<String?> _serverKey(Server server) async {
+    final personalKey = await PreferencesService().getPersonalKey();
+    if (personalKey != null && personalKey.isNotEmpty) return null;
+    final protocol =
+        Provider.of<ServerService>(context, listen: false).selectedProtocol;
+    final key = protocol == Protocol.vless
+        ? server.vlessLink
+        : (protocol == Protocol.ssh ? server.sshLink : server.hysteria2Link);
+    return key != null && key.isNotEmpty ? key : null;
+  }
+
+  /// Starts validating [server]'s config while the user is still tapping it.
+  Future<void> _prepareServer(Server server) async {
+    if (!Platform.isLinux) return;
+    final key = await _serverKey(server);
+    if (key != null) {
+      await _vpnService.prepareVpn(customVlessLink: key);
+    }
+  }
+
+  /// Moves a desktop connection to [server] without disconnecting. Returns
+  /// false when the caller should disconnect instead.
+  Future<bool> _switchServer(Server server) async {
+    if (!Platform.isLinux && !Platform.isWindows) return false;
+    final key = await _serverKey(server);
+    if (key == null) return false;
+
+    final serverService = Provider.of<ServerService>(context, listen: false);
+    final error = await _vpnService.switchVpn(customVlessLink: key);
+    if (error == null) {
+      serverService.selectServer(server);
+    } else if (mounted) {
+      // The previous connection is still up.
+      _showTopNotification(Text(error,
+          style: TextStyle(color: accentColor1, fontWeight: FontWeight.bold)));
+    }
+    return true;
+  }
+
   Future<void> _disconnect() async {
     final serverService = Provider.of<ServerService>(context, listen: false);
     if (serverService.connectionStatus != ConnectionStatus.connected) return;
@@ -517,11 +605,23 @@ class _HomeScreenState extends State<HomeScreen>
                                                                               children: [
                                                                                 GestureDetector(
                                                                                   behavior: HitTestBehavior.opaque,
+                                                                                  onTapDown: (_) {
+                                                                                    final serverService = Provider.of<ServerService>(context, listen: false);
+                                                                                    if (!isLocked &&
+                                                                                        serverService.connectionStatus == ConnectionStatus.connected &&
+                                                                                        serverService.selectedServer?.uuid != server.uuid) {
+                                                                                      _prepareServer(server);
+                                                                                    }
+                                                                                  },
                                                                                   onTap: () async {
                                                                                     if (isLocked) return;
                                                                                     final serverService = Provider.of<ServerService>(context, listen: false);
                                                                                     if (serverService.selectedServer?.uuid != server.uuid) {
                                                                                       if (serverService.connectionStatus == ConnectionStatus.connected) {
+                                                                                        if (await _switchServer(server)) {
+                                                                                          setSheetState(() {});
+                                                                                          return;
+                                                                                        }
                                                                                         await _disconnect();
                                                                                       }
                                                                                       setSheetState(() {
@@ -1031,8 +1131,16 @@ class _HomeScreenState extends State<HomeScreen>
 
 
                                                 if (vpnKeyToUse != null && vpnKeyToUse.isNotEmpty) {
-                                                  await _vpnService.startVpn(
+                                                  final error = await _vpnService.startVpn(
                                                       customVlessLink: vpnKeyToUse);
+                                                  if (Platform.isLinux || Platform.isWindows) {
+                                                    // The runner reports "Started" once sing-box is
+                                                    // actually up.
+                                                    if (error != null) {
+                                                      serverService.setConnectionStatus(ConnectionStatus.disconnected);
+                                                    }
+                                                    return;
+                                                  }
                                                   serverService.setConnectionStatus(ConnectionStatus.connected);
                                                   _showTopNotification(Text(
                                                     localizations.statusConnected,
@@ -1,6 +1,7 @@
 import 'dart:async';
 import 'package:flutter/material.dart';
 import 'package:hwl_vpn/l10n/app_localizations.dart';
+import 'package:hwl_vpn/models/log_record.dart';
 import 'package:hwl_vpn/services/server_service.dart';
 import 'package:hwl_vpn/utils/colors.dart';
 import 'package:provider/provider.dart';
@@ -16,8 +17,38 @@ class LogsScreen extends StatefulWidget {
 
 class _LogsScreenState extends State<LogsScreen> {
   final _scrollController = ScrollController();
+  final _searchController = TextEditingController();
   late final ServerService _serverService;
 
+  // Null while the search field is closed.
+  List<LogSearchMatch>? _searchResults;
+  Timer? _searchDebounce;
+
+  void _onSearchChanged(String query) {
+    _searchDebounce?.cancel();
+    _searchDebounce = Timer(const Duration(milliseconds: 250), _runSearch);
+  }
+
+  Future<void> _runSearch() async {
+    final query = _searchController.text;
+    final levelMask = _serverService.logLevelFilter?.andAbove ?? 0xff;
+    final results =
+        await _serverService.searchLogs(query, levelMask: levelMask) ?? [];
+    if (!mounted || _searchResults == null || query != _searchController.text) {
+      return;
+    }
+    setState(() => _searchResults = results);
+    _scrollToBottom();
+  }
+
+  void _toggleSearch() {
+    _searchDebounce?.cancel();
+    setState(() {
+      _searchController.clear();
+      _searchResults = _searchResults == null ? [] : null;
+    });
+  }
+
   void _scrollToBottom() {
     WidgetsBinding.instance.addPostFrameCallback((_) {
       if (_scrollController.hasClients) {
@@ -40,6 +71,8 @@ class _LogsScreenState extends State<LogsScreen> {
   @override
   void dispose() {
     _serverService.removeListener(_scrollToBottom);
+    _searchDebounce?.cancel();
+    _searchController.dispose();
     _scrollController.dispose();
     super.dispose();
   }
@@ -49,8 +82,68 @@ class _LogsScreenState extends State<LogsScreen> {
     final localizations = AppLocalizations.of(context)!;
     return Scaffold(
       appBar: AppBar(
-        title: Text(localizations.logsTitle),
+        title: _searchResults == null
+            ? Text(localizations.logsTitle)
+            : TextField(
+                controller: _searchController,
+                autofocus: true,
+                onChanged: _onSearchChanged,
+                decoration: InputDecoration(
+                  hintText: localizations.searchLogsHint,
+                  border: InputBorder.none,
+                ),
+              ),
         actions: [
+          if (_serverService.canFilterLogs)
+            IconButton(
+              icon: Icon(_searchResults == null ? Icons.search : Icons.close),
+              onPressed: _toggleSearch,
+              tooltip: localizations.searchLogsTooltip,
+            ),
+          Consumer<ServerService>(
+            builder: (context, serverService, child) {
+              if (!serverService.canLoadEarlierLogs) {
+                return const SizedBox.shrink();
+              }
+              return IconButton(
+                icon: const Icon(Icons.history),
+                onPressed: serverService.loadEarlierLogs,
+                tooltip: localizations.loadEarlierLogsTooltip,
+              );
+            },
+          ),
+          Consumer<ServerService>(
+            builder: (context, serverService, child) {
+              if (!serverService.canFilterLogs) {
+                return const SizedBox.shrink();
+              }
+              // "All levels" is sent as trace, since a null selection counts
+              // as a cancelled menu.
+              return PopupMenuButton<LogLevel>(
+                icon: Icon(serverService.logLevelFilter == null
+                    ? Icons.filter_list
+                    : Icons.filter_list_alt),
+                tooltip: localizations.logLevelFilterTooltip,
+                initialValue: serverService.logLevelFilter ?? LogLevel.trace,
+                onSelected: (level) => serverService.setLogLevelFilter(
+                    level == LogLevel.trace ? null : level),
+                itemBuilder: (context) => [
+                  PopupMenuItem(
+                    value: LogLevel.trace,
+                    child: Text(localizations.logLevelAll),
+                  ),
+                  PopupMenuItem(
+                    value: LogLevel.warn,
+                    child: Text(localizations.logLevelWarnings),
+                  ),
+                  PopupMenuItem(
+                    value: LogLevel.error,
+                    child: Text(localizations.logLevelErrors),
+                  ),
+                ],
+              );
+            },
+          ),
           IconButton(
             icon: const Icon(Icons.delete_outline),
             onPressed: () {
@@ -64,6 +157,13 @@ class _LogsScreenState extends State<LogsScreen> {
         color: darkColor,
         child: Consumer<ServerService>(
           builder: (context, serverService, child) {
+            final searchResults = _searchResults;
+            if (searchResults != null) {
+              return _buildSearchResults(searchResults, localizations);
+            }
+            if (serverService.logLevelFilter != null) {
+              return _buildRecordList(serverService.filteredLogs, localizations);
+            }
             return SingleChildScrollView(
               controller: _scrollController,
               padding: const EdgeInsets.all(8.0),
@@ -83,4 +183,60 @@ class _LogsScreenState extends State<LogsScreen> {
       ),
     );
   }
-}
\ No newline at end of file
+
+  Widget _buildRecordList(
+      List<LogRecord> records, AppLocalizations localizations) {
+    const style = TextStyle(
+      color: lightColor,
+      fontFamily: 'monospace',
+      fontSize: 12,
+    );
+    if (records.isEmpty) {
+      return Padding(
+        padding: const EdgeInsets.all(8.0),
+        child: Text(localizations.noLogsToShow, style: style),
+      );
+    }
+    return ListView.builder(
+      controller: _scrollController,
+      padding: const EdgeInsets.all(8.0),
+      itemCount: records.length,
+      itemBuilder: (context, index) {
+        final record = records[index];
+        final time = record.time?.toLocal().toIso8601String() ?? '';
+        final module = record.module.isEmpty ? '' : ' ${record.module}:';
+        return SelectableText(
+          '$time ${record.level.name.toUpperCase()}$module ${record.message}',
+          style: style.copyWith(
+            color: record.level.index >= LogLevel.error.index &&
+                    record.level != LogLevel.unknown
+                ? Colors.redAccent
+                : Colors.orangeAccent,
+          ),
+        );
+      },
+    );
+  }
+
+  Widget _buildSearchResults(
+      List<LogSearchMatch> matches, AppLocalizations localizations) {
+    const style = TextStyle(
+      color: lightColor,
+      fontFamily: 'monospace',
+      fontSize: 12,
+    );
+    if (matches.isEmpty) {
+      return Padding(
+        padding: const EdgeInsets.all(8.0),
+        child: Text(localizations.noLogsToShow, style: style),
+      );
+    }
+    return ListView.builder(
+      controller: _scrollController,
+      padding: const EdgeInsets.all(8.0),
+      itemCount: matches.length,
+      itemBuilder: (context, index) =>
+          SelectableText(matches[index].text, style: style),
+    );
+  }
+}
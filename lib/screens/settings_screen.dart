@@ -1,3 +1,4 @@
+import 'dart:async';
 import 'dart:io';
 
 import 'package:flutter/material.dart';
@@ -29,7 +30,9 @@ class SettingsScreen extends StatefulWidget {
   State<SettingsScreen> createState() => _SettingsScreenState();
 }
 
-enum DnsProvider { google, cloudflare, adguard }
+// auto is the fastest provider on the current network, which only the
+// desktop runners measure.
+enum DnsProvider { google, cloudflare, adguard, auto }
 enum PerAppProxyMode { allExcept, onlySelected }
 
 class _SettingsScreenState extends State<SettingsScreen> {
@@ -51,7 +54,9 @@ class _SettingsScreenState extends State<SettingsScreen> {
   bool _offlineMode = false;
   final TextEditingController _excludedDomainsController = TextEditingController();
   final TextEditingController _excludedDomainSuffixesController = TextEditingController();
+  final TextEditingController _splitTunnelAppsController = TextEditingController();
   String? _deviceIp;
+  StreamSubscription<Map<dynamic, dynamic>>? _networkChangesSubscription;
 
   final AdService _adService = AdService();
   BannerAd? _banner;
@@ -73,6 +78,8 @@ class _SettingsScreenState extends State<SettingsScreen> {
     super.initState();
     _loadSettings();
     _getDeviceIp();
+    _networkChangesSubscription =
+        VpnService().networkChanges.listen((_) => _getDeviceIp());
     _mixedInboundPortController.addListener(() {
       _prefsService.saveMixedInboundPort(int.tryParse(_mixedInboundPortController.text) ?? 10808);
     });
@@ -85,6 +92,10 @@ class _SettingsScreenState extends State<SettingsScreen> {
     _excludedDomainSuffixesController.addListener(() {
       _prefsService.saveExcludedDomainSuffixes(_excludedDomainSuffixesController.text.split(',').map((e) => e.trim()).where((e) => e.isNotEmpty).toList());
     });
+    // On Linux the selected apps are executable names.
+    _splitTunnelAppsController.addListener(() {
+      _prefsService.saveSelectedApps(_splitTunnelAppsController.text.split(',').map((e) => e.trim()).where((e) => e.isNotEmpty).toList());
+    });
   }
 
   @override
@@ -125,6 +136,9 @@ class _SettingsScreenState extends State<SettingsScreen> {
         ? PerAppProxyMode.onlySelected
         : PerAppProxyMode.allExcept;
     _selectedApps = await _prefsService.getSelectedApps();
+    if (Platform.isLinux) {
+      _splitTunnelAppsController.text = _selectedApps.join(', ');
+    }
     _persistentNotification = await _prefsService.getPersistentNotification();
     _isMemoryLimitEnabled = !(await _prefsService.getDisableMemoryLimit());
     _isLoggingEnabled = await _prefsService.getEnableLogging();
@@ -145,7 +159,11 @@ class _SettingsScreenState extends State<SettingsScreen> {
     _serverUrlController.dispose();
     _excludedDomainsController.dispose();
     _excludedDomainSuffixesController.dispose();
+    _splitTunnelAppsController.dispose();
     _banner?.destroy();
+    _networkChangesSubscription?.cancel();
+    // Changes made here take effect on the running connection.
+    VpnService().reloadVpn();
     super.dispose();
   }
 
@@ -156,7 +174,7 @@ class _SettingsScreenState extends State<SettingsScreen> {
         ip = await VpnService.platform.invokeMethod('getWifiIpAddress');
       } else if (Platform.isIOS) {
         ip = await _iosChannel.invokeMethod('getIpAddress');
-      } else if (Platform.isWindows) {
+      } else if (Platform.isWindows || Platform.isLinux) {
         ip = await VpnService.platform.invokeMethod('getIpAddress');
       } else if (Platform.isMacOS) {
         ip = await VpnService.platform.invokeMethod('getIpAddress');
@@ -568,6 +586,11 @@ class _SettingsScreenState extends State<SettingsScreen> {
                           value: DnsProvider.adguard,
                           label: Text(localizations.adguard),
                         ),
+                        if (Platform.isLinux || Platform.isWindows)
+                          ButtonSegment<DnsProvider>(
+                            value: DnsProvider.auto,
+                            label: Text(localizations.dnsAuto),
+                          ),
                       ],
                       selected: <DnsProvider>{_selectedDnsProvider},
                       onSelectionChanged: (Set<DnsProvider> newSelection) {
@@ -575,6 +598,11 @@ class _SettingsScreenState extends State<SettingsScreen> {
                           _selectedDnsProvider = newSelection.first;
                         });
                         _prefsService.saveDnsProvider(newSelection.first);
+                        if (newSelection.first == DnsProvider.auto) {
+                          // Picks the winner before the next connect
+                          // rather than after it.
+                          VpnService().benchmarkDns(transports: const ['tcp']);
+                        }
                       },
                       style: SegmentedButton.styleFrom(
                         backgroundColor: lightGrayColor,
@@ -587,7 +615,7 @@ class _SettingsScreenState extends State<SettingsScreen> {
                 ),
               ),
               const Divider(color: lightGrayColor),
-              if (Platform.isAndroid)
+              if (Platform.isAndroid || Platform.isLinux)
               Padding(
                 padding: const EdgeInsets.symmetric(horizontal: 16.0),
                 child: Column(
@@ -650,6 +678,24 @@ class _SettingsScreenState extends State<SettingsScreen> {
                       ),
                     ),
                     const SizedBox(height: 10),
+                    if (Platform.isLinux)
+                    TextField(
+                      controller: _splitTunnelAppsController,
+                      style: const TextStyle(color: lightColor),
+                      decoration: InputDecoration(
+                        hintText: localizations.splitTunnelAppsDescription,
+                        hintStyle: TextStyle(color: lightColor.withOpacity(0.5)),
+                        enabledBorder: OutlineInputBorder(
+                          borderSide: const BorderSide(color: lightGrayColor),
+                          borderRadius: BorderRadius.circular(10),
+                        ),
+                        focusedBorder: OutlineInputBorder(
+                          borderSide: const BorderSide(color: primaryColor),
+                          borderRadius: BorderRadius.circular(10),
+                        ),
+                      ),
+                    ),
+                    if (Platform.isAndroid)
                     ListTile(
                       leading: const Icon(Icons.apps, color: lightColor),
                       title: Text(localizations.selectApps, style: const TextStyle(color: lightColor)),
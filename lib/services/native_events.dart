@@ -0,0 +1,81 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+
+/// Reads "com.hwl_vpn.app/events", the raw channel the Linux and Windows
+/// runners send their high-frequency events on without the standard codec.
+///
+/// A message is one or more frames back to back, each an 8-byte header
+/// (u8 kind, three reserved bytes, u32 payload size) and its payload, all
+/// little-endian; native/event_frame.h has the payload layouts. Frames of
+/// unknown kinds are skipped.
+class NativeEvents {
+  static const _channel =
+      BasicMessageChannel<ByteData?>('com.hwl_vpn.app/events', BinaryCodec());
+
+  static const _headerSize = 8;
+  static const _logBatch = 1;
+  static const _trafficSample = 2;
+  static const _probeResult = 3;
+  static const _connectionDiff = 4;
+  static const _trafficSampleSize = 40;
+
+  /// Whole sing-box lines, UTF-8.
+  static void Function(Uint8List lines)? onLogBatch;
+
+  /// One second of traffic: differences from the previous sample, or
+  /// absolute values when [key] is set.
+  static void Function(int seq, bool key, int up, int down, int connections)?
+      onTrafficSample;
+
+  /// A server round trip, with [rttUs] -1 when it did not answer.
+  static void Function(String id, int rttUs)? onProbeResult;
+
+  /// What changed in the open connections, [size] bytes of [data] from
+  /// [offset]; [ActiveConnections.apply] reads it.
+  static void Function(ByteData data, int offset, int size)? onConnectionDiff;
+
+  static void listen() {
+    _channel.setMessageHandler((message) async {
+      if (message != null) _decode(message);
+      return null;
+    });
+  }
+
+  static void _decode(ByteData data) {
+    var offset = 0;
+    while (offset + _headerSize <= data.lengthInBytes) {
+      final kind = data.getUint8(offset);
+      final size = data.getUint32(offset + 4, Endian.little);
+      final start = offset + _headerSize;
+      if (start + size > data.lengthInBytes) return;
+      switch (kind) {
+        case _logBatch:
+          onLogBatch?.call(
+              data.buffer.asUint8List(data.offsetInBytes + start, size));
+          break;
+        case _trafficSample when size >= _trafficSampleSize:
+          onTrafficSample?.call(
+            data.getUint64(start, Endian.little),
+            data.getUint8(start + 8) != 0,
+            data.getInt64(start + 16, Endian.little),
+            data.getInt64(start + 24, Endian.little),
+            data.getInt64(start + 32, Endian.little),
+          );
+          break;
+        case _probeResult when size >= 8:
+          onProbeResult?.call(
+            utf8.decode(data.buffer
+                .asUint8List(data.offsetInBytes + start + 8, size - 8)),
+            data.getInt64(start, Endian.little),
+          );
+          break;
+        case _connectionDiff:
+          onConnectionDiff?.call(data, start, size);
+          break;
+      }
+      offset = start + size;
+    }
+  }
+}
@@ -14,6 +14,10 @@ class PreferencesService {
   static const String _serverUrlKey = 'serverUrl';
   static const String _persistentNotificationKey = 'persistentNotification';
   static const String _disableMemoryLimitKey = 'disableMemoryLimit';
+  static const String _memoryHighMbKey = 'memoryHighMb';
+  static const String _memoryMaxMbKey = 'memoryMaxMb';
+  static const String _cpuMaxPercentKey = 'cpuMaxPercent';
+  static const String _disableAutoRestartKey = 'disableAutoRestart';
   static const String _isGuestKey = 'isGuest';
   static const String _useFreeServersKey = 'useFreeServers';
   static const String _hideSingboxConsoleKey = 'hideSingboxConsole';
@@ -132,6 +136,51 @@ class PreferencesService {
     return prefs.getBool(_disableMemoryLimitKey) ?? false; // Default to false (limit enabled)
   }
 
+  // Linux only: sing-box is throttled above the soft limit and killed at
+  // the hard one.
+  Future<void> saveMemoryHighMb(int megabytes) async {
+    final prefs = await SharedPreferences.getInstance();
+    await prefs.setInt(_memoryHighMbKey, megabytes);
+  }
+
+  Future<int> getMemoryHighMb() async {
+    final prefs = await SharedPreferences.getInstance();
+    return prefs.getInt(_memoryHighMbKey) ?? 512;
+  }
+
+  Future<void> saveMemoryMaxMb(int megabytes) async {
+    final prefs = await SharedPreferences.getInstance();
+    await prefs.setInt(_memoryMaxMbKey, megabytes);
+  }
+
+  Future<int> getMemoryMaxMb() async {
+    final prefs = await SharedPreferences.getInstance();
+    return prefs.getInt(_memoryMaxMbKey) ?? 1024;
+  }
+
+  // Percent of one CPU core sing-box may use on Linux; 0 for no limit.
+  Future<void> saveCpuMaxPercent(int percent) async {
+    final prefs = await SharedPreferences.getInstance();
+    await prefs.setInt(_cpuMaxPercentKey, percent);
+  }
+
+  Future<int> getCpuMaxPercent() async {
+    final prefs = await SharedPreferences.getInstance();
+    return prefs.getInt(_cpuMaxPercentKey) ?? 0;
+  }
+
+  // Desktop only: whether a crashed sing-box is left stopped instead of
+  // being restarted.
+  Future<void> saveDisableAutoRestart(bool isDisabled) async {
+    final prefs = await SharedPreferences.getInstance();
+    await prefs.setBool(_disableAutoRestartKey, isDisabled);
+  }
+
+  Future<bool> getDisableAutoRestart() async {
+    final prefs = await SharedPreferences.getInstance();
+    return prefs.getBool(_disableAutoRestartKey) ?? false;
+  }
+
   Future<void> savePersistentNotification(bool isEnabled) async {
     final prefs = await SharedPreferences.getInstance();
     await prefs.setBool(_persistentNotificationKey, isEnabled);
@@ -281,6 +330,10 @@ class PreferencesService {
     await prefs.remove(_serverUrlKey);
     await prefs.remove(_persistentNotificationKey);
     await prefs.remove(_disableMemoryLimitKey);
+    await prefs.remove(_memoryHighMbKey);
+    await prefs.remove(_memoryMaxMbKey);
+    await prefs.remove(_cpuMaxPercentKey);
+    await prefs.remove(_disableAutoRestartKey);
     await prefs.remove(_isGuestKey);
     await prefs.remove(_useFreeServersKey);
     await prefs.remove(_hideSingboxConsoleKey);
@@ -1,3 +1,7 @@
+import 'dart:convert';
+import 'dart:math';
+import 'dart:typed_data';
+
 import 'package:flutter_secure_storage/flutter_secure_storage.dart';
 import 'package:uuid/uuid.dart';
 
@@ -46,4 +50,23 @@ class SecureStorageService {
   Future<String?> getSavedCountriesWithServers() async {
     return await _storage.read(key: _countriesWithServersKey);
   }
+
+  Future<void> deleteCountriesWithServers() async {
+    await _storage.delete(key: _countriesWithServersKey);
+  }
+
+  static const _serverCacheKeyKey = 'server_cache_key';
+
+  /// The 32-byte key the desktop runners encrypt the links in their server
+  /// cache file with.
+  Future<Uint8List> getOrCreateServerCacheKey() async {
+    final saved = await _storage.read(key: _serverCacheKeyKey);
+    if (saved != null) {
+      return base64Decode(saved);
+    }
+    final random = Random.secure();
+    final key = Uint8List.fromList(List.generate(32, (_) => random.nextInt(256)));
+    await _storage.write(key: _serverCacheKeyKey, value: base64Encode(key));
+    return key;
+  }
 }
\ No newline at end of file
@@ -5,6 +5,7 @@ import 'package:flutter/material.dart';
 import 'package:flutter/services.dart';
 import 'package:flutter/foundation.dart';
 import 'package:hwl_vpn/api/api_service.dart';
+import 'package:hwl_vpn/models/log_record.dart';
 import 'package:hwl_vpn/models/server_info.dart';
 import 'package:shared_preferences/shared_preferences.dart';
 import 'dart:io';
@@ -14,6 +15,7 @@ import 'package:hwl_vpn/services/secure_storage_service.dart';
 import 'package:collection/collection.dart';
 import 'package:hwl_vpn/services/preferences_service.dart';
 import 'package:uuid/uuid.dart'; // Import Uuid package
+import 'package:hwl_vpn/services/native_events.dart';
 import 'package:hwl_vpn/services/vpn_service.dart';
 
 enum SubscriptionStatus { unknown, active, expired, guest }
@@ -41,6 +43,8 @@ class ServerService extends ChangeNotifier {
   Map<String, int?> _serverPings = {};
   Map<String, int?> get serverPings => _serverPings;
 
+  Uint8List? _serverCacheKey;
+
   SubscriptionStatus _subscriptionStatus = SubscriptionStatus.unknown;
   SubscriptionStatus get subscriptionStatus => _subscriptionStatus;
 
@@ -82,6 +86,28 @@ class ServerService extends ChangeNotifier {
   final StringBuffer _logBuffer = StringBuffer();
   String get logs => _logBuffer.toString();
 
+  // Only the newest logs are kept in memory. The desktop runners retain more
+  // in a bounded native store, and older pages are fetched with getLogs.
+  static const _maxLogChars = 256 * 1024;
+  static const _logPageLines = 500;
+  bool get _hasNativeLogStore => Platform.isWindows || Platform.isLinux;
+
+  // Native id of the first line in _logBuffer, null until synced.
+  int? _firstLogLine;
+  int _oldestLogLine = 0;
+  bool get canLoadEarlierLogs =>
+      _firstLogLine != null && _firstLogLine! > _oldestLogLine;
+  bool get canFilterLogs => _hasNativeLogStore;
+
+  // When set, the logs screen shows parsed records at this level and above,
+  // fetched from the native store instead of the text buffer.
+  LogLevel? _logLevelFilter;
+  LogLevel? get logLevelFilter => _logLevelFilter;
+  List<LogRecord> _filteredLogs = [];
+  List<LogRecord> get filteredLogs => _filteredLogs;
+  int _filteredLogsNext = 0;
+  bool _refreshingFilteredLogs = false;
+
   final Map<String, String> _countryCodes = {
     'USA': 'US', 'Canada': 'CA', 'Germany': 'DE', 'Japan': 'JP',
     'Australia': 'AU', 'UK': 'GB', 'France': 'FR', 'Netherlands': 'NL',
@@ -122,24 +148,200 @@ class ServerService extends ChangeNotifier {
 
   void initLogListener() {
     if (_logSubscription != null) return; // Already initialized
+    // The desktop runners send batches of whole sing-box lines from their
+    // log rings on the raw event channel while this stream is listened to.
+    NativeEvents.onLogBatch = (lines) {
+      _appendLog(utf8.decode(lines, allowMalformed: true));
+      _refreshFilteredLogs();
+      notifyListeners();
+    };
     _logSubscription = _logChannel.receiveBroadcastStream().listen(
       (log) {
         if (log == "__CLEAR_LOGS__\n") {
           _logBuffer.clear();
+          if (_hasNativeLogStore) {
+            _syncLogsFromNative();
+            _filteredLogs = [];
+            _filteredLogsNext = 0;
+            _refreshFilteredLogs();
+          }
         } else {
-          _logBuffer.write(log);
+          _appendLog(log);
         }
         notifyListeners();
       },
       onError: (error) {
+        // This line is not in the native store, so line ids are out of step
+        // until the next sync.
+        _firstLogLine = null;
         _logBuffer.writeln('❌ [Flutter] Log stream error: $error');
         notifyListeners();
       },
     );
   }
 
+  void _appendLog(String text) {
+    _logBuffer.write(text);
+    if (_logBuffer.length <= _maxLogChars) {
+      return;
+    }
+    final current = _logBuffer.toString();
+    var cut = current.length - _maxLogChars ~/ 2;
+    final newline = current.indexOf('\n', cut);
+    cut = newline == -1 ? cut : newline + 1;
+    if (_firstLogLine != null) {
+      _firstLogLine =
+          _firstLogLine! + '\n'.allMatches(current.substring(0, cut)).length;
+    }
+    _logBuffer
+      ..clear()
+      ..write(current.substring(cut));
+  }
+
+  Future<Map<Object?, Object?>?> _getLogPage(int offset, int limit) async {
+    try {
+      return await VpnService.platform
+          .invokeMethod('getLogs', {'offset': offset, 'limit': limit});
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get logs: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  // Replaces the buffer with the newest page of the native store.
+  Future<void> _syncLogsFromNative() async {
+    final page = await _getLogPage(-_logPageLines, _logPageLines);
+    if (page == null) return;
+    _logBuffer
+      ..clear()
+      ..write(utf8.decode(page['data'] as Uint8List, allowMalformed: true));
+    _firstLogLine = page['first'] as int;
+    _oldestLogLine = page['oldest'] as int;
+    notifyListeners();
+  }
+
+  Future<void> loadEarlierLogs() async {
+    final first = _firstLogLine;
+    if (first == null || first <= _oldestLogLine) return;
+    final offset = max(_oldestLogLine, first - _logPageLines);
+    final page = await _getLogPage(offset, first - offset);
+    if (page == null || _firstLogLine != first) return;
+
+    _oldestLogLine = page['oldest'] as int;
+    final pageFirst = page['first'] as int;
+    if (pageFirst >= first) {
+      // Evicted natively in the meantime.
+      notifyListeners();
+      return;
+    }
+    final current = _logBuffer.toString();
+    _logBuffer
+      ..clear()
+      ..write(utf8.decode(page['data'] as Uint8List, allowMalformed: true))
+      ..write(current);
+    _firstLogLine = pageFirst;
+    notifyListeners();
+  }
+
+  Future<LogRecordPage?> _getLogRecords(
+      int offset, int limit, int levelMask) async {
+    try {
+      final data = await VpnService.platform.invokeMethod<Uint8List>(
+          'getLogRecords',
+          {'offset': offset, 'limit': limit, 'levelMask': levelMask});
+      return data == null ? null : LogRecordPage.decode(data);
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get log records: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  /// Searches the native log store for lines containing [query], ignoring
+  /// ASCII case. Returns the newest [limit] matches, oldest first.
+  Future<List<LogSearchMatch>?> searchLogs(String query,
+      {int levelMask = 0xff, int limit = 1000}) async {
+    if (!_hasNativeLogStore) return null;
+    try {
+      final result = await VpnService.platform.invokeMethod<Map<Object?, Object?>>(
+          'searchLogs',
+          {'query': query, 'levelMask': levelMask, 'limit': limit});
+      if (result == null) return null;
+      final lines = (result['lines'] as List).cast<int>();
+      final texts = utf8
+          .decode(result['data'] as Uint8List, allowMalformed: true)
+          .split('\n');
+      return [
+        for (var i = 0; i < lines.length; i++)
+          LogSearchMatch(lines[i], texts[i]),
+      ];
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to search logs: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  /// Retained native lines per [LogLevel], indexed by [LogLevel.index].
+  Future<List<int>?> getLogLevelCounts() async {
+    if (!_hasNativeLogStore) return null;
+    try {
+      final stats = await VpnService.platform
+          .invokeMethod<Map<Object?, Object?>>('getLogStats');
+      return (stats?['levels'] as List?)?.cast<int>();
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get log stats: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  Future<void> setLogLevelFilter(LogLevel? level) async {
+    _logLevelFilter = level;
+    _filteredLogs = [];
+    _filteredLogsNext = 0;
+    notifyListeners();
+    await _refreshFilteredLogs();
+  }
+
+  // Fetches records newer than the last refresh; the first refresh after the
+  // filter changes fetches the latest page.
+  Future<void> _refreshFilteredLogs() async {
+    final level = _logLevelFilter;
+    if (level == null || _refreshingFilteredLogs) return;
+    _refreshingFilteredLogs = true;
+    try {
+      final fromLatest = _filteredLogs.isEmpty && _filteredLogsNext == 0;
+      final page = await _getLogRecords(
+          fromLatest ? -1 : _filteredLogsNext, _logPageLines, level.andAbove);
+      if (page == null || _logLevelFilter != level) return;
+      _filteredLogsNext = page.next;
+      if (page.records.isEmpty && !fromLatest) return;
+      final combined = [..._filteredLogs, ...page.records];
+      _filteredLogs = combined.length > _logPageLines
+          ? combined.sublist(combined.length - _logPageLines)
+          : combined;
+      notifyListeners();
+    } finally {
+      _refreshingFilteredLogs = false;
+    }
+  }
+
   void clearLogs() {
     _logBuffer.clear();
+    _firstLogLine = null;
+    _filteredLogs = [];
+    if (_hasNativeLogStore) {
+      VpnService.platform
+          .invokeMethod('clearLogs')
+          .then((_) => _syncLogsFromNative())
+          .catchError((_) {});
+    }
     notifyListeners();
   }
 
@@ -198,7 +400,11 @@ class ServerService extends ChangeNotifier {
       _selectedProtocol = Protocol.values.firstWhere((p) => p.name == protocolName, orElse: () => Protocol.vless);
     }
 
-    if (serverJson != null) {
+    final serverUuid = prefs.getString('selected_server_uuid');
+    if (serverUuid != null && _usesNativeServerCache) {
+      _selectedServer = await _lookupNativeServer(serverUuid);
+    }
+    if (_selectedServer == null && serverJson != null) {
       _selectedServer = Server.fromJson(jsonDecode(serverJson));
     }
 
@@ -249,8 +455,12 @@ class ServerService extends ChangeNotifier {
         _countries = countriesJson.map((c) => Country.fromJson(c, _countryCodes)).toList();
         
         // New: Save to secure storage after successful fetch
-        final jsonToCache = jsonEncode(_countries.map((c) => c.toJson()).toList());
-        await _secureStorage.saveCountriesWithServers(jsonToCache);
+        if (_usesNativeServerCache) {
+          await _saveNativeServerCache(_countries);
+        } else {
+          final jsonToCache = jsonEncode(_countries.map((c) => c.toJson()).toList());
+          await _secureStorage.saveCountriesWithServers(jsonToCache);
+        }
         
         final now = DateTime.now().millisecondsSinceEpoch;
         await _prefs.saveServerCacheTimestamp(now);
@@ -275,6 +485,9 @@ class ServerService extends ChangeNotifier {
           print("Cache is stale or missing. Clearing local server data.");
         }
         await _secureStorage.saveCountriesWithServers('[]'); // Clear storage
+        if (_usesNativeServerCache) {
+          await _clearNativeServerCache();
+        }
         await _prefs.clearServerCacheTimestamp(); // Clear timestamp
         _countries = [];
         _selectedCountry = null;
@@ -283,8 +496,16 @@ class ServerService extends ChangeNotifier {
         if (kDebugMode) {
           print("Loading from non-stale cache.");
         }
-        final cachedJsonString = await _secureStorage.getSavedCountriesWithServers();
-        if (cachedJsonString != null && cachedJsonString.isNotEmpty) {
+        final nativeCountries = _usesNativeServerCache ? await _loadNativeServerCache() : null;
+        final cachedJsonString =
+            nativeCountries == null ? await _secureStorage.getSavedCountriesWithServers() : null;
+        if (nativeCountries != null) {
+          _countries = nativeCountries;
+          if (kDebugMode) {
+            print("Loaded ${_countries.length} countries from the native cache.");
+          }
+          _syncSelection();
+        } else if (cachedJsonString != null && cachedJsonString.isNotEmpty) {
           try {
             final List<dynamic> decodedList = jsonDecode(cachedJsonString);
             _countries = decodedList.map((json) => Country.fromCacheJson(json)).toList();
@@ -311,6 +532,84 @@ class ServerService extends ChangeNotifier {
     }
   }
 
+  /// Linux and Windows keep the country list in the runner's mapped binary
+  /// cache rather than as one JSON string in secure storage, which has to
+  /// be read and decoded whole before anything can be shown.
+  bool get _usesNativeServerCache => Platform.isLinux || Platform.isWindows;
+
+  Future<Uint8List> _nativeServerCacheKey() async {
+    return _serverCacheKey ??= await _secureStorage.getOrCreateServerCacheKey();
+  }
+
+  Future<void> _saveNativeServerCache(List<Country> countries) async {
+    try {
+      final saved = await VpnService.platform.invokeMethod<bool>('saveServerCache', {
+        'key': await _nativeServerCacheKey(),
+        'countries': countries.map((c) => c.toJson()).toList(),
+      });
+      if (saved == true) {
+        // Drop the JSON copy older versions kept.
+        await _secureStorage.deleteCountriesWithServers();
+      }
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to save the server cache: ${e.message}");
+      }
+    }
+  }
+
+  /// The cached country list, or null when the runner has none that
+  /// [_nativeServerCacheKey] opens.
+  Future<List<Country>?> _loadNativeServerCache() async {
+    try {
+      final key = await _nativeServerCacheKey();
+      final summaries = await VpnService.platform.invokeListMethod<Map>('listCountries', {'key': key});
+      if (summaries == null) return null;
+      final countries = <Country>[];
+      for (final summary in summaries) {
+        final servers = await VpnService.platform
+            .invokeListMethod<Map>('listCountry', {'key': key, 'name': summary['name']});
+        countries.add(Country(
+          name: summary['name'] as String,
+          code: summary['code'] as String,
+          servers: (servers ?? const [])
+              .map((s) => Server.fromJson(Map<String, dynamic>.from(s)))
+              .toList(),
+        ));
+      }
+      return countries;
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to read the server cache: ${e.message}");
+      }
+      return null;
+    }
+  }
+
+  Future<Server?> _lookupNativeServer(String uuid) async {
+    try {
+      final result = await VpnService.platform.invokeMapMethod<String, dynamic>(
+          'lookupServer', {'key': await _nativeServerCacheKey(), 'uuid': uuid});
+      if (result == null) return null;
+      return Server.fromJson(Map<String, dynamic>.from(result['server'] as Map));
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to look up server $uuid: ${e.message}");
+      }
+      return null;
+    }
+  }
+
+  Future<void> _clearNativeServerCache() async {
+    try {
+      await VpnService.platform.invokeMethod('clearServerCache');
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to clear the server cache: ${e.message}");
+      }
+    }
+  }
+
   void _syncSelection() {
     if (_selectedCountry != null) {
       final currentSelectedCountry = _countries.firstWhereOrNull((c) => c.name == _selectedCountry!.name);
@@ -373,15 +672,21 @@ class ServerService extends ChangeNotifier {
 
   Future<void> pingServersForCountry(Country country) async {
     final List<Future> pingFutures = [];
+    final List<Map<String, dynamic>> probeTargets = [];
     bool needsUiUpdate = false;
 
     for (var server in country.servers) {
       if (!_serverPings.containsKey(server.uuid)) {
         _serverPings[server.uuid] = -1; // Mark as pinging
         needsUiUpdate = true;
-        pingFutures.add(_getIcmpPing(server.ip).then((ping) {
-          _serverPings[server.uuid] = ping;
-        }));
+        final target = _probeTarget(server);
+        if (target != null) {
+          probeTargets.add(target);
+        } else {
+          pingFutures.add(_getIcmpPing(server.ip).then((ping) {
+            _serverPings[server.uuid] = ping;
+          }));
+        }
       }
     }
 
@@ -389,12 +694,92 @@ class ServerService extends ChangeNotifier {
       notifyListeners(); // Show "pinging..." for new servers
     }
 
+    if (probeTargets.isNotEmpty) {
+      pingFutures.add(_probeServers(probeTargets));
+    }
     if (pingFutures.isNotEmpty) {
       await Future.wait(pingFutures);
       notifyListeners(); // Update UI with new ping values
     }
   }
 
+  /// The runner's probe for [server] on Linux and Windows: the round trip
+  /// to the proxy port itself, using the selected protocol's link when the
+  /// server has one. Null where ICMP is used instead, including Hysteria2
+  /// with obfuscation, which drops packets it cannot decode.
+  Map<String, dynamic>? _probeTarget(Server server) {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    final links = {
+      Protocol.vless: server.vlessLink,
+      Protocol.hysteria2: server.hysteria2Link,
+      Protocol.ssh: server.sshLink,
+    };
+    final protocol = links[_selectedProtocol] != null
+        ? _selectedProtocol
+        : links.keys.firstWhereOrNull((p) => links[p] != null);
+    if (protocol == null) return null;
+
+    final uri = Uri.tryParse(links[protocol]!.replaceAll(' ', ''));
+    if (uri == null || !uri.hasPort) return null;
+    final String proto;
+    switch (protocol) {
+      case Protocol.vless:
+        proto = 'tls';
+        break;
+      case Protocol.hysteria2:
+        if (uri.queryParameters.containsKey('obfs')) return null;
+        proto = 'quic';
+        break;
+      case Protocol.ssh:
+        proto = 'tcp';
+        break;
+    }
+    return {
+      'id': server.uuid,
+      'ip': server.ip ?? uri.host,
+      'port': uri.port,
+      'proto': proto,
+      'sni': uri.queryParameters['sni'] ?? '',
+    };
+  }
+
+  /// Probes [targets] in the runner. Results arrive one by one through
+  /// [handleProbeResult] before the call completes.
+  Future<void> _probeServers(List<Map<String, dynamic>> targets) async {
+    try {
+      await VpnService.platform.invokeMethod('probeServers', {
+        'targets': targets,
+        'timeoutMs': 2000,
+      });
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print('Failed to probe servers: ${e.message}');
+      }
+      for (final target in targets) {
+        _serverPings[target['id'] as String] = null;
+      }
+    }
+  }
+
+  /// Records one probe result frame from [NativeEvents], with [rttUs] -1
+  /// when the server did not answer.
+  void handleProbeResult(String id, int rttUs) {
+    _serverPings[id] = rttUs < 0 ? null : (rttUs / 1000).round();
+    notifyListeners();
+  }
+
+  /// Re-probes the selected country after onNetworkChanged reports a new
+  /// address or gateway, since the old round trips were measured over a
+  /// different path.
+  void handleNetworkChange(Map<dynamic, dynamic> event) {
+    final changes = (event['changes'] as List?)?.cast<String>() ?? const [];
+    if (!changes.contains('address') && !changes.contains('gateway')) return;
+    clearPings();
+    if (_selectedCountry != null) {
+      pingServersForCountry(_selectedCountry!);
+    }
+  }
+
   Future<int?> _getIcmpPing(String? host) async {
     if (host == null || host.isEmpty) {
       return null;
@@ -458,10 +843,15 @@ class ServerService extends ChangeNotifier {
     if (_selectedCountry != null) {
       await prefs.setString('selected_country_name', _selectedCountry!.name);
     }
-    if (_selectedServer != null) {
+    if (_selectedServer != null && _usesNativeServerCache) {
+      // The server itself is in the runner's cache.
+      await prefs.setString('selected_server_uuid', _selectedServer!.uuid);
+      await prefs.remove('selected_server_json');
+    } else if (_selectedServer != null) {
       await prefs.setString('selected_server_json', jsonEncode(_selectedServer!.toJson()));
     } else {
       await prefs.remove('selected_server_json');
+      await prefs.remove('selected_server_uuid');
     }
     await prefs.setString('selected_protocol', _selectedProtocol.name);
   }
@@ -1,7 +1,9 @@
+import 'dart:async';
 import 'dart:io';
 
 import 'package:flutter/foundation.dart';
 import 'package:flutter/services.dart';
+import 'package:hwl_vpn/models/active_connection.dart';
 import 'package:hwl_vpn/services/preferences_service.dart';
 import 'package:hwl_vpn/services/secure_storage_service.dart';
 import 'package:hwl_vpn/utils/config_generator.dart';
@@ -19,31 +21,270 @@ class VpnService {
   final _secureStorage = SecureStorageService();
   final _configGenerator = ConfigGenerator();
 
-  Future<String?> startVpn({String? customVlessLink}) async {
+  /// The server of the latest start or switch, which [reloadVpn] keeps;
+  /// null for the one in the settings.
+  String? _activeVlessLink;
+
+  /// Whether this session started the running connection. A tunnel the
+  /// Linux helper kept up while the app was closed runs a server the app
+  /// no longer knows.
+  bool _activeLinkKnown = false;
+  int? _clashApiPort;
+  final _networkChanges = StreamController<Map<dynamic, dynamic>>.broadcast();
+
+  /// onNetworkChanged events from the Linux and Windows runners:
+  /// {ip, gateway, interface, changes}, where changes lists "address",
+  /// "gateway" and "link".
+  Stream<Map<dynamic, dynamic>> get networkChanges => _networkChanges.stream;
+
+  void handleNetworkChanged(Map<dynamic, dynamic> event) {
+    _networkChanges.add(event);
+  }
+
+  final _speedTestProgress =
+      StreamController<Map<dynamic, dynamic>>.broadcast();
+
+  /// onSpeedTestProgress events from the Linux and Windows runners:
+  /// {phase, elapsedMs, bytes, bps} for the running phase.
+  Stream<Map<dynamic, dynamic>> get speedTestProgress =>
+      _speedTestProgress.stream;
+
+  void handleSpeedTestProgress(Map<dynamic, dynamic> event) {
+    _speedTestProgress.add(event);
+  }
+
+  final _trafficSamples = StreamController<Map<String, int>>.broadcast();
+  Map<String, int>? _lastTrafficSample;
+
+  /// One sample per second from the Linux and Windows runners while the
+  /// tunnel is up: {seq, up, down, connections}, with up and down in bytes
+  /// for that second.
+  Stream<Map<String, int>> get trafficSamples => _trafficSamples.stream;
+
+  /// Decodes a traffic sample frame from [NativeEvents]. Samples are sent
+  /// as differences from the previous one, with a key frame of absolute
+  /// values now and then; after a gap, samples are dropped until the next
+  /// key frame.
+  void handleTrafficSample(
+      int seq, bool key, int up, int down, int connections) {
+    final last = _lastTrafficSample;
+    Map<String, int> sample;
+    if (key) {
+      sample = {
+        'seq': seq,
+        'up': up,
+        'down': down,
+        'connections': connections,
+      };
+    } else if (last != null && last['seq'] == seq - 1) {
+      sample = {
+        'seq': seq,
+        'up': last['up']! + up,
+        'down': last['down']! + down,
+        'connections': last['connections']! + connections,
+      };
+    } else {
+      _lastTrafficSample = null;
+      return;
+    }
+    _lastTrafficSample = sample;
+    _trafficSamples.add(sample);
+  }
+
+  /// The samples recorded since the tunnel came up, oldest first, to fill
+  /// in before following [trafficSamples]: {seq, up, down, connections},
+  /// where seq numbers the newest and the rest are equally long lists.
+  Future<Map<String, dynamic>?> getTrafficHistory() async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    try {
+      return await platform.invokeMapMethod<String, dynamic>('getTrafficHistory');
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get traffic history: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  final _activeConnections = ActiveConnections();
+  bool _watchingConnections = false;
+  bool _connectionsResyncing = false;
+  final _connectionUpdates =
+      StreamController<Iterable<ActiveConnection>>.broadcast();
+
+  /// The open connections after each change while [watchConnections] is
+  /// on, at most once a second, with the bytes each moved since the last.
+  Stream<Iterable<ActiveConnection>> get connectionUpdates =>
+      _connectionUpdates.stream;
+
+  /// Starts or stops the Linux and Windows runners diffing sing-box's
+  /// connections. Starting sends every open connection first; after that
+  /// only what opened, closed or moved bytes. Returns false where it is
+  /// not available, as with the Linux tunnel helper.
+  Future<bool> watchConnections(bool enabled) async {
+    if (!Platform.isLinux && !Platform.isWindows) return false;
+    _watchingConnections = enabled;
+    _activeConnections.clear();
     try {
-      final settings = {
-        'vless_link': '', // This is now handled by the customVlessLink parameter
-        'dns_provider': (await _prefsService.getDnsProvider()).name,
-        'use_mixed_inbound': await _prefsService.getMixedInboundEnabled(),
-        'mixed_inbound_listen_address': '0.0.0.0',
-        'mixed_inbound_listen_port': await _prefsService.getMixedInboundPort(),
-        'per_app_proxy_enabled':
-            (await _prefsService.getPerAppProxyMode()) != 'disabled',
-        'per_app_proxy_mode': await _prefsService.getPerAppProxyMode(),
-        'per_app_proxy_list': await _prefsService.getSelectedApps(),
-        'excluded_domains': await _prefsService.getExcludedDomains(),
-        'excluded_domain_suffixes':
-            await _prefsService.getExcludedDomainSuffixes(),
-        'enable_logging': await _prefsService.getEnableLogging(),
+      await platform.invokeMethod('watchConnections', {'enabled': enabled});
+      return true;
+    } on PlatformException catch (e) {
+      _watchingConnections = false;
+      if (kDebugMode) {
+        print("Failed to watch connections: '${e.message}'.");
+      }
+      return false;
+    }
+  }
+
+  /// Applies a connection diff frame from [NativeEvents]. After a gap the
+  /// watch is restarted once, which brings a fresh full list; diffs until
+  /// then are dropped.
+  void handleConnectionDiff(ByteData data, int offset, int size) {
+    if (!_watchingConnections) return;
+    if (!_activeConnections.apply(data, offset, size)) {
+      if (!_connectionsResyncing) {
+        _connectionsResyncing = true;
+        watchConnections(true);
+      }
+      return;
+    }
+    _connectionsResyncing = false;
+    _connectionUpdates.add(_activeConnections.byHandle.values);
+  }
+
+  /// {helper, running} from the Linux runner: whether the tunnel helper
+  /// runs sing-box, and whether the tunnel is up, which it can already be
+  /// when the helper kept it running while the app was closed.
+  Future<Map<String, dynamic>?> getServiceState() async {
+    if (!Platform.isLinux) return null;
+    try {
+      return await platform.invokeMapMethod<String, dynamic>('getServiceState');
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get service state: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  final _restartEvents = StreamController<Map<dynamic, dynamic>>.broadcast();
+
+  /// Steps of the desktop runners' restart supervisor: {kind, exitStatus,
+  /// crashes, attempt, delayMs, recoveryMs, restarts, recoveries,
+  /// lastRecoveryMs, maxRecoveryMs, totalRecoveryMs}. kind is 'scheduled'
+  /// when sing-box exited and is restarted after delayMs, 'recovered' when
+  /// it is back recoveryMs after the crash, and 'gaveUp' after a crash
+  /// loop, followed by onVpnStopped.
+  Stream<Map<dynamic, dynamic>> get restartEvents => _restartEvents.stream;
+
+  void handleRestartEvent(Map<dynamic, dynamic> event) {
+    _restartEvents.add(event);
+  }
+
+  final _resourcePressure =
+      StreamController<Map<dynamic, dynamic>>.broadcast();
+
+  /// Pressure stalls of sing-box's cgroup, or the whole system when it
+  /// has none, from the Linux runner: {resource, systemWide, someAvg10,
+  /// fullAvg10, memoryCurrent}. Each resource reports at most every 30 s.
+  Stream<Map<dynamic, dynamic>> get resourcePressure =>
+      _resourcePressure.stream;
+
+  void handleResourcePressure(Map<dynamic, dynamic> event) {
+    _resourcePressure.add(event);
+  }
+
+  /// sing-box's CPU, memory and I/O use per second since the tunnel came
+  /// up, oldest first: {seq, cpuPercent, rssBytes, rssPeakBytes, swapBytes,
+  /// threads, readBytes, writeBytes, memoryCurrent, memoryAnon, memoryFile,
+  /// cpuThrottledUs, memoryHighEvents, memoryMaxEvents, oomKills}. Linux
+  /// only.
+  Future<Map<String, dynamic>?> getResourceHistory() async {
+    if (!Platform.isLinux) return null;
+    try {
+      return await platform
+          .invokeMapMethod<String, dynamic>('getResourceHistory');
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get resource history: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  /// The cgroup limits the Linux runner applies to sing-box on start.
+  Future<Map<String, dynamic>> _resourceLimitArguments() async {
+    if (!Platform.isLinux) return {};
+    return {
+      'memoryHighBytes': (await _prefsService.getMemoryHighMb()) << 20,
+      'memoryMaxBytes': (await _prefsService.getMemoryMaxMb()) << 20,
+      'cpuMaxPercent': await _prefsService.getCpuMaxPercent(),
+    };
+  }
+
+  /// A free loopback port for sing-box's Clash API, picked once per run so
+  /// that configs for the same server compare equal.
+  Future<int?> _getClashApiPort() async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    if (_clashApiPort == null) {
+      try {
+        final socket = await ServerSocket.bind(InternetAddress.loopbackIPv4, 0);
+        _clashApiPort = socket.port;
+        await socket.close();
+      } on SocketException {
+        return null;
+      }
+    }
+    return _clashApiPort;
+  }
+
+  Future<Map<String, dynamic>> _buildSettings() async {
+    return {
+      'vless_link': '', // This is now handled by the customVlessLink parameter
+      'dns_provider': (await _prefsService.getDnsProvider()).name,
+      'use_mixed_inbound': await _prefsService.getMixedInboundEnabled(),
+      'mixed_inbound_listen_address': '0.0.0.0',
+      'mixed_inbound_listen_port': await _prefsService.getMixedInboundPort(),
+      'per_app_proxy_enabled':
+          (await _prefsService.getPerAppProxyMode()) != 'disabled',
+      'per_app_proxy_mode': await _prefsService.getPerAppProxyMode(),
+      'per_app_proxy_list': await _prefsService.getSelectedApps(),
+      'excluded_domains': await _prefsService.getExcludedDomains(),
+      'excluded_domain_suffixes':
+          await _prefsService.getExcludedDomainSuffixes(),
+      'enable_logging': await _prefsService.getEnableLogging(),
+      'clash_api_port': await _getClashApiPort(),
+    };
+  }
+
+  /// The config part of a service call. The Linux and Windows runners get
+  /// the link and settings and build the config natively, caching it for
+  /// repeated connects; elsewhere the config is generated here.
+  Map<String, dynamic> _configArguments(
+      Map<String, dynamic> settings, String? customVlessLink) {
+    if (Platform.isLinux || Platform.isWindows) {
+      return {
+        'link': customVlessLink ?? settings['vless_link'],
+        'settings': settings,
       };
+    }
+    return {
+      'config': _configGenerator.generateSingboxConfigJson(settings,
+          customVlessLink: customVlessLink),
+    };
+  }
 
-      final config = _configGenerator.generateSingboxConfigJson(settings,
-          customVlessLink: customVlessLink);
+  Future<String?> startVpn({String? customVlessLink}) async {
+    _activeVlessLink = customVlessLink;
+    _activeLinkKnown = true;
+    try {
+      final settings = await _buildSettings();
       final disableMemoryLimit = await _prefsService.getDisableMemoryLimit();
 
       if (Platform.isIOS) {
         return await _iosChannel.invokeMethod('connect', {
-          'config': config,
+          ..._configArguments(settings, customVlessLink),
           'disableMemoryLimit': disableMemoryLimit,
         });
       } else {
@@ -54,16 +295,19 @@ class VpnService {
         final persistentNotification =
             await _prefsService.getPersistentNotification();
         final hideSingboxConsole = await _prefsService.getHideSingboxConsole();
+        final disableAutoRestart = await _prefsService.getDisableAutoRestart();
 
         await platform.invokeMethod('startService', {
-          'config': config,
+          ..._configArguments(settings, customVlessLink),
           'dns': dnsServer,
           'disableMemoryLimit': disableMemoryLimit,
+          ...await _resourceLimitArguments(),
           'perAppProxyEnabled': settings['per_app_proxy_enabled'],
           'perAppProxyMode': settings['per_app_proxy_mode'],
           'perAppProxyList': settings['per_app_proxy_list'],
           'persistentNotification': persistentNotification,
           'hideSingboxConsole': hideSingboxConsole,
+          'disableAutoRestart': disableAutoRestart,
         });
       }
     } on PlatformException catch (e) {
@@ -75,7 +319,183 @@ class VpnService {
     return null;
   }
 
+  /// Validates the config for [customVlessLink] and starts a standby
+  /// sing-box for it, so a following [switchVpn] to the same server is quick.
+  /// Only the Linux runner prepares; elsewhere this is a no-op.
+  Future<bool> prepareVpn({String? customVlessLink}) async {
+    if (!Platform.isLinux) {
+      return true;
+    }
+    try {
+      final result = await platform.invokeMapMethod<String, dynamic>(
+          'prepareService',
+          _configArguments(await _buildSettings(), customVlessLink));
+      return result?['valid'] == true;
+    } catch (e) {
+      if (kDebugMode) {
+        print("Failed to prepare service: '$e'.");
+      }
+      return false;
+    }
+  }
+
+  /// Moves a running connection to [customVlessLink]. On desktop a config
+  /// that fails validation keeps the current connection and returns the error.
+  Future<String?> switchVpn({String? customVlessLink}) async {
+    _activeVlessLink = customVlessLink;
+    _activeLinkKnown = true;
+    if (!Platform.isLinux && !Platform.isWindows) {
+      await stopVpn();
+      return startVpn(customVlessLink: customVlessLink);
+    }
+    try {
+      await platform.invokeMethod('switchService', {
+        ..._configArguments(await _buildSettings(), customVlessLink),
+        'hideSingboxConsole': await _prefsService.getHideSingboxConsole(),
+        'disableAutoRestart': await _prefsService.getDisableAutoRestart(),
+      });
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to switch service: '${e.message}'.");
+      }
+      return e.message;
+    }
+    return null;
+  }
+
+  /// Applies changed settings, such as the excluded domains, DNS provider
+  /// or logging, to the running connection on Linux and Windows without a
+  /// stop and start. Returns {path, sections, elapsedMs, error}, where path
+  /// is 'signal' when sing-box re-read its config in place, 'restart' when
+  /// the process was replaced (on Windows, or when the inbounds changed)
+  /// and 'unchanged' when nothing did; null when nothing is running or the
+  /// running server is unknown, in which case the settings apply on the
+  /// next connect.
+  Future<Map<String, dynamic>?> reloadVpn() async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    // Reloading with a guessed server would quietly move the tunnel to it.
+    if (!_activeLinkKnown) return null;
+    try {
+      return await platform.invokeMapMethod<String, dynamic>('reloadConfig',
+          _configArguments(await _buildSettings(), _activeVlessLink));
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to reload config: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  /// Phase timestamps of the latest start on Linux and Windows:
+  /// `startedAt` (ms since epoch) and `phases`, mapping spawned,
+  /// configWritten, tunUp, ready and firstDial to microseconds after
+  /// `startedAt`, or -1 when the phase was not reached.
+  Future<Map<String, dynamic>?> getStartTimeline() async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    try {
+      return await platform.invokeMapMethod<String, dynamic>('getStartTimeline');
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get start timeline: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  /// The runner's cold start on Linux and Windows, from main() to the first
+  /// frame and the first method call, as Chrome trace-event JSON for
+  /// chrome://tracing or Perfetto.
+  Future<String?> getStartupTrace() async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    try {
+      return await platform.invokeMethod<String>('getStartupTrace');
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Failed to get startup trace: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  /// Measures throughput through the running tunnel's mixed inbound on
+  /// Linux and Windows: downloads from [downloadUrl], uploads to
+  /// [uploadUrl] and echoes datagrams off [udpEchoHost]:[udpEchoPort], each
+  /// for [duration] over [streams] connections. Phases without a target are
+  /// skipped. Returns `phases`, a list of {phase, bytes, goodputBps,
+  /// rttSamples, rttP50Us, rttP99Us, jitterUs, datagramsSent, datagramsLost,
+  /// failedStreams}, and `error` when the test stopped early; null if it
+  /// could not run.
+  Future<Map<String, dynamic>?> runSpeedTest({
+    String? downloadUrl,
+    String? uploadUrl,
+    String? udpEchoHost,
+    int? udpEchoPort,
+    int streams = 4,
+    Duration duration = const Duration(seconds: 10),
+  }) async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    final settings = await _buildSettings();
+    if (settings['use_mixed_inbound'] != true) return null;
+    try {
+      return await platform.invokeMapMethod<String, dynamic>('runSpeedTest', {
+        'proxyHost': settings['mixed_inbound_listen_address'],
+        'proxyPort': settings['mixed_inbound_listen_port'],
+        if (downloadUrl != null) 'downloadUrl': downloadUrl,
+        if (uploadUrl != null) 'uploadUrl': uploadUrl,
+        if (udpEchoHost != null) 'udpEchoHost': udpEchoHost,
+        if (udpEchoPort != null) 'udpEchoPort': udpEchoPort,
+        'streams': streams,
+        'durationMs': duration.inMilliseconds,
+      });
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("Speed test failed: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
+  Future<void> cancelSpeedTest() async {
+    if (!Platform.isLinux && !Platform.isWindows) return;
+    await platform.invokeMethod('cancelSpeedTest');
+  }
+
+  /// Times [repeat] queries for each of [domains] at every known DNS
+  /// provider on Linux and Windows, over the [transports] given ("udp",
+  /// "tcp"): directly while disconnected, through the mixed inbound while
+  /// connected. Returns `results`, a list of {provider, address, transport,
+  /// route, queries, failures, failureRate, p50Us, p95Us, error}, the
+  /// `winner` the "auto" provider now uses on this `network`, and `error`
+  /// when the benchmark stopped early; null if it could not run.
+  Future<Map<String, dynamic>?> benchmarkDns({
+    List<String>? domains,
+    List<String> transports = const ['udp', 'tcp'],
+    int repeat = 2,
+    Duration timeout = const Duration(seconds: 2),
+  }) async {
+    if (!Platform.isLinux && !Platform.isWindows) return null;
+    final settings = await _buildSettings();
+    try {
+      return await platform.invokeMapMethod<String, dynamic>('benchmarkDns', {
+        if (settings['use_mixed_inbound'] == true) ...{
+          'proxyHost': settings['mixed_inbound_listen_address'],
+          'proxyPort': settings['mixed_inbound_listen_port'],
+        },
+        if (domains != null) 'domains': domains,
+        'transports': transports,
+        'repeat': repeat,
+        'timeoutMs': timeout.inMilliseconds,
+      });
+    } on PlatformException catch (e) {
+      if (kDebugMode) {
+        print("DNS benchmark failed: '${e.message}'.");
+      }
+      return null;
+    }
+  }
+
   Future<String?> stopVpn() async {
+    _activeLinkKnown = false;
     try {
       if (Platform.isIOS) {
         return await _iosChannel.invokeMethod('disconnect');
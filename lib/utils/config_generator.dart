@@ -100,6 +100,7 @@ class ConfigGenerator {
         {
           "type": "tcp",
           "tag": "dns-proxy",
+          // "auto" is only offered where the runner resolves it.
           "server": dnsProvider == 'cloudflare' ? '1.1.1.1' : (dnsProvider == 'adguard' ? '94.140.14.14' : '8.8.8.8'),
         }
       ],
@@ -117,7 +118,7 @@ class ConfigGenerator {
     final List<Map<String, dynamic>> rules = [
       {"action": "sniff"},
       //{"network": "icmp", "action": "reject", "method": "reply", "outbound": "direct"},
-      {"protocol": "dns", "action": "hijack-dns"}
+      {"inbound": ["tun-in"], "protocol": "dns", "action": "hijack-dns"}
     ];
 
     final List<String> excludedDomains = List<String>.from(settings['excluded_domains'] ?? []);
@@ -165,7 +166,7 @@ class ConfigGenerator {
       }
 
       routeConfig = {"rules": rules};
-    } else if (Platform.isWindows) {
+    } else if (Platform.isWindows || Platform.isLinux) {
       tunInbound = <String, dynamic>{
         "type": "tun",
         "tag": "tun-in",
@@ -213,6 +214,14 @@ class ConfigGenerator {
       "route": routeConfig,
     };
 
+    // The desktop runners poll this API to learn when sing-box is up.
+    final clashApiPort = settings['clash_api_port'] as int?;
+    if (clashApiPort != null) {
+      config["experimental"] = {
+        "clash_api": {"external_controller": "127.0.0.1:$clashApiPort"},
+      };
+    }
+
     return jsonEncode(config);
   }
 }
\ No newline at end of file
@@ -0,0 +1,605 @@
+#include "helper_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr size_t kReadSize = 64 * 1024;
+// Ports below this need CAP_NET_BIND_SERVICE, which the helper has for
+// sing-box's own use only.
+constexpr int64_t kFirstUnprivilegedPort = 1024;
+
+bool IsLoopbackAddress(const std::string& address) {
+  in_addr v4;
+  if (inet_pton(AF_INET, address.c_str(), &v4) == 1) {
+    return (ntohl(v4.s_addr) >> 24) == 127;
+  }
+  return address == "::1" || address == "[::1]" || address == "localhost";
+}
+
+uint64_t NewSession() {
+  uint64_t session = 0;
+  if (getrandom(&session, sizeof(session), 0) != static_cast<ssize_t>(sizeof(session))) {
+    session = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+              static_cast<uint64_t>(getpid());
+  }
+  return session;
+}
+
+// The owner and group of the file |listen_fd| is bound to. False for an
+// abstract or unnamed socket, which leaves only root authorized.
+bool SocketFileOwner(int listen_fd, uid_t* uid, gid_t* gid) {
+  sockaddr_un address = {};
+  socklen_t length = sizeof(address);
+  if (getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length) != 0 ||
+      address.sun_family != AF_UNIX || length <= offsetof(sockaddr_un, sun_path) || address.sun_path[0] == '\0') {
+    return false;
+  }
+  struct stat status;
+  if (stat(address.sun_path, &status) != 0) {
+    return false;
+  }
+  *uid = status.st_uid;
+  *gid = status.st_gid;
+  return true;
+}
+
+// Whether the peer on |fd| has |group| among its supplementary groups.
+bool PeerInGroup(int fd, gid_t group) {
+  std::vector<gid_t> groups(64);
+  for (;;) {
+    auto length = static_cast<socklen_t>(groups.size() * sizeof(gid_t));
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, groups.data(), &length) == 0) {
+      groups.resize(length / sizeof(gid_t));
+      break;
+    }
+    if (errno != ERANGE || length / sizeof(gid_t) <= groups.size()) {
+      return false;
+    }
+    groups.resize(length / sizeof(gid_t));
+  }
+  for (gid_t peer_group : groups) {
+    if (peer_group == group) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+bool CheckHelperSettings(ConfigSettings* settings, const std::string& secret, bool allow_remote_inbound,
+                         std::string* error) {
+  auto valid_port = [](int64_t port) { return port >= kFirstUnprivilegedPort && port <= 65535; };
+  if (settings->clash_api_port != 0 && !valid_port(settings->clash_api_port)) {
+    *error = "Invalid Clash API port " + std::to_string(settings->clash_api_port) + ".";
+    return false;
+  }
+  if (settings->clash_api_port != 0 && secret.empty()) {
+    *error = "The Clash API has no secret.";
+    return false;
+  }
+  settings->clash_api_secret = secret;
+  if (!settings->use_mixed_inbound) {
+    return true;
+  }
+  if (!valid_port(settings->mixed_inbound_listen_port)) {
+    *error = "Invalid mixed inbound port " + std::to_string(settings->mixed_inbound_listen_port) + ".";
+    return false;
+  }
+  if (settings->mixed_inbound_listen_port == settings->clash_api_port) {
+    *error = "The mixed inbound and the Clash API cannot share a port.";
+    return false;
+  }
+  if (!allow_remote_inbound && !IsLoopbackAddress(settings->mixed_inbound_listen_address)) {
+    settings->mixed_inbound_listen_address = "127.0.0.1";
+  }
+  return true;
+}
+
+HelperServer::HelperServer(std::filesystem::path rule_set_directory, bool allow_remote_inbound)
+    : session_(NewSession()),
+      rule_set_directory_(std::move(rule_set_directory)),
+      allow_remote_inbound_(allow_remote_inbound) {}
+
+HelperServer::~HelperServer() {
+  loop_.RunSync([this]() {
+    while (!clients_.empty()) {
+      Drop(clients_.begin()->first);
+    }
+    if (listen_fd_ >= 0) {
+      loop_.Unwatch(listen_fd_);
+      close(listen_fd_);
+      listen_fd_ = -1;
+    }
+    if (log_timer_fd_ >= 0) {
+      loop_.Unwatch(log_timer_fd_);
+      close(log_timer_fd_);
+      log_timer_fd_ = -1;
+    }
+  });
+}
+
+bool HelperServer::Start(int listen_fd, std::string* error) {
+  if (!loop_.Start()) {
+    close(listen_fd);
+    *error = "Cannot start the event loop.";
+    return false;
+  }
+  std::string cgroup_error;
+  if (child_cgroup_.Create(&cgroup_error)) {
+    process_manager_.SetCgroup(&child_cgroup_);
+  }
+  if (!cgroup_error.empty()) {
+    std::cerr << "[HelperServer] " << cgroup_error << std::endl;
+  }
+
+  process_manager_.SetLogRing(&log_ring_);
+  process_manager_.SetLogCallback([this](const std::string& log) {
+    loop_.Post([this, log]() { AppendLog(log); });
+  });
+  process_manager_.SetReadyCallback([this](bool confirmed) {
+    traffic_sampler_.Start(process_manager_.api_port(), process_manager_.api_secret(), [this](const TrafficDelta& delta) {
+      Broadcast([&delta](HelperFrameWriter* writer) { writer->AppendTrafficSample(delta); });
+    });
+    std::string timeline = process_manager_.timeline().Describe();
+    AppendLog(confirmed ? "⏱️ sing-box is ready: " + timeline + "\n"
+                        : "⚠️ No readiness signal from sing-box: " + timeline + "\n");
+    SetState(HelperTunnelState::kRunning, confirmed);
+  });
+  process_manager_.SetRestartCallback([this](const RestartEvent& event) {
+    if (event.kind == RestartEvent::Kind::kScheduled) {
+      traffic_sampler_.Stop();
+      SetState(HelperTunnelState::kStarting, false);
+    }
+    Broadcast([&event](HelperFrameWriter* writer) { writer->AppendRestart(event); });
+  });
+  process_manager_.SetExitCallback([this]() {
+    traffic_sampler_.Stop();
+    SetState(HelperTunnelState::kStopped, false);
+  });
+
+  loop_.RunSync([this, listen_fd]() {
+    listen_fd_ = listen_fd;
+    if (!SocketFileOwner(listen_fd_, &socket_uid_, &socket_gid_)) {
+      socket_uid_ = 0;
+      socket_gid_ = 0;
+    }
+    fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+    loop_.Watch(listen_fd_, EPOLLIN, [this](uint32_t) { OnAccept(); });
+    log_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (log_timer_fd_ >= 0) {
+      itimerspec interval = {};
+      interval.it_interval.tv_nsec = kLogFlushIntervalNs;
+      interval.it_value.tv_nsec = kLogFlushIntervalNs;
+      timerfd_settime(log_timer_fd_, 0, &interval, nullptr);
+      loop_.Watch(log_timer_fd_, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        if (read(log_timer_fd_, &expirations, sizeof(expirations)) > 0) {
+          FlushLogs();
+        }
+      });
+    }
+  });
+  return true;
+}
+
+void HelperServer::Run() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(tasks_mutex_);
+      tasks_cv_.wait(lock, [this]() { return quit_ || !tasks_.empty(); });
+      if (quit_) {
+        break;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+  process_manager_.Stop();
+  loop_.RunSync([this]() {
+    traffic_sampler_.Stop();
+    split_tunnel_.Clear();
+    FlushLogs();
+  });
+}
+
+void HelperServer::Quit() {
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  quit_ = true;
+  tasks_cv_.notify_one();
+}
+
+void HelperServer::RunOnMain(std::function<void()> task) {
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  tasks_.push_back(std::move(task));
+  tasks_cv_.notify_one();
+}
+
+void HelperServer::OnAccept() {
+  for (;;) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    ucred peer = {};
+    socklen_t length = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 || !Authorized(fd, peer)) {
+      std::cerr << "[HelperServer] Refusing a client of user " << peer.uid << "." << std::endl;
+      close(fd);
+      continue;
+    }
+    uint64_t id = next_client_++;
+    auto client = std::make_unique<Client>();
+    client->fd = fd;
+    client->uid = peer.uid;
+    clients_[id] = std::move(client);
+    loop_.Watch(fd, EPOLLIN | EPOLLRDHUP, [this, id](uint32_t events) { OnClientEvent(id, events); });
+  }
+}
+
+bool HelperServer::Authorized(int fd, const ucred& peer) const {
+  // The socket's mode already keeps others out; this also holds when it
+  // was created with a looser mode or passed in by another service.
+  if (peer.uid == 0 || peer.uid == socket_uid_) {
+    return true;
+  }
+  return socket_gid_ != 0 && (peer.gid == socket_gid_ || PeerInGroup(fd, socket_gid_));
+}
+
+void HelperServer::OnClientEvent(uint64_t id, uint32_t events) {
+  auto it = clients_.find(id);
+  if (it == clients_.end()) {
+    return;
+  }
+  Client* client = it->second.get();
+  if (events & EPOLLOUT) {
+    if (!Flush(client)) {
+      Drop(id);
+      return;
+    }
+  }
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    char buffer[kReadSize];
+    bool closed = false;
+    for (;;) {
+      ssize_t received = recv(client->fd, buffer, sizeof(buffer), 0);
+      if (received > 0) {
+        client->reader.Append(buffer, static_cast<size_t>(received));
+        continue;
+      }
+      closed = received == 0 || errno != EAGAIN;
+      break;
+    }
+    // A client may send a request and hang up; the request still counts.
+    HelperMessage kind;
+    std::string payload;
+    while (client->reader.Next(&kind, &payload)) {
+      Handle(id, kind, payload);
+      // Handling can drop the client, e.g. when a replay does not fit.
+      if (clients_.count(id) == 0) {
+        return;
+      }
+    }
+    if (client->reader.broken()) {
+      std::cerr << "[HelperServer] Dropping a client that sent an oversized frame." << std::endl;
+      closed = true;
+    }
+    if (closed) {
+      Drop(id);
+    }
+  }
+}
+
+void HelperServer::Handle(uint64_t id, HelperMessage kind, const std::string& payload) {
+  HelperPayloadReader reader(payload);
+  Client* client = clients_[id].get();
+  if (kind == HelperMessage::kHello) {
+    uint32_t version = reader.ReadU32();
+    uint64_t session = reader.ReadU64();
+    uint64_t cursor = reader.ReadU64();
+    if (!reader.ok() || version != kHelperProtocolVersion) {
+      std::cerr << "[HelperServer] Dropping a client speaking protocol " << version << "." << std::endl;
+      Drop(id);
+      return;
+    }
+    Welcome(id, session, cursor);
+    return;
+  }
+  if (!client->welcomed) {
+    Drop(id);
+    return;
+  }
+
+  uint32_t request = reader.ReadU32();
+  HelperTunnelRequest tunnel;
+  switch (kind) {
+    case HelperMessage::kStart:
+      if (ReadTunnelRequest(&reader, &tunnel)) {
+        RunOnMain([this, id, uid = client->uid, request, tunnel]() { StartTunnel(id, uid, request, tunnel); });
+        return;
+      }
+      break;
+    case HelperMessage::kStop:
+      if (reader.ok()) {
+        RunOnMain([this, id, request]() { StopTunnel(id, request); });
+        return;
+      }
+      break;
+    case HelperMessage::kReload:
+      if (ReadTunnelRequest(&reader, &tunnel)) {
+        RunOnMain([this, id, uid = client->uid, request, tunnel]() { ReloadTunnel(id, uid, request, tunnel); });
+        return;
+      }
+      break;
+    case HelperMessage::kPrepare:
+      if (ReadTunnelRequest(&reader, &tunnel)) {
+        RunOnMain([this, id, request, tunnel]() { PrepareTunnel(id, request, tunnel); });
+        return;
+      }
+      break;
+    default:
+      // Newer clients may send requests this helper does not know.
+      if (reader.ok()) {
+        HelperResult result;
+        result.text = "Unknown request.";
+        Reply(id, request, result);
+        return;
+      }
+      break;
+  }
+  HelperResult result;
+  result.text = "Malformed request.";
+  Reply(id, request, result);
+}
+
+void HelperServer::Welcome(uint64_t id, uint64_t session, uint64_t cursor) {
+  FlushLogs();
+  Client* client = clients_[id].get();
+  // A cursor from another helper start means nothing here.
+  if (session != session_) {
+    cursor = kHelperLogFromOldest;
+  }
+  client->writer.AppendWelcome(session_, state_, log_store_.next_line());
+  std::string lines;
+  uint64_t first = log_store_.Read(cursor, log_store_.next_line(),
+                                   [&lines](const char* data, size_t size) { lines.append(data, size); });
+  if (!lines.empty()) {
+    client->writer.AppendLog(first, lines);
+  }
+  if (state_ == HelperTunnelState::kRunning) {
+    client->writer.AppendState(state_, confirmed_);
+    // The client's traffic deltas need a key frame to start from.
+    uint64_t sequence = 0;
+    std::vector<TrafficSample> samples = traffic_sampler_.History(&sequence);
+    if (!samples.empty()) {
+      TrafficDelta key;
+      key.sequence = sequence;
+      key.key = true;
+      key.up = static_cast<int64_t>(samples.back().up);
+      key.down = static_cast<int64_t>(samples.back().down);
+      key.connections = samples.back().connections;
+      client->writer.AppendTrafficSample(key);
+    }
+  }
+  client->welcomed = true;
+  if (!Flush(client)) {
+    Drop(id);
+  }
+}
+
+bool HelperServer::Flush(Client* client) {
+  size_t sent = 0;
+  const std::string& buffer = client->writer.buffer();
+  while (sent < buffer.size()) {
+    ssize_t written = send(client->fd, buffer.data() + sent, buffer.size() - sent, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EAGAIN) {
+        break;
+      }
+      return false;
+    }
+    sent += static_cast<size_t>(written);
+  }
+  client->writer.Consume(sent);
+  if (client->writer.size() > kMaxPending) {
+    std::cerr << "[HelperServer] Dropping a client that stopped reading." << std::endl;
+    return false;
+  }
+  loop_.Rearm(client->fd, EPOLLIN | EPOLLRDHUP | (client->writer.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+  return true;
+}
+
+void HelperServer::Drop(uint64_t id) {
+  auto it = clients_.find(id);
+  if (it == clients_.end()) {
+    return;
+  }
+  loop_.Unwatch(it->second->fd);
+  close(it->second->fd);
+  clients_.erase(it);
+}
+
+void HelperServer::Broadcast(const std::function<void(HelperFrameWriter* writer)>& append) {
+  std::vector<uint64_t> dropped;
+  for (auto& entry : clients_) {
+    Client* client = entry.second.get();
+    if (!client->welcomed) {
+      continue;
+    }
+    append(&client->writer);
+    if (!Flush(client)) {
+      dropped.push_back(entry.first);
+    }
+  }
+  for (uint64_t id : dropped) {
+    Drop(id);
+  }
+}
+
+void HelperServer::Reply(uint64_t id, uint32_t request, const HelperResult& result) {
+  loop_.Post([this, id, request, result]() {
+    auto it = clients_.find(id);
+    if (it == clients_.end()) {
+      return;
+    }
+    it->second->writer.AppendResult(request, result);
+    if (!Flush(it->second.get())) {
+      Drop(id);
+    }
+  });
+}
+
+void HelperServer::SetState(HelperTunnelState state, bool confirmed) {
+  state_ = state;
+  confirmed_ = confirmed;
+  // Lines logged before the change go out before it.
+  FlushLogs();
+  Broadcast([state, confirmed](HelperFrameWriter* writer) { writer->AppendState(state, confirmed); });
+}
+
+void HelperServer::FlushLogs() {
+  std::string lines;
+  log_ring_.Drain([&lines](const char* data, size_t size) { lines.append(data, size); });
+  if (lines.empty()) {
+    return;
+  }
+  uint64_t first = log_store_.next_line();
+  log_store_.Append(lines.data(), lines.size());
+  Broadcast([first, &lines](HelperFrameWriter* writer) { writer->AppendLog(first, lines); });
+}
+
+void HelperServer::AppendLog(const std::string& line) {
+  FlushLogs();
+  uint64_t first = log_store_.next_line();
+  std::string text = line.empty() || line.back() != '\n' ? line + "\n" : line;
+  log_store_.AppendLine(line);
+  Broadcast([first, &text](HelperFrameWriter* writer) { writer->AppendLog(first, text); });
+}
+
+void HelperServer::ApplySettings(const HelperTunnelRequest& tunnel, uid_t uid) {
+  CgroupLimits limits;
+  limits.memory_high = tunnel.memory_high;
+  limits.memory_max = tunnel.memory_max;
+  limits.cpu_max_percent = tunnel.cpu_max_percent;
+  std::string error;
+  if (!child_cgroup_.Apply(limits, &error)) {
+    loop_.Post([this, error]() { AppendLog("⚠️ " + error + "\n"); });
+  }
+  process_manager_.SetAutoRestart(tunnel.auto_restart);
+
+  SplitTunnelSettings split;
+  split.apps = tunnel.split_apps;
+  split.mode = ParseSplitTunnelMode(!tunnel.split_mode.empty(), tunnel.split_mode, split.apps.size());
+  // Root may move anything, so the client only gets to split its own.
+  split.owner = uid;
+  loop_.RunSync([this, &split]() {
+    std::string split_error;
+    if (!split_tunnel_.Apply(split, &split_error)) {
+      AppendLog("⚠️ Split tunneling is off: " + split_error + "\n");
+    }
+  });
+}
+
+bool HelperServer::BuildConfig(const HelperTunnelRequest& tunnel, std::string* config, std::string* error) {
+  ConfigSettings settings = tunnel.settings;
+  if (!CheckHelperSettings(&settings, clash_api_secret_, allow_remote_inbound_, error)) {
+    return false;
+  }
+  settings.rule_set_directory = rule_set_directory_;
+  return config_builder_.Build(settings, tunnel.link, config, error);
+}
+
+void HelperServer::StartTunnel(uint64_t id, uid_t uid, uint32_t request, const HelperTunnelRequest& tunnel) {
+  HelperResult result;
+  std::string config;
+  if (!BuildConfig(tunnel, &config, &result.text)) {
+    Reply(id, request, result);
+    return;
+  }
+  ApplySettings(tunnel, uid);
+  result.ok = process_manager_.Start(config);
+  if (result.ok) {
+    loop_.Post([this]() {
+      if (state_ == HelperTunnelState::kStopped) {
+        SetState(HelperTunnelState::kStarting, false);
+      }
+    });
+  } else {
+    result.text = "Failed to start sing-box process.";
+  }
+  Reply(id, request, result);
+}
+
+void HelperServer::StopTunnel(uint64_t id, uint32_t request) {
+  process_manager_.Stop();
+  loop_.RunSync([this]() {
+    traffic_sampler_.Stop();
+    split_tunnel_.Clear();
+    SetState(HelperTunnelState::kStopped, false);
+  });
+  HelperResult result;
+  result.ok = true;
+  Reply(id, request, result);
+}
+
+void HelperServer::ReloadTunnel(uint64_t id, uid_t uid, uint32_t request, const HelperTunnelRequest& tunnel) {
+  std::string config;
+  std::string error;
+  if (!BuildConfig(tunnel, &config, &error)) {
+    HelperResult result;
+    result.text = error;
+    Reply(id, request, result);
+    return;
+  }
+  bool running = process_manager_.Reload(config, [this, id, request](const ReloadResult& reload) {
+    HelperResult result;
+    result.ok = reload.error.empty();
+    result.path = reload.path;
+    result.elapsed_ms = reload.elapsed_ms;
+    result.sections = reload.sections;
+    result.text = reload.error;
+    Reply(id, request, result);
+  });
+  if (!running) {
+    HelperResult result;
+    result.text = kHelperNotRunning;
+    Reply(id, request, result);
+    return;
+  }
+  ApplySettings(tunnel, uid);
+}
+
+void HelperServer::PrepareTunnel(uint64_t id, uint32_t request, const HelperTunnelRequest& tunnel) {
+  std::string config;
+  std::string error;
+  if (!BuildConfig(tunnel, &config, &error)) {
+    HelperResult result;
+    result.text = error;
+    Reply(id, request, result);
+    return;
+  }
+  process_manager_.Prepare(config, [this, id, request](bool valid, const std::string& output) {
+    HelperResult result;
+    result.ok = valid;
+    result.text = output;
+    Reply(id, request, result);
+  });
+}
@@ -0,0 +1,159 @@
+#ifndef HELPER_HELPER_SERVER_H_
+#define HELPER_HELPER_SERVER_H_
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "child_cgroup.h"
+#include "clash_api.h"
+#include "config_builder.h"
+#include "event_loop.h"
+#include "helper_protocol.h"
+#include "log_ring.h"
+#include "log_store.h"
+#include "process_manager.h"
+#include "split_tunnel.h"
+#include "traffic_sampler.h"
+
+// Checks the settings a client sent before a config is built from them, as
+// the helper runs that config as root. The Clash API and mixed inbound
+// ports must be unprivileged and distinct, the Clash API needs |secret|,
+// and the mixed inbound is moved to 127.0.0.1 unless
+// |allow_remote_inbound|; the app asks for 0.0.0.0, which would open the
+// proxy to the whole network. Returns false with |error| set for settings
+// it refuses.
+bool CheckHelperSettings(ConfigSettings* settings, const std::string& secret, bool allow_remote_inbound,
+                         std::string* error);
+
+// The privileged half of the Linux app: owns sing-box, its cgroup and the
+// split tunnel, and serves them to UI processes over the helper protocol
+// (native/helper_protocol.h) on a Unix socket.
+//
+// Clients are handled on the EventLoop. Requests that block, starting and
+// stopping sing-box, run on the thread in Run(), the way the runner's GTK
+// thread drives its ProcessManager. The log lives in a LogStore whose line
+// ids are the cursors clients resume from, so a UI that reconnects gets
+// exactly the lines it missed. A client whose output backs up past
+// kMaxPending is dropped and can resume the same way.
+//
+// The tunnel belongs to the helper, not to a client: it keeps running with
+// no UI connected and stops with the helper.
+//
+// Only root and the owner and group of the socket file may connect. They
+// send a share link and settings rather than a config, and the helper
+// builds the config itself, so a client cannot make the root sing-box
+// write files of its choosing.
+class HelperServer {
+ public:
+  // Excluded domains are compiled into |rule_set_directory|, or kept
+  // inline when it is empty. The mixed inbound listens where clients ask
+  // only with |allow_remote_inbound|; see CheckHelperSettings().
+  explicit HelperServer(std::filesystem::path rule_set_directory, bool allow_remote_inbound = false);
+  ~HelperServer();
+
+  HelperServer(const HelperServer&) = delete;
+  HelperServer& operator=(const HelperServer&) = delete;
+
+  // Serves |listen_fd|, a listening AF_UNIX stream socket the server takes
+  // over. Returns false with |error| set if the event loop cannot run.
+  bool Start(int listen_fd, std::string* error);
+  // Carries out requests until Quit(), then stops sing-box.
+  void Run();
+  // Safe from any thread.
+  void Quit();
+
+ private:
+  static constexpr size_t kMaxPending = 8 * 1024 * 1024;
+  static constexpr long kLogFlushIntervalNs = 100 * 1000 * 1000;
+
+  struct Client {
+    int fd = -1;
+    // The peer's user, from SO_PEERCRED.
+    uid_t uid = static_cast<uid_t>(-1);
+    HelperFrameReader reader;
+    HelperFrameWriter writer;
+    // kHello has been answered; events go out from then on.
+    bool welcomed = false;
+  };
+
+  // Queues |task| for the Run() thread.
+  void RunOnMain(std::function<void()> task);
+
+  // Loop thread only.
+  void OnAccept();
+  // Whether |peer|, connected on |fd|, may drive the tunnel.
+  bool Authorized(int fd, const ucred& peer) const;
+  void OnClientEvent(uint64_t id, uint32_t events);
+  void Handle(uint64_t id, HelperMessage kind, const std::string& payload);
+  void Welcome(uint64_t id, uint64_t session, uint64_t cursor);
+  // Sends what |client| has queued. False once it has to be dropped.
+  bool Flush(Client* client);
+  void Drop(uint64_t id);
+  // Appends to every welcomed client and flushes them.
+  void Broadcast(const std::function<void(HelperFrameWriter* writer)>& append);
+  void Reply(uint64_t id, uint32_t request, const HelperResult& result);
+  void SetState(HelperTunnelState state, bool confirmed);
+  // Moves the ring into the store and out to the clients.
+  void FlushLogs();
+  void AppendLog(const std::string& line);
+
+  // Run() thread only.
+  // Builds the config for |tunnel|; false with |error| set for a bad link
+  // or settings CheckHelperSettings() refuses.
+  bool BuildConfig(const HelperTunnelRequest& tunnel, std::string* config, std::string* error);
+  void StartTunnel(uint64_t id, uid_t uid, uint32_t request, const HelperTunnelRequest& tunnel);
+  void StopTunnel(uint64_t id, uint32_t request);
+  void ReloadTunnel(uint64_t id, uid_t uid, uint32_t request, const HelperTunnelRequest& tunnel);
+  void PrepareTunnel(uint64_t id, uint32_t request, const HelperTunnelRequest& tunnel);
+  // Applies the limits and split tunnel of |tunnel|, logging what failed.
+  // Only processes of |uid|, the requesting client's user, are split.
+  void ApplySettings(const HelperTunnelRequest& tunnel, uid_t uid);
+
+  // Declared so that everything is destroyed before what it points to.
+  EventLoop loop_;
+  LogRing log_ring_;
+  ChildCgroup child_cgroup_;
+  ProcessManager process_manager_{&loop_};
+  SplitTunnel split_tunnel_{&loop_};
+  TrafficSampler traffic_sampler_{&loop_};
+  // Random per helper start, so a cursor from an earlier one is not taken
+  // for a line id of this one.
+  uint64_t session_ = 0;
+
+  // Run() thread only.
+  ConfigBuilder config_builder_;
+  std::filesystem::path rule_set_directory_;
+  bool allow_remote_inbound_;
+  // Required by the Clash API of every config built; random per helper
+  // start, and never sent to clients.
+  std::string clash_api_secret_ = RandomClashApiSecret();
+
+  // Loop thread only.
+  LogStore log_store_;
+  std::map<uint64_t, std::unique_ptr<Client>> clients_;
+  uint64_t next_client_ = 1;
+  int listen_fd_ = -1;
+  // The socket file's owner and group, read in Start().
+  uid_t socket_uid_ = 0;
+  gid_t socket_gid_ = 0;
+  int log_timer_fd_ = -1;
+  HelperTunnelState state_ = HelperTunnelState::kStopped;
+  bool confirmed_ = false;
+
+  std::mutex tasks_mutex_;
+  std::condition_variable tasks_cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool quit_ = false;
+};
+
+#endif  // HELPER_HELPER_SERVER_H_
@@ -0,0 +1,136 @@
+// The privileged tunnel helper. Started by systemd from hwl-vpn-helper.socket,
+// or by hand with --socket PATH, and stopped with SIGTERM. With
+// --allow-remote-inbound the mixed inbound listens where the app asks
+// rather than on loopback only.
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "helper_protocol.h"
+#include "helper_server.h"
+
+namespace {
+
+// The first descriptor systemd passes with socket activation.
+constexpr int kListenFdsStart = 3;
+
+// The socket systemd passed, or -1 when not socket-activated.
+int ActivatedSocket() {
+  const char* pid = getenv("LISTEN_PID");
+  const char* fds = getenv("LISTEN_FDS");
+  if (pid == nullptr || fds == nullptr || atol(pid) != getpid() || atoi(fds) < 1) {
+    return -1;
+  }
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+  return kListenFdsStart;
+}
+
+int ListenOn(const std::string& path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << path << std::endl;
+    return -1;
+  }
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(path.c_str());
+  // Only the owner and its group may drive the tunnel, as with the
+  // systemd socket.
+  mode_t old_mask = umask(0117);
+  bool listening = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(fd, 8) == 0;
+  umask(old_mask);
+  if (!listening) {
+    std::cerr << "Cannot listen on " << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Where compiled rule-sets go: the unit's StateDirectory=, which only root
+// can write. Started by hand there is none, and the domains stay inline.
+std::filesystem::path RuleSetDirectory() {
+  const char* state = getenv("STATE_DIRECTORY");
+  if (state == nullptr || state[0] == '\0') {
+    return std::filesystem::path();
+  }
+  // Several directories are separated by colons; the unit names one.
+  std::string first(state, strcspn(state, ":"));
+  return std::filesystem::path(first) / "rule-sets";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string socket_path;
+  bool allow_remote_inbound = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (strcmp(argv[i], "--allow-remote-inbound") == 0) {
+      allow_remote_inbound = true;
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--socket PATH] [--allow-remote-inbound]" << std::endl;
+      return 2;
+    }
+  }
+
+  // Blocked before any thread starts, so only the signalfd sees them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  int listen_fd = socket_path.empty() ? ActivatedSocket() : ListenOn(socket_path);
+  if (listen_fd < 0) {
+    if (socket_path.empty()) {
+      std::cerr << "Not socket-activated; pass --socket PATH." << std::endl;
+    }
+    return 1;
+  }
+
+  HelperServer server(RuleSetDirectory(), allow_remote_inbound);
+  std::string error;
+  if (!server.Start(listen_fd, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  std::thread signal_waiter([&server, signals]() {
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    signalfd_siginfo info;
+    while (signal_fd >= 0 && read(signal_fd, &info, sizeof(info)) < 0 && errno == EINTR) {
+    }
+    if (signal_fd >= 0) {
+      close(signal_fd);
+    }
+    server.Quit();
+  });
+  server.Run();
+  signal_waiter.join();
+  if (!socket_path.empty()) {
+    unlink(socket_path.c_str());
+  }
+  return 0;
+}
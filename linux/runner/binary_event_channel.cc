@@ -0,0 +1,29 @@
+#include "binary_event_channel.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+constexpr char kChannelName[] = "com.hwl_vpn.app/events";
+
+}  // namespace
+
+BinaryEventChannel::BinaryEventChannel(FlBinaryMessenger* messenger)
+    : messenger_(FL_BINARY_MESSENGER(g_object_ref(messenger))) {}
+
+BinaryEventChannel::~BinaryEventChannel() {
+  g_object_unref(messenger_);
+}
+
+void BinaryEventChannel::Flush() {
+  if (frames_.empty()) {
+    return;
+  }
+  // The GBytes takes the vector over and frees it once the engine is done.
+  auto* message = new std::vector<uint8_t>(frames_.Take());
+  g_autoptr(GBytes) bytes = g_bytes_new_with_free_func(
+      message->data(), message->size(), [](gpointer data) { delete static_cast<std::vector<uint8_t>*>(data); },
+      message);
+  fl_binary_messenger_send_on_channel(messenger_, kChannelName, bytes, nullptr, nullptr, nullptr);
+}
@@ -0,0 +1,32 @@
+#ifndef RUNNER_BINARY_EVENT_CHANNEL_H_
+#define RUNNER_BINARY_EVENT_CHANNEL_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include "event_frame.h"
+
+// Sends high-frequency events to Dart on the raw "com.hwl_vpn.app/events"
+// channel in the framing of event_frame.h, with no codec in between. Must
+// be used on the platform thread.
+//
+// Producers append frames to frames(); everything appended since the last
+// Flush() goes out as one message, which hands the buffer to the engine
+// without copying it.
+class BinaryEventChannel {
+ public:
+  explicit BinaryEventChannel(FlBinaryMessenger* messenger);
+  ~BinaryEventChannel();
+
+  BinaryEventChannel(const BinaryEventChannel&) = delete;
+  BinaryEventChannel& operator=(const BinaryEventChannel&) = delete;
+
+  EventFrameWriter* frames() { return &frames_; }
+  // Sends the pending frames, if any.
+  void Flush();
+
+ private:
+  FlBinaryMessenger* messenger_;
+  EventFrameWriter frames_;
+};
+
+#endif  // RUNNER_BINARY_EVENT_CHANNEL_H_
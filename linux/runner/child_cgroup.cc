@@ -0,0 +1,141 @@
+#include "child_cgroup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+constexpr char kCgroupRoot[] = "/sys/fs/cgroup";
+// cpu.max period in microseconds.
+constexpr int64_t kCpuPeriodUs = 100000;
+
+bool WriteFile(const std::string& path, const std::string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return written;
+}
+
+bool MakeDirectory(const std::string& path) {
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// The runner's cgroup relative to the root, from the "0::" line of
+// /proc/self/cgroup.
+std::string OwnCgroup() {
+  std::ifstream file("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.rfind("0::", 0) == 0) {
+      return line.substr(3);
+    }
+  }
+  return "";
+}
+
+}  // namespace
+
+ChildCgroup::~ChildCgroup() {
+  if (!path_.empty()) {
+    rmdir(path_.c_str());
+  }
+}
+
+bool ChildCgroup::Create(std::string* error) {
+  struct statfs root;
+  if (statfs(kCgroupRoot, &root) != 0 || root.f_type != CGROUP2_SUPER_MAGIC) {
+    *error = "cgroup v2 is not mounted at /sys/fs/cgroup.";
+    return false;
+  }
+  std::string own = OwnCgroup();
+  if (own.empty()) {
+    *error = "The runner's cgroup is unknown.";
+    return false;
+  }
+  std::string base = kCgroupRoot + (own == "/" ? "" : own);
+  // A runner restarted inside the same scope is already in its leaf.
+  const std::string kLeaf = "/runner";
+  if (base.size() > kLeaf.size() && base.compare(base.size() - kLeaf.size(), kLeaf.size(), kLeaf) == 0) {
+    base.resize(base.size() - kLeaf.size());
+  }
+
+  std::string child = base + "/sing-box";
+  if (!MakeDirectory(child)) {
+    *error = "Cannot create " + child + ": " + strerror(errno) + ".";
+    return false;
+  }
+  path_ = child;
+
+  std::string leaf = base + kLeaf;
+  if (MakeDirectory(leaf) && WriteFile(leaf + "/cgroup.procs", std::to_string(getpid()))) {
+    std::ifstream controllers_file(base + "/cgroup.controllers");
+    std::string controller;
+    while (controllers_file >> controller) {
+      // Written one by one so a controller the parent keeps does not stop
+      // the other.
+      if (controller == "memory") {
+        has_memory_ = WriteFile(base + "/cgroup.subtree_control", "+memory");
+      } else if (controller == "cpu") {
+        has_cpu_ = WriteFile(base + "/cgroup.subtree_control", "+cpu");
+      }
+    }
+  }
+  if (!has_memory_ || !has_cpu_) {
+    *error = "The " + std::string(!has_memory_ && !has_cpu_ ? "memory and cpu controllers are"
+                                  : !has_memory_            ? "memory controller is"
+                                                            : "cpu controller is") +
+             " not delegated to " + base + "; sing-box runs without those limits.";
+  }
+  return true;
+}
+
+bool ChildCgroup::Apply(const CgroupLimits& limits, std::string* error) {
+  if (path_.empty()) {
+    return true;
+  }
+  std::ostringstream failed;
+  auto bytes = [](int64_t value) { return value > 0 ? std::to_string(value) : std::string("max"); };
+  if (has_memory_) {
+    // memory.max first when lowering, so memory.high never ends up above it.
+    bool max_written = WriteFile(path_ + "/memory.max", bytes(limits.memory_max));
+    if (!WriteFile(path_ + "/memory.high", bytes(limits.memory_high))) {
+      failed << " memory.high";
+    }
+    if (!max_written && !WriteFile(path_ + "/memory.max", bytes(limits.memory_max))) {
+      failed << " memory.max";
+    }
+  } else if (limits.memory_high > 0 || limits.memory_max > 0) {
+    failed << " memory";
+  }
+  if (has_cpu_) {
+    std::string quota = limits.cpu_max_percent > 0 ? std::to_string(limits.cpu_max_percent * kCpuPeriodUs / 100)
+                                                   : std::string("max");
+    if (!WriteFile(path_ + "/cpu.max", quota + " " + std::to_string(kCpuPeriodUs))) {
+      failed << " cpu.max";
+    }
+  } else if (limits.cpu_max_percent > 0) {
+    failed << " cpu";
+  }
+  if (failed.str().empty()) {
+    return true;
+  }
+  *error = "Could not apply sing-box limits:" + failed.str() + ".";
+  return false;
+}
+
+bool ChildCgroup::AddProcess(pid_t pid) {
+  return !path_.empty() && WriteFile(path_ + "/cgroup.procs", std::to_string(pid));
+}
@@ -0,0 +1,57 @@
+#ifndef RUNNER_CHILD_CGROUP_H_
+#define RUNNER_CHILD_CGROUP_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+
+// Resource limits for sing-box. A negative or zero value means no limit.
+struct CgroupLimits {
+  // Bytes; above memory.high the child is throttled and reclaimed from,
+  // at memory.max the OOM killer picks from it alone.
+  int64_t memory_high = -1;
+  int64_t memory_max = -1;
+  // Percent of one CPU, so 200 allows two full cores.
+  int64_t cpu_max_percent = 0;
+};
+
+// A cgroup v2 subtree of the runner's own cgroup for the sing-box children.
+//
+// cgroup v2 only lets a cgroup hand controllers to its children while it
+// holds no processes itself, so Create() moves the runner into a "runner"
+// leaf next to the "sing-box" one and then enables the memory and cpu
+// controllers for both. That needs the session to have delegated the
+// runner's cgroup, as systemd does for user applications. Without the
+// controllers the child is still placed and accounted, just not limited.
+class ChildCgroup {
+ public:
+  ChildCgroup() = default;
+  // Removes the sing-box cgroup once it is empty.
+  ~ChildCgroup();
+
+  ChildCgroup(const ChildCgroup&) = delete;
+  ChildCgroup& operator=(const ChildCgroup&) = delete;
+
+  // Returns false with |error| set when there is no writable cgroup v2
+  // hierarchy; sing-box then runs in the runner's cgroup. On success
+  // |error| names the controllers that could not be enabled, if any.
+  bool Create(std::string* error);
+  // Writes memory.high, memory.max and cpu.max. Returns false with |error|
+  // naming what could not be set.
+  bool Apply(const CgroupLimits& limits, std::string* error);
+  // Moves |pid| into the sing-box cgroup.
+  bool AddProcess(pid_t pid);
+
+  // The sing-box cgroup's directory, or empty before Create().
+  const std::string& path() const { return path_; }
+  bool has_memory() const { return has_memory_; }
+  bool has_cpu() const { return has_cpu_; }
+
+ private:
+  std::string path_;
+  bool has_memory_ = false;
+  bool has_cpu_ = false;
+};
+
+#endif  // RUNNER_CHILD_CGROUP_H_
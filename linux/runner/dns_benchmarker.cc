@@ -0,0 +1,337 @@
+#include "dns_benchmarker.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t kReadBufferSize = 16 * 1024;
+constexpr size_t kMaxDatagram = 4096;
+
+// Fills |address| from an IPv4 or IPv6 literal.
+bool ParseAddress(const std::string& ip, uint16_t port, sockaddr_storage* address, socklen_t* length) {
+  auto* v4 = reinterpret_cast<sockaddr_in*>(address);
+  if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    *length = sizeof(sockaddr_in);
+    return true;
+  }
+  auto* v6 = reinterpret_cast<sockaddr_in6*>(address);
+  if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    *length = sizeof(sockaddr_in6);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+DnsBenchmarker::DnsBenchmarker(EventLoop* loop) : loop_(loop) {}
+
+DnsBenchmarker::~DnsBenchmarker() {
+  loop_->RunSync([this]() {
+    CloseSockets();
+    if (timer_fd_ >= 0) {
+      loop_->Unwatch(timer_fd_);
+      close(timer_fd_);
+      timer_fd_ = -1;
+    }
+  });
+}
+
+bool DnsBenchmarker::Start(DnsBenchOptions options, DoneCallback done) {
+  if (running_.exchange(true)) {
+    return false;
+  }
+  loop_->Post([this, options = std::move(options), done = std::move(done)]() mutable {
+    options_ = std::move(options);
+    done_ = std::move(done);
+    runs_ = PlannedDnsBenchRuns(options_);
+    run_index_ = 0;
+    results_.clear();
+    if (runs_.empty()) {
+      Finish("Nothing to test.");
+      return;
+    }
+    if (timer_fd_ < 0) {
+      timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (timer_fd_ < 0 || !loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTimer(); })) {
+        Finish("Could not create the DNS benchmark timer.");
+        return;
+      }
+    }
+    StartRun();
+  });
+  return true;
+}
+
+void DnsBenchmarker::Cancel() {
+  loop_->Post([this]() {
+    if (done_) {
+      Finish("Cancelled.");
+    }
+  });
+}
+
+void DnsBenchmarker::StartRun() {
+  probe_ = std::make_unique<DnsBenchProbe>(runs_[run_index_], options_);
+  run_error_.clear();
+  itimerspec when = {};
+  auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.timeout);
+  when.it_value.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+  when.it_value.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+  timerfd_settime(timer_fd_, 0, &when, nullptr);
+
+  if (probe_->uses_stream() && !OpenStream()) {
+    run_error_ = "Could not reach " + StreamPeer() + ".";
+    EndRun();
+    return;
+  }
+  if (probe_->datagram_ready() && !OpenDatagramSocket()) {
+    EndRun();
+  }
+}
+
+void DnsBenchmarker::EndRun() {
+  CloseSockets();
+  DnsBenchResult result = probe_->Finish();
+  probe_.reset();
+  if (result.error.empty()) {
+    result.error = run_error_;
+  }
+  results_.push_back(std::move(result));
+  if (++run_index_ < runs_.size()) {
+    StartRun();
+    return;
+  }
+  Finish("");
+}
+
+void DnsBenchmarker::Finish(const std::string& error) {
+  CloseSockets();
+  probe_.reset();
+  if (timer_fd_ >= 0) {
+    itimerspec when = {};
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  }
+  DoneCallback done = std::move(done_);
+  done_ = nullptr;
+  std::vector<DnsBenchResult> results = std::move(results_);
+  results_.clear();
+  running_ = false;
+  if (done) {
+    done(results, error);
+  }
+}
+
+bool DnsBenchmarker::OpenStream() {
+  sockaddr_storage address = {};
+  socklen_t length = 0;
+  if (probe_->stream_port() == 0 || !ParseAddress(probe_->stream_ip(), probe_->stream_port(), &address, &length)) {
+    return false;
+  }
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return false;
+  }
+  if (!loop_->Watch(fd, EPOLLOUT, [this](uint32_t events) { OnStreamEvent(events); })) {
+    close(fd);
+    return false;
+  }
+  stream_fd_ = fd;
+  stream_connected_ = false;
+  return true;
+}
+
+void DnsBenchmarker::OnStreamEvent(uint32_t events) {
+  if (stream_fd_ < 0) {
+    return;
+  }
+  if (!stream_connected_) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(stream_fd_, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+      run_error_ = "Could not reach " + StreamPeer() + ".";
+      EndRun();
+      return;
+    }
+    stream_connected_ = true;
+  }
+
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+    char buffer[kReadBufferSize];
+    for (int i = 0; i < kMaxIoPerEvent; i++) {
+      ssize_t bytes_read = recv(stream_fd_, buffer, sizeof(buffer), 0);
+      if (bytes_read < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes_read < 0 && errno == EAGAIN) {
+        break;
+      }
+      if (bytes_read <= 0) {
+        probe_->OnClosed();
+        if (bytes_read < 0 && probe_->error().empty()) {
+          run_error_ = "The connection to " + StreamPeer() + " failed.";
+        }
+        EndRun();
+        return;
+      }
+      if (!probe_->OnReceived(buffer, static_cast<size_t>(bytes_read), DnsBenchClock::now())) {
+        EndRun();
+        return;
+      }
+      if (static_cast<size_t>(bytes_read) < sizeof(buffer)) {
+        break;
+      }
+    }
+  }
+  if (probe_->complete()) {
+    EndRun();
+    return;
+  }
+  if (!Flush()) {
+    run_error_ = "The connection to " + StreamPeer() + " failed.";
+    EndRun();
+    return;
+  }
+  if (probe_->datagram_ready() && udp_fd_ < 0) {
+    if (!OpenDatagramSocket()) {
+      EndRun();
+      return;
+    }
+  }
+  loop_->Rearm(stream_fd_, EPOLLIN | (probe_->output().empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+}
+
+bool DnsBenchmarker::Flush() {
+  for (int i = 0; i < kMaxIoPerEvent; i++) {
+    std::string_view output = probe_->output();
+    if (output.empty()) {
+      return true;
+    }
+    ssize_t sent = send(stream_fd_, output.data(), output.size(), MSG_NOSIGNAL);
+    if (sent < 0) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    probe_->OnSent(static_cast<size_t>(sent), DnsBenchClock::now());
+    if (static_cast<size_t>(sent) < output.size()) {
+      return true;
+    }
+  }
+  return true;
+}
+
+bool DnsBenchmarker::OpenDatagramSocket() {
+  sockaddr_storage address = {};
+  socklen_t length = 0;
+  int fd = -1;
+  if (ParseAddress(probe_->datagram_ip(), probe_->datagram_port(), &address, &length)) {
+    fd = socket(address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  }
+  // Connected, so only the server's or relay's datagrams arrive and an
+  // unreachable one shows up as ECONNREFUSED.
+  if (fd >= 0 && (connect(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+                  !loop_->Watch(fd, EPOLLIN | EPOLLOUT, [this](uint32_t events) { OnDatagramEvent(events); }))) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    run_error_ = "Could not reach " + probe_->datagram_ip() + ":" + std::to_string(probe_->datagram_port()) + ".";
+    return false;
+  }
+  udp_fd_ = fd;
+  return true;
+}
+
+void DnsBenchmarker::OnDatagramEvent(uint32_t events) {
+  if (udp_fd_ < 0) {
+    return;
+  }
+  if ((events & (EPOLLIN | EPOLLERR)) != 0) {
+    char buffer[kMaxDatagram];
+    for (int i = 0; i < kMaxIoPerEvent; i++) {
+      ssize_t bytes_read = recv(udp_fd_, buffer, sizeof(buffer), 0);
+      if (bytes_read < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+          break;
+        }
+        run_error_ =
+            probe_->datagram_ip() + ":" + std::to_string(probe_->datagram_port()) + " is unreachable over UDP.";
+        EndRun();
+        return;
+      }
+      probe_->OnDatagram(buffer, static_cast<size_t>(bytes_read), DnsBenchClock::now());
+    }
+  }
+  if (probe_->complete()) {
+    EndRun();
+    return;
+  }
+  PumpDatagrams();
+}
+
+void DnsBenchmarker::PumpDatagrams() {
+  for (;;) {
+    if (udp_pending_.empty() && !probe_->NextDatagram(DnsBenchClock::now(), &udp_pending_)) {
+      break;
+    }
+    if (send(udp_fd_, udp_pending_.data(), udp_pending_.size(), 0) < 0) {
+      if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR) {
+        break;
+      }
+      if (errno == ECONNREFUSED) {
+        // An earlier query drew an ICMP unreachable; the rest would too.
+        run_error_ =
+            probe_->datagram_ip() + ":" + std::to_string(probe_->datagram_port()) + " is unreachable over UDP.";
+        EndRun();
+        return;
+      }
+    }
+    udp_pending_.clear();
+  }
+  loop_->Rearm(udp_fd_, EPOLLIN | (udp_pending_.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+}
+
+void DnsBenchmarker::OnTimer() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (probe_) {
+    // Whatever is still unanswered counts as failed.
+    EndRun();
+  }
+}
+
+void DnsBenchmarker::CloseSockets() {
+  if (stream_fd_ >= 0) {
+    loop_->Unwatch(stream_fd_);
+    close(stream_fd_);
+    stream_fd_ = -1;
+  }
+  stream_connected_ = false;
+  if (udp_fd_ >= 0) {
+    loop_->Unwatch(udp_fd_);
+    close(udp_fd_);
+    udp_fd_ = -1;
+  }
+  udp_pending_.clear();
+}
+
+std::string DnsBenchmarker::StreamPeer() const {
+  if (probe_->stream_ip() == options_.proxy_ip && probe_->stream_port() == options_.proxy_port) {
+    return "the mixed inbound at " + options_.proxy_ip + ":" + std::to_string(options_.proxy_port);
+  }
+  return probe_->stream_ip() + ":" + std::to_string(probe_->stream_port());
+}
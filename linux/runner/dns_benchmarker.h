@@ -0,0 +1,78 @@
+#ifndef RUNNER_DNS_BENCHMARKER_H_
+#define RUNNER_DNS_BENCHMARKER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dns_bench.h"
+#include "event_loop.h"
+
+// Measures DNS provider latency from the event loop.
+//
+// The planned runs go one after another. Each opens a non-blocking TCP
+// connection to the server or the mixed inbound and, for UDP, a connected
+// datagram socket to the server or the proxy's relay, fires all of its
+// queries at once and ends when every one is answered or a one-shot
+// timerfd reaches options.timeout.
+class DnsBenchmarker {
+ public:
+  // Receives a result per run and, when the benchmark stopped early, why.
+  using DoneCallback = std::function<void(const std::vector<DnsBenchResult>& results, const std::string& error)>;
+
+  explicit DnsBenchmarker(EventLoop* loop);
+  ~DnsBenchmarker();
+
+  DnsBenchmarker(const DnsBenchmarker&) = delete;
+  DnsBenchmarker& operator=(const DnsBenchmarker&) = delete;
+
+  // Safe from any thread. Returns false while another benchmark runs.
+  // |done| runs on the loop thread exactly once.
+  bool Start(DnsBenchOptions options, DoneCallback done);
+  // Safe from any thread. Stops a running benchmark with "Cancelled.".
+  void Cancel();
+
+ private:
+  static constexpr int kMaxIoPerEvent = 16;
+
+  void StartRun();
+  // Records the current run and starts the next.
+  void EndRun();
+  void Finish(const std::string& error);
+  // Opens the run's connection; false when the socket fails.
+  bool OpenStream();
+  void OnStreamEvent(uint32_t events);
+  // Sends what the probe has queued; false on a socket error.
+  bool Flush();
+  bool OpenDatagramSocket();
+  void OnDatagramEvent(uint32_t events);
+  void PumpDatagrams();
+  void OnTimer();
+  void CloseSockets();
+  // "8.8.8.8:53", or the mixed inbound, for error messages.
+  std::string StreamPeer() const;
+
+  EventLoop* loop_;
+  std::atomic<bool> running_{false};
+
+  // Loop thread only from here on.
+  DnsBenchOptions options_;
+  DoneCallback done_;
+  std::vector<DnsBenchRun> runs_;
+  size_t run_index_ = 0;
+  std::vector<DnsBenchResult> results_;
+
+  std::unique_ptr<DnsBenchProbe> probe_;
+  // Why the current run stopped short, when the probe does not know.
+  std::string run_error_;
+  int stream_fd_ = -1;
+  bool stream_connected_ = false;
+  int udp_fd_ = -1;
+  // A datagram the socket had no room for.
+  std::string udp_pending_;
+  int timer_fd_ = -1;
+};
+
+#endif  // RUNNER_DNS_BENCHMARKER_H_
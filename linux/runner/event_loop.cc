@@ -0,0 +1,184 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <future>
+#include <iostream>
+
+namespace {
+constexpr int kMaxEventsPerWait = 64;
+
+uint64_t PackUserData(int fd, uint32_t generation) {
+  return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+}  // namespace
+
+EventLoop::EventLoop() {}
+
+EventLoop::~EventLoop() {
+  Stop();
+}
+
+bool EventLoop::Start() {
+  if (running_.load()) {
+    return true;
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    std::cerr << "[EventLoop] epoll_create1 failed: errno " << errno << std::endl;
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd_ < 0) {
+    std::cerr << "[EventLoop] eventfd failed: errno " << errno << std::endl;
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+    return false;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = PackUserData(wake_fd_, 0);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+  running_ = true;
+  thread_ = std::thread(&EventLoop::Run, this);
+  return true;
+}
+
+void EventLoop::Stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  Wakeup();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  watchers_.clear();
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks_.clear();
+  }
+  close(wake_fd_);
+  close(epoll_fd_);
+  wake_fd_ = -1;
+  epoll_fd_ = -1;
+}
+
+bool EventLoop::Watch(int fd, uint32_t events, IoHandler handler) {
+  uint32_t generation = next_generation_++;
+  if (next_generation_ == 0) {
+    next_generation_ = 1;
+  }
+
+  epoll_event event = {};
+  event.events = events;
+  event.data.u64 = PackUserData(fd, generation);
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    return false;
+  }
+  watchers_[fd] = Watcher{generation, std::make_shared<IoHandler>(std::move(handler))};
+  return true;
+}
+
+bool EventLoop::Rearm(int fd, uint32_t events) {
+  auto it = watchers_.find(fd);
+  if (it == watchers_.end()) {
+    return false;
+  }
+  epoll_event event = {};
+  event.events = events;
+  event.data.u64 = PackUserData(fd, it->second.generation);
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void EventLoop::Unwatch(int fd) {
+  if (watchers_.erase(fd) > 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+void EventLoop::Post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  Wakeup();
+}
+
+void EventLoop::RunSync(Task task) {
+  if (IsLoopThread() || !running_.load()) {
+    task();
+    return;
+  }
+  std::promise<void> done;
+  std::future<void> finished = done.get_future();
+  Post([&task, &done]() {
+    task();
+    done.set_value();
+  });
+  finished.wait();
+}
+
+bool EventLoop::IsLoopThread() const {
+  return std::this_thread::get_id() == thread_.get_id();
+}
+
+void EventLoop::Wakeup() {
+  uint64_t one = 1;
+  ssize_t written = write(wake_fd_, &one, sizeof(one));
+  (void)written;
+}
+
+void EventLoop::RunPendingTasks() {
+  uint64_t counter;
+  while (read(wake_fd_, &counter, sizeof(counter)) > 0) {
+  }
+
+  std::vector<Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks.swap(tasks_);
+  }
+  for (auto& task : tasks) {
+    task();
+  }
+}
+
+void EventLoop::Run() {
+  epoll_event events[kMaxEventsPerWait];
+
+  while (running_.load()) {
+    int count = epoll_wait(epoll_fd_, events, kMaxEventsPerWait, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "[EventLoop] epoll_wait failed: errno " << errno << std::endl;
+      break;
+    }
+
+    for (int i = 0; i < count && running_.load(); i++) {
+      int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+      uint32_t generation = static_cast<uint32_t>(events[i].data.u64 >> 32);
+
+      if (fd == wake_fd_ && generation == 0) {
+        RunPendingTasks();
+        continue;
+      }
+
+      auto it = watchers_.find(fd);
+      if (it == watchers_.end() || it->second.generation != generation) {
+        continue;
+      }
+      // Keep the handler alive even if it unwatches its own descriptor.
+      std::shared_ptr<IoHandler> handler = it->second.handler;
+      (*handler)(events[i].events);
+    }
+  }
+}
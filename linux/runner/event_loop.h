@@ -0,0 +1,75 @@
+#ifndef RUNNER_EVENT_LOOP_H_
+#define RUNNER_EVENT_LOOP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A single epoll-driven I/O thread shared by the runner's native services.
+//
+// File descriptors are registered with Watch() and their handlers run on the
+// loop thread. Other threads hand work over with Post() or RunSync().
+class EventLoop {
+ public:
+  // Receives the epoll event mask that fired for the watched descriptor.
+  using IoHandler = std::function<void(uint32_t events)>;
+  using Task = std::function<void()>;
+
+  EventLoop();
+  ~EventLoop();
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  // Creates the epoll instance and spawns the loop thread.
+  bool Start();
+
+  // Stops the loop thread. Pending tasks are dropped.
+  void Stop();
+
+  // Loop thread only. The descriptor stays owned by the caller and must be
+  // unwatched before it is closed.
+  bool Watch(int fd, uint32_t events, IoHandler handler);
+  bool Rearm(int fd, uint32_t events);
+  void Unwatch(int fd);
+
+  // Safe from any thread.
+  void Post(Task task);
+
+  // Runs |task| on the loop thread and waits for it to finish. Runs inline
+  // when already on the loop thread.
+  void RunSync(Task task);
+
+  bool IsLoopThread() const;
+
+ private:
+  struct Watcher {
+    uint32_t generation;
+    std::shared_ptr<IoHandler> handler;
+  };
+
+  void Run();
+  void Wakeup();
+  void RunPendingTasks();
+
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+
+  std::mutex tasks_mutex_;
+  std::vector<Task> tasks_;
+
+  // Keyed by descriptor. The generation is stored in the epoll user data so
+  // events for a descriptor that was unwatched and reused in the same batch
+  // are discarded.
+  std::unordered_map<int, Watcher> watchers_;
+  uint32_t next_generation_ = 1;
+};
+
+#endif  // RUNNER_EVENT_LOOP_H_
@@ -0,0 +1,385 @@
+#include "helper_client.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+HelperClient::HelperClient(EventLoop* loop, LogRing* log_ring) : loop_(loop), log_ring_(log_ring) {}
+
+HelperClient::~HelperClient() {
+  loop_->RunSync([this]() {
+    if (fd_ >= 0) {
+      loop_->Unwatch(fd_);
+      close(fd_);
+      fd_ = -1;
+    }
+    if (timer_fd_ >= 0) {
+      loop_->Unwatch(timer_fd_);
+      close(timer_fd_);
+      timer_fd_ = -1;
+    }
+    pending_.clear();
+  });
+}
+
+bool HelperClient::Connect(const std::string& path, uint64_t session, uint64_t cursor, Callbacks callbacks) {
+  bool connected = false;
+  loop_->RunSync([this, &path, session, cursor, &callbacks, &connected]() {
+    path_ = path;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      session_ = session;
+      cursor_ = cursor;
+    }
+    if (!Open()) {
+      return;
+    }
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ >= 0) {
+      loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTimer(); });
+    }
+    callbacks_ = std::move(callbacks);
+    connected = true;
+  });
+  return connected;
+}
+
+void HelperClient::Start(const HelperTunnelRequest& tunnel, ResultCallback done) {
+  loop_->Post([this, tunnel, done]() {
+    Send([this, &tunnel](uint32_t request) { writer_.AppendTunnelRequest(HelperMessage::kStart, request, tunnel); },
+         done);
+  });
+}
+
+void HelperClient::Stop(ResultCallback done) {
+  loop_->Post([this, done]() {
+    Send([this](uint32_t request) { writer_.AppendStop(request); }, done);
+  });
+}
+
+void HelperClient::Reload(const HelperTunnelRequest& tunnel, ResultCallback done) {
+  loop_->Post([this, tunnel, done]() {
+    Send([this, &tunnel](uint32_t request) { writer_.AppendTunnelRequest(HelperMessage::kReload, request, tunnel); },
+         done);
+  });
+}
+
+void HelperClient::Prepare(const HelperTunnelRequest& tunnel, ResultCallback done) {
+  loop_->Post([this, tunnel, done]() {
+    Send([this, &tunnel](uint32_t request) { writer_.AppendTunnelRequest(HelperMessage::kPrepare, request, tunnel); },
+         done);
+  });
+}
+
+HelperTunnelState HelperClient::state() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return state_;
+}
+
+void HelperClient::Cursor(uint64_t* session, uint64_t* cursor) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  *session = session_;
+  *cursor = cursor_;
+}
+
+std::vector<TrafficSample> HelperClient::History(uint64_t* sequence) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  *sequence = history_sequence_;
+  return history_.Snapshot();
+}
+
+bool HelperClient::Open() {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  memcpy(address.sun_path, path_.c_str(), path_.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  // Unix sockets connect at once or not at all; a full backlog is retried.
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+    close(fd);
+    return false;
+  }
+  fd_ = fd;
+  reader_ = HelperFrameReader();
+  writer_ = HelperFrameWriter();
+  uint64_t session;
+  uint64_t cursor;
+  Cursor(&session, &cursor);
+  writer_.AppendHello(session, cursor);
+  if (!loop_->Watch(fd_, EPOLLIN | EPOLLRDHUP, [this](uint32_t events) { OnEvent(events); }) || !Flush()) {
+    loop_->Unwatch(fd_);
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+void HelperClient::Close(const std::string& reason) {
+  if (fd_ < 0) {
+    return;
+  }
+  loop_->Unwatch(fd_);
+  close(fd_);
+  fd_ = -1;
+  bool welcomed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    welcomed = welcomed_;
+    welcomed_ = false;
+  }
+  std::map<uint32_t, ResultCallback> pending;
+  pending.swap(pending_);
+  HelperResult result;
+  result.text = reason;
+  for (auto& entry : pending) {
+    entry.second(result);
+  }
+  if (welcomed && callbacks_.on_connection) {
+    callbacks_.on_connection(false);
+  }
+  itimerspec when = {};
+  when.it_value.tv_sec = kRetryInterval.count();
+  timerfd_settime(timer_fd_, 0, &when, nullptr);
+}
+
+void HelperClient::OnEvent(uint32_t events) {
+  if ((events & EPOLLOUT) && !Flush()) {
+    Close("Lost the connection to the tunnel helper.");
+    return;
+  }
+  if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) == 0) {
+    return;
+  }
+  char buffer[kReadSize];
+  bool closed = false;
+  for (;;) {
+    ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      reader_.Append(buffer, static_cast<size_t>(received));
+      continue;
+    }
+    closed = received == 0 || errno != EAGAIN;
+    break;
+  }
+  HelperMessage kind;
+  std::string payload;
+  while (fd_ >= 0 && reader_.Next(&kind, &payload)) {
+    Handle(kind, payload);
+  }
+  if (closed || reader_.broken()) {
+    Close("Lost the connection to the tunnel helper.");
+  }
+}
+
+bool HelperClient::Flush() {
+  size_t sent = 0;
+  const std::string& buffer = writer_.buffer();
+  while (sent < buffer.size()) {
+    ssize_t written = send(fd_, buffer.data() + sent, buffer.size() - sent, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EAGAIN) {
+        break;
+      }
+      return false;
+    }
+    sent += static_cast<size_t>(written);
+  }
+  writer_.Consume(sent);
+  loop_->Rearm(fd_, EPOLLIN | EPOLLRDHUP | (writer_.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+  return true;
+}
+
+void HelperClient::Send(const std::function<void(uint32_t request)>& append, ResultCallback done) {
+  bool welcomed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    welcomed = welcomed_;
+  }
+  if (fd_ < 0 || !welcomed) {
+    HelperResult result;
+    result.text = "The tunnel helper is not connected.";
+    done(result);
+    return;
+  }
+  uint32_t request = next_request_++;
+  pending_[request] = std::move(done);
+  append(request);
+  if (!Flush()) {
+    Close("Lost the connection to the tunnel helper.");
+  }
+}
+
+void HelperClient::Handle(HelperMessage kind, const std::string& payload) {
+  HelperPayloadReader reader(payload);
+  switch (kind) {
+    case HelperMessage::kWelcome:
+      OnWelcome(&reader);
+      break;
+    case HelperMessage::kResult: {
+      uint32_t request = reader.ReadU32();
+      HelperResult result;
+      if (!ReadResult(&reader, &result)) {
+        result = HelperResult();
+        result.text = "Malformed answer from the tunnel helper.";
+      }
+      auto it = pending_.find(request);
+      if (it != pending_.end()) {
+        ResultCallback done = std::move(it->second);
+        pending_.erase(it);
+        done(result);
+      }
+      break;
+    }
+    case HelperMessage::kState: {
+      auto state = static_cast<HelperTunnelState>(reader.ReadU8());
+      bool confirmed = reader.ReadU8() != 0;
+      if (!reader.ok()) {
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = state;
+        // A new sing-box starts a new history.
+        if (state == HelperTunnelState::kStarting) {
+          history_.Clear();
+          history_sequence_ = 0;
+        }
+      }
+      if (state == HelperTunnelState::kStarting) {
+        has_sample_ = false;
+      }
+      if (callbacks_.on_state) {
+        callbacks_.on_state(state, confirmed);
+      }
+      break;
+    }
+    case HelperMessage::kLog:
+      OnLog(&reader);
+      break;
+    case HelperMessage::kTrafficSample: {
+      TrafficDelta delta;
+      if (ReadTrafficSample(&reader, &delta)) {
+        OnTrafficSample(delta);
+      }
+      break;
+    }
+    case HelperMessage::kRestart: {
+      RestartEvent event;
+      if (ReadRestart(&reader, &event) && callbacks_.on_restart) {
+        callbacks_.on_restart(event);
+      }
+      break;
+    }
+    default:
+      // From a newer helper.
+      break;
+  }
+}
+
+void HelperClient::OnWelcome(HelperPayloadReader* reader) {
+  uint32_t version = reader->ReadU32();
+  uint64_t session = reader->ReadU64();
+  auto state = static_cast<HelperTunnelState>(reader->ReadU8());
+  reader->ReadU64();
+  if (!reader->ok() || version != kHelperProtocolVersion) {
+    Close("The tunnel helper speaks another protocol version.");
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The replay that follows starts over for another helper start.
+    if (session != session_) {
+      session_ = session;
+      cursor_ = kHelperLogFromOldest;
+    }
+    welcomed_ = true;
+    state_ = state;
+    // Only the latest sample comes with the welcome.
+    history_.Clear();
+    history_sequence_ = 0;
+  }
+  has_sample_ = false;
+  if (callbacks_.on_connection) {
+    callbacks_.on_connection(true);
+  }
+  // A running tunnel is announced with its confirmation right after.
+  if (state != HelperTunnelState::kRunning && callbacks_.on_state) {
+    callbacks_.on_state(state, false);
+  }
+}
+
+void HelperClient::OnLog(HelperPayloadReader* reader) {
+  uint64_t first = reader->ReadU64();
+  std::string_view lines = reader->Rest();
+  if (!reader->ok()) {
+    return;
+  }
+  uint64_t cursor;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cursor = cursor_;
+  }
+  // Skip what a replay repeats; lines the helper no longer had are gone.
+  size_t start = 0;
+  for (uint64_t line = first; line < cursor && start < lines.size(); line++) {
+    size_t end = lines.find('\n', start);
+    start = end == std::string_view::npos ? lines.size() : end + 1;
+  }
+  uint64_t count = static_cast<uint64_t>(std::count(lines.begin(), lines.end(), '\n'));
+  if (start < lines.size()) {
+    log_ring_->Write(lines.data() + start, lines.size() - start);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  cursor_ = std::max(cursor_, first + count);
+}
+
+void HelperClient::OnTrafficSample(const TrafficDelta& delta) {
+  if (delta.key) {
+    sample_.up = static_cast<uint64_t>(delta.up);
+    sample_.down = static_cast<uint64_t>(delta.down);
+    sample_.connections = static_cast<uint32_t>(delta.connections);
+    has_sample_ = true;
+  } else if (delta.sequence != history_sequence_ + 1) {
+    // Missed one; the next key frame catches up.
+    has_sample_ = false;
+  } else if (has_sample_) {
+    sample_.up = static_cast<uint64_t>(static_cast<int64_t>(sample_.up) + delta.up);
+    sample_.down = static_cast<uint64_t>(static_cast<int64_t>(sample_.down) + delta.down);
+    sample_.connections = static_cast<uint32_t>(static_cast<int64_t>(sample_.connections) + delta.connections);
+  }
+  if (has_sample_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    history_.Push(sample_);
+    history_sequence_ = delta.sequence;
+  }
+  if (callbacks_.on_traffic) {
+    callbacks_.on_traffic(delta);
+  }
+}
+
+void HelperClient::OnTimer() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (fd_ >= 0) {
+    return;
+  }
+  if (!Open()) {
+    itimerspec when = {};
+    when.it_value.tv_sec = kRetryInterval.count();
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  }
+}
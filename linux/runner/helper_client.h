@@ -0,0 +1,111 @@
+#ifndef RUNNER_HELPER_CLIENT_H_
+#define RUNNER_HELPER_CLIENT_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "helper_protocol.h"
+#include "log_ring.h"
+#include "restart_policy.h"
+#include "traffic_stats.h"
+
+// The UI's end of the tunnel helper (linux/helper), which runs sing-box when
+// the app is installed with it, so the UI itself needs no privileges.
+//
+// Log lines from the helper go into the LogRing as if a local sing-box had
+// written them. The connection remembers the helper's session and the id of
+// the next line, and resumes from there when it drops and comes back, which
+// it retries every kRetryInterval; Cursor() carries that over to the next
+// run of the UI. All I/O runs on the event loop thread.
+class HelperClient {
+ public:
+  // Called on the loop thread.
+  struct Callbacks {
+    // The helper answered a hello, or the connection dropped.
+    std::function<void(bool connected)> on_connection;
+    // The tunnel's state, after every change and once on connecting.
+    std::function<void(HelperTunnelState state, bool confirmed)> on_state;
+    std::function<void(const RestartEvent& event)> on_restart;
+    std::function<void(const TrafficDelta& delta)> on_traffic;
+  };
+  // Called on the loop thread with the helper's answer.
+  using ResultCallback = std::function<void(const HelperResult& result)>;
+
+  // |log_ring| is written on the loop thread, so nothing else may produce
+  // into it while the client is connected.
+  HelperClient(EventLoop* loop, LogRing* log_ring);
+  ~HelperClient();
+
+  HelperClient(const HelperClient&) = delete;
+  HelperClient& operator=(const HelperClient&) = delete;
+
+  // Connects to the helper listening on |path|, resuming the log after
+  // |cursor| if |session| is still the helper's. Returns false if no helper
+  // answers there; once connected, the client keeps reconnecting until it
+  // is destroyed. Not on the loop thread.
+  bool Connect(const std::string& path, uint64_t session, uint64_t cursor, Callbacks callbacks);
+
+  // Safe from any thread. |done| gets an error when the helper is not
+  // connected or the connection drops before it answers.
+  void Start(const HelperTunnelRequest& tunnel, ResultCallback done);
+  void Stop(ResultCallback done);
+  void Reload(const HelperTunnelRequest& tunnel, ResultCallback done);
+  void Prepare(const HelperTunnelRequest& tunnel, ResultCallback done);
+
+  // Safe from any thread.
+  HelperTunnelState state();
+  // The helper's session and the id of the next log line, to resume from.
+  void Cursor(uint64_t* session, uint64_t* cursor);
+  // The samples received since the tunnel came up, oldest first, and the
+  // helper's sequence number of the newest.
+  std::vector<TrafficSample> History(uint64_t* sequence);
+
+ private:
+  static constexpr std::chrono::seconds kRetryInterval{1};
+  static constexpr size_t kReadSize = 64 * 1024;
+
+  // Loop thread only.
+  bool Open();
+  void Close(const std::string& reason);
+  void OnEvent(uint32_t events);
+  bool Flush();
+  // Queues a request written by |append| and answers |done| with its result.
+  void Send(const std::function<void(uint32_t request)>& append, ResultCallback done);
+  void Handle(HelperMessage kind, const std::string& payload);
+  void OnWelcome(HelperPayloadReader* reader);
+  void OnLog(HelperPayloadReader* reader);
+  void OnTrafficSample(const TrafficDelta& delta);
+  void OnTimer();
+
+  EventLoop* loop_;
+  LogRing* log_ring_;
+  Callbacks callbacks_;
+  std::string path_;
+
+  // Loop thread only.
+  int fd_ = -1;
+  int timer_fd_ = -1;
+  HelperFrameReader reader_;
+  HelperFrameWriter writer_;
+  uint32_t next_request_ = 1;
+  std::map<uint32_t, ResultCallback> pending_;
+  // The last sample, rebuilt from the deltas; none until a key frame.
+  bool has_sample_ = false;
+  TrafficSample sample_;
+
+  std::mutex mutex_;
+  bool welcomed_ = false;
+  HelperTunnelState state_ = HelperTunnelState::kStopped;
+  uint64_t session_ = 0;
+  uint64_t cursor_ = kHelperLogFromOldest;
+  TrafficHistory history_;
+  uint64_t history_sequence_ = 0;
+};
+
+#endif  // RUNNER_HELPER_CLIENT_H_
@@ -0,0 +1,263 @@
+#include "latency_prober.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kMaxResponse = 64;
+
+int64_t MicrosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Fills |address| from an IPv4 or IPv6 literal.
+bool ParseAddress(const std::string& ip, uint16_t port, sockaddr_storage* address, socklen_t* length) {
+  auto* v4 = reinterpret_cast<sockaddr_in*>(address);
+  if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    *length = sizeof(sockaddr_in);
+    return true;
+  }
+  auto* v6 = reinterpret_cast<sockaddr_in6*>(address);
+  if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    *length = sizeof(sockaddr_in6);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+LatencyProber::LatencyProber(EventLoop* loop) : loop_(loop) {}
+
+LatencyProber::~LatencyProber() {
+  loop_->RunSync([this]() {
+    for (auto& entry : in_flight_) {
+      loop_->Unwatch(entry.first);
+      close(entry.first);
+    }
+    in_flight_.clear();
+    queued_.clear();
+    if (timer_fd_ >= 0) {
+      loop_->Unwatch(timer_fd_);
+      close(timer_fd_);
+      timer_fd_ = -1;
+    }
+  });
+}
+
+void LatencyProber::Probe(std::vector<ProbeTarget> targets, std::chrono::milliseconds timeout,
+                          ResultCallback on_result, DoneCallback done) {
+  auto batch = std::make_shared<Batch>();
+  batch->on_result = std::move(on_result);
+  batch->done = std::move(done);
+  batch->remaining = targets.size();
+  loop_->Post([this, batch, timeout, targets = std::move(targets)]() mutable {
+    if (targets.empty()) {
+      if (batch->done) {
+        batch->done();
+      }
+      return;
+    }
+    for (ProbeTarget& target : targets) {
+      auto attempt = std::make_unique<Attempt>();
+      attempt->target = std::move(target);
+      attempt->batch = batch;
+      attempt->timeout = timeout;
+      queued_.push_back(std::move(attempt));
+    }
+    Pump();
+  });
+}
+
+void LatencyProber::Pump() {
+  // Starting a socket costs a few syscalls, so a long queue is started in
+  // bursts to let finished probes report in between.
+  for (size_t started = 0; started < kStartBurst && !queued_.empty() && in_flight_.size() < kMaxInFlight;
+       started++) {
+    std::unique_ptr<Attempt> attempt = std::move(queued_.front());
+    queued_.pop_front();
+    if (!Begin(attempt.get())) {
+      Report(*attempt, kProbeFailed);
+      continue;
+    }
+    int fd = attempt->fd;
+    in_flight_[fd] = std::move(attempt);
+  }
+  ArmTimer();
+}
+
+bool LatencyProber::Begin(Attempt* attempt) {
+  sockaddr_storage address = {};
+  socklen_t length = 0;
+  if (attempt->target.port == 0 || !ParseAddress(attempt->target.ip, attempt->target.port, &address, &length)) {
+    return false;
+  }
+  bool datagram = attempt->target.protocol == ProbeProtocol::kQuic;
+  int fd = socket(address.ss_family, (datagram ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  attempt->started = std::chrono::steady_clock::now();
+  attempt->deadline = attempt->started + attempt->timeout;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return false;
+  }
+  if (datagram) {
+    // A connected UDP socket turns an ICMP port unreachable into
+    // ECONNREFUSED on the next recv.
+    std::string packet = BuildQuicVersionProbe();
+    if (send(fd, packet.data(), packet.size(), 0) < 0) {
+      close(fd);
+      return false;
+    }
+  }
+  if (!loop_->Watch(fd, datagram ? EPOLLIN : EPOLLOUT, [this, fd](uint32_t events) { OnEvent(fd, events); })) {
+    close(fd);
+    return false;
+  }
+  attempt->fd = fd;
+  return true;
+}
+
+void LatencyProber::OnEvent(int fd, uint32_t events) {
+  auto it = in_flight_.find(fd);
+  if (it == in_flight_.end()) {
+    return;
+  }
+  Attempt* attempt = it->second.get();
+  if (attempt->target.protocol != ProbeProtocol::kQuic && attempt->connect_us == kProbeFailed) {
+    if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0) {
+      OnConnected(attempt);
+    }
+    return;
+  }
+  OnReadable(attempt);
+}
+
+void LatencyProber::OnConnected(Attempt* attempt) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(attempt->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+    Finish(attempt->fd, kProbeFailed);
+    return;
+  }
+  attempt->connect_us = MicrosecondsSince(attempt->started);
+  if (attempt->target.protocol == ProbeProtocol::kTcp) {
+    Finish(attempt->fd, attempt->connect_us);
+    return;
+  }
+  // The ClientHello is far below the socket buffer, so one send does it.
+  std::string hello = BuildTlsClientHello(attempt->target.sni);
+  if (send(attempt->fd, hello.data(), hello.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(hello.size())) {
+    Finish(attempt->fd, kProbeFailed);
+    return;
+  }
+  loop_->Rearm(attempt->fd, EPOLLIN);
+}
+
+void LatencyProber::OnReadable(Attempt* attempt) {
+  uint8_t buffer[kMaxResponse];
+  ssize_t bytes_read = recv(attempt->fd, buffer, sizeof(buffer), 0);
+  if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (bytes_read <= 0) {
+    Finish(attempt->fd, kProbeFailed);
+    return;
+  }
+  size_t size = static_cast<size_t>(bytes_read);
+  if (attempt->target.protocol == ProbeProtocol::kQuic) {
+    // Other datagrams are not an answer to the probe; keep waiting.
+    if (IsQuicVersionNegotiation(buffer, size)) {
+      Finish(attempt->fd, MicrosecondsSince(attempt->started));
+    }
+    return;
+  }
+  attempt->response.append(reinterpret_cast<const char*>(buffer), size);
+  if (attempt->response.size() < 3) {
+    return;
+  }
+  bool answered = IsTlsRecord(reinterpret_cast<const uint8_t*>(attempt->response.data()), attempt->response.size());
+  Finish(attempt->fd, answered ? attempt->connect_us : kProbeFailed);
+}
+
+void LatencyProber::OnTimer() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  auto now = std::chrono::steady_clock::now();
+  std::vector<int> expired;
+  for (const auto& entry : in_flight_) {
+    if (entry.second->deadline <= now) {
+      expired.push_back(entry.first);
+    }
+  }
+  for (int fd : expired) {
+    Finish(fd, kProbeFailed);
+  }
+  Pump();
+}
+
+void LatencyProber::ArmTimer() {
+  if (timer_fd_ < 0) {
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      return;
+    }
+    loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTimer(); });
+  }
+  itimerspec when = {};
+  if (!queued_.empty() && in_flight_.size() < kMaxInFlight) {
+    // Resume starting right after pending events are handled.
+    when.it_value.tv_nsec = 1;
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  } else if (!in_flight_.empty()) {
+    auto earliest = std::min_element(in_flight_.begin(), in_flight_.end(), [](const auto& a, const auto& b) {
+                      return a.second->deadline < b.second->deadline;
+                    })->second->deadline;
+    // steady_clock is CLOCK_MONOTONIC on Linux. A zero it_value would
+    // disarm the timer, so a past deadline fires after 1 ns.
+    auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(earliest.time_since_epoch()).count();
+    when.it_value.tv_sec = since_epoch / 1000000000;
+    when.it_value.tv_nsec = std::max<long>(since_epoch % 1000000000, 1);
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &when, nullptr);
+  } else {
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  }
+}
+
+void LatencyProber::Finish(int fd, int64_t rtt_us) {
+  auto it = in_flight_.find(fd);
+  if (it == in_flight_.end()) {
+    return;
+  }
+  std::unique_ptr<Attempt> attempt = std::move(it->second);
+  in_flight_.erase(it);
+  loop_->Unwatch(fd);
+  close(fd);
+  Report(*attempt, rtt_us);
+  Pump();
+}
+
+void LatencyProber::Report(const Attempt& attempt, int64_t rtt_us) {
+  Batch* batch = attempt.batch.get();
+  if (batch->on_result) {
+    batch->on_result(attempt.target.id, rtt_us);
+  }
+  if (--batch->remaining == 0 && batch->done) {
+    batch->done();
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef RUNNER_LATENCY_PROBER_H_
+#define RUNNER_LATENCY_PROBER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "event_loop.h"
+#include "latency_probe.h"
+
+// Measures round trips to many servers at once from the event loop.
+//
+// Every probe is a non-blocking socket watched by the shared epoll loop, with
+// up to kMaxInFlight of them open at a time and one timerfd that both paces
+// the starts and tracks all of their deadlines. Results are reported as each
+// probe finishes, so a country's list fills in fastest-first instead of
+// waiting for the slowest server.
+class LatencyProber {
+ public:
+  // Receives the target id and the round trip in microseconds, or
+  // kProbeFailed.
+  using ResultCallback = std::function<void(const std::string& id, int64_t rtt_us)>;
+  using DoneCallback = std::function<void()>;
+
+  explicit LatencyProber(EventLoop* loop);
+  ~LatencyProber();
+
+  LatencyProber(const LatencyProber&) = delete;
+  LatencyProber& operator=(const LatencyProber&) = delete;
+
+  // Safe from any thread. Both callbacks run on the loop thread: |on_result|
+  // once per target in completion order, then |done|. Target addresses must
+  // be IP literals; names are reported as failed rather than resolved on
+  // the loop thread.
+  void Probe(std::vector<ProbeTarget> targets, std::chrono::milliseconds timeout, ResultCallback on_result,
+             DoneCallback done);
+
+ private:
+  static constexpr size_t kMaxInFlight = 256;
+  static constexpr size_t kStartBurst = 32;
+
+  struct Batch {
+    ResultCallback on_result;
+    DoneCallback done;
+    size_t remaining = 0;
+  };
+
+  struct Attempt {
+    ProbeTarget target;
+    std::shared_ptr<Batch> batch;
+    std::chrono::milliseconds timeout{0};
+    int fd = -1;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point deadline;
+    // TCP connect time, the result of a TLS probe once the server answers.
+    int64_t connect_us = kProbeFailed;
+    std::string response;
+  };
+
+  // Starts queued attempts while there is room.
+  void Pump();
+  // Opens the socket for |attempt|; false when it cannot be probed.
+  bool Begin(Attempt* attempt);
+  void OnEvent(int fd, uint32_t events);
+  void OnConnected(Attempt* attempt);
+  void OnReadable(Attempt* attempt);
+  void OnTimer();
+  // Sets the timer to fire at once while queued attempts can start, else at
+  // the earliest in-flight deadline.
+  void ArmTimer();
+  // Closes the attempt on |fd|, reports |rtt_us| and starts the next one.
+  void Finish(int fd, int64_t rtt_us);
+  static void Report(const Attempt& attempt, int64_t rtt_us);
+
+  EventLoop* loop_;
+  int timer_fd_ = -1;
+  std::deque<std::unique_ptr<Attempt>> queued_;
+  std::unordered_map<int, std::unique_ptr<Attempt>> in_flight_;
+};
+
+#endif  // RUNNER_LATENCY_PROBER_H_
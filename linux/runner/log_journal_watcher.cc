@@ -0,0 +1,73 @@
+#include "log_journal_watcher.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <utility>
+
+LogJournalWatcher::LogJournalWatcher(EventLoop* loop, std::filesystem::path directory)
+    : loop_(loop), reader_(std::move(directory)) {}
+
+LogJournalWatcher::~LogJournalWatcher() {
+  Stop();
+}
+
+bool LogJournalWatcher::Start(uint64_t cursor, LinesCallback on_lines) {
+  bool started = false;
+  loop_->RunSync([this, cursor, &on_lines, &started]() {
+    Close();
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+      std::cerr << "[LogJournalWatcher] inotify_init1 failed: errno " << errno << std::endl;
+      return;
+    }
+    // Watched before the first read, so no commit in between is missed.
+    if (inotify_add_watch(inotify_fd_, reader_.directory().c_str(), IN_MODIFY | IN_CREATE | IN_DELETE) < 0) {
+      std::cerr << "[LogJournalWatcher] watching " << reader_.directory() << " failed: errno " << errno
+                << std::endl;
+      Close();
+      return;
+    }
+    loop_->Watch(inotify_fd_, EPOLLIN, [this](uint32_t) { OnReadable(); });
+    on_lines_ = std::move(on_lines);
+    cursor_ = cursor;
+    started = true;
+    Deliver();
+  });
+  return started;
+}
+
+void LogJournalWatcher::Stop() {
+  loop_->RunSync([this]() {
+    Close();
+    on_lines_ = nullptr;
+  });
+}
+
+void LogJournalWatcher::Close() {
+  if (inotify_fd_ >= 0) {
+    loop_->Unwatch(inotify_fd_);
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+}
+
+void LogJournalWatcher::OnReadable() {
+  // The events only say that something changed; the segment headers say
+  // what. Drain them all and read once.
+  alignas(inotify_event) char buffer[4096];
+  while (read(inotify_fd_, buffer, sizeof(buffer)) > 0) {
+  }
+  Deliver();
+}
+
+void LogJournalWatcher::Deliver() {
+  cursor_ = reader_.Read(cursor_, [this](const char* data, size_t size) {
+    if (on_lines_) {
+      on_lines_(data, size);
+    }
+  });
+}
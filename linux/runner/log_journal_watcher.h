@@ -0,0 +1,53 @@
+#ifndef RUNNER_LOG_JOURNAL_WATCHER_H_
+#define RUNNER_LOG_JOURNAL_WATCHER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+
+#include "event_loop.h"
+#include "log_journal.h"
+
+// Follows a LogJournal directory with inotify instead of polling.
+//
+// LogJournal::Commit() stores the committed size with pwrite(), which
+// inotify reports as IN_MODIFY; segment creation and deletion arrive as
+// IN_CREATE and IN_DELETE. Each batch of events wakes the loop once and the
+// reader hands over every whole line committed since the cursor, straight
+// from the mapping.
+class LogJournalWatcher {
+ public:
+  // Receives committed whole lines, on the loop thread. |data| is only
+  // valid during the call.
+  using LinesCallback = std::function<void(const char* data, size_t size)>;
+
+  LogJournalWatcher(EventLoop* loop, std::filesystem::path directory);
+  ~LogJournalWatcher();
+
+  LogJournalWatcher(const LogJournalWatcher&) = delete;
+  LogJournalWatcher& operator=(const LogJournalWatcher&) = delete;
+
+  // Safe from any thread. Delivers what is already committed past |cursor|,
+  // then follows new commits. Returns false if the directory cannot be
+  // watched.
+  bool Start(uint64_t cursor, LinesCallback on_lines);
+  // Safe from any thread.
+  void Stop();
+
+  // Position after the last line delivered. Loop thread only.
+  uint64_t cursor() const { return cursor_; }
+
+ private:
+  void OnReadable();
+  void Deliver();
+  void Close();
+
+  EventLoop* loop_;
+  LogJournalReader reader_;
+  LinesCallback on_lines_;
+  int inotify_fd_ = -1;
+  uint64_t cursor_ = 0;
+};
+
+#endif  // RUNNER_LOG_JOURNAL_WATCHER_H_
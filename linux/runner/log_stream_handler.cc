@@ -0,0 +1,69 @@
+#include "log_stream_handler.h"
+
+LogStreamHandler::LogStreamHandler(FlBinaryMessenger* messenger, BinaryEventChannel* events, LogRing* ring,
+                                   LogStore* store, LogJournal* journal)
+    : events_(events), ring_(ring), store_(store), journal_(journal) {
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_event_channel_new(messenger, "com.hwl.hwl-vpn/logs", FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(channel_, OnListen, OnCancel, this, nullptr);
+}
+
+LogStreamHandler::~LogStreamHandler() {
+  g_clear_object(&channel_);
+}
+
+void LogStreamHandler::SendLog(const std::string& log) {
+  FlushLogs();
+  store_->AppendLine(log);
+  std::string line = log.empty() || log.back() != '\n' ? log + "\n" : log;
+  journal_->Append(line.data(), line.size());
+  journal_->Commit();
+  if (!listening_) {
+    return;
+  }
+  g_autoptr(FlValue) event = fl_value_new_string_sized(log.data(), log.size());
+  Send(event);
+}
+
+void LogStreamHandler::FlushLogs() {
+  // Lines go straight from the ring into the outgoing message.
+  EventFrameWriter* frames = events_->frames();
+  frames->BeginFrame(EventKind::kLogBatch);
+  size_t lines = ring_->Drain([this, frames](const char* data, size_t size) {
+    store_->Append(data, size);
+    journal_->Append(data, size);
+    if (listening_) {
+      frames->PutBytes(data, size);
+    }
+  });
+  if (lines > 0) {
+    journal_->Commit();
+  }
+  if (frames->frame_size() > 0) {
+    frames->EndFrame();
+  } else {
+    frames->CancelFrame();
+  }
+  events_->Flush();
+}
+
+void LogStreamHandler::Send(FlValue* event) {
+  g_autoptr(GError) error = nullptr;
+  if (!fl_event_channel_send(channel_, event, nullptr, &error)) {
+    g_warning("Failed to send log event: %s", error->message);
+  }
+}
+
+FlMethodErrorResponse* LogStreamHandler::OnListen(FlEventChannel* channel, FlValue* args, gpointer user_data) {
+  LogStreamHandler* self = static_cast<LogStreamHandler*>(user_data);
+  self->listening_ = true;
+  g_autoptr(FlValue) clear = fl_value_new_string("__CLEAR_LOGS__\n");
+  self->Send(clear);
+  return nullptr;
+}
+
+FlMethodErrorResponse* LogStreamHandler::OnCancel(FlEventChannel* channel, FlValue* args, gpointer user_data) {
+  LogStreamHandler* self = static_cast<LogStreamHandler*>(user_data);
+  self->listening_ = false;
+  return nullptr;
+}
@@ -0,0 +1,52 @@
+#ifndef RUNNER_LOG_STREAM_HANDLER_H_
+#define RUNNER_LOG_STREAM_HANDLER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <string>
+
+#include "binary_event_channel.h"
+#include "log_journal.h"
+#include "log_ring.h"
+#include "log_store.h"
+
+// Owns the "com.hwl.hwl-vpn/logs" event channel and forwards log lines to
+// Dart while a listener is attached. Must be used on the platform thread.
+//
+// sing-box output is sent in batches: every line published to the ring since
+// the last flush goes out as one kLogBatch frame on the |BinaryEventChannel|,
+// which is flushed with it; the event channel itself carries the runner's
+// status messages. Everything sent is also kept in the bounded |LogStore| and
+// written to the |LogJournal|, whether or not Dart is listening.
+class LogStreamHandler {
+ public:
+  LogStreamHandler(FlBinaryMessenger* messenger, BinaryEventChannel* events, LogRing* ring, LogStore* store,
+                   LogJournal* journal);
+  ~LogStreamHandler();
+
+  LogStreamHandler(const LogStreamHandler&) = delete;
+  LogStreamHandler& operator=(const LogStreamHandler&) = delete;
+
+  // Sends a runner status message. Pending ring output is flushed first so
+  // ordering is preserved.
+  void SendLog(const std::string& log);
+
+  // Drains the ring into the store and a single frame, and flushes the
+  // event channel.
+  void FlushLogs();
+
+ private:
+  static FlMethodErrorResponse* OnListen(FlEventChannel* channel, FlValue* args, gpointer user_data);
+  static FlMethodErrorResponse* OnCancel(FlEventChannel* channel, FlValue* args, gpointer user_data);
+
+  void Send(FlValue* event);
+
+  FlEventChannel* channel_ = nullptr;
+  bool listening_ = false;
+  BinaryEventChannel* events_;
+  LogRing* ring_;
+  LogStore* store_;
+  LogJournal* journal_;
+};
+
+#endif  // RUNNER_LOG_STREAM_HANDLER_H_
@@ -1,6 +1,15 @@
+#include <signal.h>
+
 #include "my_application.h"
+#include "startup_trace.h"
 
 int main(int argc, char** argv) {
+  ProcessStartupTrace().Mark(StartupStage::kMainEntry);
+
+  // Writes to the sing-box stdin pipe must fail with EPIPE rather than kill
+  // the runner when the child exits early.
+  signal(SIGPIPE, SIG_IGN);
+
   g_autoptr(MyApplication) app = my_application_new();
   return g_application_run(G_APPLICATION(app), argc, argv);
 }
@@ -4,20 +4,1553 @@
 #ifdef GDK_WINDOWING_X11
 #include <gdk/gdkx.h>
 #endif
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "flutter/generated_plugin_registrant.h"
+#include "binary_event_channel.h"
+#include "child_cgroup.h"
+#include "clash_api.h"
+#include "config_builder.h"
+#include "dns_bench.h"
+#include "dns_benchmarker.h"
+#include "event_loop.h"
+#include "helper_client.h"
+#include "helper_protocol.h"
+#include "latency_prober.h"
+#include "log_journal.h"
+#include "log_ring.h"
+#include "log_store.h"
+#include "log_stream_handler.h"
+#include "network_monitor.h"
+#include "process_manager.h"
+#include "resource_monitor.h"
+#include "server_cache.h"
+#include "speed_tester.h"
+#include "split_tunnel.h"
+#include "start_timeline.h"
+#include "startup_trace.h"
+#include "traffic_sampler.h"
 
 struct _MyApplication {
   GtkApplication parent_instance;
   char** dart_entrypoint_arguments;
+
+  // Shared I/O thread for the native services below.
+  EventLoop* event_loop;
+
+  // The process manager for sing-box.
+  ProcessManager* process_manager;
+
+  // Set when the tunnel helper (linux/helper) answered at startup. It then
+  // runs sing-box, its cgroup and the split tunnel in place of the process
+  // manager and the services below that drive it, which stay idle.
+  HelperClient* helper_client;
+
+  // sing-box's cgroup, limited from startService, and the sampler behind
+  // getResourceHistory and onResourcePressure.
+  ChildCgroup* child_cgroup;
+  ResourceMonitor* resource_monitor;
+
+  // Routes the per-app proxy list around or into the TUN.
+  SplitTunnel* split_tunnel;
+
+  // Builds sing-box configs from a share link and the user settings.
+  ConfigBuilder* config_builder;
+  // Required by the Clash API of every config built; random per run.
+  gchar* clash_api_secret;
+
+  // Measures server round trips for probeServers.
+  LatencyProber* latency_prober;
+
+  // Runs runSpeedTest through the mixed inbound.
+  SpeedTester* speed_tester;
+
+  // Runs benchmarkDns, and keeps the winner on each network for configs
+  // whose dns_provider is "auto".
+  DnsBenchmarker* dns_benchmarker;
+  DnsAutoSelector* dns_auto_selector;
+  // Whether the latest config asked for "auto", and the mixed inbound it
+  // opens, for the benchmarks run in the background.
+  gboolean dns_auto;
+  gchar* dns_proxy_ip;
+  uint16_t dns_proxy_port;
+
+  // Follows the running sing-box's Clash API for the traffic sample frames
+  // and getTrafficHistory.
+  TrafficSampler* traffic_sampler;
+
+  // Interface table behind getIpAddress and onNetworkChanged.
+  NetworkMonitor* network_monitor;
+
+  // The mapped country list behind listCountries, listCountry and
+  // lookupServer. saveServerCache writes new lists on its own thread.
+  ServerCache* server_cache;
+  std::thread* server_cache_writer;
+
+  // sing-box output, filled on the event loop thread and drained here in
+  // batches.
+  LogRing* log_ring;
+  guint log_flush_source;
+
+  // Bounded history Dart pages through with getLogs.
+  LogStore* log_store;
+
+  // On-disk copy of the history that survives restarts.
+  LogJournal* log_journal;
+
+  // The method channel for communication with Dart.
+  FlMethodChannel* channel;
+
+  // The raw channel for log batches, traffic samples and probe results.
+  // Flushed with every log flush.
+  BinaryEventChannel* events;
+
+  // The event channel for logs.
+  LogStreamHandler* log_handler;
+
+  // Gives up waiting for the first Dart call when HWL_STARTUP_TRACE is set.
+  guint startup_trace_source;
 };
 
 G_DEFINE_TYPE(MyApplication, my_application, GTK_TYPE_APPLICATION)
 
+static constexpr guint kLogFlushIntervalMs = 100;
+static constexpr size_t kLogHighWaterBytes = 64 * 1024;
+static constexpr int64_t kDefaultLogPageLines = 500;
+static constexpr int64_t kDefaultSearchLimit = 1000;
+static constexpr int64_t kDefaultProbeTimeoutMs = 2000;
+static constexpr guint kStartupTraceWaitS = 10;
+
+// Returns the integer argument |key| from |args|, or |fallback|.
+static int64_t lookup_int_arg(FlValue* args, const gchar* key, int64_t fallback) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return fallback;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_INT) {
+    return fallback;
+  }
+  return fl_value_get_int(value);
+}
+
+// Runs |task| on the GTK main loop. Used to hop back from the event loop
+// thread, the same way the Windows runner posts window messages.
+static void run_on_main_thread(std::function<void()> task) {
+  g_idle_add_full(
+      G_PRIORITY_DEFAULT,
+      [](gpointer data) -> gboolean {
+        (*static_cast<std::function<void()>*>(data))();
+        return G_SOURCE_REMOVE;
+      },
+      new std::function<void()>(std::move(task)),
+      [](gpointer data) { delete static_cast<std::function<void()>*>(data); });
+}
+
+// Returns the string argument |key| from |args|, or nullptr.
+static const gchar* lookup_string_arg(FlValue* args, const gchar* key) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_STRING) {
+    return nullptr;
+  }
+  return fl_value_get_string(value);
+}
+
+// Returns the string list argument |key| from |args|; other entries are
+// skipped.
+static std::vector<std::string> lookup_string_list_arg(FlValue* args, const gchar* key) {
+  std::vector<std::string> items;
+  FlValue* list = fl_value_lookup_string(args, key);
+  if (list == nullptr || fl_value_get_type(list) != FL_VALUE_TYPE_LIST) {
+    return items;
+  }
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* item = fl_value_get_list_value(list, i);
+    if (fl_value_get_type(item) == FL_VALUE_TYPE_STRING) {
+      items.emplace_back(fl_value_get_string(item));
+    }
+  }
+  return items;
+}
+
+static bool lookup_bool_arg(FlValue* args, const gchar* key) {
+  FlValue* value = fl_value_lookup_string(args, key);
+  return value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_BOOL && fl_value_get_bool(value);
+}
+
+// The network "auto" DNS winners are kept for.
+static std::string current_dns_network(MyApplication* self) {
+  std::shared_ptr<const NetworkSnapshot> snapshot = self->network_monitor->snapshot();
+  return DnsNetworkKey(snapshot->default_interface, snapshot->gateway);
+}
+
+// Whether the tunnel is up, in this process or in the tunnel helper.
+static bool tunnel_running(MyApplication* self) {
+  return self->helper_client != nullptr ? self->helper_client->state() == HelperTunnelState::kRunning
+                                        : self->process_manager->IsRunning();
+}
+
+// Receives every run's result, the provider PickDnsProvider() chose from
+// them, empty when none answered, and why the benchmark stopped early.
+using DnsBenchDone =
+    std::function<void(const std::vector<DnsBenchResult>& results, const std::string& winner, const std::string& error)>;
+
+static void refresh_dns_auto(MyApplication* self);
+
+// Benchmarks the DNS providers and keeps the winner for the current
+// network. While sing-box runs the TUN would hijack direct queries, so
+// only tunnel runs are made then, and those need the mixed inbound in
+// |options|. |done| runs on the main thread. Returns false while another
+// benchmark runs.
+static bool start_dns_benchmark(MyApplication* self, DnsBenchOptions options, DnsBenchDone done) {
+  bool connected = tunnel_running(self);
+  options.direct = !connected;
+  if (!connected) {
+    options.proxy_port = 0;
+  }
+  std::string network = current_dns_network(self);
+  std::chrono::milliseconds timeout = options.timeout;
+  return self->dns_benchmarker->Start(
+      std::move(options), [self, network, connected, timeout, done = std::move(done)](
+                              const std::vector<DnsBenchResult>& results, const std::string& error) {
+        run_on_main_thread([self, network, connected, timeout, done, results, error]() {
+          if (self->process_manager == nullptr) {
+            return;
+          }
+          std::string winner = PickDnsProvider(results, timeout);
+          if (connected != tunnel_running(self)) {
+            // sing-box started or stopped underneath, so some runs went a
+            // different way than planned. Try again as things are now.
+            refresh_dns_auto(self);
+          } else if (!winner.empty()) {
+            self->dns_auto_selector->Record(network, winner);
+            self->log_handler->SendLog("🧭 Fastest DNS on " + network + ": " + winner + ".\n");
+          }
+          if (done) {
+            done(results, winner, error);
+          }
+        });
+      });
+}
+
+// Benchmarks in the background when "auto" is in use and the current
+// network has no winner yet. The winner takes effect with the next start
+// or switch.
+static void refresh_dns_auto(MyApplication* self) {
+  if (!self->dns_auto || !self->dns_auto_selector->Winner(current_dns_network(self)).empty()) {
+    return;
+  }
+  DnsBenchOptions options;
+  // sing-box asks its server over TCP.
+  options.udp = false;
+  options.proxy_ip = self->dns_proxy_ip != nullptr ? self->dns_proxy_ip : "";
+  options.proxy_port = self->dns_proxy_port;
+  if (tunnel_running(self) && options.proxy_port == 0) {
+    // Nothing can be measured until the next disconnect.
+    return;
+  }
+  // A busy benchmarker is fine; the next change asks again.
+  start_dns_benchmark(self, std::move(options), nullptr);
+}
+
+// Reads the "link" and the "settings" map VpnService builds from |args|,
+// with the DNS provider already resolved. Returns false when either is
+// missing.
+static bool resolve_settings(MyApplication* self, FlValue* args, ConfigSettings* settings_out, std::string* link_out) {
+  const gchar* link = lookup_string_arg(args, "link");
+  FlValue* settings_value = link != nullptr ? fl_value_lookup_string(args, "settings") : nullptr;
+  if (settings_value == nullptr || fl_value_get_type(settings_value) != FL_VALUE_TYPE_MAP) {
+    return false;
+  }
+
+  ConfigSettings& settings = *settings_out;
+  const gchar* dns_provider = lookup_string_arg(settings_value, "dns_provider");
+  settings.dns_provider = dns_provider != nullptr ? dns_provider : "";
+  self->dns_auto = settings.dns_provider == kAutoDnsProvider;
+  if (self->dns_auto) {
+    // Google's until a benchmark picks a winner for this network.
+    settings.dns_provider = self->dns_auto_selector->Winner(current_dns_network(self));
+  }
+  settings.enable_logging = lookup_bool_arg(settings_value, "enable_logging");
+  settings.use_mixed_inbound = lookup_bool_arg(settings_value, "use_mixed_inbound");
+  const gchar* listen_address = lookup_string_arg(settings_value, "mixed_inbound_listen_address");
+  settings.mixed_inbound_listen_address = listen_address != nullptr ? listen_address : "";
+  settings.mixed_inbound_listen_port = lookup_int_arg(settings_value, "mixed_inbound_listen_port", 0);
+  g_clear_pointer(&self->dns_proxy_ip, g_free);
+  self->dns_proxy_port = 0;
+  if (settings.use_mixed_inbound) {
+    self->dns_proxy_ip = g_strdup(MixedInboundDialAddress(settings.mixed_inbound_listen_address).c_str());
+    self->dns_proxy_port = static_cast<uint16_t>(std::clamp<int64_t>(settings.mixed_inbound_listen_port, 0, 65535));
+  }
+  refresh_dns_auto(self);
+  settings.excluded_domains = lookup_string_list_arg(settings_value, "excluded_domains");
+  settings.excluded_domain_suffixes = lookup_string_list_arg(settings_value, "excluded_domain_suffixes");
+  settings.clash_api_port = lookup_int_arg(settings_value, "clash_api_port", 0);
+  *link_out = link;
+  return true;
+}
+
+// Reads the sing-box config from |args|: either a ready "config" string or
+// a "link" with its "settings", turned into a config here. Returns false
+// with |error| set when neither is usable.
+static bool resolve_config(MyApplication* self, FlValue* args, std::string* config, std::string* error) {
+  const gchar* ready = lookup_string_arg(args, "config");
+  if (ready != nullptr) {
+    *config = ready;
+    return true;
+  }
+  ConfigSettings settings;
+  std::string link;
+  if (!resolve_settings(self, args, &settings, &link)) {
+    *error = "Missing 'config' argument.";
+    return false;
+  }
+  g_autofree gchar* rule_set_dir = g_build_filename(g_get_user_data_dir(), APPLICATION_ID, "rule-sets", nullptr);
+  settings.rule_set_directory = rule_set_dir;
+  settings.clash_api_secret = self->clash_api_secret;
+  return self->config_builder->Build(settings, link, config, error);
+}
+
+// $XDG_DATA_HOME/<application id>/servers.bin, next to the log journal.
+static std::string server_cache_path() {
+  g_autofree gchar* path = g_build_filename(g_get_user_data_dir(), APPLICATION_ID, "servers.bin", nullptr);
+  return path;
+}
+
+// Reads the ServerCache::kKeySize byte "key" from |args|.
+static bool lookup_server_cache_key(FlValue* args, std::string* key) {
+  FlValue* value = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                       ? fl_value_lookup_string(args, "key")
+                       : nullptr;
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_UINT8_LIST ||
+      fl_value_get_length(value) != ServerCache::kKeySize) {
+    return false;
+  }
+  key->assign(reinterpret_cast<const char*>(fl_value_get_uint8_list(value)), ServerCache::kKeySize);
+  return true;
+}
+
+// Reads the string |key| of |args| into |out|; false when it is null or
+// missing.
+static bool lookup_optional_string_arg(FlValue* args, const gchar* key, std::string* out) {
+  const gchar* value = lookup_string_arg(args, key);
+  *out = value != nullptr ? value : "";
+  return value != nullptr;
+}
+
+// Builds a map in the shape of the Dart Server model's toJson.
+static FlValue* cached_server_value(const CachedServer& server) {
+  auto optional = [](bool present, const std::string& text) {
+    return present ? fl_value_new_string(text.c_str()) : fl_value_new_null();
+  };
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "name", fl_value_new_string(server.name.c_str()));
+  fl_value_set_string_take(value, "uuid", fl_value_new_string(server.uuid.c_str()));
+  fl_value_set_string_take(value, "ip", optional(server.has_ip, server.ip));
+  fl_value_set_string_take(value, "has_vless", fl_value_new_bool(server.has_vless));
+  fl_value_set_string_take(value, "has_ssh", fl_value_new_bool(server.has_ssh));
+  fl_value_set_string_take(value, "has_hysteria2", fl_value_new_bool(server.has_hysteria2));
+  fl_value_set_string_take(value, "status", fl_value_new_string(server.status.c_str()));
+  fl_value_set_string_take(value, "vless_link", optional(server.has_vless_link, server.vless_link));
+  fl_value_set_string_take(value, "ssh_link", optional(server.has_ssh_link, server.ssh_link));
+  fl_value_set_string_take(value, "hysteria2_link", optional(server.has_hysteria2_link, server.hysteria2_link));
+  return value;
+}
+
+static void join_server_cache_writer(MyApplication* self) {
+  if (self->server_cache_writer != nullptr) {
+    self->server_cache_writer->join();
+    delete self->server_cache_writer;
+    self->server_cache_writer = nullptr;
+  }
+}
+
+// Replaces the server cache with "countries", a list in the shape of the
+// Dart Country model's toJson, encrypting the links under "key". Responds
+// asynchronously with whether the new file is in place.
+static FlMethodResponse* save_server_cache(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  std::string key;
+  FlValue* list = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                      ? fl_value_lookup_string(args, "countries")
+                      : nullptr;
+  if (!lookup_server_cache_key(args, &key) || list == nullptr || fl_value_get_type(list) != FL_VALUE_TYPE_LIST) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing 'key' or 'countries' argument.", nullptr));
+  }
+  std::vector<CachedCountry> countries;
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* item = fl_value_get_list_value(list, i);
+    CachedCountry country;
+    FlValue* servers = fl_value_get_type(item) == FL_VALUE_TYPE_MAP ? fl_value_lookup_string(item, "servers") : nullptr;
+    if (!lookup_optional_string_arg(item, "name", &country.name) || servers == nullptr ||
+        fl_value_get_type(servers) != FL_VALUE_TYPE_LIST) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Invalid country.", nullptr));
+    }
+    lookup_optional_string_arg(item, "code", &country.code);
+    for (size_t j = 0; j < fl_value_get_length(servers); j++) {
+      FlValue* entry = fl_value_get_list_value(servers, j);
+      CachedServer server;
+      if (!lookup_optional_string_arg(entry, "uuid", &server.uuid) ||
+          !lookup_optional_string_arg(entry, "name", &server.name)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Invalid server.", nullptr));
+      }
+      if (!lookup_optional_string_arg(entry, "status", &server.status)) {
+        server.status = "subscribe";
+      }
+      server.has_ip = lookup_optional_string_arg(entry, "ip", &server.ip);
+      server.has_vless = lookup_bool_arg(entry, "has_vless");
+      server.has_ssh = lookup_bool_arg(entry, "has_ssh");
+      server.has_hysteria2 = lookup_bool_arg(entry, "has_hysteria2");
+      server.has_vless_link = lookup_optional_string_arg(entry, "vless_link", &server.vless_link);
+      server.has_ssh_link = lookup_optional_string_arg(entry, "ssh_link", &server.ssh_link);
+      server.has_hysteria2_link = lookup_optional_string_arg(entry, "hysteria2_link", &server.hysteria2_link);
+      country.servers.push_back(std::move(server));
+    }
+    countries.push_back(std::move(country));
+  }
+
+  // Each save writes its own temporary file, so a slow rename on the main
+  // loop never races the next writer.
+  static uint64_t next_save = 0;
+  std::string path = server_cache_path();
+  std::string file = path + "." + std::to_string(next_save++) + ".tmp";
+  join_server_cache_writer(self);
+  g_object_ref(method_call);
+  self->server_cache_writer =
+      new std::thread([self, method_call, countries = std::move(countries), key, path, file]() {
+        bool written = ServerCache::Write(file, countries, key);
+        run_on_main_thread([self, method_call, written, key, path, file]() {
+          bool saved = written && self->server_cache->Replace(file, path, key);
+          g_autoptr(FlValue) result = fl_value_new_bool(saved);
+          g_autoptr(FlMethodResponse) response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+          g_autoptr(GError) error = nullptr;
+          if (!fl_method_call_respond(method_call, response, &error)) {
+            g_warning("Failed to send method call response: %s", error->message);
+          }
+          g_object_unref(method_call);
+        });
+      });
+  return nullptr;
+}
+
+// Returns [{name, code, servers}] with each country's server count, or
+// null when there is no cache readable with "key".
+static FlMethodResponse* list_countries(MyApplication* self, FlValue* args) {
+  std::string key;
+  if (!lookup_server_cache_key(args, &key)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing 'key' argument.", nullptr));
+  }
+  if (!self->server_cache->Open(server_cache_path(), key)) {
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const CountrySummary& country : self->server_cache->ListCountries()) {
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "name", fl_value_new_string(country.name.c_str()));
+    fl_value_set_string_take(value, "code", fl_value_new_string(country.code.c_str()));
+    fl_value_set_string_take(value, "servers", fl_value_new_int(static_cast<int64_t>(country.server_count)));
+    fl_value_append_take(result, value);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns the servers of the country called "name", or null when the
+// cache or the country is missing.
+static FlMethodResponse* list_country(MyApplication* self, FlValue* args) {
+  std::string key;
+  const gchar* name = lookup_string_arg(args, "name");
+  if (!lookup_server_cache_key(args, &key) || name == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing 'key' or 'name' argument.", nullptr));
+  }
+  std::vector<CachedServer> servers;
+  if (!self->server_cache->Open(server_cache_path(), key) || !self->server_cache->ListCountry(name, &servers)) {
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const CachedServer& server : servers) {
+    fl_value_append_take(result, cached_server_value(server));
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns {country, server} for the server with "uuid", or null.
+static FlMethodResponse* lookup_server(MyApplication* self, FlValue* args) {
+  std::string key;
+  const gchar* uuid = lookup_string_arg(args, "uuid");
+  if (!lookup_server_cache_key(args, &key) || uuid == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing 'key' or 'uuid' argument.", nullptr));
+  }
+  CachedServer server;
+  std::string country;
+  if (!self->server_cache->Open(server_cache_path(), key) ||
+      !self->server_cache->LookupServer(uuid, &server, &country)) {
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "country", fl_value_new_string(country.c_str()));
+  fl_value_set_string_take(result, "server", cached_server_value(server));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlMethodResponse* clear_server_cache(MyApplication* self) {
+  join_server_cache_writer(self);
+  self->server_cache->Remove(server_cache_path());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+static void invoke_update_status(MyApplication* self, const gchar* status) {
+  g_autoptr(FlValue) args = fl_value_new_string(status);
+  fl_method_channel_invoke_method(self->channel, "updateStatus", args, nullptr, nullptr, nullptr);
+}
+
+// Limits sing-box's cgroup to "memoryHighBytes", "memoryMaxBytes" and
+// "cpuMaxPercent"; "disableMemoryLimit" lifts the memory limits as on
+// mobile. Missing values mean no limit.
+static void apply_resource_limits(MyApplication* self, FlValue* args) {
+  CgroupLimits limits;
+  if (!lookup_bool_arg(args, "disableMemoryLimit")) {
+    limits.memory_high = lookup_int_arg(args, "memoryHighBytes", -1);
+    limits.memory_max = lookup_int_arg(args, "memoryMaxBytes", -1);
+  }
+  limits.cpu_max_percent = lookup_int_arg(args, "cpuMaxPercent", 0);
+  std::string error;
+  if (!self->child_cgroup->Apply(limits, &error)) {
+    self->log_handler->SendLog("⚠️ " + error + "\n");
+  }
+}
+
+// Applies the per-app proxy settings in the "settings" map of |args| to the
+// tunnel, with per_app_proxy_list naming executables on Linux. A ready
+// "config" carries no settings and leaves the current ones.
+static void apply_split_tunnel(MyApplication* self, FlValue* args) {
+  FlValue* settings_value = fl_value_lookup_string(args, "settings");
+  if (settings_value == nullptr || fl_value_get_type(settings_value) != FL_VALUE_TYPE_MAP) {
+    return;
+  }
+  SplitTunnelSettings settings;
+  settings.apps = lookup_string_list_arg(settings_value, "per_app_proxy_list");
+  const gchar* mode = lookup_string_arg(settings_value, "per_app_proxy_mode");
+  settings.mode = ParseSplitTunnelMode(lookup_bool_arg(settings_value, "per_app_proxy_enabled"),
+                                       mode != nullptr ? mode : "", settings.apps.size());
+  bool applied = false;
+  std::string error;
+  size_t moved = 0;
+  self->event_loop->RunSync([self, &settings, &applied, &error, &moved]() {
+    applied = self->split_tunnel->Apply(settings, &error);
+    moved = self->split_tunnel->moved_count();
+  });
+  if (!applied) {
+    self->log_handler->SendLog("⚠️ Split tunneling is off: " + error + "\n");
+  } else if (settings.mode != SplitTunnelMode::kOff) {
+    self->log_handler->SendLog(std::string("🔀 Split tunneling: ") +
+                               (settings.mode == SplitTunnelMode::kExclude ? "bypassing" : "tunneling only") +
+                               " the selected apps, " + std::to_string(moved) + " running.\n");
+  }
+}
+
+// What the helper needs to build and run a config of its own: the link and
+// settings, and what apply_resource_limits and apply_split_tunnel would
+// apply. The helper takes no ready "config", so that fails with |error|.
+static bool helper_tunnel_request(MyApplication* self, FlValue* args, HelperTunnelRequest* request, std::string* error) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP ||
+      !resolve_settings(self, args, &request->settings, &request->link)) {
+    *error = "Missing 'link' and 'settings' arguments.";
+    return false;
+  }
+  HelperTunnelRequest& tunnel = *request;
+  tunnel.auto_restart = !lookup_bool_arg(args, "disableAutoRestart");
+  if (!lookup_bool_arg(args, "disableMemoryLimit")) {
+    tunnel.memory_high = lookup_int_arg(args, "memoryHighBytes", -1);
+    tunnel.memory_max = lookup_int_arg(args, "memoryMaxBytes", -1);
+  }
+  tunnel.cpu_max_percent = lookup_int_arg(args, "cpuMaxPercent", 0);
+  FlValue* settings = fl_value_lookup_string(args, "settings");
+  if (settings != nullptr && fl_value_get_type(settings) == FL_VALUE_TYPE_MAP &&
+      lookup_bool_arg(settings, "per_app_proxy_enabled")) {
+    const gchar* mode = lookup_string_arg(settings, "per_app_proxy_mode");
+    tunnel.split_mode = mode != nullptr ? mode : "";
+    tunnel.split_apps = lookup_string_list_arg(settings, "per_app_proxy_list");
+  }
+  return true;
+}
+
+// Answers |method_call| with null once the helper has carried out a
+// request, or with |code| and the helper's error.
+static HelperClient::ResultCallback respond_from_helper(FlMethodCall* method_call, const gchar* code) {
+  g_object_ref(method_call);
+  std::string error_code = code;
+  return [method_call, error_code](const HelperResult& result) {
+    run_on_main_thread([method_call, error_code, result]() {
+      g_autoptr(FlMethodResponse) response =
+          result.ok ? FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr))
+                    : FL_METHOD_RESPONSE(fl_method_error_response_new(error_code.c_str(), result.text.c_str(), nullptr));
+      g_autoptr(GError) error = nullptr;
+      if (!fl_method_call_respond(method_call, response, &error)) {
+        g_warning("Failed to send method call response: %s", error->message);
+      }
+      g_object_unref(method_call);
+    });
+  };
+}
+
+static FlMethodResponse* start_service(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Invalid arguments", nullptr));
+  }
+  std::string error;
+  if (self->helper_client != nullptr) {
+    HelperTunnelRequest tunnel;
+    if (!helper_tunnel_request(self, args, &tunnel, &error)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", error.c_str(), nullptr));
+    }
+    // "Started" follows from the helper's state.
+    self->helper_client->Start(tunnel, respond_from_helper(method_call, "START_FAILED"));
+    return nullptr;
+  }
+  std::string config_json;
+  if (!resolve_config(self, args, &config_json, &error)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", error.c_str(), nullptr));
+  }
+
+  apply_resource_limits(self, args);
+  apply_split_tunnel(self, args);
+  self->process_manager->SetAutoRestart(!lookup_bool_arg(args, "disableAutoRestart"));
+
+  // "Started" follows from the ready callback.
+  if (self->process_manager->Start(config_json)) {
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  invoke_update_status(self, "Error starting process");
+  return FL_METHOD_RESPONSE(fl_method_error_response_new("START_FAILED", "Failed to start sing-box process.", nullptr));
+}
+
+// Validates the config and starts a standby sing-box for it, so a later
+// switchService with the same config only has to hand it over. Responds
+// asynchronously with {valid, output} once "sing-box check" finishes.
+static FlMethodResponse* prepare_service(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  std::string config;
+  HelperTunnelRequest tunnel;
+  std::string error;
+  if (self->helper_client != nullptr ? !helper_tunnel_request(self, args, &tunnel, &error)
+                                     : !resolve_config(self, args, &config, &error)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", error.c_str(), nullptr));
+  }
+
+  g_object_ref(method_call);
+  auto respond = [method_call](bool valid, const std::string& output) {
+    run_on_main_thread([method_call, valid, output]() {
+      g_autoptr(FlValue) result = fl_value_new_map();
+      fl_value_set_string_take(result, "valid", fl_value_new_bool(valid));
+      fl_value_set_string_take(result, "output", fl_value_new_string(output.c_str()));
+      g_autoptr(FlMethodResponse) response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      g_autoptr(GError) error = nullptr;
+      if (!fl_method_call_respond(method_call, response, &error)) {
+        g_warning("Failed to send method call response: %s", error->message);
+      }
+      g_object_unref(method_call);
+    });
+  };
+  if (self->helper_client != nullptr) {
+    self->helper_client->Prepare(tunnel, [respond](const HelperResult& result) { respond(result.ok, result.text); });
+    return nullptr;
+  }
+  self->process_manager->Prepare(config, respond);
+  return nullptr;
+}
+
+// Moves a running service to a new config. An invalid config leaves the
+// current connection untouched.
+// The helper has no standby sing-box to hand over to, so there the switch
+// is a reload, which keeps the tunnel up as well. With the tunnel down it
+// is a start, as ProcessManager::Switch() makes it.
+static FlMethodResponse* switch_service(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  std::string error;
+  if (self->helper_client != nullptr) {
+    HelperTunnelRequest tunnel;
+    if (!helper_tunnel_request(self, args, &tunnel, &error)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", error.c_str(), nullptr));
+    }
+    HelperClient::ResultCallback respond = respond_from_helper(method_call, "SWITCH_FAILED");
+    HelperClient* client = self->helper_client;
+    if (client->state() == HelperTunnelState::kStopped) {
+      client->Start(tunnel, respond);
+      return nullptr;
+    }
+    // The tunnel may also have stopped after the state was read.
+    client->Reload(tunnel, [client, tunnel, respond](const HelperResult& result) {
+      if (!result.ok && result.text == kHelperNotRunning) {
+        client->Start(tunnel, respond);
+        return;
+      }
+      respond(result);
+    });
+    return nullptr;
+  }
+  std::string config;
+  if (!resolve_config(self, args, &config, &error)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", error.c_str(), nullptr));
+  }
+
+  if (self->process_manager->Switch(config)) {
+    apply_split_tunnel(self, args);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  return FL_METHOD_RESPONSE(fl_method_error_response_new("SWITCH_FAILED", "Failed to switch sing-box config.", nullptr));
+}
+
+// Applies a new config to the running service without a stop and start,
+// answering {path, sections, elapsedMs, error} once it is running or was
+// rejected, in which case the current config keeps running.
+static FlMethodResponse* reload_config(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  std::string config;
+  HelperTunnelRequest tunnel;
+  std::string error;
+  if (self->helper_client != nullptr ? !helper_tunnel_request(self, args, &tunnel, &error)
+                                     : !resolve_config(self, args, &config, &error)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", error.c_str(), nullptr));
+  }
+
+  if (self->helper_client != nullptr && self->helper_client->state() != HelperTunnelState::kRunning) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("NOT_RUNNING", "sing-box is not running.", nullptr));
+  }
+
+  g_object_ref(method_call);
+  auto respond = [method_call](const ReloadResult& reload) {
+    run_on_main_thread([method_call, reload]() {
+      g_autoptr(FlValue) result = fl_value_new_map();
+      fl_value_set_string_take(result, "path", fl_value_new_string(ReloadPathName(reload.path)));
+      FlValue* sections = fl_value_new_list();
+      for (const std::string& section : reload.sections) {
+        fl_value_append_take(sections, fl_value_new_string(section.c_str()));
+      }
+      fl_value_set_string_take(result, "sections", sections);
+      fl_value_set_string_take(result, "elapsedMs", fl_value_new_int(reload.elapsed_ms));
+      fl_value_set_string_take(result, "error",
+                               reload.error.empty() ? fl_value_new_null() : fl_value_new_string(reload.error.c_str()));
+      g_autoptr(FlMethodResponse) response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      g_autoptr(GError) respond_error = nullptr;
+      if (!fl_method_call_respond(method_call, response, &respond_error)) {
+        g_warning("Failed to send method call response: %s", respond_error->message);
+      }
+      g_object_unref(method_call);
+    });
+  };
+  if (self->helper_client != nullptr) {
+    self->helper_client->Reload(tunnel, [respond](const HelperResult& result) {
+      ReloadResult reload;
+      reload.path = result.path;
+      reload.sections = result.sections;
+      reload.elapsed_ms = result.elapsed_ms;
+      reload.error = result.ok ? "" : result.text;
+      respond(reload);
+    });
+    return nullptr;
+  }
+  bool running = self->process_manager->Reload(config, respond);
+  if (!running) {
+    g_object_unref(method_call);
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("NOT_RUNNING", "sing-box is not running.", nullptr));
+  }
+  apply_split_tunnel(self, args);
+  return nullptr;
+}
+
+// Probes every {id, ip, port, proto, sni} in "targets" at once. Each result
+// is queued for Dart as a kProbeResult frame as soon as it is known, with
+// rtt_us -1 for no answer within "timeoutMs"; the call itself completes after
+// the last one.
+static FlMethodResponse* probe_servers(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  FlValue* list = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                      ? fl_value_lookup_string(args, "targets")
+                      : nullptr;
+  if (list == nullptr || fl_value_get_type(list) != FL_VALUE_TYPE_LIST) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing 'targets' argument.", nullptr));
+  }
+  std::vector<ProbeTarget> targets;
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* item = fl_value_get_list_value(list, i);
+    const gchar* id = lookup_string_arg(item, "id");
+    const gchar* ip = lookup_string_arg(item, "ip");
+    const gchar* proto = lookup_string_arg(item, "proto");
+    const gchar* sni = lookup_string_arg(item, "sni");
+    ProbeTarget target;
+    if (id == nullptr || ip == nullptr || !ParseProbeProtocol(proto != nullptr ? proto : "tcp", &target.protocol)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Invalid probe target.", nullptr));
+    }
+    target.id = id;
+    target.ip = ip;
+    target.port = static_cast<uint16_t>(std::clamp<int64_t>(lookup_int_arg(item, "port", 0), 0, 65535));
+    target.sni = sni != nullptr ? sni : "";
+    targets.push_back(std::move(target));
+  }
+  int64_t timeout_ms = std::max<int64_t>(lookup_int_arg(args, "timeoutMs", kDefaultProbeTimeoutMs), 1);
+
+  g_object_ref(method_call);
+  self->latency_prober->Probe(
+      std::move(targets), std::chrono::milliseconds(timeout_ms),
+      [self](const std::string& id, int64_t rtt_us) {
+        run_on_main_thread([self, id, rtt_us]() {
+          if (self->events != nullptr) {
+            self->events->frames()->AppendProbeResult(id, rtt_us);
+          }
+        });
+      },
+      [self, method_call]() {
+        // Queued after the last result, and the results are flushed first,
+        // so Dart has every one by the time the call completes.
+        run_on_main_thread([self, method_call]() {
+          if (self->events != nullptr) {
+            self->events->Flush();
+          }
+          g_autoptr(FlMethodResponse) response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+          g_autoptr(GError) error = nullptr;
+          if (!fl_method_call_respond(method_call, response, &error)) {
+            g_warning("Failed to send method call response: %s", error->message);
+          }
+          g_object_unref(method_call);
+        });
+      });
+  return nullptr;
+}
+
+static FlValue* speed_test_result_value(const SpeedTestResult& result) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "phase", fl_value_new_string(SpeedTestPhaseName(result.phase)));
+  fl_value_set_string_take(value, "bytes", fl_value_new_int(static_cast<int64_t>(result.bytes)));
+  fl_value_set_string_take(value, "goodputBps", fl_value_new_float(result.goodput_bps));
+  fl_value_set_string_take(value, "rttSamples", fl_value_new_int(static_cast<int64_t>(result.rtt_samples)));
+  fl_value_set_string_take(value, "rttP50Us", fl_value_new_int(result.rtt_p50_us));
+  fl_value_set_string_take(value, "rttP99Us", fl_value_new_int(result.rtt_p99_us));
+  fl_value_set_string_take(value, "jitterUs", fl_value_new_int(result.jitter_us));
+  fl_value_set_string_take(value, "datagramsSent", fl_value_new_int(static_cast<int64_t>(result.datagrams_sent)));
+  fl_value_set_string_take(value, "datagramsLost", fl_value_new_int(static_cast<int64_t>(result.datagrams_lost)));
+  fl_value_set_string_take(value, "failedStreams", fl_value_new_int(static_cast<int64_t>(result.failed_streams)));
+  return value;
+}
+
+// Measures throughput through the mixed inbound at "proxyHost":"proxyPort":
+// "downloadUrl" and "uploadUrl" over "streams" parallel connections, then
+// the UDP echo service at "udpEchoHost":"udpEchoPort", each for
+// "durationMs". Any of the three may be left out. Progress goes to Dart as
+// onSpeedTestProgress {phase, elapsedMs, bytes, bps} every quarter second;
+// the call completes with {phases, error} after the last phase.
+static FlMethodResponse* run_speed_test(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing speed test arguments.", nullptr));
+  }
+  SpeedTestOptions options;
+  const gchar* proxy_host = lookup_string_arg(args, "proxyHost");
+  options.proxy_ip = MixedInboundDialAddress(proxy_host != nullptr ? proxy_host : "");
+  options.proxy_port = static_cast<uint16_t>(std::clamp<int64_t>(lookup_int_arg(args, "proxyPort", 0), 0, 65535));
+  const gchar* download_url = lookup_string_arg(args, "downloadUrl");
+  const gchar* upload_url = lookup_string_arg(args, "uploadUrl");
+  if ((download_url != nullptr && !ParseHttpUrl(download_url, &options.download_url)) ||
+      (upload_url != nullptr && !ParseHttpUrl(upload_url, &options.upload_url))) {
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("ARG_ERROR", "Speed test URLs must be http:// URLs.", nullptr));
+  }
+  const gchar* udp_echo_host = lookup_string_arg(args, "udpEchoHost");
+  options.udp_echo_host = udp_echo_host != nullptr ? udp_echo_host : "";
+  options.udp_echo_port =
+      static_cast<uint16_t>(std::clamp<int64_t>(lookup_int_arg(args, "udpEchoPort", 0), 0, 65535));
+  options.streams = static_cast<size_t>(
+      std::clamp<int64_t>(lookup_int_arg(args, "streams", 4), 1, static_cast<int64_t>(kMaxSpeedTestStreams)));
+  options.phase_duration =
+      std::chrono::milliseconds(std::clamp<int64_t>(lookup_int_arg(args, "durationMs", 10000), 1000, 60000));
+  options.upload_size =
+      static_cast<uint64_t>(std::max<int64_t>(lookup_int_arg(args, "uploadBytes", 16 << 20), 1));
+  if (options.proxy_port == 0 || PlannedSpeedTestPhases(options).empty()) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Nothing to test.", nullptr));
+  }
+
+  g_object_ref(method_call);
+  bool started = self->speed_tester->Start(
+      std::move(options),
+      [self](SpeedTestPhase phase, int64_t elapsed_ms, uint64_t bytes, double bps) {
+        run_on_main_thread([self, phase, elapsed_ms, bytes, bps]() {
+          g_autoptr(FlValue) progress = fl_value_new_map();
+          fl_value_set_string_take(progress, "phase", fl_value_new_string(SpeedTestPhaseName(phase)));
+          fl_value_set_string_take(progress, "elapsedMs", fl_value_new_int(elapsed_ms));
+          fl_value_set_string_take(progress, "bytes", fl_value_new_int(static_cast<int64_t>(bytes)));
+          fl_value_set_string_take(progress, "bps", fl_value_new_float(bps));
+          fl_method_channel_invoke_method(self->channel, "onSpeedTestProgress", progress, nullptr, nullptr, nullptr);
+        });
+      },
+      [method_call](const std::vector<SpeedTestResult>& results, const std::string& error) {
+        run_on_main_thread([method_call, results, error]() {
+          g_autoptr(FlMethodResponse) response = nullptr;
+          if (results.empty() && !error.empty()) {
+            response = FL_METHOD_RESPONSE(fl_method_error_response_new("SPEED_TEST_FAILED", error.c_str(), nullptr));
+          } else {
+            g_autoptr(FlValue) value = fl_value_new_map();
+            FlValue* phases = fl_value_new_list();
+            for (const SpeedTestResult& result : results) {
+              fl_value_append_take(phases, speed_test_result_value(result));
+            }
+            fl_value_set_string_take(value, "phases", phases);
+            fl_value_set_string_take(value, "error",
+                                     error.empty() ? fl_value_new_null() : fl_value_new_string(error.c_str()));
+            response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+          }
+          g_autoptr(GError) respond_error = nullptr;
+          if (!fl_method_call_respond(method_call, response, &respond_error)) {
+            g_warning("Failed to send method call response: %s", respond_error->message);
+          }
+          g_object_unref(method_call);
+        });
+      });
+  if (!started) {
+    g_object_unref(method_call);
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("BUSY", "A speed test is already running.", nullptr));
+  }
+  return nullptr;
+}
+
+static FlValue* dns_bench_result_value(const DnsBenchResult& result) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "provider", fl_value_new_string(result.run.target.provider.c_str()));
+  fl_value_set_string_take(value, "address", fl_value_new_string(result.run.target.address.c_str()));
+  fl_value_set_string_take(value, "transport", fl_value_new_string(DnsTransportName(result.run.transport)));
+  fl_value_set_string_take(value, "route", fl_value_new_string(DnsRouteName(result.run.route)));
+  fl_value_set_string_take(value, "queries", fl_value_new_int(static_cast<int64_t>(result.queries)));
+  fl_value_set_string_take(value, "failures", fl_value_new_int(static_cast<int64_t>(result.failures)));
+  fl_value_set_string_take(value, "failureRate", fl_value_new_float(result.failure_rate()));
+  fl_value_set_string_take(value, "p50Us", fl_value_new_int(result.p50_us));
+  fl_value_set_string_take(value, "p95Us", fl_value_new_int(result.p95_us));
+  fl_value_set_string_take(value, "error",
+                           result.error.empty() ? fl_value_new_null() : fl_value_new_string(result.error.c_str()));
+  return value;
+}
+
+// Times "repeat" pipelined queries for each of "domains" at every known DNS
+// provider over the "transports" given, UDP and TCP by default: directly
+// while disconnected, through the mixed inbound at "proxyHost":"proxyPort"
+// while connected. Completes with {results, winner, network, error}; the
+// winner becomes the "auto" provider on that network.
+static FlMethodResponse* benchmark_dns(MyApplication* self, FlMethodCall* method_call, FlValue* args) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing benchmark arguments.", nullptr));
+  }
+  DnsBenchOptions options;
+  options.domains = lookup_string_list_arg(args, "domains");
+  options.repeat = static_cast<size_t>(std::clamp<int64_t>(lookup_int_arg(args, "repeat", 2), 1, 10));
+  options.timeout =
+      std::chrono::milliseconds(std::clamp<int64_t>(lookup_int_arg(args, "timeoutMs", 2000), 100, 10000));
+  std::vector<std::string> transports = lookup_string_list_arg(args, "transports");
+  if (!transports.empty()) {
+    options.udp = std::find(transports.begin(), transports.end(), "udp") != transports.end();
+    options.tcp = std::find(transports.begin(), transports.end(), "tcp") != transports.end();
+  }
+  const gchar* proxy_host = lookup_string_arg(args, "proxyHost");
+  options.proxy_ip = MixedInboundDialAddress(proxy_host != nullptr ? proxy_host : "");
+  options.proxy_port = static_cast<uint16_t>(std::clamp<int64_t>(lookup_int_arg(args, "proxyPort", 0), 0, 65535));
+
+  std::string network = current_dns_network(self);
+  g_object_ref(method_call);
+  bool started = start_dns_benchmark(
+      self, std::move(options),
+      [method_call, network](const std::vector<DnsBenchResult>& results, const std::string& winner,
+                             const std::string& error) {
+        g_autoptr(FlMethodResponse) response = nullptr;
+        if (results.empty() && !error.empty()) {
+          response = FL_METHOD_RESPONSE(fl_method_error_response_new("DNS_BENCH_FAILED", error.c_str(), nullptr));
+        } else {
+          g_autoptr(FlValue) value = fl_value_new_map();
+          FlValue* list = fl_value_new_list();
+          for (const DnsBenchResult& result : results) {
+            fl_value_append_take(list, dns_bench_result_value(result));
+          }
+          fl_value_set_string_take(value, "results", list);
+          fl_value_set_string_take(value, "winner",
+                                   winner.empty() ? fl_value_new_null() : fl_value_new_string(winner.c_str()));
+          fl_value_set_string_take(value, "network", fl_value_new_string(network.c_str()));
+          fl_value_set_string_take(value, "error",
+                                   error.empty() ? fl_value_new_null() : fl_value_new_string(error.c_str()));
+          response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+        }
+        g_autoptr(GError) respond_error = nullptr;
+        if (!fl_method_call_respond(method_call, response, &respond_error)) {
+          g_warning("Failed to send method call response: %s", respond_error->message);
+        }
+        g_object_unref(method_call);
+      });
+  if (!started) {
+    g_object_unref(method_call);
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("BUSY", "A DNS benchmark is already running.", nullptr));
+  }
+  return nullptr;
+}
+
+// Returns the address other devices on the LAN reach this host at, or
+// null when there is none.
+static FlMethodResponse* get_ip_address(MyApplication* self) {
+  std::shared_ptr<const NetworkSnapshot> snapshot = self->network_monitor->snapshot();
+  if (snapshot->local_ip.empty()) {
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  g_autoptr(FlValue) result = fl_value_new_string(snapshot->local_ip.c_str());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Sends onNetworkChanged {ip, gateway, interface, changes}, where changes
+// lists "address", "gateway" and "link" as they apply.
+static void invoke_network_changed(MyApplication* self, uint32_t changes, const NetworkSnapshot& snapshot) {
+  if (self->channel == nullptr) {
+    return;
+  }
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "ip", fl_value_new_string(snapshot.local_ip.c_str()));
+  fl_value_set_string_take(args, "gateway", fl_value_new_string(snapshot.gateway.c_str()));
+  fl_value_set_string_take(args, "interface", fl_value_new_string(snapshot.default_interface.c_str()));
+  FlValue* kinds = fl_value_new_list();
+  if ((changes & kNetworkAddressChanged) != 0) {
+    fl_value_append_take(kinds, fl_value_new_string("address"));
+  }
+  if ((changes & kNetworkGatewayChanged) != 0) {
+    fl_value_append_take(kinds, fl_value_new_string("gateway"));
+  }
+  if ((changes & kNetworkLinkChanged) != 0) {
+    fl_value_append_take(kinds, fl_value_new_string("link"));
+  }
+  fl_value_set_string_take(args, "changes", kinds);
+  fl_method_channel_invoke_method(self->channel, "onNetworkChanged", args, nullptr, nullptr, nullptr);
+}
+
+// Returns {startedAt, phases} for the latest start. Phase values are
+// microseconds after startedAt, -1 for phases not reached.
+static FlMethodResponse* get_start_timeline(MyApplication* self) {
+  StartTimeline::Snapshot snapshot = self->process_manager->timeline().snapshot();
+  FlValue* phases = fl_value_new_map();
+  for (size_t i = 0; i < kStartPhaseCount; i++) {
+    fl_value_set_string_take(phases, StartPhaseName(static_cast<StartPhase>(i)), fl_value_new_int(snapshot.phase_us[i]));
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "startedAt", fl_value_new_int(snapshot.started_at_ms));
+  fl_value_set_string_take(result, "phases", phases);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns the startup trace as Chrome trace-event JSON.
+static FlMethodResponse* get_startup_trace() {
+  std::string json = ProcessStartupTrace().ToChromeTraceJson(getpid());
+  g_autoptr(FlValue) result = fl_value_new_string(json.c_str());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Writes the startup trace to the file named by HWL_STARTUP_TRACE, if set,
+// and quits when HWL_STARTUP_TRACE_QUIT is 1 and the trace is complete or
+// |give_up|, so CI can time cold starts under Xvfb.
+static void dump_startup_trace(MyApplication* self, gboolean give_up) {
+  const gchar* path = g_getenv("HWL_STARTUP_TRACE");
+  if (path == nullptr || *path == '\0') {
+    return;
+  }
+  StartupTrace& trace = ProcessStartupTrace();
+  std::string json = trace.ToChromeTraceJson(getpid());
+  g_autoptr(GError) error = nullptr;
+  if (!g_file_set_contents(path, json.c_str(), static_cast<gssize>(json.size()), &error)) {
+    g_warning("Failed to write the startup trace: %s", error->message);
+  }
+  if ((trace.complete() || give_up) && g_strcmp0(g_getenv("HWL_STARTUP_TRACE_QUIT"), "1") == 0) {
+    g_application_quit(G_APPLICATION(self));
+  }
+}
+
+// Writes the trace without the first Dart call, which never came.
+static gboolean startup_trace_timeout_cb(gpointer user_data) {
+  MyApplication* self = MY_APPLICATION(user_data);
+  self->startup_trace_source = 0;
+  dump_startup_trace(self, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+// Sends onVpnRestart {kind, exitStatus, crashes, attempt, delayMs,
+// recoveryMs, restarts, recoveries, lastRecoveryMs, maxRecoveryMs,
+// totalRecoveryMs} for a step of the process manager's supervisor.
+static void invoke_restart_event(MyApplication* self, const RestartEvent& event) {
+  if (self->channel == nullptr) {
+    return;
+  }
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "kind", fl_value_new_string(RestartEventKindName(event.kind)));
+  fl_value_set_string_take(args, "exitStatus", fl_value_new_string(event.exit_status.c_str()));
+  fl_value_set_string_take(args, "crashes", fl_value_new_int(event.crashes));
+  fl_value_set_string_take(args, "attempt", fl_value_new_int(event.attempt));
+  fl_value_set_string_take(args, "delayMs", fl_value_new_int(event.delay_ms));
+  fl_value_set_string_take(args, "recoveryMs", fl_value_new_int(event.recovery_ms));
+  fl_value_set_string_take(args, "restarts", fl_value_new_int(event.stats.restarts));
+  fl_value_set_string_take(args, "recoveries", fl_value_new_int(event.stats.recoveries));
+  fl_value_set_string_take(args, "lastRecoveryMs", fl_value_new_int(event.stats.last_recovery_ms));
+  fl_value_set_string_take(args, "maxRecoveryMs", fl_value_new_int(event.stats.max_recovery_ms));
+  fl_value_set_string_take(args, "totalRecoveryMs", fl_value_new_int(event.stats.total_recovery_ms));
+  fl_method_channel_invoke_method(self->channel, "onVpnRestart", args, nullptr, nullptr, nullptr);
+}
+
+// Queues a kTrafficSample frame: one second of traffic as differences from
+// the previous sample, or absolute values when key is set. It goes out with
+// the next log flush.
+static void send_traffic_sample(MyApplication* self, const TrafficDelta& delta) {
+  if (self->events == nullptr) {
+    return;
+  }
+  self->events->frames()->AppendTrafficSample(delta);
+}
+
+// Queues a kConnectionDiff frame with what changed in the open
+// connections. It goes out with the next log flush.
+static void send_connection_diff(MyApplication* self, const ConnectionDiff& diff) {
+  if (self->events == nullptr) {
+    return;
+  }
+  self->events->frames()->AppendConnectionDiff(diff);
+}
+
+// Starts following sing-box's open connections when "enabled" is true and
+// stops otherwise. While on, kConnectionDiff frames carry what changed,
+// starting with a reset that lists them all, at most once a second.
+static FlMethodResponse* watch_connections(MyApplication* self, FlValue* args) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Invalid arguments", nullptr));
+  }
+  if (self->helper_client != nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "UNAVAILABLE", "Connections are not tracked while the tunnel helper runs sing-box.", nullptr));
+  }
+  bool enabled = lookup_bool_arg(args, "enabled");
+  self->event_loop->RunSync([self, enabled]() {
+    if (!enabled) {
+      self->traffic_sampler->TrackConnections(nullptr);
+      return;
+    }
+    self->traffic_sampler->TrackConnections([self](const ConnectionDiff& diff) {
+      auto copy = std::make_shared<ConnectionDiff>(diff);
+      run_on_main_thread([self, copy]() { send_connection_diff(self, *copy); });
+    });
+  });
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Returns {seq, up, down, connections} with the recorded samples oldest
+// first, seq numbering the newest, so a listener can fill in before
+// following the traffic sample frames.
+static FlMethodResponse* get_traffic_history(MyApplication* self) {
+  uint64_t sequence = 0;
+  std::vector<TrafficSample> samples = self->helper_client != nullptr ? self->helper_client->History(&sequence)
+                                                                     : self->traffic_sampler->History(&sequence);
+  std::vector<int64_t> up;
+  std::vector<int64_t> down;
+  std::vector<int64_t> connections;
+  for (const TrafficSample& sample : samples) {
+    up.push_back(static_cast<int64_t>(sample.up));
+    down.push_back(static_cast<int64_t>(sample.down));
+    connections.push_back(sample.connections);
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "seq", fl_value_new_int(static_cast<int64_t>(sequence)));
+  fl_value_set_string_take(result, "up", fl_value_new_int64_list(up.data(), up.size()));
+  fl_value_set_string_take(result, "down", fl_value_new_int64_list(down.data(), down.size()));
+  fl_value_set_string_take(result, "connections", fl_value_new_int64_list(connections.data(), connections.size()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Sends onResourcePressure {resource, systemWide, someAvg10, fullAvg10,
+// memoryCurrent} and logs it, so creeping memory shows before the OOM
+// killer steps in.
+static void invoke_resource_pressure(MyApplication* self, const PressureEvent& event) {
+  if (self->channel == nullptr) {
+    return;
+  }
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "resource", fl_value_new_string(PressureResourceName(event.resource)));
+  fl_value_set_string_take(args, "systemWide", fl_value_new_bool(event.system_wide));
+  fl_value_set_string_take(args, "someAvg10", fl_value_new_float(event.some_avg10));
+  fl_value_set_string_take(args, "fullAvg10", fl_value_new_float(event.full_avg10));
+  fl_value_set_string_take(args, "memoryCurrent", fl_value_new_int(static_cast<int64_t>(event.memory_current)));
+  fl_method_channel_invoke_method(self->channel, "onResourcePressure", args, nullptr, nullptr, nullptr);
+
+  g_autofree gchar* message =
+      g_strdup_printf("⚠️ %s %s pressure: stalled %.1f%% of the last 10 s", event.system_wide ? "System" : "sing-box",
+                      PressureResourceName(event.resource), event.some_avg10);
+  std::string line = message;
+  if (event.memory_current > 0) {
+    line += ", " + std::to_string(event.memory_current >> 20) + " MiB in use";
+  }
+  self->log_handler->SendLog(line + "\n");
+}
+
+// Returns {seq, cpuPercent, rssBytes, rssPeakBytes, swapBytes, threads,
+// readBytes, writeBytes, memoryCurrent, memoryAnon, memoryFile,
+// cpuThrottledUs, memoryHighEvents, memoryMaxEvents, oomKills}: one list
+// per figure with a value per second, oldest first, seq numbering the
+// newest.
+static FlMethodResponse* get_resource_history(MyApplication* self) {
+  uint64_t sequence = 0;
+  std::vector<ResourceSample> samples = self->resource_monitor->History(&sequence);
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "seq", fl_value_new_int(static_cast<int64_t>(sequence)));
+  std::vector<double> cpu;
+  for (const ResourceSample& sample : samples) {
+    cpu.push_back(sample.cpu_percent);
+  }
+  fl_value_set_string_take(result, "cpuPercent", fl_value_new_float_list(cpu.data(), cpu.size()));
+  auto add = [&samples, result](const gchar* key, uint64_t ResourceSample::*field) {
+    std::vector<int64_t> values;
+    for (const ResourceSample& sample : samples) {
+      values.push_back(static_cast<int64_t>(sample.*field));
+    }
+    fl_value_set_string_take(result, key, fl_value_new_int64_list(values.data(), values.size()));
+  };
+  add("rssBytes", &ResourceSample::rss_bytes);
+  add("rssPeakBytes", &ResourceSample::rss_peak_bytes);
+  add("swapBytes", &ResourceSample::swap_bytes);
+  add("readBytes", &ResourceSample::read_bytes);
+  add("writeBytes", &ResourceSample::write_bytes);
+  add("memoryCurrent", &ResourceSample::memory_current);
+  add("memoryAnon", &ResourceSample::memory_anon);
+  add("memoryFile", &ResourceSample::memory_file);
+  add("cpuThrottledUs", &ResourceSample::cpu_throttled_us);
+  add("memoryHighEvents", &ResourceSample::memory_high_events);
+  add("memoryMaxEvents", &ResourceSample::memory_max_events);
+  add("oomKills", &ResourceSample::oom_kills);
+  std::vector<int64_t> threads;
+  for (const ResourceSample& sample : samples) {
+    threads.push_back(sample.threads);
+  }
+  fl_value_set_string_take(result, "threads", fl_value_new_int64_list(threads.data(), threads.size()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlMethodResponse* stop_service(MyApplication* self, FlMethodCall* method_call) {
+  if (self->helper_client != nullptr) {
+    // onVpnStopped follows from the helper's state.
+    self->helper_client->Stop(respond_from_helper(method_call, "STOP_FAILED"));
+    return nullptr;
+  }
+  self->process_manager->Stop();
+  self->event_loop->RunSync([self]() {
+    self->traffic_sampler->Stop();
+    self->resource_monitor->Stop();
+    self->split_tunnel->Clear();
+  });
+  invoke_update_status(self, "Stopped");
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Returns {helper, running}: whether the tunnel helper runs sing-box, and
+// whether the tunnel is up, for a UI that starts while it already is.
+static FlMethodResponse* get_service_state(MyApplication* self) {
+  bool running = tunnel_running(self);
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "helper", fl_value_new_bool(self->helper_client != nullptr));
+  fl_value_set_string_take(result, "running", fl_value_new_bool(running));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns a page of retained log lines. A negative offset counts back from
+// the newest line.
+static FlMethodResponse* get_logs(MyApplication* self, FlValue* args) {
+  self->log_handler->FlushLogs();
+
+  int64_t limit = lookup_int_arg(args, "limit", kDefaultLogPageLines);
+  int64_t offset = lookup_int_arg(args, "offset", -limit);
+  LogStore::Page page = self->log_store->ReadPage(offset, static_cast<size_t>(std::max<int64_t>(limit, 0)));
+
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "first", fl_value_new_int(static_cast<int64_t>(page.first)));
+  fl_value_set_string_take(result, "next", fl_value_new_int(static_cast<int64_t>(page.next)));
+  fl_value_set_string_take(result, "oldest", fl_value_new_int(static_cast<int64_t>(self->log_store->first_line())));
+  fl_value_set_string_take(result, "newest", fl_value_new_int(static_cast<int64_t>(self->log_store->next_line())));
+  fl_value_set_string_take(result, "evicted", fl_value_new_int(static_cast<int64_t>(self->log_store->evicted_lines())));
+  fl_value_set_string_take(result, "droppedBytes", fl_value_new_int(static_cast<int64_t>(self->log_ring->dropped_bytes())));
+  fl_value_set_string_take(result, "data", fl_value_new_uint8_list(page.data.data(), page.data.size()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns parsed records as one binary blob; the layout is documented on
+// LogStore::ReadRecords.
+static FlMethodResponse* get_log_records(MyApplication* self, FlValue* args) {
+  self->log_handler->FlushLogs();
+
+  int64_t limit = lookup_int_arg(args, "limit", kDefaultLogPageLines);
+  int64_t offset = lookup_int_arg(args, "offset", -1);
+  int64_t level_mask = lookup_int_arg(args, "levelMask", 0xffffffff);
+  int64_t module = lookup_int_arg(args, "module", -1);
+  LogStore::Page page = self->log_store->ReadRecords(offset, static_cast<size_t>(std::max<int64_t>(limit, 0)),
+                                                     static_cast<uint32_t>(level_mask), static_cast<int>(module));
+  g_autoptr(FlValue) result = fl_value_new_uint8_list(page.data.data(), page.data.size());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns the ids of the newest lines matching the query, oldest first, and
+// their text joined by newlines.
+static FlMethodResponse* search_logs(MyApplication* self, FlValue* args) {
+  self->log_handler->FlushLogs();
+
+  FlValue* query_value = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                             ? fl_value_lookup_string(args, "query")
+                             : nullptr;
+  if (query_value == nullptr || fl_value_get_type(query_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new("ARG_ERROR", "Missing 'query' argument.", nullptr));
+  }
+  int64_t level_mask = lookup_int_arg(args, "levelMask", 0xffffffff);
+  int64_t limit = lookup_int_arg(args, "limit", kDefaultSearchLimit);
+
+  struct Match {
+    int64_t line;
+    const char* data;
+    size_t size;
+  };
+  std::vector<Match> matches;
+  self->log_store->Search(fl_value_get_string(query_value), static_cast<uint32_t>(level_mask),
+                          static_cast<size_t>(std::max<int64_t>(limit, 0)),
+                          [&matches](uint64_t line, const char* data, size_t size) {
+                            matches.push_back({static_cast<int64_t>(line), data, size});
+                          });
+
+  std::vector<int64_t> lines;
+  std::vector<uint8_t> data;
+  for (auto it = matches.rbegin(); it != matches.rend(); ++it) {
+    lines.push_back(it->line);
+    data.insert(data.end(), it->data, it->data + it->size);
+    data.push_back('\n');
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "lines", fl_value_new_int64_list(lines.data(), lines.size()));
+  fl_value_set_string_take(result, "data", fl_value_new_uint8_list(data.data(), data.size()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns the number of retained lines per log level.
+static FlMethodResponse* get_log_stats(MyApplication* self) {
+  self->log_handler->FlushLogs();
+
+  const uint64_t* counts = self->log_store->level_counts();
+  int64_t levels[kLogLevelCount];
+  for (size_t i = 0; i < kLogLevelCount; i++) {
+    levels[i] = static_cast<int64_t>(counts[i]);
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "levels", fl_value_new_int64_list(levels, kLogLevelCount));
+  fl_value_set_string_take(result, "oldest", fl_value_new_int(static_cast<int64_t>(self->log_store->first_line())));
+  fl_value_set_string_take(result, "newest", fl_value_new_int(static_cast<int64_t>(self->log_store->next_line())));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlMethodResponse* clear_logs(MyApplication* self) {
+  self->log_handler->FlushLogs();
+  self->log_store->Clear();
+  self->log_journal->Clear();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Handles calls on the "com.hwl_vpn.app/channel" method channel.
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call, gpointer user_data) {
+  MyApplication* self = MY_APPLICATION(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+  if (ProcessStartupTrace().Mark(StartupStage::kFirstDartCall) &&
+      ProcessStartupTrace().reached(StartupStage::kFirstFrame)) {
+    if (self->startup_trace_source != 0) {
+      g_source_remove(self->startup_trace_source);
+      self->startup_trace_source = 0;
+    }
+    dump_startup_trace(self, FALSE);
+  }
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "startService") == 0) {
+    response = start_service(self, method_call, args);
+    if (response == nullptr) {
+      // Answered by the tunnel helper.
+      return;
+    }
+  } else if (strcmp(method, "stopService") == 0) {
+    response = stop_service(self, method_call);
+    if (response == nullptr) {
+      // Answered by the tunnel helper.
+      return;
+    }
+  } else if (strcmp(method, "getServiceState") == 0) {
+    response = get_service_state(self);
+  } else if (strcmp(method, "prepareService") == 0) {
+    response = prepare_service(self, method_call, args);
+    if (response == nullptr) {
+      // Answered once the check finishes.
+      return;
+    }
+  } else if (strcmp(method, "reloadConfig") == 0) {
+    response = reload_config(self, method_call, args);
+    if (response == nullptr) {
+      // Answered once the new config is running.
+      return;
+    }
+  } else if (strcmp(method, "switchService") == 0) {
+    response = switch_service(self, method_call, args);
+    if (response == nullptr) {
+      // Answered by the tunnel helper.
+      return;
+    }
+  } else if (strcmp(method, "probeServers") == 0) {
+    response = probe_servers(self, method_call, args);
+    if (response == nullptr) {
+      // Answered after the last result.
+      return;
+    }
+  } else if (strcmp(method, "runSpeedTest") == 0) {
+    response = run_speed_test(self, method_call, args);
+    if (response == nullptr) {
+      // Answered after the last phase.
+      return;
+    }
+  } else if (strcmp(method, "cancelSpeedTest") == 0) {
+    self->speed_tester->Cancel();
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "benchmarkDns") == 0) {
+    response = benchmark_dns(self, method_call, args);
+    if (response == nullptr) {
+      // Answered after the last run.
+      return;
+    }
+  } else if (strcmp(method, "saveServerCache") == 0) {
+    response = save_server_cache(self, method_call, args);
+    if (response == nullptr) {
+      // Answered once the file is in place.
+      return;
+    }
+  } else if (strcmp(method, "listCountries") == 0) {
+    response = list_countries(self, args);
+  } else if (strcmp(method, "listCountry") == 0) {
+    response = list_country(self, args);
+  } else if (strcmp(method, "lookupServer") == 0) {
+    response = lookup_server(self, args);
+  } else if (strcmp(method, "clearServerCache") == 0) {
+    response = clear_server_cache(self);
+  } else if (strcmp(method, "getIpAddress") == 0) {
+    response = get_ip_address(self);
+  } else if (strcmp(method, "getStartTimeline") == 0) {
+    response = get_start_timeline(self);
+  } else if (strcmp(method, "getStartupTrace") == 0) {
+    response = get_startup_trace();
+  } else if (strcmp(method, "getTrafficHistory") == 0) {
+    response = get_traffic_history(self);
+  } else if (strcmp(method, "watchConnections") == 0) {
+    response = watch_connections(self, args);
+  } else if (strcmp(method, "getResourceHistory") == 0) {
+    response = get_resource_history(self);
+  } else if (strcmp(method, "getLogs") == 0) {
+    response = get_logs(self, args);
+  } else if (strcmp(method, "getLogRecords") == 0) {
+    response = get_log_records(self, args);
+  } else if (strcmp(method, "searchLogs") == 0) {
+    response = search_logs(self, args);
+  } else if (strcmp(method, "getLogStats") == 0) {
+    response = get_log_stats(self);
+  } else if (strcmp(method, "clearLogs") == 0) {
+    response = clear_logs(self);
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send method call response: %s", error->message);
+  }
+}
+
+// Drains the log ring on the platform thread.
+static gboolean flush_logs_cb(gpointer user_data) {
+  MyApplication* self = MY_APPLICATION(user_data);
+  if (self->log_handler) {
+    self->log_handler->FlushLogs();
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Wires the native services to the Flutter engine hosted by |view|.
+static void setup_channels(MyApplication* self, FlView* view) {
+  FlBinaryMessenger* messenger = fl_engine_get_binary_messenger(fl_view_get_engine(view));
+
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(messenger, "com.hwl_vpn.app/channel", FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb, self, nullptr);
+
+  self->events = new BinaryEventChannel(messenger);
+  self->log_handler =
+      new LogStreamHandler(messenger, self->events, self->log_ring, self->log_store, self->log_journal);
+
+  // Batches go out on a timer, or as soon as the ring passes the high-water
+  // mark during a burst of debug output.
+  self->log_flush_source = g_timeout_add(kLogFlushIntervalMs, flush_logs_cb, self);
+  self->log_ring->SetWakeCallback(kLogHighWaterBytes, [self]() {
+    run_on_main_thread([self]() { flush_logs_cb(self); });
+  });
+
+  self->process_manager->SetLogCallback([self](const std::string& log) {
+    self->log_handler->SendLog(log);
+  });
+  self->process_manager->SetReadyCallback([self](bool confirmed) {
+    self->traffic_sampler->Start(self->process_manager->api_port(), self->process_manager->api_secret(),
+                                 [self](const TrafficDelta& delta) {
+                                   run_on_main_thread([self, delta]() { send_traffic_sample(self, delta); });
+                                 });
+    self->resource_monitor->Start(self->process_manager->pid(), self->child_cgroup->path(),
+                                  [self](const PressureEvent& event) {
+                                    run_on_main_thread([self, event]() { invoke_resource_pressure(self, event); });
+                                  });
+    run_on_main_thread([self, confirmed]() {
+      if (self->channel == nullptr || self->process_manager == nullptr) {
+        return;
+      }
+      std::string timeline = self->process_manager->timeline().Describe();
+      self->log_handler->SendLog(confirmed ? "⏱️ sing-box is ready: " + timeline + "\n"
+                                           : "⚠️ No readiness signal from sing-box: " + timeline + "\n");
+      invoke_update_status(self, "Started");
+      refresh_dns_auto(self);
+    });
+  });
+  self->process_manager->SetRestartCallback([self](const RestartEvent& event) {
+    if (event.kind == RestartEvent::Kind::kScheduled) {
+      self->traffic_sampler->Stop();
+      self->resource_monitor->Stop();
+    }
+    run_on_main_thread([self, event]() { invoke_restart_event(self, event); });
+  });
+  self->process_manager->SetExitCallback([self]() {
+    self->traffic_sampler->Stop();
+    self->resource_monitor->Stop();
+    run_on_main_thread([self]() {
+      if (self->channel) {
+        fl_method_channel_invoke_method(self->channel, "onVpnStopped", nullptr, nullptr, nullptr, nullptr);
+      }
+    });
+  });
+
+  ProcessStartupTrace().Mark(StartupStage::kChannelReady);
+}
+
 // Called when first Flutter frame received.
 static void first_frame_cb(MyApplication* self, FlView *view)
 {
   gtk_widget_show(gtk_widget_get_toplevel(GTK_WIDGET(view)));
+
+  StartupTrace& trace = ProcessStartupTrace();
+  if (!trace.Mark(StartupStage::kFirstFrame)) {
+    return;
+  }
+  dump_startup_trace(self, FALSE);
+  if (!trace.complete() && g_getenv("HWL_STARTUP_TRACE") != nullptr) {
+    self->startup_trace_source = g_timeout_add_seconds(kStartupTraceWaitS, startup_trace_timeout_cb, self);
+  }
 }
 
 // Implements GApplication::activate.
@@ -25,6 +1558,7 @@ static void my_application_activate(GApplication* application) {
   MyApplication* self = MY_APPLICATION(application);
   GtkWindow* window =
       GTK_WINDOW(gtk_application_window_new(GTK_APPLICATION(application)));
+  ProcessStartupTrace().Mark(StartupStage::kWindowCreated);
 
   // Use a header bar when running in GNOME as this is the common style used
   // by applications and is the setup most users will be using (e.g. Ubuntu
@@ -70,8 +1604,11 @@ static void my_application_activate(GApplication* application) {
   // Requires the view to be realized so we can start rendering.
   g_signal_connect_swapped(view, "first-frame", G_CALLBACK(first_frame_cb), self);
   gtk_widget_realize(GTK_WIDGET(view));
+  ProcessStartupTrace().Mark(StartupStage::kEngineStarted);
 
   fl_register_plugins(FL_PLUGIN_REGISTRY(view));
+  ProcessStartupTrace().Mark(StartupStage::kPluginsRegistered);
+  setup_channels(self, view);
 
   gtk_widget_grab_focus(GTK_WIDGET(view));
 }
@@ -95,20 +1632,152 @@ static gboolean my_application_local_command_line(GApplication* application, gch
   return TRUE;
 }
 
+static gchar* helper_cursor_path() {
+  return g_build_filename(g_get_user_data_dir(), APPLICATION_ID, "helper-cursor", nullptr);
+}
+
+// Hands sing-box over to the tunnel helper if one listens on
+// HWL_HELPER_SOCKET, or else kHelperSocketPath, resuming its log after the
+// last line the previous run of the UI journaled.
+static void connect_helper(MyApplication* self) {
+  const gchar* path = g_getenv("HWL_HELPER_SOCKET");
+  if (path == nullptr || *path == '\0') {
+    path = kHelperSocketPath;
+  }
+  uint64_t session = 0;
+  uint64_t cursor = kHelperLogFromOldest;
+  g_autofree gchar* cursor_path = helper_cursor_path();
+  g_autofree gchar* contents = nullptr;
+  if (g_file_get_contents(cursor_path, &contents, nullptr, nullptr)) {
+    gchar* end = nullptr;
+    session = g_ascii_strtoull(contents, &end, 10);
+    cursor = g_ascii_strtoull(end, nullptr, 10);
+  }
+
+  HelperClient::Callbacks callbacks;
+  callbacks.on_connection = [self](bool connected) {
+    if (connected) {
+      return;
+    }
+    run_on_main_thread([self]() {
+      if (self->log_handler != nullptr) {
+        self->log_handler->SendLog("⚠️ Lost the connection to the tunnel helper, reconnecting.\n");
+      }
+    });
+  };
+  callbacks.on_state = [self](HelperTunnelState state, bool) {
+    run_on_main_thread([self, state]() {
+      if (self->channel == nullptr) {
+        return;
+      }
+      if (state == HelperTunnelState::kRunning) {
+        invoke_update_status(self, "Started");
+        refresh_dns_auto(self);
+      } else if (state == HelperTunnelState::kStopped) {
+        fl_method_channel_invoke_method(self->channel, "onVpnStopped", nullptr, nullptr, nullptr, nullptr);
+      }
+    });
+  };
+  callbacks.on_restart = [self](const RestartEvent& event) {
+    run_on_main_thread([self, event]() { invoke_restart_event(self, event); });
+  };
+  callbacks.on_traffic = [self](const TrafficDelta& delta) {
+    run_on_main_thread([self, delta]() { send_traffic_sample(self, delta); });
+  };
+  self->helper_client = new HelperClient(self->event_loop, self->log_ring);
+  if (!self->helper_client->Connect(path, session, cursor, std::move(callbacks))) {
+    delete self->helper_client;
+    self->helper_client = nullptr;
+  }
+}
+
+// Disconnects from the helper and saves where its log stopped, once every
+// line before that is in the journal, so the next run neither repeats nor
+// misses any.
+static void disconnect_helper(MyApplication* self) {
+  if (self->helper_client == nullptr) {
+    return;
+  }
+  uint64_t session = 0;
+  uint64_t cursor = kHelperLogFromOldest;
+  self->event_loop->RunSync([self, &session, &cursor]() {
+    self->helper_client->Cursor(&session, &cursor);
+    delete self->helper_client;
+    self->helper_client = nullptr;
+  });
+  if (self->log_handler != nullptr) {
+    self->log_handler->FlushLogs();
+  }
+  g_autofree gchar* path = helper_cursor_path();
+  g_autofree gchar* contents = g_strdup_printf("%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n", session, cursor);
+  g_autoptr(GError) error = nullptr;
+  if (!g_file_set_contents(path, contents, -1, &error)) {
+    g_warning("Failed to save the helper log cursor: %s", error->message);
+  }
+}
+
 // Implements GApplication::startup.
 static void my_application_startup(GApplication* application) {
-  //MyApplication* self = MY_APPLICATION(object);
+  MyApplication* self = MY_APPLICATION(application);
 
   // Perform any actions required at application startup.
+  self->event_loop = new EventLoop();
+  if (!self->event_loop->Start()) {
+    g_warning("Failed to start the native event loop");
+  }
+  self->log_ring = new LogRing();
+  self->log_store = new LogStore();
+  self->log_journal = new LogJournal();
+  g_autofree gchar* journal_dir = g_build_filename(g_get_user_data_dir(), APPLICATION_ID, "logs", nullptr);
+  if (self->log_journal->Open(journal_dir)) {
+    // Bring back the previous sessions' logs.
+    self->log_journal->Read(0, [self](const char* data, size_t size) { self->log_store->Append(data, size); });
+  } else {
+    g_warning("Failed to open the log journal in %s", journal_dir);
+  }
+  self->process_manager = new ProcessManager(self->event_loop);
+  self->process_manager->SetLogRing(self->log_ring);
+  connect_helper(self);
+  self->child_cgroup = new ChildCgroup();
+  std::string cgroup_error;
+  // The helper has a cgroup of its own for sing-box.
+  if (self->helper_client == nullptr && self->child_cgroup->Create(&cgroup_error)) {
+    self->process_manager->SetCgroup(self->child_cgroup);
+  }
+  if (!cgroup_error.empty()) {
+    g_warning("%s", cgroup_error.c_str());
+  }
+  self->resource_monitor = new ResourceMonitor(self->event_loop);
+  self->split_tunnel = new SplitTunnel(self->event_loop);
+  self->config_builder = new ConfigBuilder();
+  self->clash_api_secret = g_strdup(RandomClashApiSecret().c_str());
+  self->latency_prober = new LatencyProber(self->event_loop);
+  self->speed_tester = new SpeedTester(self->event_loop);
+  self->dns_benchmarker = new DnsBenchmarker(self->event_loop);
+  self->dns_auto_selector = new DnsAutoSelector();
+  self->traffic_sampler = new TrafficSampler(self->event_loop);
+  self->network_monitor = new NetworkMonitor(self->event_loop);
+  self->server_cache = new ServerCache();
+  self->network_monitor->Start([self](uint32_t changes, std::shared_ptr<const NetworkSnapshot> snapshot) {
+    run_on_main_thread([self, changes, snapshot]() {
+      invoke_network_changed(self, changes, *snapshot);
+      refresh_dns_auto(self);
+    });
+  });
 
   G_APPLICATION_CLASS(my_application_parent_class)->startup(application);
 }
 
 // Implements GApplication::shutdown.
 static void my_application_shutdown(GApplication* application) {
-  //MyApplication* self = MY_APPLICATION(object);
+  MyApplication* self = MY_APPLICATION(application);
 
   // Perform any actions required at application shutdown.
+  // The tunnel does not outlive the window, as on Windows, unless the
+  // helper runs it.
+  if (self->process_manager && self->helper_client == nullptr) {
+    self->process_manager->Stop();
+  }
 
   G_APPLICATION_CLASS(my_application_parent_class)->shutdown(application);
 }
@@ -117,6 +1786,56 @@ static void my_application_shutdown(GApplication* application) {
 static void my_application_dispose(GObject* object) {
   MyApplication* self = MY_APPLICATION(object);
   g_clear_pointer(&self->dart_entrypoint_arguments, g_strfreev);
+  g_clear_object(&self->channel);
+  if (self->log_flush_source != 0) {
+    g_source_remove(self->log_flush_source);
+    self->log_flush_source = 0;
+  }
+  if (self->startup_trace_source != 0) {
+    g_source_remove(self->startup_trace_source);
+    self->startup_trace_source = 0;
+  }
+  disconnect_helper(self);
+  delete self->log_handler;
+  self->log_handler = nullptr;
+  delete self->events;
+  self->events = nullptr;
+  delete self->latency_prober;
+  self->latency_prober = nullptr;
+  delete self->speed_tester;
+  self->speed_tester = nullptr;
+  delete self->dns_benchmarker;
+  self->dns_benchmarker = nullptr;
+  delete self->dns_auto_selector;
+  self->dns_auto_selector = nullptr;
+  g_clear_pointer(&self->dns_proxy_ip, g_free);
+  g_clear_pointer(&self->clash_api_secret, g_free);
+  delete self->network_monitor;
+  self->network_monitor = nullptr;
+  join_server_cache_writer(self);
+  delete self->server_cache;
+  self->server_cache = nullptr;
+  delete self->process_manager;
+  self->process_manager = nullptr;
+  // After the process manager, whose callbacks drive them.
+  delete self->traffic_sampler;
+  self->traffic_sampler = nullptr;
+  delete self->resource_monitor;
+  self->resource_monitor = nullptr;
+  delete self->child_cgroup;
+  self->child_cgroup = nullptr;
+  delete self->split_tunnel;
+  self->split_tunnel = nullptr;
+  delete self->config_builder;
+  self->config_builder = nullptr;
+  delete self->event_loop;
+  self->event_loop = nullptr;
+  delete self->log_ring;
+  self->log_ring = nullptr;
+  delete self->log_store;
+  self->log_store = nullptr;
+  delete self->log_journal;
+  self->log_journal = nullptr;
   G_OBJECT_CLASS(my_application_parent_class)->dispose(object);
 }
 
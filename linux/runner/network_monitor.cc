@@ -0,0 +1,291 @@
+#include "network_monitor.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// Quiet time after the last notification before a change is reported.
+constexpr long kSettleNs = 150 * 1000 * 1000;
+constexpr size_t kReceiveBufferSize = 32 * 1024;
+
+// Text form of an address attribute, or empty.
+std::string FormatAddress(bool ipv6, const struct rtattr* attribute) {
+  size_t size = RTA_PAYLOAD(attribute);
+  if (size != (ipv6 ? 16u : 4u)) {
+    return "";
+  }
+  char text[INET6_ADDRSTRLEN];
+  if (inet_ntop(ipv6 ? AF_INET6 : AF_INET, RTA_DATA(attribute), text, sizeof(text)) == nullptr) {
+    return "";
+  }
+  return text;
+}
+
+}  // namespace
+
+NetworkMonitor::NetworkMonitor(EventLoop* loop) : loop_(loop), snapshot_(table_.snapshot()) {}
+
+NetworkMonitor::~NetworkMonitor() {
+  loop_->RunSync([this]() { Close(); });
+}
+
+void NetworkMonitor::Start(ChangeCallback on_change) {
+  loop_->Post([this, on_change = std::move(on_change)]() mutable {
+    on_change_ = std::move(on_change);
+    Open();
+  });
+}
+
+std::shared_ptr<const NetworkSnapshot> NetworkMonitor::snapshot() const {
+  std::lock_guard<std::mutex> lock(snapshot_mutex_);
+  return snapshot_;
+}
+
+void NetworkMonitor::Open() {
+  Close();
+  netlink_fd_ = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (netlink_fd_ < 0) {
+    std::cerr << "[NetworkMonitor] netlink socket failed: errno " << errno << std::endl;
+    return;
+  }
+  sockaddr_nl address = {};
+  address.nl_family = AF_NETLINK;
+  address.nl_groups =
+      RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (bind(netlink_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+    std::cerr << "[NetworkMonitor] netlink bind failed: errno " << errno << std::endl;
+    Close();
+    return;
+  }
+  settle_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (settle_fd_ >= 0) {
+    loop_->Watch(settle_fd_, EPOLLIN, [this](uint32_t) { OnSettled(); });
+  }
+  loop_->Watch(netlink_fd_, EPOLLIN, [this](uint32_t) { OnReadable(); });
+
+  table_.Clear();
+  sync_ = Sync::kLinks;
+  RequestDump();
+}
+
+void NetworkMonitor::Close() {
+  if (netlink_fd_ >= 0) {
+    loop_->Unwatch(netlink_fd_);
+    close(netlink_fd_);
+    netlink_fd_ = -1;
+  }
+  if (settle_fd_ >= 0) {
+    loop_->Unwatch(settle_fd_);
+    close(settle_fd_);
+    settle_fd_ = -1;
+  }
+}
+
+void NetworkMonitor::RequestDump() {
+  struct {
+    nlmsghdr header;
+    rtgenmsg body;
+  } request = {};
+  request.header.nlmsg_len = sizeof(request);
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = ++sequence_;
+  request.header.nlmsg_type =
+      sync_ == Sync::kLinks ? RTM_GETLINK : (sync_ == Sync::kAddresses ? RTM_GETADDR : RTM_GETROUTE);
+  request.body.rtgen_family = AF_UNSPEC;
+  sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(netlink_fd_, &request, sizeof(request), 0, reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+    std::cerr << "[NetworkMonitor] netlink dump request failed: errno " << errno << std::endl;
+  }
+}
+
+void NetworkMonitor::OnReadable() {
+  alignas(nlmsghdr) char buffer[kReceiveBufferSize];
+  for (;;) {
+    ssize_t received = recv(netlink_fd_, buffer, sizeof(buffer), 0);
+    if (received < 0) {
+      if (errno == ENOBUFS) {
+        // Notifications were dropped, so the table can no longer be
+        // trusted. Reload it; Publish() reports whatever moved meanwhile.
+        table_.Clear();
+        sync_ = Sync::kLinks;
+        RequestDump();
+        continue;
+      }
+      break;
+    }
+    int length = static_cast<int>(received);
+    for (auto* message = reinterpret_cast<const nlmsghdr*>(buffer); NLMSG_OK(message, length);
+         message = NLMSG_NEXT(message, length)) {
+      Handle(message);
+    }
+  }
+  if (sync_ == Sync::kDone) {
+    Publish();
+  }
+}
+
+void NetworkMonitor::Handle(const nlmsghdr* message) {
+  switch (message->nlmsg_type) {
+    case NLMSG_DONE:
+    case NLMSG_ERROR:
+      // Only dumps end this way; an error ends the dump just the same.
+      if (message->nlmsg_seq == sequence_ && sync_ != Sync::kDone) {
+        sync_ = static_cast<Sync>(static_cast<int>(sync_) + 1);
+        if (sync_ != Sync::kDone) {
+          RequestDump();
+        }
+      }
+      break;
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+      HandleLink(message);
+      break;
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+      HandleAddress(message);
+      break;
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE:
+      HandleRoute(message);
+      break;
+    default:
+      break;
+  }
+}
+
+void NetworkMonitor::HandleLink(const nlmsghdr* message) {
+  const auto* link = static_cast<const ifinfomsg*>(NLMSG_DATA(message));
+  if (message->nlmsg_type == RTM_DELLINK) {
+    table_.RemoveLink(link->ifi_index);
+    return;
+  }
+  std::string name;
+  int length = static_cast<int>(IFLA_PAYLOAD(message));
+  for (auto* attribute = IFLA_RTA(link); RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length)) {
+    if (attribute->rta_type == IFLA_IFNAME) {
+      const char* text = static_cast<const char*>(RTA_DATA(attribute));
+      name.assign(text, strnlen(text, RTA_PAYLOAD(attribute)));
+    }
+  }
+  // Up means administratively up with a carrier, so an unplugged cable or
+  // a dropped Wi-Fi association counts as down.
+  bool up = (link->ifi_flags & IFF_UP) != 0 && (link->ifi_flags & IFF_RUNNING) != 0;
+  bool point_to_point = (link->ifi_flags & IFF_POINTOPOINT) != 0 || link->ifi_type == ARPHRD_NONE;
+  table_.SetLink(link->ifi_index, name, up, (link->ifi_flags & IFF_LOOPBACK) != 0, point_to_point);
+}
+
+void NetworkMonitor::HandleAddress(const nlmsghdr* message) {
+  const auto* address = static_cast<const ifaddrmsg*>(NLMSG_DATA(message));
+  if (address->ifa_family != AF_INET && address->ifa_family != AF_INET6) {
+    return;
+  }
+  bool ipv6 = address->ifa_family == AF_INET6;
+  // IFA_LOCAL is the interface's own address; IFA_ADDRESS is the peer on
+  // point-to-point links and the same as IFA_LOCAL elsewhere.
+  std::string local;
+  std::string fallback;
+  int length = static_cast<int>(IFA_PAYLOAD(message));
+  for (auto* attribute = IFA_RTA(address); RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length)) {
+    if (attribute->rta_type == IFA_LOCAL) {
+      local = FormatAddress(ipv6, attribute);
+    } else if (attribute->rta_type == IFA_ADDRESS) {
+      fallback = FormatAddress(ipv6, attribute);
+    }
+  }
+  const std::string& text = local.empty() ? fallback : local;
+  if (text.empty()) {
+    return;
+  }
+  int index = static_cast<int>(address->ifa_index);
+  if (message->nlmsg_type == RTM_DELADDR) {
+    table_.RemoveAddress(index, ipv6, text);
+  } else {
+    table_.AddAddress(index, ipv6, text);
+  }
+}
+
+void NetworkMonitor::HandleRoute(const nlmsghdr* message) {
+  const auto* route = static_cast<const rtmsg*>(NLMSG_DATA(message));
+  if ((route->rtm_family != AF_INET && route->rtm_family != AF_INET6) || route->rtm_dst_len != 0 ||
+      route->rtm_type != RTN_UNICAST) {
+    return;
+  }
+  bool ipv6 = route->rtm_family == AF_INET6;
+  uint32_t table = route->rtm_table;
+  int index = 0;
+  uint32_t metric = 0;
+  std::string gateway;
+  int length = static_cast<int>(RTM_PAYLOAD(message));
+  for (auto* attribute = RTM_RTA(route); RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length)) {
+    switch (attribute->rta_type) {
+      case RTA_TABLE:
+        table = *static_cast<const uint32_t*>(RTA_DATA(attribute));
+        break;
+      case RTA_OIF:
+        index = *static_cast<const int*>(RTA_DATA(attribute));
+        break;
+      case RTA_PRIORITY:
+        metric = *static_cast<const uint32_t*>(RTA_DATA(attribute));
+        break;
+      case RTA_GATEWAY:
+        gateway = FormatAddress(ipv6, attribute);
+        break;
+      default:
+        break;
+    }
+  }
+  // sing-box's auto_route puts its default route in a table of its own, so
+  // the main table keeps describing the physical network.
+  if (table != RT_TABLE_MAIN || index == 0) {
+    return;
+  }
+  if (message->nlmsg_type == RTM_DELROUTE) {
+    table_.RemoveDefaultRoute(index, ipv6, gateway, metric);
+  } else {
+    table_.AddDefaultRoute(index, ipv6, gateway, metric, (message->nlmsg_flags & NLM_F_REPLACE) != 0);
+  }
+}
+
+void NetworkMonitor::Publish() {
+  uint32_t changes = table_.Publish();
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    snapshot_ = table_.snapshot();
+  }
+  if (!synced_) {
+    synced_ = true;
+    return;
+  }
+  if (changes == 0 || settle_fd_ < 0) {
+    return;
+  }
+  pending_changes_ |= changes;
+  itimerspec settle = {};
+  settle.it_value.tv_nsec = kSettleNs;
+  timerfd_settime(settle_fd_, 0, &settle, nullptr);
+}
+
+void NetworkMonitor::OnSettled() {
+  uint64_t expirations;
+  while (read(settle_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  uint32_t changes = pending_changes_;
+  pending_changes_ = 0;
+  if (changes != 0 && on_change_) {
+    on_change_(changes, table_.snapshot());
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef RUNNER_NETWORK_MONITOR_H_
+#define RUNNER_NETWORK_MONITOR_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "event_loop.h"
+#include "network_table.h"
+
+// Keeps a NetworkTable current from a NETLINK_ROUTE subscription.
+//
+// The socket joins the link, address and route multicast groups, then dumps
+// links, addresses and routes once to fill the table. From then on every
+// notification updates it, and readers on any thread get the latest
+// snapshot without a syscall. A burst of notifications, such as a Wi-Fi
+// reconnect, is reported once it has settled.
+class NetworkMonitor {
+ public:
+  // Receives the NetworkChange bits and the snapshot that has them.
+  using ChangeCallback = std::function<void(uint32_t changes, std::shared_ptr<const NetworkSnapshot> snapshot)>;
+
+  explicit NetworkMonitor(EventLoop* loop);
+  ~NetworkMonitor();
+
+  NetworkMonitor(const NetworkMonitor&) = delete;
+  NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+  // Safe from any thread. |on_change| runs on the loop thread.
+  void Start(ChangeCallback on_change);
+
+  // Safe from any thread. Empty until the first dump has finished.
+  std::shared_ptr<const NetworkSnapshot> snapshot() const;
+
+ private:
+  enum class Sync : uint8_t { kLinks, kAddresses, kRoutes, kDone };
+
+  void Open();
+  void Close();
+  // Starts the dump for |sync_|.
+  void RequestDump();
+  void OnReadable();
+  void Handle(const struct nlmsghdr* message);
+  void HandleLink(const struct nlmsghdr* message);
+  void HandleAddress(const struct nlmsghdr* message);
+  void HandleRoute(const struct nlmsghdr* message);
+  // Moves the snapshot forward and schedules the change report.
+  void Publish();
+  void OnSettled();
+
+  EventLoop* loop_;
+  ChangeCallback on_change_;
+  int netlink_fd_ = -1;
+  int settle_fd_ = -1;
+  uint32_t sequence_ = 0;
+  Sync sync_ = Sync::kLinks;
+  // Whether the table has been filled once; changes before that are the
+  // initial state, not news.
+  bool synced_ = false;
+  uint32_t pending_changes_ = 0;
+  NetworkTable table_;
+
+  mutable std::mutex snapshot_mutex_;
+  std::shared_ptr<const NetworkSnapshot> snapshot_;
+};
+
+#endif  // RUNNER_NETWORK_MONITOR_H_
@@ -0,0 +1,73 @@
+#include "pipe_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+PipeWriter::PipeWriter(EventLoop* loop, int fd, std::string data, std::chrono::milliseconds timeout,
+                       DoneCallback done)
+    : loop_(loop), fd_(fd), data_(std::move(data)), done_(std::move(done)) {
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ >= 0) {
+    itimerspec expiry = {};
+    expiry.it_value.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    expiry.it_value.tv_nsec = static_cast<long>(timeout.count() % 1000) * 1000 * 1000;
+    timerfd_settime(timer_fd_, 0, &expiry, nullptr);
+    loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { Finish(false); });
+  }
+  // Most configs fit in the pipe buffer and are written right here.
+  loop_->Watch(fd_, EPOLLOUT, [this](uint32_t) { OnWritable(); });
+  OnWritable();
+}
+
+PipeWriter::~PipeWriter() {
+  Close();
+}
+
+void PipeWriter::OnWritable() {
+  while (fd_ >= 0 && written_ < data_.size()) {
+    ssize_t written = write(fd_, data_.data() + written_, data_.size() - written_);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0 && errno == EAGAIN) {
+      return;
+    }
+    if (written < 0) {
+      Finish(false);
+      return;
+    }
+    written_ += static_cast<size_t>(written);
+  }
+  if (fd_ >= 0) {
+    Finish(true);
+  }
+}
+
+void PipeWriter::Finish(bool written) {
+  Close();
+  // Free a multi-megabyte config as soon as it is delivered.
+  std::string().swap(data_);
+  DoneCallback done = std::move(done_);
+  done_ = nullptr;
+  if (done) {
+    done(written);
+  }
+}
+
+void PipeWriter::Close() {
+  if (timer_fd_ >= 0) {
+    loop_->Unwatch(timer_fd_);
+    close(timer_fd_);
+    timer_fd_ = -1;
+  }
+  if (fd_ >= 0) {
+    loop_->Unwatch(fd_);
+    close(fd_);
+    fd_ = -1;
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef RUNNER_PIPE_WRITER_H_
+#define RUNNER_PIPE_WRITER_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "event_loop.h"
+
+// Writes a buffer into a pipe from the event loop.
+//
+// sing-box reads its config from stdin only once its runtime is up, and a
+// config with long domain lists is larger than the 64 KiB pipe buffer, so a
+// blocking write would hold the calling thread for the whole start-up. The
+// writer instead fills the pipe whenever it drains and closes it at the end,
+// which is sing-box's end of input.
+class PipeWriter {
+ public:
+  // Receives true once everything was written, false on a write error or
+  // when |timeout| ran out first.
+  using DoneCallback = std::function<void(bool written)>;
+
+  // Loop thread only. Takes ownership of |fd| and makes it non-blocking. The
+  // descriptor is closed when writing ends or the writer is destroyed;
+  // |done| is not called in the latter case.
+  PipeWriter(EventLoop* loop, int fd, std::string data, std::chrono::milliseconds timeout, DoneCallback done);
+  ~PipeWriter();
+
+  PipeWriter(const PipeWriter&) = delete;
+  PipeWriter& operator=(const PipeWriter&) = delete;
+
+ private:
+  void OnWritable();
+  void Finish(bool written);
+  void Close();
+
+  EventLoop* loop_;
+  int fd_;
+  int timer_fd_ = -1;
+  std::string data_;
+  size_t written_ = 0;
+  DoneCallback done_;
+};
+
+#endif  // RUNNER_PIPE_WRITER_H_
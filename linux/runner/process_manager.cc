@@ -0,0 +1,890 @@
+#include "process_manager.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "clash_api.h"
+
+extern char** environ;
+
+namespace {
+// sing-box removes its routes and nftables rules on SIGTERM, so give it a
+// moment before falling back to SIGKILL.
+constexpr auto kGracefulStopTimeout = std::chrono::seconds(3);
+// "sing-box check" normally finishes well within a second.
+constexpr auto kCheckTimeout = std::chrono::seconds(10);
+constexpr size_t kMaxCheckOutput = 16 * 1024;
+// Longer than any real start; past it the runner stops waiting for a
+// readiness signal.
+constexpr auto kReadyTimeout = std::chrono::seconds(15);
+// sing-box reads its config right after its runtime starts. A child that has
+// not taken it by then is stuck.
+constexpr auto kConfigWriteTimeout = std::chrono::seconds(10);
+
+std::string GetExecutableDir() {
+  char exe_path[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+  if (length <= 0) {
+    return ".";
+  }
+  exe_path[length] = '\0';
+  std::string path(exe_path);
+  return path.substr(0, path.find_last_of('/'));
+}
+
+int OpenPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+void CloseFd(int* fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+// Replaces the contents of the memfd |fd| with |config|.
+bool WriteConfigFile(int fd, const std::string& config) {
+  if (ftruncate(fd, 0) != 0) {
+    return false;
+  }
+  size_t written = 0;
+  while (written < config.size()) {
+    ssize_t result = pwrite(fd, config.data() + written, config.size() - written, static_cast<off_t>(written));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return false;
+    }
+    written += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+// How a reaped child ended, e.g. "exited with code 1".
+std::string DescribeExitStatus(int status) {
+  if (WIFSIGNALED(status)) {
+    return "was killed by signal " + std::to_string(WTERMSIG(status)) + " (" + strsignal(WTERMSIG(status)) + ")";
+  }
+  return "exited with code " + std::to_string(WEXITSTATUS(status));
+}
+
+// A memfd holding |config|, or -1.
+int CreateConfigFile(const std::string& config) {
+#ifdef MFD_CLOEXEC
+  int fd = memfd_create("sing-box-config", MFD_CLOEXEC);
+  if (fd >= 0 && !WriteConfigFile(fd, config)) {
+    CloseFd(&fd);
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+void ClosePipe(int fds[2]) {
+  for (int i = 0; i < 2; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+}
+}  // namespace
+
+ProcessManager::ProcessManager(EventLoop* loop) : loop_(loop), probe_(loop), ready_timeout_(kReadyTimeout) {}
+
+ProcessManager::~ProcessManager() {
+  Stop();
+  loop_->RunSync([this]() {
+    if (restart_timer_fd_ >= 0) {
+      loop_->Unwatch(restart_timer_fd_);
+      CloseFd(&restart_timer_fd_);
+    }
+  });
+}
+
+void ProcessManager::SetLogCallback(std::function<void(const std::string&)> callback) {
+  log_callback_ = callback;
+}
+
+void ProcessManager::SetExitCallback(std::function<void()> callback) {
+  exit_callback_ = callback;
+}
+
+void ProcessManager::SetLogRing(LogRing* ring) {
+  log_ring_ = ring;
+}
+
+void ProcessManager::SetCgroup(ChildCgroup* cgroup) {
+  cgroup_ = cgroup;
+}
+
+void ProcessManager::SetReadyTimeout(std::chrono::milliseconds timeout) {
+  ready_timeout_ = timeout;
+}
+
+void ProcessManager::SetReadyCallback(std::function<void(bool confirmed)> callback) {
+  ready_callback_ = callback;
+}
+
+void ProcessManager::SetRestartCallback(std::function<void(const RestartEvent& event)> callback) {
+  restart_callback_ = callback;
+}
+
+void ProcessManager::SetAutoRestart(bool enabled) {
+  auto_restart_ = enabled;
+}
+
+void ProcessManager::Log(const std::string& message) {
+  // Restarts happen on the event loop, whose way to the UI is the ring.
+  if (loop_->IsLoopThread()) {
+    if (log_ring_) log_ring_->Write(message.data(), message.size());
+    return;
+  }
+  if (log_callback_) log_callback_(message);
+}
+
+bool ProcessManager::Spawn(const char* command, Child* child, int config_fd) {
+  std::string app_dir = GetExecutableDir();
+  std::string executable_path = app_dir + "/sing-box";
+
+  int stdin_pipe[2] = {-1, -1};
+  int output_pipe[2] = {-1, -1};
+  if ((config_fd < 0 && pipe2(stdin_pipe, O_CLOEXEC) != 0) || pipe2(output_pipe, O_CLOEXEC) != 0) {
+    Log("❌ pipe2 failed with error: " + std::to_string(errno) + "\n");
+    ClosePipe(stdin_pipe);
+    ClosePipe(output_pipe);
+    return false;
+  }
+
+  // dup2 clears O_CLOEXEC on the targets, so the child inherits exactly its
+  // three standard descriptors, and the config memfd as descriptor 3.
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (config_fd >= 0) {
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, config_fd, 3);
+  } else {
+    posix_spawn_file_actions_adddup2(&actions, stdin_pipe[0], STDIN_FILENO);
+  }
+  posix_spawn_file_actions_adddup2(&actions, output_pipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, output_pipe[1], STDERR_FILENO);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+  posix_spawn_file_actions_addchdir_np(&actions, app_dir.c_str());
+#endif
+
+  // The runner ignores SIGPIPE; the child must get the default behaviour
+  // back along with an empty signal mask.
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+  posix_spawnattr_setsigmask(&attributes, &empty_mask);
+  sigset_t default_signals;
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attributes, &default_signals);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  char* const argv[] = {
+      const_cast<char*>(executable_path.c_str()),
+      const_cast<char*>(command),
+      const_cast<char*>("-c"),
+      const_cast<char*>(config_fd >= 0 ? "/dev/fd/3" : "stdin"),
+      nullptr,
+  };
+
+  pid_t pid = -1;
+  int spawn_error = posix_spawn(&pid, executable_path.c_str(), &actions, &attributes, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+
+  CloseFd(&stdin_pipe[0]);
+  close(output_pipe[1]);
+
+  if (spawn_error != 0) {
+    Log("❌ posix_spawn failed with error: " + std::string(strerror(spawn_error)) + "\n");
+    CloseFd(&stdin_pipe[1]);
+    close(output_pipe[0]);
+    return false;
+  }
+
+  // sing-box is only initialising when it is moved, so its allocations are
+  // charged to the cgroup from the start in practice.
+  if (cgroup_ && strcmp(command, "run") == 0 && !cgroup_->AddProcess(pid)) {
+    std::cout << "[ProcessManager] Could not move sing-box into " << cgroup_->path() << "." << std::endl;
+  }
+
+  child->pid = pid;
+  child->pid_fd = OpenPidFd(pid);
+  if (child->pid_fd < 0) {
+    std::cout << "[ProcessManager] pidfd_open unavailable, exit is detected from pipe EOF." << std::endl;
+  }
+  child->stdin_fd = stdin_pipe[1];
+  child->output_fd = output_pipe[0];
+  child->config_fd = config_fd;
+  fcntl(child->output_fd, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+bool ProcessManager::SpawnRun(const std::string& config_content, Child* child) {
+  int config_fd = CreateConfigFile(config_content);
+  if (Spawn("run", child, config_fd)) {
+    return true;
+  }
+  CloseFd(&config_fd);
+  return false;
+}
+
+void ProcessManager::Discard(Child* child) {
+  CloseFd(&child->stdin_fd);
+  CloseFd(&child->config_fd);
+  CloseFd(&child->output_fd);
+  if (child->pid >= 0) {
+    kill(child->pid, SIGKILL);
+    waitpid(child->pid, nullptr, 0);
+    child->pid = -1;
+  }
+  CloseFd(&child->pid_fd);
+}
+
+bool ProcessManager::Start(const std::string& config_content) {
+  if (IsRunning()) {
+    std::cout << "[ProcessManager] Process is already running." << std::endl;
+    return true;
+  }
+
+  Log("🚀 Starting VPN service...\n");
+  timeline_.Begin();
+
+  // A standby prepared for this config is already past exec and runtime
+  // start-up.
+  Child child;
+  loop_->RunSync([this, &child, &config_content]() {
+    CancelRestart();
+    restart_policy_.Reset();
+    supervised_ = false;
+    last_config_ = config_content;
+    if (standby_.pid >= 0 && standby_config_ == config_content) {
+      if (standby_.pid_fd >= 0) {
+        loop_->Unwatch(standby_.pid_fd);
+      }
+      child = standby_;
+      standby_ = Child();
+      standby_config_.clear();
+    } else if (standby_.pid >= 0) {
+      DiscardPrepared();
+    }
+  });
+  if (child.pid < 0 && !SpawnRun(config_content, &child)) {
+    return false;
+  }
+  timeline_.Mark(StartPhase::kSpawned);
+  Launch(child, config_content);
+  return true;
+}
+
+void ProcessManager::Launch(Child child, const std::string& config_content) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pid_ = child.pid;
+    pid_fd_ = child.pid_fd;
+    stop_requested_ = false;
+    output_fd_ = child.output_fd;
+  }
+  is_running_ = true;
+
+  uint16_t api_port = FindClashApiPort(config_content);
+  std::string api_secret = FindClashApiSecret(config_content);
+  loop_->Post([this, api_port, api_secret = std::move(api_secret), child, config = config_content]() mutable {
+    CloseFd(&config_fd_);
+    config_fd_ = child.config_fd;
+    // A reload that needed a restart is done once this process is ready.
+    reload_applied_ = reload_callback_ != nullptr;
+    if (config_fd_ >= 0) {
+      // Written before the spawn.
+      timeline_.Mark(StartPhase::kConfigWritten);
+    } else {
+      config_writer_ = std::make_unique<PipeWriter>(loop_, child.stdin_fd, std::move(config), kConfigWriteTimeout,
+                                                    [this](bool written) { OnConfigWritten(written); });
+    }
+    WatchChild();
+    ready_reported_ = false;
+    api_port_ = api_port;
+    api_secret_ = std::move(api_secret);
+    probe_.Start(api_port_, api_secret_, ready_timeout_, [this](bool answered) {
+      if (answered) {
+        timeline_.Mark(StartPhase::kReady);
+      }
+      ReportReady(answered);
+    });
+  });
+
+  Log("✅ Process started successfully.\n");
+}
+
+void ProcessManager::OnConfigWritten(bool written) {
+  if (written) {
+    timeline_.Mark(StartPhase::kConfigWritten);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pid_ < 0) {
+    // It already exited and its exit is being reported.
+    return;
+  }
+  if (log_ring_) {
+    static const char kMessage[] = "❌ sing-box did not read its config, stopping it.\n";
+    log_ring_->Write(kMessage, sizeof(kMessage) - 1);
+  }
+  SignalChild(SIGKILL);
+}
+
+void ProcessManager::Prepare(const std::string& config_content, CheckCallback callback) {
+  BeginCheck(config_content, true, std::move(callback));
+}
+
+void ProcessManager::BeginCheck(const std::string& config_content, bool with_standby, CheckCallback callback) {
+  Child check;
+  bool checking = Spawn("check", &check);
+
+  Child standby;
+  if (checking && with_standby && !Spawn("run", &standby)) {
+    standby = Child();
+  }
+
+  loop_->RunSync([&]() {
+    DiscardPrepared();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      checked_config_ = config_content;
+      checked_output_.clear();
+      check_state_ = checking ? CheckState::kPending : CheckState::kNone;
+    }
+    if (!checking) {
+      if (callback) {
+        callback(false, "Failed to run sing-box check.\n");
+      }
+      return;
+    }
+
+    check_ = check;
+    check_output_.clear();
+    check_callback_ = std::move(callback);
+    check_writer_ = std::make_unique<PipeWriter>(loop_, std::exchange(check.stdin_fd, -1), config_content,
+                                                 kConfigWriteTimeout, [this](bool written) {
+                                                   // A check that cannot take its config is killed and
+                                                   // reports the config as invalid.
+                                                   if (!written && check_.pid >= 0) {
+                                                     kill(check_.pid, SIGKILL);
+                                                   }
+                                                 });
+    loop_->Watch(check_.output_fd, EPOLLIN, [this](uint32_t) { OnCheckOutput(); });
+    if (check_.pid_fd >= 0) {
+      loop_->Watch(check_.pid_fd, EPOLLIN, [this](uint32_t) { OnCheckExited(); });
+    }
+
+    standby_ = standby;
+    standby_config_ = standby_.pid >= 0 ? config_content : std::string();
+    if (standby_.pid_fd >= 0) {
+      loop_->Watch(standby_.pid_fd, EPOLLIN, [this](uint32_t) { OnStandbyExited(); });
+    }
+  });
+}
+
+bool ProcessManager::Switch(const std::string& config_content) {
+  return Replace(config_content, true);
+}
+
+bool ProcessManager::Replace(const std::string& config_content, bool standby) {
+  if (!IsRunning()) {
+    return Start(config_content);
+  }
+
+  bool prepared;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    prepared = check_state_ != CheckState::kNone && checked_config_ == config_content;
+  }
+  if (!prepared) {
+    BeginCheck(config_content, standby, nullptr);
+  }
+  std::string output;
+  if (!WaitForCheck(config_content, &output)) {
+    Log("❌ The new configuration did not pass sing-box check, keeping the current connection.\n" + output);
+    return false;
+  }
+
+  Log("🔁 Switching VPN service...\n");
+  StopRunning();
+  return Start(config_content);
+}
+
+bool ProcessManager::Reload(const std::string& config_content, ReloadCallback callback) {
+  if (!IsRunning()) {
+    return false;
+  }
+  ReloadResult result;
+  bool busy = false;
+  bool in_place = false;
+  loop_->RunSync([&]() {
+    busy = reload_callback_ != nullptr;
+    if (busy) {
+      return;
+    }
+    ConfigDiff diff = DiffConfigs(last_config_, config_content);
+    result.sections = diff.changed;
+    if (diff.identical()) {
+      return;
+    }
+    in_place = !diff.needs_restart && config_fd_ >= 0;
+    result.path = in_place ? ReloadPath::kSignal : ReloadPath::kRestart;
+    // Set before the switch, whose old process exits as requested and
+    // whose new one finishes the reload once ready.
+    reload_callback_ = callback;
+    reload_result_ = result;
+    reload_config_ = in_place ? config_content : std::string();
+    reload_applied_ = false;
+    reload_begin_ = std::chrono::steady_clock::now();
+  });
+  if (busy) {
+    result.error = "another reload is in progress.";
+  }
+  if (busy || result.path == ReloadPath::kUnchanged) {
+    Log(DescribeReloadResult(result));
+    loop_->Post([callback, result]() { callback(result); });
+    return true;
+  }
+
+  if (in_place) {
+    BeginCheck(config_content, false, [this](bool valid, const std::string& output) {
+      OnReloadChecked(valid, output);
+    });
+  } else if (!Replace(config_content, false)) {
+    loop_->RunSync([this]() { FinishReload("sing-box could not be switched to it."); });
+  }
+  return true;
+}
+
+void ProcessManager::OnReloadChecked(bool valid, const std::string& output) {
+  if (!reload_callback_) {
+    return;
+  }
+  if (!valid) {
+    std::string message = output;
+    while (!message.empty() && message.back() == '\n') {
+      message.pop_back();
+    }
+    FinishReload("it did not pass sing-box check, keeping the current one.\n" + message);
+    return;
+  }
+  if (config_fd_ < 0 || !WriteConfigFile(config_fd_, reload_config_)) {
+    FinishReload("it could not be handed to sing-box.");
+    return;
+  }
+  last_config_ = std::move(reload_config_);
+  reload_config_.clear();
+  reload_applied_ = true;
+  uint16_t old_api_port = api_port_;
+  api_port_ = FindClashApiPort(last_config_);
+  api_secret_ = FindClashApiSecret(last_config_);
+  timeline_.Begin();
+  timeline_.Mark(StartPhase::kConfigWritten);
+  ready_reported_ = false;
+  // The old instance's Clash API answers until sing-box has re-read the
+  // config, and sing-box closes it before building the new one, so the new
+  // API is probed once the old one hung up. Without an API only the
+  // "sing-box started" line, hidden below the info level, or the timeout
+  // ends the wait.
+  probe_.StartAfterClose(old_api_port, api_port_, api_secret_, ready_timeout_, [this](bool answered) {
+    if (answered) {
+      timeline_.Mark(StartPhase::kReady);
+    }
+    ReportReady(answered);
+  });
+  std::lock_guard<std::mutex> lock(mutex_);
+  SignalChild(SIGHUP);
+}
+
+void ProcessManager::FinishReload(const std::string& error) {
+  ReloadCallback callback = std::move(reload_callback_);
+  reload_callback_ = nullptr;
+  if (!callback) {
+    return;
+  }
+  ReloadResult result = std::move(reload_result_);
+  result.error = error;
+  result.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - reload_begin_).count();
+  reload_config_.clear();
+  Log(DescribeReloadResult(result));
+  callback(result);
+}
+
+bool ProcessManager::WaitForCheck(const std::string& config_content, std::string* output) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (checked_config_ != config_content || check_state_ == CheckState::kNone) {
+    // The check could not run; let sing-box itself report problems.
+    return true;
+  }
+  checked_cv_.wait_for(lock, kCheckTimeout, [this]() { return check_state_ != CheckState::kPending; });
+  *output = checked_output_;
+  return check_state_ != CheckState::kInvalid;
+}
+
+void ProcessManager::OnCheckOutput() {
+  char buffer[4096];
+  for (;;) {
+    ssize_t bytes_read = read(check_.output_fd, buffer, sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read < 0 && errno == EAGAIN) {
+      return;
+    }
+    if (bytes_read <= 0) {
+      loop_->Unwatch(check_.output_fd);
+      CloseFd(&check_.output_fd);
+      if (check_.pid_fd < 0) {
+        OnCheckExited();
+      }
+      return;
+    }
+    size_t room = kMaxCheckOutput - std::min(kMaxCheckOutput, check_output_.size());
+    check_output_.append(buffer, std::min(room, static_cast<size_t>(bytes_read)));
+  }
+}
+
+void ProcessManager::OnCheckExited() {
+  if (check_.pid < 0) {
+    return;
+  }
+  if (check_.output_fd >= 0) {
+    OnCheckOutput();
+  }
+  if (check_.output_fd >= 0) {
+    loop_->Unwatch(check_.output_fd);
+    CloseFd(&check_.output_fd);
+  }
+  check_writer_.reset();
+  int status = 0;
+  waitpid(check_.pid, &status, 0);
+  check_.pid = -1;
+  if (check_.pid_fd >= 0) {
+    loop_->Unwatch(check_.pid_fd);
+    CloseFd(&check_.pid_fd);
+  }
+  FinishCheck(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void ProcessManager::FinishCheck(bool valid) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    check_state_ = valid ? CheckState::kValid : CheckState::kInvalid;
+    checked_output_ = check_output_;
+  }
+  checked_cv_.notify_all();
+  CheckCallback callback = std::move(check_callback_);
+  check_callback_ = nullptr;
+  if (callback) {
+    callback(valid, check_output_);
+  }
+}
+
+void ProcessManager::OnStandbyExited() {
+  // Nothing should stop a process blocked reading stdin, but if something
+  // does, forget it and cold-start instead.
+  loop_->Unwatch(standby_.pid_fd);
+  waitpid(standby_.pid, nullptr, 0);
+  standby_.pid = -1;
+  Discard(&standby_);
+  standby_config_.clear();
+}
+
+void ProcessManager::DiscardPrepared() {
+  check_writer_.reset();
+  if (check_.pid >= 0) {
+    if (check_.output_fd >= 0) {
+      loop_->Unwatch(check_.output_fd);
+    }
+    if (check_.pid_fd >= 0) {
+      loop_->Unwatch(check_.pid_fd);
+    }
+    Discard(&check_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      check_state_ = CheckState::kNone;
+    }
+    checked_cv_.notify_all();
+    CheckCallback callback = std::move(check_callback_);
+    check_callback_ = nullptr;
+    if (callback) {
+      callback(false, "Check cancelled.\n");
+    }
+  }
+  if (standby_.pid >= 0) {
+    if (standby_.pid_fd >= 0) {
+      loop_->Unwatch(standby_.pid_fd);
+    }
+    Discard(&standby_);
+    standby_config_.clear();
+  }
+}
+
+void ProcessManager::WatchChild() {
+  loop_->Watch(output_fd_, EPOLLIN, [this](uint32_t) { OnOutputReadable(); });
+  if (pid_fd_ >= 0) {
+    loop_->Watch(pid_fd_, EPOLLIN, [this](uint32_t) { OnChildExited(); });
+  }
+}
+
+void ProcessManager::OnOutputReadable() {
+  char scratch[4096];
+  for (;;) {
+    LogRing::Span span = log_ring_ ? log_ring_->PrepareWrite() : LogRing::Span{nullptr, 0};
+    bool into_ring = span.size > 0;
+    ssize_t bytes_read = into_ring ? read(output_fd_, span.data, span.size)
+                                   : read(output_fd_, scratch, sizeof(scratch));
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read < 0 && errno == EAGAIN) {
+      return;
+    }
+    if (bytes_read <= 0) {
+      CloseOutput();
+      if (pid_fd_ < 0) {
+        OnChildExited();
+      }
+      return;
+    }
+
+    bool started = timeline_.Scan(into_ring ? span.data : scratch, static_cast<size_t>(bytes_read));
+    // Committed before ReportReady(), whose status lines would otherwise
+    // be written over these bytes.
+    if (into_ring) {
+      log_ring_->CommitWrite(static_cast<size_t>(bytes_read));
+    } else if (log_ring_) {
+      log_ring_->CountDropped(static_cast<size_t>(bytes_read));
+    }
+    if (started) {
+      ReportReady(true);
+    }
+  }
+}
+
+void ProcessManager::ReportReady(bool confirmed) {
+  if (ready_reported_) {
+    return;
+  }
+  ready_reported_ = true;
+  probe_.Cancel();
+  supervised_ = true;
+  RestartEvent event;
+  if (restart_policy_.OnReady(std::chrono::steady_clock::now(), &event)) {
+    Log(DescribeRestartEvent(event));
+    if (restart_callback_) {
+      restart_callback_(event);
+    }
+  }
+  if (ready_callback_) {
+    ready_callback_(confirmed);
+  }
+  if (reload_callback_ && reload_applied_) {
+    FinishReload(std::string());
+  }
+}
+
+void ProcessManager::CloseOutput() {
+  if (output_fd_ < 0) {
+    return;
+  }
+  if (log_ring_) {
+    log_ring_->TerminateLine();
+  }
+  loop_->Unwatch(output_fd_);
+  close(output_fd_);
+  output_fd_ = -1;
+}
+
+void ProcessManager::OnChildExited() {
+  // Whatever the child wrote before exiting is still sitting in the pipe.
+  if (output_fd_ >= 0) {
+    OnOutputReadable();
+    CloseOutput();
+  }
+  // A process that died while starting never becomes ready.
+  ready_reported_ = true;
+  probe_.Cancel();
+  config_writer_.reset();
+
+  bool unexpected_exit;
+  int status = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pid_ < 0) {
+      return;
+    }
+    waitpid(pid_, &status, 0);
+    if (pid_fd_ >= 0) {
+      loop_->Unwatch(pid_fd_);
+      close(pid_fd_);
+      pid_fd_ = -1;
+    }
+    pid_ = -1;
+    unexpected_exit = !stop_requested_;
+    is_running_ = false;
+  }
+  exited_cv_.notify_all();
+  CloseFd(&config_fd_);
+  if (unexpected_exit) {
+    FinishReload("sing-box exited.");
+  }
+
+  if (unexpected_exit) {
+    OnUnexpectedExit(DescribeExitStatus(status));
+  }
+}
+
+void ProcessManager::OnUnexpectedExit(const std::string& exit_status) {
+  if (auto_restart_.load() && supervised_) {
+    RestartEvent event;
+    event.exit_status = exit_status;
+    if (restart_policy_.OnCrash(std::chrono::steady_clock::now(), &event) && ScheduleRestart(event.delay_ms)) {
+      Log(DescribeRestartEvent(event));
+      if (restart_callback_) {
+        restart_callback_(event);
+      }
+      return;
+    }
+    if (event.kind == RestartEvent::Kind::kGaveUp) {
+      Log(DescribeRestartEvent(event));
+      if (restart_callback_) {
+        restart_callback_(event);
+      }
+    } else {
+      Log("❌ Could not schedule a restart of sing-box.\n");
+    }
+    restart_policy_.Reset();
+    supervised_ = false;
+  }
+  if (exit_callback_) {
+    exit_callback_();
+  }
+}
+
+bool ProcessManager::ScheduleRestart(int64_t delay_ms) {
+  if (restart_timer_fd_ < 0) {
+    restart_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (restart_timer_fd_ < 0) {
+      return false;
+    }
+    if (!loop_->Watch(restart_timer_fd_, EPOLLIN, [this](uint32_t) { OnRestartTimer(); })) {
+      CloseFd(&restart_timer_fd_);
+      return false;
+    }
+  }
+  itimerspec when = {};
+  when.it_value.tv_sec = static_cast<time_t>(delay_ms / 1000);
+  // A zero it_value would disarm the timer instead.
+  when.it_value.tv_nsec = std::max(static_cast<long>(delay_ms % 1000 * 1000000), 1L);
+  timerfd_settime(restart_timer_fd_, 0, &when, nullptr);
+  restart_pending_ = true;
+  return true;
+}
+
+void ProcessManager::OnRestartTimer() {
+  uint64_t expirations;
+  while (read(restart_timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (!restart_pending_) {
+    return;
+  }
+  restart_pending_ = false;
+
+  Log("🔄 Restarting VPN service...\n");
+  timeline_.Begin();
+  Child child;
+  if (!SpawnRun(last_config_, &child)) {
+    OnUnexpectedExit("could not be spawned");
+    return;
+  }
+  timeline_.Mark(StartPhase::kSpawned);
+  Launch(child, last_config_);
+}
+
+void ProcessManager::CancelRestart() {
+  restart_pending_ = false;
+  if (restart_timer_fd_ >= 0) {
+    itimerspec when = {};
+    timerfd_settime(restart_timer_fd_, 0, &when, nullptr);
+  }
+}
+
+void ProcessManager::SignalChild(int signal_number) {
+#ifdef SYS_pidfd_send_signal
+  if (pid_fd_ >= 0 && syscall(SYS_pidfd_send_signal, pid_fd_, signal_number, nullptr, 0) == 0) {
+    return;
+  }
+#endif
+  // The child is only reaped on the loop thread under |mutex_|, so the pid
+  // cannot have been recycled yet.
+  kill(pid_, signal_number);
+}
+
+void ProcessManager::Stop() {
+  loop_->RunSync([this]() {
+    DiscardPrepared();
+    CancelRestart();
+    FinishReload("the service was stopped.");
+  });
+  if (!is_running_.load()) {
+    return;
+  }
+  Log("🛑 Stopping VPN service...\n");
+  StopRunning();
+}
+
+void ProcessManager::StopRunning() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pid_ < 0) {
+    return;
+  }
+  stop_requested_ = true;
+  SignalChild(SIGTERM);
+  if (!exited_cv_.wait_for(lock, kGracefulStopTimeout, [this]() { return pid_ < 0; })) {
+    SignalChild(SIGKILL);
+    exited_cv_.wait(lock, [this]() { return pid_ < 0; });
+  }
+}
+
+bool ProcessManager::IsRunning() {
+  return is_running_.load();
+}
+
+pid_t ProcessManager::pid() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pid_;
+}
@@ -0,0 +1,238 @@
+#ifndef RUNNER_PROCESS_MANAGER_H_
+#define RUNNER_PROCESS_MANAGER_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "child_cgroup.h"
+#include "config_diff.h"
+#include "event_loop.h"
+#include "log_ring.h"
+#include "pipe_writer.h"
+#include "readiness_probe.h"
+#include "restart_policy.h"
+#include "start_timeline.h"
+
+// Supervises the sing-box child process.
+//
+// The child is spawned with posix_spawn and watched through a pidfd. Its
+// stdout, stderr and exit are all handled on the shared |EventLoop|, so no
+// threads are created per start. Output is read straight into the |LogRing|.
+//
+// For server switches, Prepare() validates the next config with
+// "sing-box check" and spawns a standby "sing-box run -c stdin" that blocks
+// reading its config. Two instances cannot own the TUN device at once, so
+// Switch() still stops the old process first, but the new one is already
+// exec'd and initialised and only needs its config, and a config that fails
+// the check never takes the tunnel down.
+//
+// Start() returns once sing-box is spawned. Its config is written by a
+// PipeWriter on the event loop, and readiness is reported separately, when
+// sing-box logs "sing-box started" or its Clash API first answers. Each
+// start's phases are kept in a StartTimeline.
+//
+// A cold-started "sing-box run" reads its config from a memfd passed as
+// /dev/fd/3 rather than from stdin, so Reload() can rewrite it and send
+// SIGHUP: sing-box checks and re-reads the file and rebuilds its services
+// inside the running process, skipping the stop, exec and runtime start-up
+// of a restart, and keeps the old config running if the new one fails. A
+// process taken over from the standby read stdin and is switched instead.
+//
+// Once a start has been ready, a sing-box that exits without Stop() is
+// restarted from the event loop with the same config after a RestartPolicy
+// backoff, without a round trip through Dart. A crash loop ends the
+// restarts and is reported like any other exit.
+class ProcessManager {
+ public:
+  // Receives whether the config passed "sing-box check" and its output.
+  using CheckCallback = std::function<void(bool valid, const std::string& output)>;
+  // Receives how a Reload() went, on the event loop thread.
+  using ReloadCallback = std::function<void(const ReloadResult& result)>;
+
+  explicit ProcessManager(EventLoop* loop);
+  ~ProcessManager();
+
+  ProcessManager(const ProcessManager&) = delete;
+  ProcessManager& operator=(const ProcessManager&) = delete;
+
+  // Receives the runner's own status messages on the thread calling
+  // Start() or Stop().
+  void SetLogCallback(std::function<void(const std::string&)> callback);
+  // Runs on the event loop thread when the child exits without Stop() being
+  // requested and is not restarted.
+  void SetExitCallback(std::function<void()> callback);
+  // Runs on the event loop thread when a restart is scheduled, when the
+  // restarted process is ready (before the ready callback) and when the
+  // restarts give up (before the exit callback).
+  void SetRestartCallback(std::function<void(const RestartEvent& event)> callback);
+  // Whether crashed processes are restarted. On by default.
+  void SetAutoRestart(bool enabled);
+  // Destination for the child's output. Written on the event loop thread.
+  void SetLogRing(LogRing* ring);
+  // Runs on the event loop thread once per start when sing-box is ready.
+  // |confirmed| is false when no readiness signal came before the timeout
+  // and the process is assumed to be up.
+  void SetReadyCallback(std::function<void(bool confirmed)> callback);
+  // Cgroup every "sing-box run" is moved into as it is spawned.
+  void SetCgroup(ChildCgroup* cgroup);
+  // How long a start or reload waits for a readiness signal before it is
+  // reported unconfirmed. 15 seconds by default; set before Start().
+  void SetReadyTimeout(std::chrono::milliseconds timeout);
+
+  bool Start(const std::string& config_content);
+  void Stop();
+  bool IsRunning();
+  // The running process, or -1.
+  pid_t pid();
+
+  // Checks |config_content| and keeps a standby process for it, replacing
+  // any earlier one. |callback| runs on the event loop thread.
+  void Prepare(const std::string& config_content, CheckCallback callback);
+  // Replaces the running process with one running |config_content|. The
+  // config is checked first (reusing a matching Prepare()) and the running
+  // process is left alone if the check fails.
+  bool Switch(const std::string& config_content);
+  // Applies |config_content| to the running process: in place with SIGHUP
+  // after a check when only sections sing-box can re-read changed, with a
+  // Switch() when the inbounds changed. |callback| runs once the new config
+  // is running, was rejected, or the process exited. Returns false if
+  // nothing is running.
+  bool Reload(const std::string& config_content, ReloadCallback callback);
+
+  // Phases of the latest start.
+  const StartTimeline& timeline() const { return timeline_; }
+
+  // Loop thread only. The Clash API port of the latest start, or 0 when
+  // its config has none.
+  uint16_t api_port() const { return api_port_; }
+  // Loop thread only. The Clash API secret of the latest start, or empty.
+  const std::string& api_secret() const { return api_secret_; }
+
+ private:
+  struct Child {
+    pid_t pid = -1;
+    int pid_fd = -1;
+    int stdin_fd = -1;
+    int output_fd = -1;
+    // The memfd the child reads its config from, or -1 for stdin.
+    int config_fd = -1;
+  };
+
+  enum class CheckState { kNone, kPending, kValid, kInvalid };
+
+  void Log(const std::string& message);
+  void SignalChild(int signal_number);
+  // Spawns "sing-box |command| -c stdin", or with "-c /dev/fd/3" reading
+  // |config_fd| when one is given.
+  bool Spawn(const char* command, Child* child, int config_fd = -1);
+  // Spawns "sing-box run" reading |config_content| from a new memfd, or from
+  // stdin if memfds are unavailable.
+  bool SpawnRun(const std::string& config_content, Child* child);
+  // Kills and reaps a child that is not the running process. Its
+  // descriptors must already be unwatched.
+  static void Discard(Child* child);
+  // Makes |child| the running process. Its config is written from the
+  // event loop, so this never waits for the child to read it.
+  void Launch(Child child, const std::string& config_content);
+  void StopRunning();
+  // Switch() that spawns a standby for the new config only with |standby|;
+  // without one the new process cold-starts and can be reloaded in place.
+  bool Replace(const std::string& config_content, bool standby);
+  // Waits for the pending check and returns whether |config_content| passed.
+  bool WaitForCheck(const std::string& config_content, std::string* output);
+  // Runs "sing-box check" on |config_content|, replacing any earlier check,
+  // and with |with_standby| also spawns a standby process for it.
+  void BeginCheck(const std::string& config_content, bool with_standby, CheckCallback callback);
+
+  // Loop thread only.
+  void WatchChild();
+  void OnOutputReadable();
+  void CloseOutput();
+  void OnChildExited();
+  void OnCheckOutput();
+  void OnCheckExited();
+  void OnStandbyExited();
+  void FinishCheck(bool valid);
+  void DiscardPrepared();
+  void ReportReady(bool confirmed);
+  // Hands the checked reload config to the running process.
+  void OnReloadChecked(bool valid, const std::string& output);
+  void FinishReload(const std::string& error);
+  void OnConfigWritten(bool written);
+  // Restarts the process that just exited, or reports the exit.
+  void OnUnexpectedExit(const std::string& exit_status);
+  // Arms the restart timer. Returns false if there is none.
+  bool ScheduleRestart(int64_t delay_ms);
+  void OnRestartTimer();
+  void CancelRestart();
+
+  EventLoop* loop_;
+  StartTimeline timeline_;
+  ReadinessProbe probe_;
+  std::chrono::milliseconds ready_timeout_;
+  // Loop thread only.
+  bool ready_reported_ = false;
+  uint16_t api_port_ = 0;
+  std::string api_secret_;
+  std::unique_ptr<PipeWriter> config_writer_;
+  // The config of the latest Start() or Reload(), which restarts reuse.
+  std::string last_config_;
+  // The running process's config memfd, or -1 if it read stdin.
+  int config_fd_ = -1;
+  // The Reload() in progress, reported from the first ReportReady() after
+  // the new config was handed over.
+  ReloadCallback reload_callback_;
+  ReloadResult reload_result_;
+  std::string reload_config_;
+  bool reload_applied_ = false;
+  std::chrono::steady_clock::time_point reload_begin_;
+  // Set once the latest Start() was ready; a process that never came up
+  // is not restarted.
+  bool supervised_ = false;
+  bool restart_pending_ = false;
+  int restart_timer_fd_ = -1;
+  RestartPolicy restart_policy_;
+  std::atomic<bool> auto_restart_{true};
+
+  std::mutex mutex_;
+  std::condition_variable exited_cv_;
+  pid_t pid_ = -1;
+  int pid_fd_ = -1;
+  bool stop_requested_ = false;
+  std::atomic<bool> is_running_{false};
+
+  // stdout and stderr share one pipe so the ring has a single producer and
+  // lines from the two streams never interleave.
+  int output_fd_ = -1;
+  LogRing* log_ring_ = nullptr;
+  ChildCgroup* cgroup_ = nullptr;
+
+  // Owned by the loop thread; other threads go through RunSync().
+  Child check_;
+  std::unique_ptr<PipeWriter> check_writer_;
+  // Output of the running check, capped.
+  std::string check_output_;
+  CheckCallback check_callback_;
+  Child standby_;
+  std::string standby_config_;
+
+  // Guarded by |mutex_|.
+  std::condition_variable checked_cv_;
+  std::string checked_config_;
+  std::string checked_output_;
+  CheckState check_state_ = CheckState::kNone;
+
+  std::function<void(const std::string&)> log_callback_;
+  std::function<void()> exit_callback_;
+  std::function<void(bool confirmed)> ready_callback_;
+  std::function<void(const RestartEvent& event)> restart_callback_;
+};
+
+#endif  // RUNNER_PROCESS_MANAGER_H_
@@ -0,0 +1,187 @@
+#include "readiness_probe.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "clash_api.h"
+
+namespace {
+constexpr long kIntervalNs = 50 * 1000 * 1000;
+constexpr size_t kMaxResponse = 64;
+
+// A non-blocking socket connecting to 127.0.0.1:|port|, or -1 when the
+// connection was refused outright.
+int ConnectLoopback(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+}  // namespace
+
+ReadinessProbe::ReadinessProbe(EventLoop* loop) : loop_(loop) {}
+
+ReadinessProbe::~ReadinessProbe() {
+  loop_->RunSync([this]() { Cancel(); });
+}
+
+void ReadinessProbe::Start(uint16_t port, const std::string& secret, std::chrono::milliseconds timeout,
+                           DoneCallback done) {
+  Cancel();
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    return;
+  }
+  itimerspec interval = {};
+  interval.it_interval.tv_nsec = kIntervalNs;
+  interval.it_value.tv_nsec = kIntervalNs;
+  timerfd_settime(timer_fd_, 0, &interval, nullptr);
+  loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTick(); });
+
+  port_ = port;
+  request_ = ClashApiProbeRequest(secret);
+  deadline_ = std::chrono::steady_clock::now() + timeout;
+  done_ = std::move(done);
+  if (port_ != 0) {
+    Connect();
+  }
+}
+
+void ReadinessProbe::StartAfterClose(uint16_t old_port, uint16_t port, const std::string& secret,
+                                     std::chrono::milliseconds timeout, DoneCallback done) {
+  Start(0, secret, timeout, std::move(done));
+  port_ = port;
+  if (timer_fd_ < 0) {
+    return;
+  }
+  held_fd_ = old_port != 0 ? ConnectLoopback(old_port) : -1;
+  if (held_fd_ < 0) {
+    // Nothing to wait for.
+    if (port_ != 0) {
+      Connect();
+    }
+    return;
+  }
+  loop_->Watch(held_fd_, EPOLLIN | EPOLLRDHUP, [this](uint32_t) { OnHeldEvent(); });
+}
+
+void ReadinessProbe::Cancel() {
+  CloseSocket();
+  CloseHeld();
+  if (timer_fd_ >= 0) {
+    loop_->Unwatch(timer_fd_);
+    close(timer_fd_);
+    timer_fd_ = -1;
+  }
+  done_ = nullptr;
+}
+
+void ReadinessProbe::OnTick() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (std::chrono::steady_clock::now() >= deadline_) {
+    Finish(false);
+    return;
+  }
+  if (port_ != 0 && socket_fd_ < 0 && held_fd_ < 0) {
+    Connect();
+  }
+}
+
+void ReadinessProbe::Connect() {
+  socket_fd_ = ConnectLoopback(port_);
+  if (socket_fd_ < 0) {
+    // Refused: sing-box has not opened the API yet. Retry on the next tick.
+    return;
+  }
+  request_sent_ = false;
+  response_.clear();
+  loop_->Watch(socket_fd_, EPOLLOUT | EPOLLIN, [this](uint32_t events) { OnSocketEvent(events); });
+}
+
+void ReadinessProbe::OnSocketEvent(uint32_t events) {
+  if (!request_sent_ && (events & EPOLLOUT) != 0) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0 || send(socket_fd_, request_.data(), request_.size(), MSG_NOSIGNAL) < 0) {
+      CloseSocket();
+      return;
+    }
+    request_sent_ = true;
+    loop_->Rearm(socket_fd_, EPOLLIN);
+    return;
+  }
+
+  char buffer[kMaxResponse];
+  ssize_t bytes_read = recv(socket_fd_, buffer, sizeof(buffer), 0);
+  if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (bytes_read > 0) {
+    response_.append(buffer, static_cast<size_t>(bytes_read));
+    if (response_.size() < 12) {
+      return;
+    }
+  }
+  bool answered = IsHttpResponse(response_);
+  CloseSocket();
+  if (answered) {
+    Finish(true);
+  }
+}
+
+void ReadinessProbe::OnHeldEvent() {
+  // sing-box never writes on a connection that sent no request; anything
+  // but the close or reset is ignored.
+  char buffer[kMaxResponse];
+  ssize_t bytes_read = recv(held_fd_, buffer, sizeof(buffer), 0);
+  if (bytes_read > 0 || (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))) {
+    return;
+  }
+  CloseHeld();
+  if (port_ != 0) {
+    Connect();
+  }
+}
+
+void ReadinessProbe::CloseHeld() {
+  if (held_fd_ >= 0) {
+    loop_->Unwatch(held_fd_);
+    close(held_fd_);
+    held_fd_ = -1;
+  }
+}
+
+void ReadinessProbe::CloseSocket() {
+  if (socket_fd_ >= 0) {
+    loop_->Unwatch(socket_fd_);
+    close(socket_fd_);
+    socket_fd_ = -1;
+  }
+}
+
+void ReadinessProbe::Finish(bool answered) {
+  DoneCallback done = std::move(done_);
+  Cancel();
+  if (done) {
+    done(answered);
+  }
+}
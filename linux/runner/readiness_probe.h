@@ -0,0 +1,63 @@
+#ifndef RUNNER_READINESS_PROBE_H_
+#define RUNNER_READINESS_PROBE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "event_loop.h"
+
+// Polls sing-box's Clash API on 127.0.0.1 until it answers HTTP, as a
+// readiness signal that works whatever the log level.
+//
+// A timerfd ticks every 50 ms; each tick without a connection in flight
+// starts a non-blocking connect and sends ClashApiProbeRequest(), with the
+// run's secret as a bearer token. All of it runs on the event loop thread.
+class ReadinessProbe {
+ public:
+  // Receives true when the API answered, false when |timeout| ran out.
+  using DoneCallback = std::function<void(bool answered)>;
+
+  explicit ReadinessProbe(EventLoop* loop);
+  ~ReadinessProbe();
+
+  ReadinessProbe(const ReadinessProbe&) = delete;
+  ReadinessProbe& operator=(const ReadinessProbe&) = delete;
+
+  // Loop thread only. Restarts the probe, sending |secret| unless it is
+  // empty. With |port| 0 nothing is probed and |done| only reports the
+  // timeout.
+  void Start(uint16_t port, const std::string& secret, std::chrono::milliseconds timeout, DoneCallback done);
+  // Loop thread only. Like Start(), for an in-place reload: the API that
+  // answers on |old_port| now belongs to the instance being replaced, so a
+  // connection to it is held open and |port| is only probed once sing-box
+  // has closed it. With |old_port| 0 this is Start().
+  void StartAfterClose(uint16_t old_port, uint16_t port, const std::string& secret, std::chrono::milliseconds timeout,
+                       DoneCallback done);
+  // Loop thread only. Stops without calling |done|.
+  void Cancel();
+
+ private:
+  void OnTick();
+  void Connect();
+  void OnSocketEvent(uint32_t events);
+  void OnHeldEvent();
+  void CloseSocket();
+  void CloseHeld();
+  void Finish(bool answered);
+
+  EventLoop* loop_;
+  int timer_fd_ = -1;
+  int socket_fd_ = -1;
+  // The connection to the replaced instance's API, open until it closes.
+  int held_fd_ = -1;
+  uint16_t port_ = 0;
+  std::string request_;
+  bool request_sent_ = false;
+  std::string response_;
+  std::chrono::steady_clock::time_point deadline_;
+  DoneCallback done_;
+};
+
+#endif  // RUNNER_READINESS_PROBE_H_
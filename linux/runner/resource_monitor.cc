@@ -0,0 +1,285 @@
+#include "resource_monitor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+namespace {
+
+// Stall over a two second window, the shortest unprivileged processes may
+// arm: 150 ms for memory, a second for cpu and half that for io.
+constexpr const char* kTriggers[] = {
+    "some 1000000 2000000",
+    "some 150000 2000000",
+    "some 500000 2000000",
+};
+
+// Reads a small /proc or cgroup file into |contents|.
+bool ReadFile(const std::string& path, std::string* contents) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  contents->clear();
+  char buffer[4096];
+  ssize_t bytes_read;
+  while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+    contents->append(buffer, static_cast<size_t>(bytes_read));
+  }
+  close(fd);
+  return bytes_read == 0;
+}
+
+// The number after "|key|" at the start of a line of |contents|, as in
+// "VmRSS:   1234 kB" or "anon 4096".
+uint64_t FindField(std::string_view contents, std::string_view key) {
+  size_t position = 0;
+  while (position < contents.size()) {
+    size_t end = contents.find('\n', position);
+    std::string_view line = contents.substr(position, end == std::string_view::npos ? end : end - position);
+    if (line.size() > key.size() && line.compare(0, key.size(), key) == 0 &&
+        (line[key.size()] == ' ' || line[key.size()] == '\t')) {
+      return std::strtoull(std::string(line.substr(key.size())).c_str(), nullptr, 10);
+    }
+    if (end == std::string_view::npos) {
+      break;
+    }
+    position = end + 1;
+  }
+  return 0;
+}
+
+// The avg10 of the "some" or "full" line of a pressure file.
+double FindAverage(std::string_view contents, std::string_view kind) {
+  size_t line = contents.find(kind);
+  if (line == std::string_view::npos) {
+    return 0;
+  }
+  size_t average = contents.find("avg10=", line);
+  if (average == std::string_view::npos) {
+    return 0;
+  }
+  return std::strtod(std::string(contents.substr(average + 6, 8)).c_str(), nullptr);
+}
+
+}  // namespace
+
+const char* PressureResourceName(PressureResource resource) {
+  switch (resource) {
+    case PressureResource::kCpu:
+      return "cpu";
+    case PressureResource::kMemory:
+      return "memory";
+    case PressureResource::kIo:
+      return "io";
+  }
+  return "";
+}
+
+ResourceMonitor::ResourceMonitor(EventLoop* loop) : loop_(loop) {}
+
+ResourceMonitor::~ResourceMonitor() {
+  loop_->RunSync([this]() {
+    Stop();
+    if (timer_fd_ >= 0) {
+      loop_->Unwatch(timer_fd_);
+      close(timer_fd_);
+      timer_fd_ = -1;
+    }
+  });
+}
+
+void ResourceMonitor::Start(pid_t pid, const std::string& cgroup_path, PressureCallback on_pressure) {
+  Stop();
+  next_ = 0;
+  size_ = 0;
+  sequence_ = 0;
+  if (pid <= 0) {
+    return;
+  }
+  if (timer_fd_ < 0) {
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0 || !loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTimer(); })) {
+      return;
+    }
+  }
+  pid_ = pid;
+  cgroup_path_ = cgroup_path;
+  on_pressure_ = std::move(on_pressure);
+  last_cpu_ticks_ = 0;
+  last_sample_time_ = std::chrono::steady_clock::time_point();
+  for (size_t i = 0; i < triggers_.size(); i++) {
+    ArmTrigger(static_cast<PressureResource>(i));
+  }
+  itimerspec when = {};
+  when.it_interval.tv_sec = kInterval.count();
+  when.it_value = when.it_interval;
+  timerfd_settime(timer_fd_, 0, &when, nullptr);
+}
+
+void ResourceMonitor::Stop() {
+  if (timer_fd_ >= 0) {
+    itimerspec when = {};
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  }
+  for (Trigger& trigger : triggers_) {
+    CloseTrigger(&trigger);
+  }
+  pid_ = -1;
+  on_pressure_ = nullptr;
+}
+
+std::vector<ResourceSample> ResourceMonitor::History(uint64_t* sequence) {
+  std::vector<ResourceSample> samples;
+  loop_->RunSync([this, &samples, sequence]() {
+    samples.reserve(size_);
+    size_t first = (next_ + kCapacity - size_) % kCapacity;
+    for (size_t i = 0; i < size_; i++) {
+      samples.push_back(samples_[(first + i) % kCapacity]);
+    }
+    *sequence = sequence_;
+  });
+  return samples;
+}
+
+void ResourceMonitor::OnTimer() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (pid_ <= 0) {
+    return;
+  }
+  std::string proc = "/proc/" + std::to_string(pid_);
+  std::string contents;
+  if (!ReadFile(proc + "/stat", &contents)) {
+    // The child is gone; its exit is reported by the process manager.
+    return;
+  }
+  ResourceSample sample;
+  // Fields after the parenthesised command, which may contain spaces.
+  // utime and stime are the 12th and 13th of them, num_threads the 18th.
+  size_t comm_end = contents.rfind(')');
+  std::vector<std::string_view> fields;
+  std::string_view rest = std::string_view(contents).substr(comm_end == std::string::npos ? 0 : comm_end + 2);
+  while (!rest.empty() && fields.size() < 18) {
+    size_t space = rest.find(' ');
+    fields.push_back(rest.substr(0, space));
+    rest = space == std::string_view::npos ? std::string_view() : rest.substr(space + 1);
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (fields.size() >= 18) {
+    uint64_t ticks = std::strtoull(std::string(fields[11]).c_str(), nullptr, 10) +
+                     std::strtoull(std::string(fields[12]).c_str(), nullptr, 10);
+    sample.threads = static_cast<uint32_t>(std::strtoul(std::string(fields[17]).c_str(), nullptr, 10));
+    double elapsed = std::chrono::duration<double>(now - last_sample_time_).count();
+    if (last_sample_time_ != std::chrono::steady_clock::time_point() && elapsed > 0 && ticks >= last_cpu_ticks_) {
+      sample.cpu_percent =
+          static_cast<double>(ticks - last_cpu_ticks_) / static_cast<double>(sysconf(_SC_CLK_TCK)) / elapsed * 100;
+    }
+    last_cpu_ticks_ = ticks;
+    last_sample_time_ = now;
+  }
+  if (ReadFile(proc + "/status", &contents)) {
+    sample.rss_bytes = FindField(contents, "VmRSS:") * 1024;
+    sample.rss_peak_bytes = FindField(contents, "VmHWM:") * 1024;
+    sample.swap_bytes = FindField(contents, "VmSwap:") * 1024;
+  }
+  if (ReadFile(proc + "/io", &contents)) {
+    sample.read_bytes = FindField(contents, "read_bytes:");
+    sample.write_bytes = FindField(contents, "write_bytes:");
+  }
+  if (!cgroup_path_.empty()) {
+    if (ReadFile(cgroup_path_ + "/memory.current", &contents)) {
+      sample.memory_current = std::strtoull(contents.c_str(), nullptr, 10);
+    }
+    if (ReadFile(cgroup_path_ + "/memory.stat", &contents)) {
+      sample.memory_anon = FindField(contents, "anon");
+      sample.memory_file = FindField(contents, "file");
+    }
+    if (ReadFile(cgroup_path_ + "/memory.events", &contents)) {
+      sample.memory_high_events = FindField(contents, "high");
+      sample.memory_max_events = FindField(contents, "max");
+      sample.oom_kills = FindField(contents, "oom_kill");
+    }
+    if (ReadFile(cgroup_path_ + "/cpu.stat", &contents)) {
+      sample.cpu_throttled_us = FindField(contents, "throttled_usec");
+    }
+  }
+
+  samples_[next_] = sample;
+  next_ = (next_ + 1) % kCapacity;
+  if (size_ < kCapacity) {
+    size_++;
+  }
+  sequence_++;
+}
+
+void ResourceMonitor::ArmTrigger(PressureResource resource) {
+  Trigger* trigger = &triggers_[static_cast<size_t>(resource)];
+  const char* trigger_spec = kTriggers[static_cast<size_t>(resource)];
+  std::string name = std::string(PressureResourceName(resource)) + ".pressure";
+  std::string paths[] = {cgroup_path_.empty() ? std::string() : cgroup_path_ + "/" + name,
+                         std::string("/proc/pressure/") + PressureResourceName(resource)};
+  for (size_t i = 0; i < 2; i++) {
+    if (paths[i].empty()) {
+      continue;
+    }
+    int fd = open(paths[i].c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    if (write(fd, trigger_spec, strlen(trigger_spec) + 1) < 0 ||
+        !loop_->Watch(fd, EPOLLPRI, [this, resource](uint32_t events) { OnTrigger(resource, events); })) {
+      close(fd);
+      continue;
+    }
+    trigger->fd = fd;
+    trigger->system_wide = i == 1;
+    trigger->path = paths[i];
+    trigger->last_reported = std::chrono::steady_clock::time_point();
+    return;
+  }
+}
+
+void ResourceMonitor::OnTrigger(PressureResource resource, uint32_t events) {
+  Trigger* trigger = &triggers_[static_cast<size_t>(resource)];
+  if ((events & EPOLLERR) != 0) {
+    // The cgroup was removed under the trigger.
+    CloseTrigger(trigger);
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (trigger->last_reported != std::chrono::steady_clock::time_point() &&
+      now - trigger->last_reported < kPressureQuiet) {
+    return;
+  }
+  trigger->last_reported = now;
+  PressureEvent event;
+  event.resource = resource;
+  event.system_wide = trigger->system_wide;
+  std::string contents;
+  if (ReadFile(trigger->path, &contents)) {
+    event.some_avg10 = FindAverage(contents, "some");
+    event.full_avg10 = FindAverage(contents, "full");
+  }
+  if (!cgroup_path_.empty() && ReadFile(cgroup_path_ + "/memory.current", &contents)) {
+    event.memory_current = std::strtoull(contents.c_str(), nullptr, 10);
+  }
+  if (on_pressure_) {
+    on_pressure_(event);
+  }
+}
+
+void ResourceMonitor::CloseTrigger(Trigger* trigger) {
+  if (trigger->fd >= 0) {
+    loop_->Unwatch(trigger->fd);
+    close(trigger->fd);
+    trigger->fd = -1;
+  }
+}
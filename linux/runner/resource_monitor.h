@@ -0,0 +1,120 @@
+#ifndef RUNNER_RESOURCE_MONITOR_H_
+#define RUNNER_RESOURCE_MONITOR_H_
+
+#include <sys/types.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+
+// What sing-box used over one sampling interval.
+struct ResourceSample {
+  // Share of one CPU over the interval, in percent.
+  double cpu_percent = 0;
+  uint64_t rss_bytes = 0;
+  uint64_t rss_peak_bytes = 0;
+  uint64_t swap_bytes = 0;
+  uint32_t threads = 0;
+  // Storage I/O since the process started.
+  uint64_t read_bytes = 0;
+  uint64_t write_bytes = 0;
+  // From the sing-box cgroup; 0 without one or without its controllers.
+  uint64_t memory_current = 0;
+  uint64_t memory_anon = 0;
+  uint64_t memory_file = 0;
+  uint64_t cpu_throttled_us = 0;
+  // memory.events counters: times memory.high throttled the cgroup,
+  // times it hit memory.max and OOM kills inside it.
+  uint64_t memory_high_events = 0;
+  uint64_t memory_max_events = 0;
+  uint64_t oom_kills = 0;
+};
+
+enum class PressureResource : uint8_t { kCpu, kMemory, kIo };
+
+// "cpu", "memory" or "io".
+const char* PressureResourceName(PressureResource resource);
+
+// A pressure stall trigger that fired.
+struct PressureEvent {
+  PressureResource resource = PressureResource::kMemory;
+  // Whether the cgroup could not be watched and this is the whole system.
+  bool system_wide = false;
+  // Percent of the last ten seconds in which some or all tasks stalled.
+  double some_avg10 = 0;
+  double full_avg10 = 0;
+  // The cgroup's memory.current when it fired, 0 without one.
+  uint64_t memory_current = 0;
+};
+
+// Samples the running sing-box from the event loop.
+//
+// A timerfd reads /proc/<pid>/stat, status and io plus the cgroup's
+// memory.current, memory.stat, memory.events and cpu.stat every
+// kInterval into a fixed ring. Pressure stall triggers are armed on the
+// cgroup's cpu, memory and io pressure files, or the system-wide ones in
+// /proc/pressure when those cannot be written, and are watched for
+// EPOLLPRI. Each resource reports at most once per kPressureQuiet.
+class ResourceMonitor {
+ public:
+  // Runs on the loop thread.
+  using PressureCallback = std::function<void(const PressureEvent& event)>;
+
+  static constexpr size_t kCapacity = 600;
+
+  explicit ResourceMonitor(EventLoop* loop);
+  ~ResourceMonitor();
+
+  ResourceMonitor(const ResourceMonitor&) = delete;
+  ResourceMonitor& operator=(const ResourceMonitor&) = delete;
+
+  // Loop thread only. Starts a new history for |pid|, in the cgroup at
+  // |cgroup_path| unless that is empty.
+  void Start(pid_t pid, const std::string& cgroup_path, PressureCallback on_pressure);
+  // Loop thread only. Keeps the history.
+  void Stop();
+
+  // Safe from any thread. The recorded samples, oldest first, and the
+  // sequence number of the newest.
+  std::vector<ResourceSample> History(uint64_t* sequence);
+
+ private:
+  static constexpr std::chrono::seconds kInterval{1};
+  static constexpr std::chrono::seconds kPressureQuiet{30};
+
+  struct Trigger {
+    int fd = -1;
+    bool system_wide = false;
+    // Where the averages are read when it fires.
+    std::string path;
+    std::chrono::steady_clock::time_point last_reported;
+  };
+
+  void OnTimer();
+  void ArmTrigger(PressureResource resource);
+  void OnTrigger(PressureResource resource, uint32_t events);
+  void CloseTrigger(Trigger* trigger);
+
+  EventLoop* loop_;
+  int timer_fd_ = -1;
+  pid_t pid_ = -1;
+  std::string cgroup_path_;
+  PressureCallback on_pressure_;
+  std::array<Trigger, 3> triggers_;
+
+  // CPU ticks of the previous sample, for the next one's cpu_percent.
+  uint64_t last_cpu_ticks_ = 0;
+  std::chrono::steady_clock::time_point last_sample_time_;
+
+  std::array<ResourceSample, kCapacity> samples_ = {};
+  size_t next_ = 0;
+  size_t size_ = 0;
+  uint64_t sequence_ = 0;
+};
+
+#endif  // RUNNER_RESOURCE_MONITOR_H_
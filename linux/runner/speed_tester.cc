@@ -0,0 +1,391 @@
+#include "speed_tester.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kReadBufferSize = 64 * 1024;
+constexpr size_t kMaxDatagram = 2048;
+
+// Fills |address| from an IPv4 or IPv6 literal.
+bool ParseAddress(const std::string& ip, uint16_t port, sockaddr_storage* address, socklen_t* length) {
+  auto* v4 = reinterpret_cast<sockaddr_in*>(address);
+  if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    *length = sizeof(sockaddr_in);
+    return true;
+  }
+  auto* v6 = reinterpret_cast<sockaddr_in6*>(address);
+  if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    *length = sizeof(sockaddr_in6);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+SpeedTester::SpeedTester(EventLoop* loop) : loop_(loop) {}
+
+SpeedTester::~SpeedTester() {
+  loop_->RunSync([this]() {
+    CloseAll();
+    if (timer_fd_ >= 0) {
+      loop_->Unwatch(timer_fd_);
+      close(timer_fd_);
+      timer_fd_ = -1;
+    }
+  });
+}
+
+bool SpeedTester::Start(SpeedTestOptions options, ProgressCallback on_progress, DoneCallback done) {
+  if (running_.exchange(true)) {
+    return false;
+  }
+  loop_->Post([this, options = std::move(options), on_progress = std::move(on_progress),
+               done = std::move(done)]() mutable {
+    options_ = std::move(options);
+    on_progress_ = std::move(on_progress);
+    done_ = std::move(done);
+    phases_ = PlannedSpeedTestPhases(options_);
+    phase_index_ = 0;
+    results_.clear();
+    last_error_.clear();
+    if (phases_.empty()) {
+      Finish("Nothing to test.");
+      return;
+    }
+    if (timer_fd_ < 0) {
+      timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (timer_fd_ < 0 || !loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTimer(); })) {
+        Finish("Could not create the speed test timer.");
+        return;
+      }
+    }
+    StartPhase();
+  });
+  return true;
+}
+
+void SpeedTester::Cancel() {
+  loop_->Post([this]() {
+    if (done_) {
+      Finish("Cancelled.");
+    }
+  });
+}
+
+void SpeedTester::StartPhase() {
+  SpeedTestPhase phase = phases_[phase_index_];
+  auto now = SpeedTestClock::now();
+  auto warmup = std::min<SpeedTestClock::duration>(std::chrono::seconds(1), options_.phase_duration / 4);
+  meter_ = std::make_unique<SpeedTestMeter>(phase, now, warmup);
+  deadline_ = now + options_.phase_duration;
+  last_tick_ = now;
+  last_bytes_ = 0;
+
+  size_t streams = phase == SpeedTestPhase::kUdp ? 1 : options_.streams;
+  for (size_t i = 0; i < streams; i++) {
+    if (!OpenConnection()) {
+      Finish("Could not reach the mixed inbound at " + options_.proxy_ip + ":" +
+             std::to_string(options_.proxy_port) + ".");
+      return;
+    }
+  }
+  itimerspec when = {};
+  when.it_interval.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(kProgressInterval).count();
+  when.it_value = when.it_interval;
+  timerfd_settime(timer_fd_, 0, &when, nullptr);
+}
+
+void SpeedTester::EndPhase() {
+  CloseAll();
+  SpeedTestResult result = meter_->Finish(SpeedTestClock::now());
+  meter_.reset();
+  results_.push_back(result);
+  if (result.bytes == 0 && result.failed_streams > 0) {
+    Finish(last_error_);
+    return;
+  }
+  if (++phase_index_ < phases_.size()) {
+    StartPhase();
+    return;
+  }
+  Finish("");
+}
+
+void SpeedTester::Finish(const std::string& error) {
+  CloseAll();
+  meter_.reset();
+  if (timer_fd_ >= 0) {
+    itimerspec when = {};
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  }
+  DoneCallback done = std::move(done_);
+  done_ = nullptr;
+  on_progress_ = nullptr;
+  std::vector<SpeedTestResult> results = std::move(results_);
+  results_.clear();
+  running_ = false;
+  if (done) {
+    done(results, error);
+  }
+}
+
+bool SpeedTester::OpenConnection() {
+  sockaddr_storage address = {};
+  socklen_t length = 0;
+  if (options_.proxy_port == 0 || !ParseAddress(options_.proxy_ip, options_.proxy_port, &address, &length)) {
+    return false;
+  }
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return false;
+  }
+  if (!loop_->Watch(fd, EPOLLOUT, [this, fd](uint32_t events) { OnEvent(fd, events); })) {
+    close(fd);
+    return false;
+  }
+  Connection& connection = connections_[fd];
+  connection.fd = fd;
+  SpeedTestPhase phase = phases_[phase_index_];
+  connection.stream = std::make_unique<SpeedTestStream>(
+      phase, phase == SpeedTestPhase::kUpload ? options_.upload_url : options_.download_url, options_.upload_size,
+      meter_.get());
+  return true;
+}
+
+void SpeedTester::OnEvent(int fd, uint32_t events) {
+  auto it = connections_.find(fd);
+  if (it == connections_.end()) {
+    return;
+  }
+  Connection* connection = &it->second;
+  SpeedTestStream* stream = connection->stream.get();
+  if (!connection->connected) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+      last_error_ = "Could not reach the mixed inbound at " + options_.proxy_ip + ":" +
+                    std::to_string(options_.proxy_port) + ".";
+      CloseConnection(fd, true);
+      return;
+    }
+    connection->connected = true;
+  }
+
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+    static char buffer[kReadBufferSize];
+    for (int i = 0; i < kMaxIoPerEvent; i++) {
+      ssize_t bytes_read = recv(fd, buffer, sizeof(buffer), 0);
+      if (bytes_read < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes_read < 0 && errno == EAGAIN) {
+        break;
+      }
+      if (bytes_read <= 0) {
+        bool clean = bytes_read == 0 && stream->OnClosed();
+        if (!clean && stream->error().empty()) {
+          last_error_ = "The connection to the mixed inbound failed.";
+        }
+        CloseConnection(fd, !clean);
+        return;
+      }
+      if (!stream->OnReceived(buffer, static_cast<size_t>(bytes_read), SpeedTestClock::now())) {
+        CloseConnection(fd, true);
+        return;
+      }
+      if (static_cast<size_t>(bytes_read) < sizeof(buffer)) {
+        break;
+      }
+    }
+  }
+  if (stream->finished()) {
+    CloseConnection(fd, false);
+    return;
+  }
+  if (!Flush(connection)) {
+    last_error_ = "The connection to the mixed inbound failed.";
+    CloseConnection(fd, true);
+    return;
+  }
+  if (stream->associated() && udp_fd_ < 0) {
+    OpenDatagramSocket(*stream);
+    if (udp_fd_ < 0) {
+      // No relay socket ended the phase along with this connection.
+      return;
+    }
+  }
+  loop_->Rearm(fd, EPOLLIN | (stream->output().empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+}
+
+bool SpeedTester::Flush(Connection* connection) {
+  SpeedTestStream* stream = connection->stream.get();
+  for (int i = 0; i < kMaxIoPerEvent; i++) {
+    std::string_view output = stream->output();
+    if (output.empty()) {
+      return true;
+    }
+    ssize_t sent = send(connection->fd, output.data(), output.size(), MSG_NOSIGNAL);
+    if (sent < 0) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    stream->OnSent(static_cast<size_t>(sent), SpeedTestClock::now());
+    if (static_cast<size_t>(sent) < output.size()) {
+      return true;
+    }
+  }
+  return true;
+}
+
+void SpeedTester::CloseConnection(int fd, bool failed) {
+  auto it = connections_.find(fd);
+  if (it == connections_.end()) {
+    return;
+  }
+  std::unique_ptr<SpeedTestStream> stream = std::move(it->second.stream);
+  connections_.erase(it);
+  loop_->Unwatch(fd);
+  close(fd);
+  if (failed) {
+    if (!stream->error().empty()) {
+      last_error_ = stream->error();
+    }
+    meter_->AddFailedStream();
+  }
+
+  // The association ends with its control connection.
+  bool udp = phases_[phase_index_] == SpeedTestPhase::kUdp;
+  if (udp || (failed && connections_.empty())) {
+    EndPhase();
+    return;
+  }
+  if (!failed && !OpenConnection()) {
+    meter_->AddFailedStream();
+    if (connections_.empty()) {
+      EndPhase();
+    }
+  }
+}
+
+void SpeedTester::CloseAll() {
+  for (auto& entry : connections_) {
+    loop_->Unwatch(entry.first);
+    close(entry.first);
+  }
+  connections_.clear();
+  if (udp_fd_ >= 0) {
+    loop_->Unwatch(udp_fd_);
+    close(udp_fd_);
+    udp_fd_ = -1;
+  }
+  udp_flow_.reset();
+  udp_pending_.clear();
+}
+
+void SpeedTester::OpenDatagramSocket(const SpeedTestStream& control) {
+  const std::string& relay_ip = control.relay_ip().empty() ? options_.proxy_ip : control.relay_ip();
+  sockaddr_storage address = {};
+  socklen_t length = 0;
+  int fd = -1;
+  if (ParseAddress(relay_ip, control.relay_port(), &address, &length)) {
+    fd = socket(address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  }
+  // Connected, so only the relay's datagrams arrive and an unreachable
+  // relay shows up as ECONNREFUSED.
+  if (fd >= 0 && (connect(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+                  !loop_->Watch(fd, EPOLLIN | EPOLLOUT, [this](uint32_t events) { OnDatagramEvent(events); }))) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    last_error_ = "Could not reach the UDP relay of the mixed inbound.";
+    meter_->AddFailedStream();
+    EndPhase();
+    return;
+  }
+  udp_fd_ = fd;
+  udp_flow_ = std::make_unique<SpeedTestUdpFlow>(options_.udp_echo_host, options_.udp_echo_port, meter_.get());
+}
+
+void SpeedTester::OnDatagramEvent(uint32_t events) {
+  if ((events & (EPOLLIN | EPOLLERR)) != 0) {
+    char buffer[kMaxDatagram];
+    for (int i = 0; i < kMaxIoPerEvent; i++) {
+      ssize_t bytes_read = recv(udp_fd_, buffer, sizeof(buffer), 0);
+      if (bytes_read < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+          break;
+        }
+        last_error_ = "The UDP relay of the mixed inbound is unreachable.";
+        meter_->AddFailedStream();
+        EndPhase();
+        return;
+      }
+      udp_flow_->OnDatagram(buffer, static_cast<size_t>(bytes_read), SpeedTestClock::now());
+    }
+  }
+  PumpDatagrams();
+}
+
+void SpeedTester::PumpDatagrams() {
+  if (udp_fd_ < 0) {
+    return;
+  }
+  for (;;) {
+    if (udp_pending_.empty() && !udp_flow_->NextDatagram(SpeedTestClock::now(), &udp_pending_)) {
+      break;
+    }
+    if (send(udp_fd_, udp_pending_.data(), udp_pending_.size(), 0) < 0) {
+      if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR) {
+        break;
+      }
+    }
+    udp_pending_.clear();
+  }
+  // With the window full the next echo or expiry sends more, so the socket
+  // is only watched for room while a datagram waits for it.
+  loop_->Rearm(udp_fd_, EPOLLIN | (udp_pending_.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+}
+
+void SpeedTester::OnTimer() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (!meter_) {
+    return;
+  }
+  auto now = SpeedTestClock::now();
+  if (udp_flow_) {
+    udp_flow_->Expire(now);
+    PumpDatagrams();
+  }
+  uint64_t bytes = meter_->bytes();
+  double seconds = std::chrono::duration<double>(now - last_tick_).count();
+  double bps = seconds > 0 ? static_cast<double>(bytes - last_bytes_) * 8 / seconds : 0;
+  last_tick_ = now;
+  last_bytes_ = bytes;
+  if (on_progress_) {
+    on_progress_(phases_[phase_index_],
+                 std::chrono::duration_cast<std::chrono::milliseconds>(now - meter_->start()).count(), bytes, bps);
+  }
+  if (now >= deadline_) {
+    EndPhase();
+  }
+}
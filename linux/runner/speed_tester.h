@@ -0,0 +1,96 @@
+#ifndef RUNNER_SPEED_TESTER_H_
+#define RUNNER_SPEED_TESTER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "event_loop.h"
+#include "speed_test.h"
+
+// Measures tunnel throughput through the mixed inbound from the event loop.
+//
+// A TCP phase keeps options.streams non-blocking connections to the proxy
+// busy and opens a new one whenever the server ends a response on a
+// connection it will not reuse. The UDP phase holds one SOCKS5 association
+// and a connected datagram socket. A single timerfd ticks every
+// kProgressInterval to report progress, expire lost datagrams and end the
+// phase.
+class SpeedTester {
+ public:
+  // Receives the running phase, milliseconds since it started, its bytes so
+  // far and the bits per second over the last tick.
+  using ProgressCallback = std::function<void(SpeedTestPhase phase, int64_t elapsed_ms, uint64_t bytes, double bps)>;
+  // Receives every finished phase and, when the test stopped early, why.
+  using DoneCallback = std::function<void(const std::vector<SpeedTestResult>& results, const std::string& error)>;
+
+  explicit SpeedTester(EventLoop* loop);
+  ~SpeedTester();
+
+  SpeedTester(const SpeedTester&) = delete;
+  SpeedTester& operator=(const SpeedTester&) = delete;
+
+  // Safe from any thread. Returns false while another test runs. Both
+  // callbacks run on the loop thread, |done| exactly once.
+  bool Start(SpeedTestOptions options, ProgressCallback on_progress, DoneCallback done);
+  // Safe from any thread. Stops a running test with "Cancelled.".
+  void Cancel();
+
+ private:
+  static constexpr std::chrono::milliseconds kProgressInterval{250};
+  // Reads or writes per readiness event, so one busy stream cannot starve
+  // the others or the loop's other services.
+  static constexpr int kMaxIoPerEvent = 16;
+
+  struct Connection {
+    int fd = -1;
+    bool connected = false;
+    std::unique_ptr<SpeedTestStream> stream;
+  };
+
+  void StartPhase();
+  void EndPhase();
+  void Finish(const std::string& error);
+  // Opens one more connection to the proxy; false when the socket fails.
+  bool OpenConnection();
+  void OnEvent(int fd, uint32_t events);
+  // Sends what the stream has queued; false on a socket error.
+  bool Flush(Connection* connection);
+  // Closes |fd|. A connection that failed is counted and not replaced.
+  void CloseConnection(int fd, bool failed);
+  void CloseAll();
+  void OpenDatagramSocket(const SpeedTestStream& control);
+  void OnDatagramEvent(uint32_t events);
+  void PumpDatagrams();
+  void OnTimer();
+
+  EventLoop* loop_;
+  std::atomic<bool> running_{false};
+
+  // Loop thread only from here on.
+  SpeedTestOptions options_;
+  ProgressCallback on_progress_;
+  DoneCallback done_;
+  std::vector<SpeedTestPhase> phases_;
+  size_t phase_index_ = 0;
+  std::vector<SpeedTestResult> results_;
+  std::string last_error_;
+
+  std::unique_ptr<SpeedTestMeter> meter_;
+  std::unordered_map<int, Connection> connections_;
+  std::unique_ptr<SpeedTestUdpFlow> udp_flow_;
+  int udp_fd_ = -1;
+  // A datagram the socket had no room for.
+  std::string udp_pending_;
+  int timer_fd_ = -1;
+  SpeedTestClock::time_point deadline_;
+  SpeedTestClock::time_point last_tick_;
+  uint64_t last_bytes_ = 0;
+};
+
+#endif  // RUNNER_SPEED_TESTER_H_
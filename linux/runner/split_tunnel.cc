@@ -0,0 +1,595 @@
+#include "split_tunnel.h"
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/fib_rules.h>
+#include <linux/magic.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "config_builder.h"
+
+extern char** environ;
+
+namespace {
+
+constexpr char kTable[] = "hwl_vpn_split";
+constexpr char kCgroupName[] = "hwl-vpn-split";
+constexpr uint32_t kMark = 0x4857;
+// Ahead of the rules sing-box's auto_route adds from 9000.
+constexpr uint32_t kRulePriority = 8900;
+// How often /proc is walked when exec events are unavailable.
+constexpr time_t kRescanIntervalS = 3;
+constexpr size_t kCommLength = 15;
+constexpr char kSrcValidMark[] = "/proc/sys/net/ipv4/conf/all/src_valid_mark";
+
+bool WriteFile(const std::string& path, const std::string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return written;
+}
+
+std::string ReadFirstLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+// The cgroup v2 mount, or empty on a cgroup v1 only system.
+std::string FindCgroupRoot() {
+  for (const char* path : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+    struct statfs root;
+    if (statfs(path, &root) == 0 && root.f_type == CGROUP2_SUPER_MAGIC) {
+      return path;
+    }
+  }
+  return "";
+}
+
+// |pid|'s cgroup v2 path without the leading slash, "" for the root. False
+// when the process is gone.
+bool ReadProcessCgroup(pid_t pid, std::string* cgroup) {
+  std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.rfind("0::/", 0) == 0) {
+      *cgroup = line.substr(4);
+      return true;
+    }
+  }
+  return false;
+}
+
+// The directory of cgroup |relative| under |root|.
+std::string CgroupDirectory(const std::string& root, const std::string& relative) {
+  return relative.empty() ? root : root + "/" + relative;
+}
+
+// Whether all of |pid|'s user IDs, real, effective, saved and filesystem,
+// are |owner|.
+bool IsOwnedBy(pid_t pid, uid_t owner) {
+  std::ifstream file("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.rfind("Uid:", 0) != 0) {
+      continue;
+    }
+    std::istringstream ids(line.substr(4));
+    int count = 0;
+    unsigned long id;
+    while (ids >> id) {
+      if (id != owner) {
+        return false;
+      }
+      count++;
+    }
+    return count == 4;
+  }
+  return false;
+}
+
+// The cgroup a split cgroup was made in.
+std::string ParentCgroup(const std::string& relative) {
+  size_t slash = relative.rfind('/');
+  return slash == std::string::npos ? "" : relative.substr(0, slash);
+}
+
+bool IsSplitCgroup(const std::string& relative) {
+  size_t length = strlen(kCgroupName);
+  return relative.size() >= length && relative.compare(relative.size() - length, length, kCgroupName) == 0 &&
+         (relative.size() == length || relative[relative.size() - length - 1] == '/');
+}
+
+// "172.20.10.1/24" as the network "172.20.10.0/24".
+std::string TunSubnet() {
+  std::string address(kTunAddress);
+  size_t slash = address.find('/');
+  int prefix = std::stoi(address.substr(slash + 1));
+  in_addr host;
+  inet_pton(AF_INET, address.substr(0, slash).c_str(), &host);
+  uint32_t mask = prefix == 0 ? 0 : ~uint32_t{0} << (32 - prefix);
+  host.s_addr = htonl(ntohl(host.s_addr) & mask);
+  char text[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &host, text, sizeof(text));
+  return std::string(text) + address.substr(slash);
+}
+
+// Runs "nft -f -" on |script|. Returns false with nft's complaint in
+// |error|.
+bool RunNft(const std::string& script, std::string* error) {
+  int input = memfd_create("nft-ruleset", MFD_CLOEXEC);
+  int output = memfd_create("nft-output", MFD_CLOEXEC);
+  if (input < 0 || output < 0 ||
+      write(input, script.data(), script.size()) != static_cast<ssize_t>(script.size()) ||
+      lseek(input, 0, SEEK_SET) != 0) {
+    *error = "Cannot pass the ruleset to nft: " + std::string(strerror(errno)) + ".";
+    if (input >= 0) close(input);
+    if (output >= 0) close(output);
+    return false;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, output, STDERR_FILENO);
+  // The event loop thread blocks signals the child should not inherit.
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+  posix_spawnattr_setsigmask(&attributes, &empty_mask);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+  char* argv[] = {const_cast<char*>("nft"), const_cast<char*>("-f"), const_cast<char*>("-"), nullptr};
+  pid_t pid = -1;
+  int spawn_error = posix_spawnp(&pid, "nft", &actions, &attributes, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  close(input);
+  if (spawn_error != 0) {
+    close(output);
+    *error = "Cannot run nft: " + std::string(strerror(spawn_error)) + ".";
+    return false;
+  }
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  bool succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!succeeded) {
+    std::string text;
+    char buffer[4096];
+    ssize_t count;
+    lseek(output, 0, SEEK_SET);
+    while ((count = read(output, buffer, sizeof(buffer))) > 0) {
+      text.append(buffer, static_cast<size_t>(count));
+    }
+    while (!text.empty() && (text.back() == '\n' || text.back() == ' ')) {
+      text.pop_back();
+    }
+    *error = "nft failed" + (text.empty() ? std::string(".") : ": " + text);
+  }
+  close(output);
+  return succeeded;
+}
+
+// Sends one RTM_NEWRULE or RTM_DELRULE for |family| and waits for the
+// kernel's answer.
+bool SendRoutingRule(int family, bool add, bool invert, std::string* error) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    *error = "Cannot open a netlink socket: " + std::string(strerror(errno)) + ".";
+    return false;
+  }
+  struct {
+    nlmsghdr header;
+    fib_rule_hdr rule;
+    char attributes[64];
+  } request = {};
+  request.header.nlmsg_type = add ? RTM_NEWRULE : RTM_DELRULE;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | (add ? NLM_F_CREATE | NLM_F_EXCL : 0);
+  request.header.nlmsg_seq = 1;
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(fib_rule_hdr));
+  request.rule.family = static_cast<uint8_t>(family);
+  request.rule.action = FR_ACT_TO_TBL;
+  request.rule.table = RT_TABLE_MAIN;
+  request.rule.flags = invert ? FIB_RULE_INVERT : 0;
+  auto add_u32 = [&request](uint16_t type, uint32_t value) {
+    auto* attribute = reinterpret_cast<rtattr*>(reinterpret_cast<char*>(&request) +
+                                                NLMSG_ALIGN(request.header.nlmsg_len));
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(sizeof(value));
+    memcpy(RTA_DATA(attribute), &value, sizeof(value));
+    request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+  };
+  add_u32(FRA_PRIORITY, kRulePriority);
+  add_u32(FRA_FWMARK, kMark);
+  add_u32(FRA_FWMASK, ~uint32_t{0});
+  add_u32(FRA_TABLE, RT_TABLE_MAIN);
+
+  sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  int result = -EIO;
+  if (sendto(fd, &request, request.header.nlmsg_len, 0, reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) >= 0) {
+    alignas(nlmsghdr) char buffer[1024];
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    const auto* answer = reinterpret_cast<const nlmsghdr*>(buffer);
+    if (received >= static_cast<ssize_t>(NLMSG_LENGTH(sizeof(nlmsgerr))) && answer->nlmsg_type == NLMSG_ERROR) {
+      result = static_cast<const nlmsgerr*>(NLMSG_DATA(answer))->error;
+    }
+  } else {
+    result = -errno;
+  }
+  close(fd);
+  // A rule left behind by a runner that did not get to clean up is reused.
+  if (result == 0 || (add && result == -EEXIST) || (!add && result == -ENOENT)) {
+    return true;
+  }
+  *error = std::string("Cannot ") + (add ? "add" : "remove") + " the IPv" + (family == AF_INET ? "4" : "6") +
+           " routing rule: " + strerror(-result) + ".";
+  return false;
+}
+
+}  // namespace
+
+SplitTunnelMode ParseSplitTunnelMode(bool enabled, std::string_view mode, size_t app_count) {
+  if (!enabled || app_count == 0) {
+    return SplitTunnelMode::kOff;
+  }
+  if (mode == "only_selected") {
+    return SplitTunnelMode::kInclude;
+  }
+  return mode == "all_except" ? SplitTunnelMode::kExclude : SplitTunnelMode::kOff;
+}
+
+bool MatchesSplitTunnelApp(const std::vector<std::string>& apps, std::string_view exe, std::string_view comm) {
+  // An executable replaced by an upgrade, as apt does to itself.
+  constexpr std::string_view kDeleted = " (deleted)";
+  if (exe.size() > kDeleted.size() && exe.substr(exe.size() - kDeleted.size()) == kDeleted) {
+    exe.remove_suffix(kDeleted.size());
+  }
+  std::string_view exe_name = exe.substr(exe.rfind('/') + 1);
+  for (const std::string& app : apps) {
+    if (app.empty()) {
+      continue;
+    }
+    std::string_view app_name = std::string_view(app).substr(app.rfind('/') + 1);
+    if (!exe.empty()) {
+      if (app.front() == '/' ? exe == app : exe_name == app) {
+        return true;
+      }
+    } else if (!comm.empty() && app_name.substr(0, kCommLength) == comm) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsSafeCgroupPath(std::string_view cgroup) {
+  if (cgroup.empty()) {
+    return false;
+  }
+  size_t start = 0;
+  for (;;) {
+    size_t slash = cgroup.find('/', start);
+    std::string_view name = cgroup.substr(start, slash == std::string_view::npos ? std::string_view::npos : slash - start);
+    if (name.empty() || name == "." || name == "..") {
+      return false;
+    }
+    for (char c : name) {
+      bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                  std::string_view("-_.@:+,=").find(c) != std::string_view::npos;
+      if (!safe) {
+        return false;
+      }
+    }
+    if (slash == std::string_view::npos) {
+      return true;
+    }
+    start = slash + 1;
+  }
+}
+
+std::string BuildSplitTunnelRuleset(SplitTunnelMode mode, const std::set<std::string>& cgroups) {
+  std::ostringstream mark;
+  mark << "0x" << std::hex << kMark;
+  std::ostringstream script;
+  script << "add table inet " << kTable << "\n"
+         << "delete table inet " << kTable << "\n"
+         << "table inet " << kTable << " {\n"
+         << "  chain output {\n"
+         << "    type route hook output priority mangle; policy accept;\n";
+  for (const std::string& cgroup : cgroups) {
+    if (!IsSafeCgroupPath(cgroup)) {
+      continue;
+    }
+    size_t level = 1;
+    for (char c : cgroup) {
+      level += c == '/' ? 1 : 0;
+    }
+    script << "    socket cgroupv2 level " << level << " \"" << cgroup << "\" meta mark set " << mark.str()
+           << " ct mark set meta mark\n";
+  }
+  script << "  }\n"
+         << "  chain prerouting {\n"
+         << "    type filter hook prerouting priority mangle; policy accept;\n"
+         << "    ct mark " << mark.str() << " meta mark set ct mark\n"
+         << "  }\n";
+  if (mode == SplitTunnelMode::kExclude) {
+    // connect() picked the TUN's address before the mark rerouted the
+    // packet to the physical interface.
+    script << "  chain postrouting {\n"
+           << "    type nat hook postrouting priority srcnat; policy accept;\n"
+           << "    meta mark " << mark.str() << " ip saddr " << TunSubnet() << " masquerade\n"
+           << "  }\n";
+  }
+  script << "}\n";
+  return script.str();
+}
+
+SplitTunnel::SplitTunnel(EventLoop* loop) : loop_(loop) {}
+
+SplitTunnel::~SplitTunnel() {
+  loop_->RunSync([this]() { Clear(); });
+}
+
+bool SplitTunnel::Apply(const SplitTunnelSettings& settings, std::string* error) {
+  Clear();
+  if (settings.mode == SplitTunnelMode::kOff) {
+    return true;
+  }
+  cgroup_root_ = FindCgroupRoot();
+  if (cgroup_root_.empty()) {
+    *error = "cgroup v2 is not mounted.";
+    return false;
+  }
+  settings_ = settings;
+  Scan();
+  if (!LoadRuleset(error)) {
+    Clear();
+    return false;
+  }
+  // Replies carry the restored mark, which the reverse path filter only
+  // honours with src_valid_mark.
+  saved_src_valid_mark_ = ReadFirstLine(kSrcValidMark);
+  if (saved_src_valid_mark_ != "1") {
+    WriteFile(kSrcValidMark, "1");
+  }
+  rules_installed_ = true;
+  if (!ChangeRoutingRules(true, error)) {
+    Clear();
+    return false;
+  }
+  OpenExecEvents();
+  return true;
+}
+
+void SplitTunnel::Clear() {
+  CloseExecEvents();
+  std::string error;
+  if (rules_installed_) {
+    if (!ChangeRoutingRules(false, &error)) {
+      std::cerr << "[SplitTunnel] " << error << std::endl;
+    }
+    if (!saved_src_valid_mark_.empty() && saved_src_valid_mark_ != "1") {
+      WriteFile(kSrcValidMark, saved_src_valid_mark_);
+    }
+    saved_src_valid_mark_.clear();
+    rules_installed_ = false;
+  }
+  if (ruleset_loaded_) {
+    if (!RunNft(std::string("add table inet ") + kTable + "\ndelete table inet " + kTable + "\n", &error)) {
+      std::cerr << "[SplitTunnel] " << error << std::endl;
+    }
+    ruleset_loaded_ = false;
+  }
+  for (const std::string& cgroup : cgroups_) {
+    std::string directory = CgroupDirectory(cgroup_root_, cgroup);
+    std::string parent = CgroupDirectory(cgroup_root_, ParentCgroup(cgroup)) + "/cgroup.procs";
+    std::ifstream procs(directory + "/cgroup.procs");
+    std::string pid;
+    while (std::getline(procs, pid)) {
+      WriteFile(parent, pid);
+    }
+    rmdir(directory.c_str());
+  }
+  cgroups_.clear();
+  settings_ = SplitTunnelSettings();
+  moved_count_ = 0;
+}
+
+bool SplitTunnel::MoveIfListed(pid_t pid) {
+  if (pid == getpid() || (settings_.owner != static_cast<uid_t>(-1) && !IsOwnedBy(pid, settings_.owner))) {
+    return false;
+  }
+  std::string proc = "/proc/" + std::to_string(pid);
+  char exe[PATH_MAX];
+  ssize_t exe_length = readlink((proc + "/exe").c_str(), exe, sizeof(exe) - 1);
+  std::string comm = exe_length < 0 ? ReadFirstLine(proc + "/comm") : "";
+  if (!MatchesSplitTunnelApp(settings_.apps, std::string_view(exe, exe_length > 0 ? static_cast<size_t>(exe_length) : 0),
+                             comm)) {
+    return false;
+  }
+  std::string cgroup;
+  if (!ReadProcessCgroup(pid, &cgroup) || IsSplitCgroup(cgroup)) {
+    return false;
+  }
+  std::string split = cgroup.empty() ? kCgroupName : cgroup + "/" + kCgroupName;
+  if (!IsSafeCgroupPath(split)) {
+    std::cerr << "[SplitTunnel] Leaving process " << pid << " alone: its cgroup has an unusual name." << std::endl;
+    return false;
+  }
+  std::string directory = CgroupDirectory(cgroup_root_, split);
+  bool created = cgroups_.count(split) == 0;
+  if (created) {
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+      std::cerr << "[SplitTunnel] Cannot create " << directory << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    cgroups_.insert(split);
+  }
+  if (WriteFile(directory + "/cgroup.procs", std::to_string(pid))) {
+    moved_count_++;
+  }
+  return created;
+}
+
+void SplitTunnel::Scan() {
+  DIR* proc = opendir("/proc");
+  if (proc == nullptr) {
+    return;
+  }
+  while (dirent* entry = readdir(proc)) {
+    char* end = nullptr;
+    long pid = strtol(entry->d_name, &end, 10);
+    if (pid > 0 && *end == '\0') {
+      MoveIfListed(static_cast<pid_t>(pid));
+    }
+  }
+  closedir(proc);
+}
+
+bool SplitTunnel::LoadRuleset(std::string* error) {
+  // systemd removes a stopped unit's cgroup with ours inside, and nft
+  // rejects the whole script over a path that no longer exists.
+  for (auto it = cgroups_.begin(); it != cgroups_.end();) {
+    struct stat info;
+    it = stat(CgroupDirectory(cgroup_root_, *it).c_str(), &info) == 0 ? std::next(it) : cgroups_.erase(it);
+  }
+  if (!RunNft(BuildSplitTunnelRuleset(settings_.mode, cgroups_), error)) {
+    return false;
+  }
+  ruleset_loaded_ = true;
+  return true;
+}
+
+void SplitTunnel::OpenExecEvents() {
+  exec_events_fd_ = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  sockaddr_nl address = {};
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = CN_IDX_PROC;
+  // nlmsghdr, cn_msg and its payload, the listen op, back to back.
+  alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+  auto* header = reinterpret_cast<nlmsghdr*>(request);
+  header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+  header->nlmsg_type = NLMSG_DONE;
+  auto* message = static_cast<cn_msg*>(NLMSG_DATA(header));
+  message->id.idx = CN_IDX_PROC;
+  message->id.val = CN_VAL_PROC;
+  message->len = sizeof(proc_cn_mcast_op);
+  proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+  memcpy(message->data, &op, sizeof(op));
+  if (exec_events_fd_ >= 0 && bind(exec_events_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+      send(exec_events_fd_, request, header->nlmsg_len, 0) >= 0) {
+    loop_->Watch(exec_events_fd_, EPOLLIN, [this](uint32_t) { OnExecEvents(); });
+    return;
+  }
+  std::cerr << "[SplitTunnel] No exec events (errno " << errno << "), rescanning every " << kRescanIntervalS
+            << " s." << std::endl;
+  CloseExecEvents();
+  rescan_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (rescan_fd_ < 0) {
+    return;
+  }
+  itimerspec interval = {};
+  interval.it_interval.tv_sec = kRescanIntervalS;
+  interval.it_value.tv_sec = kRescanIntervalS;
+  timerfd_settime(rescan_fd_, 0, &interval, nullptr);
+  loop_->Watch(rescan_fd_, EPOLLIN, [this](uint32_t) { OnRescan(); });
+}
+
+void SplitTunnel::CloseExecEvents() {
+  if (exec_events_fd_ >= 0) {
+    loop_->Unwatch(exec_events_fd_);
+    close(exec_events_fd_);
+    exec_events_fd_ = -1;
+  }
+  if (rescan_fd_ >= 0) {
+    loop_->Unwatch(rescan_fd_);
+    close(rescan_fd_);
+    rescan_fd_ = -1;
+  }
+}
+
+void SplitTunnel::OnExecEvents() {
+  alignas(nlmsghdr) char buffer[8192];
+  bool reload = false;
+  for (;;) {
+    ssize_t received = recv(exec_events_fd_, buffer, sizeof(buffer), 0);
+    if (received < 0) {
+      if (errno == ENOBUFS) {
+        // Events were dropped; look at everything instead.
+        size_t before = cgroups_.size();
+        Scan();
+        reload = reload || cgroups_.size() != before;
+        continue;
+      }
+      break;
+    }
+    int length = static_cast<int>(received);
+    for (auto* message = reinterpret_cast<const nlmsghdr*>(buffer); NLMSG_OK(message, length);
+         message = NLMSG_NEXT(message, length)) {
+      const auto* connector = static_cast<const cn_msg*>(NLMSG_DATA(message));
+      const auto* event = reinterpret_cast<const proc_event*>(connector->data);
+      if (connector->id.idx == CN_IDX_PROC && event->what == proc_event::PROC_EVENT_EXEC) {
+        reload = MoveIfListed(event->event_data.exec.process_tgid) || reload;
+      }
+    }
+  }
+  std::string error;
+  if (reload && !LoadRuleset(&error)) {
+    std::cerr << "[SplitTunnel] " << error << std::endl;
+  }
+}
+
+void SplitTunnel::OnRescan() {
+  uint64_t expirations;
+  if (read(rescan_fd_, &expirations, sizeof(expirations)) < 0) {
+    return;
+  }
+  size_t before = cgroups_.size();
+  Scan();
+  std::string error;
+  if (cgroups_.size() != before && !LoadRuleset(&error)) {
+    std::cerr << "[SplitTunnel] " << error << std::endl;
+  }
+}
+
+bool SplitTunnel::ChangeRoutingRules(bool add, std::string* error) {
+  // Exclude mode sends marked traffic around the TUN, include mode
+  // everything that is not marked.
+  bool invert = settings_.mode == SplitTunnelMode::kInclude;
+  bool ipv4 = SendRoutingRule(AF_INET, add, invert, error);
+  // IPv6 may be disabled; the TUN only has an IPv4 address anyway.
+  std::string ipv6_error;
+  SendRoutingRule(AF_INET6, add, invert, &ipv6_error);
+  return ipv4;
+}
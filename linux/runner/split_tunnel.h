@@ -0,0 +1,124 @@
+#ifndef RUNNER_SPLIT_TUNNEL_H_
+#define RUNNER_SPLIT_TUNNEL_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "event_loop.h"
+
+// Which side of the TUN the listed applications end up on.
+enum class SplitTunnelMode : uint8_t {
+  kOff,
+  // Everything but the listed applications goes through the TUN, as
+  // "all_except" does on Android.
+  kExclude,
+  // Only the listed applications go through the TUN ("only_selected").
+  kInclude,
+};
+
+// The per-app proxy settings, with the applications named by executable:
+// a file name such as "apt" or "restic", or an absolute path.
+struct SplitTunnelSettings {
+  SplitTunnelMode mode = SplitTunnelMode::kOff;
+  std::vector<std::string> apps;
+  // Only processes whose user IDs are all |owner| are moved, for the
+  // helper acting for a UI process. -1 moves any listed process.
+  uid_t owner = static_cast<uid_t>(-1);
+};
+
+// Reads the per_app_proxy_enabled and per_app_proxy_mode settings. An
+// empty list turns it off whatever the mode, as it does on Android.
+SplitTunnelMode ParseSplitTunnelMode(bool enabled, std::string_view mode, size_t app_count);
+
+// Whether a process with executable |exe| and comm |comm| is one of |apps|.
+// |comm| is what the kernel truncated to 15 bytes and only counts when the
+// executable cannot be read.
+bool MatchesSplitTunnelApp(const std::vector<std::string>& apps, std::string_view exe, std::string_view comm);
+
+// Whether |cgroup|, a path relative to the cgroup v2 root, can be quoted
+// in an nftables script and created under as is: slash-separated names of
+// letters, digits and "-_.@:+,=", none of them "." or "..". systemd's
+// escaped unit names, with backslashes, are not.
+bool IsSafeCgroupPath(std::string_view cgroup);
+
+// The nftables script that marks the sockets of |cgroups|, paths relative
+// to the cgroup v2 root, loaded with "nft -f". It replaces any earlier
+// table atomically. Paths that are not IsSafeCgroupPath() are left out; an
+// empty |cgroups| leaves the chains empty.
+std::string BuildSplitTunnelRuleset(SplitTunnelMode mode, const std::set<std::string>& cgroups);
+
+// Per-application split tunneling for the TUN.
+//
+// Processes of the listed applications are moved into a "hwl-vpn-split"
+// child of the cgroup they were in, so they stay under the unit that owns
+// them and are stopped with it. An nftables output chain marks the sockets
+// of those cgroups ("socket cgroupv2") and a policy routing rule ahead of
+// sing-box's sends marked traffic to the main table in exclude mode, or
+// everything unmarked in include mode. The mark is kept in conntrack so
+// replies pass the reverse path filter, and in exclude mode connections
+// whose source address was picked from the TUN are masqueraded.
+//
+// Applications started later are caught from the kernel's exec events
+// (the proc connector), or by a rescan every few seconds when those are
+// unavailable. A socket keeps the cgroup it was created in, so connections
+// a process opened before it was moved keep their old route.
+//
+// Everything here needs CAP_NET_ADMIN, like the TUN itself, and write
+// access to the applications' cgroups. Processes in cgroups whose paths
+// are not IsSafeCgroupPath() are left alone. Loop thread only.
+class SplitTunnel {
+ public:
+  explicit SplitTunnel(EventLoop* loop);
+  // Clear()s on the loop thread.
+  ~SplitTunnel();
+
+  SplitTunnel(const SplitTunnel&) = delete;
+  SplitTunnel& operator=(const SplitTunnel&) = delete;
+
+  // Replaces the current settings. kOff is the same as Clear(). Returns
+  // false with |error| set and nothing left installed when the rules could
+  // not be set up.
+  bool Apply(const SplitTunnelSettings& settings, std::string* error);
+  // Removes the rules and moves every process back to its own cgroup.
+  void Clear();
+
+  bool active() const { return settings_.mode != SplitTunnelMode::kOff; }
+  // Processes moved since Apply(), including ones that have since exited.
+  size_t moved_count() const { return moved_count_; }
+
+ private:
+  // Moves |pid| if it runs one of the applications. Returns true when the
+  // ruleset has to be reloaded for a new cgroup.
+  bool MoveIfListed(pid_t pid);
+  // Walks /proc once.
+  void Scan();
+  bool LoadRuleset(std::string* error);
+  void OpenExecEvents();
+  void CloseExecEvents();
+  void OnExecEvents();
+  void OnRescan();
+  // Adds or removes the IPv4 and IPv6 routing rules.
+  bool ChangeRoutingRules(bool add, std::string* error);
+
+  EventLoop* loop_;
+  SplitTunnelSettings settings_;
+  // The cgroup v2 mount, "/sys/fs/cgroup" or "/sys/fs/cgroup/unified" on
+  // hybrid systems.
+  std::string cgroup_root_;
+  // Created split cgroups, relative to |cgroup_root_|.
+  std::set<std::string> cgroups_;
+  size_t moved_count_ = 0;
+  bool rules_installed_ = false;
+  bool ruleset_loaded_ = false;
+  // net.ipv4.conf.all.src_valid_mark before Apply(), restored by Clear().
+  std::string saved_src_valid_mark_;
+  int exec_events_fd_ = -1;
+  int rescan_fd_ = -1;
+};
+
+#endif  // RUNNER_SPLIT_TUNNEL_H_
@@ -0,0 +1,223 @@
+#include "traffic_sampler.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+constexpr size_t kReadBufferSize = 64 * 1024;
+}  // namespace
+
+TrafficSampler::TrafficSampler(EventLoop* loop) : loop_(loop) {}
+
+TrafficSampler::~TrafficSampler() {
+  loop_->RunSync([this]() {
+    on_connections_ = nullptr;
+    Stop();
+    if (timer_fd_ >= 0) {
+      loop_->Unwatch(timer_fd_);
+      close(timer_fd_);
+      timer_fd_ = -1;
+    }
+  });
+}
+
+void TrafficSampler::Start(uint16_t port, const std::string& secret, SampleCallback on_sample) {
+  Stop();
+  recorder_.Reset();
+  connection_table_.Reset();
+  if (port == 0) {
+    return;
+  }
+  if (timer_fd_ < 0) {
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0 || !loop_->Watch(timer_fd_, EPOLLIN, [this](uint32_t) { OnTimer(); })) {
+      return;
+    }
+  }
+  port_ = port;
+  secret_ = secret;
+  on_sample_ = std::move(on_sample);
+  Connect();
+}
+
+void TrafficSampler::Stop() {
+  Close(&traffic_);
+  Close(&connections_);
+  if (timer_fd_ >= 0) {
+    itimerspec when = {};
+    timerfd_settime(timer_fd_, 0, &when, nullptr);
+  }
+  port_ = 0;
+  on_sample_ = nullptr;
+  // The connections are gone with the tunnel.
+  if (connection_table_.size() > 0) {
+    connection_table_.Reset(&connection_diff_);
+    if (on_connections_) {
+      on_connections_(connection_diff_);
+    }
+  }
+}
+
+void TrafficSampler::TrackConnections(ConnectionsCallback on_diff) {
+  on_connections_ = std::move(on_diff);
+  // A new listener starts from the full list.
+  connection_table_.Reset();
+}
+
+std::vector<TrafficSample> TrafficSampler::History(uint64_t* sequence) {
+  std::vector<TrafficSample> samples;
+  loop_->RunSync([this, &samples, sequence]() {
+    samples = recorder_.history().Snapshot();
+    *sequence = recorder_.history().sequence();
+  });
+  return samples;
+}
+
+void TrafficSampler::Connect() {
+  if (!Open(&traffic_, "/traffic") || !Open(&connections_, "/connections")) {
+    Retry();
+    return;
+  }
+  awaiting_connections_ = true;
+}
+
+bool TrafficSampler::Open(Connection* connection, std::string_view path) {
+  connection->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (connection->fd < 0) {
+    return false;
+  }
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port_);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(connection->fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 && errno != EINPROGRESS) {
+    close(connection->fd);
+    connection->fd = -1;
+    return false;
+  }
+  connection->connected = false;
+  connection->output = ClashApiRequest(path, secret_);
+  connection->stream = ClashApiStream();
+  return loop_->Watch(connection->fd, EPOLLIN | EPOLLOUT,
+                      [this, connection](uint32_t events) { OnEvent(connection, events); });
+}
+
+void TrafficSampler::Close(Connection* connection) {
+  if (connection->fd >= 0) {
+    loop_->Unwatch(connection->fd);
+    close(connection->fd);
+    connection->fd = -1;
+  }
+  connection->output.clear();
+}
+
+void TrafficSampler::OnEvent(Connection* connection, uint32_t events) {
+  if (!connection->connected) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0 || (events & (EPOLLERR | EPOLLHUP)) != 0) {
+      Retry();
+      return;
+    }
+    if ((events & EPOLLOUT) == 0) {
+      return;
+    }
+    connection->connected = true;
+  }
+
+  bool is_traffic = connection == &traffic_;
+  auto on_document = [this, is_traffic](std::string_view document) {
+    if (!is_traffic) {
+      awaiting_connections_ = false;
+      recorder_.OnConnectionsDocument(document);
+      if (on_connections_ && connection_table_.Apply(document, &connection_diff_) && !connection_diff_.empty()) {
+        on_connections_(connection_diff_);
+      }
+      return;
+    }
+    TrafficDelta delta;
+    if (recorder_.OnTrafficDocument(document, &delta)) {
+      if (on_sample_) {
+        on_sample_(delta);
+      }
+      RequestConnections();
+    }
+  };
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+    char buffer[kReadBufferSize];
+    for (int i = 0; i < kMaxReadsPerEvent && connection->fd >= 0; i++) {
+      ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+      if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+        break;
+      }
+      if (received <= 0) {
+        connection->stream.OnClosed(on_document);
+        Retry();
+        return;
+      }
+      if (!connection->stream.Feed(std::string_view(buffer, static_cast<size_t>(received)), on_document)) {
+        Retry();
+        return;
+      }
+      if (static_cast<size_t>(received) < sizeof(buffer)) {
+        break;
+      }
+    }
+  }
+  if (connection->fd >= 0 && !Flush(connection)) {
+    Retry();
+  }
+}
+
+bool TrafficSampler::Flush(Connection* connection) {
+  while (!connection->output.empty()) {
+    ssize_t sent = send(connection->fd, connection->output.data(), connection->output.size(), MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN) {
+        return false;
+      }
+      break;
+    }
+    connection->output.erase(0, static_cast<size_t>(sent));
+  }
+  return loop_->Rearm(connection->fd, connection->output.empty() ? static_cast<uint32_t>(EPOLLIN)
+                                                                 : static_cast<uint32_t>(EPOLLIN | EPOLLOUT));
+}
+
+void TrafficSampler::RequestConnections() {
+  if (awaiting_connections_ || connections_.fd < 0 || !connections_.connected) {
+    return;
+  }
+  awaiting_connections_ = true;
+  connections_.output = ClashApiRequest("/connections", secret_);
+  // A send error also shows up as EPOLLERR on the connection, which
+  // retries from its own handler.
+  Flush(&connections_);
+}
+
+void TrafficSampler::Retry() {
+  Close(&traffic_);
+  Close(&connections_);
+  awaiting_connections_ = false;
+  itimerspec when = {};
+  when.it_value.tv_sec = kRetryInterval.count();
+  timerfd_settime(timer_fd_, 0, &when, nullptr);
+}
+
+void TrafficSampler::OnTimer() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+  if (port_ != 0 && traffic_.fd < 0) {
+    Connect();
+  }
+}
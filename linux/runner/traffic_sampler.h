@@ -0,0 +1,92 @@
+#ifndef RUNNER_TRAFFIC_SAMPLER_H_
+#define RUNNER_TRAFFIC_SAMPLER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "clash_api.h"
+#include "connection_table.h"
+#include "event_loop.h"
+#include "traffic_stats.h"
+
+// Follows sing-box's traffic through its Clash API on 127.0.0.1.
+//
+// One persistent connection streams /traffic, which sends a document per
+// second; the second it closes becomes a sample. Since that response never
+// ends, the connection count is polled on a second keep-alive connection,
+// with one /connections request per traffic document. If either connection
+// drops, both are reopened after kRetryInterval. All of it runs on the
+// event loop thread.
+//
+// While connections are tracked, each of those snapshots is also diffed
+// against the previous one, so a listener gets at most one diff a second
+// however many connections there are.
+class TrafficSampler {
+ public:
+  // Receives every sample as it is recorded, on the loop thread.
+  using SampleCallback = std::function<void(const TrafficDelta& delta)>;
+  // Receives what changed in the open connections, on the loop thread.
+  using ConnectionsCallback = std::function<void(const ConnectionDiff& diff)>;
+
+  explicit TrafficSampler(EventLoop* loop);
+  ~TrafficSampler();
+
+  TrafficSampler(const TrafficSampler&) = delete;
+  TrafficSampler& operator=(const TrafficSampler&) = delete;
+
+  // Loop thread only. Starts a new history for the API at |port|, sending
+  // |secret| with every request unless it is empty.
+  void Start(uint16_t port, const std::string& secret, SampleCallback on_sample);
+  // Loop thread only. Keeps the history.
+  void Stop();
+  // Loop thread only. Sends |on_diff| the changes of every snapshot from
+  // now on, starting with a reset that lists every connection; null stops.
+  void TrackConnections(ConnectionsCallback on_diff);
+
+  // Safe from any thread. The recorded samples, oldest first, and the
+  // sequence number of the newest.
+  std::vector<TrafficSample> History(uint64_t* sequence);
+
+ private:
+  static constexpr std::chrono::seconds kRetryInterval{1};
+  static constexpr int kMaxReadsPerEvent = 16;
+
+  struct Connection {
+    int fd = -1;
+    bool connected = false;
+    std::string output;
+    ClashApiStream stream;
+  };
+
+  void Connect();
+  bool Open(Connection* connection, std::string_view path);
+  void Close(Connection* connection);
+  void OnEvent(Connection* connection, uint32_t events);
+  // Sends what is queued; false on a socket error.
+  bool Flush(Connection* connection);
+  void RequestConnections();
+  // Drops both connections and reconnects after kRetryInterval.
+  void Retry();
+  void OnTimer();
+
+  EventLoop* loop_;
+  uint16_t port_ = 0;
+  std::string secret_;
+  SampleCallback on_sample_;
+  TrafficRecorder recorder_;
+  ConnectionsCallback on_connections_;
+  ConnectionTable connection_table_;
+  // Reused for every snapshot.
+  ConnectionDiff connection_diff_;
+  Connection traffic_;
+  Connection connections_;
+  // A /connections request is out.
+  bool awaiting_connections_ = false;
+  int timer_fd_ = -1;
+};
+
+#endif  // RUNNER_TRAFFIC_SAMPLER_H_
@@ -0,0 +1,511 @@
+#include "helper_server.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "helper_protocol.h"
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+constexpr char kLink[] = "vless://0b3c7f2a-1111-2222-3333-444455556666@127.0.0.1:443?type=tcp&security=tls";
+
+// A loopback port nothing listens on.
+uint16_t FreePort() {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+  close(fd);
+  return ntohs(address.sin_port);
+}
+
+// A UI speaking the helper protocol by hand, so a test decides when it
+// reads and what it sends.
+class RawClient {
+ public:
+  ~RawClient() { Close(); }
+
+  bool Connect(const std::string& path) {
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return fd_ >= 0 && connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+  }
+
+  void Close() {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  // Sends everything written to |writer|. False once the helper hung up.
+  bool Send(const HelperFrameWriter& writer) { return Send(writer.buffer()); }
+  bool Send(const std::string& bytes) {
+    size_t sent = 0;
+    while (sent < bytes.size()) {
+      ssize_t written = send(fd_, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+      if (written <= 0) {
+        return false;
+      }
+      sent += static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  // Sends kHello and reads the kWelcome.
+  bool Hello(uint64_t session, uint64_t cursor, uint64_t* welcome_session, HelperTunnelState* state,
+             uint64_t* log_next) {
+    HelperFrameWriter writer;
+    writer.AppendHello(session, cursor);
+    HelperMessage kind;
+    std::string payload;
+    if (!Send(writer) || !Next(&kind, &payload, seconds(5)) || kind != HelperMessage::kWelcome) {
+      return false;
+    }
+    HelperPayloadReader reader(payload);
+    uint32_t version = reader.ReadU32();
+    *welcome_session = reader.ReadU64();
+    *state = static_cast<HelperTunnelState>(reader.ReadU8());
+    *log_next = reader.ReadU64();
+    return reader.ok() && version == kHelperProtocolVersion;
+  }
+
+  // Waits up to |timeout| for the next frame. False on a timeout or once
+  // the helper hung up, which closed() tells apart.
+  bool Next(HelperMessage* kind, std::string* payload, milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!reader_.Next(kind, payload)) {
+      auto left = std::chrono::duration_cast<milliseconds>(deadline - std::chrono::steady_clock::now());
+      pollfd entry = {fd_, POLLIN, 0};
+      if (closed_ || left.count() <= 0 || poll(&entry, 1, static_cast<int>(left.count())) <= 0) {
+        return false;
+      }
+      char buffer[64 * 1024];
+      ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+      if (received <= 0) {
+        closed_ = true;
+        return false;
+      }
+      reader_.Append(buffer, static_cast<size_t>(received));
+    }
+    return true;
+  }
+
+  // Reads frames until one of |kind| arrives, collecting the log on the
+  // way. Returns its payload, or false on a timeout or hang-up.
+  bool WaitFor(HelperMessage wanted, std::string* payload, milliseconds timeout = seconds(10)) {
+    HelperMessage kind;
+    std::string frame;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      auto left = std::chrono::duration_cast<milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (!Next(&kind, &frame, left)) {
+        return false;
+      }
+      if (kind == HelperMessage::kLog) {
+        HelperPayloadReader reader(frame);
+        uint64_t first = reader.ReadU64();
+        if (log_first_ == kNoLog) {
+          log_first_ = first;
+        }
+        log_.append(reader.Rest());
+      }
+      if (kind == wanted) {
+        *payload = frame;
+        return true;
+      }
+    }
+  }
+
+  bool closed() const { return closed_; }
+  int fd() const { return fd_; }
+  // The log received so far and the id of its first line.
+  const std::string& log() const { return log_; }
+  uint64_t log_first() const { return log_first_; }
+
+  static constexpr uint64_t kNoLog = ~uint64_t{0};
+
+ private:
+  int fd_ = -1;
+  bool closed_ = false;
+  HelperFrameReader reader_;
+  std::string log_;
+  uint64_t log_first_ = kNoLog;
+};
+
+// Runs a HelperServer on a socket in the temporary directory, with the
+// stub sing-box next to this binary; see stub_sing_box.cc.
+class HelperServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = std::filesystem::temp_directory_path() /
+            ("hwl-helper-" + std::to_string(getpid()) + "-" +
+             ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".sock");
+    std::filesystem::remove(path_);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path_.c_str(), sizeof(address.sun_path) - 1);
+    ASSERT_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_EQ(listen(fd, 8), 0);
+    server_ = std::make_unique<HelperServer>(std::filesystem::path());
+    std::string error;
+    ASSERT_TRUE(server_->Start(fd, &error)) << error;
+    runner_ = std::thread([this]() { server_->Run(); });
+  }
+
+  void TearDown() override {
+    if (server_) {
+      server_->Quit();
+      if (runner_.joinable()) {
+        runner_.join();
+      }
+      server_.reset();
+    }
+    std::filesystem::remove(path_);
+  }
+
+  // Sends |kind| with request id |request| and a tunnel for kLink.
+  static bool SendTunnelRequest(RawClient* client, HelperMessage kind, uint32_t request) {
+    HelperTunnelRequest tunnel;
+    tunnel.link = kLink;
+    tunnel.settings.clash_api_port = FreePort();
+    HelperFrameWriter writer;
+    writer.AppendTunnelRequest(kind, request, tunnel);
+    return client->Send(writer);
+  }
+
+  // Waits for the kResult of |request|.
+  static bool WaitForResult(RawClient* client, uint32_t request, HelperResult* result) {
+    std::string payload;
+    while (client->WaitFor(HelperMessage::kResult, &payload)) {
+      HelperPayloadReader reader(payload);
+      if (reader.ReadU32() == request) {
+        return ReadResult(&reader, result);
+      }
+    }
+    return false;
+  }
+
+  // Waits for a kState of |state|.
+  static bool WaitForState(RawClient* client, HelperTunnelState state) {
+    std::string payload;
+    while (client->WaitFor(HelperMessage::kState, &payload)) {
+      if (static_cast<HelperTunnelState>(payload[0]) == state) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::filesystem::path path_;
+  std::unique_ptr<HelperServer> server_;
+  std::thread runner_;
+};
+
+TEST_F(HelperServerTest, ResumesTheLogFromTheCursorAfterADisconnect) {
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t before;
+  {
+    RawClient first;
+    ASSERT_TRUE(first.Connect(path_));
+    ASSERT_TRUE(first.Hello(0, kHelperLogFromOldest, &session, &state, &before));
+    EXPECT_EQ(state, HelperTunnelState::kStopped);
+  }
+
+  // Another UI brings the tunnel up while the first is away.
+  std::string missed;
+  {
+    RawClient second;
+    ASSERT_TRUE(second.Connect(path_));
+    uint64_t log_next;
+    ASSERT_TRUE(second.Hello(session, before, &session, &state, &log_next));
+    ASSERT_TRUE(SendTunnelRequest(&second, HelperMessage::kStart, 1));
+    HelperResult result;
+    ASSERT_TRUE(WaitForResult(&second, 1, &result));
+    ASSERT_TRUE(result.ok) << result.text;
+    ASSERT_TRUE(WaitForState(&second, HelperTunnelState::kRunning));
+    ASSERT_FALSE(second.log().empty());
+    EXPECT_EQ(second.log_first(), before);
+    missed = second.log();
+  }
+
+  // The tunnel outlives its clients, and the first UI gets what it missed.
+  RawClient resumed;
+  ASSERT_TRUE(resumed.Connect(path_));
+  uint64_t after;
+  ASSERT_TRUE(resumed.Hello(session, before, &session, &state, &after));
+  EXPECT_EQ(state, HelperTunnelState::kRunning);
+  EXPECT_GT(after, before);
+  ASSERT_TRUE(WaitForState(&resumed, HelperTunnelState::kRunning));
+  EXPECT_EQ(resumed.log_first(), before);
+  EXPECT_EQ(resumed.log().substr(0, missed.size()), missed);
+
+  // Caught up, a reconnect replays nothing.
+  RawClient current;
+  ASSERT_TRUE(current.Connect(path_));
+  uint64_t log_next;
+  ASSERT_TRUE(current.Hello(session, after, &session, &state, &log_next));
+  ASSERT_TRUE(WaitForState(&current, HelperTunnelState::kRunning));
+  EXPECT_TRUE(current.log_first() == RawClient::kNoLog || current.log_first() >= after);
+
+  // A cursor from another helper start replays everything there is.
+  RawClient stale;
+  ASSERT_TRUE(stale.Connect(path_));
+  ASSERT_TRUE(stale.Hello(session ^ 1, after, &session, &state, &log_next));
+  ASSERT_TRUE(WaitForState(&stale, HelperTunnelState::kRunning));
+  EXPECT_LE(stale.log_first(), before);
+}
+
+TEST_F(HelperServerTest, DropsAClientThatStopsReading) {
+  RawClient slow;
+  ASSERT_TRUE(slow.Connect(path_));
+  int buffer_size = 4096;
+  setsockopt(slow.fd(), SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t log_next;
+  ASSERT_TRUE(slow.Hello(0, kHelperLogFromOldest, &session, &state, &log_next));
+
+  // Each request of an unknown kind is answered with a kResult about four
+  // times its size; unread, those pile up well past kMaxPending.
+  constexpr uint32_t kRequests = 400000;
+  HelperFrameWriter writer;
+  for (uint32_t request = 1; request <= kRequests; request++) {
+    writer.BeginFrame(static_cast<HelperMessage>(100));
+    writer.PutU32(request);
+    writer.EndFrame();
+  }
+  // The helper hangs up part way through, or takes everything and then
+  // gives up on sending the answers.
+  slow.Send(writer);
+
+  // Every request the helper read was answered before it reads the next
+  // client's, so this one's answer means the flood has been dealt with.
+  RawClient other;
+  ASSERT_TRUE(other.Connect(path_));
+  ASSERT_TRUE(other.Hello(session, log_next, &session, &state, &log_next));
+  HelperFrameWriter unknown;
+  unknown.BeginFrame(static_cast<HelperMessage>(100));
+  unknown.PutU32(7);
+  unknown.EndFrame();
+  ASSERT_TRUE(other.Send(unknown));
+  HelperResult result;
+  ASSERT_TRUE(WaitForResult(&other, 7, &result));
+
+  uint32_t answered = 0;
+  HelperMessage kind;
+  std::string payload;
+  while (slow.Next(&kind, &payload, seconds(10))) {
+    if (kind == HelperMessage::kResult) {
+      answered++;
+    }
+  }
+  EXPECT_TRUE(slow.closed());
+  EXPECT_LT(answered, kRequests);
+}
+
+TEST_F(HelperServerTest, AnswersAnUnknownRequest) {
+  RawClient client;
+  ASSERT_TRUE(client.Connect(path_));
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t log_next;
+  ASSERT_TRUE(client.Hello(0, kHelperLogFromOldest, &session, &state, &log_next));
+  HelperFrameWriter writer;
+  writer.BeginFrame(static_cast<HelperMessage>(100));
+  writer.PutU32(3);
+  writer.EndFrame();
+  ASSERT_TRUE(client.Send(writer));
+  HelperResult result;
+  ASSERT_TRUE(WaitForResult(&client, 3, &result));
+  EXPECT_FALSE(result.ok);
+  EXPECT_EQ(result.text, "Unknown request.");
+}
+
+TEST_F(HelperServerTest, RejectsALinkItCannotBuild) {
+  RawClient client;
+  ASSERT_TRUE(client.Connect(path_));
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t log_next;
+  ASSERT_TRUE(client.Hello(0, kHelperLogFromOldest, &session, &state, &log_next));
+  HelperTunnelRequest tunnel;
+  tunnel.link = "file:///etc/shadow";
+  HelperFrameWriter writer;
+  writer.AppendTunnelRequest(HelperMessage::kStart, 4, tunnel);
+  ASSERT_TRUE(client.Send(writer));
+  HelperResult result;
+  ASSERT_TRUE(WaitForResult(&client, 4, &result));
+  EXPECT_FALSE(result.ok);
+  EXPECT_FALSE(result.text.empty());
+}
+
+TEST_F(HelperServerTest, RejectsSettingsItWillNotRun) {
+  RawClient client;
+  ASSERT_TRUE(client.Connect(path_));
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t log_next;
+  ASSERT_TRUE(client.Hello(0, kHelperLogFromOldest, &session, &state, &log_next));
+  HelperTunnelRequest tunnel;
+  tunnel.link = kLink;
+  tunnel.settings.clash_api_port = 80;
+  HelperFrameWriter writer;
+  writer.AppendTunnelRequest(HelperMessage::kStart, 5, tunnel);
+  ASSERT_TRUE(client.Send(writer));
+  HelperResult result;
+  ASSERT_TRUE(WaitForResult(&client, 5, &result));
+  EXPECT_FALSE(result.ok);
+  EXPECT_EQ(result.text, "Invalid Clash API port 80.");
+}
+
+TEST_F(HelperServerTest, AnswersAReloadWhileStoppedAsNotRunning) {
+  RawClient client;
+  ASSERT_TRUE(client.Connect(path_));
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t log_next;
+  ASSERT_TRUE(client.Hello(0, kHelperLogFromOldest, &session, &state, &log_next));
+  ASSERT_TRUE(SendTunnelRequest(&client, HelperMessage::kReload, 6));
+  HelperResult result;
+  ASSERT_TRUE(WaitForResult(&client, 6, &result));
+  EXPECT_FALSE(result.ok);
+  // What the UI's switchService falls back to a start on.
+  EXPECT_EQ(result.text, kHelperNotRunning);
+}
+
+TEST_F(HelperServerTest, DropsAClientSendingAnOversizedFrame) {
+  RawClient client;
+  ASSERT_TRUE(client.Connect(path_));
+  uint64_t session;
+  HelperTunnelState state;
+  uint64_t log_next;
+  ASSERT_TRUE(client.Hello(0, kHelperLogFromOldest, &session, &state, &log_next));
+  HelperFrameWriter writer;
+  writer.BeginFrame(HelperMessage::kStart);
+  writer.EndFrame();
+  std::string header = writer.buffer();
+  uint32_t size = kHelperMaxFrameSize + 1;
+  for (int i = 0; i < 4; i++) {
+    header[4 + i] = static_cast<char>(size >> (i * 8));
+  }
+  ASSERT_TRUE(client.Send(header));
+  HelperMessage kind;
+  std::string payload;
+  EXPECT_FALSE(client.Next(&kind, &payload, seconds(5)));
+  EXPECT_TRUE(client.closed());
+}
+
+TEST_F(HelperServerTest, DropsAClientOfAnotherVersionOrWithoutHello) {
+  RawClient old_client;
+  ASSERT_TRUE(old_client.Connect(path_));
+  HelperFrameWriter hello;
+  hello.BeginFrame(HelperMessage::kHello);
+  hello.PutU32(kHelperProtocolVersion - 1);
+  hello.PutU64(0);
+  hello.PutU64(kHelperLogFromOldest);
+  hello.EndFrame();
+  ASSERT_TRUE(old_client.Send(hello));
+  HelperMessage kind;
+  std::string payload;
+  EXPECT_FALSE(old_client.Next(&kind, &payload, seconds(5)));
+  EXPECT_TRUE(old_client.closed());
+
+  RawClient rude;
+  ASSERT_TRUE(rude.Connect(path_));
+  HelperFrameWriter stop;
+  stop.AppendStop(1);
+  ASSERT_TRUE(rude.Send(stop));
+  EXPECT_FALSE(rude.Next(&kind, &payload, seconds(5)));
+  EXPECT_TRUE(rude.closed());
+}
+
+ConfigSettings MixedInbound(const char* address, int64_t port) {
+  ConfigSettings settings;
+  settings.use_mixed_inbound = true;
+  settings.mixed_inbound_listen_address = address;
+  settings.mixed_inbound_listen_port = port;
+  settings.clash_api_port = 9090;
+  return settings;
+}
+
+TEST(CheckHelperSettingsTest, KeepsTheMixedInboundOnLoopback) {
+  std::string error;
+  for (const char* address : {"0.0.0.0", "", "::", "192.168.1.10", "example.com"}) {
+    ConfigSettings settings = MixedInbound(address, 10808);
+    ASSERT_TRUE(CheckHelperSettings(&settings, "secret", false, &error)) << error;
+    EXPECT_EQ(settings.mixed_inbound_listen_address, "127.0.0.1") << address;
+  }
+  for (const char* address : {"127.0.0.1", "127.0.0.2", "::1", "localhost"}) {
+    ConfigSettings settings = MixedInbound(address, 10808);
+    ASSERT_TRUE(CheckHelperSettings(&settings, "secret", false, &error)) << error;
+    EXPECT_EQ(settings.mixed_inbound_listen_address, address);
+  }
+}
+
+TEST(CheckHelperSettingsTest, ListensWhereAskedWhenAllowed) {
+  ConfigSettings settings = MixedInbound("0.0.0.0", 10808);
+  std::string error;
+  ASSERT_TRUE(CheckHelperSettings(&settings, "secret", true, &error)) << error;
+  EXPECT_EQ(settings.mixed_inbound_listen_address, "0.0.0.0");
+}
+
+TEST(CheckHelperSettingsTest, RequiresTheSecret) {
+  ConfigSettings settings = MixedInbound("127.0.0.1", 10808);
+  settings.clash_api_secret = "from the client";
+  std::string error;
+  ASSERT_TRUE(CheckHelperSettings(&settings, "secret", false, &error)) << error;
+  EXPECT_EQ(settings.clash_api_secret, "secret");
+  EXPECT_FALSE(CheckHelperSettings(&settings, "", false, &error));
+  EXPECT_EQ(error, "The Clash API has no secret.");
+  // Without an API there is nothing to protect.
+  settings.clash_api_port = 0;
+  EXPECT_TRUE(CheckHelperSettings(&settings, "", false, &error));
+}
+
+TEST(CheckHelperSettingsTest, RejectsBadPorts) {
+  std::string error;
+  for (int64_t port : {int64_t{0}, int64_t{-1}, int64_t{53}, int64_t{1023}, int64_t{65536}, int64_t{1} << 40}) {
+    ConfigSettings settings = MixedInbound("127.0.0.1", port);
+    EXPECT_FALSE(CheckHelperSettings(&settings, "secret", false, &error)) << port;
+    EXPECT_EQ(error, "Invalid mixed inbound port " + std::to_string(port) + ".");
+
+    settings = MixedInbound("127.0.0.1", 10808);
+    settings.clash_api_port = port;
+    EXPECT_EQ(CheckHelperSettings(&settings, "secret", false, &error), port == 0) << port;
+  }
+  ConfigSettings settings = MixedInbound("127.0.0.1", 9090);
+  EXPECT_FALSE(CheckHelperSettings(&settings, "secret", false, &error));
+  EXPECT_EQ(error, "The mixed inbound and the Clash API cannot share a port.");
+  // An unused mixed inbound's port does not matter.
+  settings.use_mixed_inbound = false;
+  settings.mixed_inbound_listen_port = 0;
+  EXPECT_TRUE(CheckHelperSettings(&settings, "secret", false, &error));
+  settings = MixedInbound("127.0.0.1", 1024);
+  settings.clash_api_port = 65535;
+  EXPECT_TRUE(CheckHelperSettings(&settings, "secret", false, &error)) << error;
+}
+
+}  // namespace
@@ -0,0 +1,192 @@
+#include "latency_prober.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+// A socket of |type| bound to a free loopback port, listening when it is a
+// stream. Closing it right away leaves a port nothing answers on.
+int BindLoopback(int type, uint16_t* port) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+  if (type == SOCK_STREAM) {
+    listen(fd, 16);
+  }
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+ProbeTarget Target(const char* id, uint16_t port, ProbeProtocol protocol = ProbeProtocol::kTcp,
+                   const char* ip = "127.0.0.1") {
+  ProbeTarget target;
+  target.id = id;
+  target.ip = ip;
+  target.port = port;
+  target.protocol = protocol;
+  target.sni = "example.com";
+  return target;
+}
+
+class LatencyProberTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(loop_.Start()); }
+  void TearDown() override {
+    prober_.reset();
+    loop_.Stop();
+    for (int fd : fds_) {
+      // Wakes an accept() that never got its connection.
+      shutdown(fd, SHUT_RDWR);
+      close(fd);
+    }
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // A port that accepts the handshake and then stays silent.
+  uint16_t SilentTcpPort() {
+    uint16_t port;
+    fds_.push_back(BindLoopback(SOCK_STREAM, &port));
+    return port;
+  }
+
+  // A port nothing listens on.
+  uint16_t ClosedPort(int type) {
+    uint16_t port;
+    close(BindLoopback(type, &port));
+    return port;
+  }
+
+  // Accepts one connection, reads the request and answers with |reply|.
+  uint16_t AnsweringTcpPort(std::string reply) {
+    uint16_t port;
+    int listen_fd = BindLoopback(SOCK_STREAM, &port);
+    fds_.push_back(listen_fd);
+    threads_.emplace_back([listen_fd, reply]() {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      char buffer[4096];
+      if (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+        (void)!send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+      }
+      // Held open a little, so only the reply can end the probe.
+      std::this_thread::sleep_for(milliseconds(200));
+      close(fd);
+    });
+    return port;
+  }
+
+  // Probes |targets| and waits for the batch. Returns the results by id.
+  std::map<std::string, int64_t> Probe(std::vector<ProbeTarget> targets, milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    results_.clear();
+    order_.clear();
+    done_ = false;
+    prober_->Probe(
+        std::move(targets), timeout,
+        [this](const std::string& id, int64_t rtt_us) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          results_[id] = rtt_us;
+          order_.push_back(id);
+        },
+        [this]() {
+          std::lock_guard<std::mutex> lock(mutex_);
+          done_ = true;
+          changed_.notify_all();
+        });
+    EXPECT_TRUE(changed_.wait_for(lock, seconds(5), [this]() { return done_; }));
+    return results_;
+  }
+
+  EventLoop loop_;
+  std::unique_ptr<LatencyProber> prober_ = std::make_unique<LatencyProber>(&loop_);
+  std::vector<int> fds_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::map<std::string, int64_t> results_;
+  std::vector<std::string> order_;
+  bool done_ = false;
+};
+
+TEST_F(LatencyProberTest, TimesAnOpenPortAndFailsARefusedOne) {
+  auto begin = std::chrono::steady_clock::now();
+  auto results = Probe({Target("open", SilentTcpPort()), Target("refused", ClosedPort(SOCK_STREAM))}, seconds(2));
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_GE(results["open"], 0);
+  EXPECT_LT(results["open"], 1000000);
+  EXPECT_EQ(results["refused"], kProbeFailed);
+  // Neither waited for the timeout.
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, seconds(1));
+}
+
+TEST_F(LatencyProberTest, FailsASilentTlsServerAtTheTimeout) {
+  auto begin = std::chrono::steady_clock::now();
+  auto results = Probe({Target("silent", SilentTcpPort(), ProbeProtocol::kTls)}, milliseconds(300));
+  EXPECT_EQ(results["silent"], kProbeFailed);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, milliseconds(300));
+}
+
+TEST_F(LatencyProberTest, ReportsResultsAsTheyFinish) {
+  // The silent one is listed first but reported last, at its deadline.
+  auto results = Probe({Target("silent", SilentTcpPort(), ProbeProtocol::kTls),
+                        Target("alert", AnsweringTcpPort(std::string("\x15\x03\x03\x00\x02\x02\x28", 7)),
+                               ProbeProtocol::kTls),
+                        Target("http", AnsweringTcpPort("HTTP/1.1 400 Bad Request\r\n\r\n"), ProbeProtocol::kTls)},
+                       milliseconds(500));
+  // A TLS alert means a TLS server read the ClientHello; HTTP does not.
+  EXPECT_GE(results["alert"], 0);
+  EXPECT_EQ(results["http"], kProbeFailed);
+  EXPECT_EQ(results["silent"], kProbeFailed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ASSERT_EQ(order_.size(), 3u);
+  EXPECT_EQ(order_.back(), "silent");
+}
+
+TEST_F(LatencyProberTest, FailsQuicOnARefusedOrSilentPort) {
+  uint16_t silent_port;
+  fds_.push_back(BindLoopback(SOCK_DGRAM, &silent_port));
+  auto begin = std::chrono::steady_clock::now();
+  auto results = Probe({Target("refused", ClosedPort(SOCK_DGRAM), ProbeProtocol::kQuic)}, seconds(2));
+  EXPECT_EQ(results["refused"], kProbeFailed);
+  // The ICMP port unreachable ends it well before the timeout.
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, seconds(1));
+
+  results = Probe({Target("silent", silent_port, ProbeProtocol::kQuic)}, milliseconds(300));
+  EXPECT_EQ(results["silent"], kProbeFailed);
+}
+
+TEST_F(LatencyProberTest, FailsWhatItCannotProbeWithoutWaiting) {
+  auto begin = std::chrono::steady_clock::now();
+  auto results = Probe({Target("name", 443, ProbeProtocol::kTcp, "example.com"), Target("no-port", 0)}, seconds(2));
+  EXPECT_EQ(results["name"], kProbeFailed);
+  EXPECT_EQ(results["no-port"], kProbeFailed);
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, seconds(1));
+  // An empty batch is done at once.
+  EXPECT_TRUE(Probe({}, seconds(2)).empty());
+}
+
+}  // namespace
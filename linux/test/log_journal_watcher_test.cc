@@ -0,0 +1,112 @@
+#include "log_journal_watcher.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+class LogJournalWatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("hwl-journal-watcher-test-" +
+                  std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+    std::filesystem::remove_all(directory_);
+    ASSERT_TRUE(loop_.Start());
+  }
+  void TearDown() override {
+    loop_.Stop();
+    std::filesystem::remove_all(directory_);
+  }
+
+  LogJournalWatcher::LinesCallback Collect() {
+    return [this](const char* data, size_t size) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      received_.append(data, size);
+      changed_.notify_all();
+    };
+  }
+
+  // Waits until |expected| has arrived in full.
+  bool WaitFor(const std::string& expected) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, 2s, [&]() { return received_ == expected; });
+  }
+
+  std::string received() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return received_;
+  }
+
+  std::filesystem::path directory_;
+  EventLoop loop_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::string received_;
+};
+
+TEST_F(LogJournalWatcherTest, DeliversEachCommitWithoutPolling) {
+  LogJournal journal(64 * 1024, 3);
+  ASSERT_TRUE(journal.Open(directory_));
+  journal.Append("already there\n", 14);
+  journal.Commit();
+
+  LogJournalWatcher watcher(&loop_, directory_);
+  ASSERT_TRUE(watcher.Start(0, Collect()));
+  EXPECT_TRUE(WaitFor("already there\n"));
+
+  journal.Append("uncommitted\n", 12);
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(received(), "already there\n");
+  journal.Commit();
+  EXPECT_TRUE(WaitFor("already there\nuncommitted\n"));
+}
+
+TEST_F(LogJournalWatcherTest, FollowsANewSegment) {
+  LogJournal journal(64 * 1024, 2);
+  ASSERT_TRUE(journal.Open(directory_));
+  LogJournalWatcher watcher(&loop_, directory_);
+  ASSERT_TRUE(watcher.Start(journal.end_position(), Collect()));
+
+  // Enough to fill the first segment and start the next.
+  std::string expected;
+  std::string line(99, 'x');
+  line += "\n";
+  for (int i = 0; i < 700; i++) {
+    journal.Append(line.data(), line.size());
+    expected += line;
+  }
+  journal.Commit();
+  EXPECT_TRUE(WaitFor(expected));
+  loop_.RunSync([&]() { EXPECT_EQ(watcher.cursor(), journal.end_position()); });
+}
+
+TEST_F(LogJournalWatcherTest, ResumesFromACursor) {
+  LogJournal journal(64 * 1024, 3);
+  ASSERT_TRUE(journal.Open(directory_));
+  journal.Append("seen\nnew\n", 9);
+  journal.Commit();
+  LogJournalWatcher watcher(&loop_, directory_);
+  ASSERT_TRUE(watcher.Start(5, Collect()));
+  EXPECT_TRUE(WaitFor("new\n"));
+
+  watcher.Stop();
+  journal.Append("after stop\n", 11);
+  journal.Commit();
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(received(), "new\n");
+}
+
+TEST_F(LogJournalWatcherTest, FailsForAMissingDirectory) {
+  LogJournalWatcher watcher(&loop_, directory_ / "missing");
+  EXPECT_FALSE(watcher.Start(0, Collect()));
+}
+
+}  // namespace
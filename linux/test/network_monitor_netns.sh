@@ -0,0 +1,28 @@
+#!/bin/sh
+# Runs NetworkMonitorNetnsTest from the test binary $1 in a network
+# namespace of its own, where the tests create and change a link "hwl0".
+# That is a dummy interface, or a veth pair where the dummy driver is
+# missing. Needs root; exits 77, which ctest counts as skipped, without it.
+set -eu
+tests=$1
+
+[ "$(id -u)" = 0 ] || { echo "Needs root."; exit 77; }
+for tool in unshare ip; do
+  command -v "$tool" >/dev/null || { echo "Needs $tool."; exit 77; }
+done
+unshare --net true 2>/dev/null || { echo "Cannot create a network namespace."; exit 77; }
+
+unshare --net sh -euc '
+  ip link set lo up
+  if ip link add hwl-probe type dummy 2>/dev/null; then
+    ip link del hwl-probe
+    export HWL_NETWORK_NETNS_LINK=dummy
+  elif ip link add hwl-probe type veth peer name hwl-probe-peer 2>/dev/null; then
+    ip link del hwl-probe
+    export HWL_NETWORK_NETNS_LINK=veth
+  else
+    echo "Cannot create a dummy or veth link."
+    exit 77
+  fi
+  exec "$0" --gtest_filter="NetworkMonitorNetnsTest.*"
+' "$tests"
@@ -0,0 +1,156 @@
+#include "network_monitor.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+// Runs only inside network_monitor_netns.sh, which provides a network
+// namespace of its own and names in $HWL_NETWORK_NETNS_LINK the link type
+// the kernel can create: "dummy", or "veth" where the dummy driver is
+// missing. Each test starts from link hwl0, up, at 192.168.60.2/24 with the
+// default route via 192.168.60.1.
+class NetworkMonitorNetnsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const char* type = std::getenv("HWL_NETWORK_NETNS_LINK");
+    if (type == nullptr) {
+      GTEST_SKIP() << "Run through network_monitor_netns.sh.";
+    }
+    type_ = type;
+    Run("ip link del hwl0 2>/dev/null; ip link del hwl1 2>/dev/null; true");
+    ASSERT_TRUE(AddLink("hwl0"));
+    ASSERT_TRUE(Run("ip addr add 192.168.60.2/24 dev hwl0"));
+    ASSERT_TRUE(Run("ip route add default via 192.168.60.1 dev hwl0 onlink"));
+
+    ASSERT_TRUE(loop_.Start());
+    monitor_ = std::make_unique<NetworkMonitor>(&loop_);
+    monitor_->Start([this](uint32_t changes, std::shared_ptr<const NetworkSnapshot> snapshot) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        changes_ |= changes;
+        latest_ = std::move(snapshot);
+      }
+      changed_.notify_all();
+    });
+    // The dump fills the table without reporting a change.
+    for (int i = 0; i < 200 && monitor_->snapshot()->default_interface.empty(); i++) {
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+    ASSERT_EQ(monitor_->snapshot()->default_interface, "hwl0");
+  }
+
+  void TearDown() override {
+    monitor_.reset();
+    loop_.Stop();
+  }
+
+  static bool Run(const std::string& command) { return std::system(command.c_str()) == 0; }
+
+  // Creates |name| up, with a carrier.
+  bool AddLink(const std::string& name) {
+    if (type_ == "dummy") {
+      return Run("ip link add " + name + " type dummy && ip link set " + name + " up");
+    }
+    return Run("ip link add " + name + " type veth peer name " + name + "-peer && ip link set " + name +
+               "-peer up && ip link set " + name + " up");
+  }
+
+  // Waits for a report with all of |bits| and returns its snapshot.
+  std::shared_ptr<const NetworkSnapshot> WaitForChange(uint32_t bits) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    EXPECT_TRUE(changed_.wait_for(lock, seconds(3), [&]() { return (changes_ & bits) == bits; }))
+        << "changes " << changes_;
+    uint32_t seen = changes_;
+    changes_ = 0;
+    last_changes_ = seen;
+    return latest_ ? latest_ : monitor_->snapshot();
+  }
+
+  static const NetworkInterface* Find(const NetworkSnapshot& snapshot, const std::string& name) {
+    for (const NetworkInterface& link : snapshot.interfaces) {
+      if (link.name == name) {
+        return &link;
+      }
+    }
+    return nullptr;
+  }
+
+  std::string type_;
+  EventLoop loop_;
+  std::unique_ptr<NetworkMonitor> monitor_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  uint32_t changes_ = 0;
+  // What the last WaitForChange() saw.
+  uint32_t last_changes_ = 0;
+  std::shared_ptr<const NetworkSnapshot> latest_;
+};
+
+TEST_F(NetworkMonitorNetnsTest, ReadsTheInitialState) {
+  std::shared_ptr<const NetworkSnapshot> snapshot = monitor_->snapshot();
+  EXPECT_EQ(snapshot->gateway, "192.168.60.1");
+  EXPECT_EQ(snapshot->local_ip, "192.168.60.2");
+  const NetworkInterface* link = Find(*snapshot, "hwl0");
+  ASSERT_NE(link, nullptr);
+  EXPECT_TRUE(link->up);
+  EXPECT_FALSE(link->point_to_point);
+  EXPECT_EQ(link->ipv4, std::vector<std::string>{"192.168.60.2"});
+}
+
+TEST_F(NetworkMonitorNetnsTest, ReportsAnAddressChange) {
+  // The gateway is on-link, so moving the address leaves the route alone.
+  ASSERT_TRUE(Run("ip addr add 10.9.0.2/24 dev hwl0 && ip addr del 192.168.60.2/24 dev hwl0"));
+  std::shared_ptr<const NetworkSnapshot> snapshot = WaitForChange(kNetworkAddressChanged);
+  EXPECT_EQ(snapshot->local_ip, "10.9.0.2");
+  EXPECT_EQ(snapshot->gateway, "192.168.60.1");
+  EXPECT_EQ(last_changes_, static_cast<uint32_t>(kNetworkAddressChanged));
+}
+
+TEST_F(NetworkMonitorNetnsTest, ReportsAGatewayChange) {
+  ASSERT_TRUE(Run("ip route replace default via 192.168.60.254 dev hwl0 onlink"));
+  std::shared_ptr<const NetworkSnapshot> snapshot = WaitForChange(kNetworkGatewayChanged);
+  EXPECT_EQ(snapshot->gateway, "192.168.60.254");
+  EXPECT_EQ(snapshot->default_interface, "hwl0");
+  EXPECT_EQ(last_changes_, static_cast<uint32_t>(kNetworkGatewayChanged));
+
+  ASSERT_TRUE(Run("ip route del default"));
+  snapshot = WaitForChange(kNetworkGatewayChanged);
+  EXPECT_EQ(snapshot->gateway, "");
+  EXPECT_EQ(snapshot->default_interface, "");
+  // The LAN address stays that of a physical link that is up.
+  EXPECT_EQ(snapshot->local_ip, "192.168.60.2");
+}
+
+TEST_F(NetworkMonitorNetnsTest, ReportsALinkChange) {
+  ASSERT_TRUE(AddLink("hwl1"));
+  std::shared_ptr<const NetworkSnapshot> snapshot = WaitForChange(kNetworkLinkChanged);
+  const NetworkInterface* added = Find(*snapshot, "hwl1");
+  ASSERT_NE(added, nullptr);
+  EXPECT_TRUE(added->up);
+
+  // Taking the link down drops its default route with it.
+  ASSERT_TRUE(Run("ip link set hwl0 down"));
+  snapshot = WaitForChange(kNetworkLinkChanged | kNetworkGatewayChanged);
+  const NetworkInterface* down = Find(*snapshot, "hwl0");
+  ASSERT_NE(down, nullptr);
+  EXPECT_FALSE(down->up);
+  EXPECT_EQ(snapshot->default_interface, "");
+
+  ASSERT_TRUE(Run("ip link del hwl1"));
+  snapshot = WaitForChange(kNetworkLinkChanged);
+  EXPECT_EQ(Find(*snapshot, "hwl1"), nullptr);
+}
+
+}  // namespace
@@ -0,0 +1,469 @@
+#include "process_manager.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clash_api.h"
+#include "event_loop.h"
+#include "log_ring.h"
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+// How long the stub takes to bring the Clash API back after SIGHUP.
+constexpr int64_t kStubReloadMs = 150;
+
+// A loopback port nothing listens on.
+uint16_t FreePort() {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+  close(fd);
+  return ntohs(address.sin_port);
+}
+
+// A config the stub serves, with a Clash API unless |api_port| is 0.
+std::string StubConfig(const char* level, uint16_t api_port, const char* dns_server = "a", int mtu = 1500,
+                       const std::string& secret = "") {
+  std::string config = std::string("{\"log\":{\"level\":\"") + level + "\"},\"dns\":{\"servers\":[\"" + dns_server +
+                       "\"]},\"inbounds\":[{\"type\":\"tun\",\"mtu\":" + std::to_string(mtu) + "}]";
+  if (api_port != 0) {
+    config += ",\"experimental\":{\"clash_api\":{\"external_controller\":\"127.0.0.1:" +
+              std::to_string(api_port) + "\"";
+    if (!secret.empty()) {
+      config += ",\"secret\":\"" + secret + "\"";
+    }
+    config += "}}";
+  }
+  return config + "}";
+}
+
+// Runs ProcessManager against stub_sing_box.cc, which the build puts next
+// to this binary as "sing-box".
+class ProcessManagerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    control_ = std::filesystem::temp_directory_path() /
+               ("hwl-stub-control-" + std::to_string(getpid()) + "-" +
+                ::testing::UnitTest::GetInstance()->current_test_info()->name());
+    std::filesystem::remove(control_);
+    setenv("HWL_STUB_CONTROL", control_.c_str(), 1);
+    ASSERT_TRUE(loop_.Start());
+    manager_ = std::make_unique<ProcessManager>(&loop_);
+    manager_->SetLogRing(&ring_);
+    manager_->SetReadyCallback([this](bool confirmed) {
+      Record([&]() { ready_.push_back(confirmed); });
+    });
+    manager_->SetRestartCallback([this](const RestartEvent& event) {
+      Record([&]() { restarts_.push_back(event); });
+    });
+    manager_->SetExitCallback([this]() { Record([&]() { exits_++; }); });
+  }
+
+  void TearDown() override {
+    manager_.reset();
+    loop_.Stop();
+    std::filesystem::remove(control_);
+    unsetenv("HWL_STUB_CONTROL");
+    unsetenv("HWL_STUB_STARTUP_MS");
+  }
+
+  void Control(const char* command) { std::ofstream(control_) << command; }
+
+  void Record(const std::function<void()>& update) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      update();
+    }
+    changed_.notify_all();
+  }
+
+  // Waits for |done| to hold, checked under the lock after every callback.
+  bool WaitFor(std::chrono::steady_clock::duration timeout, const std::function<bool()>& done) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, timeout, done);
+  }
+
+  void StartAndWaitForReady(const std::string& config = "{}") {
+    ASSERT_TRUE(manager_->Start(config));
+    ASSERT_TRUE(WaitFor(seconds(5), [this]() { return ready_.size() == 1; }));
+    EXPECT_TRUE(ready_[0]);
+  }
+
+  // Waits for |text| in the log. The API can confirm readiness before the
+  // stub's stdout has been read, so the ring is drained until it shows up.
+  bool WaitForLog(const std::string& text) {
+    auto deadline = std::chrono::steady_clock::now() + seconds(5);
+    while (logs_.find(text) == std::string::npos) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(milliseconds(10));
+      ring_.Drain([this](const char* data, size_t size) { logs_.append(data, size); });
+    }
+    return true;
+  }
+
+  // Reloads |config| and waits for the outcome, well short of the 15 s
+  // after which an unconfirmed reload is assumed to have worked.
+  ReloadResult Reload(const std::string& config) {
+    auto promise = std::make_shared<std::promise<ReloadResult>>();
+    std::future<ReloadResult> future = promise->get_future();
+    EXPECT_TRUE(manager_->Reload(config, [promise](const ReloadResult& result) { promise->set_value(result); }));
+    if (future.wait_for(seconds(5)) != std::future_status::ready) {
+      ADD_FAILURE() << "The reload was not confirmed.";
+      return ReloadResult();
+    }
+    return future.get();
+  }
+
+  std::filesystem::path control_;
+  EventLoop loop_;
+  LogRing ring_{1 << 16};
+  std::unique_ptr<ProcessManager> manager_;
+  // What WaitForLog() drained from |ring_|.
+  std::string logs_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<bool> ready_;
+  std::vector<RestartEvent> restarts_;
+  int exits_ = 0;
+};
+
+TEST_F(ProcessManagerTest, RestartsACrashAndMeasuresTheRecovery) {
+  StartAndWaitForReady();
+  pid_t first = manager_->pid();
+
+  auto crashed = std::chrono::steady_clock::now();
+  Control("crash");
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return restarts_.size() == 2; }));
+  auto recovered = std::chrono::steady_clock::now();
+
+  const RestartEvent& scheduled = restarts_[0];
+  EXPECT_EQ(scheduled.kind, RestartEvent::Kind::kScheduled);
+  EXPECT_EQ(scheduled.exit_status, "exited with code 2");
+  EXPECT_EQ(scheduled.crashes, 1u);
+  EXPECT_GE(scheduled.delay_ms, RestartPolicy::kInitialDelay.count() / 2);
+  EXPECT_LE(scheduled.delay_ms, RestartPolicy::kInitialDelay.count());
+
+  // The recovery covers the backoff and the new start, and no more than
+  // the time this test saw pass.
+  const RestartEvent& recovery = restarts_[1];
+  EXPECT_EQ(recovery.kind, RestartEvent::Kind::kRecovered);
+  EXPECT_EQ(recovery.attempt, 1u);
+  EXPECT_GE(recovery.recovery_ms, scheduled.delay_ms);
+  EXPECT_LE(recovery.recovery_ms, std::chrono::duration_cast<milliseconds>(recovered - crashed).count());
+  EXPECT_EQ(recovery.stats.recoveries, 1u);
+  EXPECT_EQ(recovery.stats.last_recovery_ms, recovery.recovery_ms);
+
+  ASSERT_TRUE(WaitFor(seconds(1), [this]() { return ready_.size() == 2; }));
+  EXPECT_TRUE(manager_->IsRunning());
+  EXPECT_NE(manager_->pid(), first);
+  EXPECT_EQ(exits_, 0);
+}
+
+TEST_F(ProcessManagerTest, GivesUpOnACrashLoop) {
+  StartAndWaitForReady();
+  Control("loop");
+  // The backoff of the crashes before the limit adds up to at most 7.5 s.
+  ASSERT_TRUE(WaitFor(seconds(15), [this]() { return exits_ == 1; }));
+
+  std::vector<RestartEvent> scheduled;
+  for (const RestartEvent& event : restarts_) {
+    if (event.kind == RestartEvent::Kind::kScheduled) {
+      scheduled.push_back(event);
+    }
+  }
+  ASSERT_EQ(scheduled.size(), RestartPolicy::kCrashLimit - 1);
+  int64_t step = RestartPolicy::kInitialDelay.count();
+  for (size_t i = 0; i < scheduled.size(); i++) {
+    EXPECT_EQ(scheduled[i].crashes, i + 1);
+    EXPECT_GE(scheduled[i].delay_ms, step / 2);
+    EXPECT_LE(scheduled[i].delay_ms, step);
+    step *= 2;
+  }
+  EXPECT_EQ(restarts_.back().kind, RestartEvent::Kind::kGaveUp);
+  EXPECT_EQ(restarts_.back().crashes, RestartPolicy::kCrashLimit);
+  EXPECT_FALSE(manager_->IsRunning());
+  EXPECT_EQ(manager_->pid(), -1);
+}
+
+TEST_F(ProcessManagerTest, DoesNotRestartAStartThatNeverCameUp) {
+  Control("early");
+  ASSERT_TRUE(manager_->Start("{}"));
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return exits_ == 1; }));
+  std::this_thread::sleep_for(RestartPolicy::kInitialDelay);
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_TRUE(restarts_.empty());
+  EXPECT_TRUE(ready_.empty());
+  EXPECT_FALSE(manager_->IsRunning());
+}
+
+TEST_F(ProcessManagerTest, StopCancelsAPendingRestart) {
+  StartAndWaitForReady();
+  Control("crash");
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return !restarts_.empty(); }));
+  manager_->Stop();
+  std::this_thread::sleep_for(RestartPolicy::kInitialDelay * 2);
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_EQ(restarts_.size(), 1u);
+  EXPECT_EQ(ready_.size(), 1u);
+  EXPECT_FALSE(manager_->IsRunning());
+  EXPECT_EQ(manager_->pid(), -1);
+}
+
+TEST_F(ProcessManagerTest, ConfirmsASignalReloadWithoutAnyLogLine) {
+  // At the error level sing-box never logs "sing-box started".
+  uint16_t port = FreePort();
+  StartAndWaitForReady(StubConfig("error", port));
+  pid_t pid = manager_->pid();
+
+  ReloadResult result = Reload(StubConfig("error", port, "b"));
+  EXPECT_EQ(result.path, ReloadPath::kSignal);
+  EXPECT_EQ(result.sections, std::vector<std::string>{"dns"});
+  EXPECT_EQ(result.error, "");
+  // Confirmed by the new API rather than by the old one still answering.
+  EXPECT_GE(result.elapsed_ms, kStubReloadMs);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ASSERT_EQ(ready_.size(), 2u);
+  EXPECT_TRUE(ready_[1]);
+  EXPECT_EQ(manager_->pid(), pid);
+}
+
+TEST_F(ProcessManagerTest, DeliversAMultiMegabyteConfigThroughTheMemfd) {
+  // Well past a pipe's 64 KiB buffer, and reloaded into the same memfd
+  // with a smaller one, so a stale tail would show in the size.
+  std::string large_server(8 << 20, 'x');
+  std::string large = StubConfig("info", FreePort(), large_server.c_str());
+  StartAndWaitForReady(large);
+  EXPECT_TRUE(manager_->timeline().reached(StartPhase::kConfigWritten));
+
+  std::string small_server(3 << 20, 'y');
+  std::string small = StubConfig("info", manager_->api_port(), small_server.c_str());
+  ReloadResult result = Reload(small);
+  EXPECT_EQ(result.path, ReloadPath::kSignal);
+  EXPECT_EQ(result.error, "");
+
+  EXPECT_TRUE(WaitForLog("config: " + std::to_string(large.size()) + " bytes from /dev/fd/3\n")) << logs_;
+  EXPECT_TRUE(WaitForLog("config: " + std::to_string(small.size()) + " bytes from /dev/fd/3\n")) << logs_;
+}
+
+TEST_F(ProcessManagerTest, ConfirmsASignalReloadThatMovesTheApi) {
+  StartAndWaitForReady(StubConfig("error", FreePort()));
+  ReloadResult result = Reload(StubConfig("error", FreePort()));
+  EXPECT_EQ(result.path, ReloadPath::kSignal);
+  EXPECT_EQ(result.sections, std::vector<std::string>{"experimental"});
+  EXPECT_EQ(result.error, "");
+  EXPECT_GE(result.elapsed_ms, kStubReloadMs);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ASSERT_EQ(ready_.size(), 2u);
+  EXPECT_TRUE(ready_[1]);
+}
+
+TEST_F(ProcessManagerTest, ConfirmsASignalReloadFromTheLogWithoutAnApi) {
+  StartAndWaitForReady(StubConfig("info", 0));
+  ReloadResult result = Reload(StubConfig("debug", 0, "b"));
+  EXPECT_EQ(result.path, ReloadPath::kSignal);
+  EXPECT_EQ(result.sections, (std::vector<std::string>{"log", "dns"}));
+  EXPECT_EQ(result.error, "");
+  std::lock_guard<std::mutex> lock(mutex_);
+  ASSERT_EQ(ready_.size(), 2u);
+  EXPECT_TRUE(ready_[1]);
+}
+
+TEST_F(ProcessManagerTest, KeepsTheRunningConfigWhenTheCheckFails) {
+  uint16_t port = FreePort();
+  StartAndWaitForReady(StubConfig("error", port));
+  pid_t pid = manager_->pid();
+  ReloadResult result = Reload(StubConfig("error", port, "bad"));
+  EXPECT_EQ(result.path, ReloadPath::kSignal);
+  EXPECT_EQ(result.error.rfind("it did not pass sing-box check, keeping the current one.\n", 0), 0u) << result.error;
+  EXPECT_EQ(manager_->pid(), pid);
+
+  // The rejected config was never handed over.
+  result = Reload(StubConfig("error", port, "b"));
+  EXPECT_EQ(result.sections, std::vector<std::string>{"dns"});
+  EXPECT_EQ(result.error, "");
+}
+
+TEST_F(ProcessManagerTest, RestartsForInboundsAndSkipsTheSameConfig) {
+  uint16_t port = FreePort();
+  std::string config = StubConfig("error", port);
+  StartAndWaitForReady(config);
+  pid_t pid = manager_->pid();
+
+  std::string reformatted;
+  for (char c : config) {
+    reformatted += c;
+    if (c == ',' || c == '[') {
+      reformatted += ' ';
+    }
+  }
+  ReloadResult result = Reload(reformatted);
+  EXPECT_EQ(result.path, ReloadPath::kUnchanged);
+  EXPECT_EQ(manager_->pid(), pid);
+
+  result = Reload(StubConfig("error", port, "a", 1400));
+  EXPECT_EQ(result.path, ReloadPath::kRestart);
+  EXPECT_EQ(result.sections, std::vector<std::string>{"inbounds"});
+  EXPECT_EQ(result.error, "");
+  EXPECT_NE(manager_->pid(), pid);
+  EXPECT_TRUE(manager_->IsRunning());
+}
+
+}  // namespace
+
+// Prepare() then Switch(), measuring the gap from Switch() to the new
+// process being ready, and a cold Stop() and Start() for comparison. The
+// stub takes kStartupMs to start, which the standby has already spent.
+TEST_F(ProcessManagerTest, SwitchesToAPreparedStandby) {
+  constexpr int kStartupMs = 200;
+  setenv("HWL_STUB_STARTUP_MS", std::to_string(kStartupMs).c_str(), 1);
+  StartAndWaitForReady(StubConfig("info", 0));
+  pid_t first = manager_->pid();
+
+  std::string next = StubConfig("info", 0, "b");
+  std::promise<std::pair<bool, std::string>> checked;
+  manager_->Prepare(next, [&checked](bool valid, const std::string& output) {
+    checked.set_value({valid, output});
+  });
+  std::future<std::pair<bool, std::string>> check = checked.get_future();
+  ASSERT_EQ(check.wait_for(seconds(5)), std::future_status::ready);
+  EXPECT_TRUE(check.get().first);
+
+  auto switch_begin = std::chrono::steady_clock::now();
+  ASSERT_TRUE(manager_->Switch(next));
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return ready_.size() == 2; }));
+  auto switch_gap = std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - switch_begin);
+  EXPECT_TRUE(manager_->IsRunning());
+  EXPECT_NE(manager_->pid(), first);
+
+  manager_->Stop();
+  auto cold_begin = std::chrono::steady_clock::now();
+  ASSERT_TRUE(manager_->Start(next));
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return ready_.size() == 3; }));
+  auto cold_gap = std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - cold_begin);
+
+  RecordProperty("switch_gap_ms", static_cast<int>(switch_gap.count()));
+  RecordProperty("cold_start_ms", static_cast<int>(cold_gap.count()));
+  std::cout << "Switch gap " << switch_gap.count() << " ms, stop and cold start " << cold_gap.count() << " ms"
+            << std::endl;
+  unsetenv("HWL_STUB_STARTUP_MS");
+  EXPECT_GE(cold_gap, milliseconds(kStartupMs));
+  EXPECT_LT(switch_gap, milliseconds(kStartupMs));
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_EQ(exits_, 0);
+  EXPECT_TRUE(restarts_.empty());
+}
+
+TEST_F(ProcessManagerTest, SwitchChecksAnUnpreparedConfig) {
+  StartAndWaitForReady(StubConfig("info", 0));
+  pid_t first = manager_->pid();
+  ASSERT_TRUE(manager_->Switch(StubConfig("info", 0, "c")));
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return ready_.size() == 2; }));
+  EXPECT_NE(manager_->pid(), first);
+}
+
+TEST_F(ProcessManagerTest, KeepsTheCurrentProcessWhenTheSwitchCheckFails) {
+  StartAndWaitForReady(StubConfig("info", 0));
+  pid_t pid = manager_->pid();
+
+  std::string rejected = StubConfig("info", 0, "bad");
+  std::promise<std::pair<bool, std::string>> checked;
+  manager_->Prepare(rejected, [&checked](bool valid, const std::string& output) {
+    checked.set_value({valid, output});
+  });
+  std::future<std::pair<bool, std::string>> check = checked.get_future();
+  ASSERT_EQ(check.wait_for(seconds(5)), std::future_status::ready);
+  std::pair<bool, std::string> result = check.get();
+  EXPECT_FALSE(result.first);
+  EXPECT_NE(result.second.find("bad value"), std::string::npos) << result.second;
+
+  // Neither the prepared failure nor a fresh check replaces the process.
+  EXPECT_FALSE(manager_->Switch(rejected));
+  EXPECT_FALSE(manager_->Switch(StubConfig("info", 0, "also bad")));
+  EXPECT_TRUE(manager_->IsRunning());
+  EXPECT_EQ(manager_->pid(), pid);
+  std::this_thread::sleep_for(milliseconds(100));
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_EQ(ready_.size(), 1u);
+  EXPECT_EQ(exits_, 0);
+}
+
+TEST_F(ProcessManagerTest, MarksReadyFromTheStartedLine) {
+  StartAndWaitForReady(StubConfig("info", 0));
+  StartTimeline::Snapshot timeline = manager_->timeline().snapshot();
+  int64_t spawned = timeline.phase_us[static_cast<size_t>(StartPhase::kSpawned)];
+  int64_t written = timeline.phase_us[static_cast<size_t>(StartPhase::kConfigWritten)];
+  int64_t ready = timeline.phase_us[static_cast<size_t>(StartPhase::kReady)];
+  EXPECT_GE(spawned, 0);
+  EXPECT_GE(written, spawned);
+  EXPECT_GE(ready, written);
+  EXPECT_GT(timeline.started_at_ms, 0);
+}
+
+TEST_F(ProcessManagerTest, MarksReadyFromTheApiBelowTheInfoLevel) {
+  // No "sing-box started" line at the warn level; only the API says so.
+  StartAndWaitForReady(StubConfig("warn", FreePort()));
+  EXPECT_TRUE(manager_->timeline().reached(StartPhase::kReady));
+}
+
+TEST_F(ProcessManagerTest, ProbesTheApiWithItsSecret) {
+  std::string secret = RandomClashApiSecret();
+  StartAndWaitForReady(StubConfig("warn", FreePort(), "a", 1500, secret));
+  EXPECT_EQ(manager_->api_secret(), secret);
+  // The stub logs every request without the bearer token.
+  std::string logs;
+  ring_.Drain([&logs](const char* data, size_t size) { logs.append(data, size); });
+  EXPECT_EQ(logs.find("unauthorized"), std::string::npos) << logs;
+}
+
+TEST_F(ProcessManagerTest, ReportsAnUnconfirmedStartAfterTheTimeout) {
+  manager_->SetReadyTimeout(milliseconds(300));
+  auto begin = std::chrono::steady_clock::now();
+  // Neither the line nor an API: nothing ever confirms this start.
+  ASSERT_TRUE(manager_->Start(StubConfig("error", 0)));
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return ready_.size() == 1; }));
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, milliseconds(300));
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_FALSE(ready_[0]);
+  EXPECT_FALSE(manager_->timeline().reached(StartPhase::kReady));
+  EXPECT_TRUE(manager_->IsRunning());
+  EXPECT_EQ(exits_, 0);
+}
+
+TEST_F(ProcessManagerTest, ReportsAnExitBeforeReady) {
+  Control("early");
+  ASSERT_TRUE(manager_->Start(StubConfig("info", FreePort())));
+  ASSERT_TRUE(WaitFor(seconds(5), [this]() { return exits_ == 1; }));
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_TRUE(ready_.empty());
+  EXPECT_TRUE(manager_->timeline().reached(StartPhase::kSpawned));
+  EXPECT_FALSE(manager_->timeline().reached(StartPhase::kReady));
+  EXPECT_FALSE(manager_->IsRunning());
+  EXPECT_EQ(manager_->pid(), -1);
+}
@@ -0,0 +1,506 @@
+#include "speed_tester.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr uint64_t kDownloadSize = 1 << 20;
+
+// How the sink/source answers.
+enum class ServerMode {
+  // Content-Length responses on a kept-alive connection.
+  kKeepAlive,
+  // Content-Length responses, each ending its connection.
+  kCloseAfterEach,
+  // A response head promising kDownloadSize bytes, a little of the body,
+  // then the connection closes.
+  kCutShort,
+};
+
+// A socket of |type| bound to a free loopback port, listening when it is a
+// stream.
+int BindLoopback(int type, uint16_t* port) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+  if (type == SOCK_STREAM) {
+    listen(fd, 64);
+  }
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+bool SendAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+bool RecvAll(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t received = recv(fd, data, size, 0);
+    if (received <= 0) {
+      return false;
+    }
+    data += received;
+    size -= static_cast<size_t>(received);
+  }
+  return true;
+}
+
+HttpUrl Url(uint16_t port, const char* target) {
+  HttpUrl url;
+  url.host = "127.0.0.1";
+  url.port = port;
+  url.target = target;
+  return url;
+}
+
+// Runs SpeedTester against a local HTTP sink/source reached through a SOCKS5
+// stand-in for the mixed inbound. Every socket the stand-ins open is
+// tracked, so TearDown can wake and join their threads.
+class SpeedTesterTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(loop_.Start()); }
+  void TearDown() override {
+    tester_.reset();
+    loop_.Stop();
+    {
+      std::lock_guard<std::mutex> lock(sockets_mutex_);
+      stopping_ = true;
+      for (int fd : sockets_) {
+        shutdown(fd, SHUT_RDWR);
+      }
+    }
+    for (;;) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(sockets_mutex_);
+        threads.swap(threads_);
+      }
+      if (threads.empty()) {
+        break;
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+    }
+    for (int fd : sockets_) {
+      close(fd);
+    }
+  }
+
+  // Starts the HTTP server and returns its port.
+  uint16_t StartServer(ServerMode mode) {
+    uint16_t port;
+    int listen_fd = Track(BindLoopback(SOCK_STREAM, &port));
+    Spawn([this, listen_fd, mode]() {
+      AcceptLoop(listen_fd, [this, mode](int fd) { ServeHttp(fd, mode); });
+    });
+    return port;
+  }
+
+  // Starts the SOCKS5 stand-in and returns its port. It refuses the first
+  // |refused| CONNECT requests, relays the rest to their target and
+  // answers UDP ASSOCIATE with a relay that echoes every datagram.
+  uint16_t StartProxy(int refused = 0) {
+    uint16_t port;
+    int listen_fd = Track(BindLoopback(SOCK_STREAM, &port));
+    refused_ = refused;
+    Spawn([this, listen_fd]() {
+      AcceptLoop(listen_fd, [this](int fd) {
+        proxy_connections_++;
+        ServeSocks(fd);
+      });
+    });
+    return port;
+  }
+
+  // Runs a test to the end, cancelling it after |cancel_after| when set.
+  void Run(SpeedTestOptions options, std::chrono::milliseconds cancel_after = 0ms) {
+    ASSERT_TRUE(tester_->Start(
+        std::move(options),
+        [this](SpeedTestPhase, int64_t, uint64_t, double) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          progress_++;
+        },
+        [this](const std::vector<SpeedTestResult>& results, const std::string& error) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          results_ = results;
+          error_ = error;
+          done_ = true;
+          changed_.notify_all();
+        }));
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (cancel_after > 0ms && !changed_.wait_for(lock, cancel_after, [this]() { return done_; })) {
+      tester_->Cancel();
+    }
+    ASSERT_TRUE(changed_.wait_for(lock, 10s, [this]() { return done_; }));
+  }
+
+  SpeedTestOptions Options(uint16_t proxy_port) {
+    SpeedTestOptions options;
+    options.proxy_ip = "127.0.0.1";
+    options.proxy_port = proxy_port;
+    options.streams = 2;
+    options.phase_duration = 600ms;
+    options.upload_size = 256 * 1024;
+    return options;
+  }
+
+  int Track(int fd) {
+    std::lock_guard<std::mutex> lock(sockets_mutex_);
+    sockets_.insert(fd);
+    if (stopping_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    return fd;
+  }
+
+  void Close(int fd) {
+    std::lock_guard<std::mutex> lock(sockets_mutex_);
+    sockets_.erase(fd);
+    close(fd);
+  }
+
+  void Spawn(std::function<void()> body) {
+    std::lock_guard<std::mutex> lock(sockets_mutex_);
+    threads_.emplace_back(std::move(body));
+  }
+
+  // Hands each accepted connection to |serve| on a thread of its own,
+  // which closes it after.
+  void AcceptLoop(int listen_fd, std::function<void(int)> serve) {
+    for (;;) {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      Track(fd);
+      Spawn([this, fd, serve]() {
+        serve(fd);
+        Close(fd);
+      });
+    }
+  }
+
+  void ServeHttp(int fd, ServerMode mode) {
+    std::string in;
+    char buffer[64 * 1024];
+    for (;;) {
+      size_t head_end;
+      while ((head_end = in.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+          return;
+        }
+        in.append(buffer, static_cast<size_t>(received));
+      }
+      std::string head = in.substr(0, head_end);
+      in.erase(0, head_end + 4);
+      if (head.compare(0, 5, "POST ") == 0) {
+        size_t length_at = head.find("Content-Length: ");
+        uint64_t length = length_at == std::string::npos ? 0 : std::stoull(head.substr(length_at + 16));
+        while (in.size() < length) {
+          ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+          if (received <= 0) {
+            return;
+          }
+          uploaded_ += static_cast<uint64_t>(received);
+          in.append(buffer, static_cast<size_t>(received));
+        }
+        in.erase(0, length);
+        std::string reply = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+        if (!SendAll(fd, reply.data(), reply.size())) {
+          return;
+        }
+        continue;
+      }
+
+      std::string reply = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(kDownloadSize) + "\r\n";
+      reply += mode == ServerMode::kCloseAfterEach ? "Connection: close\r\n\r\n" : "\r\n";
+      if (!SendAll(fd, reply.data(), reply.size())) {
+        return;
+      }
+      std::string body(mode == ServerMode::kCutShort ? 1000 : kDownloadSize, 'x');
+      if (!SendAll(fd, body.data(), body.size()) || mode != ServerMode::kKeepAlive) {
+        return;
+      }
+    }
+  }
+
+  void ServeSocks(int fd) {
+    // Greeting, then the request up to its address type.
+    char greeting[3];
+    uint8_t request[4];
+    if (!RecvAll(fd, greeting, sizeof(greeting)) || !SendAll(fd, "\x05\x00", 2) ||
+        !RecvAll(fd, reinterpret_cast<char*>(request), sizeof(request)) || request[3] != 0x01) {
+      return;
+    }
+    uint8_t address[6];
+    if (!RecvAll(fd, reinterpret_cast<char*>(address), sizeof(address))) {
+      return;
+    }
+    if (request[1] == 0x03) {
+      ServeAssociation(fd);
+      return;
+    }
+    if (refused_-- > 0) {
+      SendAll(fd, "\x05\x05\x00\x01\x00\x00\x00\x00\x00\x00", 10);
+      return;
+    }
+    sockaddr_in target = {};
+    target.sin_family = AF_INET;
+    memcpy(&target.sin_addr, address, 4);
+    memcpy(&target.sin_port, address + 4, 2);
+    int upstream = Track(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (connect(upstream, reinterpret_cast<sockaddr*>(&target), sizeof(target)) != 0) {
+      SendAll(fd, "\x05\x05\x00\x01\x00\x00\x00\x00\x00\x00", 10);
+      Close(upstream);
+      return;
+    }
+    if (SendAll(fd, "\x05\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10)) {
+      Relay(fd, upstream);
+    }
+    Close(upstream);
+  }
+
+  // Copies both ways until either side closes.
+  static void Relay(int a, int b) {
+    char buffer[64 * 1024];
+    pollfd fds[2] = {{a, POLLIN, 0}, {b, POLLIN, 0}};
+    while (poll(fds, 2, -1) > 0) {
+      for (int i = 0; i < 2; i++) {
+        if (fds[i].revents == 0) {
+          continue;
+        }
+        ssize_t received = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+        if (received <= 0 || !SendAll(fds[1 - i].fd, buffer, static_cast<size_t>(received))) {
+          return;
+        }
+      }
+    }
+  }
+
+  // Answers with an echoing relay and holds it until the control
+  // connection closes.
+  void ServeAssociation(int fd) {
+    uint16_t port;
+    int relay = Track(BindLoopback(SOCK_DGRAM, &port));
+    std::string reply("\x05\x00\x00\x01\x7f\x00\x00\x01", 8);
+    reply.push_back(static_cast<char>(port >> 8));
+    reply.push_back(static_cast<char>(port & 0xff));
+    if (SendAll(fd, reply.data(), reply.size())) {
+      char buffer[2048];
+      pollfd fds[2] = {{fd, POLLIN, 0}, {relay, POLLIN, 0}};
+      while (poll(fds, 2, -1) > 0 && fds[0].revents == 0) {
+        sockaddr_storage from = {};
+        socklen_t length = sizeof(from);
+        ssize_t received = recvfrom(relay, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &length);
+        if (received > 0) {
+          echoed_++;
+          sendto(relay, buffer, static_cast<size_t>(received), 0, reinterpret_cast<sockaddr*>(&from), length);
+        }
+      }
+    }
+    Close(relay);
+  }
+
+  EventLoop loop_;
+  std::unique_ptr<SpeedTester> tester_ = std::make_unique<SpeedTester>(&loop_);
+
+  std::mutex sockets_mutex_;
+  std::set<int> sockets_;
+  std::vector<std::thread> threads_;
+  bool stopping_ = false;
+  std::atomic<int> refused_{0};
+  std::atomic<int> proxy_connections_{0};
+  std::atomic<uint64_t> uploaded_{0};
+  std::atomic<uint64_t> echoed_{0};
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool done_ = false;
+  int progress_ = 0;
+  std::vector<SpeedTestResult> results_;
+  std::string error_;
+};
+
+TEST_F(SpeedTesterTest, MeasuresDownloadAndUploadThroughTheProxy) {
+  uint16_t server = StartServer(ServerMode::kKeepAlive);
+  SpeedTestOptions options = Options(StartProxy());
+  options.download_url = Url(server, "/download");
+  options.upload_url = Url(server, "/upload");
+  Run(options);
+
+  EXPECT_EQ(error_, "");
+  EXPECT_GT(progress_, 0);
+  ASSERT_EQ(results_.size(), 2u);
+  const SpeedTestResult& download = results_[0];
+  EXPECT_EQ(download.phase, SpeedTestPhase::kDownload);
+  EXPECT_GE(download.bytes, kDownloadSize);
+  EXPECT_GT(download.goodput_bps, 0);
+  EXPECT_GT(download.rtt_samples, 0u);
+  EXPECT_GE(download.rtt_p99_us, download.rtt_p50_us);
+  EXPECT_EQ(download.failed_streams, 0u);
+
+  const SpeedTestResult& upload = results_[1];
+  EXPECT_EQ(upload.phase, SpeedTestPhase::kUpload);
+  EXPECT_GE(upload.bytes, options.upload_size);
+  EXPECT_GT(upload.goodput_bps, 0);
+  EXPECT_EQ(upload.rtt_samples, 0u);
+  EXPECT_EQ(upload.failed_streams, 0u);
+  EXPECT_GT(uploaded_, 0u);
+  // Kept-alive streams never needed replacing.
+  EXPECT_EQ(proxy_connections_, 4);
+}
+
+TEST_F(SpeedTesterTest, ReplacesAConnectionTheServerEnds) {
+  uint16_t server = StartServer(ServerMode::kCloseAfterEach);
+  SpeedTestOptions options = Options(StartProxy());
+  options.download_url = Url(server, "/download");
+  Run(options);
+
+  EXPECT_EQ(error_, "");
+  ASSERT_EQ(results_.size(), 1u);
+  EXPECT_GE(results_[0].bytes, 2 * kDownloadSize);
+  EXPECT_EQ(results_[0].failed_streams, 0u);
+  EXPECT_GT(proxy_connections_, 2);
+}
+
+TEST_F(SpeedTesterTest, BouncesDatagramsOffTheUdpRelay) {
+  SpeedTestOptions options = Options(StartProxy());
+  options.udp_echo_host = "127.0.0.1";
+  options.udp_echo_port = 7;
+  Run(options);
+
+  EXPECT_EQ(error_, "");
+  ASSERT_EQ(results_.size(), 1u);
+  const SpeedTestResult& udp = results_[0];
+  EXPECT_EQ(udp.phase, SpeedTestPhase::kUdp);
+  EXPECT_GT(udp.datagrams_sent, SpeedTestUdpFlow::kWindow);
+  EXPECT_EQ(udp.datagrams_lost, 0u);
+  EXPECT_GT(udp.rtt_samples, 0u);
+  EXPECT_GE(udp.jitter_us, 0);
+  EXPECT_GT(echoed_, 0u);
+  // One association held for the whole phase.
+  EXPECT_EQ(proxy_connections_, 1);
+}
+
+TEST_F(SpeedTesterTest, CancelStopsEarlyWithoutTheRunningPhase) {
+  uint16_t server = StartServer(ServerMode::kKeepAlive);
+  SpeedTestOptions options = Options(StartProxy());
+  options.download_url = Url(server, "/download");
+  options.upload_url = Url(server, "/upload");
+  options.phase_duration = 30s;
+  auto begin = std::chrono::steady_clock::now();
+  Run(options, 300ms);
+
+  EXPECT_EQ(error_, "Cancelled.");
+  EXPECT_TRUE(results_.empty());
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, 5s);
+
+  // The tester is free for the next run.
+  done_ = false;
+  options.phase_duration = 300ms;
+  options.upload_url = HttpUrl();
+  Run(options);
+  EXPECT_EQ(error_, "");
+  EXPECT_EQ(results_.size(), 1u);
+}
+
+TEST_F(SpeedTesterTest, RefusesASecondTestWhileOneRuns) {
+  uint16_t server = StartServer(ServerMode::kKeepAlive);
+  SpeedTestOptions options = Options(StartProxy());
+  options.download_url = Url(server, "/download");
+  options.phase_duration = 300ms;
+  ASSERT_TRUE(tester_->Start(options, nullptr, [](const std::vector<SpeedTestResult>&, const std::string&) {}));
+  EXPECT_FALSE(tester_->Start(options, nullptr, [](const std::vector<SpeedTestResult>&, const std::string&) {}));
+  tester_->Cancel();
+}
+
+TEST_F(SpeedTesterTest, CountsARefusedStreamWithoutReplacingIt) {
+  uint16_t server = StartServer(ServerMode::kKeepAlive);
+  SpeedTestOptions options = Options(StartProxy(1));
+  options.download_url = Url(server, "/download");
+  Run(options);
+
+  EXPECT_EQ(error_, "");
+  ASSERT_EQ(results_.size(), 1u);
+  EXPECT_EQ(results_[0].failed_streams, 1u);
+  EXPECT_GE(results_[0].bytes, kDownloadSize);
+  EXPECT_EQ(proxy_connections_, 2);
+}
+
+TEST_F(SpeedTesterTest, StopsWhenEveryStreamIsRefused) {
+  uint16_t server = StartServer(ServerMode::kKeepAlive);
+  SpeedTestOptions options = Options(StartProxy(2));
+  options.download_url = Url(server, "/download");
+  options.upload_url = Url(server, "/upload");
+  options.phase_duration = 5s;
+  auto begin = std::chrono::steady_clock::now();
+  Run(options);
+
+  EXPECT_EQ(error_, "The proxy could not connect: connection refused.");
+  // The upload phase never ran, and the download one ended with its last
+  // stream rather than at its deadline.
+  ASSERT_EQ(results_.size(), 1u);
+  EXPECT_EQ(results_[0].bytes, 0u);
+  EXPECT_EQ(results_[0].failed_streams, 2u);
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, 2s);
+}
+
+TEST_F(SpeedTesterTest, FailsAResponseCutShort) {
+  uint16_t server = StartServer(ServerMode::kCutShort);
+  SpeedTestOptions options = Options(StartProxy());
+  options.download_url = Url(server, "/download");
+  Run(options);
+
+  ASSERT_EQ(results_.size(), 1u);
+  EXPECT_EQ(results_[0].failed_streams, 2u);
+  // The partial bodies still count.
+  EXPECT_EQ(results_[0].bytes, 2000u);
+  EXPECT_EQ(error_, "");
+}
+
+TEST_F(SpeedTesterTest, FailsWithoutAProxy) {
+  uint16_t port;
+  close(BindLoopback(SOCK_STREAM, &port));
+  SpeedTestOptions options = Options(port);
+  options.download_url = Url(port, "/download");
+  Run(options);
+
+  EXPECT_EQ(error_, "Could not reach the mixed inbound at 127.0.0.1:" + std::to_string(port) + ".");
+  ASSERT_EQ(results_.size(), 1u);
+  EXPECT_EQ(results_[0].failed_streams, 2u);
+}
+
+}  // namespace
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Runs SplitTunnelNetnsTest from the test binary $1 in a network namespace
+# of its own: a tap "eth9" with the default route, a "tun0" standing in for
+# sing-box's TUN with its table 2022 and rule, and a stub nft that logs the
+# scripts it is fed. Needs root; exits 77, which ctest counts as skipped,
+# without it.
+set -eu
+tests=$1
+
+[ "$(id -u)" = 0 ] || { echo "Needs root."; exit 77; }
+for tool in unshare ip; do
+  command -v "$tool" >/dev/null || { echo "Needs $tool."; exit 77; }
+done
+[ -c /dev/net/tun ] || { echo "Needs /dev/net/tun."; exit 77; }
+unshare --net true 2>/dev/null || { echo "Cannot create a network namespace."; exit 77; }
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/bin"
+cat > "$work/bin/nft" <<'NFT'
+#!/bin/sh
+cat >> "$HWL_SPLIT_NETNS_DIR/nft.log"
+echo --- >> "$HWL_SPLIT_NETNS_DIR/nft.log"
+NFT
+chmod +x "$work/bin/nft"
+cp "$(command -v sleep)" "$work/hwl-split-app"
+
+HWL_SPLIT_NETNS_DIR=$work PATH="$work/bin:$PATH" unshare --net sh -euc '
+  ip link set lo up
+  ip tuntap add eth9 mode tap
+  ip link set eth9 up
+  ip addr add 192.168.50.2/24 dev eth9
+  ip route add default via 192.168.50.1 dev eth9 onlink
+  ip tuntap add tun0 mode tun
+  ip link set tun0 up
+  ip addr add 172.20.10.1/24 dev tun0
+  ip route add default dev tun0 table 2022
+  ip rule add pref 9000 lookup 2022
+  exec "$0" --gtest_filter="SplitTunnelNetnsTest.*"
+' "$tests"
@@ -0,0 +1,245 @@
+#include "split_tunnel.h"
+
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "event_loop.h"
+
+extern char** environ;
+
+namespace {
+
+using std::chrono::milliseconds;
+
+const char kSplitCgroup[] = "user.slice/user-1000.slice/user@1000.service/app.slice/backup.service/hwl-vpn-split";
+
+TEST(SplitTunnelTest, ParsesTheMode) {
+  EXPECT_EQ(ParseSplitTunnelMode(true, "all_except", 1), SplitTunnelMode::kExclude);
+  EXPECT_EQ(ParseSplitTunnelMode(true, "only_selected", 2), SplitTunnelMode::kInclude);
+  EXPECT_EQ(ParseSplitTunnelMode(true, "only_selected", 0), SplitTunnelMode::kOff);
+  EXPECT_EQ(ParseSplitTunnelMode(false, "all_except", 1), SplitTunnelMode::kOff);
+  EXPECT_EQ(ParseSplitTunnelMode(true, "everything", 1), SplitTunnelMode::kOff);
+}
+
+TEST(SplitTunnelTest, MatchesApps) {
+  EXPECT_TRUE(MatchesSplitTunnelApp({"apt"}, "/usr/bin/apt", ""));
+  // Replaced by an upgrade while running.
+  EXPECT_TRUE(MatchesSplitTunnelApp({"apt"}, "/usr/bin/apt (deleted)", ""));
+  EXPECT_TRUE(MatchesSplitTunnelApp({"/usr/bin/restic"}, "/usr/bin/restic", ""));
+  EXPECT_FALSE(MatchesSplitTunnelApp({"/usr/bin/restic"}, "/opt/restic/restic", ""));
+  EXPECT_FALSE(MatchesSplitTunnelApp({"apt"}, "/usr/bin/apt-get", ""));
+  EXPECT_FALSE(MatchesSplitTunnelApp({"", "git"}, "/usr/bin/ssh", "git"));
+  // Only without an executable does the truncated comm count.
+  EXPECT_TRUE(MatchesSplitTunnelApp({"unattended-upgrade"}, "", "unattended-upgr"));
+  EXPECT_TRUE(MatchesSplitTunnelApp({"/usr/bin/unattended-upgrade"}, "", "unattended-upgr"));
+  EXPECT_FALSE(MatchesSplitTunnelApp({"unattended-upgrade"}, "/usr/bin/python3", "unattended-upgr"));
+  EXPECT_FALSE(MatchesSplitTunnelApp({"apt"}, "", ""));
+}
+
+TEST(SplitTunnelTest, AcceptsOnlyPlainCgroupPaths) {
+  EXPECT_TRUE(IsSafeCgroupPath(kSplitCgroup));
+  EXPECT_TRUE(IsSafeCgroupPath("hwl-vpn-split"));
+  EXPECT_TRUE(IsSafeCgroupPath("system.slice/run-r1a2b3:4_5+6,7=8.scope/hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath(""));
+  EXPECT_FALSE(IsSafeCgroupPath("/hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath("a//hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath("a/../hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath("./hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath("app-a\" accept; }\ntable inet x { #/hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath("app-flatpak-org.example\\x2dapp.scope/hwl-vpn-split"));
+  EXPECT_FALSE(IsSafeCgroupPath("my app.scope/hwl-vpn-split"));
+}
+
+TEST(SplitTunnelTest, BuildsTheExcludeRuleset) {
+  EXPECT_EQ(BuildSplitTunnelRuleset(SplitTunnelMode::kExclude, {kSplitCgroup}),
+            "add table inet hwl_vpn_split\n"
+            "delete table inet hwl_vpn_split\n"
+            "table inet hwl_vpn_split {\n"
+            "  chain output {\n"
+            "    type route hook output priority mangle; policy accept;\n"
+            "    socket cgroupv2 level 6 \"" + std::string(kSplitCgroup) +
+                "\" meta mark set 0x4857 ct mark set meta mark\n"
+            "  }\n"
+            "  chain prerouting {\n"
+            "    type filter hook prerouting priority mangle; policy accept;\n"
+            "    ct mark 0x4857 meta mark set ct mark\n"
+            "  }\n"
+            "  chain postrouting {\n"
+            "    type nat hook postrouting priority srcnat; policy accept;\n"
+            "    meta mark 0x4857 ip saddr 172.20.10.0/24 masquerade\n"
+            "  }\n"
+            "}\n");
+}
+
+TEST(SplitTunnelTest, BuildsTheIncludeRulesetWithoutMasquerading) {
+  std::string script = BuildSplitTunnelRuleset(SplitTunnelMode::kInclude, {"hwl-vpn-split", "a/hwl-vpn-split"});
+  EXPECT_NE(script.find("socket cgroupv2 level 1 \"hwl-vpn-split\""), std::string::npos);
+  EXPECT_NE(script.find("socket cgroupv2 level 2 \"a/hwl-vpn-split\""), std::string::npos);
+  EXPECT_EQ(script.find("postrouting"), std::string::npos);
+}
+
+TEST(SplitTunnelTest, LeavesUnsafeCgroupsOutOfTheRuleset) {
+  std::string evil = "a\" accept; }\ntable inet evil { chain x {/hwl-vpn-split";
+  std::string script = BuildSplitTunnelRuleset(SplitTunnelMode::kExclude, {evil, "b/hwl-vpn-split"});
+  EXPECT_EQ(script.find("evil"), std::string::npos);
+  EXPECT_NE(script.find("\"b/hwl-vpn-split\""), std::string::npos);
+  EXPECT_EQ(script, BuildSplitTunnelRuleset(SplitTunnelMode::kExclude, {"b/hwl-vpn-split"}));
+}
+
+// Runs only inside split_tunnel_netns.sh, which provides a network
+// namespace with a TUN and sing-box's routing rule, a stub nft logging its
+// scripts to $HWL_SPLIT_NETNS_DIR/nft.log and a copy of sleep named
+// hwl-split-app there.
+class SplitTunnelNetnsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const char* directory = std::getenv("HWL_SPLIT_NETNS_DIR");
+    if (directory == nullptr) {
+      GTEST_SKIP() << "Run through split_tunnel_netns.sh.";
+    }
+    directory_ = directory;
+    ASSERT_TRUE(loop_.Start());
+    split_ = std::make_unique<SplitTunnel>(&loop_);
+  }
+
+  void TearDown() override {
+    split_.reset();
+    for (pid_t pid : apps_) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+    loop_.Stop();
+  }
+
+  pid_t SpawnApp() {
+    std::string path = directory_ + "/hwl-split-app";
+    char* argv[] = {const_cast<char*>(path.c_str()), const_cast<char*>("60"), nullptr};
+    pid_t pid = -1;
+    EXPECT_EQ(posix_spawn(&pid, path.c_str(), nullptr, nullptr, argv, environ), 0);
+    apps_.push_back(pid);
+    // Past the exec.
+    for (int i = 0; i < 100 && ExeOf(pid) != path; i++) {
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+    return pid;
+  }
+
+  static std::string ExeOf(pid_t pid) {
+    char exe[4096];
+    ssize_t length = readlink(("/proc/" + std::to_string(pid) + "/exe").c_str(), exe, sizeof(exe));
+    return length > 0 ? std::string(exe, static_cast<size_t>(length)) : std::string();
+  }
+
+  static std::string CgroupOf(pid_t pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+    std::string line;
+    while (std::getline(file, line)) {
+      if (line.rfind("0::", 0) == 0) {
+        return line.substr(3);
+      }
+    }
+    return std::string();
+  }
+
+  static std::string Run(const char* command) {
+    std::string output;
+    FILE* pipe = popen(command, "r");
+    char buffer[1024];
+    size_t count;
+    while (pipe != nullptr && (count = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+      output.append(buffer, count);
+    }
+    if (pipe != nullptr) {
+      pclose(pipe);
+    }
+    return output;
+  }
+
+  std::string NftLog() {
+    std::ifstream file(directory_ + "/nft.log");
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }
+
+  bool Apply(uid_t owner, std::string* error) {
+    SplitTunnelSettings settings;
+    settings.mode = SplitTunnelMode::kExclude;
+    settings.apps = {"hwl-split-app"};
+    settings.owner = owner;
+    bool applied = false;
+    loop_.RunSync([&]() { applied = split_->Apply(settings, error); });
+    return applied;
+  }
+
+  std::string directory_;
+  EventLoop loop_;
+  std::unique_ptr<SplitTunnel> split_;
+  std::vector<pid_t> apps_;
+};
+
+TEST_F(SplitTunnelNetnsTest, MovesListedAppsAndRestoresThem) {
+  pid_t running = SpawnApp();
+  std::string original = CgroupOf(running);
+  std::string error;
+  bool applied = Apply(getuid(), &error);
+  if (error == "cgroup v2 is not mounted.") {
+    GTEST_SKIP() << error;
+  }
+  ASSERT_TRUE(applied) << error;
+
+  std::string split = (original == "/" ? "" : original) + "/hwl-vpn-split";
+  EXPECT_EQ(CgroupOf(running), split);
+  EXPECT_NE(NftLog().find("socket cgroupv2 level"), std::string::npos);
+  EXPECT_NE(NftLog().find("\"" + split.substr(1) + "\""), std::string::npos);
+  std::string rules = Run("ip rule");
+  EXPECT_NE(rules.find("8900:"), std::string::npos) << rules;
+  EXPECT_NE(rules.find("fwmark 0x4857"), std::string::npos) << rules;
+  // Marked traffic leaves through the physical interface, the rest
+  // through the TUN.
+  EXPECT_NE(Run("ip route get 8.8.8.8 mark 0x4857").find("dev eth9"), std::string::npos);
+  EXPECT_NE(Run("ip route get 8.8.8.8").find("dev tun0"), std::string::npos);
+
+  // Started later, caught from exec events or the rescan.
+  pid_t later = SpawnApp();
+  for (int i = 0; i < 400 && CgroupOf(later) != split; i++) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  EXPECT_EQ(CgroupOf(later), split);
+
+  loop_.RunSync([&]() { split_->Clear(); });
+  EXPECT_EQ(CgroupOf(running), original);
+  EXPECT_EQ(CgroupOf(later), original);
+  EXPECT_EQ(Run("ip rule").find("8900:"), std::string::npos);
+  struct stat info;
+  for (const char* root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+    EXPECT_NE(stat((root + split).c_str(), &info), 0) << root << split;
+  }
+}
+
+TEST_F(SplitTunnelNetnsTest, LeavesOtherUsersProcessesAlone) {
+  pid_t running = SpawnApp();
+  std::string original = CgroupOf(running);
+  std::string error;
+  bool applied = Apply(getuid() + 1, &error);
+  if (error == "cgroup v2 is not mounted.") {
+    GTEST_SKIP() << error;
+  }
+  ASSERT_TRUE(applied) << error;
+  EXPECT_EQ(CgroupOf(running), original);
+  size_t moved = 1;
+  loop_.RunSync([&]() { moved = split_->moved_count(); });
+  EXPECT_EQ(moved, 0u);
+}
+
+}  // namespace
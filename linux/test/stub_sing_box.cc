@@ -0,0 +1,229 @@
+// A stand-in for sing-box that ProcessManager spawns from the test binary's
+// directory. It understands the two commands the runner uses:
+//
+//   sing-box check -c stdin|<path>   passes unless the config contains "bad"
+//   sing-box run -c stdin|<path>     serves the config's Clash API and waits
+//
+// Like sing-box, "run" logs "sing-box started" only at the info level or
+// below, and on SIGHUP re-reads a config file, closes the Clash API with
+// every connection to it and opens the new config's API after a while.
+//
+// HWL_STUB_CONTROL names a file the running stub polls, so a test can make
+// it misbehave on demand:
+//
+//   early   exit with code 3 before starting
+//   crash   exit with code 2 once, removing the file
+//   loop    exit with code 2 shortly after every start
+//
+// HWL_STUB_STARTUP_MS delays every command before it reads its config, as
+// the Go runtime and sing-box's own initialisation do.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "clash_api.h"
+
+namespace {
+
+// How long a reload takes between closing the old API and opening the new.
+constexpr int kReloadMs = 150;
+
+volatile sig_atomic_t reload_requested = 0;
+
+std::string ReadAll(std::istream& in) {
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+std::string ReadConfig(const std::string& path) {
+  if (path == "stdin") {
+    return ReadAll(std::cin);
+  }
+  std::ifstream in(path, std::ios::binary);
+  return ReadAll(in);
+}
+
+std::string ReadControl() {
+  const char* path = std::getenv("HWL_STUB_CONTROL");
+  if (!path) {
+    return std::string();
+  }
+  std::ifstream in(path);
+  std::string command;
+  in >> command;
+  return command;
+}
+
+// sing-box logs at the info level unless the config asks for less.
+bool LogsInfo(const std::string& config) {
+  for (const char* level : {"warn", "error", "fatal", "panic"}) {
+    if (config.find(std::string("\"level\":\"") + level + "\"") != std::string::npos) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A Clash API that answers every request with an empty object, or with a
+// 401 and an error line when the config has a secret the request lacks.
+class ClashApi {
+ public:
+  ~ClashApi() { Close(); }
+
+  void Open(uint16_t port, const std::string& secret) {
+    if (port == 0) {
+      return;
+    }
+    authorization_ = secret.empty() ? std::string() : "Authorization: Bearer " + secret + "\r\n";
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd_, 16) != 0) {
+      std::cout << "FATAL[0000] start service: listen 127.0.0.1:" << port << std::endl;
+      std::exit(1);
+    }
+  }
+
+  void Close() {
+    for (int fd : connections_) {
+      close(fd);
+    }
+    connections_.clear();
+    if (listen_fd_ >= 0) {
+      close(listen_fd_);
+      listen_fd_ = -1;
+    }
+  }
+
+  // Serves for up to |timeout_ms|.
+  void Poll(int timeout_ms) {
+    std::vector<pollfd> fds;
+    if (listen_fd_ >= 0) {
+      fds.push_back({listen_fd_, POLLIN, 0});
+    }
+    for (int fd : connections_) {
+      fds.push_back({fd, POLLIN, 0});
+    }
+    if (poll(fds.data(), fds.size(), timeout_ms) <= 0) {
+      return;
+    }
+    for (const pollfd& entry : fds) {
+      if (entry.revents == 0) {
+        continue;
+      }
+      if (entry.fd == listen_fd_) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) {
+          connections_.push_back(fd);
+        }
+        continue;
+      }
+      // Any request gets the answer; the connection stays open until the
+      // client or a reload closes it, as with Go's keep-alive.
+      char buffer[1024];
+      ssize_t bytes_read = read(entry.fd, buffer, sizeof(buffer));
+      if (bytes_read > 0) {
+        static const char kAnswer[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n{}";
+        static const char kUnauthorized[] = "HTTP/1.1 401 Unauthorized\r\nContent-Length: 2\r\n\r\n{}";
+        if (!authorization_.empty() &&
+            std::string_view(buffer, static_cast<size_t>(bytes_read)).find(authorization_) == std::string_view::npos) {
+          std::cout << "ERROR[0000] clash api: unauthorized request" << std::endl;
+          (void)!write(entry.fd, kUnauthorized, sizeof(kUnauthorized) - 1);
+          continue;
+        }
+        (void)!write(entry.fd, kAnswer, sizeof(kAnswer) - 1);
+        continue;
+      }
+      close(entry.fd);
+      for (size_t i = 0; i < connections_.size(); i++) {
+        if (connections_[i] == entry.fd) {
+          connections_.erase(connections_.begin() + i);
+          break;
+        }
+      }
+    }
+  }
+
+ private:
+  int listen_fd_ = -1;
+  std::vector<int> connections_;
+  // The header every request must carry, or empty.
+  std::string authorization_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string command = argc > 1 ? argv[1] : "";
+  std::string path = argc > 3 && std::string(argv[2]) == "-c" ? argv[3] : "stdin";
+  if (const char* startup_ms = std::getenv("HWL_STUB_STARTUP_MS")) {
+    usleep(static_cast<useconds_t>(std::atoi(startup_ms)) * 1000);
+  }
+  std::string config = ReadConfig(path);
+  if (command == "check") {
+    if (config.find("bad") != std::string::npos) {
+      std::cout << "FATAL[0000] decode config: bad value" << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  if (command != "run") {
+    return 1;
+  }
+
+  if (ReadControl() == "early") {
+    return 3;
+  }
+  struct sigaction action = {};
+  action.sa_handler = [](int) { reload_requested = 1; };
+  sigaction(SIGHUP, &action, nullptr);
+
+  ClashApi api;
+  api.Open(FindClashApiPort(config), FindClashApiSecret(config));
+  if (LogsInfo(config)) {
+    std::cout << "INFO[0000] config: " << config.size() << " bytes from " << path << std::endl;
+    std::cout << "INFO[0000] sing-box started (0.01s)" << std::endl;
+  }
+  for (int polls = 0;; polls++) {
+    std::string control = ReadControl();
+    if (control == "crash") {
+      std::remove(std::getenv("HWL_STUB_CONTROL"));
+      return 2;
+    }
+    if (control == "loop" && polls >= 2) {
+      return 2;
+    }
+    if (reload_requested) {
+      reload_requested = 0;
+      std::string next = path == "stdin" ? config : ReadConfig(path);
+      if (next.find("bad") != std::string::npos) {
+        std::cout << "ERROR[0000] reload service: bad value" << std::endl;
+        continue;
+      }
+      config = next;
+      api.Close();
+      usleep(kReloadMs * 1000);
+      api.Open(FindClashApiPort(config), FindClashApiSecret(config));
+      if (LogsInfo(config)) {
+        std::cout << "INFO[0000] config: " << config.size() << " bytes from " << path << std::endl;
+        std::cout << "INFO[0000] sing-box started (0.15s)" << std::endl;
+      }
+    }
+    api.Poll(20);
+  }
+}
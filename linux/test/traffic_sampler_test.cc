@@ -0,0 +1,322 @@
+#include "traffic_sampler.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+constexpr char kSecret[] = "0123456789abcdef0123456789abcdef";
+
+bool SendAll(int fd, const std::string& data) {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    ssize_t sent = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    offset += static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+std::string Chunk(const std::string& line) {
+  char size[16];
+  snprintf(size, sizeof(size), "%zx", line.size());
+  return size + std::string("\r\n") + line + "\r\n";
+}
+
+// Runs TrafficSampler against a mock of sing-box's Clash API on a loopback
+// port. /traffic streams one chunked document every kTick, up, down =
+// (i, 1000 * i) counting from 1 on each connection; /connections answers
+// with |open_connections_| entries. Requests without the bearer token get
+// a 401, as sing-box gives them.
+class TrafficSamplerTest : public ::testing::Test {
+ protected:
+  static constexpr std::chrono::milliseconds kTick{50};
+
+  void SetUp() override {
+    ASSERT_TRUE(loop_.Start());
+    listen_fd_ = Track(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    ASSERT_EQ(bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_EQ(getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length), 0);
+    ASSERT_EQ(listen(listen_fd_, 16), 0);
+    port_ = ntohs(address.sin_port);
+    Spawn([this]() { AcceptLoop(); });
+  }
+
+  void TearDown() override {
+    sampler_.reset();
+    loop_.Stop();
+    {
+      std::lock_guard<std::mutex> lock(server_mutex_);
+      stopping_ = true;
+      for (int fd : sockets_) {
+        shutdown(fd, SHUT_RDWR);
+      }
+    }
+    for (;;) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(server_mutex_);
+        threads.swap(threads_);
+      }
+      if (threads.empty()) {
+        break;
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+    }
+    for (int fd : sockets_) {
+      close(fd);
+    }
+  }
+
+  void Start(const std::string& secret) {
+    loop_.RunSync([this, &secret]() {
+      sampler_->Start(port_, secret, [this](const TrafficDelta& delta) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        deltas_.push_back(delta);
+        changed_.notify_all();
+      });
+    });
+  }
+
+  // Waits until |count| samples have arrived.
+  bool WaitForSamples(size_t count, std::chrono::milliseconds timeout = 5s) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, timeout, [&]() { return deltas_.size() >= count; });
+  }
+
+  std::vector<TrafficDelta> deltas() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return deltas_;
+  }
+
+  int Track(int fd) {
+    std::lock_guard<std::mutex> lock(server_mutex_);
+    sockets_.insert(fd);
+    if (stopping_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    return fd;
+  }
+
+  void Spawn(std::function<void()> body) {
+    std::lock_guard<std::mutex> lock(server_mutex_);
+    threads_.emplace_back(std::move(body));
+  }
+
+  void AcceptLoop() {
+    for (;;) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      Track(fd);
+      Spawn([this, fd]() {
+        Serve(fd);
+        std::lock_guard<std::mutex> lock(server_mutex_);
+        sockets_.erase(fd);
+        close(fd);
+      });
+    }
+  }
+
+  void Serve(int fd) {
+    std::string in;
+    char buffer[4096];
+    for (;;) {
+      size_t head_end;
+      while ((head_end = in.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+          return;
+        }
+        in.append(buffer, static_cast<size_t>(received));
+      }
+      std::string head = in.substr(0, head_end + 4);
+      in.erase(0, head_end + 4);
+      if (head.find("Authorization: Bearer " + std::string(kSecret) + "\r\n") == std::string::npos) {
+        unauthorized_++;
+        SendAll(fd, "HTTP/1.1 401 Unauthorized\r\nContent-Type: application/json\r\nContent-Length: 27\r\n\r\n"
+                    "{\"message\":\"Unauthorized\"}\n");
+        return;
+      }
+      if (head.compare(0, 13, "GET /traffic ") == 0) {
+        traffic_requests_++;
+        StreamTraffic(fd);
+        return;
+      }
+      if (head.compare(0, 17, "GET /connections ") != 0) {
+        return;
+      }
+      connections_requests_++;
+      std::string body = "{\"downloadTotal\":0,\"uploadTotal\":0,\"connections\":[";
+      for (int i = 0; i < open_connections_; i++) {
+        body += i == 0 ? "" : ",";
+        body += "{\"id\":\"00000000-0000-0000-0000-00000000000" + std::to_string(i) +
+                "\",\"upload\":1,\"download\":2,\"start\":\"2024-01-01T00:00:00Z\","
+                "\"metadata\":{\"network\":\"tcp\",\"host\":\"example.com\"},\"chains\":[\"direct\"]}";
+      }
+      body += "]}\n";
+      if (!SendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\n\r\n" + body)) {
+        return;
+      }
+    }
+  }
+
+  void StreamTraffic(int fd) {
+    if (!SendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n")) {
+      return;
+    }
+    int64_t documents = traffic_documents_;
+    for (uint64_t i = 1; documents < 0 || static_cast<int64_t>(i) <= documents; i++) {
+      std::this_thread::sleep_for(kTick);
+      if (!SendAll(fd, Chunk("{\"up\":" + std::to_string(i) + ",\"down\":" + std::to_string(i * 1000) + "}\n"))) {
+        return;
+      }
+    }
+  }
+
+  EventLoop loop_;
+  std::unique_ptr<TrafficSampler> sampler_ = std::make_unique<TrafficSampler>(&loop_);
+  int listen_fd_ = -1;
+  uint16_t port_ = 0;
+
+  std::mutex server_mutex_;
+  std::set<int> sockets_;
+  std::vector<std::thread> threads_;
+  bool stopping_ = false;
+  // Documents per /traffic response before the API drops it, read as the
+  // response starts; -1 for no end.
+  std::atomic<int64_t> traffic_documents_{-1};
+  std::atomic<int> open_connections_{2};
+  std::atomic<int> traffic_requests_{0};
+  std::atomic<int> connections_requests_{0};
+  std::atomic<int> unauthorized_{0};
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<TrafficDelta> deltas_;
+};
+
+TEST_F(TrafficSamplerTest, SamplesEachSecondWithTheConnectionCount) {
+  Start(kSecret);
+  ASSERT_TRUE(WaitForSamples(4));
+
+  std::vector<TrafficDelta> received = deltas();
+  EXPECT_TRUE(received[0].key);
+  EXPECT_EQ(received[0].sequence, 1u);
+  EXPECT_EQ(received[0].up, 1);
+  EXPECT_EQ(received[0].down, 1000);
+  for (size_t i = 1; i < received.size(); i++) {
+    EXPECT_FALSE(received[i].key);
+    EXPECT_EQ(received[i].sequence, i + 1);
+    EXPECT_EQ(received[i].up, 1);
+    EXPECT_EQ(received[i].down, 1000);
+  }
+
+  // A /connections request follows each document; by the later seconds the
+  // snapshot has landed.
+  uint64_t sequence = 0;
+  std::vector<TrafficSample> history = sampler_->History(&sequence);
+  ASSERT_GE(history.size(), 4u);
+  EXPECT_EQ(sequence, history.size());
+  EXPECT_EQ(history[0].up, 1u);
+  EXPECT_EQ(history[3].down, 4000u);
+  EXPECT_EQ(history.back().connections, 2u);
+  EXPECT_GE(connections_requests_, 3);
+  EXPECT_EQ(traffic_requests_, 1);
+  EXPECT_EQ(unauthorized_, 0);
+}
+
+TEST_F(TrafficSamplerTest, ReconnectsWhenTheApiDropsTheStream) {
+  traffic_documents_ = 2;
+  Start(kSecret);
+  ASSERT_TRUE(WaitForSamples(2));
+  traffic_documents_ = -1;
+  // Reconnected after the retry interval; the history carries on.
+  ASSERT_TRUE(WaitForSamples(3, 3s));
+  EXPECT_EQ(traffic_requests_, 2);
+  EXPECT_EQ(deltas()[2].sequence, 3u);
+  uint64_t sequence = 0;
+  EXPECT_GE(sampler_->History(&sequence).size(), 3u);
+}
+
+TEST_F(TrafficSamplerTest, GetsNoSamplesWithTheWrongSecret) {
+  Start("wrong");
+  EXPECT_FALSE(WaitForSamples(1, 500ms));
+  EXPECT_GE(unauthorized_, 1);
+  EXPECT_EQ(traffic_requests_, 0);
+}
+
+TEST_F(TrafficSamplerTest, StopKeepsTheHistory) {
+  Start(kSecret);
+  ASSERT_TRUE(WaitForSamples(2));
+  loop_.RunSync([this]() { sampler_->Stop(); });
+  size_t stopped_at = deltas().size();
+  std::this_thread::sleep_for(4 * kTick);
+  EXPECT_EQ(deltas().size(), stopped_at);
+  uint64_t sequence = 0;
+  EXPECT_EQ(sampler_->History(&sequence).size(), stopped_at);
+  EXPECT_EQ(sequence, stopped_at);
+
+  // A new start is a new sing-box, with a history of its own.
+  Start(kSecret);
+  ASSERT_TRUE(WaitForSamples(stopped_at + 1));
+  EXPECT_TRUE(deltas()[stopped_at].key);
+  EXPECT_EQ(deltas()[stopped_at].sequence, 1u);
+}
+
+TEST_F(TrafficSamplerTest, DiffsTheTrackedConnections) {
+  std::vector<ConnectionDiff> diffs;
+  loop_.RunSync([this, &diffs]() {
+    sampler_->TrackConnections([this, &diffs](const ConnectionDiff& diff) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      diffs.push_back(diff);
+      changed_.notify_all();
+    });
+  });
+  Start(kSecret);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ASSERT_TRUE(changed_.wait_for(lock, 5s, [&]() { return !diffs.empty(); }));
+    EXPECT_TRUE(diffs[0].reset);
+    EXPECT_EQ(diffs[0].total, 2u);
+    ASSERT_EQ(diffs[0].opened.size(), 2u);
+    EXPECT_EQ(diffs[0].opened[0].host, "example.com");
+  }
+
+  // Stopping the tunnel closes them all.
+  open_connections_ = 0;
+  loop_.RunSync([this]() {
+    sampler_->Stop();
+    sampler_->TrackConnections(nullptr);
+  });
+  std::lock_guard<std::mutex> lock(mutex_);
+  EXPECT_TRUE(diffs.back().reset);
+  EXPECT_EQ(diffs.back().total, 0u);
+}
+
+}  // namespace
@@ -0,0 +1,437 @@
+#include "clash_api.h"
+
+#include <algorithm>
+#include <random>
+
+namespace {
+
+// "Authorization: Bearer <secret>\r\n", or nothing without a secret.
+void AppendAuthorization(std::string_view secret, std::string* request) {
+  if (secret.empty()) {
+    return;
+  }
+  *request += "Authorization: Bearer ";
+  request->append(secret);
+  *request += "\r\n";
+}
+
+}  // namespace
+
+uint16_t FindClashApiPort(std::string_view config) {
+  constexpr std::string_view kKey = "\"external_controller\"";
+  size_t position = config.find(kKey);
+  if (position == std::string_view::npos) {
+    return 0;
+  }
+  position += kKey.size();
+  while (position < config.size() && (config[position] == ' ' || config[position] == ':' ||
+                                      config[position] == '\t' || config[position] == '\n')) {
+    position++;
+  }
+  if (position >= config.size() || config[position] != '"') {
+    return 0;
+  }
+  size_t end = config.find('"', ++position);
+  if (end == std::string_view::npos) {
+    return 0;
+  }
+  std::string_view address = config.substr(position, end - position);
+  size_t colon = address.rfind(':');
+  if (colon == std::string_view::npos) {
+    return 0;
+  }
+  std::string_view host = address.substr(0, colon);
+  if (host != "127.0.0.1" && host != "localhost") {
+    return 0;
+  }
+  uint32_t port = 0;
+  for (char c : address.substr(colon + 1)) {
+    if (c < '0' || c > '9') {
+      return 0;
+    }
+    port = port * 10 + static_cast<uint32_t>(c - '0');
+    if (port > 65535) {
+      return 0;
+    }
+  }
+  return static_cast<uint16_t>(port);
+}
+
+std::string FindClashApiSecret(std::string_view config) {
+  // The clash_api object holds no nested objects, so its secret is the one
+  // before the next closing brace.
+  size_t begin = config.find("\"clash_api\"");
+  if (begin == std::string_view::npos) {
+    return std::string();
+  }
+  size_t end = config.find('}', begin);
+  std::string_view object = config.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+  constexpr std::string_view kKey = "\"secret\"";
+  size_t position = object.find(kKey);
+  if (position == std::string_view::npos) {
+    return std::string();
+  }
+  position += kKey.size();
+  while (position < object.size() && (object[position] == ' ' || object[position] == ':' ||
+                                      object[position] == '\t' || object[position] == '\n')) {
+    position++;
+  }
+  if (position >= object.size() || object[position] != '"') {
+    return std::string();
+  }
+  size_t close = object.find('"', ++position);
+  if (close == std::string_view::npos) {
+    return std::string();
+  }
+  // Only what RandomClashApiSecret() makes is expected; anything that would
+  // need unescaping or could break the request line is ignored.
+  std::string_view secret = object.substr(position, close - position);
+  for (char c : secret) {
+    if (c == '\\' || static_cast<unsigned char>(c) < 0x20) {
+      return std::string();
+    }
+  }
+  return std::string(secret);
+}
+
+std::string RandomClashApiSecret() {
+  static const char kHex[] = "0123456789abcdef";
+  std::random_device random;
+  std::string secret;
+  for (int i = 0; i < 4; i++) {
+    uint32_t bits = random();
+    for (int j = 0; j < 8; j++) {
+      secret += kHex[(bits >> (j * 4)) & 0xf];
+    }
+  }
+  return secret;
+}
+
+std::string ClashApiProbeRequest(std::string_view secret) {
+  std::string request = "GET /version HTTP/1.0\r\nHost: 127.0.0.1\r\n";
+  AppendAuthorization(secret, &request);
+  request += "\r\n";
+  return request;
+}
+
+bool IsHttpResponse(std::string_view response) {
+  return response.size() >= 12 && response.substr(0, 7) == "HTTP/1." && response[8] == ' ';
+}
+
+namespace {
+
+// Longest status line and header block accepted, and longest chunk-size
+// or trailer line.
+constexpr size_t kMaxHeadSize = 16 * 1024;
+constexpr size_t kMaxLineSize = 1024;
+// Longest body line kept; /connections lists every open connection.
+constexpr size_t kMaxDocumentSize = 16 << 20;
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    char x = a[i] >= 'A' && a[i] <= 'Z' ? static_cast<char>(a[i] - 'A' + 'a') : a[i];
+    char y = b[i] >= 'A' && b[i] <= 'Z' ? static_cast<char>(b[i] - 'A' + 'a') : b[i];
+    if (x != y) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string_view Trim(std::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t' || value.front() == '\r')) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t' || value.back() == '\r')) {
+    value.remove_suffix(1);
+  }
+  return value;
+}
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Position just past the ':' that follows |key| in |document|, with
+// whitespace skipped, or npos.
+size_t FindValue(std::string_view document, std::string_view key) {
+  std::string quoted = "\"" + std::string(key) + "\"";
+  size_t position = document.find(quoted);
+  if (position == std::string_view::npos) {
+    return position;
+  }
+  position += quoted.size();
+  while (position < document.size() && IsSpace(document[position])) {
+    position++;
+  }
+  if (position >= document.size() || document[position] != ':') {
+    return std::string_view::npos;
+  }
+  position++;
+  while (position < document.size() && IsSpace(document[position])) {
+    position++;
+  }
+  return position;
+}
+
+bool ParseUnsigned(std::string_view document, std::string_view key, uint64_t* value) {
+  size_t position = FindValue(document, key);
+  if (position == std::string_view::npos || position >= document.size() || document[position] < '0' ||
+      document[position] > '9') {
+    return false;
+  }
+  uint64_t result = 0;
+  for (; position < document.size() && document[position] >= '0' && document[position] <= '9'; position++) {
+    result = result * 10 + static_cast<uint64_t>(document[position] - '0');
+  }
+  *value = result;
+  return true;
+}
+
+}  // namespace
+
+std::string ClashApiRequest(std::string_view path, std::string_view secret) {
+  std::string request = "GET ";
+  request.append(path);
+  request += " HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: application/json\r\n";
+  AppendAuthorization(secret, &request);
+  request += "\r\n";
+  return request;
+}
+
+bool ClashApiStream::Feed(std::string_view data, const DocumentCallback& on_document) {
+  if (state_ == State::kFailed) {
+    return false;
+  }
+  buffer_.append(data);
+  size_t consumed = 0;
+  bool ok = true;
+  while (ok && consumed < buffer_.size()) {
+    std::string_view pending(buffer_.data() + consumed, buffer_.size() - consumed);
+    if (state_ == State::kHead) {
+      size_t end = pending.find("\r\n\r\n");
+      if (end == std::string_view::npos) {
+        if (pending.size() > kMaxHeadSize) {
+          ok = Fail("The API sent an oversized response head.");
+        }
+        break;
+      }
+      consumed += end + 4;
+      ok = ParseHead(pending.substr(0, end));
+    } else if (state_ == State::kChunkSize || state_ == State::kTrailer) {
+      size_t end = pending.find("\r\n");
+      if (end == std::string_view::npos) {
+        if (pending.size() > kMaxLineSize) {
+          ok = Fail("The API sent an oversized chunk header.");
+        }
+        break;
+      }
+      std::string_view line = pending.substr(0, end);
+      consumed += end + 2;
+      if (state_ == State::kTrailer) {
+        if (line.empty()) {
+          EndBody(on_document);
+        }
+        continue;
+      }
+      line = Trim(line.substr(0, line.find(';')));
+      uint64_t size = 0;
+      for (char c : line) {
+        int digit = c >= '0' && c <= '9' ? c - '0'
+                    : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                    : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                           : -1;
+        if (digit < 0 || size > (UINT64_MAX >> 4)) {
+          size = UINT64_MAX;
+          break;
+        }
+        size = size << 4 | static_cast<uint64_t>(digit);
+      }
+      if (line.empty() || size == UINT64_MAX) {
+        ok = Fail("The API sent a malformed chunk size.");
+        break;
+      }
+      remaining_ = size;
+      state_ = size == 0 ? State::kTrailer : State::kChunkData;
+    } else if (state_ == State::kChunkEnd) {
+      if (pending.size() < 2) {
+        break;
+      }
+      if (pending.substr(0, 2) != "\r\n") {
+        ok = Fail("The API sent a malformed chunk.");
+        break;
+      }
+      consumed += 2;
+      state_ = State::kChunkSize;
+    } else {
+      // kChunkData, kLength and kUntilClose pass body bytes straight on.
+      size_t take = state_ == State::kUntilClose ? pending.size()
+                                                  : static_cast<size_t>(std::min<uint64_t>(remaining_, pending.size()));
+      AddBody(pending.substr(0, take), on_document);
+      consumed += take;
+      if (state_ == State::kUntilClose) {
+        continue;
+      }
+      remaining_ -= take;
+      if (remaining_ == 0) {
+        if (state_ == State::kChunkData) {
+          state_ = State::kChunkEnd;
+        } else {
+          EndBody(on_document);
+        }
+      }
+    }
+    if (state_ != State::kFailed && document_.size() > kMaxDocumentSize) {
+      ok = Fail("The API sent an oversized document.");
+    }
+  }
+  if (state_ == State::kFailed) {
+    return false;
+  }
+  buffer_.erase(0, consumed);
+  return ok;
+}
+
+bool ClashApiStream::OnClosed(const DocumentCallback& on_document) {
+  if (state_ != State::kUntilClose) {
+    return idle();
+  }
+  EndBody(on_document);
+  return true;
+}
+
+bool ClashApiStream::Fail(std::string error) {
+  state_ = State::kFailed;
+  error_ = std::move(error);
+  buffer_.clear();
+  document_.clear();
+  return false;
+}
+
+bool ClashApiStream::ParseHead(std::string_view head) {
+  size_t line_end = head.find("\r\n");
+  std::string_view status_line = head.substr(0, line_end);
+  if (!IsHttpResponse(status_line)) {
+    return Fail("The API did not answer with HTTP.");
+  }
+  std::string_view status = status_line.substr(9, 3);
+  if (status != "200") {
+    return Fail("The API answered " + std::string(Trim(status_line.substr(9))) + ".");
+  }
+  bool chunked = false;
+  bool has_length = false;
+  uint64_t length = 0;
+  while (line_end != std::string_view::npos) {
+    size_t start = line_end + 2;
+    line_end = head.find("\r\n", start);
+    std::string_view line = head.substr(start, line_end == std::string_view::npos ? line_end : line_end - start);
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    std::string_view name = Trim(line.substr(0, colon));
+    std::string_view value = Trim(line.substr(colon + 1));
+    if (EqualsIgnoreCase(name, "transfer-encoding")) {
+      chunked = EqualsIgnoreCase(value, "chunked");
+    } else if (EqualsIgnoreCase(name, "content-length")) {
+      has_length = !value.empty();
+      length = 0;
+      for (char c : value) {
+        if (c < '0' || c > '9') {
+          return Fail("The API sent a malformed Content-Length.");
+        }
+        length = length * 10 + static_cast<uint64_t>(c - '0');
+      }
+    }
+  }
+  if (chunked) {
+    state_ = State::kChunkSize;
+  } else if (has_length) {
+    remaining_ = length;
+    state_ = State::kLength;
+    if (length == 0) {
+      state_ = State::kHead;
+    }
+  } else {
+    state_ = State::kUntilClose;
+  }
+  return true;
+}
+
+void ClashApiStream::AddBody(std::string_view data, const DocumentCallback& on_document) {
+  size_t newline;
+  while ((newline = data.find('\n')) != std::string_view::npos) {
+    document_.append(data.substr(0, newline));
+    std::string_view document = Trim(document_);
+    if (!document.empty()) {
+      on_document(document);
+    }
+    document_.clear();
+    data.remove_prefix(newline + 1);
+  }
+  document_.append(data);
+}
+
+void ClashApiStream::EndBody(const DocumentCallback& on_document) {
+  std::string_view document = Trim(document_);
+  if (!document.empty()) {
+    on_document(document);
+  }
+  document_.clear();
+  state_ = State::kHead;
+}
+
+bool ParseTrafficDocument(std::string_view document, uint64_t* up, uint64_t* down) {
+  return ParseUnsigned(document, "up", up) && ParseUnsigned(document, "down", down);
+}
+
+bool CountConnections(std::string_view document, uint32_t* count) {
+  size_t position = FindValue(document, "connections");
+  if (position == std::string_view::npos || position >= document.size()) {
+    return false;
+  }
+  if (document.substr(position, 4) == "null") {
+    *count = 0;
+    return true;
+  }
+  if (document[position] != '[') {
+    return false;
+  }
+  position++;
+  while (position < document.size() && IsSpace(document[position])) {
+    position++;
+  }
+  if (position < document.size() && document[position] == ']') {
+    *count = 0;
+    return true;
+  }
+  // One entry plus one per comma directly inside the array.
+  uint32_t entries = 1;
+  int depth = 1;
+  bool in_string = false;
+  for (; position < document.size(); position++) {
+    char c = document[position];
+    if (in_string) {
+      if (c == '\\') {
+        position++;
+      } else if (c == '"') {
+        in_string = false;
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '[' || c == '{') {
+      depth++;
+    } else if (c == ']' || c == '}') {
+      if (--depth == 0) {
+        *count = entries;
+        return true;
+      }
+    } else if (c == ',' && depth == 1) {
+      entries++;
+    }
+  }
+  return false;
+}
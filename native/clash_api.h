@@ -0,0 +1,83 @@
+#ifndef NATIVE_CLASH_API_H_
+#define NATIVE_CLASH_API_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Helpers for sing-box's Clash-compatible HTTP API
+// (experimental.clash_api in the config).
+
+// Port of "external_controller" when it listens on 127.0.0.1 or localhost,
+// or 0 when the config has no such controller.
+uint16_t FindClashApiPort(std::string_view config);
+
+// The controller's "secret", or empty when the config sets none.
+std::string FindClashApiSecret(std::string_view config);
+
+// A fresh secret for the API: 32 hex digits from the OS random source.
+// The runners make one per run, so nothing else on the machine can drive
+// sing-box through its controller.
+std::string RandomClashApiSecret();
+
+// Request used to check that the API is serving, carrying |secret| as a
+// bearer token unless it is empty.
+std::string ClashApiProbeRequest(std::string_view secret);
+
+// Whether |response| starts with an HTTP status line. Any status counts,
+// since a secret set outside the runner turns the probe into a 401.
+bool IsHttpResponse(std::string_view response);
+
+// Keep-alive request for |path| on the API, such as "/traffic", carrying
+// |secret| as a bearer token unless it is empty.
+std::string ClashApiRequest(std::string_view path, std::string_view secret = {});
+
+// Reads the responses on one persistent connection to the API and splits
+// their bodies into newline-delimited JSON documents. Content-Length,
+// chunked and close-delimited bodies are understood, so a streaming
+// endpoint such as /traffic yields a document per line as it arrives and a
+// snapshot such as /connections yields one when its response ends.
+class ClashApiStream {
+ public:
+  using DocumentCallback = std::function<void(std::string_view document)>;
+
+  // Returns false when the response is not a 200 or is malformed; the
+  // connection is unusable from then on.
+  bool Feed(std::string_view data, const DocumentCallback& on_document);
+  // Call when the server closes the connection. Returns whether that
+  // ended a close-delimited body rather than cutting one short.
+  bool OnClosed(const DocumentCallback& on_document);
+
+  // Whether no response is in progress, so the next request's response is
+  // the next thing to arrive.
+  bool idle() const { return state_ == State::kHead && buffer_.empty(); }
+  const std::string& error() const { return error_; }
+
+ private:
+  enum class State { kHead, kChunkSize, kChunkData, kChunkEnd, kTrailer, kLength, kUntilClose, kFailed };
+
+  bool Fail(std::string error);
+  bool ParseHead(std::string_view head);
+  void AddBody(std::string_view data, const DocumentCallback& on_document);
+  void EndBody(const DocumentCallback& on_document);
+
+  State state_ = State::kHead;
+  // Received bytes not consumed yet; only head and chunk framing waits
+  // here.
+  std::string buffer_;
+  // The body line being assembled.
+  std::string document_;
+  uint64_t remaining_ = 0;
+  std::string error_;
+};
+
+// Reads a /traffic document, {"up":<bytes>,"down":<bytes>} for the last
+// second.
+bool ParseTrafficDocument(std::string_view document, uint64_t* up, uint64_t* down);
+
+// Counts the entries of the "connections" array of a /connections
+// snapshot; a null array counts as none.
+bool CountConnections(std::string_view document, uint32_t* count);
+
+#endif  // NATIVE_CLASH_API_H_
@@ -0,0 +1,620 @@
+#include "config_builder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "dns_bench.h"
+#include "rule_set.h"
+
+namespace {
+// A multiply-xorshift hash over length-prefixed fields, so ("ab", "c") and
+// ("a", "bc") differ. It takes eight bytes per step: even a cache hit
+// hashes every excluded domain, and byte-wise FNV-1a made that most of
+// its cost.
+class Hasher {
+ public:
+  Hasher& Add(std::string_view value) {
+    Add(static_cast<int64_t>(value.size()));
+    size_t i = 0;
+    for (; i + 8 <= value.size(); i += 8) {
+      uint64_t word;
+      memcpy(&word, value.data() + i, 8);
+      Word(word);
+    }
+    if (i < value.size()) {
+      uint64_t word = 0;
+      memcpy(&word, value.data() + i, value.size() - i);
+      Word(word);
+    }
+    return *this;
+  }
+  Hasher& Add(int64_t value) {
+    Word(static_cast<uint64_t>(value));
+    return *this;
+  }
+  Hasher& Add(bool value) { return Add(static_cast<int64_t>(value)); }
+  Hasher& Add(const std::vector<std::string>& values) {
+    Add(static_cast<int64_t>(values.size()));
+    for (const std::string& value : values) {
+      Add(std::string_view(value));
+    }
+    return *this;
+  }
+  uint64_t value() const { return hash_; }
+
+ private:
+  void Word(uint64_t word) {
+    hash_ = (hash_ ^ word) * 0x9e3779b97f4a7c15ULL;
+    hash_ ^= hash_ >> 29;
+  }
+
+  uint64_t hash_ = 0xcbf29ce484222325ULL;
+};
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+char ToLower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Strict UTF-8, as utf8.decode without allowMalformed.
+bool IsValidUtf8(std::string_view text) {
+  for (size_t i = 0; i < text.size();) {
+    uint8_t lead = static_cast<uint8_t>(text[i]);
+    size_t length;
+    uint32_t code_point;
+    if (lead < 0x80) {
+      i++;
+      continue;
+    } else if ((lead & 0xe0) == 0xc0) {
+      length = 2;
+      code_point = lead & 0x1f;
+    } else if ((lead & 0xf0) == 0xe0) {
+      length = 3;
+      code_point = lead & 0x0f;
+    } else if ((lead & 0xf8) == 0xf0) {
+      length = 4;
+      code_point = lead & 0x07;
+    } else {
+      return false;
+    }
+    if (i + length > text.size()) {
+      return false;
+    }
+    for (size_t j = 1; j < length; j++) {
+      uint8_t continuation = static_cast<uint8_t>(text[i + j]);
+      if ((continuation & 0xc0) != 0x80) {
+        return false;
+      }
+      code_point = code_point << 6 | (continuation & 0x3f);
+    }
+    static const uint32_t kMinimum[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (code_point < kMinimum[length] || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff)) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+// Uri.decodeQueryComponent: '+' is a space and %XX a byte. The parser has
+// already turned a stray '%' into "%25", so here it stays as is.
+std::string DecodeQueryComponent(std::string_view value) {
+  std::string decoded;
+  decoded.reserve(value.size());
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] == '+') {
+      decoded.push_back(' ');
+    } else if (value[i] == '%' && i + 2 < value.size() && HexValue(value[i + 1]) >= 0 &&
+               HexValue(value[i + 2]) >= 0) {
+      decoded.push_back(static_cast<char>(HexValue(value[i + 1]) << 4 | HexValue(value[i + 2])));
+      i += 2;
+    } else {
+      decoded.push_back(value[i]);
+    }
+  }
+  return decoded;
+}
+
+// The parts of a link that Uri.parse exposes and the generator reads.
+struct Link {
+  std::string scheme;
+  std::string user_info;
+  std::string host;
+  int64_t port = 0;
+  // Later duplicates win, as in Uri.queryParameters.
+  std::map<std::string, std::string> query;
+
+  JsonValue Query(const char* key) const {
+    auto it = query.find(key);
+    return it == query.end() ? JsonValue() : JsonValue(it->second);
+  }
+};
+
+bool ParseLink(std::string_view text, Link* link, std::string* error) {
+  size_t colon = text.find(':');
+  if (colon == std::string_view::npos || colon == 0) {
+    *error = "Invalid link: missing scheme";
+    return false;
+  }
+  for (char c : text.substr(0, colon)) {
+    link->scheme.push_back(ToLower(c));
+  }
+  std::string_view rest = text.substr(colon + 1);
+
+  size_t fragment = rest.find('#');
+  if (fragment != std::string_view::npos) {
+    rest = rest.substr(0, fragment);
+  }
+  size_t query = rest.find('?');
+  if (query != std::string_view::npos) {
+    std::string_view pairs = rest.substr(query + 1);
+    rest = rest.substr(0, query);
+    while (!pairs.empty()) {
+      size_t end = std::min(pairs.find('&'), pairs.size());
+      std::string_view pair = pairs.substr(0, end);
+      pairs = pairs.substr(std::min(end + 1, pairs.size()));
+      if (pair.empty()) {
+        continue;
+      }
+      size_t equals = std::min(pair.find('='), pair.size());
+      std::string key = DecodeQueryComponent(pair.substr(0, equals));
+      std::string value = DecodeQueryComponent(pair.substr(std::min(equals + 1, pair.size())));
+      // Uri.queryParameters throws on bytes that are not UTF-8.
+      if (!IsValidUtf8(key) || !IsValidUtf8(value)) {
+        *error = "Invalid link: malformed query encoding";
+        return false;
+      }
+      link->query[std::move(key)] = std::move(value);
+    }
+  }
+
+  if (rest.substr(0, 2) != "//") {
+    return true;
+  }
+  std::string_view authority = rest.substr(2);
+  authority = authority.substr(0, std::min(authority.find('/'), authority.size()));
+
+  size_t at = authority.rfind('@');
+  if (at != std::string_view::npos) {
+    link->user_info = std::string(authority.substr(0, at));
+    authority = authority.substr(at + 1);
+  }
+
+  std::string_view port;
+  if (!authority.empty() && authority[0] == '[') {
+    size_t close = authority.find(']');
+    if (close == std::string_view::npos) {
+      *error = "Invalid link: unterminated IPv6 address";
+      return false;
+    }
+    link->host = std::string(authority.substr(1, close - 1));
+    std::string_view after = authority.substr(close + 1);
+    if (!after.empty() && after[0] != ':') {
+      *error = "Invalid link: bad IPv6 address";
+      return false;
+    }
+    port = after.substr(std::min<size_t>(1, after.size()));
+  } else {
+    size_t port_colon = authority.find(':');
+    link->host = std::string(authority.substr(0, std::min(port_colon, authority.size())));
+    if (port_colon != std::string_view::npos) {
+      port = authority.substr(port_colon + 1);
+    }
+  }
+  std::transform(link->host.begin(), link->host.end(), link->host.begin(), ToLower);
+
+  if (port.size() > 18) {
+    *error = "Invalid port";
+    return false;
+  }
+  for (char c : port) {
+    if (c < '0' || c > '9') {
+      *error = "Invalid port";
+      return false;
+    }
+    link->port = link->port * 10 + (c - '0');
+  }
+  return true;
+}
+
+// dart:convert's base64Decode: either alphabet, padding required (also
+// percent-encoded as "%3D").
+bool DecodeBase64(std::string_view text, std::string* decoded) {
+  std::string input;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text.substr(i, 3) == "%3D" || text.substr(i, 3) == "%3d") {
+      input.push_back('=');
+      i += 2;
+    } else {
+      input.push_back(text[i]);
+    }
+  }
+  if (input.size() % 4 != 0) {
+    return false;
+  }
+  uint32_t accumulator = 0;
+  int bits = 0;
+  size_t padding = 0;
+  for (size_t i = 0; i < input.size(); i++) {
+    char c = input[i];
+    int value;
+    if (c >= 'A' && c <= 'Z') {
+      value = c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+      value = c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+      value = c - '0' + 52;
+    } else if (c == '+' || c == '-') {
+      value = 62;
+    } else if (c == '/' || c == '_') {
+      value = 63;
+    } else if (c == '=' && i + 2 >= input.size()) {
+      padding++;
+      continue;
+    } else {
+      return false;
+    }
+    if (padding > 0) {
+      return false;
+    }
+    accumulator = accumulator << 6 | static_cast<uint32_t>(value);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      decoded->push_back(static_cast<char>(accumulator >> bits & 0xff));
+    }
+  }
+  return true;
+}
+
+JsonValue BuildVless(const Link& link) {
+  bool reality = link.query.count("security") > 0 && link.query.at("security") == "reality";
+
+  JsonValue reality_options = JsonValue::Object();
+  reality_options.Set("enabled", reality);
+  reality_options.Set("public_key", link.Query("pbk"));
+  reality_options.Set("short_id", link.Query("sid"));
+
+  JsonValue utls = JsonValue::Object();
+  utls.Set("enabled", true);
+  utls.Set("fingerprint", link.Query("fp"));
+
+  JsonValue tls = JsonValue::Object();
+  tls.Set("enabled", reality);
+  tls.Set("server_name", link.Query("sni"));
+  tls.Set("reality", std::move(reality_options));
+  tls.Set("utls", std::move(utls));
+
+  JsonValue outbound = JsonValue::Object();
+  outbound.Set("type", "vless");
+  outbound.Set("tag", "proxy");
+  outbound.Set("server", link.host);
+  outbound.Set("server_port", link.port);
+  outbound.Set("uuid", link.user_info);
+  outbound.Set("flow", link.Query("flow"));
+  outbound.Set("tls", std::move(tls));
+  return outbound;
+}
+
+bool BuildSsh(const Link& link, JsonValue* outbound, std::string* error) {
+  size_t colon = link.user_info.find(':');
+  std::string username = link.user_info.substr(0, colon);
+  std::string private_key;
+  bool has_private_key = false;
+  if (colon != std::string::npos && colon + 1 < link.user_info.size()) {
+    if (!DecodeBase64(std::string_view(link.user_info).substr(colon + 1), &private_key) ||
+        !IsValidUtf8(private_key)) {
+      *error = "Failed to decode Base64 private key";
+      return false;
+    }
+    has_private_key = true;
+  }
+
+  *outbound = JsonValue::Object();
+  outbound->Set("type", "ssh");
+  outbound->Set("tag", "proxy");
+  outbound->Set("server", link.host);
+  outbound->Set("server_port", link.port);
+  outbound->Set("user", username);
+  if (has_private_key) {
+    outbound->Set("private_key", private_key);
+  }
+  return true;
+}
+
+JsonValue BuildHysteria2(const Link& link) {
+  JsonValue outbound = JsonValue::Object();
+  outbound.Set("type", "hysteria2");
+  outbound.Set("tag", "proxy");
+  outbound.Set("server", link.host);
+  outbound.Set("server_port", link.port);
+  outbound.Set("password", link.user_info);
+  auto obfs_type = link.query.find("obfs");
+  auto obfs_password = link.query.find("obfspassword");
+  if (obfs_type != link.query.end() && obfs_password != link.query.end()) {
+    JsonValue obfs = JsonValue::Object();
+    obfs.Set("type", obfs_type->second);
+    obfs.Set("password", obfs_password->second);
+    outbound.Set("obfs", std::move(obfs));
+  }
+  JsonValue tls = JsonValue::Object();
+  tls.Set("enabled", true);
+  auto sni = link.query.find("tls_sni");
+  if (sni != link.query.end()) {
+    tls.Set("server_name", sni->second);
+  }
+  outbound.Set("tls", std::move(tls));
+  return outbound;
+}
+
+std::string RemoveSpaces(std::string_view link) {
+  std::string result;
+  result.reserve(link.size());
+  for (char c : link) {
+    if (c != ' ') {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+}  // namespace
+
+bool ParseProxyLink(std::string_view text, JsonValue* outbound, std::string* error) {
+  Link link;
+  if (!ParseLink(RemoveSpaces(text), &link, error)) {
+    return false;
+  }
+  if (link.scheme == "vless") {
+    *outbound = BuildVless(link);
+    return true;
+  }
+  if (link.scheme == "ssh") {
+    return BuildSsh(link, outbound, error);
+  }
+  if (link.scheme == "hysteria2") {
+    *outbound = BuildHysteria2(link);
+    return true;
+  }
+  *error = "Unsupported protocol scheme: " + link.scheme;
+  return false;
+}
+
+template <typename Builder>
+bool ConfigBuilder::Update(Section* section, const char* name, uint64_t key, Builder build, std::string* error) {
+  if (section->valid && section->key == key) {
+    return true;
+  }
+  JsonValue value;
+  if (!build(&value, error)) {
+    section->valid = false;
+    return false;
+  }
+  section->json = "\"";
+  section->json += name;
+  section->json += "\":";
+  value.Serialize(&section->json);
+  section->key = key;
+  section->valid = true;
+  sections_built_++;
+  return true;
+}
+
+bool ConfigBuilder::Build(const ConfigSettings& settings, std::string_view link, std::string* config,
+                          std::string* error) {
+  const uint64_t log_key = Hasher().Add(settings.enable_logging).value();
+  const uint64_t dns_key = Hasher().Add(std::string_view(settings.dns_provider)).value();
+  const uint64_t inbounds_key = Hasher()
+                                    .Add(settings.use_mixed_inbound)
+                                    .Add(std::string_view(settings.mixed_inbound_listen_address))
+                                    .Add(settings.mixed_inbound_listen_port)
+                                    .value();
+  const uint64_t outbounds_key = Hasher().Add(link).value();
+  // Checked on every build, ahead of the config cache, so a rule-set that
+  // was deleted is written again rather than referenced. The file name
+  // carries the hash of the lists. When it cannot be written the lists
+  // stay inline.
+  std::string rule_set_path;
+  if (!settings.rule_set_directory.empty() &&
+      (!settings.excluded_domains.empty() || !settings.excluded_domain_suffixes.empty())) {
+    std::filesystem::path path;
+    std::string compile_error;
+    if (EnsureDomainRuleSet(settings.rule_set_directory, settings.excluded_domains,
+                            settings.excluded_domain_suffixes, &path, &compile_error)) {
+      rule_set_path = path.u8string();
+    }
+  }
+  const uint64_t route_key =
+      rule_set_path.empty()
+          ? Hasher().Add(settings.excluded_domains).Add(settings.excluded_domain_suffixes).value()
+          : Hasher().Add(std::string_view(rule_set_path)).value();
+  const uint64_t experimental_key = Hasher().Add(settings.clash_api_port).Add(settings.clash_api_secret).value();
+  const uint64_t config_key = Hasher()
+                                  .Add(static_cast<int64_t>(log_key))
+                                  .Add(static_cast<int64_t>(dns_key))
+                                  .Add(static_cast<int64_t>(inbounds_key))
+                                  .Add(static_cast<int64_t>(outbounds_key))
+                                  .Add(static_cast<int64_t>(route_key))
+                                  .Add(static_cast<int64_t>(experimental_key))
+                                  .value();
+
+  for (auto it = configs_.begin(); it != configs_.end(); ++it) {
+    if (it->first == config_key) {
+      *config = it->second;
+      if (it != configs_.begin()) {
+        auto entry = std::move(*it);
+        configs_.erase(it);
+        configs_.push_front(std::move(entry));
+      }
+      return true;
+    }
+  }
+
+  bool built =
+      Update(&log_, "log", log_key,
+             [&](JsonValue* log, std::string*) {
+               *log = JsonValue::Object();
+               log->Set("level", settings.enable_logging ? "debug" : "error");
+               log->Set("timestamp", true);
+               return true;
+             },
+             error) &&
+      Update(&dns_, "dns", dns_key,
+             [&](JsonValue* dns, std::string*) {
+               JsonValue server = JsonValue::Object();
+               server.Set("type", "tcp");
+               server.Set("tag", "dns-proxy");
+               server.Set("server", DnsProviderAddress(settings.dns_provider));
+               JsonValue rule = JsonValue::Object();
+               rule.Set("server", "dns-proxy");
+               *dns = JsonValue::Object();
+               dns->Set("servers", JsonValue::Array()).Append(std::move(server));
+               dns->Set("strategy", "prefer_ipv4");
+               dns->Set("rules", JsonValue::Array()).Append(std::move(rule));
+               return true;
+             },
+             error) &&
+      Update(&inbounds_, "inbounds", inbounds_key,
+             [&](JsonValue* inbounds, std::string*) {
+               JsonValue tun = JsonValue::Object();
+               tun.Set("type", "tun");
+               tun.Set("tag", "tun-in");
+               tun.Set("address", JsonValue::StringArray({std::string(kTunAddress)}));
+               tun.Set("mtu", 1500);
+               tun.Set("route_address", JsonValue::StringArray({"0.0.0.0/1", "128.0.0.0/1"}));
+               tun.Set("auto_route", true);
+               tun.Set("strict_route", true);
+               tun.Set("stack", "gvisor");
+               tun.Set("sniff", true);
+               *inbounds = JsonValue::Array();
+               inbounds->Append(std::move(tun));
+               if (settings.use_mixed_inbound) {
+                 JsonValue mixed = JsonValue::Object();
+                 mixed.Set("type", "mixed");
+                 mixed.Set("tag", "mixed-in");
+                 mixed.Set("listen", settings.mixed_inbound_listen_address);
+                 mixed.Set("listen_port", settings.mixed_inbound_listen_port);
+                 inbounds->Append(std::move(mixed));
+               }
+               return true;
+             },
+             error) &&
+      Update(&outbounds_, "outbounds", outbounds_key,
+             [&](JsonValue* outbounds, std::string* parse_error) {
+               JsonValue proxy;
+               if (!ParseProxyLink(link, &proxy, parse_error)) {
+                 return false;
+               }
+               JsonValue direct = JsonValue::Object();
+               direct.Set("type", "direct");
+               direct.Set("tag", "direct");
+               *outbounds = JsonValue::Array();
+               outbounds->Append(std::move(proxy));
+               outbounds->Append(std::move(direct));
+               return true;
+             },
+             error) &&
+      Update(&route_, "route", route_key,
+             [&](JsonValue* route, std::string*) {
+               JsonValue rules = JsonValue::Array();
+               JsonValue sniff = JsonValue::Object();
+               sniff.Set("action", "sniff");
+               rules.Append(std::move(sniff));
+               // Only the TUN's DNS; queries sent through the mixed inbound
+               // go where they are addressed, which is what benchmarkDns
+               // measures there.
+               JsonValue hijack_dns = JsonValue::Object();
+               hijack_dns.Set("inbound", JsonValue::StringArray({"tun-in"}));
+               hijack_dns.Set("protocol", "dns");
+               hijack_dns.Set("action", "hijack-dns");
+               rules.Append(std::move(hijack_dns));
+               if (!rule_set_path.empty()) {
+                 JsonValue excluded = JsonValue::Object();
+                 excluded.Set("rule_set", "excluded-domains");
+                 excluded.Set("action", "route");
+                 excluded.Set("outbound", "direct");
+                 rules.Insert(0, std::move(excluded));
+                 JsonValue rule_set = JsonValue::Object();
+                 rule_set.Set("type", "local");
+                 rule_set.Set("tag", "excluded-domains");
+                 rule_set.Set("format", "binary");
+                 rule_set.Set("path", rule_set_path);
+                 *route = JsonValue::Object();
+                 route->Set("rules", std::move(rules));
+                 route->Set("rule_set", JsonValue::Array()).Append(std::move(rule_set));
+                 route->Set("auto_detect_interface", true);
+                 return true;
+               }
+               // Both go in front, suffixes first, as in ConfigGenerator.
+               if (!settings.excluded_domains.empty()) {
+                 JsonValue keyword = JsonValue::Object();
+                 keyword.Set("domain_keyword", JsonValue::StringArray(settings.excluded_domains));
+                 keyword.Set("action", "route");
+                 keyword.Set("outbound", "direct");
+                 rules.Insert(0, std::move(keyword));
+               }
+               if (!settings.excluded_domain_suffixes.empty()) {
+                 JsonValue suffix = JsonValue::Object();
+                 suffix.Set("domain_suffix", JsonValue::StringArray(settings.excluded_domain_suffixes));
+                 suffix.Set("action", "route");
+                 suffix.Set("outbound", "direct");
+                 rules.Insert(0, std::move(suffix));
+               }
+               *route = JsonValue::Object();
+               route->Set("rules", std::move(rules));
+               route->Set("auto_detect_interface", true);
+               return true;
+             },
+             error) &&
+      (settings.clash_api_port == 0 ||
+       Update(&experimental_, "experimental", experimental_key,
+             [&](JsonValue* experimental, std::string*) {
+               JsonValue clash_api = JsonValue::Object();
+               clash_api.Set("external_controller", "127.0.0.1:" + std::to_string(settings.clash_api_port));
+               if (!settings.clash_api_secret.empty()) {
+                 clash_api.Set("secret", settings.clash_api_secret);
+               }
+               *experimental = JsonValue::Object();
+               experimental->Set("clash_api", std::move(clash_api));
+               return true;
+             },
+             error));
+  if (!built) {
+    return false;
+  }
+
+  std::string result;
+  result.reserve(log_.json.size() + dns_.json.size() + inbounds_.json.size() + outbounds_.json.size() +
+                 route_.json.size() + experimental_.json.size() + 8);
+  result += '{';
+  for (const Section* section : {&log_, &dns_, &inbounds_, &outbounds_, &route_}) {
+    if (result.size() > 1) {
+      result += ',';
+    }
+    result += section->json;
+  }
+  if (settings.clash_api_port != 0) {
+    result += ',';
+    result += experimental_.json;
+  }
+  result += '}';
+
+  configs_.emplace_front(config_key, result);
+  if (configs_.size() > kCachedConfigs) {
+    configs_.pop_back();
+  }
+  *config = std::move(result);
+  return true;
+}
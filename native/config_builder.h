@@ -0,0 +1,96 @@
+#ifndef NATIVE_CONFIG_BUILDER_H_
+#define NATIVE_CONFIG_BUILDER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "json_value.h"
+
+// The user settings that shape a desktop sing-box config; the same keys
+// VpnService passes to ConfigGenerator in Dart.
+struct ConfigSettings {
+  std::string dns_provider;
+  bool enable_logging = false;
+  bool use_mixed_inbound = false;
+  std::string mixed_inbound_listen_address;
+  int64_t mixed_inbound_listen_port = 0;
+  std::vector<std::string> excluded_domains;
+  std::vector<std::string> excluded_domain_suffixes;
+  // 0 when the config has no Clash API.
+  int64_t clash_api_port = 0;
+  // Bearer token the Clash API requires; empty leaves it open, as
+  // ConfigGenerator does.
+  std::string clash_api_secret;
+  // Where the excluded domains are compiled into a binary rule-set. Empty
+  // keeps them inline, as ConfigGenerator does.
+  std::filesystem::path rule_set_directory;
+};
+
+// The TUN inbound's address. The Linux runner's split tunneling
+// masquerades connections it routes around the TUN from this subnet.
+constexpr std::string_view kTunAddress = "172.20.10.1/24";
+
+// Turns a vless://, ssh:// or hysteria2:// share link into the sing-box
+// outbound tagged "proxy". The link is read the way Dart's Uri.parse reads
+// it: spaces removed, scheme and host lower-cased, user info left encoded
+// and query values percent-decoded. Returns false with |error| set when the
+// link cannot be used.
+bool ParseProxyLink(std::string_view link, JsonValue* outbound, std::string* error);
+
+// Builds the desktop sing-box config, byte for byte what
+// ConfigGenerator.generateSingboxConfigJson produces on Windows and Linux.
+// The one exception is a rule_set_directory: sing-box then loads the
+// excluded domains from a compiled rule-set instead of building matchers
+// from tens of thousands of JSON strings on every start.
+//
+// Every top-level section is kept serialized together with a hash of the
+// settings it depends on, so flipping one setting re-serializes only that
+// section. Whole configs are also kept for the last few distinct settings,
+// which makes switching back and forth between servers a lookup.
+//
+// Not thread-safe; the runners use it on the platform thread.
+class ConfigBuilder {
+ public:
+  ConfigBuilder() = default;
+
+  ConfigBuilder(const ConfigBuilder&) = delete;
+  ConfigBuilder& operator=(const ConfigBuilder&) = delete;
+
+  // Returns false with |error| set when |link| is not usable.
+  bool Build(const ConfigSettings& settings, std::string_view link, std::string* config, std::string* error);
+
+  // Sections serialized since construction, for measuring the cache.
+  size_t sections_built() const { return sections_built_; }
+
+ private:
+  static constexpr size_t kCachedConfigs = 8;
+
+  struct Section {
+    bool valid = false;
+    uint64_t key = 0;
+    // "name":value, ready to be joined.
+    std::string json;
+  };
+
+  // Re-serializes |section| unless it was built for |key|. |build| fills
+  // the value and returns false with |error| set on failure.
+  template <typename Builder>
+  bool Update(Section* section, const char* name, uint64_t key, Builder build, std::string* error);
+
+  Section log_;
+  Section dns_;
+  Section inbounds_;
+  Section outbounds_;
+  Section route_;
+  Section experimental_;
+  std::deque<std::pair<uint64_t, std::string>> configs_;
+  size_t sections_built_ = 0;
+};
+
+#endif  // NATIVE_CONFIG_BUILDER_H_
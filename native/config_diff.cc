@@ -0,0 +1,185 @@
+#include "config_diff.h"
+
+#include <algorithm>
+
+namespace {
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void SkipSpace(std::string_view json, size_t* position) {
+  while (*position < json.size() && IsSpace(json[*position])) {
+    (*position)++;
+  }
+}
+
+// Appends the string literal starting at the quote at |*position|, escapes
+// included, to |out| and moves past it.
+bool ReadString(std::string_view json, size_t* position, std::string* out) {
+  for (size_t i = *position + 1; i < json.size(); i++) {
+    if (json[i] == '\\') {
+      i++;
+    } else if (json[i] == '"') {
+      out->append(json.substr(*position, i + 1 - *position));
+      *position = i + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Appends the value at |*position| to |out| without the whitespace outside
+// its strings and moves past it.
+bool ReadValue(std::string_view json, size_t* position, std::string* out) {
+  size_t start = out->size();
+  int depth = 0;
+  size_t i = *position;
+  while (i < json.size()) {
+    char c = json[i];
+    if (c == '"') {
+      if (!ReadString(json, &i, out)) {
+        return false;
+      }
+      if (depth == 0) {
+        break;
+      }
+      continue;
+    }
+    if (IsSpace(c)) {
+      if (depth == 0 && out->size() > start) {
+        break;
+      }
+      i++;
+      continue;
+    }
+    if (depth == 0 && (c == ',' || c == '}' || c == ']')) {
+      break;
+    }
+    if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      depth--;
+    }
+    out->push_back(c);
+    i++;
+    if (depth == 0 && (c == '}' || c == ']')) {
+      break;
+    }
+  }
+  *position = i;
+  return depth == 0 && out->size() > start;
+}
+
+std::string JoinSections(const std::vector<std::string>& sections) {
+  std::string joined;
+  for (const std::string& section : sections) {
+    if (!joined.empty()) {
+      joined += ", ";
+    }
+    joined += section;
+  }
+  return joined;
+}
+
+}  // namespace
+
+const char* ReloadPathName(ReloadPath path) {
+  switch (path) {
+    case ReloadPath::kUnchanged:
+      return "unchanged";
+    case ReloadPath::kSignal:
+      return "signal";
+    case ReloadPath::kRestart:
+      return "restart";
+  }
+  return "";
+}
+
+bool SplitTopLevelMembers(std::string_view json, std::vector<std::pair<std::string, std::string>>* members) {
+  members->clear();
+  size_t i = 0;
+  SkipSpace(json, &i);
+  if (i >= json.size() || json[i] != '{') {
+    return false;
+  }
+  i++;
+  SkipSpace(json, &i);
+  if (i < json.size() && json[i] == '}') {
+    i++;
+  } else {
+    for (;;) {
+      SkipSpace(json, &i);
+      std::string key;
+      if (i >= json.size() || json[i] != '"' || !ReadString(json, &i, &key)) {
+        return false;
+      }
+      SkipSpace(json, &i);
+      if (i >= json.size() || json[i] != ':') {
+        return false;
+      }
+      i++;
+      SkipSpace(json, &i);
+      std::string value;
+      if (!ReadValue(json, &i, &value)) {
+        return false;
+      }
+      members->emplace_back(key.substr(1, key.size() - 2), std::move(value));
+      SkipSpace(json, &i);
+      if (i < json.size() && json[i] == ',') {
+        i++;
+        continue;
+      }
+      if (i < json.size() && json[i] == '}') {
+        i++;
+        break;
+      }
+      return false;
+    }
+  }
+  SkipSpace(json, &i);
+  return i == json.size();
+}
+
+ConfigDiff DiffConfigs(std::string_view running, std::string_view next) {
+  ConfigDiff diff;
+  std::vector<std::pair<std::string, std::string>> old_members;
+  std::vector<std::pair<std::string, std::string>> new_members;
+  if (!SplitTopLevelMembers(running, &old_members) || !SplitTopLevelMembers(next, &new_members)) {
+    diff.needs_restart = true;
+    return diff;
+  }
+  auto find = [](const std::vector<std::pair<std::string, std::string>>& members, const std::string& key) {
+    return std::find_if(members.begin(), members.end(), [&key](const auto& member) { return member.first == key; });
+  };
+  for (const auto& member : new_members) {
+    auto old_member = find(old_members, member.first);
+    if (old_member == old_members.end() || old_member->second != member.second) {
+      diff.changed.push_back(member.first);
+    }
+  }
+  for (const auto& member : old_members) {
+    if (find(new_members, member.first) == new_members.end()) {
+      diff.changed.push_back(member.first);
+    }
+  }
+  diff.needs_restart = std::find(diff.changed.begin(), diff.changed.end(), "inbounds") != diff.changed.end();
+  return diff;
+}
+
+std::string DescribeReloadResult(const ReloadResult& result) {
+  if (!result.error.empty()) {
+    return "❌ Could not apply the new configuration: " + result.error + "\n";
+  }
+  std::string elapsed = std::to_string(result.elapsed_ms) + " ms";
+  std::string sections = result.sections.empty() ? "the new configuration" : JoinSections(result.sections);
+  switch (result.path) {
+    case ReloadPath::kUnchanged:
+      return "🔃 The configuration is unchanged, nothing to reload.\n";
+    case ReloadPath::kSignal:
+      return "🔃 Reloaded " + sections + " in place in " + elapsed + ".\n";
+    case ReloadPath::kRestart:
+      return "🔃 Restarted sing-box for " + sections + " in " + elapsed + ".\n";
+  }
+  return "";
+}
@@ -0,0 +1,57 @@
+#ifndef NATIVE_CONFIG_DIFF_H_
+#define NATIVE_CONFIG_DIFF_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// How a new config was applied to the running sing-box.
+enum class ReloadPath : uint8_t {
+  // Nothing sing-box reads had changed.
+  kUnchanged,
+  // sing-box re-read it in place, e.g. after SIGHUP.
+  kSignal,
+  // The process was replaced, as for a server switch.
+  kRestart,
+};
+
+// Name used for |path| on the method channel.
+const char* ReloadPathName(ReloadPath path);
+
+// The top-level sections that differ between two sing-box configs.
+struct ConfigDiff {
+  // Keys added, changed or removed, e.g. "dns" and "route".
+  std::vector<std::string> changed;
+  // The inbounds changed, which hold the TUN, or a config could not be
+  // read; the process has to be replaced.
+  bool needs_restart = false;
+
+  bool identical() const { return changed.empty() && !needs_restart; }
+};
+
+// Compares |running| and |next| section by section, ignoring whitespace
+// outside strings.
+ConfigDiff DiffConfigs(std::string_view running, std::string_view next);
+
+// Splits a JSON object into its members' keys, as written, and values with
+// the whitespace outside strings removed. Returns false if |json| is not a
+// single well-formed object.
+bool SplitTopLevelMembers(std::string_view json, std::vector<std::pair<std::string, std::string>>* members);
+
+// The outcome of a reloadConfig call.
+struct ReloadResult {
+  ReloadPath path = ReloadPath::kUnchanged;
+  std::vector<std::string> sections;
+  // From the request until the new config was running, in milliseconds.
+  int64_t elapsed_ms = 0;
+  // Empty on success; the previous config keeps running otherwise.
+  std::string error;
+};
+
+// One-line summary for the log, e.g.
+// "🔃 Reloaded dns, route in place in 180 ms.\n".
+std::string DescribeReloadResult(const ReloadResult& result);
+
+#endif  // NATIVE_CONFIG_DIFF_H_
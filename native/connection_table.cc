@@ -0,0 +1,575 @@
+#include "connection_table.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void SkipSpace(std::string_view document, size_t* position) {
+  while (*position < document.size() && IsSpace(document[*position])) {
+    (*position)++;
+  }
+}
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void AppendUtf8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else if (code_point < 0x10000) {
+    out->push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else {
+    out->push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  }
+}
+
+// Reads the four hex digits of a \u escape at |position|.
+bool ReadHex4(std::string_view document, size_t position, uint32_t* value) {
+  if (position + 4 > document.size()) {
+    return false;
+  }
+  uint32_t result = 0;
+  for (size_t i = 0; i < 4; i++) {
+    int digit = HexDigit(document[position + i]);
+    if (digit < 0) {
+      return false;
+    }
+    result = result << 4 | static_cast<uint32_t>(digit);
+  }
+  *value = result;
+  return true;
+}
+
+// Moves past the string at |*position|, appending its decoded contents to
+// |out| unless it is null.
+bool ReadString(std::string_view document, size_t* position, std::string* out) {
+  if (*position >= document.size() || document[*position] != '"') {
+    return false;
+  }
+  size_t i = *position + 1;
+  while (i < document.size()) {
+    char c = document[i];
+    if (c == '"') {
+      *position = i + 1;
+      return true;
+    }
+    if (c != '\\') {
+      if (out != nullptr) {
+        out->push_back(c);
+      }
+      i++;
+      continue;
+    }
+    if (i + 1 >= document.size()) {
+      return false;
+    }
+    char escaped = document[i + 1];
+    i += 2;
+    if (out == nullptr) {
+      continue;
+    }
+    switch (escaped) {
+      case 'b':
+        out->push_back('\b');
+        break;
+      case 'f':
+        out->push_back('\f');
+        break;
+      case 'n':
+        out->push_back('\n');
+        break;
+      case 'r':
+        out->push_back('\r');
+        break;
+      case 't':
+        out->push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code_point;
+        if (!ReadHex4(document, i, &code_point)) {
+          return false;
+        }
+        i += 4;
+        uint32_t low;
+        if (code_point >= 0xd800 && code_point < 0xdc00 && i + 1 < document.size() && document[i] == '\\' &&
+            document[i + 1] == 'u' && ReadHex4(document, i + 2, &low) && low >= 0xdc00 && low < 0xe000) {
+          code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+          i += 6;
+        }
+        AppendUtf8(code_point, out);
+        break;
+      }
+      default:
+        // Quote, backslash and slash stand for themselves.
+        out->push_back(escaped);
+        break;
+    }
+  }
+  return false;
+}
+
+// Moves past the value at |*position|.
+bool SkipValue(std::string_view document, size_t* position) {
+  SkipSpace(document, position);
+  if (*position >= document.size()) {
+    return false;
+  }
+  char first = document[*position];
+  if (first == '"') {
+    return ReadString(document, position, nullptr);
+  }
+  if (first == '{' || first == '[') {
+    int depth = 0;
+    for (size_t i = *position; i < document.size(); i++) {
+      char c = document[i];
+      if (c == '"') {
+        size_t end = i;
+        if (!ReadString(document, &end, nullptr)) {
+          return false;
+        }
+        i = end - 1;
+      } else if (c == '{' || c == '[') {
+        depth++;
+      } else if ((c == '}' || c == ']') && --depth == 0) {
+        *position = i + 1;
+        return true;
+      }
+    }
+    return false;
+  }
+  size_t start = *position;
+  while (*position < document.size() && !IsSpace(document[*position]) && document[*position] != ',' &&
+         document[*position] != '}' && document[*position] != ']') {
+    (*position)++;
+  }
+  return *position > start;
+}
+
+bool ReadUnsigned(std::string_view document, size_t* position, uint64_t* value) {
+  SkipSpace(document, position);
+  size_t start = *position;
+  uint64_t result = 0;
+  while (*position < document.size() && document[*position] >= '0' && document[*position] <= '9') {
+    result = result * 10 + static_cast<uint64_t>(document[*position] - '0');
+    (*position)++;
+  }
+  if (*position == start) {
+    return false;
+  }
+  *value = result;
+  // A fraction or exponent would be a bug in sing-box; take the integer.
+  while (*position < document.size() && (document[*position] == '.' || document[*position] == 'e' ||
+                                          document[*position] == 'E' || document[*position] == '+' ||
+                                          document[*position] == '-' || HexDigit(document[*position]) >= 0)) {
+    (*position)++;
+  }
+  return true;
+}
+
+// A string, or the text of a number, as sing-box writes ports either way.
+bool ReadScalar(std::string_view document, size_t* position, std::string* out) {
+  SkipSpace(document, position);
+  if (*position < document.size() && document[*position] == '"') {
+    return ReadString(document, position, out);
+  }
+  size_t start = *position;
+  if (!SkipValue(document, position)) {
+    return false;
+  }
+  std::string_view text = document.substr(start, *position - start);
+  if (text != "null") {
+    out->append(text);
+  }
+  return true;
+}
+
+// Calls |member| with each key of the object at |*position| and the
+// position of its value, which |member| must move past. Keys are compared
+// as written; sing-box escapes none.
+template <typename Member>
+bool ForEachMember(std::string_view document, size_t* position, Member member) {
+  SkipSpace(document, position);
+  if (*position >= document.size() || document[*position] != '{') {
+    return false;
+  }
+  (*position)++;
+  SkipSpace(document, position);
+  if (*position < document.size() && document[*position] == '}') {
+    (*position)++;
+    return true;
+  }
+  while (*position < document.size()) {
+    SkipSpace(document, position);
+    size_t key_start = *position + 1;
+    if (!ReadString(document, position, nullptr)) {
+      return false;
+    }
+    std::string_view key = document.substr(key_start, *position - 1 - key_start);
+    SkipSpace(document, position);
+    if (*position >= document.size() || document[*position] != ':') {
+      return false;
+    }
+    (*position)++;
+    SkipSpace(document, position);
+    if (!member(key, position)) {
+      return false;
+    }
+    SkipSpace(document, position);
+    if (*position >= document.size()) {
+      return false;
+    }
+    char c = document[(*position)++];
+    if (c == '}') {
+      return true;
+    }
+    if (c != ',') {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Calls |element| with the position of each element of the array at
+// |*position|, which |element| must move past.
+template <typename Element>
+bool ForEachElement(std::string_view document, size_t* position, Element element) {
+  SkipSpace(document, position);
+  if (*position >= document.size() || document[*position] != '[') {
+    return false;
+  }
+  (*position)++;
+  SkipSpace(document, position);
+  if (*position < document.size() && document[*position] == ']') {
+    (*position)++;
+    return true;
+  }
+  while (*position < document.size()) {
+    SkipSpace(document, position);
+    if (!element(position)) {
+      return false;
+    }
+    SkipSpace(document, position);
+    if (*position >= document.size()) {
+      return false;
+    }
+    char c = document[(*position)++];
+    if (c == ']') {
+      return true;
+    }
+    if (c != ',') {
+      return false;
+    }
+  }
+  return false;
+}
+
+// sing-box ids are UUIDs, which fit the 16 bytes exactly; anything else is
+// hashed into them.
+void ParseId(std::string_view id, uint64_t* high, uint64_t* low) {
+  uint64_t words[2] = {0, 0};
+  size_t digits = 0;
+  bool uuid = true;
+  for (char c : id) {
+    if (c == '-') {
+      continue;
+    }
+    int digit = HexDigit(c);
+    if (digit < 0 || digits == 32) {
+      uuid = false;
+      break;
+    }
+    words[digits / 16] = words[digits / 16] << 4 | static_cast<uint64_t>(digit);
+    digits++;
+  }
+  if (uuid && digits == 32) {
+    *high = words[0];
+    *low = words[1];
+    return;
+  }
+  // FNV-1a from two offset bases.
+  uint64_t a = 14695981039346656037ull;
+  uint64_t b = 0x6c62272e07bb0142ull;
+  for (char c : id) {
+    a = (a ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    b = (b ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+  *high = a;
+  *low = b;
+}
+
+std::string JoinHostPort(const std::string& host, const std::string& port) {
+  if (host.empty()) {
+    return std::string();
+  }
+  std::string address = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+  return port.empty() ? address : address + ":" + port;
+}
+
+// Fills in the details of a new connection from its snapshot entry.
+bool ParseOpened(std::string_view object, OpenedConnection* opened) {
+  std::string source_ip;
+  std::string source_port;
+  std::string destination_ip;
+  std::string destination_port;
+  std::string rule_payload;
+  std::vector<std::string> chains;
+  size_t position = 0;
+  bool parsed = ForEachMember(object, &position, [&](std::string_view key, size_t* value) {
+    if (key == "id") {
+      return ReadString(object, value, &opened->id);
+    }
+    if (key == "start") {
+      return ReadScalar(object, value, &opened->start);
+    }
+    if (key == "rule") {
+      return ReadScalar(object, value, &opened->rule);
+    }
+    if (key == "rulePayload") {
+      return ReadScalar(object, value, &rule_payload);
+    }
+    if (key == "chains") {
+      SkipSpace(object, value);
+      if (object.substr(*value, 4) == "null") {
+        return SkipValue(object, value);
+      }
+      return ForEachElement(object, value, [&](size_t* element) {
+        chains.emplace_back();
+        return ReadScalar(object, element, &chains.back());
+      });
+    }
+    if (key != "metadata") {
+      return SkipValue(object, value);
+    }
+    return ForEachMember(object, value, [&](std::string_view field, size_t* field_value) {
+      std::string* out = nullptr;
+      if (field == "network") {
+        out = &opened->network;
+      } else if (field == "type") {
+        out = &opened->inbound;
+      } else if (field == "sourceIP") {
+        out = &source_ip;
+      } else if (field == "sourcePort") {
+        out = &source_port;
+      } else if (field == "destinationIP") {
+        out = &destination_ip;
+      } else if (field == "destinationPort") {
+        out = &destination_port;
+      } else if (field == "host") {
+        out = &opened->host;
+      } else if (field == "processPath") {
+        out = &opened->process;
+      }
+      return out != nullptr ? ReadScalar(object, field_value, out) : SkipValue(object, field_value);
+    });
+  });
+  opened->source = JoinHostPort(source_ip, source_port);
+  opened->destination = JoinHostPort(destination_ip, destination_port);
+  if (!rule_payload.empty()) {
+    opened->rule += " (" + rule_payload + ")";
+  }
+  // Clash lists the chain from the last hop back.
+  for (auto it = chains.rbegin(); it != chains.rend(); ++it) {
+    if (!opened->chain.empty()) {
+      opened->chain += " > ";
+    }
+    opened->chain += *it;
+  }
+  return parsed;
+}
+
+}  // namespace
+
+void ConnectionDiff::Clear() {
+  sequence = 0;
+  reset = false;
+  total = 0;
+  opened.clear();
+  closed.clear();
+  changed.clear();
+}
+
+ConnectionTable::ConnectionTable() : slots_(kMinCapacity), mask_(kMinCapacity - 1) {}
+
+bool ConnectionTable::Apply(std::string_view document, ConnectionDiff* diff) {
+  entries_.clear();
+  bool found = false;
+  size_t position = 0;
+  bool parsed = ForEachMember(document, &position, [&](std::string_view key, size_t* value) {
+    if (key != "connections") {
+      return SkipValue(document, value);
+    }
+    found = true;
+    if (document.substr(*value, 4) == "null") {
+      return SkipValue(document, value);
+    }
+    return ForEachElement(document, value, [&](size_t* element) {
+      size_t begin = *element;
+      Entry entry = {};
+      bool has_id = false;
+      bool valid = ForEachMember(document, element, [&](std::string_view field, size_t* field_value) {
+        if (field == "id") {
+          size_t id_start = *field_value + 1;
+          if (!ReadString(document, field_value, nullptr)) {
+            return false;
+          }
+          ParseId(document.substr(id_start, *field_value - 1 - id_start), &entry.id_high, &entry.id_low);
+          has_id = true;
+          return true;
+        }
+        if (field == "upload") {
+          return ReadUnsigned(document, field_value, &entry.upload);
+        }
+        if (field == "download") {
+          return ReadUnsigned(document, field_value, &entry.download);
+        }
+        return SkipValue(document, field_value);
+      });
+      if (!valid) {
+        return false;
+      }
+      if (has_id) {
+        entry.object = document.substr(begin, *element - begin);
+        entries_.push_back(entry);
+      }
+      return true;
+    });
+  });
+  if (!parsed || !found) {
+    return false;
+  }
+
+  diff->Clear();
+  diff->sequence = ++sequence_;
+  diff->reset = reset_pending_;
+  reset_pending_ = false;
+  generation_++;
+  for (const Entry& entry : entries_) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      Grow();
+    }
+    Slot& slot = slots_[Find(entry.id_high, entry.id_low)];
+    if (slot.handle == 0) {
+      slot.id_high = entry.id_high;
+      slot.id_low = entry.id_low;
+      slot.upload = entry.upload;
+      slot.download = entry.download;
+      slot.handle = NextHandle();
+      slot.generation = generation_;
+      size_++;
+      OpenedConnection opened;
+      opened.handle = slot.handle;
+      opened.upload = entry.upload;
+      opened.download = entry.download;
+      ParseOpened(entry.object, &opened);
+      diff->opened.push_back(std::move(opened));
+      continue;
+    }
+    // A repeated id counts once.
+    if (slot.generation == generation_) {
+      continue;
+    }
+    slot.generation = generation_;
+    if (slot.upload != entry.upload || slot.download != entry.download) {
+      ConnectionBytes bytes;
+      bytes.handle = slot.handle;
+      bytes.upload = static_cast<int64_t>(entry.upload - slot.upload);
+      bytes.download = static_cast<int64_t>(entry.download - slot.download);
+      diff->changed.push_back(bytes);
+      slot.upload = entry.upload;
+      slot.download = entry.download;
+    }
+  }
+  for (size_t i = 0; i < slots_.size();) {
+    if (slots_[i].handle != 0 && slots_[i].generation != generation_) {
+      diff->closed.push_back(slots_[i].handle);
+      // The shift can pull a later entry into |i|, which is checked next.
+      // Entries only move towards the hole, so none is skipped.
+      Erase(i);
+      continue;
+    }
+    i++;
+  }
+  diff->total = static_cast<uint32_t>(size_);
+  return true;
+}
+
+void ConnectionTable::Reset(ConnectionDiff* diff) {
+  slots_.assign(kMinCapacity, Slot());
+  mask_ = kMinCapacity - 1;
+  size_ = 0;
+  reset_pending_ = true;
+  if (diff != nullptr) {
+    diff->Clear();
+    diff->sequence = ++sequence_;
+    diff->reset = true;
+  }
+}
+
+size_t ConnectionTable::Home(uint64_t id_high, uint64_t id_low) const {
+  uint64_t hash = (id_high ^ (id_low * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+  return static_cast<size_t>(hash >> 32) & mask_;
+}
+
+size_t ConnectionTable::Find(uint64_t id_high, uint64_t id_low) const {
+  size_t slot = Home(id_high, id_low);
+  while (slots_[slot].handle != 0 && (slots_[slot].id_high != id_high || slots_[slot].id_low != id_low)) {
+    slot = (slot + 1) & mask_;
+  }
+  return slot;
+}
+
+void ConnectionTable::Erase(size_t slot) {
+  size_t hole = slot;
+  for (size_t next = (hole + 1) & mask_; slots_[next].handle != 0; next = (next + 1) & mask_) {
+    // |next| may fill the hole if that is no further from its home slot.
+    size_t home = Home(slots_[next].id_high, slots_[next].id_low);
+    if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+  slots_[hole] = Slot();
+  size_--;
+}
+
+void ConnectionTable::Grow() {
+  std::vector<Slot> old = std::move(slots_);
+  slots_.assign(old.size() * 2, Slot());
+  mask_ = slots_.size() - 1;
+  for (const Slot& slot : old) {
+    if (slot.handle != 0) {
+      slots_[Find(slot.id_high, slot.id_low)] = slot;
+    }
+  }
+}
+
+uint32_t ConnectionTable::NextHandle() {
+  uint32_t handle = next_handle_++;
+  if (next_handle_ == 0) {
+    next_handle_ = 1;
+  }
+  return handle;
+}
@@ -0,0 +1,125 @@
+#ifndef NATIVE_CONNECTION_TABLE_H_
+#define NATIVE_CONNECTION_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A connection that showed up in a /connections snapshot, with everything
+// sing-box knows about where it goes and why.
+struct OpenedConnection {
+  // Stands for the connection in later diffs.
+  uint32_t handle = 0;
+  uint64_t upload = 0;
+  uint64_t download = 0;
+  std::string id;
+  // RFC 3339, as sing-box writes it.
+  std::string start;
+  // "tcp" or "udp".
+  std::string network;
+  // The inbound, e.g. "tun/tun-in".
+  std::string inbound;
+  // host:port pairs; |host| is the sniffed or requested domain, if any.
+  std::string source;
+  std::string destination;
+  std::string host;
+  std::string process;
+  // The route rule that matched, e.g. "rule_set=geosite-ru => direct",
+  // and the outbound chain, joined with " > ".
+  std::string rule;
+  std::string chain;
+};
+
+// Bytes a connection moved since the previous diff.
+struct ConnectionBytes {
+  uint32_t handle = 0;
+  int64_t upload = 0;
+  int64_t download = 0;
+};
+
+// What changed between two snapshots.
+struct ConnectionDiff {
+  uint64_t sequence = 0;
+  // The receiver's view starts over: |opened| lists every open connection
+  // and nothing else is known.
+  bool reset = false;
+  // Open connections after this diff.
+  uint32_t total = 0;
+  std::vector<OpenedConnection> opened;
+  std::vector<uint32_t> closed;
+  std::vector<ConnectionBytes> changed;
+
+  // Keeps the capacity for the next diff.
+  void Clear();
+  bool empty() const { return !reset && opened.empty() && closed.empty() && changed.empty(); }
+};
+
+// The open connections of the latest /connections snapshot, diffed against
+// each new one.
+//
+// sing-box lists every connection in every snapshot, thousands of them on a
+// busy desktop, so per connection the table keeps only what the next diff
+// needs: the id as 16 bytes, the byte counts last reported and the handle.
+// Those live in one open-addressing array probed linearly, and a closed
+// connection is removed by shifting the rest of its cluster back, so
+// lookups never wade through tombstones. The rest of an entry is parsed
+// only when it first shows up.
+class ConnectionTable {
+ public:
+  ConnectionTable();
+
+  // Fills |diff| with the changes |document| brings. Returns false, with
+  // the table unchanged, for a document that is not a snapshot.
+  bool Apply(std::string_view document, ConnectionDiff* diff);
+  // Forgets every connection; the next diff is a reset. If |diff| is set,
+  // it is filled with a reset that lists none, for a tunnel that stopped.
+  void Reset(ConnectionDiff* diff = nullptr);
+
+  size_t size() const { return size_; }
+
+ private:
+  static constexpr size_t kMinCapacity = 64;
+
+  struct Slot {
+    uint64_t id_high = 0;
+    uint64_t id_low = 0;
+    // As of the last diff.
+    uint64_t upload = 0;
+    uint64_t download = 0;
+    // 0 for an empty slot.
+    uint32_t handle = 0;
+    // The snapshot it was last seen in.
+    uint32_t generation = 0;
+  };
+
+  // An entry of the snapshot being applied.
+  struct Entry {
+    uint64_t id_high;
+    uint64_t id_low;
+    uint64_t upload;
+    uint64_t download;
+    // The entry's object, parsed further if it is new.
+    std::string_view object;
+  };
+
+  size_t Home(uint64_t id_high, uint64_t id_low) const;
+  // The slot holding the id, or the empty slot where it would go.
+  size_t Find(uint64_t id_high, uint64_t id_low) const;
+  void Erase(size_t slot);
+  void Grow();
+  uint32_t NextHandle();
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+  size_t size_ = 0;
+  uint32_t generation_ = 0;
+  uint32_t next_handle_ = 1;
+  uint64_t sequence_ = 0;
+  bool reset_pending_ = true;
+  // Reused between snapshots.
+  std::vector<Entry> entries_;
+};
+
+#endif  // NATIVE_CONNECTION_TABLE_H_
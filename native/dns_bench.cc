@@ -0,0 +1,430 @@
+#include "dns_bench.h"
+
+#include <algorithm>
+#include <random>
+
+#include "socks5.h"
+
+namespace {
+
+constexpr size_t kMaxQueries = 4096;
+constexpr uint8_t kRcodeServerFailure = 2;
+constexpr uint8_t kRcodeRefused = 5;
+
+void AppendUint16(std::string* out, uint16_t value) {
+  out->push_back(static_cast<char>(value >> 8));
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+// Nearest rank.
+int64_t Percentile(const std::vector<int64_t>& sorted, double fraction) {
+  size_t rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size()) + 0.999999);
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+bool IsFailure(uint8_t rcode) {
+  return rcode == kRcodeServerFailure || rcode == kRcodeRefused;
+}
+
+}  // namespace
+
+const std::vector<DnsProviderInfo>& KnownDnsProviders() {
+  static const std::vector<DnsProviderInfo> providers = {
+      {"google", "8.8.8.8"},
+      {"cloudflare", "1.1.1.1"},
+      {"adguard", "94.140.14.14"},
+  };
+  return providers;
+}
+
+const char* DnsProviderAddress(std::string_view name) {
+  for (const DnsProviderInfo& provider : KnownDnsProviders()) {
+    if (name == provider.name) {
+      return provider.address;
+    }
+  }
+  return KnownDnsProviders().front().address;
+}
+
+const char* DnsTransportName(DnsTransport transport) {
+  switch (transport) {
+    case DnsTransport::kUdp:
+      return "udp";
+    case DnsTransport::kTcp:
+      return "tcp";
+  }
+  return "";
+}
+
+const char* DnsRouteName(DnsRoute route) {
+  switch (route) {
+    case DnsRoute::kDirect:
+      return "direct";
+    case DnsRoute::kTunnel:
+      return "tunnel";
+  }
+  return "";
+}
+
+std::vector<std::string> DefaultDnsBenchDomains() {
+  return {"google.com", "youtube.com",   "wikipedia.org",  "github.com",   "amazon.com",
+          "apple.com",  "microsoft.com", "cloudflare.com", "telegram.org", "whatsapp.net"};
+}
+
+std::vector<DnsBenchRun> PlannedDnsBenchRuns(const DnsBenchOptions& options) {
+  std::vector<DnsBenchTarget> targets = options.targets;
+  if (targets.empty()) {
+    for (const DnsProviderInfo& provider : KnownDnsProviders()) {
+      targets.push_back({provider.name, provider.address, 53});
+    }
+  }
+  std::vector<DnsTransport> transports;
+  if (options.tcp) {
+    transports.push_back(DnsTransport::kTcp);
+  }
+  if (options.udp) {
+    transports.push_back(DnsTransport::kUdp);
+  }
+  std::vector<DnsRoute> routes;
+  if (options.direct) {
+    routes.push_back(DnsRoute::kDirect);
+  }
+  if (options.proxy_port != 0 && !options.proxy_ip.empty()) {
+    routes.push_back(DnsRoute::kTunnel);
+  }
+
+  std::vector<DnsBenchRun> runs;
+  for (DnsRoute route : routes) {
+    for (const DnsBenchTarget& target : targets) {
+      for (DnsTransport transport : transports) {
+        runs.push_back({target, transport, route});
+      }
+    }
+  }
+  return runs;
+}
+
+bool BuildDnsQuery(std::string_view domain, uint16_t id, std::string* query) {
+  if (!domain.empty() && domain.back() == '.') {
+    domain.remove_suffix(1);
+  }
+  if (domain.empty()) {
+    return false;
+  }
+  query->clear();
+  AppendUint16(query, id);
+  // RD; one question, no other records.
+  query->append("\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10);
+  size_t name_size = 0;
+  while (!domain.empty()) {
+    size_t dot = domain.find('.');
+    std::string_view label = domain.substr(0, dot);
+    if (label.empty() || label.size() > 63) {
+      return false;
+    }
+    query->push_back(static_cast<char>(label.size()));
+    query->append(label);
+    name_size += 1 + label.size();
+    domain.remove_prefix(dot == std::string_view::npos ? domain.size() : dot + 1);
+  }
+  if (name_size + 1 > 255) {
+    return false;
+  }
+  // Root, then QTYPE A and QCLASS IN.
+  query->append("\x00\x00\x01\x00\x01", 5);
+  return true;
+}
+
+bool ParseDnsResponse(const uint8_t* data, size_t size, uint16_t* id, uint8_t* rcode) {
+  if (size < 12 || (data[2] & 0x80) == 0) {
+    return false;
+  }
+  *id = static_cast<uint16_t>(data[0] << 8 | data[1]);
+  *rcode = data[3] & 0x0f;
+  return true;
+}
+
+DnsBenchProbe::DnsBenchProbe(const DnsBenchRun& run, const DnsBenchOptions& options)
+    : run_(run), proxy_ip_(options.proxy_ip) {
+  bool tunnel = run.route == DnsRoute::kTunnel;
+  bool udp = run.transport == DnsTransport::kUdp;
+  uses_stream_ = tunnel || !udp;
+  stream_ip_ = tunnel ? options.proxy_ip : run.target.address;
+  stream_port_ = tunnel ? options.proxy_port : run.target.port;
+  if (tunnel) {
+    // Version 5, one method: no authentication.
+    out_.assign("\x05\x01\x00", 3);
+    state_ = State::kGreeting;
+  } else {
+    state_ = State::kOpen;
+  }
+  if (udp && tunnel) {
+    // RSV, FRAG 0, then the destination.
+    udp_header_.assign("\x00\x00\x00", 3);
+    AppendSocksAddress(&udp_header_, run.target.address, run.target.port);
+  } else if (udp) {
+    datagram_ready_ = true;
+    datagram_ip_ = run.target.address;
+    datagram_port_ = run.target.port;
+  }
+
+  const std::vector<std::string> domains = options.domains.empty() ? DefaultDnsBenchDomains() : options.domains;
+  // IDs count up from a random start, so a late answer from an earlier run
+  // is unlikely to be taken for one of these.
+  auto next_id = static_cast<uint16_t>(std::random_device{}());
+  for (size_t round = 0; round < std::max<size_t>(options.repeat, 1); round++) {
+    for (const std::string& domain : domains) {
+      if (queries_.size() >= kMaxQueries) {
+        break;
+      }
+      Query query;
+      query.id = next_id++;
+      if (!BuildDnsQuery(domain, query.id, &query.packet)) {
+        continue;
+      }
+      query_index_[query.id] = queries_.size();
+      queries_.push_back(std::move(query));
+    }
+  }
+  if (!udp && !tunnel) {
+    QueueTcpQueries();
+  }
+}
+
+std::string_view DnsBenchProbe::output() const {
+  return std::string_view(out_).substr(out_sent_);
+}
+
+void DnsBenchProbe::OnSent(size_t size, DnsBenchClock::time_point now) {
+  size = std::min(size, out_.size() - out_sent_);
+  out_sent_ += size;
+  total_sent_ += size;
+  if (out_sent_ == out_.size()) {
+    out_.clear();
+    out_sent_ = 0;
+  }
+  if (run_.transport != DnsTransport::kTcp) {
+    return;
+  }
+  while (next_query_ < queries_.size() && queries_[next_query_].end != 0 &&
+         queries_[next_query_].end <= total_sent_) {
+    queries_[next_query_].sent = true;
+    queries_[next_query_].sent_at = now;
+    next_query_++;
+  }
+}
+
+bool DnsBenchProbe::OnReceived(const char* data, size_t size, DnsBenchClock::time_point now) {
+  if (state_ == State::kFailed) {
+    return false;
+  }
+  in_.append(data, size);
+  const auto* bytes = reinterpret_cast<const uint8_t*>(in_.data());
+  if (state_ == State::kGreeting) {
+    if (in_.size() < 2) {
+      return true;
+    }
+    if (bytes[0] != 0x05 || bytes[1] != 0x00) {
+      return Fail("The proxy refused the SOCKS5 greeting.");
+    }
+    in_.erase(0, 2);
+    // CONNECT to the server, or UDP ASSOCIATE from any local address.
+    if (run_.transport == DnsTransport::kUdp) {
+      out_.append("\x05\x03\x00\x01\x00\x00\x00\x00\x00\x00", 10);
+    } else {
+      out_.append("\x05\x01\x00", 3);
+      AppendSocksAddress(&out_, run_.target.address, run_.target.port);
+    }
+    state_ = State::kConnect;
+    bytes = reinterpret_cast<const uint8_t*>(in_.data());
+  }
+  if (state_ == State::kConnect) {
+    if (in_.size() < 3) {
+      return true;
+    }
+    if (bytes[0] != 0x05) {
+      return Fail("The proxy does not speak SOCKS5.");
+    }
+    if (bytes[1] != 0x00) {
+      return Fail(std::string("The proxy could not reach the server: ") + SocksReplyError(bytes[1]) + ".");
+    }
+    size_t address_size = SocksAddressSize(bytes + 3, in_.size() - 3);
+    if (address_size == 0) {
+      bool known_type = in_.size() < 4 || bytes[3] == 0x01 || bytes[3] == 0x03 || bytes[3] == 0x04;
+      return known_type || Fail("The proxy sent a malformed SOCKS5 reply.");
+    }
+    if (run_.transport == DnsTransport::kUdp) {
+      std::string relay_ip = FormatSocksAddress(bytes + 3, &datagram_port_);
+      datagram_ip_ = relay_ip.empty() ? proxy_ip_ : relay_ip;
+      datagram_ready_ = true;
+      in_.clear();
+      state_ = State::kOpen;
+      return true;
+    }
+    in_.erase(0, 3 + address_size);
+    state_ = State::kOpen;
+    QueueTcpQueries();
+  }
+
+  if (run_.transport == DnsTransport::kUdp) {
+    // The connection only holds the association open.
+    in_.clear();
+    return true;
+  }
+  size_t offset = 0;
+  while (in_.size() - offset >= 2) {
+    const auto* frame = reinterpret_cast<const uint8_t*>(in_.data() + offset);
+    size_t length = static_cast<size_t>(frame[0] << 8 | frame[1]);
+    if (in_.size() - offset - 2 < length) {
+      break;
+    }
+    OnAnswer(frame + 2, length, now);
+    offset += 2 + length;
+  }
+  in_.erase(0, offset);
+  return true;
+}
+
+void DnsBenchProbe::OnClosed() {
+  if (state_ == State::kFailed || complete()) {
+    return;
+  }
+  Fail(run_.route == DnsRoute::kTunnel ? "The proxy closed the connection." : "The server closed the connection.");
+}
+
+bool DnsBenchProbe::NextDatagram(DnsBenchClock::time_point now, std::string* datagram) {
+  if (!datagram_ready_ || state_ == State::kFailed || next_query_ >= queries_.size()) {
+    return false;
+  }
+  Query& query = queries_[next_query_++];
+  datagram->assign(udp_header_);
+  datagram->append(query.packet);
+  query.sent = true;
+  query.sent_at = now;
+  return true;
+}
+
+void DnsBenchProbe::OnDatagram(const char* data, size_t size, DnsBenchClock::time_point now) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+  if (run_.route == DnsRoute::kTunnel) {
+    if (size < 4 || bytes[2] != 0) {
+      return;
+    }
+    size_t address_size = SocksAddressSize(bytes + 3, size - 3);
+    if (address_size == 0) {
+      return;
+    }
+    bytes += 3 + address_size;
+    size -= 3 + address_size;
+  }
+  OnAnswer(bytes, size, now);
+}
+
+DnsBenchResult DnsBenchProbe::Finish() const {
+  DnsBenchResult result;
+  result.run = run_;
+  result.queries = queries_.size();
+  result.error = error_;
+  std::vector<int64_t> latencies;
+  for (const Query& query : queries_) {
+    if (!query.answered || IsFailure(query.rcode)) {
+      result.failures++;
+    } else {
+      latencies.push_back(query.latency_us);
+    }
+  }
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    result.p50_us = Percentile(latencies, 0.50);
+    result.p95_us = Percentile(latencies, 0.95);
+  }
+  return result;
+}
+
+bool DnsBenchProbe::Fail(std::string error) {
+  state_ = State::kFailed;
+  error_ = std::move(error);
+  return false;
+}
+
+void DnsBenchProbe::OnAnswer(const uint8_t* data, size_t size, DnsBenchClock::time_point now) {
+  uint16_t id;
+  uint8_t rcode;
+  if (!ParseDnsResponse(data, size, &id, &rcode)) {
+    return;
+  }
+  auto it = query_index_.find(id);
+  if (it == query_index_.end()) {
+    return;
+  }
+  Query& query = queries_[it->second];
+  if (!query.sent || query.answered) {
+    return;
+  }
+  query.answered = true;
+  query.rcode = rcode;
+  query.latency_us = std::chrono::duration_cast<std::chrono::microseconds>(now - query.sent_at).count();
+  answered_++;
+}
+
+void DnsBenchProbe::QueueTcpQueries() {
+  uint64_t queued = total_sent_ + (out_.size() - out_sent_);
+  for (Query& query : queries_) {
+    AppendUint16(&out_, static_cast<uint16_t>(query.packet.size()));
+    out_.append(query.packet);
+    queued += 2 + query.packet.size();
+    query.end = queued;
+  }
+}
+
+std::string PickDnsProvider(const std::vector<DnsBenchResult>& results, std::chrono::milliseconds timeout) {
+  bool tunnel = std::any_of(results.begin(), results.end(), [](const DnsBenchResult& result) {
+    return result.run.route == DnsRoute::kTunnel && result.p50_us >= 0;
+  });
+  DnsRoute route = tunnel ? DnsRoute::kTunnel : DnsRoute::kDirect;
+
+  // The run that counts for each provider, in the order they were tested.
+  std::vector<const DnsBenchResult*> chosen;
+  for (const DnsBenchResult& result : results) {
+    if (result.run.route != route || result.p50_us < 0) {
+      continue;
+    }
+    auto same = std::find_if(chosen.begin(), chosen.end(), [&](const DnsBenchResult* other) {
+      return other->run.target.provider == result.run.target.provider;
+    });
+    if (same == chosen.end()) {
+      chosen.push_back(&result);
+    } else if ((*same)->run.transport == DnsTransport::kUdp && result.run.transport == DnsTransport::kTcp) {
+      *same = &result;
+    }
+  }
+
+  const double timeout_us = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(timeout).count());
+  std::string winner;
+  double best = 0;
+  for (const DnsBenchResult* result : chosen) {
+    double failed = result->failure_rate();
+    double score = (1 - failed) * static_cast<double>(result->p50_us + result->p95_us) + failed * 2 * timeout_us;
+    if (winner.empty() || score < best) {
+      winner = result->run.target.provider;
+      best = score;
+    }
+  }
+  return winner;
+}
+
+std::string DnsNetworkKey(const std::string& interface_name, const std::string& gateway) {
+  return gateway.empty() ? interface_name : interface_name + " via " + gateway;
+}
+
+std::string DnsAutoSelector::Winner(const std::string& network) const {
+  auto it = winners_.find(network);
+  return it == winners_.end() ? std::string() : it->second;
+}
+
+void DnsAutoSelector::Record(const std::string& network, const std::string& provider) {
+  if (provider.empty()) {
+    return;
+  }
+  winners_[network] = provider;
+}
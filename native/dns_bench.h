@@ -0,0 +1,230 @@
+#ifndef NATIVE_DNS_BENCH_H_
+#define NATIVE_DNS_BENCH_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The DNS providers the config can point sing-box at, and a latency
+// benchmark of them shared by the runners' DNS benchmarkers. As with
+// speed_test.h, the runners own the sockets; the classes here only turn
+// received bytes into bytes to send and into figures.
+
+using DnsBenchClock = std::chrono::steady_clock;
+
+// The dns_provider value that asks the runner for the fastest provider on
+// the current network.
+constexpr std::string_view kAutoDnsProvider = "auto";
+
+struct DnsProviderInfo {
+  const char* name;
+  // IPv4 literal, port 53.
+  const char* address;
+};
+
+// google, cloudflare and adguard, in that order.
+const std::vector<DnsProviderInfo>& KnownDnsProviders();
+
+// The server of provider |name|. Google's for an unknown name, which
+// includes "auto" before any benchmark picked a winner.
+const char* DnsProviderAddress(std::string_view name);
+
+enum class DnsTransport : uint8_t { kUdp, kTcp };
+enum class DnsRoute : uint8_t {
+  // From this machine straight to the server.
+  kDirect,
+  // Through the mixed inbound, as sing-box itself would send it.
+  kTunnel,
+};
+
+// "udp" or "tcp".
+const char* DnsTransportName(DnsTransport transport);
+// "direct" or "tunnel".
+const char* DnsRouteName(DnsRoute route);
+
+// Popular names, so the resolvers answer from cache and the figures are
+// about the path rather than about recursion.
+std::vector<std::string> DefaultDnsBenchDomains();
+
+struct DnsBenchTarget {
+  std::string provider;
+  std::string address;
+  uint16_t port = 53;
+};
+
+struct DnsBenchOptions {
+  // Every known provider when empty.
+  std::vector<DnsBenchTarget> targets;
+  // DefaultDnsBenchDomains() when empty.
+  std::vector<std::string> domains;
+  // Queries per domain and run, all sent at once.
+  size_t repeat = 2;
+  bool udp = true;
+  bool tcp = true;
+  bool direct = true;
+  // IP literal and port of the mixed inbound. Tunnel runs are planned only
+  // when the port is set.
+  std::string proxy_ip;
+  uint16_t proxy_port = 0;
+  // How long a run waits for its answers; unanswered queries fail.
+  std::chrono::milliseconds timeout{2000};
+};
+
+// One provider over one transport and route.
+struct DnsBenchRun {
+  DnsBenchTarget target;
+  DnsTransport transport = DnsTransport::kTcp;
+  DnsRoute route = DnsRoute::kDirect;
+};
+
+// The runs |options| asks for: every target over every transport, direct
+// runs first, then tunnel runs.
+std::vector<DnsBenchRun> PlannedDnsBenchRuns(const DnsBenchOptions& options);
+
+struct DnsBenchResult {
+  DnsBenchRun run;
+  size_t queries = 0;
+  // Queries left unanswered or answered with SERVFAIL or REFUSED.
+  size_t failures = 0;
+  // From each query leaving to its answer, over the answered ones; -1
+  // without any.
+  int64_t p50_us = -1;
+  int64_t p95_us = -1;
+  // Why the run ended before every query was sent, e.g. a refused
+  // connection.
+  std::string error;
+
+  double failure_rate() const {
+    return queries > 0 ? static_cast<double>(failures) / static_cast<double>(queries) : 1;
+  }
+};
+
+// An A query for |domain| with recursion desired. Returns false for a name
+// that does not fit in DNS.
+bool BuildDnsQuery(std::string_view domain, uint16_t id, std::string* query);
+
+// The ID and RCODE of a response. Returns false for anything that is not
+// a DNS response.
+bool ParseDnsResponse(const uint8_t* data, size_t size, uint16_t* id, uint8_t* rcode);
+
+// One run's queries. For TCP they go back to back on one connection, each
+// behind its two-byte length, and are answered in any order. For UDP each
+// is a datagram of its own. Tunnel runs first greet the mixed inbound and
+// CONNECT to the server, or for UDP hold a UDP ASSOCIATE open on the
+// connection and wrap every datagram in the SOCKS5 UDP header. Connection
+// setup is not part of the latencies; sing-box keeps its DNS connection
+// open too.
+class DnsBenchProbe {
+ public:
+  DnsBenchProbe(const DnsBenchRun& run, const DnsBenchOptions& options);
+
+  DnsBenchProbe(const DnsBenchProbe&) = delete;
+  DnsBenchProbe& operator=(const DnsBenchProbe&) = delete;
+
+  // Whether the run needs a TCP connection, and where to. Only direct UDP
+  // runs go without.
+  bool uses_stream() const { return uses_stream_; }
+  const std::string& stream_ip() const { return stream_ip_; }
+  uint16_t stream_port() const { return stream_port_; }
+
+  // Bytes to send on the connection next; empty while it waits.
+  std::string_view output() const;
+  // The first |size| bytes of output() were sent.
+  void OnSent(size_t size, DnsBenchClock::time_point now);
+  // Returns false once the run has failed; error() says why.
+  bool OnReceived(const char* data, size_t size, DnsBenchClock::time_point now);
+  // The peer closed the connection.
+  void OnClosed();
+
+  // Whether datagrams can go out, and where to: the server for a direct
+  // run, the relay the proxy named for a tunnel run.
+  bool datagram_ready() const { return datagram_ready_; }
+  const std::string& datagram_ip() const { return datagram_ip_; }
+  uint16_t datagram_port() const { return datagram_port_; }
+  // Fills |datagram| with the next query. Returns false once all are out.
+  bool NextDatagram(DnsBenchClock::time_point now, std::string* datagram);
+  // Takes a datagram from the server or relay; strays are ignored.
+  void OnDatagram(const char* data, size_t size, DnsBenchClock::time_point now);
+
+  // Every query has its answer.
+  bool complete() const { return answered_ == queries_.size(); }
+  bool failed() const { return state_ == State::kFailed; }
+  const std::string& error() const { return error_; }
+
+  DnsBenchResult Finish() const;
+
+ private:
+  enum class State : uint8_t { kGreeting, kConnect, kOpen, kFailed };
+
+  struct Query {
+    uint16_t id;
+    std::string packet;
+    // Output offset just past the query, for TCP.
+    uint64_t end = 0;
+    bool sent = false;
+    DnsBenchClock::time_point sent_at;
+    bool answered = false;
+    uint8_t rcode = 0;
+    int64_t latency_us = 0;
+  };
+
+  bool Fail(std::string error);
+  void OnAnswer(const uint8_t* data, size_t size, DnsBenchClock::time_point now);
+  // Queues every query behind its length.
+  void QueueTcpQueries();
+
+  DnsBenchRun run_;
+  std::string proxy_ip_;
+  bool uses_stream_;
+  std::string stream_ip_;
+  uint16_t stream_port_;
+  State state_;
+  std::string error_;
+
+  std::string out_;
+  size_t out_sent_ = 0;
+  // Bytes of output sent since the start, for timing TCP queries.
+  uint64_t total_sent_ = 0;
+  std::string in_;
+
+  bool datagram_ready_ = false;
+  std::string datagram_ip_;
+  uint16_t datagram_port_ = 0;
+  std::string udp_header_;
+
+  std::vector<Query> queries_;
+  std::unordered_map<uint16_t, size_t> query_index_;
+  // The first query not yet sent.
+  size_t next_query_ = 0;
+  size_t answered_ = 0;
+};
+
+// The provider to use from |results|: the tunnel runs when there are any,
+// as that is how sing-box reaches it, else the direct ones; TCP over UDP
+// for the same reason. Each provider is scored by p50 plus p95 as if its
+// failed share of queries had taken |timeout|, and the lowest wins. Empty
+// when nothing was answered.
+std::string PickDnsProvider(const std::vector<DnsBenchResult>& results, std::chrono::milliseconds timeout);
+
+// Which network a winner belongs to, e.g. "wlan0 via 192.168.1.1".
+std::string DnsNetworkKey(const std::string& interface_name, const std::string& gateway);
+
+// The "auto" provider picked on each network this session. Not
+// thread-safe; each runner keeps it on its UI thread.
+class DnsAutoSelector {
+ public:
+  // The provider picked for |network|, or empty before a benchmark ran
+  // there.
+  std::string Winner(const std::string& network) const;
+  void Record(const std::string& network, const std::string& provider);
+
+ private:
+  std::map<std::string, std::string> winners_;
+};
+
+#endif  // NATIVE_DNS_BENCH_H_
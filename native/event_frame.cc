@@ -0,0 +1,112 @@
+#include "event_frame.h"
+
+#include <algorithm>
+#include <utility>
+
+void EventFrameWriter::BeginFrame(EventKind kind) {
+  frame_start_ = buffer_.size();
+  buffer_.resize(frame_start_ + kEventHeaderSize, 0);
+  buffer_[frame_start_] = static_cast<uint8_t>(kind);
+}
+
+void EventFrameWriter::PutBytes(const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  buffer_.insert(buffer_.end(), bytes, bytes + size);
+}
+
+void EventFrameWriter::PutU32(uint32_t value) {
+  size_t at = buffer_.size();
+  buffer_.resize(at + 4);
+  for (size_t i = 0; i < 4; i++) {
+    buffer_[at + i] = static_cast<uint8_t>(value >> (i * 8));
+  }
+}
+
+void EventFrameWriter::PutU64(uint64_t value) {
+  size_t at = buffer_.size();
+  buffer_.resize(at + 8);
+  for (size_t i = 0; i < 8; i++) {
+    buffer_[at + i] = static_cast<uint8_t>(value >> (i * 8));
+  }
+}
+
+void EventFrameWriter::EndFrame() {
+  auto size = static_cast<uint32_t>(frame_size());
+  for (int i = 0; i < 4; i++) {
+    buffer_[frame_start_ + 4 + static_cast<size_t>(i)] = static_cast<uint8_t>(size >> (i * 8));
+  }
+}
+
+void EventFrameWriter::CancelFrame() {
+  buffer_.resize(frame_start_);
+}
+
+void EventFrameWriter::AppendTrafficSample(const TrafficDelta& delta) {
+  BeginFrame(EventKind::kTrafficSample);
+  PutU64(delta.sequence);
+  PutU64(delta.key ? 1 : 0);
+  PutI64(delta.up);
+  PutI64(delta.down);
+  PutI64(delta.connections);
+  EndFrame();
+}
+
+void EventFrameWriter::AppendProbeResult(std::string_view id, int64_t rtt_us) {
+  BeginFrame(EventKind::kProbeResult);
+  PutI64(rtt_us);
+  PutBytes(id.data(), id.size());
+  EndFrame();
+}
+
+void EventFrameWriter::AppendConnectionDiff(const ConnectionDiff& diff) {
+  BeginFrame(EventKind::kConnectionDiff);
+  PutU64(diff.sequence);
+  PutU32(diff.reset ? 1 : 0);
+  PutU32(diff.total);
+  PutU32(static_cast<uint32_t>(diff.opened.size()));
+  PutU32(static_cast<uint32_t>(diff.closed.size()));
+  PutU32(static_cast<uint32_t>(diff.changed.size()));
+  PutU32(0);
+  auto put_string = [this](const std::string& value) {
+    // Cut at a UTF-8 boundary if it does not fit the count.
+    size_t size = std::min<size_t>(value.size(), UINT16_MAX);
+    while (size < value.size() && size > 0 && (static_cast<uint8_t>(value[size]) & 0xc0) == 0x80) {
+      size--;
+    }
+    buffer_.push_back(static_cast<uint8_t>(size));
+    buffer_.push_back(static_cast<uint8_t>(size >> 8));
+    PutBytes(value.data(), size);
+  };
+  for (const OpenedConnection& opened : diff.opened) {
+    PutU32(opened.handle);
+    size_t size_at = buffer_.size();
+    PutU32(0);
+    PutU64(opened.upload);
+    PutU64(opened.download);
+    for (const std::string* field : {&opened.id, &opened.start, &opened.network, &opened.inbound, &opened.source,
+                                     &opened.destination, &opened.host, &opened.process, &opened.rule,
+                                     &opened.chain}) {
+      put_string(*field);
+    }
+    auto size = static_cast<uint32_t>(buffer_.size() - size_at - 4);
+    for (size_t i = 0; i < 4; i++) {
+      buffer_[size_at + i] = static_cast<uint8_t>(size >> (i * 8));
+    }
+  }
+  for (uint32_t handle : diff.closed) {
+    PutU32(handle);
+  }
+  for (const ConnectionBytes& bytes : diff.changed) {
+    PutU32(bytes.handle);
+    PutU32(0);
+    PutI64(bytes.upload);
+    PutI64(bytes.download);
+  }
+  EndFrame();
+}
+
+std::vector<uint8_t> EventFrameWriter::Take() {
+  std::vector<uint8_t> frames = std::move(buffer_);
+  buffer_.clear();
+  return frames;
+}
@@ -0,0 +1,83 @@
+#ifndef NATIVE_EVENT_FRAME_H_
+#define NATIVE_EVENT_FRAME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "connection_table.h"
+#include "traffic_stats.h"
+
+// The framing of "com.hwl_vpn.app/events", the raw BinaryMessenger channel
+// the runners send their high-frequency events on, bypassing the standard
+// codec. Dart reads it with a BinaryCodec (see lib/services/native_events.dart).
+//
+// A message is one or more frames back to back. Every frame is an 8-byte
+// header followed by its payload; all integers are little-endian:
+//
+//   u8 kind | u8 reserved[3] | u32 payload size | payload
+//
+// kLogBatch      Whole sing-box lines, UTF-8, newline terminated.
+// kTrafficSample u64 seq | u8 key | u8 reserved[7] | i64 up | i64 down |
+//                i64 connections; a TrafficDelta.
+// kProbeResult   i64 rtt_us (-1 for no answer) | id, UTF-8, to the end of
+//                the payload.
+// kConnectionDiff
+//                u64 seq | u8 reset | u8 reserved[3] | u32 total |
+//                u32 opened | u32 closed | u32 changed | u32 reserved, then
+//                per opened connection u32 handle | u32 size of the rest |
+//                i64 upload | i64 download | id, start, network, inbound,
+//                source, destination, host, process, rule and chain, each a
+//                u16 byte count and UTF-8; per closed one u32 handle; per
+//                changed one u32 handle | u32 reserved | i64 upload |
+//                i64 download, the bytes since the previous diff. A
+//                ConnectionDiff.
+//
+// Unknown kinds are skipped by their size, so new kinds can be added
+// without breaking older readers.
+enum class EventKind : uint8_t {
+  kLogBatch = 1,
+  kTrafficSample = 2,
+  kProbeResult = 3,
+  kConnectionDiff = 4,
+};
+
+constexpr size_t kEventHeaderSize = 8;
+constexpr size_t kTrafficSampleSize = 40;
+
+// Appends frames to a buffer that is handed to the messenger as is, so
+// payloads are written straight into the outgoing message.
+class EventFrameWriter {
+ public:
+  // Starts a frame whose payload is whatever the Put calls append until
+  // EndFrame() or CancelFrame().
+  void BeginFrame(EventKind kind);
+  void PutBytes(const void* data, size_t size);
+  void PutU32(uint32_t value);
+  void PutU64(uint64_t value);
+  void PutI64(int64_t value) { PutU64(static_cast<uint64_t>(value)); }
+  // Fills in the open frame's size.
+  void EndFrame();
+  // Drops the open frame, e.g. a log batch that found nothing to drain.
+  void CancelFrame();
+  // Payload bytes of the open frame so far.
+  size_t frame_size() const { return buffer_.size() - frame_start_ - kEventHeaderSize; }
+
+  void AppendTrafficSample(const TrafficDelta& delta);
+  void AppendProbeResult(std::string_view id, int64_t rtt_us);
+  void AppendConnectionDiff(const ConnectionDiff& diff);
+
+  bool empty() const { return buffer_.empty(); }
+  const std::vector<uint8_t>& buffer() const { return buffer_; }
+  // Hands over the frames written so far and starts a new message.
+  std::vector<uint8_t> Take();
+  // Starts a new message, keeping the buffer's capacity.
+  void Clear() { buffer_.clear(); }
+
+ private:
+  std::vector<uint8_t> buffer_;
+  size_t frame_start_ = 0;
+};
+
+#endif  // NATIVE_EVENT_FRAME_H_
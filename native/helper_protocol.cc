@@ -0,0 +1,286 @@
+#include "helper_protocol.h"
+
+#include <cstring>
+#include <utility>
+
+void HelperFrameWriter::BeginFrame(HelperMessage kind) {
+  frame_start_ = buffer_.size();
+  buffer_.resize(frame_start_ + kHelperHeaderSize, '\0');
+  buffer_[frame_start_] = static_cast<char>(kind);
+}
+
+void HelperFrameWriter::PutU32(uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buffer_.push_back(static_cast<char>(value >> (i * 8)));
+  }
+}
+
+void HelperFrameWriter::PutU64(uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    buffer_.push_back(static_cast<char>(value >> (i * 8)));
+  }
+}
+
+void HelperFrameWriter::PutString(std::string_view value) {
+  PutU32(static_cast<uint32_t>(value.size()));
+  buffer_.append(value);
+}
+
+void HelperFrameWriter::PutStringList(const std::vector<std::string>& values) {
+  PutU32(static_cast<uint32_t>(values.size()));
+  for (const std::string& value : values) {
+    PutString(value);
+  }
+}
+
+void HelperFrameWriter::PutBytes(const void* data, size_t size) {
+  buffer_.append(static_cast<const char*>(data), size);
+}
+
+void HelperFrameWriter::EndFrame() {
+  auto size = static_cast<uint32_t>(buffer_.size() - frame_start_ - kHelperHeaderSize);
+  for (size_t i = 0; i < 4; i++) {
+    buffer_[frame_start_ + 4 + i] = static_cast<char>(size >> (i * 8));
+  }
+}
+
+void HelperFrameWriter::AppendHello(uint64_t session, uint64_t log_cursor) {
+  BeginFrame(HelperMessage::kHello);
+  PutU32(kHelperProtocolVersion);
+  PutU64(session);
+  PutU64(log_cursor);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendTunnelRequest(HelperMessage kind, uint32_t request, const HelperTunnelRequest& tunnel) {
+  BeginFrame(kind);
+  PutU32(request);
+  PutU8(tunnel.auto_restart ? 1 : 0);
+  PutI64(tunnel.memory_high);
+  PutI64(tunnel.memory_max);
+  PutI64(tunnel.cpu_max_percent);
+  PutString(tunnel.split_mode);
+  PutStringList(tunnel.split_apps);
+  PutString(tunnel.link);
+  PutString(tunnel.settings.dns_provider);
+  PutU8(tunnel.settings.enable_logging ? 1 : 0);
+  PutU8(tunnel.settings.use_mixed_inbound ? 1 : 0);
+  PutString(tunnel.settings.mixed_inbound_listen_address);
+  PutI64(tunnel.settings.mixed_inbound_listen_port);
+  PutStringList(tunnel.settings.excluded_domains);
+  PutStringList(tunnel.settings.excluded_domain_suffixes);
+  PutI64(tunnel.settings.clash_api_port);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendStop(uint32_t request) {
+  BeginFrame(HelperMessage::kStop);
+  PutU32(request);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendWelcome(uint64_t session, HelperTunnelState state, uint64_t log_next) {
+  BeginFrame(HelperMessage::kWelcome);
+  PutU32(kHelperProtocolVersion);
+  PutU64(session);
+  PutU8(static_cast<uint8_t>(state));
+  PutU64(log_next);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendResult(uint32_t request, const HelperResult& result) {
+  BeginFrame(HelperMessage::kResult);
+  PutU32(request);
+  PutU8(result.ok ? 1 : 0);
+  PutU8(static_cast<uint8_t>(result.path));
+  PutI64(result.elapsed_ms);
+  PutStringList(result.sections);
+  PutString(result.text);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendState(HelperTunnelState state, bool confirmed) {
+  BeginFrame(HelperMessage::kState);
+  PutU8(static_cast<uint8_t>(state));
+  PutU8(confirmed ? 1 : 0);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendLog(uint64_t first_line, std::string_view lines) {
+  BeginFrame(HelperMessage::kLog);
+  PutU64(first_line);
+  buffer_.append(lines);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendTrafficSample(const TrafficDelta& delta) {
+  BeginFrame(HelperMessage::kTrafficSample);
+  PutU64(delta.sequence);
+  PutU8(delta.key ? 1 : 0);
+  PutI64(delta.up);
+  PutI64(delta.down);
+  PutI64(delta.connections);
+  EndFrame();
+}
+
+void HelperFrameWriter::AppendRestart(const RestartEvent& event) {
+  BeginFrame(HelperMessage::kRestart);
+  PutU8(static_cast<uint8_t>(event.kind));
+  PutU32(event.crashes);
+  PutU32(event.attempt);
+  PutI64(event.delay_ms);
+  PutI64(event.recovery_ms);
+  PutU32(event.stats.restarts);
+  PutU32(event.stats.recoveries);
+  PutI64(event.stats.last_recovery_ms);
+  PutI64(event.stats.max_recovery_ms);
+  PutI64(event.stats.total_recovery_ms);
+  PutString(event.exit_status);
+  EndFrame();
+}
+
+bool HelperPayloadReader::Take(size_t size, const char** data) {
+  if (!ok_ || payload_.size() - position_ < size) {
+    ok_ = false;
+    return false;
+  }
+  *data = payload_.data() + position_;
+  position_ += size;
+  return true;
+}
+
+uint8_t HelperPayloadReader::ReadU8() {
+  const char* data;
+  return Take(1, &data) ? static_cast<uint8_t>(data[0]) : 0;
+}
+
+uint32_t HelperPayloadReader::ReadU32() {
+  const char* data;
+  if (!Take(4, &data)) {
+    return 0;
+  }
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+  }
+  return value;
+}
+
+uint64_t HelperPayloadReader::ReadU64() {
+  const char* data;
+  if (!Take(8, &data)) {
+    return 0;
+  }
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+  }
+  return value;
+}
+
+std::string HelperPayloadReader::ReadString() {
+  uint32_t size = ReadU32();
+  const char* data;
+  return Take(size, &data) ? std::string(data, size) : std::string();
+}
+
+std::vector<std::string> HelperPayloadReader::ReadStringList() {
+  uint32_t count = ReadU32();
+  std::vector<std::string> items;
+  // Each item takes at least its length, so a bogus count fails fast.
+  for (uint32_t i = 0; i < count && ok_; i++) {
+    items.push_back(ReadString());
+  }
+  return items;
+}
+
+std::string_view HelperPayloadReader::Rest() {
+  std::string_view rest = ok_ ? payload_.substr(position_) : std::string_view();
+  position_ = payload_.size();
+  return rest;
+}
+
+bool HelperFrameReader::Next(HelperMessage* kind, std::string* payload) {
+  if (broken_ || buffer_.size() - position_ < kHelperHeaderSize) {
+    return false;
+  }
+  const char* header = buffer_.data() + position_;
+  uint32_t size = 0;
+  for (int i = 0; i < 4; i++) {
+    size |= static_cast<uint32_t>(static_cast<uint8_t>(header[4 + i])) << (i * 8);
+  }
+  if (size > kHelperMaxFrameSize) {
+    broken_ = true;
+    return false;
+  }
+  if (buffer_.size() - position_ - kHelperHeaderSize < size) {
+    // Keep the partial frame at the front for the next read.
+    buffer_.erase(0, position_);
+    position_ = 0;
+    return false;
+  }
+  *kind = static_cast<HelperMessage>(header[0]);
+  payload->assign(header + kHelperHeaderSize, size);
+  position_ += kHelperHeaderSize + size;
+  if (position_ == buffer_.size()) {
+    buffer_.clear();
+    position_ = 0;
+  }
+  return true;
+}
+
+bool ReadTunnelRequest(HelperPayloadReader* reader, HelperTunnelRequest* tunnel) {
+  tunnel->auto_restart = reader->ReadU8() != 0;
+  tunnel->memory_high = reader->ReadI64();
+  tunnel->memory_max = reader->ReadI64();
+  tunnel->cpu_max_percent = reader->ReadI64();
+  tunnel->split_mode = reader->ReadString();
+  tunnel->split_apps = reader->ReadStringList();
+  tunnel->link = reader->ReadString();
+  tunnel->settings.dns_provider = reader->ReadString();
+  tunnel->settings.enable_logging = reader->ReadU8() != 0;
+  tunnel->settings.use_mixed_inbound = reader->ReadU8() != 0;
+  tunnel->settings.mixed_inbound_listen_address = reader->ReadString();
+  tunnel->settings.mixed_inbound_listen_port = reader->ReadI64();
+  tunnel->settings.excluded_domains = reader->ReadStringList();
+  tunnel->settings.excluded_domain_suffixes = reader->ReadStringList();
+  tunnel->settings.clash_api_port = reader->ReadI64();
+  return reader->ok();
+}
+
+bool ReadResult(HelperPayloadReader* reader, HelperResult* result) {
+  result->ok = reader->ReadU8() != 0;
+  uint8_t path = reader->ReadU8();
+  result->path = path <= static_cast<uint8_t>(ReloadPath::kRestart) ? static_cast<ReloadPath>(path)
+                                                                     : ReloadPath::kRestart;
+  result->elapsed_ms = reader->ReadI64();
+  result->sections = reader->ReadStringList();
+  result->text = reader->ReadString();
+  return reader->ok();
+}
+
+bool ReadTrafficSample(HelperPayloadReader* reader, TrafficDelta* delta) {
+  delta->sequence = reader->ReadU64();
+  delta->key = reader->ReadU8() != 0;
+  delta->up = reader->ReadI64();
+  delta->down = reader->ReadI64();
+  delta->connections = reader->ReadI64();
+  return reader->ok();
+}
+
+bool ReadRestart(HelperPayloadReader* reader, RestartEvent* event) {
+  uint8_t kind = reader->ReadU8();
+  event->kind = kind <= static_cast<uint8_t>(RestartEvent::Kind::kGaveUp) ? static_cast<RestartEvent::Kind>(kind)
+                                                                          : RestartEvent::Kind::kGaveUp;
+  event->crashes = reader->ReadU32();
+  event->attempt = reader->ReadU32();
+  event->delay_ms = reader->ReadI64();
+  event->recovery_ms = reader->ReadI64();
+  event->stats.restarts = reader->ReadU32();
+  event->stats.recoveries = reader->ReadU32();
+  event->stats.last_recovery_ms = reader->ReadI64();
+  event->stats.max_recovery_ms = reader->ReadI64();
+  event->stats.total_recovery_ms = reader->ReadI64();
+  event->exit_status = reader->ReadString();
+  return reader->ok();
+}
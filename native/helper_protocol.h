@@ -0,0 +1,201 @@
+#ifndef NATIVE_HELPER_PROTOCOL_H_
+#define NATIVE_HELPER_PROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config_builder.h"
+#include "config_diff.h"
+#include "restart_policy.h"
+#include "traffic_stats.h"
+
+// The protocol between the UI and the privileged tunnel helper, which owns
+// sing-box so the UI can run unprivileged and come and go while the tunnel
+// stays up.
+//
+// Both directions are a stream of frames with the same header as the event
+// channel's (see event_frame.h), all integers little-endian:
+//
+//   u8 kind | u8 reserved[3] | u32 payload size | payload
+//
+// Payloads are the fields listed below, in order. A string is a u32 byte
+// count and the bytes; a list is a u32 count and its items. Fields added to
+// the end of a payload are ignored by older readers, and frames of unknown
+// kinds are skipped by their size.
+//
+// The UI opens with kHello and the helper answers kWelcome, then replays
+// the log from the hello's cursor and follows with live events. Requests
+// carry an id that their kResult echoes.
+enum class HelperMessage : uint8_t {
+  // UI to helper.
+  // u32 version | u64 session | u64 log cursor
+  kHello = 1,
+  // u32 request | HelperTunnelRequest
+  kStart = 2,
+  // u32 request
+  kStop = 3,
+  // u32 request | HelperTunnelRequest; applied like ProcessManager::Reload.
+  kReload = 4,
+  // u32 request | HelperTunnelRequest; answered once "sing-box check" is
+  // done with the config it builds.
+  kPrepare = 5,
+
+  // Helper to UI.
+  // u32 version | u64 session | u8 HelperTunnelState | u64 log next
+  kWelcome = 64,
+  // u32 request | HelperResult
+  kResult = 65,
+  // u8 HelperTunnelState | u8 confirmed
+  kState = 66,
+  // u64 first line id | whole lines, UTF-8, to the end of the payload
+  kLog = 67,
+  // u64 seq | u8 key | i64 up | i64 down | i64 connections; a TrafficDelta
+  kTrafficSample = 68,
+  // u8 kind | u32 crashes | u32 attempt | i64 delay_ms | i64 recovery_ms |
+  // u32 restarts | u32 recoveries | i64 last, max and total recovery ms |
+  // string exit status; a RestartEvent
+  kRestart = 69,
+};
+
+constexpr uint32_t kHelperProtocolVersion = 2;
+constexpr size_t kHelperHeaderSize = 8;
+// Larger frames are a broken peer; configs are well under this.
+constexpr size_t kHelperMaxFrameSize = 16 * 1024 * 1024;
+// A kHello log cursor for "everything the helper still has".
+constexpr uint64_t kHelperLogFromOldest = 0;
+// The kResult text of a kReload while sing-box is not running.
+constexpr char kHelperNotRunning[] = "sing-box is not running.";
+
+// The system socket of the helper's systemd unit. HWL_HELPER_SOCKET
+// overrides it on both ends.
+constexpr char kHelperSocketPath[] = "/run/hwl-vpn/helper.sock";
+
+enum class HelperTunnelState : uint8_t {
+  kStopped,
+  // Spawned, waiting for sing-box to be ready.
+  kStarting,
+  kRunning,
+};
+
+// What kStart, kReload and kPrepare carry: the settings the UI used to
+// apply itself, and the link and settings the helper builds the sing-box
+// config from with its own ConfigBuilder. The UI never sends a config, as
+// one runs as root and could name any file to write, in log.output say.
+//
+// On the wire, after the split apps: string link | string dns_provider |
+// u8 enable_logging | u8 use_mixed_inbound | string listen address |
+// i64 listen port | list excluded domains | list excluded suffixes |
+// i64 clash_api_port. The rule_set_directory is the helper's and is not
+// sent.
+struct HelperTunnelRequest {
+  bool auto_restart = true;
+  // CgroupLimits; negative or zero for no limit.
+  int64_t memory_high = -1;
+  int64_t memory_max = -1;
+  int64_t cpu_max_percent = 0;
+  // per_app_proxy_mode, empty when per-app proxying is disabled, and the
+  // executables it lists.
+  std::string split_mode;
+  std::vector<std::string> split_apps;
+  std::string link;
+  ConfigSettings settings;
+};
+
+// The answer to a request. |ok| is whether it was carried out; for
+// kPrepare whether the config passed the check, with its output in |text|,
+// for the others |text| is the error. kReload also fills in the
+// ReloadResult fields.
+struct HelperResult {
+  bool ok = false;
+  ReloadPath path = ReloadPath::kUnchanged;
+  int64_t elapsed_ms = 0;
+  std::vector<std::string> sections;
+  std::string text;
+};
+
+// Appends frames to an outgoing buffer.
+class HelperFrameWriter {
+ public:
+  void BeginFrame(HelperMessage kind);
+  void PutU8(uint8_t value) { buffer_.push_back(static_cast<char>(value)); }
+  void PutU32(uint32_t value);
+  void PutU64(uint64_t value);
+  void PutI64(int64_t value) { PutU64(static_cast<uint64_t>(value)); }
+  void PutString(std::string_view value);
+  void PutStringList(const std::vector<std::string>& values);
+  void PutBytes(const void* data, size_t size);
+  // Fills in the open frame's size.
+  void EndFrame();
+
+  void AppendHello(uint64_t session, uint64_t log_cursor);
+  void AppendTunnelRequest(HelperMessage kind, uint32_t request, const HelperTunnelRequest& tunnel);
+  void AppendStop(uint32_t request);
+  void AppendWelcome(uint64_t session, HelperTunnelState state, uint64_t log_next);
+  void AppendResult(uint32_t request, const HelperResult& result);
+  void AppendState(HelperTunnelState state, bool confirmed);
+  void AppendLog(uint64_t first_line, std::string_view lines);
+  void AppendTrafficSample(const TrafficDelta& delta);
+  void AppendRestart(const RestartEvent& event);
+
+  bool empty() const { return buffer_.empty(); }
+  size_t size() const { return buffer_.size(); }
+  const std::string& buffer() const { return buffer_; }
+  // Drops the first |size| bytes, once they have been sent.
+  void Consume(size_t size) { buffer_.erase(0, size); }
+
+ private:
+  std::string buffer_;
+  size_t frame_start_ = 0;
+};
+
+// Reads the fields of one payload. A read past the end fails and leaves
+// the reader failed, so a run of reads can be checked once with ok().
+class HelperPayloadReader {
+ public:
+  explicit HelperPayloadReader(std::string_view payload) : payload_(payload) {}
+
+  uint8_t ReadU8();
+  uint32_t ReadU32();
+  uint64_t ReadU64();
+  int64_t ReadI64() { return static_cast<int64_t>(ReadU64()); }
+  std::string ReadString();
+  std::vector<std::string> ReadStringList();
+  // Whatever is left.
+  std::string_view Rest();
+
+  bool ok() const { return ok_; }
+
+ private:
+  bool Take(size_t size, const char** data);
+
+  std::string_view payload_;
+  size_t position_ = 0;
+  bool ok_ = true;
+};
+
+// Splits a byte stream into frames.
+class HelperFrameReader {
+ public:
+  // Adds bytes read from the socket.
+  void Append(const char* data, size_t size) { buffer_.append(data, size); }
+  // Moves the next complete frame's kind and payload out. False when none
+  // is complete yet, or when the stream is broken().
+  bool Next(HelperMessage* kind, std::string* payload);
+  // A frame claimed more than kHelperMaxFrameSize.
+  bool broken() const { return broken_; }
+
+ private:
+  std::string buffer_;
+  size_t position_ = 0;
+  bool broken_ = false;
+};
+
+bool ReadTunnelRequest(HelperPayloadReader* reader, HelperTunnelRequest* tunnel);
+bool ReadResult(HelperPayloadReader* reader, HelperResult* result);
+bool ReadTrafficSample(HelperPayloadReader* reader, TrafficDelta* delta);
+bool ReadRestart(HelperPayloadReader* reader, RestartEvent* event);
+
+#endif  // NATIVE_HELPER_PROTOCOL_H_
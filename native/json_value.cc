@@ -0,0 +1,132 @@
+#include "json_value.h"
+
+#include <algorithm>
+
+JsonValue JsonValue::Array() {
+  JsonValue value;
+  value.type_ = Type::kArray;
+  return value;
+}
+
+JsonValue JsonValue::Object() {
+  JsonValue value;
+  value.type_ = Type::kObject;
+  return value;
+}
+
+JsonValue JsonValue::StringArray(const std::vector<std::string>& items) {
+  JsonValue value = Array();
+  value.items_.reserve(items.size());
+  for (const std::string& item : items) {
+    value.items_.emplace_back(item);
+  }
+  return value;
+}
+
+JsonValue& JsonValue::Set(const std::string& key, JsonValue value) {
+  for (auto& member : members_) {
+    if (member.first == key) {
+      member.second = std::move(value);
+      return member.second;
+    }
+  }
+  members_.emplace_back(key, std::move(value));
+  return members_.back().second;
+}
+
+JsonValue& JsonValue::Append(JsonValue value) {
+  items_.push_back(std::move(value));
+  return items_.back();
+}
+
+void JsonValue::Insert(size_t index, JsonValue value) {
+  items_.insert(items_.begin() + static_cast<std::ptrdiff_t>(std::min(index, items_.size())), std::move(value));
+}
+
+void JsonValue::Serialize(std::string* out) const {
+  switch (type_) {
+    case Type::kNull:
+      out->append("null");
+      break;
+    case Type::kBool:
+      out->append(bool_ ? "true" : "false");
+      break;
+    case Type::kInt:
+      out->append(std::to_string(int_));
+      break;
+    case Type::kString:
+      SerializeString(string_, out);
+      break;
+    case Type::kArray:
+      out->push_back('[');
+      for (size_t i = 0; i < items_.size(); i++) {
+        if (i > 0) {
+          out->push_back(',');
+        }
+        items_[i].Serialize(out);
+      }
+      out->push_back(']');
+      break;
+    case Type::kObject:
+      out->push_back('{');
+      for (size_t i = 0; i < members_.size(); i++) {
+        if (i > 0) {
+          out->push_back(',');
+        }
+        SerializeString(members_[i].first, out);
+        out->push_back(':');
+        members_[i].second.Serialize(out);
+      }
+      out->push_back('}');
+      break;
+  }
+}
+
+std::string JsonValue::ToString() const {
+  std::string out;
+  Serialize(&out);
+  return out;
+}
+
+void JsonValue::SerializeString(const std::string& value, std::string* out) {
+  static const char kHex[] = "0123456789abcdef";
+  out->push_back('"');
+  size_t run_start = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(value[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out->append(value, run_start, i - run_start);
+    run_start = i + 1;
+    out->push_back('\\');
+    switch (c) {
+      case '\b':
+        out->push_back('b');
+        break;
+      case '\t':
+        out->push_back('t');
+        break;
+      case '\n':
+        out->push_back('n');
+        break;
+      case '\f':
+        out->push_back('f');
+        break;
+      case '\r':
+        out->push_back('r');
+        break;
+      case '"':
+      case '\\':
+        out->push_back(static_cast<char>(c));
+        break;
+      default:
+        out->append("u00");
+        out->push_back(kHex[c >> 4]);
+        out->push_back(kHex[c & 0xf]);
+        break;
+    }
+  }
+  out->append(value, run_start, value.size() - run_start);
+  out->push_back('"');
+}
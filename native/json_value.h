@@ -0,0 +1,58 @@
+#ifndef NATIVE_JSON_VALUE_H_
+#define NATIVE_JSON_VALUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A JSON document node for building configs.
+//
+// Objects keep their keys in insertion order, like Dart's map literals, so
+// Serialize() can produce exactly what jsonEncode() does for the same
+// structure. Only what the runners write is supported: there is no parser
+// and no floating point.
+class JsonValue {
+ public:
+  enum class Type : uint8_t { kNull, kBool, kInt, kString, kArray, kObject };
+
+  JsonValue() = default;
+  JsonValue(std::nullptr_t) {}
+  JsonValue(bool value) : type_(Type::kBool), bool_(value) {}
+  JsonValue(int value) : type_(Type::kInt), int_(value) {}
+  JsonValue(int64_t value) : type_(Type::kInt), int_(value) {}
+  JsonValue(const char* value) : type_(Type::kString), string_(value) {}
+  JsonValue(std::string value) : type_(Type::kString), string_(std::move(value)) {}
+
+  static JsonValue Array();
+  static JsonValue Object();
+  static JsonValue StringArray(const std::vector<std::string>& items);
+
+  Type type() const { return type_; }
+
+  // Objects only. Replaces the value of an existing |key| in place.
+  JsonValue& Set(const std::string& key, JsonValue value);
+  // Arrays only.
+  JsonValue& Append(JsonValue value);
+  // Arrays only.
+  void Insert(size_t index, JsonValue value);
+
+  // Appends the compact encoding to |out|. Strings are escaped the way
+  // dart:convert does it: quote, backslash and control characters, with
+  // everything else, including non-ASCII UTF-8, written as is.
+  void Serialize(std::string* out) const;
+  std::string ToString() const;
+
+ private:
+  static void SerializeString(const std::string& value, std::string* out);
+
+  Type type_ = Type::kNull;
+  bool bool_ = false;
+  int64_t int_ = 0;
+  std::string string_;
+  std::vector<JsonValue> items_;
+  std::vector<std::pair<std::string, JsonValue>> members_;
+};
+
+#endif  // NATIVE_JSON_VALUE_H_
@@ -0,0 +1,139 @@
+#include "latency_probe.h"
+
+#include <random>
+
+namespace {
+
+constexpr size_t kQuicProbeSize = 1200;
+// Matches the 0x?a?a?a?a pattern RFC 9000 reserves for forcing version
+// negotiation.
+constexpr uint32_t kQuicReservedVersion = 0x1a2a3a4a;
+
+void AppendRandom(std::string* out, size_t count) {
+  thread_local std::mt19937_64 generator{std::random_device{}()};
+  for (size_t i = 0; i < count; i++) {
+    out->push_back(static_cast<char>(generator() & 0xff));
+  }
+}
+
+void AppendUint8(std::string* out, uint32_t value) {
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+void AppendUint16(std::string* out, uint32_t value) {
+  AppendUint8(out, value >> 8);
+  AppendUint8(out, value);
+}
+
+void AppendUint24(std::string* out, uint32_t value) {
+  AppendUint8(out, value >> 16);
+  AppendUint16(out, value);
+}
+
+void AppendUint32(std::string* out, uint32_t value) {
+  AppendUint16(out, value >> 16);
+  AppendUint16(out, value);
+}
+
+// Appends extension |type| with |body| as its data.
+void AppendExtension(std::string* out, uint16_t type, const std::string& body) {
+  AppendUint16(out, type);
+  AppendUint16(out, static_cast<uint32_t>(body.size()));
+  out->append(body);
+}
+
+}  // namespace
+
+bool ParseProbeProtocol(std::string_view name, ProbeProtocol* protocol) {
+  if (name == "tcp") {
+    *protocol = ProbeProtocol::kTcp;
+  } else if (name == "tls") {
+    *protocol = ProbeProtocol::kTls;
+  } else if (name == "quic") {
+    *protocol = ProbeProtocol::kQuic;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::string BuildTlsClientHello(std::string_view sni) {
+  static const uint16_t kCipherSuites[] = {0x1301, 0x1302, 0x1303, 0xc02b, 0xc02f, 0xc02c, 0xc030, 0xcca9, 0xcca8};
+  static const uint16_t kSignatureAlgorithms[] = {0x0403, 0x0804, 0x0401, 0x0503, 0x0805, 0x0501, 0x0806, 0x0601};
+
+  std::string extensions;
+  if (!sni.empty()) {
+    std::string server_name;
+    AppendUint16(&server_name, static_cast<uint32_t>(sni.size() + 3));
+    AppendUint8(&server_name, 0);  // host_name
+    AppendUint16(&server_name, static_cast<uint32_t>(sni.size()));
+    server_name.append(sni);
+    AppendExtension(&extensions, 0x0000, server_name);
+  }
+  std::string groups;
+  AppendUint16(&groups, 4);
+  AppendUint16(&groups, 0x001d);  // x25519
+  AppendUint16(&groups, 0x0017);  // secp256r1
+  AppendExtension(&extensions, 0x000a, groups);
+  AppendExtension(&extensions, 0x000b, std::string("\x01\x00", 2));
+  std::string signatures;
+  AppendUint16(&signatures, sizeof(kSignatureAlgorithms));
+  for (uint16_t algorithm : kSignatureAlgorithms) {
+    AppendUint16(&signatures, algorithm);
+  }
+  AppendExtension(&extensions, 0x000d, signatures);
+  AppendExtension(&extensions, 0x002b, std::string("\x04\x03\x04\x03\x03", 5));
+  AppendExtension(&extensions, 0x002d, std::string("\x01\x01", 2));
+  // Any 32 bytes are a usable x25519 public key.
+  std::string key_share;
+  AppendUint16(&key_share, 36);
+  AppendUint16(&key_share, 0x001d);
+  AppendUint16(&key_share, 32);
+  AppendRandom(&key_share, 32);
+  AppendExtension(&extensions, 0x0033, key_share);
+
+  std::string hello;
+  AppendUint16(&hello, 0x0303);
+  AppendRandom(&hello, 32);
+  // A session id keeps middleboxes happy (RFC 8446, appendix D.4).
+  AppendUint8(&hello, 32);
+  AppendRandom(&hello, 32);
+  AppendUint16(&hello, sizeof(kCipherSuites));
+  for (uint16_t suite : kCipherSuites) {
+    AppendUint16(&hello, suite);
+  }
+  AppendUint8(&hello, 1);
+  AppendUint8(&hello, 0);
+  AppendUint16(&hello, static_cast<uint32_t>(extensions.size()));
+  hello.append(extensions);
+
+  std::string record;
+  AppendUint8(&record, 0x16);
+  AppendUint16(&record, 0x0301);
+  AppendUint16(&record, static_cast<uint32_t>(hello.size() + 4));
+  AppendUint8(&record, 0x01);  // client_hello
+  AppendUint24(&record, static_cast<uint32_t>(hello.size()));
+  record.append(hello);
+  return record;
+}
+
+bool IsTlsRecord(const uint8_t* data, size_t size) {
+  return size >= 3 && (data[0] == 0x15 || data[0] == 0x16) && data[1] == 0x03;
+}
+
+std::string BuildQuicVersionProbe() {
+  std::string packet;
+  packet.reserve(kQuicProbeSize);
+  AppendUint8(&packet, 0xc0);  // Long header, fixed bit.
+  AppendUint32(&packet, kQuicReservedVersion);
+  AppendUint8(&packet, 8);
+  AppendRandom(&packet, 8);  // Destination connection id.
+  AppendUint8(&packet, 8);
+  AppendRandom(&packet, 8);  // Source connection id.
+  packet.resize(kQuicProbeSize, '\0');
+  return packet;
+}
+
+bool IsQuicVersionNegotiation(const uint8_t* data, size_t size) {
+  return size >= 7 && (data[0] & 0x80) != 0 && data[1] == 0 && data[2] == 0 && data[3] == 0 && data[4] == 0;
+}
@@ -0,0 +1,54 @@
+#ifndef NATIVE_LATENCY_PROBE_H_
+#define NATIVE_LATENCY_PROBE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Protocol-level reachability checks for servers, shared by the runners'
+// probers. Each probe is a single round trip that only a live proxy port
+// answers, unlike ICMP.
+
+enum class ProbeProtocol : uint8_t {
+  // Time to complete the TCP handshake.
+  kTcp,
+  // TCP handshake, then a ClientHello the server must answer with a TLS
+  // record. Timed to the handshake, so it compares with kTcp.
+  kTls,
+  // A QUIC long-header packet with a reserved version. Servers answer with
+  // Version Negotiation (RFC 9000, section 6); timed to that answer.
+  kQuic,
+};
+
+// "tcp", "tls" or "quic"; false for anything else.
+bool ParseProbeProtocol(std::string_view name, ProbeProtocol* protocol);
+
+// One endpoint to probe, as Dart sends it in probeServers.
+struct ProbeTarget {
+  std::string id;
+  std::string ip;
+  uint16_t port = 0;
+  ProbeProtocol protocol = ProbeProtocol::kTcp;
+  // Server name for the ClientHello; may be empty.
+  std::string sni;
+};
+
+// Microseconds, or kProbeFailed when the endpoint did not answer in time.
+constexpr int64_t kProbeFailed = -1;
+
+// A TLS 1.3 ClientHello record offering x25519, with |sni| when not empty.
+// The key share and randoms are fresh per call.
+std::string BuildTlsClientHello(std::string_view sni);
+
+// Whether |data| starts like a TLS handshake or alert record. Either means
+// a TLS server read the ClientHello.
+bool IsTlsRecord(const uint8_t* data, size_t size);
+
+// A 1200-byte datagram: the smallest size servers must answer.
+std::string BuildQuicVersionProbe();
+
+// Whether |data| is a QUIC Version Negotiation packet.
+bool IsQuicVersionNegotiation(const uint8_t* data, size_t size);
+
+#endif  // NATIVE_LATENCY_PROBE_H_
@@ -0,0 +1,58 @@
+#ifndef NATIVE_LOG_INDEX_H_
+#define NATIVE_LOG_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Case-insensitive trigram index over the lines of one LogStore arena.
+//
+// Lines are grouped into blocks of kLinesPerBlock and the index maps each
+// trigram to the blocks containing it, one 32-bit entry per pair, which keeps
+// it near the size of the text it covers. Lines past the last block share
+// it. Candidate blocks still have to be verified line by line. Each
+// block also records which log levels occur in it, so level-filtered
+// searches skip whole blocks.
+//
+// While its arena is being filled the index only collects trigrams in a
+// shared pending buffer; Seal() sorts them into the compact form.
+class LogArenaIndex {
+ public:
+  static constexpr size_t kLinesPerBlock = 16;
+  static constexpr size_t kMaxBlocks = 256;
+
+  // First and end line index of |block| in an arena of |line_count| lines.
+  static size_t BlockBegin(uint32_t block) { return block * kLinesPerBlock; }
+  static size_t BlockEnd(uint32_t block, size_t line_count);
+
+  // Adds line |index| of the arena. |pending| is the store-wide buffer for
+  // the arena currently being filled.
+  void AddLine(size_t index, uint8_t level, const char* data, size_t size, std::vector<uint32_t>* pending);
+  // Builds the searchable index from |pending| and clears it.
+  void Seal(std::vector<uint32_t>* pending);
+  void Clear();
+
+  bool sealed() const { return sealed_; }
+
+  // Replaces |blocks| with the ascending blocks that contain every trigram in
+  // |trigrams| and at least one line whose level bit is set in |level_mask|.
+  void CandidateBlocks(const std::vector<uint32_t>& trigrams, uint32_t level_mask,
+                       std::vector<uint32_t>* blocks) const;
+
+ private:
+  // (trigram << 8) | block, sorted and unique once sealed.
+  std::vector<uint32_t> entries_;
+  // Bit |level| set when a line of that level is in the block.
+  std::vector<uint8_t> block_levels_;
+  bool sealed_ = false;
+};
+
+// ASCII lower-casing used for both indexing and matching.
+inline char FoldLogChar(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Distinct case-folded trigrams of |data|, sorted.
+std::vector<uint32_t> LogTrigrams(const char* data, size_t size);
+
+#endif  // NATIVE_LOG_INDEX_H_
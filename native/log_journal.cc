@@ -0,0 +1,351 @@
+#include "log_journal.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr uint32_t kJournalMagic = 0x4A4C5748;  // "HWLJ"
+constexpr uint32_t kJournalVersion = 1;
+
+// First bytes of every segment file; line data follows.
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sequence;
+  // Bytes of line data visible to readers.
+  uint64_t committed;
+  uint8_t reserved[40];
+};
+static_assert(sizeof(SegmentHeader) == 64, "segment header layout changed");
+
+constexpr size_t kHeaderSize = sizeof(SegmentHeader);
+
+SegmentHeader LoadHeader(const MappedFile& file) {
+  SegmentHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  return header;
+}
+
+std::string SegmentName(uint64_t sequence) {
+  char name[32];
+  snprintf(name, sizeof(name), "segment-%016" PRIx64 ".log", sequence);
+  return name;
+}
+
+// Parses "segment-<16 hex digits>.log".
+bool ParseSegmentName(const std::string& name, uint64_t* sequence) {
+  if (name.size() != 28 || name.compare(0, 8, "segment-") != 0 || name.compare(24, 4, ".log") != 0) {
+    return false;
+  }
+  uint64_t value = 0;
+  for (size_t i = 8; i < 24; i++) {
+    char c = name[i];
+    int digit = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1);
+    if (digit < 0) {
+      return false;
+    }
+    value = value << 4 | static_cast<uint64_t>(digit);
+  }
+  *sequence = value;
+  return true;
+}
+}  // namespace
+
+LogJournal::LogJournal(size_t segment_size, size_t max_segments)
+    : segment_size_(std::max<size_t>(segment_size, 64 * 1024)), max_segments_(std::max<size_t>(max_segments, 2)) {}
+
+size_t LogJournal::data_capacity() const {
+  return segment_size_ - kHeaderSize;
+}
+
+std::filesystem::path LogJournal::SegmentPath(uint64_t sequence) const {
+  return directory_ / SegmentName(sequence);
+}
+
+bool LogJournal::Open(const std::filesystem::path& directory) {
+  Close();
+  directory_ = directory;
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error) {
+    return false;
+  }
+
+  std::vector<uint64_t> sequences;
+  for (std::filesystem::directory_iterator it(directory_, error), end; !error && it != end; it.increment(error)) {
+    uint64_t sequence;
+    if (ParseSegmentName(it->path().filename().string(), &sequence)) {
+      sequences.push_back(sequence);
+    }
+  }
+  std::sort(sequences.begin(), sequences.end());
+  uint64_t next_sequence = sequences.empty() ? 0 : sequences.back() + 1;
+
+  for (size_t i = 0; i < sequences.size(); i++) {
+    Segment segment;
+    if (i + max_segments_ < sequences.size() || !OpenSegment(sequences[i], &segment)) {
+      std::filesystem::remove(SegmentPath(sequences[i]), error);
+      continue;
+    }
+    segments_.push_back(std::move(segment));
+  }
+  if (segments_.empty()) {
+    return AddSegment(next_sequence);
+  }
+  Recover(&segments_.back());
+  return true;
+}
+
+void LogJournal::Close() {
+  if (!segments_.empty()) {
+    CommitSegment(&segments_.back());
+  }
+  segments_.clear();
+}
+
+bool LogJournal::OpenSegment(uint64_t sequence, Segment* segment) {
+  std::filesystem::path path = SegmentPath(sequence);
+  std::error_code error;
+  if (std::filesystem::file_size(path, error) != segment_size_ || error) {
+    return false;
+  }
+  if (!segment->file.Open(path, segment_size_)) {
+    return false;
+  }
+  SegmentHeader header = LoadHeader(segment->file);
+  if (header.magic != kJournalMagic || header.version != kJournalVersion || header.sequence != sequence) {
+    segment->file.Close();
+    return false;
+  }
+  segment->sequence = sequence;
+  segment->used = static_cast<size_t>(std::min<uint64_t>(header.committed, data_capacity()));
+  return true;
+}
+
+bool LogJournal::AddSegment(uint64_t sequence) {
+  std::filesystem::path path = SegmentPath(sequence);
+  std::error_code error;
+  std::filesystem::remove(path, error);
+
+  Segment segment;
+  if (!segment.file.Open(path, segment_size_)) {
+    return false;
+  }
+  SegmentHeader header = {};
+  header.magic = kJournalMagic;
+  header.version = kJournalVersion;
+  header.sequence = sequence;
+  memcpy(segment.file.data(), &header, sizeof(header));
+  segment.sequence = sequence;
+  segments_.push_back(std::move(segment));
+
+  while (segments_.size() > max_segments_) {
+    RemoveSegment(&segments_.front());
+    segments_.pop_front();
+  }
+  return true;
+}
+
+void LogJournal::RemoveSegment(Segment* segment) {
+  segment->file.Close();
+  std::error_code error;
+  std::filesystem::remove(SegmentPath(segment->sequence), error);
+}
+
+void LogJournal::Recover(Segment* segment) {
+  // Segments start zero-filled, so lines written after the last commit run
+  // up to the first zero byte. Keep the whole ones.
+  char* committed_end = segment->file.data() + kHeaderSize + segment->used;
+  char* data_end = segment->file.data() + kHeaderSize + data_capacity();
+  char* dirty_end = committed_end;
+  while (dirty_end < data_end && *dirty_end != '\0') {
+    dirty_end++;
+  }
+  char* written_end = dirty_end;
+  while (written_end > committed_end && written_end[-1] != '\n') {
+    written_end--;
+  }
+  // Zero a torn last line so a later recovery does not stitch it onto new
+  // lines.
+  memset(written_end, 0, static_cast<size_t>(dirty_end - written_end));
+  if (written_end != committed_end) {
+    segment->used += static_cast<size_t>(written_end - committed_end);
+    CommitSegment(segment);
+  }
+}
+
+void LogJournal::CommitSegment(Segment* segment) {
+  uint64_t committed = segment->used;
+  if (LoadHeader(segment->file).committed != committed) {
+    segment->file.WriteThrough(offsetof(SegmentHeader, committed), &committed, sizeof(committed));
+  }
+}
+
+void LogJournal::Commit() {
+  if (!segments_.empty()) {
+    CommitSegment(&segments_.back());
+  }
+}
+
+void LogJournal::Append(const char* data, size_t size) {
+  const size_t capacity = data_capacity();
+  const char* end = data + size;
+  while (data < end && !segments_.empty()) {
+    Segment& segment = segments_.back();
+    char* destination = segment.file.data() + kHeaderSize + segment.used;
+    size_t remaining = static_cast<size_t>(end - data);
+    size_t room = capacity - segment.used;
+
+    size_t length = std::min(remaining, room);
+    if (length < remaining) {
+      // Only whole lines go into a segment.
+      while (length > 0 && data[length - 1] != '\n') {
+        length--;
+      }
+    }
+    if (length > 0) {
+      memcpy(destination, data, length);
+      segment.used += length;
+      data += length;
+      continue;
+    }
+
+    if (segment.used == 0) {
+      // A line longer than a whole segment; keep its head.
+      const char* newline = static_cast<const char*>(memchr(data, '\n', remaining));
+      memcpy(destination, data, capacity - 1);
+      destination[capacity - 1] = '\n';
+      segment.used = capacity;
+      data = newline == nullptr ? end : newline + 1;
+      continue;
+    }
+
+    CommitSegment(&segment);
+    if (!AddSegment(segment.sequence + 1)) {
+      Close();
+    }
+  }
+}
+
+void LogJournal::Clear() {
+  if (segments_.empty()) {
+    return;
+  }
+  uint64_t next_sequence = segments_.back().sequence + 1;
+  for (Segment& segment : segments_) {
+    RemoveSegment(&segment);
+  }
+  segments_.clear();
+  AddSegment(next_sequence);
+}
+
+uint64_t LogJournal::Read(uint64_t position,
+                          const std::function<void(const char* data, size_t size)>& visitor) const {
+  uint64_t start = std::max(position, begin_position());
+  for (const Segment& segment : segments_) {
+    uint64_t base = segment.sequence * data_capacity();
+    uint64_t committed = std::min<uint64_t>(LoadHeader(segment.file).committed, data_capacity());
+    if (start >= base + committed) {
+      continue;
+    }
+    size_t offset = static_cast<size_t>(start > base ? start - base : 0);
+    visitor(segment.file.data() + kHeaderSize + offset, static_cast<size_t>(committed) - offset);
+    start = base + committed;
+  }
+  return start;
+}
+
+uint64_t LogJournal::begin_position() const {
+  return segments_.empty() ? 0 : segments_.front().sequence * data_capacity();
+}
+
+uint64_t LogJournal::end_position() const {
+  if (segments_.empty()) {
+    return 0;
+  }
+  const Segment& segment = segments_.back();
+  return segment.sequence * data_capacity() +
+         std::min<uint64_t>(LoadHeader(segment.file).committed, data_capacity());
+}
+
+LogJournalReader::LogJournalReader(std::filesystem::path directory) : directory_(std::move(directory)) {}
+
+uint64_t LogJournalReader::Read(uint64_t position,
+                                const std::function<void(const char* data, size_t size)>& visitor) {
+  uint64_t next = ReadMapped(position, visitor);
+  // The writer only ever adds the segment after its newest one, on rotation
+  // and on Clear(), so one lookup tells whether the listing is stale.
+  std::error_code error;
+  if (!segments_.empty() &&
+      !std::filesystem::exists(directory_ / SegmentName(segments_.back().sequence + 1), error)) {
+    return next;
+  }
+  Rescan();
+  return ReadMapped(next, visitor);
+}
+
+uint64_t LogJournalReader::ReadMapped(uint64_t position,
+                                      const std::function<void(const char* data, size_t size)>& visitor) const {
+  if (segments_.empty()) {
+    return position;
+  }
+  // Every segment of one journal has the same size.
+  const size_t capacity = segments_.front().file.size() - kHeaderSize;
+  uint64_t start = std::max(position, segments_.front().sequence * capacity);
+  for (const Segment& segment : segments_) {
+    uint64_t base = segment.sequence * capacity;
+    uint64_t committed = std::min<uint64_t>(LoadHeader(segment.file).committed, capacity);
+    if (start >= base + committed) {
+      continue;
+    }
+    size_t offset = static_cast<size_t>(start > base ? start - base : 0);
+    visitor(segment.file.data() + kHeaderSize + offset, static_cast<size_t>(committed) - offset);
+    start = base + committed;
+  }
+  return start;
+}
+
+void LogJournalReader::Rescan() {
+  std::vector<uint64_t> sequences;
+  std::error_code error;
+  for (std::filesystem::directory_iterator it(directory_, error), end; !error && it != end; it.increment(error)) {
+    uint64_t sequence;
+    if (ParseSegmentName(it->path().filename().string(), &sequence)) {
+      sequences.push_back(sequence);
+    }
+  }
+  std::sort(sequences.begin(), sequences.end());
+
+  std::vector<Segment> segments;
+  segments.reserve(sequences.size());
+  auto mapped = segments_.begin();
+  for (uint64_t sequence : sequences) {
+    while (mapped != segments_.end() && mapped->sequence < sequence) {
+      ++mapped;
+    }
+    if (mapped != segments_.end() && mapped->sequence == sequence) {
+      segments.push_back(std::move(*mapped));
+      continue;
+    }
+    Segment segment;
+    segment.sequence = sequence;
+    if (!segment.file.OpenReadOnly(directory_ / SegmentName(sequence)) || segment.file.size() <= kHeaderSize ||
+        (!segments.empty() && segment.file.size() != segments.front().file.size())) {
+      continue;
+    }
+    SegmentHeader header = LoadHeader(segment.file);
+    if (header.magic != kJournalMagic || header.version != kJournalVersion || header.sequence != sequence) {
+      continue;
+    }
+    segments.push_back(std::move(segment));
+  }
+  // Segments no longer listed were deleted by rotation or Clear(); their
+  // mappings are released here.
+  segments_ = std::move(segments);
+}
@@ -0,0 +1,126 @@
+#ifndef NATIVE_LOG_JOURNAL_H_
+#define NATIVE_LOG_JOURNAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#include "mapped_file.h"
+
+// On-disk log history that survives restarts of the app.
+//
+// The journal is a directory of fixed-size, memory-mapped segment files named
+// by sequence number. Lines are copied straight into the mapping and become
+// visible to readers when Commit() stores the segment's write cursor in its
+// header. When a segment is full the next one is created, and the oldest is
+// deleted once there are |max_segments|.
+//
+// Every byte has a position: sequence * data capacity + offset. Positions
+// only grow, also across Clear() and restarts, so a reader can resume from
+// the position it last saw.
+//
+// Open() recovers from a crash: committed lines are kept, as are whole lines
+// written after the last commit, which are found by scanning the zero-filled
+// tail of the newest segment.
+//
+// Not thread-safe; the runners only touch it on the platform thread.
+class LogJournal {
+ public:
+  static constexpr size_t kDefaultSegmentSize = 4 * 1024 * 1024;
+  static constexpr size_t kDefaultMaxSegments = 8;
+
+  explicit LogJournal(size_t segment_size = kDefaultSegmentSize, size_t max_segments = kDefaultMaxSegments);
+
+  LogJournal(const LogJournal&) = delete;
+  LogJournal& operator=(const LogJournal&) = delete;
+
+  // Opens or creates the journal in |directory|. Returns false when the
+  // directory or the first segment cannot be created.
+  bool Open(const std::filesystem::path& directory);
+  void Close();
+  bool is_open() const { return !segments_.empty(); }
+
+  // Appends whole lines. A line longer than a segment is truncated.
+  void Append(const char* data, size_t size);
+  // Publishes everything appended so far to readers.
+  void Commit();
+  // Deletes all segments and starts a new one.
+  void Clear();
+
+  // Calls |visitor| with committed whole lines from |position| (clamped to
+  // the oldest retained byte), one chunk per segment, pointing into the
+  // mapping. Returns the position after the last byte visited.
+  uint64_t Read(uint64_t position, const std::function<void(const char* data, size_t size)>& visitor) const;
+
+  // Position of the oldest retained byte.
+  uint64_t begin_position() const;
+  // Position after the last committed byte.
+  uint64_t end_position() const;
+
+ private:
+  struct Segment {
+    uint64_t sequence = 0;
+    MappedFile file;
+    // Bytes of line data written, ahead of the header's until Commit().
+    size_t used = 0;
+  };
+
+  std::filesystem::path SegmentPath(uint64_t sequence) const;
+  bool AddSegment(uint64_t sequence);
+  bool OpenSegment(uint64_t sequence, Segment* segment);
+  void RemoveSegment(Segment* segment);
+  void Recover(Segment* segment);
+  void CommitSegment(Segment* segment);
+  size_t data_capacity() const;
+
+  size_t segment_size_;
+  size_t max_segments_;
+  std::filesystem::path directory_;
+  std::deque<Segment> segments_;
+};
+
+// Tails a LogJournal by position, from this process or another one.
+//
+// Segments are mapped read-only and committed lines are handed out straight
+// from the mapping, so a reader copies nothing and needs no lock: the writer
+// only ever publishes whole lines by storing a segment's committed size.
+// Read() takes the position the caller last saw and returns the next one;
+// the caller decides when to read, e.g. when inotify reports a commit (see
+// linux/runner/log_journal_watcher.h).
+//
+// Once the writer has started the segment after the newest mapped one, the
+// directory is listed again to map new segments and let go of deleted ones,
+// so rotation and LogJournal::Clear() need no separate notice. A segment
+// whose header is not written yet is skipped until a later Read().
+class LogJournalReader {
+ public:
+  explicit LogJournalReader(std::filesystem::path directory);
+
+  LogJournalReader(const LogJournalReader&) = delete;
+  LogJournalReader& operator=(const LogJournalReader&) = delete;
+
+  // Calls |visitor| with committed whole lines from |position| (clamped to
+  // the oldest retained byte), one chunk per segment. Returns the position
+  // after the last byte visited. The chunks stay valid until the next call.
+  uint64_t Read(uint64_t position, const std::function<void(const char* data, size_t size)>& visitor);
+
+  const std::filesystem::path& directory() const { return directory_; }
+
+ private:
+  struct Segment {
+    uint64_t sequence = 0;
+    MappedFile file;
+  };
+
+  uint64_t ReadMapped(uint64_t position, const std::function<void(const char* data, size_t size)>& visitor) const;
+  void Rescan();
+
+  std::filesystem::path directory_;
+  // Ascending by sequence.
+  std::vector<Segment> segments_;
+};
+
+#endif  // NATIVE_LOG_JOURNAL_H_
@@ -0,0 +1,233 @@
+#include "log_parser.h"
+
+#include <cstring>
+
+namespace {
+struct LevelName {
+  const char* name;
+  size_t length;
+  LogLevel level;
+};
+
+constexpr LevelName kLevelNames[] = {
+    {"TRACE", 5, kLogLevelTrace}, {"DEBUG", 5, kLogLevelDebug}, {"INFO", 4, kLogLevelInfo},
+    {"WARN", 4, kLogLevelWarn},   {"ERROR", 5, kLogLevelError}, {"FATAL", 5, kLogLevelFatal},
+    {"PANIC", 5, kLogLevelPanic},
+};
+
+class Cursor {
+ public:
+  Cursor(const char* begin, const char* end) : p_(begin), end_(end) {}
+
+  const char* position() const { return p_; }
+
+  // Skips "ESC [ ... final-byte" colour sequences.
+  void SkipAnsi() {
+    while (end_ - p_ >= 2 && p_[0] == '\x1b' && p_[1] == '[') {
+      p_ += 2;
+      while (p_ < end_ && !(*p_ >= 0x40 && *p_ <= 0x7e)) {
+        p_++;
+      }
+      if (p_ < end_) {
+        p_++;
+      }
+    }
+  }
+
+  void SkipSpaces() {
+    SkipAnsi();
+    while (p_ < end_ && *p_ == ' ') {
+      p_++;
+      SkipAnsi();
+    }
+  }
+
+  bool Consume(char c) {
+    if (p_ < end_ && *p_ == c) {
+      p_++;
+      return true;
+    }
+    return false;
+  }
+
+  // Reads exactly |count| decimal digits.
+  bool Digits(int count, int* value) {
+    if (end_ - p_ < count) {
+      return false;
+    }
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+      char c = p_[i];
+      if (c < '0' || c > '9') {
+        return false;
+      }
+      result = result * 10 + (c - '0');
+    }
+    p_ += count;
+    *value = result;
+    return true;
+  }
+
+  // Reads one or more decimal digits into a uint32 (wrapping on overflow).
+  bool Number(uint32_t* value) {
+    const char* start = p_;
+    uint32_t result = 0;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+      result = result * 10 + static_cast<uint32_t>(*p_ - '0');
+      p_++;
+    }
+    *value = result;
+    return p_ != start;
+  }
+
+  // Advances past the next |c|, or to the end.
+  void SkipPast(char c) {
+    while (p_ < end_ && *p_ != c) {
+      p_++;
+    }
+    if (p_ < end_) {
+      p_++;
+    }
+  }
+
+  void Reset(const char* position) { p_ = position; }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+int64_t DaysFromCivil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2 ? 1 : 0;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+  const unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+}
+
+// "+0300 2024-05-01 12:00:00[.123]"
+bool ParseTimestamp(Cursor* cursor, int64_t* timestamp_ms) {
+  const char* start = cursor->position();
+  int sign = cursor->Consume('+') ? 1 : (cursor->Consume('-') ? -1 : 0);
+  int zone = 0;
+  int year, month, day, hour, minute, second;
+  if (sign == 0 || !cursor->Digits(4, &zone) || !cursor->Consume(' ') || !cursor->Digits(4, &year) ||
+      !cursor->Consume('-') || !cursor->Digits(2, &month) || !cursor->Consume('-') ||
+      !cursor->Digits(2, &day) || !cursor->Consume(' ') || !cursor->Digits(2, &hour) ||
+      !cursor->Consume(':') || !cursor->Digits(2, &minute) || !cursor->Consume(':') ||
+      !cursor->Digits(2, &second) || month < 1 || month > 12 || day < 1 || day > 31) {
+    cursor->Reset(start);
+    return false;
+  }
+  int millis = 0;
+  if (cursor->Consume('.')) {
+    uint32_t fraction = 0;
+    const char* fraction_start = cursor->position();
+    cursor->Number(&fraction);
+    // Keep millisecond precision whatever the number of fraction digits.
+    ptrdiff_t digits = cursor->position() - fraction_start;
+    for (; digits > 3; digits--) {
+      fraction /= 10;
+    }
+    for (; digits < 3; digits++) {
+      fraction *= 10;
+    }
+    millis = static_cast<int>(fraction);
+  }
+
+  int64_t days = DaysFromCivil(year, static_cast<unsigned>(month), static_cast<unsigned>(day));
+  int64_t seconds = days * 86400 + hour * 3600 + minute * 60 + second;
+  seconds -= sign * ((zone / 100) * 3600 + (zone % 100) * 60);
+  *timestamp_ms = seconds * 1000 + millis;
+  return true;
+}
+
+bool ParseLevel(Cursor* cursor, uint8_t* level) {
+  const char* start = cursor->position();
+  for (const LevelName& candidate : kLevelNames) {
+    cursor->Reset(start);
+    bool matched = true;
+    for (size_t i = 0; i < candidate.length && matched; i++) {
+      matched = cursor->Consume(candidate.name[i]);
+    }
+    if (matched) {
+      *level = candidate.level;
+      return true;
+    }
+  }
+  cursor->Reset(start);
+  return false;
+}
+
+// "[3141592653 12ms]"
+void ParseConnection(Cursor* cursor, uint32_t* connection_id) {
+  const char* start = cursor->position();
+  uint32_t id = 0;
+  if (!cursor->Consume('[')) {
+    return;
+  }
+  cursor->SkipAnsi();
+  if (!cursor->Number(&id)) {
+    cursor->Reset(start);
+    return;
+  }
+  cursor->SkipPast(']');
+  *connection_id = id;
+}
+}  // namespace
+
+LogModuleTable::LogModuleTable() {
+  names_.emplace_back();
+}
+
+uint16_t LogModuleTable::Intern(const char* data, size_t size) {
+  std::string name(data, size);
+  auto it = ids_.find(name);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  if (names_.size() > UINT16_MAX) {
+    return 0;
+  }
+  uint16_t id = static_cast<uint16_t>(names_.size());
+  names_.push_back(name);
+  ids_.emplace(std::move(name), id);
+  return id;
+}
+
+LogRecord ParseLogLine(const char* base, const char* line, size_t size, LogModuleTable* modules) {
+  LogRecord record = {};
+  record.level = kLogLevelUnknown;
+  record.message_offset = static_cast<uint32_t>(line - base);
+  record.message_length = static_cast<uint32_t>(size);
+
+  const char* end = line + size;
+  Cursor cursor(line, end);
+  cursor.SkipAnsi();
+  if (ParseTimestamp(&cursor, &record.timestamp_ms)) {
+    cursor.SkipSpaces();
+  }
+  if (!ParseLevel(&cursor, &record.level)) {
+    record.timestamp_ms = 0;
+    return record;
+  }
+  cursor.SkipSpaces();
+  ParseConnection(&cursor, &record.connection_id);
+  cursor.SkipSpaces();
+
+  // A module is a run without spaces ending in ": ".
+  const char* module_start = cursor.position();
+  const char* p = module_start;
+  while (p < end && *p != ' ' && *p != ':') {
+    p++;
+  }
+  if (p > module_start && end - p >= 2 && p[0] == ':' && p[1] == ' ') {
+    record.module = modules->Intern(module_start, static_cast<size_t>(p - module_start));
+    cursor.Reset(p + 2);
+  }
+
+  record.message_offset = static_cast<uint32_t>(cursor.position() - base);
+  record.message_length = static_cast<uint32_t>(end - cursor.position());
+  return record;
+}
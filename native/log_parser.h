@@ -0,0 +1,63 @@
+#ifndef NATIVE_LOG_PARSER_H_
+#define NATIVE_LOG_PARSER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// sing-box log levels, in increasing severity. Bit |level| of a level mask
+// selects that level.
+enum LogLevel : uint8_t {
+  kLogLevelTrace = 0,
+  kLogLevelDebug,
+  kLogLevelInfo,
+  kLogLevelWarn,
+  kLogLevelError,
+  kLogLevelFatal,
+  kLogLevelPanic,
+  // Lines that are not sing-box log lines, e.g. runner status messages.
+  kLogLevelUnknown,
+  kLogLevelCount,
+};
+
+// Fixed-layout description of one log line. The message itself stays in the
+// arena holding the line; |message_offset| is relative to that arena.
+struct LogRecord {
+  // Unix time in milliseconds, 0 when the line has no timestamp.
+  int64_t timestamp_ms;
+  uint32_t message_offset;
+  uint32_t message_length;
+  // sing-box connection id from the "[id duration]" prefix, 0 when absent.
+  uint32_t connection_id;
+  // Index into LogModuleTable, 0 when the line has no module.
+  uint16_t module;
+  uint8_t level;
+  uint8_t reserved;
+};
+
+// Interns module tags such as "inbound/tun[tun-in]" or "dns".
+class LogModuleTable {
+ public:
+  LogModuleTable();
+
+  uint16_t Intern(const char* data, size_t size);
+  const std::vector<std::string>& names() const { return names_; }
+
+ private:
+  std::unordered_map<std::string, uint16_t> ids_;
+  std::vector<std::string> names_;
+};
+
+// Parses a sing-box line written with "log.timestamp: true":
+//
+//   +0300 2024-05-01 12:00:00 INFO [3141592653 12ms] outbound/vless[proxy]: message
+//
+// The connection prefix and module are optional and ANSI colour codes around
+// the header are skipped. |line| must not include the trailing newline. Lines
+// in any other format become kLogLevelUnknown records spanning the whole line.
+// |base| is the start of the arena, for the message offset.
+LogRecord ParseLogLine(const char* base, const char* line, size_t size, LogModuleTable* modules);
+
+#endif  // NATIVE_LOG_PARSER_H_
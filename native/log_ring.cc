@@ -0,0 +1,160 @@
+#include "log_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+}  // namespace
+
+LogRing::LogRing(size_t capacity)
+    : capacity_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 4096))),
+      mask_(capacity_ - 1) {
+  buffer_.reset(new char[capacity_]);
+}
+
+LogRing::Span LogRing::PrepareWrite() {
+  uint64_t read_pos = read_pos_.load(std::memory_order_acquire);
+  size_t free_bytes = capacity_ - static_cast<size_t>(write_pos_ - read_pos);
+  size_t offset = static_cast<size_t>(write_pos_) & mask_;
+  return Span{buffer_.get() + offset, std::min(free_bytes, capacity_ - offset)};
+}
+
+void LogRing::CommitWrite(size_t size) {
+  if (size == 0) {
+    return;
+  }
+  char* begin = buffer_.get() + (static_cast<size_t>(write_pos_) & mask_);
+  if (truncating_) {
+    const char* newline = static_cast<const char*>(memchr(begin, '\n', size));
+    if (newline == nullptr) {
+      CountDropped(size);
+      return;
+    }
+    // Keep what follows the truncated line's newline. The region from
+    // PrepareWrite() is contiguous, so it moves back in one piece.
+    size_t skipped = static_cast<size_t>(newline - begin) + 1;
+    CountDropped(skipped);
+    truncating_ = false;
+    size -= skipped;
+    memmove(begin, begin + skipped, size);
+    if (size == 0) {
+      return;
+    }
+  }
+  const char* end = begin + size;
+  const char* last_newline = nullptr;
+  for (const char* p = begin; p < end; p++) {
+    p = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (p == nullptr) {
+      break;
+    }
+    last_newline = p;
+    produced_lines_++;
+  }
+  write_pos_ += size;
+
+  if (last_newline != nullptr) {
+    Publish(write_pos_ - static_cast<uint64_t>(end - last_newline - 1), produced_lines_);
+  }
+  if (write_pos_ - published_pos_.load(std::memory_order_relaxed) >= max_line()) {
+    // An overlong line would otherwise fill the ring and never be published.
+    TruncateLine();
+  }
+}
+
+void LogRing::TruncateLine() {
+  constexpr size_t kMarkerSize = sizeof(kTruncatedMarker) - 1;
+  uint64_t start = published_pos_.load(std::memory_order_relaxed);
+  // The pending bytes are the producer's until published, so the line is
+  // cut by moving the write position back over them.
+  uint64_t cut = start + max_line() - kMarkerSize;
+  while (cut > start && (static_cast<uint8_t>(buffer_[static_cast<size_t>(cut) & mask_]) & 0xc0) == 0x80) {
+    cut--;
+  }
+  CountDropped(static_cast<size_t>(write_pos_ - cut));
+  write_pos_ = cut;
+  for (size_t i = 0; i < kMarkerSize; i++) {
+    buffer_[static_cast<size_t>(write_pos_++) & mask_] = kTruncatedMarker[i];
+  }
+  produced_lines_++;
+  truncating_ = true;
+  Publish(write_pos_, produced_lines_);
+}
+
+size_t LogRing::Write(const char* data, size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    Span span = PrepareWrite();
+    if (span.size == 0) {
+      CountDropped(size - written);
+      break;
+    }
+    size_t chunk = std::min(span.size, size - written);
+    memcpy(span.data, data + written, chunk);
+    CommitWrite(chunk);
+    written += chunk;
+  }
+  return written;
+}
+
+void LogRing::TerminateLine() {
+  truncating_ = false;
+  if (write_pos_ != published_pos_.load(std::memory_order_relaxed)) {
+    Write("\n", 1);
+  }
+}
+
+void LogRing::CountDropped(size_t size) {
+  dropped_bytes_.fetch_add(size, std::memory_order_relaxed);
+}
+
+void LogRing::SetWakeCallback(size_t high_water_bytes, std::function<void()> wake) {
+  high_water_bytes_ = high_water_bytes;
+  wake_ = std::move(wake);
+}
+
+void LogRing::Publish(uint64_t position, uint64_t lines) {
+  published_lines_.store(lines, std::memory_order_relaxed);
+  published_pos_.store(position, std::memory_order_release);
+
+  if (wake_ && position - read_pos_.load(std::memory_order_relaxed) >= high_water_bytes_ &&
+      !wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+    wake_();
+  }
+}
+
+size_t LogRing::Drain(const std::function<void(const char* data, size_t size)>& visitor) {
+  uint64_t published = published_pos_.load(std::memory_order_acquire);
+  uint64_t read_pos = read_pos_.load(std::memory_order_relaxed);
+  if (published == read_pos) {
+    return 0;
+  }
+  uint64_t lines = published_lines_.load(std::memory_order_relaxed);
+
+  size_t offset = static_cast<size_t>(read_pos) & mask_;
+  size_t total = static_cast<size_t>(published - read_pos);
+  size_t first = std::min(total, capacity_ - offset);
+  visitor(buffer_.get() + offset, first);
+  if (first < total) {
+    visitor(buffer_.get(), total - first);
+  }
+
+  // The line counter is read after the position, so a line published while
+  // draining may be attributed to this batch. Totals stay exact.
+  size_t drained_lines = static_cast<size_t>(lines - consumed_lines_);
+  consumed_lines_ = lines;
+  read_pos_.store(published, std::memory_order_release);
+  wake_pending_.store(false, std::memory_order_release);
+  return drained_lines;
+}
+
+bool LogRing::HasPendingLines() const {
+  return published_pos_.load(std::memory_order_acquire) != read_pos_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,95 @@
+#ifndef NATIVE_LOG_RING_H_
+#define NATIVE_LOG_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Fixed-size single-producer/single-consumer byte ring for sing-box output.
+//
+// The producer reads from the pipe straight into the ring (PrepareWrite and
+// CommitWrite) and only whole lines are published, so a drain never splits a
+// line or a UTF-8 sequence. Nothing is allocated per line: the consumer takes
+// everything published so far as one batch.
+//
+// A line that reaches max_line() bytes without a newline would fill the
+// ring, so it is cut at a UTF-8 boundary and published ending in
+// kTruncatedMarker. The rest of it, up to its newline, is dropped and
+// counted in dropped_bytes().
+class LogRing {
+ public:
+  static constexpr size_t kDefaultCapacity = 1 << 20;
+  static constexpr char kTruncatedMarker[] = " [truncated]\n";
+
+  struct Span {
+    char* data;
+    size_t size;
+  };
+
+  // |capacity| is rounded up to a power of two.
+  explicit LogRing(size_t capacity = kDefaultCapacity);
+
+  LogRing(const LogRing&) = delete;
+  LogRing& operator=(const LogRing&) = delete;
+
+  // Producer side.
+
+  // Returns the contiguous free region at the write position. Empty when the
+  // ring is full.
+  Span PrepareWrite();
+  // Publishes |size| bytes written into the region from PrepareWrite().
+  void CommitWrite(size_t size);
+  // Copies |data| in. Bytes that do not fit are counted as dropped.
+  size_t Write(const char* data, size_t size);
+  // Ends a pending partial line, e.g. when the child exits mid-line, and
+  // stops dropping the rest of a truncated one.
+  void TerminateLine();
+  // Records output that was read but discarded because the ring was full.
+  void CountDropped(size_t size);
+
+  // Invokes |wake| on the producer thread once published bytes reach
+  // |high_water_bytes|. It fires again only after the next Drain().
+  void SetWakeCallback(size_t high_water_bytes, std::function<void()> wake);
+
+  // Consumer side.
+
+  // Calls |visitor| with up to two contiguous chunks that together hold every
+  // line published so far, then releases them. Returns the number of lines.
+  size_t Drain(const std::function<void(const char* data, size_t size)>& visitor);
+  bool HasPendingLines() const;
+
+  size_t capacity() const { return capacity_; }
+  // The longest line published whole, newline included.
+  size_t max_line() const { return capacity_ / 2; }
+  uint64_t dropped_bytes() const { return dropped_bytes_.load(std::memory_order_relaxed); }
+
+ private:
+  void Publish(uint64_t position, uint64_t lines);
+  // Cuts the pending line short and publishes it.
+  void TruncateLine();
+
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  size_t mask_;
+
+  // Producer-owned. Includes a trailing partial line, if any.
+  uint64_t write_pos_ = 0;
+  uint64_t produced_lines_ = 0;
+  // Dropping the rest of a truncated line.
+  bool truncating_ = false;
+
+  std::atomic<uint64_t> published_pos_{0};
+  std::atomic<uint64_t> published_lines_{0};
+  std::atomic<uint64_t> read_pos_{0};
+  uint64_t consumed_lines_ = 0;
+
+  std::atomic<uint64_t> dropped_bytes_{0};
+
+  size_t high_water_bytes_ = 0;
+  std::function<void()> wake_;
+  std::atomic<bool> wake_pending_{false};
+};
+
+#endif  // NATIVE_LOG_RING_H_
@@ -0,0 +1,349 @@
+#include "log_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+LogStore::LogStore(size_t arena_size, size_t max_arenas)
+    : arena_size_(std::max<size_t>(arena_size, 4096)), max_arenas_(std::max<size_t>(max_arenas, 2)) {}
+
+void LogStore::Append(const char* data, size_t size) {
+  const char* end = data + size;
+  while (data < end) {
+    const char* newline = static_cast<const char*>(memchr(data, '\n', static_cast<size_t>(end - data)));
+    if (newline == nullptr) {
+      partial_line_.append(data, static_cast<size_t>(end - data));
+      return;
+    }
+    size_t length = static_cast<size_t>(newline - data) + 1;
+    if (partial_line_.empty()) {
+      StoreLine(data, length);
+    } else {
+      partial_line_.append(data, length);
+      StoreLine(partial_line_.data(), partial_line_.size());
+      partial_line_.clear();
+    }
+    data = newline + 1;
+  }
+}
+
+void LogStore::AppendLine(const std::string& line) {
+  if (!partial_line_.empty()) {
+    partial_line_.push_back('\n');
+    StoreLine(partial_line_.data(), partial_line_.size());
+    partial_line_.clear();
+  }
+  if (!line.empty() && line.back() == '\n') {
+    StoreLine(line.data(), line.size());
+  } else {
+    std::string terminated = line + "\n";
+    StoreLine(terminated.data(), terminated.size());
+  }
+}
+
+void LogStore::Clear() {
+  arenas_.clear();
+  partial_line_.clear();
+  pending_trigrams_.clear();
+  std::fill(std::begin(level_counts_), std::end(level_counts_), 0);
+}
+
+void LogStore::Forget(const Arena& arena) {
+  for (const LogRecord& record : arena.records) {
+    level_counts_[record.level]--;
+  }
+}
+
+LogStore::Arena& LogStore::ArenaWithRoom(size_t size) {
+  if (!arenas_.empty() && arenas_.back().used + size <= arena_size_) {
+    return arenas_.back();
+  }
+
+  if (!arenas_.empty()) {
+    arenas_.back().index.Seal(&pending_trigrams_);
+  }
+
+  Arena arena;
+  if (arenas_.size() >= max_arenas_) {
+    // Reuse the oldest arena's buffers instead of allocating new ones.
+    arena = std::move(arenas_.front());
+    arenas_.pop_front();
+    evicted_lines_ += arena.line_ends.size();
+    Forget(arena);
+    arena.used = 0;
+    arena.line_ends.clear();
+    arena.records.clear();
+    arena.index.Clear();
+  } else {
+    arena.data.reset(new char[arena_size_]);
+  }
+  arena.first_line = next_line_;
+  arenas_.push_back(std::move(arena));
+  return arenas_.back();
+}
+
+void LogStore::StoreLine(const char* data, size_t size) {
+  if (size > arena_size_) {
+    // Keep the head of an overlong line; the newline is restored at the end.
+    size = arena_size_;
+  }
+  Arena& arena = ArenaWithRoom(size);
+  char* line = arena.data.get() + arena.used;
+  memcpy(line, data, size);
+  arena.used += size;
+  arena.data[arena.used - 1] = '\n';
+  arena.line_ends.push_back(static_cast<uint32_t>(arena.used));
+
+  size_t length = size - 1;
+  if (length > 0 && line[length - 1] == '\r') {
+    length--;
+  }
+  LogRecord record = ParseLogLine(arena.data.get(), line, length, &modules_);
+  level_counts_[record.level]++;
+  arena.index.AddLine(arena.records.size(), record.level, line, length, &pending_trigrams_);
+  arena.records.push_back(record);
+  next_line_++;
+}
+
+uint64_t LogStore::first_line() const {
+  return arenas_.empty() ? next_line_ : arenas_.front().first_line;
+}
+
+uint64_t LogStore::Read(uint64_t offset, size_t limit,
+                        const std::function<void(const char* data, size_t size)>& visitor) const {
+  uint64_t start = std::max(offset, first_line());
+  if (arenas_.empty() || start >= next_line_ || limit == 0) {
+    return start;
+  }
+
+  auto it = std::upper_bound(arenas_.begin(), arenas_.end(), start,
+                             [](uint64_t line, const Arena& arena) { return line < arena.first_line; });
+  --it;
+
+  uint64_t line = start;
+  for (; it != arenas_.end() && limit > 0; ++it) {
+    const Arena& arena = *it;
+    size_t index = static_cast<size_t>(line - arena.first_line);
+    size_t count = std::min(limit, arena.line_ends.size() - index);
+    if (count == 0) {
+      continue;
+    }
+    // Consecutive lines in one arena are contiguous, so each arena is visited
+    // once.
+    uint32_t begin = index == 0 ? 0 : arena.line_ends[index - 1];
+    uint32_t end = arena.line_ends[index + count - 1];
+    visitor(arena.data.get() + begin, end - begin);
+    line += count;
+    limit -= count;
+  }
+  return start;
+}
+
+LogStore::Page LogStore::ReadPage(int64_t offset, size_t limit) const {
+  uint64_t start;
+  if (offset < 0) {
+    uint64_t back = static_cast<uint64_t>(-(offset + 1)) + 1;
+    start = next_line_ - std::min(back, next_line_);
+  } else {
+    start = static_cast<uint64_t>(offset);
+  }
+
+  Page page;
+  page.first = Read(start, limit, [&page](const char* data, size_t size) {
+    page.data.insert(page.data.end(), data, data + size);
+  });
+  page.next = std::min<uint64_t>(page.first + limit, std::max(page.first, next_line_));
+  return page;
+}
+
+namespace {
+bool ContainsFolded(const char* data, size_t size, const std::string& folded_query) {
+  const char* end = data + size;
+  return std::search(data, end, folded_query.begin(), folded_query.end(),
+                     [](char a, char b) { return FoldLogChar(a) == b; }) != end;
+}
+}  // namespace
+
+void LogStore::Search(const std::string& query, uint32_t level_mask, size_t limit,
+                      const std::function<void(uint64_t line, const char* data, size_t size)>& visitor) const {
+  std::string folded(query);
+  std::transform(folded.begin(), folded.end(), folded.begin(), FoldLogChar);
+  const std::vector<uint32_t> trigrams = LogTrigrams(folded.data(), folded.size());
+
+  size_t found = 0;
+  std::vector<uint32_t> blocks;
+  // Returns false once |limit| is reached.
+  auto visit_line = [&](const Arena& arena, size_t index) {
+    if ((level_mask & (1u << arena.records[index].level)) == 0) {
+      return true;
+    }
+    uint32_t begin = index == 0 ? 0 : arena.line_ends[index - 1];
+    uint32_t end = arena.line_ends[index] - 1;
+    const char* data = arena.data.get() + begin;
+    if (!ContainsFolded(data, end - begin, folded)) {
+      return true;
+    }
+    visitor(arena.first_line + index, data, end - begin);
+    return ++found < limit;
+  };
+
+  for (auto it = arenas_.rbegin(); it != arenas_.rend() && found < limit; ++it) {
+    const Arena& arena = *it;
+    size_t count = arena.records.size();
+    if (!arena.index.sealed()) {
+      // Only the arena being filled; small enough to scan.
+      for (size_t index = count; index > 0;) {
+        if (!visit_line(arena, --index)) {
+          return;
+        }
+      }
+      continue;
+    }
+    arena.index.CandidateBlocks(trigrams, level_mask, &blocks);
+    for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+      size_t first = LogArenaIndex::BlockBegin(*block);
+      for (size_t index = LogArenaIndex::BlockEnd(*block, count); index > first;) {
+        if (!visit_line(arena, --index)) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+namespace {
+constexpr uint32_t kRecordsMagic = 0x31524C48;  // "HLR1"
+constexpr size_t kRecordsHeaderSize = 32;
+constexpr size_t kWireRecordSize = 32;
+
+template <typename T>
+void Put(std::vector<uint8_t>* out, size_t position, T value) {
+  // Both runners target little-endian CPUs, so the host layout is the wire
+  // layout.
+  memcpy(out->data() + position, &value, sizeof(value));
+}
+
+template <typename T>
+void PutBack(std::vector<uint8_t>* out, T value) {
+  size_t position = out->size();
+  out->resize(position + sizeof(value));
+  Put(out, position, value);
+}
+}  // namespace
+
+// Layout, all integers little-endian:
+//
+//   header   u32 magic "HLR1", u32 record count, u64 first line scanned,
+//            u64 line after the last one scanned, u32 module count,
+//            u32 record size (32)
+//   modules  module count x (u16 byte length, UTF-8 name); index 0 is ""
+//   records  record count x (i64 timestamp ms, u64 line id, u32 message
+//            offset into the text block, u32 message length, u32 connection
+//            id, u16 module, u8 level, u8 reserved), in line order
+//   text     message bytes
+//
+// Continue a forward scan from "line after the last one scanned" and a
+// backward one from "first line scanned" minus one.
+LogStore::Page LogStore::ReadRecords(int64_t offset, size_t limit, uint32_t level_mask, int module) const {
+  auto matches_filter = [level_mask, module](const LogRecord& record) {
+    return (level_mask & (1u << record.level)) != 0 && (module < 0 || record.module == module);
+  };
+  struct Match {
+    uint64_t line;
+    const Arena* arena;
+    const LogRecord* record;
+  };
+  std::vector<Match> matches;
+  uint64_t scan_first = next_line_;
+  uint64_t scan_next = next_line_;
+
+  if (offset < 0) {
+    uint64_t back = static_cast<uint64_t>(-(offset + 1));
+    uint64_t newest = next_line_ - std::min(back, next_line_);
+    for (auto it = arenas_.rbegin(); it != arenas_.rend() && matches.size() < limit; ++it) {
+      const Arena& arena = *it;
+      if (arena.first_line >= newest) {
+        continue;
+      }
+      size_t index = std::min<size_t>(arena.records.size(), static_cast<size_t>(newest - arena.first_line));
+      if (scan_next == next_line_) {
+        scan_next = arena.first_line + index;
+      }
+      while (index > 0 && matches.size() < limit) {
+        index--;
+        const LogRecord& record = arena.records[index];
+        if (matches_filter(record)) {
+          matches.push_back({arena.first_line + index, &arena, &record});
+        }
+      }
+      scan_first = arena.first_line + index;
+    }
+    std::reverse(matches.begin(), matches.end());
+  } else {
+    uint64_t start = std::max(static_cast<uint64_t>(offset), first_line());
+    scan_first = std::min(start, next_line_);
+    scan_next = scan_first;
+    for (const Arena& arena : arenas_) {
+      if (matches.size() >= limit) {
+        break;
+      }
+      size_t count = arena.records.size();
+      if (arena.first_line + count <= start) {
+        continue;
+      }
+      size_t index = static_cast<size_t>(std::max(start, arena.first_line) - arena.first_line);
+      for (; index < count && matches.size() < limit; index++) {
+        const LogRecord& record = arena.records[index];
+        if (matches_filter(record)) {
+          matches.push_back({arena.first_line + index, &arena, &record});
+        }
+      }
+      scan_next = arena.first_line + index;
+    }
+  }
+
+  Page page;
+  page.first = scan_first;
+  page.next = scan_next;
+  std::vector<uint8_t>& out = page.data;
+  const std::vector<std::string>& modules = modules_.names();
+
+  size_t text_size = 0;
+  for (const Match& match : matches) {
+    text_size += match.record->message_length;
+  }
+  out.reserve(kRecordsHeaderSize + matches.size() * kWireRecordSize + text_size);
+
+  PutBack<uint32_t>(&out, kRecordsMagic);
+  PutBack<uint32_t>(&out, static_cast<uint32_t>(matches.size()));
+  PutBack<uint64_t>(&out, scan_first);
+  PutBack<uint64_t>(&out, scan_next);
+  PutBack<uint32_t>(&out, static_cast<uint32_t>(modules.size()));
+  PutBack<uint32_t>(&out, static_cast<uint32_t>(kWireRecordSize));
+  for (const std::string& name : modules) {
+    PutBack<uint16_t>(&out, static_cast<uint16_t>(name.size()));
+    out.insert(out.end(), name.begin(), name.end());
+  }
+
+  size_t records_start = out.size();
+  out.resize(records_start + matches.size() * kWireRecordSize);
+  uint32_t text_offset = 0;
+  for (size_t i = 0; i < matches.size(); i++) {
+    const LogRecord& record = *matches[i].record;
+    size_t position = records_start + i * kWireRecordSize;
+    Put<int64_t>(&out, position, record.timestamp_ms);
+    Put<uint64_t>(&out, position + 8, matches[i].line);
+    Put<uint32_t>(&out, position + 16, text_offset);
+    Put<uint32_t>(&out, position + 20, record.message_length);
+    Put<uint32_t>(&out, position + 24, record.connection_id);
+    Put<uint16_t>(&out, position + 28, record.module);
+    Put<uint8_t>(&out, position + 30, record.level);
+    Put<uint8_t>(&out, position + 31, 0);
+    text_offset += record.message_length;
+  }
+  for (const Match& match : matches) {
+    const char* message = match.arena->data.get() + match.record->message_offset;
+    out.insert(out.end(), message, message + match.record->message_length);
+  }
+  return page;
+}
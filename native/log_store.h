@@ -0,0 +1,112 @@
+#ifndef NATIVE_LOG_STORE_H_
+#define NATIVE_LOG_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log_index.h"
+#include "log_parser.h"
+
+// Size-bounded retention for everything shown on the logs screen.
+//
+// Lines are packed into fixed-size arenas. When the last arena is full and the
+// arena limit is reached, the oldest arena is evicted and its memory reused,
+// so the footprint stays at |arena_size| * |max_arenas| however long the
+// session runs. Every line gets a sequential id that Dart pages by, and a
+// parsed LogRecord kept next to it so filtering never re-scans the text.
+//
+// Not thread-safe; the runners only touch it on the platform thread.
+class LogStore {
+ public:
+  static constexpr size_t kDefaultArenaSize = 256 * 1024;
+  static constexpr size_t kDefaultMaxArenas = 32;
+
+  explicit LogStore(size_t arena_size = kDefaultArenaSize, size_t max_arenas = kDefaultMaxArenas);
+
+  LogStore(const LogStore&) = delete;
+  LogStore& operator=(const LogStore&) = delete;
+
+  // Appends raw output. A trailing partial line is held back until the next
+  // call completes it.
+  void Append(const char* data, size_t size);
+  // Appends one complete line; the newline is added when missing.
+  void AppendLine(const std::string& line);
+  void Clear();
+
+  struct Page {
+    // Id of the first line in |data|.
+    uint64_t first;
+    // Id after the last line in |data|.
+    uint64_t next;
+    // Whole lines, newline included.
+    std::vector<uint8_t> data;
+  };
+
+  // Calls |visitor| with chunks of whole lines, up to |limit| lines starting
+  // at line id |offset| (clamped to the oldest retained line). Returns the id
+  // of the first line visited.
+  uint64_t Read(uint64_t offset, size_t limit,
+                const std::function<void(const char* data, size_t size)>& visitor) const;
+
+  // Copies up to |limit| lines starting at |offset|. A negative |offset|
+  // counts back from the newest line, so -|limit| returns the latest page.
+  Page ReadPage(int64_t offset, size_t limit) const;
+
+  // Encodes up to |limit| records whose level bit is set in |level_mask| and,
+  // unless |module| is negative, whose module index equals |module|. A
+  // non-negative |offset| scans forward from that line id; a negative one
+  // scans back from the newest line and returns the latest matches. The
+  // layout is described above ReadRecords() in log_store.cc.
+  Page ReadRecords(int64_t offset, size_t limit, uint32_t level_mask, int module = -1) const;
+
+  // Calls |visitor| for up to |limit| lines, newest first, that contain
+  // |query| (ASCII case-insensitive) and whose level bit is set in
+  // |level_mask|. An empty |query| matches every line. |data| excludes the
+  // newline.
+  void Search(const std::string& query, uint32_t level_mask, size_t limit,
+              const std::function<void(uint64_t line, const char* data, size_t size)>& visitor) const;
+
+  // Retained lines per LogLevel.
+  const uint64_t* level_counts() const { return level_counts_; }
+
+  // Id of the oldest retained line.
+  uint64_t first_line() const;
+  // Id the next appended line will get.
+  uint64_t next_line() const { return next_line_; }
+  // Lines evicted to stay within the memory bound.
+  uint64_t evicted_lines() const { return evicted_lines_; }
+
+ private:
+  struct Arena {
+    std::unique_ptr<char[]> data;
+    size_t used = 0;
+    uint64_t first_line = 0;
+    // End offset of each line in |data|.
+    std::vector<uint32_t> line_ends;
+    // Parsed form of each line, parallel to |line_ends|.
+    std::vector<LogRecord> records;
+    LogArenaIndex index;
+  };
+
+  void StoreLine(const char* data, size_t size);
+  Arena& ArenaWithRoom(size_t size);
+  void Forget(const Arena& arena);
+
+  size_t arena_size_;
+  size_t max_arenas_;
+  std::deque<Arena> arenas_;
+  std::string partial_line_;
+  uint64_t next_line_ = 0;
+  uint64_t evicted_lines_ = 0;
+  LogModuleTable modules_;
+  // Trigrams of the arena being filled, until it is sealed.
+  std::vector<uint32_t> pending_trigrams_;
+  uint64_t level_counts_[kLogLevelCount] = {};
+};
+
+#endif  // NATIVE_LOG_STORE_H_
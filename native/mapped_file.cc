@@ -0,0 +1,168 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+#ifdef _WIN32
+    file_ = std::exchange(other.file_, nullptr);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+#else
+    fd_ = std::exchange(other.fd_, -1);
+#endif
+  }
+  return *this;
+}
+
+bool MappedFile::Open(const std::filesystem::path& path, size_t size) {
+  return Map(path, size, true);
+}
+
+bool MappedFile::OpenReadOnly(const std::filesystem::path& path) {
+  return Map(path, 0, false);
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Map(const std::filesystem::path& path, size_t size, bool writable) {
+  Close();
+  HANDLE file = CreateFileW(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                            writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER current;
+  if (!GetFileSizeEx(file, &current)) {
+    CloseHandle(file);
+    return false;
+  }
+  if (!writable) {
+    size = static_cast<size_t>(current.QuadPart);
+  }
+  if (size == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  // The mapping extends a shorter file with zeros.
+  const uint64_t mapping_size = std::max<uint64_t>(size, static_cast<uint64_t>(current.QuadPart));
+  HANDLE mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                      static_cast<DWORD>(mapping_size >> 32), static_cast<DWORD>(mapping_size),
+                                      nullptr);
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    return false;
+  }
+  void* view = MapViewOfFile(mapping, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+  if (view == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  data_ = static_cast<char*>(view);
+  size_ = size;
+  file_ = file;
+  mapping_ = mapping;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+  }
+  if (file_ != nullptr) {
+    CloseHandle(file_);
+    file_ = nullptr;
+  }
+  size_ = 0;
+}
+
+void MappedFile::WriteThrough(size_t offset, const void* data, size_t size) {
+  // Windows has no inotify to wake; the view is coherent with the file.
+  memcpy(data_ + offset, data, size);
+}
+
+#else
+
+bool MappedFile::Map(const std::filesystem::path& path, size_t size, bool writable) {
+  Close();
+  int fd = open(path.c_str(), writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) == -1) {
+    close(fd);
+    return false;
+  }
+  if (!writable) {
+    size = static_cast<size_t>(status.st_size);
+  } else if (static_cast<size_t>(status.st_size) < size && ftruncate(fd, static_cast<off_t>(size)) == -1) {
+    close(fd);
+    return false;
+  }
+  if (size == 0) {
+    close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  data_ = static_cast<char*>(data);
+  size_ = size;
+  fd_ = fd;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+    data_ = nullptr;
+  }
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+}
+
+void MappedFile::WriteThrough(size_t offset, const void* data, size_t size) {
+  ssize_t written = pwrite(fd_, data, size, static_cast<off_t>(offset));
+  if (written != static_cast<ssize_t>(size)) {
+    memcpy(data_ + offset, data, size);
+  }
+}
+
+#endif
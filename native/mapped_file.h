@@ -0,0 +1,50 @@
+#ifndef NATIVE_MAPPED_FILE_H_
+#define NATIVE_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// A file mapped read-write into memory, shared with other processes mapping
+// the same file.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Maps |path|, creating it if missing. A file shorter than |size| is
+  // extended with zeros. Returns false if the file cannot be opened or
+  // mapped.
+  bool Open(const std::filesystem::path& path, size_t size);
+  // Maps |path| read-only at its current size.
+  bool OpenReadOnly(const std::filesystem::path& path);
+  void Close();
+
+  bool is_open() const { return data_ != nullptr; }
+  char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Writes through the file descriptor instead of the mapping. The bytes land
+  // in the same pages, but file watchers (inotify) are only notified of
+  // writes made this way.
+  void WriteThrough(size_t offset, const void* data, size_t size);
+
+ private:
+  bool Map(const std::filesystem::path& path, size_t size, bool writable);
+
+  char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+#endif  // NATIVE_MAPPED_FILE_H_
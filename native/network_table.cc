@@ -0,0 +1,138 @@
+#include "network_table.h"
+
+#include <algorithm>
+
+NetworkTable::NetworkTable() : snapshot_(std::make_shared<NetworkSnapshot>()) {}
+
+void NetworkTable::SetLink(int index, const std::string& name, bool up, bool loopback, bool point_to_point) {
+  NetworkInterface& link = links_[index];
+  link.index = index;
+  link.name = name;
+  link.up = up;
+  link.loopback = loopback;
+  link.point_to_point = point_to_point;
+  dirty_ = true;
+}
+
+void NetworkTable::RemoveLink(int index) {
+  links_.erase(index);
+  auto on_link = [index](const Route& route) { return route.index == index; };
+  routes_.erase(std::remove_if(routes_.begin(), routes_.end(), on_link), routes_.end());
+  dirty_ = true;
+}
+
+void NetworkTable::AddAddress(int index, bool ipv6, const std::string& address) {
+  // Address notifications can come before the link's own.
+  NetworkInterface& link = links_[index];
+  link.index = index;
+  std::vector<std::string>& addresses = ipv6 ? link.ipv6 : link.ipv4;
+  if (std::find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+    addresses.push_back(address);
+    dirty_ = true;
+  }
+}
+
+void NetworkTable::RemoveAddress(int index, bool ipv6, const std::string& address) {
+  auto it = links_.find(index);
+  if (it == links_.end()) {
+    return;
+  }
+  std::vector<std::string>& addresses = ipv6 ? it->second.ipv6 : it->second.ipv4;
+  auto position = std::find(addresses.begin(), addresses.end(), address);
+  if (position != addresses.end()) {
+    addresses.erase(position);
+    dirty_ = true;
+  }
+}
+
+void NetworkTable::AddDefaultRoute(int index, bool ipv6, const std::string& gateway, uint32_t metric,
+                                   bool replace) {
+  Route route{index, ipv6, gateway, metric};
+  if (replace) {
+    auto same_key = [&route](const Route& other) { return other.ipv6 == route.ipv6 && other.metric == route.metric; };
+    auto end = std::remove_if(routes_.begin(), routes_.end(), same_key);
+    dirty_ = dirty_ || end != routes_.end();
+    routes_.erase(end, routes_.end());
+  }
+  if (std::find(routes_.begin(), routes_.end(), route) == routes_.end()) {
+    routes_.push_back(route);
+    dirty_ = true;
+  }
+}
+
+void NetworkTable::RemoveDefaultRoute(int index, bool ipv6, const std::string& gateway, uint32_t metric) {
+  auto position = std::find(routes_.begin(), routes_.end(), Route{index, ipv6, gateway, metric});
+  if (position != routes_.end()) {
+    routes_.erase(position);
+    dirty_ = true;
+  }
+}
+
+void NetworkTable::Clear() {
+  links_.clear();
+  routes_.clear();
+  dirty_ = true;
+}
+
+uint32_t NetworkTable::Publish() {
+  if (!dirty_) {
+    return 0;
+  }
+  dirty_ = false;
+
+  auto next = std::make_shared<NetworkSnapshot>();
+  next->interfaces.reserve(links_.size());
+  for (const auto& entry : links_) {
+    next->interfaces.push_back(entry.second);
+  }
+
+  const Route* best = nullptr;
+  for (const Route& route : routes_) {
+    auto link = links_.find(route.index);
+    if (route.ipv6 || link == links_.end() || !IsPhysical(link->second)) {
+      continue;
+    }
+    if (best == nullptr || route.metric < best->metric) {
+      best = &route;
+    }
+  }
+  if (best != nullptr) {
+    const NetworkInterface& link = links_.at(best->index);
+    next->default_interface = link.name;
+    next->gateway = best->gateway;
+    if (!link.ipv4.empty()) {
+      next->local_ip = link.ipv4.front();
+    }
+  }
+  if (next->local_ip.empty()) {
+    for (const auto& entry : links_) {
+      if (IsPhysical(entry.second) && !entry.second.ipv4.empty()) {
+        next->local_ip = entry.second.ipv4.front();
+        break;
+      }
+    }
+  }
+
+  uint32_t changes = 0;
+  if (next->local_ip != snapshot_->local_ip) {
+    changes |= kNetworkAddressChanged;
+  }
+  if (next->gateway != snapshot_->gateway || next->default_interface != snapshot_->default_interface) {
+    changes |= kNetworkGatewayChanged;
+  }
+  bool links_changed = next->interfaces.size() != snapshot_->interfaces.size();
+  for (size_t i = 0; !links_changed && i < next->interfaces.size(); i++) {
+    const NetworkInterface& a = next->interfaces[i];
+    const NetworkInterface& b = snapshot_->interfaces[i];
+    links_changed = a.index != b.index || a.name != b.name || a.up != b.up;
+  }
+  if (links_changed) {
+    changes |= kNetworkLinkChanged;
+  }
+  snapshot_ = std::move(next);
+  return changes;
+}
+
+bool NetworkTable::IsPhysical(const NetworkInterface& link) {
+  return link.up && !link.loopback && !link.point_to_point;
+}
@@ -0,0 +1,91 @@
+#ifndef NATIVE_NETWORK_TABLE_H_
+#define NATIVE_NETWORK_TABLE_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct NetworkInterface {
+  int index = 0;
+  std::string name;
+  bool up = false;
+  bool loopback = false;
+  // Tunnels, including sing-box's own TUN device.
+  bool point_to_point = false;
+  std::vector<std::string> ipv4;
+  std::vector<std::string> ipv6;
+};
+
+// An immutable view of the host's interfaces. Everything the runners are
+// asked for is precomputed, so readers on any thread only copy a pointer.
+struct NetworkSnapshot {
+  std::vector<NetworkInterface> interfaces;
+  // The interface and next hop of the preferred IPv4 default route, empty
+  // when there is none.
+  std::string default_interface;
+  std::string gateway;
+  // The address other devices on the LAN reach this host at: the first
+  // IPv4 address of the default route's interface, or of any other
+  // physical interface that is up.
+  std::string local_ip;
+};
+
+// What Publish() found different from the previous snapshot.
+enum NetworkChange : uint32_t {
+  kNetworkAddressChanged = 1 << 0,
+  kNetworkGatewayChanged = 1 << 1,
+  kNetworkLinkChanged = 1 << 2,
+};
+
+// The mutable model behind NetworkSnapshot, fed from OS change
+// notifications. Not thread-safe; the monitor that owns it publishes
+// snapshots for other threads.
+class NetworkTable {
+ public:
+  NetworkTable();
+
+  NetworkTable(const NetworkTable&) = delete;
+  NetworkTable& operator=(const NetworkTable&) = delete;
+
+  // Adds or updates link |index|, keeping its addresses.
+  void SetLink(int index, const std::string& name, bool up, bool loopback, bool point_to_point);
+  // Drops the link with its addresses and routes.
+  void RemoveLink(int index);
+  void AddAddress(int index, bool ipv6, const std::string& address);
+  void RemoveAddress(int index, bool ipv6, const std::string& address);
+  // Default routes only; |gateway| may be empty for on-link routes. With
+  // |replace|, the route takes the place of the one with the same family
+  // and metric, as the kernel does for "ip route replace".
+  void AddDefaultRoute(int index, bool ipv6, const std::string& gateway, uint32_t metric, bool replace);
+  void RemoveDefaultRoute(int index, bool ipv6, const std::string& gateway, uint32_t metric);
+  void Clear();
+
+  // Rebuilds the snapshot if anything was applied since the last call and
+  // returns the NetworkChange bits that differ from the previous one.
+  uint32_t Publish();
+  std::shared_ptr<const NetworkSnapshot> snapshot() const { return snapshot_; }
+
+ private:
+  struct Route {
+    int index;
+    bool ipv6;
+    std::string gateway;
+    uint32_t metric;
+
+    bool operator==(const Route& other) const {
+      return index == other.index && ipv6 == other.ipv6 && gateway == other.gateway && metric == other.metric;
+    }
+  };
+
+  // Whether |link| can carry the LAN address.
+  static bool IsPhysical(const NetworkInterface& link);
+
+  std::map<int, NetworkInterface> links_;
+  std::vector<Route> routes_;
+  bool dirty_ = false;
+  std::shared_ptr<const NetworkSnapshot> snapshot_;
+};
+
+#endif  // NATIVE_NETWORK_TABLE_H_
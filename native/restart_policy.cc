@@ -0,0 +1,112 @@
+#include "restart_policy.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// "0.6 s" from milliseconds.
+std::string Seconds(int64_t milliseconds) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.1f s", static_cast<double>(milliseconds) / 1000);
+  return text;
+}
+
+}  // namespace
+
+const char* RestartEventKindName(RestartEvent::Kind kind) {
+  switch (kind) {
+    case RestartEvent::Kind::kScheduled:
+      return "scheduled";
+    case RestartEvent::Kind::kRecovered:
+      return "recovered";
+    case RestartEvent::Kind::kGaveUp:
+      return "gaveUp";
+  }
+  return "";
+}
+
+std::string DescribeRestartEvent(const RestartEvent& event) {
+  std::string window = " within " + std::to_string(RestartPolicy::kCrashWindow.count()) + " s";
+  switch (event.kind) {
+    case RestartEvent::Kind::kScheduled:
+      return "🔄 sing-box " + event.exit_status + ", restarting in " + Seconds(event.delay_ms) + " (crash " +
+             std::to_string(event.crashes) + " of " + std::to_string(RestartPolicy::kCrashLimit) + window + ").\n";
+    case RestartEvent::Kind::kRecovered: {
+      std::string message = "✅ sing-box recovered in " + Seconds(event.recovery_ms) + " after " +
+                            std::to_string(event.attempt) + (event.attempt == 1 ? " restart" : " restarts");
+      if (event.stats.recoveries > 1) {
+        message += " (mean " + Seconds(event.stats.total_recovery_ms / event.stats.recoveries) + ", slowest " +
+                   Seconds(event.stats.max_recovery_ms) + ")";
+      }
+      return message + ".\n";
+    }
+    case RestartEvent::Kind::kGaveUp:
+      return "❌ sing-box crashed " + std::to_string(event.crashes) + " times" + window + ", last " +
+             event.exit_status + ". Not restarting it; the log above shows why it fails.\n";
+  }
+  return "";
+}
+
+RestartPolicy::RestartPolicy() : random_(std::random_device()()) {}
+
+void RestartPolicy::Reset() {
+  crashes_.clear();
+  recovering_ = false;
+  attempt_ = 0;
+}
+
+bool RestartPolicy::OnCrash(Clock::time_point now, RestartEvent* event) {
+  while (!crashes_.empty() && now - crashes_.front() >= kCrashWindow) {
+    crashes_.pop_front();
+  }
+  crashes_.push_back(now);
+  if (!recovering_) {
+    recovering_ = true;
+    outage_start_ = now;
+    attempt_ = 0;
+  }
+
+  event->crashes = static_cast<uint32_t>(crashes_.size());
+  event->attempt = attempt_;
+  if (crashes_.size() >= kCrashLimit) {
+    event->kind = RestartEvent::Kind::kGaveUp;
+    event->stats = stats_;
+    Reset();
+    return false;
+  }
+
+  // 2^(crashes - 1) steps, capped before the shift can overflow.
+  auto step = kInitialDelay * (int64_t{1} << std::min<size_t>(crashes_.size() - 1, 16));
+  step = std::min<std::chrono::milliseconds>(step, kMaxDelay);
+  std::uniform_int_distribution<int64_t> jitter(step.count() / 2, step.count());
+  attempt_++;
+  stats_.restarts++;
+  event->kind = RestartEvent::Kind::kScheduled;
+  event->attempt = attempt_;
+  event->delay_ms = jitter(random_);
+  event->stats = stats_;
+  return true;
+}
+
+bool RestartPolicy::OnReady(Clock::time_point now, RestartEvent* event) {
+  if (!recovering_) {
+    return false;
+  }
+  recovering_ = false;
+  int64_t recovery_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - outage_start_).count();
+  stats_.recoveries++;
+  stats_.last_recovery_ms = recovery_ms;
+  stats_.max_recovery_ms = std::max(stats_.max_recovery_ms, recovery_ms);
+  stats_.total_recovery_ms += recovery_ms;
+
+  event->kind = RestartEvent::Kind::kRecovered;
+  event->exit_status.clear();
+  event->crashes = static_cast<uint32_t>(crashes_.size());
+  event->attempt = attempt_;
+  event->delay_ms = 0;
+  event->recovery_ms = recovery_ms;
+  event->stats = stats_;
+  attempt_ = 0;
+  return true;
+}
@@ -0,0 +1,92 @@
+#ifndef NATIVE_RESTART_POLICY_H_
+#define NATIVE_RESTART_POLICY_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+
+// Recovery times since the runner started.
+struct RestartStats {
+  uint32_t restarts = 0;
+  uint32_t recoveries = 0;
+  // From the crash that began an outage until the restarted sing-box was
+  // ready, in milliseconds. -1 before the first recovery.
+  int64_t last_recovery_ms = -1;
+  int64_t max_recovery_ms = 0;
+  int64_t total_recovery_ms = 0;
+};
+
+// One step of the supervisor, as reported to the UI.
+struct RestartEvent {
+  enum class Kind : uint8_t {
+    // sing-box exited on its own and is restarted after |delay_ms|.
+    kScheduled,
+    // The restarted sing-box is ready, |recovery_ms| after the crash.
+    kRecovered,
+    // kCrashLimit crashes within kCrashWindow; it is left stopped.
+    kGaveUp,
+  };
+
+  Kind kind = Kind::kScheduled;
+  // How sing-box ended, e.g. "exited with code 1". Empty for kRecovered.
+  std::string exit_status;
+  // Crashes within the window, this one included.
+  uint32_t crashes = 0;
+  // Restarts since the outage began.
+  uint32_t attempt = 0;
+  int64_t delay_ms = 0;
+  int64_t recovery_ms = 0;
+  RestartStats stats;
+};
+
+// "scheduled", "recovered" or "gaveUp".
+const char* RestartEventKindName(RestartEvent::Kind kind);
+
+// One-line summary for the log, e.g. "🔄 sing-box exited with code 1,
+// restarting in 0.6 s (crash 1 of 5 within 120 s).\n".
+std::string DescribeRestartEvent(const RestartEvent& event);
+
+// Decides whether and when a sing-box that exited on its own is restarted.
+//
+// Delays grow exponentially from kInitialDelay with the crashes inside
+// kCrashWindow, capped at kMaxDelay, and each is drawn from the upper half
+// of its step so several runners that lost the same server do not come
+// back in lockstep. The kCrashLimit-th crash inside the window is a crash
+// loop and ends the restarts. Not thread-safe; each runner keeps it on its
+// supervising thread.
+class RestartPolicy {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::milliseconds kInitialDelay{500};
+  static constexpr std::chrono::milliseconds kMaxDelay{30000};
+  static constexpr uint32_t kCrashLimit = 5;
+  static constexpr std::chrono::seconds kCrashWindow{120};
+
+  RestartPolicy();
+
+  // Forgets earlier crashes, for a start the user asked for.
+  void Reset();
+
+  // Records a crash at |now| into |event|. Returns true with the event
+  // scheduled and its delay set, or false when this crash makes a loop.
+  bool OnCrash(Clock::time_point now, RestartEvent* event);
+  // The restarted sing-box became ready. Returns false, leaving |event|
+  // alone, when no restart was in progress.
+  bool OnReady(Clock::time_point now, RestartEvent* event);
+
+  const RestartStats& stats() const { return stats_; }
+
+ private:
+  std::deque<Clock::time_point> crashes_;
+  bool recovering_ = false;
+  Clock::time_point outage_start_;
+  uint32_t attempt_ = 0;
+  std::minstd_rand random_;
+  RestartStats stats_;
+};
+
+#endif  // NATIVE_RESTART_POLICY_H_
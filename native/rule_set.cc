@@ -0,0 +1,282 @@
+#include "rule_set.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+
+namespace {
+constexpr uint8_t kRuleSetVersion = 1;
+constexpr uint8_t kDefaultRule = 0;
+constexpr uint8_t kItemDomain = 2;
+constexpr uint8_t kItemDomainKeyword = 3;
+constexpr uint8_t kItemFinal = 0xff;
+constexpr uint8_t kSuccinctSetVersion = 0;
+// Ends a reversed key that matches any name below it.
+constexpr char kPrefixLabel = '\r';
+
+constexpr char kFilePrefix[] = "excluded-";
+constexpr char kFileSuffix[] = ".srs";
+
+void WriteUvarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void WriteBigEndian64(std::string* out, uint64_t value) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>(value >> shift));
+  }
+}
+
+void WriteWords(std::string* out, const std::vector<uint64_t>& words) {
+  WriteUvarint(out, words.size());
+  for (uint64_t word : words) {
+    WriteBigEndian64(out, word);
+  }
+}
+
+void SetBit(std::vector<uint64_t>* words, size_t index, bool value) {
+  if (words->size() <= index >> 6) {
+    words->resize((index >> 6) + 1);
+  }
+  if (value) {
+    (*words)[index >> 6] |= uint64_t{1} << (index & 63);
+  }
+}
+
+// Reverses |domain| by code point, keeping UTF-8 sequences intact.
+std::string ReverseDomain(std::string_view domain) {
+  std::string reversed(domain.size(), '\0');
+  size_t end = domain.size();
+  for (size_t i = 0; i < domain.size();) {
+    uint8_t lead = static_cast<uint8_t>(domain[i]);
+    size_t length = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+    length = std::min(length, domain.size() - i);
+    end -= length;
+    reversed.replace(end, length, domain.substr(i, length));
+    i += length;
+  }
+  return reversed;
+}
+
+// The succinct set sing-box keeps domain and domain_suffix items in: a
+// LOUDS-encoded trie over the reversed names. A suffix that starts with a
+// dot matches names below it; one without also matches itself.
+void WriteDomainMatcher(std::string* out, const std::vector<std::string>& suffixes) {
+  std::vector<std::string> keys;
+  keys.reserve(suffixes.size() * 2);
+  for (const std::string& suffix : suffixes) {
+    if (suffix.empty()) {
+      continue;
+    }
+    if (suffix[0] == '.') {
+      keys.push_back(ReverseDomain(suffix) + kPrefixLabel);
+    } else {
+      keys.push_back(ReverseDomain(suffix));
+      keys.push_back(ReverseDomain("." + suffix) + kPrefixLabel);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  // Breadth first, as sing-box builds it: every node adds a 0 bit and a
+  // label per child, then a closing 1 bit.
+  struct Node {
+    size_t begin;
+    size_t end;
+    size_t column;
+  };
+  std::vector<uint64_t> leaves;
+  std::vector<uint64_t> label_bitmap;
+  std::string labels;
+  std::vector<Node> queue;
+  size_t label_index = 0;
+  if (!keys.empty()) {
+    queue.push_back({0, keys.size(), 0});
+  }
+  for (size_t i = 0; i < queue.size(); i++) {
+    Node node = queue[i];
+    if (node.column == keys[node.begin].size()) {
+      node.begin++;
+      SetBit(&leaves, i, true);
+    }
+    for (size_t j = node.begin; j < node.end;) {
+      size_t from = j;
+      char label = keys[from][node.column];
+      while (j < node.end && keys[j][node.column] == label) {
+        j++;
+      }
+      queue.push_back({from, j, node.column + 1});
+      labels.push_back(label);
+      SetBit(&label_bitmap, label_index++, false);
+    }
+    SetBit(&label_bitmap, label_index++, true);
+  }
+
+  out->push_back(static_cast<char>(kSuccinctSetVersion));
+  WriteWords(out, leaves);
+  WriteWords(out, label_bitmap);
+  WriteUvarint(out, labels.size());
+  out->append(labels);
+}
+
+void WriteStrings(std::string* out, const std::vector<std::string>& values) {
+  WriteUvarint(out, values.size());
+  for (const std::string& value : values) {
+    WriteUvarint(out, value.size());
+    out->append(value);
+  }
+}
+
+// Wraps |data| in a zlib stream of stored blocks.
+void WriteZlibStored(std::string* out, std::string_view data) {
+  constexpr size_t kMaxBlock = 0xffff;
+  out->push_back(0x78);
+  out->push_back(0x01);
+  size_t offset = 0;
+  do {
+    size_t size = std::min(kMaxBlock, data.size() - offset);
+    bool final = offset + size == data.size();
+    out->push_back(static_cast<char>(final ? 1 : 0));
+    out->push_back(static_cast<char>(size));
+    out->push_back(static_cast<char>(size >> 8));
+    out->push_back(static_cast<char>(~size));
+    out->push_back(static_cast<char>(~size >> 8));
+    out->append(data.substr(offset, size));
+    offset += size;
+  } while (offset < data.size());
+
+  // Adler-32; 5552 bytes is the most that cannot overflow between modulos.
+  uint32_t a = 1;
+  uint32_t b = 0;
+  for (size_t i = 0; i < data.size();) {
+    size_t chunk_end = std::min(data.size(), i + 5552);
+    for (; i < chunk_end; i++) {
+      a += static_cast<uint8_t>(data[i]);
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  uint32_t adler = b << 16 | a;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>(adler >> shift));
+  }
+}
+
+// FNV-1a over the format version and the length-prefixed lists.
+uint64_t HashLists(const std::vector<std::string>& keywords, const std::vector<std::string>& suffixes) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto add = [&hash](uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      hash ^= static_cast<uint8_t>(value >> (i * 8));
+      hash *= 0x100000001b3ULL;
+    }
+  };
+  add(kRuleSetVersion);
+  for (const std::vector<std::string>* list : {&keywords, &suffixes}) {
+    add(list->size());
+    for (const std::string& value : *list) {
+      add(value.size());
+      for (char c : value) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+      }
+    }
+  }
+  return hash;
+}
+
+bool IsRuleSetName(const std::string& name) {
+  constexpr size_t kPrefixSize = sizeof(kFilePrefix) - 1;
+  constexpr size_t kSuffixSize = sizeof(kFileSuffix) - 1;
+  return name.size() > kPrefixSize + kSuffixSize && name.compare(0, kPrefixSize, kFilePrefix) == 0 &&
+         name.compare(name.size() - kSuffixSize, kSuffixSize, kFileSuffix) == 0;
+}
+}  // namespace
+
+bool CompileDomainRuleSet(const std::vector<std::string>& keywords, const std::vector<std::string>& suffixes,
+                          std::string* srs) {
+  bool has_suffixes = std::any_of(suffixes.begin(), suffixes.end(), [](const std::string& s) { return !s.empty(); });
+  if (keywords.empty() && !has_suffixes) {
+    return false;
+  }
+
+  std::string payload;
+  WriteUvarint(&payload, (has_suffixes ? 1u : 0u) + (keywords.empty() ? 0u : 1u));
+  if (has_suffixes) {
+    payload.push_back(static_cast<char>(kDefaultRule));
+    payload.push_back(static_cast<char>(kItemDomain));
+    WriteDomainMatcher(&payload, suffixes);
+    payload.push_back(static_cast<char>(kItemFinal));
+    payload.push_back(0);  // invert
+  }
+  if (!keywords.empty()) {
+    payload.push_back(static_cast<char>(kDefaultRule));
+    payload.push_back(static_cast<char>(kItemDomainKeyword));
+    WriteStrings(&payload, keywords);
+    payload.push_back(static_cast<char>(kItemFinal));
+    payload.push_back(0);
+  }
+
+  srs->assign("SRS");
+  srs->push_back(static_cast<char>(kRuleSetVersion));
+  WriteZlibStored(srs, payload);
+  return true;
+}
+
+bool EnsureDomainRuleSet(const std::filesystem::path& directory, const std::vector<std::string>& keywords,
+                         const std::vector<std::string>& suffixes, std::filesystem::path* path,
+                         std::string* error) {
+  char name[48];
+  snprintf(name, sizeof(name), "%s%016" PRIx64 "%s", kFilePrefix, HashLists(keywords, suffixes), kFileSuffix);
+  *path = directory / name;
+  std::error_code fs_error;
+  if (std::filesystem::is_regular_file(*path, fs_error)) {
+    return true;
+  }
+
+  std::string srs;
+  if (!CompileDomainRuleSet(keywords, suffixes, &srs)) {
+    *error = "Nothing to compile into a rule-set.";
+    return false;
+  }
+  std::filesystem::create_directories(directory, fs_error);
+  std::filesystem::path file = *path;
+  file += ".tmp";
+  {
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(srs.data(), static_cast<std::streamsize>(srs.size()));
+    if (!out.flush()) {
+      std::filesystem::remove(file, fs_error);
+      *error = "Could not write " + file.u8string() + ".";
+      return false;
+    }
+  }
+  std::filesystem::rename(file, *path, fs_error);
+  if (fs_error) {
+    *error = "Could not move the rule-set into place: " + fs_error.message();
+    std::filesystem::remove(file, fs_error);
+    return false;
+  }
+
+  std::vector<std::filesystem::path> stale;
+  for (std::filesystem::directory_iterator it(directory, fs_error), end; !fs_error && it != end;
+       it.increment(fs_error)) {
+    if (it->path() != *path && IsRuleSetName(it->path().filename().u8string())) {
+      stale.push_back(it->path());
+    }
+  }
+  for (const std::filesystem::path& old_path : stale) {
+    std::filesystem::remove(old_path, fs_error);
+  }
+  return true;
+}
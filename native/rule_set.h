@@ -0,0 +1,28 @@
+#ifndef NATIVE_RULE_SET_H_
+#define NATIVE_RULE_SET_H_
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Compiles the excluded domain lists into sing-box's binary rule-set (.srs)
+// format, version 1: one headless rule matching |suffixes| through the
+// succinct domain trie sing-box builds from domain_suffix, and one matching
+// |keywords| as domain_keyword. Either list may be empty, not both.
+//
+// Version 1 is what every sing-box since 1.8 reads. The payload goes into
+// stored zlib blocks rather than deflated ones: the file never leaves the
+// machine, and reading it back is then a copy.
+bool CompileDomainRuleSet(const std::vector<std::string>& keywords, const std::vector<std::string>& suffixes,
+                          std::string* srs);
+
+// Makes sure |directory| holds the rule-set for |keywords| and |suffixes|
+// and returns its path. Files are named after a hash of the lists, so
+// unchanged lists are never compiled twice; the rule-sets of earlier lists
+// are removed once a new one is written. Returns false with |error| set
+// when the file cannot be written.
+bool EnsureDomainRuleSet(const std::filesystem::path& directory, const std::vector<std::string>& keywords,
+                         const std::vector<std::string>& suffixes, std::filesystem::path* path,
+                         std::string* error);
+
+#endif  // NATIVE_RULE_SET_H_
@@ -0,0 +1,445 @@
+#include "server_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <system_error>
+
+namespace {
+constexpr uint32_t kCacheMagic = 0x43535748;  // "HWSC"
+constexpr uint32_t kCacheVersion = 1;
+
+// ServerRecord::flags.
+constexpr uint32_t kHasVless = 1 << 0;
+constexpr uint32_t kHasSsh = 1 << 1;
+constexpr uint32_t kHasHysteria2 = 1 << 2;
+constexpr uint32_t kHasIp = 1 << 3;
+constexpr uint32_t kHasVlessLink = 1 << 4;
+constexpr uint32_t kHasSshLink = 1 << 5;
+constexpr uint32_t kHasHysteria2Link = 1 << 6;
+
+enum LinkSlot { kVlessLink, kSshLink, kHysteria2Link, kLinkSlots };
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t country_count;
+  uint32_t server_count;
+  // Slots in the uuid index, a power of two above server_count.
+  uint32_t index_capacity;
+  uint32_t reserved0;
+  uint64_t countries_offset;
+  uint64_t servers_offset;
+  uint64_t index_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t links_offset;
+  uint64_t links_size;
+  uint8_t nonce[12];
+  // The first bytes of keystream block 0, which encrypts nothing.
+  uint8_t key_check[16];
+  uint8_t reserved[20];
+};
+static_assert(sizeof(FileHeader) == 128, "server cache header layout changed");
+
+// A range of the string table or of the link region.
+struct Span {
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct CountryRecord {
+  Span name;
+  Span code;
+  uint32_t first_server;
+  uint32_t server_count;
+};
+static_assert(sizeof(CountryRecord) == 24, "country record layout changed");
+
+struct ServerRecord {
+  Span uuid;
+  Span name;
+  Span ip;
+  Span status;
+  Span links[kLinkSlots];
+  uint32_t country;
+  uint32_t flags;
+};
+static_assert(sizeof(ServerRecord) == 64, "server record layout changed");
+
+template <typename T>
+T Load(const char* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint64_t HashUuid(std::string_view uuid) {
+  // FNV-1a.
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : uuid) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint32_t RotateLeft(uint32_t value, int bits) {
+  return value << bits | value >> (32 - bits);
+}
+
+void QuarterRound(uint32_t* state, int a, int b, int c, int d) {
+  state[a] += state[b];
+  state[d] = RotateLeft(state[d] ^ state[a], 16);
+  state[c] += state[d];
+  state[b] = RotateLeft(state[b] ^ state[c], 12);
+  state[a] += state[b];
+  state[d] = RotateLeft(state[d] ^ state[a], 8);
+  state[c] += state[d];
+  state[b] = RotateLeft(state[b] ^ state[c], 7);
+}
+
+// One 64-byte ChaCha20 keystream block (RFC 8439).
+void ChaChaBlock(const std::string& key, const uint8_t nonce[12], uint32_t counter, uint8_t out[64]) {
+  uint32_t input[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+  memcpy(&input[4], key.data(), 32);
+  input[12] = counter;
+  memcpy(&input[13], nonce, 12);
+  uint32_t state[16];
+  memcpy(state, input, sizeof(state));
+  for (int round = 0; round < 10; round++) {
+    QuarterRound(state, 0, 4, 8, 12);
+    QuarterRound(state, 1, 5, 9, 13);
+    QuarterRound(state, 2, 6, 10, 14);
+    QuarterRound(state, 3, 7, 11, 15);
+    QuarterRound(state, 0, 5, 10, 15);
+    QuarterRound(state, 1, 6, 11, 12);
+    QuarterRound(state, 2, 7, 8, 13);
+    QuarterRound(state, 3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; i++) {
+    state[i] += input[i];
+  }
+  memcpy(out, state, 64);
+}
+
+// XORs |size| bytes at |position| of the link region with the keystream.
+// Block 0 is reserved for the key check, so the region starts at block 1.
+void ApplyKeystream(const std::string& key, const uint8_t nonce[12], uint64_t position, char* data, size_t size) {
+  uint8_t block[64];
+  size_t done = 0;
+  while (done < size) {
+    uint64_t at = position + done;
+    ChaChaBlock(key, nonce, static_cast<uint32_t>(at / 64 + 1), block);
+    size_t skip = static_cast<size_t>(at % 64);
+    size_t count = std::min(size - done, 64 - skip);
+    for (size_t i = 0; i < count; i++) {
+      data[done + i] = static_cast<char>(data[done + i] ^ block[skip + i]);
+    }
+    done += count;
+  }
+}
+
+void KeyCheck(const std::string& key, const uint8_t nonce[12], uint8_t out[16]) {
+  uint8_t block[64];
+  ChaChaBlock(key, nonce, 0, block);
+  memcpy(out, block, 16);
+}
+
+// Whether |count| records of |size| bytes at |offset| lie within |file_size|.
+bool Fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+  return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+class Writer {
+ public:
+  Span AddString(const std::string& text) {
+    Span span{static_cast<uint32_t>(strings_.size()), static_cast<uint32_t>(text.size())};
+    strings_ += text;
+    return span;
+  }
+
+  Span AddLink(const std::string& link) {
+    Span span{static_cast<uint32_t>(links_.size()), static_cast<uint32_t>(link.size())};
+    links_ += link;
+    return span;
+  }
+
+  std::string& strings() { return strings_; }
+  std::string& links() { return links_; }
+
+ private:
+  std::string strings_;
+  std::string links_;
+};
+}  // namespace
+
+bool ServerCache::Open(const std::filesystem::path& path, const std::string& key) {
+  if (file_.is_open() && path == path_ && key == key_) {
+    return true;
+  }
+  Close();
+  if (key.size() != kKeySize || !file_.OpenReadOnly(path)) {
+    return false;
+  }
+  uint64_t size = file_.size();
+  if (size < sizeof(FileHeader)) {
+    Close();
+    return false;
+  }
+  FileHeader header = Load<FileHeader>(file_.data());
+  uint8_t check[16];
+  KeyCheck(key, header.nonce, check);
+  uint32_t capacity = header.index_capacity;
+  bool valid = header.magic == kCacheMagic && header.version == kCacheVersion &&
+               memcmp(check, header.key_check, sizeof(check)) == 0 && capacity > header.server_count &&
+               (capacity & (capacity - 1)) == 0 &&
+               Fits(header.countries_offset, header.country_count, sizeof(CountryRecord), size) &&
+               Fits(header.servers_offset, header.server_count, sizeof(ServerRecord), size) &&
+               Fits(header.index_offset, capacity, sizeof(uint32_t), size) &&
+               Fits(header.strings_offset, header.strings_size, 1, size) &&
+               Fits(header.links_offset, header.links_size, 1, size);
+  if (!valid) {
+    Close();
+    return false;
+  }
+  path_ = path;
+  key_ = key;
+  memcpy(nonce_, header.nonce, sizeof(nonce_));
+  return true;
+}
+
+bool ServerCache::Write(const std::filesystem::path& file, const std::vector<CachedCountry>& countries,
+                        const std::string& key) {
+  if (key.size() != kKeySize) {
+    return false;
+  }
+  size_t server_count = 0;
+  for (const CachedCountry& country : countries) {
+    server_count += country.servers.size();
+  }
+  uint32_t capacity = 16;
+  while (capacity < server_count * 2) {
+    capacity <<= 1;
+  }
+
+  FileHeader header = {};
+  header.magic = kCacheMagic;
+  header.version = kCacheVersion;
+  header.country_count = static_cast<uint32_t>(countries.size());
+  header.server_count = static_cast<uint32_t>(server_count);
+  header.index_capacity = capacity;
+  std::random_device random;
+  for (uint8_t& byte : header.nonce) {
+    byte = static_cast<uint8_t>(random());
+  }
+  KeyCheck(key, header.nonce, header.key_check);
+
+  Writer writer;
+  std::vector<CountryRecord> country_records;
+  std::vector<ServerRecord> server_records;
+  std::vector<uint32_t> index(capacity, 0);
+  country_records.reserve(countries.size());
+  server_records.reserve(server_count);
+  for (const CachedCountry& country : countries) {
+    CountryRecord record = {writer.AddString(country.name), writer.AddString(country.code),
+                            static_cast<uint32_t>(server_records.size()),
+                            static_cast<uint32_t>(country.servers.size())};
+    for (const CachedServer& server : country.servers) {
+      ServerRecord entry = {};
+      entry.uuid = writer.AddString(server.uuid);
+      entry.name = writer.AddString(server.name);
+      entry.ip = writer.AddString(server.ip);
+      entry.status = writer.AddString(server.status);
+      entry.links[kVlessLink] = writer.AddLink(server.vless_link);
+      entry.links[kSshLink] = writer.AddLink(server.ssh_link);
+      entry.links[kHysteria2Link] = writer.AddLink(server.hysteria2_link);
+      entry.country = static_cast<uint32_t>(country_records.size());
+      entry.flags = (server.has_vless ? kHasVless : 0u) | (server.has_ssh ? kHasSsh : 0u) |
+                    (server.has_hysteria2 ? kHasHysteria2 : 0u) | (server.has_ip ? kHasIp : 0u) |
+                    (server.has_vless_link ? kHasVlessLink : 0u) | (server.has_ssh_link ? kHasSshLink : 0u) |
+                    (server.has_hysteria2_link ? kHasHysteria2Link : 0u);
+      // A uuid listed twice resolves to its first server.
+      size_t slot = HashUuid(server.uuid) & (capacity - 1);
+      bool duplicate = false;
+      while (index[slot] != 0 && !duplicate) {
+        duplicate = server_records[index[slot] - 1].uuid.size == server.uuid.size() &&
+                    writer.strings().compare(server_records[index[slot] - 1].uuid.offset, server.uuid.size(),
+                                             server.uuid) == 0;
+        slot = (slot + 1) & (capacity - 1);
+      }
+      if (!duplicate) {
+        index[slot] = static_cast<uint32_t>(server_records.size() + 1);
+      }
+      server_records.push_back(entry);
+    }
+    country_records.push_back(record);
+  }
+  if (writer.strings().size() > UINT32_MAX || writer.links().size() > UINT32_MAX) {
+    return false;
+  }
+  ApplyKeystream(key, header.nonce, 0, writer.links().data(), writer.links().size());
+
+  header.countries_offset = sizeof(FileHeader);
+  header.servers_offset = header.countries_offset + country_records.size() * sizeof(CountryRecord);
+  header.index_offset = header.servers_offset + server_records.size() * sizeof(ServerRecord);
+  header.strings_offset = header.index_offset + index.size() * sizeof(uint32_t);
+  header.strings_size = writer.strings().size();
+  header.links_offset = header.strings_offset + header.strings_size;
+  header.links_size = writer.links().size();
+
+  std::error_code error;
+  std::filesystem::create_directories(file.parent_path(), error);
+  {
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(country_records.data()),
+              static_cast<std::streamsize>(country_records.size() * sizeof(CountryRecord)));
+    out.write(reinterpret_cast<const char*>(server_records.data()),
+              static_cast<std::streamsize>(server_records.size() * sizeof(ServerRecord)));
+    out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(uint32_t)));
+    out.write(writer.strings().data(), static_cast<std::streamsize>(writer.strings().size()));
+    out.write(writer.links().data(), static_cast<std::streamsize>(writer.links().size()));
+    if (!out.flush()) {
+      std::filesystem::remove(file, error);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ServerCache::Replace(const std::filesystem::path& file, const std::filesystem::path& path,
+                          const std::string& key) {
+  // Windows cannot replace a file that is still mapped.
+  Close();
+  std::error_code error;
+  std::filesystem::rename(file, path, error);
+  if (error) {
+    std::filesystem::remove(file, error);
+    return false;
+  }
+  return Open(path, key);
+}
+
+void ServerCache::Remove(const std::filesystem::path& path) {
+  Close();
+  std::error_code error;
+  std::filesystem::remove(path, error);
+}
+
+void ServerCache::Close() {
+  file_.Close();
+  path_.clear();
+  key_.clear();
+}
+
+std::vector<CountrySummary> ServerCache::ListCountries() const {
+  std::vector<CountrySummary> countries;
+  if (!file_.is_open()) {
+    return countries;
+  }
+  FileHeader header = Load<FileHeader>(file_.data());
+  countries.reserve(header.country_count);
+  for (uint32_t i = 0; i < header.country_count; i++) {
+    auto record = Load<CountryRecord>(file_.data() + header.countries_offset + i * sizeof(CountryRecord));
+    countries.push_back({std::string(Text(record.name.offset, record.name.size)), std::string(Text(record.code.offset, record.code.size)), record.server_count});
+  }
+  return countries;
+}
+
+bool ServerCache::ListCountry(std::string_view name, std::vector<CachedServer>* servers) const {
+  if (!file_.is_open()) {
+    return false;
+  }
+  FileHeader header = Load<FileHeader>(file_.data());
+  for (uint32_t i = 0; i < header.country_count; i++) {
+    auto record = Load<CountryRecord>(file_.data() + header.countries_offset + i * sizeof(CountryRecord));
+    if (Text(record.name.offset, record.name.size) != name) {
+      continue;
+    }
+    servers->clear();
+    if (record.first_server > header.server_count || record.server_count > header.server_count - record.first_server) {
+      return true;
+    }
+    servers->reserve(record.server_count);
+    for (uint32_t j = 0; j < record.server_count; j++) {
+      servers->push_back(LoadServer(record.first_server + j));
+    }
+    return true;
+  }
+  return false;
+}
+
+bool ServerCache::LookupServer(std::string_view uuid, CachedServer* server, std::string* country) const {
+  if (!file_.is_open()) {
+    return false;
+  }
+  FileHeader header = Load<FileHeader>(file_.data());
+  uint32_t mask = header.index_capacity - 1;
+  const char* index = file_.data() + header.index_offset;
+  // The index is never full, so the probe ends at an empty slot.
+  for (uint32_t slot = static_cast<uint32_t>(HashUuid(uuid)) & mask;; slot = (slot + 1) & mask) {
+    uint32_t entry = Load<uint32_t>(index + slot * sizeof(uint32_t));
+    if (entry == 0 || entry > header.server_count) {
+      return false;
+    }
+    auto record = Load<ServerRecord>(file_.data() + header.servers_offset + (entry - 1) * sizeof(ServerRecord));
+    if (Text(record.uuid.offset, record.uuid.size) != uuid) {
+      continue;
+    }
+    *server = LoadServer(entry - 1);
+    if (country != nullptr) {
+      country->clear();
+      if (record.country < header.country_count) {
+        auto owner = Load<CountryRecord>(file_.data() + header.countries_offset + record.country * sizeof(CountryRecord));
+        *country = std::string(Text(owner.name.offset, owner.name.size));
+      }
+    }
+    return true;
+  }
+}
+
+std::string_view ServerCache::Text(uint32_t offset, uint32_t size) const {
+  FileHeader header = Load<FileHeader>(file_.data());
+  if (offset > header.strings_size || size > header.strings_size - offset) {
+    return {};
+  }
+  return std::string_view(file_.data() + header.strings_offset + offset, size);
+}
+
+std::string ServerCache::Link(uint32_t offset, uint32_t size) const {
+  FileHeader header = Load<FileHeader>(file_.data());
+  if (offset > header.links_size || size > header.links_size - offset) {
+    return "";
+  }
+  std::string link(file_.data() + header.links_offset + offset, size);
+  ApplyKeystream(key_, nonce_, offset, link.data(), link.size());
+  return link;
+}
+
+CachedServer ServerCache::LoadServer(uint32_t index) const {
+  FileHeader header = Load<FileHeader>(file_.data());
+  auto record = Load<ServerRecord>(file_.data() + header.servers_offset + index * sizeof(ServerRecord));
+  CachedServer server;
+  server.uuid = std::string(Text(record.uuid.offset, record.uuid.size));
+  server.name = std::string(Text(record.name.offset, record.name.size));
+  server.status = std::string(Text(record.status.offset, record.status.size));
+  server.has_ip = (record.flags & kHasIp) != 0;
+  server.ip = std::string(Text(record.ip.offset, record.ip.size));
+  server.has_vless = (record.flags & kHasVless) != 0;
+  server.has_ssh = (record.flags & kHasSsh) != 0;
+  server.has_hysteria2 = (record.flags & kHasHysteria2) != 0;
+  server.has_vless_link = (record.flags & kHasVlessLink) != 0;
+  server.has_ssh_link = (record.flags & kHasSshLink) != 0;
+  server.has_hysteria2_link = (record.flags & kHasHysteria2Link) != 0;
+  if (server.has_vless_link) {
+    server.vless_link = Link(record.links[kVlessLink].offset, record.links[kVlessLink].size);
+  }
+  if (server.has_ssh_link) {
+    server.ssh_link = Link(record.links[kSshLink].offset, record.links[kSshLink].size);
+  }
+  if (server.has_hysteria2_link) {
+    server.hysteria2_link = Link(record.links[kHysteria2Link].offset, record.links[kHysteria2Link].size);
+  }
+  return server;
+}
@@ -0,0 +1,103 @@
+#ifndef NATIVE_SERVER_CACHE_H_
+#define NATIVE_SERVER_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.h"
+
+// One server of the country list, as the app's Server model has it. The
+// optional fields are empty strings with their has_ flag cleared.
+struct CachedServer {
+  std::string uuid;
+  std::string name;
+  std::string status;
+  bool has_ip = false;
+  std::string ip;
+  bool has_vless = false;
+  bool has_ssh = false;
+  bool has_hysteria2 = false;
+  bool has_vless_link = false;
+  std::string vless_link;
+  bool has_ssh_link = false;
+  std::string ssh_link;
+  bool has_hysteria2_link = false;
+  std::string hysteria2_link;
+};
+
+struct CachedCountry {
+  std::string name;
+  std::string code;
+  std::vector<CachedServer> servers;
+};
+
+struct CountrySummary {
+  std::string name;
+  std::string code;
+  size_t server_count = 0;
+};
+
+// The last fetched country list in a versioned binary file that is mapped
+// instead of parsed.
+//
+// After a fixed header come fixed-size country and server records, an
+// open-addressing hash index of server uuids, a string table and the link
+// region. Records refer to strings and links by offset, so a lookup reads
+// a handful of pages and nothing is decoded up front. Only the links are
+// secret: they are encrypted with ChaCha20 under a key the caller keeps in
+// the platform's secure storage, with a fresh nonce per file. The header
+// carries a check value, so a file written under another key is rejected
+// rather than decrypted into garbage.
+//
+// Not thread-safe; the runners only touch it on the platform thread.
+class ServerCache {
+ public:
+  static constexpr size_t kKeySize = 32;
+
+  ServerCache() = default;
+
+  ServerCache(const ServerCache&) = delete;
+  ServerCache& operator=(const ServerCache&) = delete;
+
+  // Maps |path| and checks it against |key|, which must be kKeySize bytes.
+  // Does nothing when |path| is already mapped under |key|. Returns false
+  // when the file is missing, damaged, from another version or was written
+  // under another key.
+  bool Open(const std::filesystem::path& path, const std::string& key);
+  // Writes |countries| to |file| under |key|. Encrypting the links of a
+  // large list takes tens of milliseconds, so this is static and safe on
+  // any thread; Replace() then moves the file into place.
+  static bool Write(const std::filesystem::path& file, const std::vector<CachedCountry>& countries,
+                    const std::string& key);
+  // Renames |file|, written by Write(), over |path| and maps it.
+  bool Replace(const std::filesystem::path& file, const std::filesystem::path& path, const std::string& key);
+  // Unmaps and deletes |path|.
+  void Remove(const std::filesystem::path& path);
+  void Close();
+  bool is_open() const { return file_.is_open(); }
+
+  std::vector<CountrySummary> ListCountries() const;
+  // Returns false when there is no country called |name|.
+  bool ListCountry(std::string_view name, std::vector<CachedServer>* servers) const;
+  // Returns false when no server has |uuid|. |country| may be null.
+  bool LookupServer(std::string_view uuid, CachedServer* server, std::string* country) const;
+
+ private:
+  // |size| bytes at |offset| in the string table, or empty when the range
+  // is out of bounds.
+  std::string_view Text(uint32_t offset, uint32_t size) const;
+  // Decrypts |size| bytes at |offset| in the link region.
+  std::string Link(uint32_t offset, uint32_t size) const;
+  CachedServer LoadServer(uint32_t index) const;
+
+  MappedFile file_;
+  std::filesystem::path path_;
+  std::string key_;
+  uint8_t nonce_[12] = {};
+};
+
+#endif  // NATIVE_SERVER_CACHE_H_
@@ -0,0 +1,123 @@
+#include "socks5.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
+
+namespace {
+
+bool ParseIpv4(std::string_view text, uint8_t bytes[4]) {
+  for (int i = 0; i < 4; i++) {
+    size_t end = i < 3 ? text.find('.') : text.size();
+    if (end == std::string_view::npos || end == 0 || end > 3) {
+      return false;
+    }
+    unsigned part = 0;
+    for (char c : text.substr(0, end)) {
+      if (c < '0' || c > '9') {
+        return false;
+      }
+      part = part * 10 + static_cast<unsigned>(c - '0');
+    }
+    if (part > 255) {
+      return false;
+    }
+    bytes[i] = static_cast<uint8_t>(part);
+    text.remove_prefix(i < 3 ? end + 1 : end);
+  }
+  return true;
+}
+
+void AppendUint16(std::string* out, uint16_t value) {
+  out->push_back(static_cast<char>(value >> 8));
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+}  // namespace
+
+void AppendSocksAddress(std::string* out, const std::string& host, uint16_t port) {
+  uint8_t ipv4[4];
+  if (ParseIpv4(host, ipv4)) {
+    out->push_back(0x01);
+    out->append(reinterpret_cast<const char*>(ipv4), 4);
+  } else {
+    out->push_back(0x03);
+    out->push_back(static_cast<char>(host.size()));
+    out->append(host);
+  }
+  AppendUint16(out, port);
+}
+
+size_t SocksAddressSize(const uint8_t* data, size_t size) {
+  if (size < 1) {
+    return 0;
+  }
+  size_t address_size;
+  switch (data[0]) {
+    case 0x01:
+      address_size = 4;
+      break;
+    case 0x04:
+      address_size = 16;
+      break;
+    case 0x03:
+      if (size < 2) {
+        return 0;
+      }
+      address_size = 1 + static_cast<size_t>(data[1]);
+      break;
+    default:
+      return 0;
+  }
+  size_t total = 1 + address_size + 2;
+  return size >= total ? total : 0;
+}
+
+std::string FormatSocksAddress(const uint8_t* data, uint16_t* port) {
+  std::string address;
+  size_t port_offset;
+  if (data[0] == 0x01) {
+    if (data[1] | data[2] | data[3] | data[4]) {
+      char text[16];
+      snprintf(text, sizeof(text), "%u.%u.%u.%u", data[1], data[2], data[3], data[4]);
+      address = text;
+    }
+    port_offset = 5;
+  } else if (data[0] == 0x04) {
+    bool wildcard = std::all_of(data + 1, data + 17, [](uint8_t byte) { return byte == 0; });
+    for (int i = 0; i < 8 && !wildcard; i++) {
+      char group[8];
+      snprintf(group, sizeof(group), i == 0 ? "%x" : ":%x", data[1 + i * 2] << 8 | data[2 + i * 2]);
+      address += group;
+    }
+    port_offset = 17;
+  } else {
+    address.assign(reinterpret_cast<const char*>(data + 2), data[1]);
+    port_offset = 2 + static_cast<size_t>(data[1]);
+  }
+  *port = static_cast<uint16_t>(data[port_offset] << 8 | data[port_offset + 1]);
+  return address;
+}
+
+const char* SocksReplyError(uint8_t code) {
+  switch (code) {
+    case 0x01:
+      return "general failure";
+    case 0x02:
+      return "not allowed by ruleset";
+    case 0x03:
+      return "network unreachable";
+    case 0x04:
+      return "host unreachable";
+    case 0x05:
+      return "connection refused";
+    case 0x06:
+      return "TTL expired";
+    case 0x07:
+      return "command not supported";
+    case 0x08:
+      return "address type not supported";
+    default:
+      return "unknown error";
+  }
+}
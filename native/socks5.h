@@ -0,0 +1,26 @@
+#ifndef NATIVE_SOCKS5_H_
+#define NATIVE_SOCKS5_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// SOCKS5 framing shared by the tests that go through the mixed inbound.
+
+// DST.ADDR and DST.PORT of a SOCKS5 request or UDP header. IPv4 literals go
+// as addresses and everything else as a name, which sing-box also accepts
+// for IPv6 literals.
+void AppendSocksAddress(std::string* out, const std::string& host, uint16_t port);
+
+// Size of the ATYP, address and port at the start of |data|, or 0 when it
+// is cut short or of an unknown type.
+size_t SocksAddressSize(const uint8_t* data, size_t size);
+
+// The bound address of a SOCKS5 reply, or empty for a wildcard. |data|
+// holds at least SocksAddressSize() bytes.
+std::string FormatSocksAddress(const uint8_t* data, uint16_t* port);
+
+// "connection refused" and the like for a reply code.
+const char* SocksReplyError(uint8_t code);
+
+#endif  // NATIVE_SOCKS5_H_
@@ -0,0 +1,630 @@
+#include "speed_test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#include "socks5.h"
+
+namespace {
+
+constexpr size_t kMaxHeadSize = 16 * 1024;
+constexpr size_t kMaxChunkLine = 1024;
+constexpr size_t kFillSize = 64 * 1024;
+
+// Upload bodies: pseudo-random, so nothing along the way can compress them
+// into a better figure.
+const std::string& FillBlock() {
+  static const std::string block = []() {
+    std::string bytes(kFillSize, '\0');
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (char& byte : bytes) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      byte = static_cast<char>(state);
+    }
+    return bytes;
+  }();
+  return block;
+}
+
+char ToLower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (ToLower(a[i]) != ToLower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ContainsIgnoreCase(std::string_view text, std::string_view word) {
+  for (size_t i = 0; i + word.size() <= text.size(); i++) {
+    if (EqualsIgnoreCase(text.substr(i, word.size()), word)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string_view Trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+bool ParseDecimal(std::string_view text, uint64_t* value) {
+  if (text.empty() || text.size() > 19) {
+    return false;
+  }
+  uint64_t result = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    result = result * 10 + static_cast<uint64_t>(c - '0');
+  }
+  *value = result;
+  return true;
+}
+
+// Nearest rank.
+int64_t Percentile(const std::vector<int64_t>& sorted, double fraction) {
+  size_t rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size()) + 0.999999);
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+uint64_t ReadUint64(const uint8_t* data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value = value << 8 | data[i];
+  }
+  return value;
+}
+
+void AppendUint64(std::string* out, uint64_t value) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>(value >> shift));
+  }
+}
+
+}  // namespace
+
+const char* SpeedTestPhaseName(SpeedTestPhase phase) {
+  switch (phase) {
+    case SpeedTestPhase::kDownload:
+      return "download";
+    case SpeedTestPhase::kUpload:
+      return "upload";
+    case SpeedTestPhase::kUdp:
+      return "udp";
+  }
+  return "";
+}
+
+bool ParseHttpUrl(std::string_view url, HttpUrl* parsed) {
+  constexpr std::string_view kScheme = "http://";
+  if (url.size() <= kScheme.size() || !EqualsIgnoreCase(url.substr(0, kScheme.size()), kScheme)) {
+    return false;
+  }
+  url.remove_prefix(kScheme.size());
+  url = url.substr(0, url.find('#'));
+  size_t authority_end = url.find_first_of("/?");
+  std::string_view authority = url.substr(0, authority_end);
+  std::string_view target = authority_end == std::string_view::npos ? std::string_view() : url.substr(authority_end);
+  if (authority.find('@') != std::string_view::npos) {
+    return false;
+  }
+
+  std::string_view host = authority;
+  std::string_view port;
+  if (!authority.empty() && authority.front() == '[') {
+    size_t close = authority.find(']');
+    if (close == std::string_view::npos) {
+      return false;
+    }
+    host = authority.substr(1, close - 1);
+    std::string_view rest = authority.substr(close + 1);
+    if (!rest.empty()) {
+      if (rest.front() != ':') {
+        return false;
+      }
+      port = rest.substr(1);
+    }
+  } else if (size_t colon = authority.rfind(':'); colon != std::string_view::npos) {
+    host = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  }
+  uint64_t port_number = 80;
+  if (host.empty() || host.size() > 255 || (!port.empty() && (!ParseDecimal(port, &port_number) ||
+                                                              port_number == 0 || port_number > 65535))) {
+    return false;
+  }
+
+  parsed->host.clear();
+  for (char c : host) {
+    parsed->host.push_back(ToLower(c));
+  }
+  parsed->port = static_cast<uint16_t>(port_number);
+  parsed->target = target.empty() || target.front() == '?' ? "/" + std::string(target) : std::string(target);
+  return true;
+}
+
+std::string MixedInboundDialAddress(std::string_view listen_address) {
+  if (listen_address.empty() || listen_address == "0.0.0.0" || EqualsIgnoreCase(listen_address, "localhost")) {
+    return "127.0.0.1";
+  }
+  if (listen_address == "::" || listen_address == "[::]") {
+    return "::1";
+  }
+  if (listen_address.size() > 2 && listen_address.front() == '[' && listen_address.back() == ']') {
+    listen_address = listen_address.substr(1, listen_address.size() - 2);
+  }
+  return std::string(listen_address);
+}
+
+std::vector<SpeedTestPhase> PlannedSpeedTestPhases(const SpeedTestOptions& options) {
+  std::vector<SpeedTestPhase> phases;
+  if (!options.download_url.host.empty()) {
+    phases.push_back(SpeedTestPhase::kDownload);
+  }
+  if (!options.upload_url.host.empty()) {
+    phases.push_back(SpeedTestPhase::kUpload);
+  }
+  if (!options.udp_echo_host.empty() && options.udp_echo_port != 0) {
+    phases.push_back(SpeedTestPhase::kUdp);
+  }
+  return phases;
+}
+
+SpeedTestMeter::SpeedTestMeter(SpeedTestPhase phase, SpeedTestClock::time_point start,
+                               SpeedTestClock::duration warmup)
+    : start_(start), warm_(start + warmup) {
+  result_.phase = phase;
+}
+
+void SpeedTestMeter::AddBytes(uint64_t size, SpeedTestClock::time_point now) {
+  result_.bytes += size;
+  if (now < warm_) {
+    warmup_bytes_ += size;
+  }
+}
+
+void SpeedTestMeter::AddRtt(SpeedTestClock::duration rtt) {
+  rtts_.push_back(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+}
+
+SpeedTestResult SpeedTestMeter::Finish(SpeedTestClock::time_point end) const {
+  SpeedTestResult result = result_;
+  // A phase cut short inside the warm-up is measured whole.
+  bool warmed = end > warm_ && result.bytes > warmup_bytes_;
+  double seconds = std::chrono::duration<double>(end - (warmed ? warm_ : start_)).count();
+  if (seconds > 0) {
+    result.goodput_bps = static_cast<double>(warmed ? result.bytes - warmup_bytes_ : result.bytes) * 8 / seconds;
+  }
+
+  result.rtt_samples = rtts_.size();
+  if (!rtts_.empty()) {
+    int64_t deltas = 0;
+    for (size_t i = 1; i < rtts_.size(); i++) {
+      deltas += std::abs(rtts_[i] - rtts_[i - 1]);
+    }
+    result.jitter_us = rtts_.size() > 1 ? deltas / static_cast<int64_t>(rtts_.size() - 1) : 0;
+    std::vector<int64_t> sorted = rtts_;
+    std::sort(sorted.begin(), sorted.end());
+    result.rtt_p50_us = Percentile(sorted, 0.50);
+    result.rtt_p99_us = Percentile(sorted, 0.99);
+  }
+  return result;
+}
+
+SpeedTestStream::SpeedTestStream(SpeedTestPhase phase, const HttpUrl& url, uint64_t upload_size,
+                                 SpeedTestMeter* meter)
+    : phase_(phase), url_(url), upload_size_(upload_size), meter_(meter) {
+  // Version 5, one method: no authentication.
+  out_.assign("\x05\x01\x00", 3);
+}
+
+std::string_view SpeedTestStream::output() const {
+  if (out_sent_ < out_.size()) {
+    return std::string_view(out_).substr(out_sent_);
+  }
+  if (body_to_send_ > 0) {
+    return std::string_view(FillBlock()).substr(0, static_cast<size_t>(std::min<uint64_t>(body_to_send_, kFillSize)));
+  }
+  return {};
+}
+
+void SpeedTestStream::OnSent(size_t size, SpeedTestClock::time_point now) {
+  size_t from_out = std::min(size, out_.size() - out_sent_);
+  out_sent_ += from_out;
+  if (out_sent_ == out_.size()) {
+    out_.clear();
+    out_sent_ = 0;
+  }
+  size_t body = std::min<uint64_t>(size - from_out, body_to_send_);
+  if (body > 0) {
+    body_to_send_ -= body;
+    meter_->AddBytes(body, now);
+  }
+  if (!request_timed_ && state_ == State::kHead && out_.empty() && body_to_send_ == 0) {
+    request_timed_ = true;
+    request_sent_ = now;
+  }
+}
+
+bool SpeedTestStream::OnReceived(const char* data, size_t size, SpeedTestClock::time_point now) {
+  while (size > 0) {
+    switch (state_) {
+      case State::kFailed:
+        return false;
+      case State::kAssociated:
+      case State::kFinished:
+        // Nothing more is expected on this connection.
+        return true;
+      case State::kBody: {
+        size_t used = 0;
+        if (!OnBody(data, size, now, &used)) {
+          return false;
+        }
+        data += used;
+        size -= used;
+        continue;
+      }
+      default:
+        break;
+    }
+
+    if (state_ == State::kHead && in_.empty() && request_timed_ && phase_ == SpeedTestPhase::kDownload) {
+      meter_->AddRtt(now - request_sent_);
+      request_timed_ = false;
+    }
+    in_.append(data, size);
+    size = 0;
+
+    const auto* bytes = reinterpret_cast<const uint8_t*>(in_.data());
+    if (state_ == State::kGreeting) {
+      if (in_.size() < 2) {
+        return true;
+      }
+      if (bytes[0] != 0x05 || bytes[1] != 0x00) {
+        return Fail("The proxy refused the SOCKS5 greeting.");
+      }
+      in_.erase(0, 2);
+      // CONNECT, or UDP ASSOCIATE from any local address.
+      if (phase_ == SpeedTestPhase::kUdp) {
+        out_.append("\x05\x03\x00\x01\x00\x00\x00\x00\x00\x00", 10);
+      } else {
+        out_.append("\x05\x01\x00", 3);
+        AppendSocksAddress(&out_, url_.host, url_.port);
+      }
+      state_ = State::kConnect;
+      bytes = reinterpret_cast<const uint8_t*>(in_.data());
+    }
+    if (state_ == State::kConnect) {
+      if (in_.size() < 3) {
+        return true;
+      }
+      if (bytes[0] != 0x05) {
+        return Fail("The proxy does not speak SOCKS5.");
+      }
+      if (bytes[1] != 0x00) {
+        return Fail(std::string("The proxy could not connect: ") + SocksReplyError(bytes[1]) + ".");
+      }
+      size_t address_size = SocksAddressSize(bytes + 3, in_.size() - 3);
+      if (address_size == 0) {
+        bool known_type = in_.size() < 4 || bytes[3] == 0x01 || bytes[3] == 0x03 || bytes[3] == 0x04;
+        return known_type || Fail("The proxy sent a malformed SOCKS5 reply.");
+      }
+      if (phase_ == SpeedTestPhase::kUdp) {
+        relay_ip_ = FormatSocksAddress(bytes + 3, &relay_port_);
+        in_.clear();
+        state_ = State::kAssociated;
+        return true;
+      }
+      std::string rest = in_.substr(3 + address_size);
+      StartRequest();
+      return rest.empty() || OnReceived(rest.data(), rest.size(), now);
+    }
+
+    // State::kHead.
+    size_t head_end = in_.find("\r\n\r\n");
+    if (head_end == std::string::npos) {
+      return in_.size() <= kMaxHeadSize || Fail("The response head is too large.");
+    }
+    std::string rest = in_.substr(head_end + 4);
+    if (in_.size() > 12 && in_.compare(0, 7, "HTTP/1.") == 0 && in_[9] == '1') {
+      // An interim response; the real one follows.
+      in_.clear();
+      return rest.empty() || OnReceived(rest.data(), rest.size(), now);
+    }
+    if (!ParseHead(head_end + 4)) {
+      return false;
+    }
+    in_.clear();
+    if (framing_ == Framing::kLength && body_remaining_ == 0) {
+      EndResponse();
+    } else {
+      state_ = State::kBody;
+    }
+    return rest.empty() || OnReceived(rest.data(), rest.size(), now);
+  }
+  return state_ != State::kFailed;
+}
+
+bool SpeedTestStream::OnClosed() {
+  if (state_ == State::kBody && framing_ == Framing::kClose) {
+    state_ = State::kFinished;
+    return true;
+  }
+  if (state_ == State::kFinished) {
+    return true;
+  }
+  if (state_ == State::kHead && in_.empty() && responses_ > 0) {
+    // The server dropped an idle keep-alive connection as the next request
+    // went out; the runner simply opens another.
+    state_ = State::kFinished;
+    return true;
+  }
+  return Fail(state_ == State::kGreeting || state_ == State::kConnect || state_ == State::kAssociated
+                  ? "The proxy closed the connection."
+                  : "The server closed the connection mid-response.");
+}
+
+void SpeedTestStream::StartRequest() {
+  std::string host = url_.host.find(':') != std::string::npos ? "[" + url_.host + "]" : url_.host;
+  if (url_.port != 80) {
+    host += ":" + std::to_string(url_.port);
+  }
+  bool upload = phase_ == SpeedTestPhase::kUpload;
+  out_ += upload ? "POST " : "GET ";
+  out_ += url_.target;
+  out_ += " HTTP/1.1\r\nHost: ";
+  out_ += host;
+  out_ += "\r\nUser-Agent: hwl-vpn-speed-test\r\nAccept-Encoding: identity\r\nCache-Control: no-cache\r\n";
+  if (upload) {
+    out_ += "Content-Type: application/octet-stream\r\nContent-Length: ";
+    out_ += std::to_string(upload_size_);
+    out_ += "\r\n";
+    body_to_send_ = upload_size_;
+  }
+  out_ += "\r\n";
+  in_.clear();
+  request_timed_ = false;
+  framing_ = Framing::kLength;
+  reusable_ = true;
+  body_remaining_ = 0;
+  chunk_line_.clear();
+  chunk_remaining_ = 0;
+  chunk_crlf_ = 0;
+  in_trailer_ = false;
+  state_ = State::kHead;
+}
+
+bool SpeedTestStream::Fail(std::string error) {
+  state_ = State::kFailed;
+  error_ = std::move(error);
+  return false;
+}
+
+bool SpeedTestStream::ParseHead(size_t head_size) {
+  std::string_view head(in_.data(), head_size);
+  size_t line_end = head.find("\r\n");
+  std::string_view status_line = head.substr(0, line_end);
+  uint64_t status = 0;
+  if (status_line.size() < 12 || status_line.compare(0, 7, "HTTP/1.") != 0 ||
+      !ParseDecimal(status_line.substr(9, 3), &status)) {
+    return Fail("The server did not answer with HTTP.");
+  }
+  if (status < 200 || status > 299) {
+    return Fail("The server answered HTTP " + std::to_string(status) + ".");
+  }
+  reusable_ = status_line[7] == '1';
+
+  bool has_length = false;
+  bool chunked = false;
+  for (size_t start = line_end + 2; start < head.size();) {
+    size_t end = head.find("\r\n", start);
+    std::string_view line = head.substr(start, end - start);
+    start = end + 2;
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    std::string_view name = Trim(line.substr(0, colon));
+    std::string_view value = Trim(line.substr(colon + 1));
+    if (EqualsIgnoreCase(name, "content-length")) {
+      has_length = ParseDecimal(value, &body_remaining_);
+    } else if (EqualsIgnoreCase(name, "transfer-encoding")) {
+      chunked = ContainsIgnoreCase(value, "chunked");
+    } else if (EqualsIgnoreCase(name, "connection")) {
+      if (ContainsIgnoreCase(value, "close")) {
+        reusable_ = false;
+      } else if (ContainsIgnoreCase(value, "keep-alive")) {
+        reusable_ = true;
+      }
+    }
+  }
+  if (chunked) {
+    framing_ = Framing::kChunked;
+  } else if (has_length) {
+    framing_ = Framing::kLength;
+  } else {
+    framing_ = Framing::kClose;
+    reusable_ = false;
+  }
+  return true;
+}
+
+bool SpeedTestStream::OnBody(const char* data, size_t size, SpeedTestClock::time_point now, size_t* used) {
+  bool counted = phase_ == SpeedTestPhase::kDownload;
+  if (framing_ == Framing::kClose) {
+    if (counted) {
+      meter_->AddBytes(size, now);
+    }
+    *used = size;
+    return true;
+  }
+  if (framing_ == Framing::kLength) {
+    size_t take = static_cast<size_t>(std::min<uint64_t>(size, body_remaining_));
+    body_remaining_ -= take;
+    if (counted) {
+      meter_->AddBytes(take, now);
+    }
+    *used = take;
+    if (body_remaining_ == 0) {
+      EndResponse();
+    }
+    return true;
+  }
+
+  size_t i = 0;
+  while (i < size) {
+    if (chunk_remaining_ > 0) {
+      size_t take = static_cast<size_t>(std::min<uint64_t>(size - i, chunk_remaining_));
+      chunk_remaining_ -= take;
+      if (counted) {
+        meter_->AddBytes(take, now);
+      }
+      i += take;
+      if (chunk_remaining_ == 0) {
+        chunk_crlf_ = 2;
+      }
+      continue;
+    }
+    if (chunk_crlf_ > 0) {
+      chunk_crlf_--;
+      i++;
+      continue;
+    }
+    char c = data[i++];
+    if (c != '\n') {
+      if (chunk_line_.size() >= kMaxChunkLine) {
+        return Fail("The server sent a malformed chunk.");
+      }
+      chunk_line_.push_back(c);
+      continue;
+    }
+    std::string_view line = Trim(chunk_line_);
+    if (in_trailer_) {
+      if (line.empty()) {
+        *used = i;
+        EndResponse();
+        return true;
+      }
+      chunk_line_.clear();
+      continue;
+    }
+    line = line.substr(0, line.find(';'));
+    uint64_t chunk_size = 0;
+    if (line.empty() || line.size() > 15) {
+      return Fail("The server sent a malformed chunk.");
+    }
+    for (char digit : line) {
+      int value = digit >= '0' && digit <= '9'   ? digit - '0'
+                  : digit >= 'a' && digit <= 'f' ? digit - 'a' + 10
+                  : digit >= 'A' && digit <= 'F' ? digit - 'A' + 10
+                                                 : -1;
+      if (value < 0) {
+        return Fail("The server sent a malformed chunk.");
+      }
+      chunk_size = chunk_size << 4 | static_cast<uint64_t>(value);
+    }
+    chunk_line_.clear();
+    if (chunk_size == 0) {
+      in_trailer_ = true;
+    } else {
+      chunk_remaining_ = chunk_size;
+    }
+  }
+  *used = i;
+  return true;
+}
+
+void SpeedTestStream::EndResponse() {
+  responses_++;
+  if (reusable_) {
+    StartRequest();
+  } else {
+    state_ = State::kFinished;
+  }
+}
+
+SpeedTestUdpFlow::SpeedTestUdpFlow(const std::string& host, uint16_t port, SpeedTestMeter* meter)
+    : flow_id_(std::random_device{}() | static_cast<uint64_t>(std::random_device{}()) << 32), meter_(meter) {
+  // RSV, FRAG 0, then the destination.
+  header_.assign("\x00\x00\x00", 3);
+  AppendSocksAddress(&header_, host, port);
+}
+
+bool SpeedTestUdpFlow::NextDatagram(SpeedTestClock::time_point now, std::string* datagram) {
+  if (outstanding_ >= kWindow) {
+    return false;
+  }
+  uint64_t sequence = next_sequence_++;
+  datagram->assign(header_);
+  AppendUint64(datagram, flow_id_);
+  AppendUint64(datagram, sequence);
+  datagram->append(std::string_view(FillBlock()).substr(0, kPayloadSize - 16));
+  in_flight_.push_back({sequence, now, false});
+  outstanding_++;
+  meter_->AddDatagram();
+  return true;
+}
+
+void SpeedTestUdpFlow::OnDatagram(const char* data, size_t size, SpeedTestClock::time_point now) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+  if (size < 4 || bytes[2] != 0) {
+    return;
+  }
+  size_t address_size = SocksAddressSize(bytes + 3, size - 3);
+  if (address_size == 0 || size - 3 - address_size < 16) {
+    return;
+  }
+  const uint8_t* payload = bytes + 3 + address_size;
+  size_t payload_size = size - 3 - address_size;
+  if (ReadUint64(payload) != flow_id_ || in_flight_.empty()) {
+    return;
+  }
+  uint64_t sequence = ReadUint64(payload + 8);
+  uint64_t first = in_flight_.front().sequence;
+  if (sequence < first || sequence - first >= in_flight_.size()) {
+    return;
+  }
+  InFlight& entry = in_flight_[static_cast<size_t>(sequence - first)];
+  if (entry.answered) {
+    return;
+  }
+  entry.answered = true;
+  outstanding_--;
+  meter_->AddRtt(now - entry.sent);
+  meter_->AddBytes(payload_size, now);
+  PopAnswered();
+}
+
+void SpeedTestUdpFlow::Expire(SpeedTestClock::time_point now) {
+  while (!in_flight_.empty() && (in_flight_.front().answered || now - in_flight_.front().sent >= kLossTimeout)) {
+    if (!in_flight_.front().answered) {
+      outstanding_--;
+      meter_->AddLostDatagram();
+    }
+    in_flight_.pop_front();
+  }
+}
+
+void SpeedTestUdpFlow::PopAnswered() {
+  while (!in_flight_.empty() && in_flight_.front().answered) {
+    in_flight_.pop_front();
+  }
+}
@@ -0,0 +1,236 @@
+#ifndef NATIVE_SPEED_TEST_H_
+#define NATIVE_SPEED_TEST_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Throughput tests through the mixed inbound sing-box opens at
+// mixed_inbound_listen_port, shared by the runners' speed testers. The
+// runners own the sockets; the classes here only turn received bytes into
+// bytes to send and into figures, so both platforms speak the same SOCKS5
+// and HTTP.
+
+using SpeedTestClock = std::chrono::steady_clock;
+
+enum class SpeedTestPhase : uint8_t {
+  // Parallel streams of back-to-back HTTP GETs of the download URL.
+  kDownload,
+  // Parallel streams of back-to-back HTTP POSTs to the upload URL.
+  kUpload,
+  // Datagrams bounced off a UDP echo service through SOCKS5 UDP ASSOCIATE.
+  kUdp,
+};
+
+// "download", "upload" or "udp".
+const char* SpeedTestPhaseName(SpeedTestPhase phase);
+
+// An http:// URL split for a request sent through the proxy. There is no
+// TLS here; the tunnel already encrypts.
+struct HttpUrl {
+  std::string host;
+  uint16_t port = 80;
+  // Path and query; "/" when the URL has neither.
+  std::string target;
+};
+
+// Returns false for anything but an http:// URL with a host.
+bool ParseHttpUrl(std::string_view url, HttpUrl* parsed);
+
+// Where to reach a mixed inbound that listens on |listen_address|: the
+// loopback address for a wildcard, empty or "localhost" one.
+std::string MixedInboundDialAddress(std::string_view listen_address);
+
+constexpr size_t kMaxSpeedTestStreams = 32;
+
+struct SpeedTestOptions {
+  // IP literal and port of the mixed inbound.
+  std::string proxy_ip;
+  uint16_t proxy_port = 0;
+  // A phase whose host is empty is skipped.
+  HttpUrl download_url;
+  HttpUrl upload_url;
+  std::string udp_echo_host;
+  uint16_t udp_echo_port = 0;
+  // TCP streams per phase, 1 to kMaxSpeedTestStreams.
+  size_t streams = 4;
+  std::chrono::milliseconds phase_duration{10000};
+  // Body size of each upload request.
+  uint64_t upload_size = 16 << 20;
+};
+
+// The phases |options| asks for, in the order they run.
+std::vector<SpeedTestPhase> PlannedSpeedTestPhases(const SpeedTestOptions& options);
+
+// What one phase measured. Round trips are -1 without samples.
+struct SpeedTestResult {
+  SpeedTestPhase phase = SpeedTestPhase::kDownload;
+  // Payload bytes moved, warm-up included.
+  uint64_t bytes = 0;
+  // Payload bits per second after the warm-up.
+  double goodput_bps = 0;
+  // Request to first response byte for downloads, echo round trips for
+  // UDP; uploads have none.
+  size_t rtt_samples = 0;
+  int64_t rtt_p50_us = -1;
+  int64_t rtt_p99_us = -1;
+  // Mean difference between consecutive round trips.
+  int64_t jitter_us = -1;
+  uint64_t datagrams_sent = 0;
+  uint64_t datagrams_lost = 0;
+  size_t failed_streams = 0;
+};
+
+// Accumulates one phase. Bytes moved during |warmup| count toward bytes
+// but not goodput, which leaves out TCP slow start and the tunnel dialing
+// out.
+class SpeedTestMeter {
+ public:
+  SpeedTestMeter(SpeedTestPhase phase, SpeedTestClock::time_point start, SpeedTestClock::duration warmup);
+
+  void AddBytes(uint64_t size, SpeedTestClock::time_point now);
+  void AddRtt(SpeedTestClock::duration rtt);
+  void AddDatagram() { result_.datagrams_sent++; }
+  void AddLostDatagram() { result_.datagrams_lost++; }
+  void AddFailedStream() { result_.failed_streams++; }
+
+  uint64_t bytes() const { return result_.bytes; }
+  SpeedTestClock::time_point start() const { return start_; }
+  SpeedTestResult Finish(SpeedTestClock::time_point end) const;
+
+ private:
+  SpeedTestResult result_;
+  SpeedTestClock::time_point start_;
+  SpeedTestClock::time_point warm_;
+  uint64_t warmup_bytes_ = 0;
+  // Microseconds, in arrival order.
+  std::vector<int64_t> rtts_;
+};
+
+// One TCP connection to the mixed inbound: the SOCKS5 greeting, then
+// CONNECT and HTTP requests back to back for the TCP phases, or UDP
+// ASSOCIATE for the UDP phase, where the connection only holds the
+// association open.
+class SpeedTestStream {
+ public:
+  // |meter| must outlive the stream.
+  SpeedTestStream(SpeedTestPhase phase, const HttpUrl& url, uint64_t upload_size, SpeedTestMeter* meter);
+
+  SpeedTestStream(const SpeedTestStream&) = delete;
+  SpeedTestStream& operator=(const SpeedTestStream&) = delete;
+
+  // Bytes to send next; empty while the stream waits for the peer.
+  std::string_view output() const;
+  // The first |size| bytes of output() were sent.
+  void OnSent(size_t size, SpeedTestClock::time_point now);
+  // Returns false once the stream has failed; error() says why.
+  bool OnReceived(const char* data, size_t size, SpeedTestClock::time_point now);
+  // The peer closed. Returns false when that cut a response short.
+  bool OnClosed();
+
+  // Set once a response ended a connection the server will not reuse; the
+  // runner opens a new one.
+  bool finished() const { return state_ == State::kFinished; }
+  bool failed() const { return state_ == State::kFailed; }
+  const std::string& error() const { return error_; }
+
+  // Where to send datagrams once UDP ASSOCIATE succeeded. The address is
+  // empty when the proxy answered with a wildcard, meaning its own.
+  bool associated() const { return state_ == State::kAssociated; }
+  const std::string& relay_ip() const { return relay_ip_; }
+  uint16_t relay_port() const { return relay_port_; }
+
+ private:
+  enum class State : uint8_t {
+    kGreeting,
+    kConnect,
+    kHead,
+    kBody,
+    kAssociated,
+    kFinished,
+    kFailed,
+  };
+  enum class Framing : uint8_t { kLength, kChunked, kClose };
+
+  void StartRequest();
+  bool Fail(std::string error);
+  // Parses the buffered response head; false on a bad one.
+  bool ParseHead(size_t head_size);
+  // Takes body bytes up to the end of the response and sets |used|;
+  // returns false on bad chunk framing.
+  bool OnBody(const char* data, size_t size, SpeedTestClock::time_point now, size_t* used);
+  void EndResponse();
+
+  SpeedTestPhase phase_;
+  HttpUrl url_;
+  uint64_t upload_size_;
+  SpeedTestMeter* meter_;
+  State state_ = State::kGreeting;
+  std::string error_;
+
+  std::string out_;
+  size_t out_sent_ = 0;
+  uint64_t body_to_send_ = 0;
+  bool request_timed_ = false;
+  SpeedTestClock::time_point request_sent_;
+
+  // Protocol bytes not yet parsed: replies and the response head.
+  std::string in_;
+  Framing framing_ = Framing::kLength;
+  bool reusable_ = true;
+  size_t responses_ = 0;
+  uint64_t body_remaining_ = 0;
+  // Chunked framing: the size line being read, or the data left in the
+  // current chunk, then its CRLF.
+  std::string chunk_line_;
+  uint64_t chunk_remaining_ = 0;
+  size_t chunk_crlf_ = 0;
+  bool in_trailer_ = false;
+
+  std::string relay_ip_;
+  uint16_t relay_port_ = 0;
+};
+
+// The datagrams of the UDP phase, echoed back by the target. At most
+// kWindow are in flight; a slot frees up when the echo returns or after
+// kLossTimeout, so the flow paces itself to what the tunnel carries
+// instead of flooding it.
+class SpeedTestUdpFlow {
+ public:
+  static constexpr size_t kWindow = 64;
+  static constexpr size_t kPayloadSize = 1200;
+  static constexpr std::chrono::milliseconds kLossTimeout{1000};
+
+  // |meter| must outlive the flow.
+  SpeedTestUdpFlow(const std::string& host, uint16_t port, SpeedTestMeter* meter);
+
+  // Fills |datagram|, SOCKS5 header included, unless the window is full.
+  bool NextDatagram(SpeedTestClock::time_point now, std::string* datagram);
+  // Takes a datagram from the relay; strays and late echoes are ignored.
+  void OnDatagram(const char* data, size_t size, SpeedTestClock::time_point now);
+  // Counts datagrams older than kLossTimeout as lost.
+  void Expire(SpeedTestClock::time_point now);
+
+ private:
+  struct InFlight {
+    uint64_t sequence;
+    SpeedTestClock::time_point sent;
+    bool answered;
+  };
+
+  void PopAnswered();
+
+  std::string header_;
+  uint64_t flow_id_;
+  uint64_t next_sequence_ = 0;
+  SpeedTestMeter* meter_;
+  // Ordered by sequence; answered entries wait until they reach the front.
+  std::deque<InFlight> in_flight_;
+  size_t outstanding_ = 0;
+};
+
+#endif  // NATIVE_SPEED_TEST_H_
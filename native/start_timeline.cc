@@ -0,0 +1,127 @@
+#include "start_timeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+
+namespace {
+// A marker further into a line than this is not looked for.
+constexpr size_t kMaxPartialLine = 512;
+
+const char* const kPhaseNames[kStartPhaseCount] = {
+    "spawned", "configWritten", "tunUp", "ready", "firstDial",
+};
+
+const char* const kPhaseDescriptions[kStartPhaseCount] = {
+    "spawned", "config written", "tun up", "ready", "first dial",
+};
+
+bool Contains(std::string_view line, const char* marker) {
+  return line.find(marker) != std::string_view::npos;
+}
+}  // namespace
+
+const char* StartPhaseName(StartPhase phase) {
+  return kPhaseNames[static_cast<size_t>(phase)];
+}
+
+StartTimeline::StartTimeline() {
+  for (auto& phase : phase_us_) {
+    phase.store(-1);
+  }
+}
+
+int64_t StartTimeline::Now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void StartTimeline::Begin() {
+  for (auto& phase : phase_us_) {
+    phase.store(-1);
+  }
+  begin_us_.store(Now());
+  started_at_ms_.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count());
+  generation_.fetch_add(1);
+}
+
+bool StartTimeline::Mark(StartPhase phase) {
+  int64_t unset = -1;
+  return phase_us_[static_cast<size_t>(phase)].compare_exchange_strong(unset, Now() - begin_us_.load());
+}
+
+bool StartTimeline::reached(StartPhase phase) const {
+  return phase_us_[static_cast<size_t>(phase)].load() >= 0;
+}
+
+bool StartTimeline::Scan(const char* data, size_t size) {
+  uint32_t generation = generation_.load();
+  if (generation != scanned_generation_) {
+    scanned_generation_ = generation;
+    partial_line_.clear();
+  }
+  // Past the first dial sing-box is fully up; later output costs nothing.
+  if (reached(StartPhase::kTunUp) && reached(StartPhase::kReady) && reached(StartPhase::kFirstDial)) {
+    partial_line_.clear();
+    return false;
+  }
+
+  bool was_ready = reached(StartPhase::kReady);
+  const char* end = data + size;
+  while (data < end) {
+    const char* newline = static_cast<const char*>(memchr(data, '\n', static_cast<size_t>(end - data)));
+    const char* line_end = newline != nullptr ? newline : end;
+    size_t length = static_cast<size_t>(line_end - data);
+    if (newline == nullptr || !partial_line_.empty()) {
+      partial_line_.append(data, std::min(length, kMaxPartialLine - std::min(kMaxPartialLine, partial_line_.size())));
+      if (newline != nullptr) {
+        ScanLine(partial_line_.data(), partial_line_.size());
+        partial_line_.clear();
+      }
+    } else {
+      ScanLine(data, length);
+    }
+    data = newline != nullptr ? newline + 1 : end;
+  }
+  return !was_ready && reached(StartPhase::kReady);
+}
+
+void StartTimeline::ScanLine(const char* data, size_t size) {
+  std::string_view line(data, size);
+  if (Contains(line, "sing-box started")) {
+    Mark(StartPhase::kReady);
+  } else if (Contains(line, "inbound/tun[") && Contains(line, "started")) {
+    Mark(StartPhase::kTunUp);
+  } else if (Contains(line, "outbound connection to")) {
+    Mark(StartPhase::kFirstDial);
+  }
+}
+
+StartTimeline::Snapshot StartTimeline::snapshot() const {
+  Snapshot snapshot;
+  snapshot.started_at_ms = started_at_ms_.load();
+  for (size_t i = 0; i < kStartPhaseCount; i++) {
+    snapshot.phase_us[i] = phase_us_[i].load();
+  }
+  return snapshot;
+}
+
+std::string StartTimeline::Describe() const {
+  Snapshot current = snapshot();
+  std::string description;
+  for (size_t i = 0; i < kStartPhaseCount; i++) {
+    if (current.phase_us[i] < 0) {
+      continue;
+    }
+    if (!description.empty()) {
+      description += ", ";
+    }
+    description += kPhaseDescriptions[i];
+    description += " +" + std::to_string(current.phase_us[i] / 1000) + " ms";
+  }
+  return description;
+}
@@ -0,0 +1,79 @@
+#ifndef NATIVE_START_TIMELINE_H_
+#define NATIVE_START_TIMELINE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Milestones of one sing-box start, in the order they normally happen.
+enum class StartPhase : uint8_t {
+  kSpawned,
+  kConfigWritten,
+  kTunUp,
+  kReady,
+  kFirstDial,
+};
+constexpr size_t kStartPhaseCount = 5;
+
+// Name used for |phase| on the method channel.
+const char* StartPhaseName(StartPhase phase);
+
+// Timestamps of the phases of the latest sing-box start, relative to the
+// Start() call.
+//
+// TUN, ready and first-dial are found by Scan() in sing-box's output:
+//   inbound/tun[tun-in]: started at tun0
+//   sing-box started (0.12s)
+//   outbound/vless[proxy]: outbound connection to example.com:443
+// Those are info lines, so with a quieter log level the runners mark
+// kReady themselves from a Clash API probe.
+//
+// Begin() and Mark() may be called from any thread, Scan() from one thread
+// at a time.
+class StartTimeline {
+ public:
+  struct Snapshot {
+    // Wall clock of Begin(), in milliseconds since the epoch. 0 before the
+    // first start.
+    int64_t started_at_ms = 0;
+    // Microseconds after Begin(), or -1 if the phase was not reached.
+    int64_t phase_us[kStartPhaseCount];
+  };
+
+  StartTimeline();
+
+  StartTimeline(const StartTimeline&) = delete;
+  StartTimeline& operator=(const StartTimeline&) = delete;
+
+  // Forgets the previous start and takes the current time as zero.
+  void Begin();
+  // Records |phase| now. Returns false if it was already recorded.
+  bool Mark(StartPhase phase);
+  bool reached(StartPhase phase) const;
+
+  // Marks the phases announced in a chunk of sing-box output. Lines may be
+  // split across chunks. Returns true if this chunk marked kReady.
+  bool Scan(const char* data, size_t size);
+
+  Snapshot snapshot() const;
+  // One-line summary for the log, e.g.
+  // "spawned +2 ms, config written +3 ms, tun up +95 ms, ready +180 ms".
+  std::string Describe() const;
+
+ private:
+  void ScanLine(const char* data, size_t size);
+  int64_t Now() const;
+
+  std::atomic<int64_t> begin_us_{0};
+  std::atomic<int64_t> started_at_ms_{0};
+  std::atomic<int64_t> phase_us_[kStartPhaseCount];
+  // Bumped by Begin() so Scan() drops a line left over from the last start.
+  std::atomic<uint32_t> generation_{0};
+
+  // Scan() state: the unterminated tail of the last chunk, capped.
+  uint32_t scanned_generation_ = 0;
+  std::string partial_line_;
+};
+
+#endif  // NATIVE_START_TIMELINE_H_
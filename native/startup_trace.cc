@@ -0,0 +1,102 @@
+#include "startup_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "json_value.h"
+
+namespace {
+const char* const kStageNames[kStartupStageCount] = {
+    "main entry", "window created", "engine started", "plugins registered",
+    "channel ready", "first frame", "first dart call",
+};
+
+int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
+const char* StartupStageName(StartupStage stage) {
+  return kStageNames[static_cast<size_t>(stage)];
+}
+
+StartupTrace::StartupTrace() {
+  for (auto& stage : stage_us_) {
+    stage.store(-1);
+  }
+}
+
+bool StartupTrace::Mark(StartupStage stage) {
+  int64_t unset = -1;
+  return stage_us_[static_cast<size_t>(stage)].compare_exchange_strong(unset, NowUs());
+}
+
+bool StartupTrace::reached(StartupStage stage) const {
+  return stage_us_[static_cast<size_t>(stage)].load() >= 0;
+}
+
+bool StartupTrace::complete() const {
+  return std::all_of(std::begin(stage_us_), std::end(stage_us_),
+                     [](const std::atomic<int64_t>& stage) { return stage.load() >= 0; });
+}
+
+std::string StartupTrace::ToChromeTraceJson(int64_t pid) const {
+  // Recorded stages by time, as the first frame and the first Dart call
+  // race.
+  std::vector<std::pair<int64_t, size_t>> stages;
+  for (size_t i = 0; i < kStartupStageCount; i++) {
+    int64_t us = stage_us_[i].load();
+    if (us >= 0) {
+      stages.emplace_back(us, i);
+    }
+  }
+  std::sort(stages.begin(), stages.end());
+
+  auto event = [pid](const char* name, const char* phase, int64_t ts) {
+    JsonValue value = JsonValue::Object();
+    value.Set("name", name);
+    value.Set("cat", "startup");
+    value.Set("ph", phase);
+    value.Set("ts", ts);
+    value.Set("pid", pid);
+    value.Set("tid", 1);
+    return value;
+  };
+  JsonValue events = JsonValue::Array();
+  JsonValue thread_name = event("thread_name", "M", 0);
+  JsonValue thread_args = JsonValue::Object();
+  thread_args.Set("name", "platform");
+  thread_name.Set("args", std::move(thread_args));
+  events.Append(std::move(thread_name));
+  // Main entry comes first whenever it was marked.
+  int64_t origin_us = stages.empty() ? 0 : stages.front().first;
+  JsonValue since_main = JsonValue::Object();
+  for (size_t i = 0; i < stages.size(); i++) {
+    const char* name = kStageNames[stages[i].second];
+    if (i > 0) {
+      JsonValue span = event(name, "X", stages[i - 1].first);
+      span.Set("dur", stages[i].first - stages[i - 1].first);
+      events.Append(std::move(span));
+    }
+    JsonValue instant = event(name, "i", stages[i].first);
+    // Thread-scoped, so it is drawn on the platform thread's track.
+    instant.Set("s", "t");
+    events.Append(std::move(instant));
+    since_main.Set(name, stages[i].first - origin_us);
+  }
+
+  JsonValue trace = JsonValue::Object();
+  trace.Set("traceEvents", std::move(events));
+  trace.Set("displayTimeUnit", "ms");
+  trace.Set("otherData", std::move(since_main));
+  return trace.ToString();
+}
+
+StartupTrace& ProcessStartupTrace() {
+  static StartupTrace trace;
+  return trace;
+}
@@ -0,0 +1,56 @@
+#ifndef NATIVE_STARTUP_TRACE_H_
+#define NATIVE_STARTUP_TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Milestones of a runner's cold start, in the order they normally happen.
+// The first frame and the first Dart call may come in either order.
+enum class StartupStage : uint8_t {
+  kMainEntry,
+  kWindowCreated,
+  kEngineStarted,
+  kPluginsRegistered,
+  kChannelReady,
+  kFirstFrame,
+  kFirstDartCall,
+};
+constexpr size_t kStartupStageCount = 7;
+
+// Name used for |stage| in the trace, e.g. "window created".
+const char* StartupStageName(StartupStage stage);
+
+// Monotonic timestamps of the runner's start, from main() to the first
+// frame and the first method call from Dart, for finding cold-start
+// regressions. Mark() may be called from any thread.
+class StartupTrace {
+ public:
+  StartupTrace();
+
+  StartupTrace(const StartupTrace&) = delete;
+  StartupTrace& operator=(const StartupTrace&) = delete;
+
+  // Records |stage| now. Returns false if it was already recorded.
+  bool Mark(StartupStage stage);
+  bool reached(StartupStage stage) const;
+  // Every stage has been recorded.
+  bool complete() const;
+
+  // The trace in Chrome's trace-event JSON object format, for
+  // chrome://tracing or Perfetto: an instant event per recorded stage and a
+  // complete event for the time it took to get there from the one before,
+  // on thread 1 of process |pid|, with timestamps in microseconds on the
+  // monotonic clock. otherData maps each stage name to microseconds after
+  // main entry, for scripts comparing runs.
+  std::string ToChromeTraceJson(int64_t pid) const;
+
+ private:
+  std::atomic<int64_t> stage_us_[kStartupStageCount];
+};
+
+// The trace of this process, which main() starts.
+StartupTrace& ProcessStartupTrace();
+
+#endif  // NATIVE_STARTUP_TRACE_H_
@@ -0,0 +1,54 @@
+#include "clash_api.h"
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+
+namespace {
+
+TEST(ClashApiTest, FindsTheSecretOfTheController) {
+  EXPECT_EQ(FindClashApiSecret(
+                R"({"experimental":{"clash_api":{"external_controller":"127.0.0.1:9090","secret":"abc123"}}})"),
+            "abc123");
+  EXPECT_EQ(FindClashApiSecret(R"({"experimental": {"clash_api": {"secret" : "abc"}}})"), "abc");
+  EXPECT_EQ(FindClashApiSecret(R"({"experimental":{"clash_api":{"external_controller":"127.0.0.1:9090"}}})"), "");
+  // A "secret" elsewhere in the config is not the controller's.
+  EXPECT_EQ(FindClashApiSecret(
+                R"({"outbounds":[{"secret":"no"}],"experimental":{"clash_api":{"external_controller":"x"}}})"),
+            "");
+  EXPECT_EQ(FindClashApiSecret(R"({"experimental":{"clash_api":{},"other":{"secret":"no"}}})"), "");
+  EXPECT_EQ(FindClashApiSecret(R"({"outbounds":[{"secret":"no"}]})"), "");
+}
+
+TEST(ClashApiTest, IgnoresASecretThatWouldBreakTheRequest) {
+  EXPECT_EQ(FindClashApiSecret(R"({"clash_api":{"secret":"a\"b"}})"), "");
+  EXPECT_EQ(FindClashApiSecret("{\"clash_api\":{\"secret\":\"a\r\nX-Injected: 1\"}}"), "");
+  EXPECT_EQ(FindClashApiSecret(R"({"clash_api":{"secret":"unterminated)"), "");
+  EXPECT_EQ(FindClashApiSecret(R"({"clash_api":{"secret":42}})"), "");
+}
+
+TEST(ClashApiTest, SendsTheSecretAsABearerToken) {
+  EXPECT_EQ(ClashApiProbeRequest(""), "GET /version HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n");
+  EXPECT_EQ(ClashApiProbeRequest("abc"),
+            "GET /version HTTP/1.0\r\nHost: 127.0.0.1\r\nAuthorization: Bearer abc\r\n\r\n");
+  EXPECT_EQ(ClashApiRequest("/traffic"), "GET /traffic HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: application/json\r\n\r\n");
+  EXPECT_EQ(ClashApiRequest("/connections", "abc"),
+            "GET /connections HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: application/json\r\n"
+            "Authorization: Bearer abc\r\n\r\n");
+}
+
+TEST(ClashApiTest, MakesADifferentSecretEachTime) {
+  std::set<std::string> secrets;
+  for (int i = 0; i < 100; i++) {
+    std::string secret = RandomClashApiSecret();
+    ASSERT_EQ(secret.size(), 32u);
+    EXPECT_EQ(secret.find_first_not_of("0123456789abcdef"), std::string::npos) << secret;
+    // What the runners write is what they read back.
+    EXPECT_EQ(FindClashApiSecret(R"({"clash_api":{"secret":")" + secret + "\"}}"), secret);
+    secrets.insert(secret);
+  }
+  EXPECT_EQ(secrets.size(), 100u);
+}
+
+}  // namespace
@@ -0,0 +1,92 @@
+#include "config_builder.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const char kLinkA[] =
+    "vless://0b3c7f2a-1111-2222-3333-444455556666@example.com:443?type=tcp&security=reality&pbk=AbC-_123"
+    "&fp=chrome&sni=www.microsoft.com&sid=6ba85179e30d4fc2&flow=xtls-rprx-vision#A";
+const char kLinkB[] = "hysteria2://pw@hy.example.net:8443?obfs=salamander&obfspassword=x&tls_sni=hy.example.net";
+
+// A user with a long exclusion list, which dominates the config's size.
+ConfigSettings Settings() {
+  ConfigSettings settings;
+  settings.dns_provider = "cloudflare";
+  settings.enable_logging = true;
+  settings.use_mixed_inbound = true;
+  settings.mixed_inbound_listen_address = "127.0.0.1";
+  settings.mixed_inbound_listen_port = 2080;
+  settings.clash_api_port = 39123;
+  for (int i = 0; i < 5000; i++) {
+    settings.excluded_domain_suffixes.push_back("site-" + std::to_string(i) + ".example.ru");
+  }
+  settings.excluded_domains = {"yandex", "vk", "sber"};
+  return settings;
+}
+
+void Build(ConfigBuilder* builder, const ConfigSettings& settings, const char* link, std::string* config) {
+  std::string error;
+  if (!builder->Build(settings, link, config, &error)) {
+    abort();
+  }
+  benchmark::DoNotOptimize(config->data());
+}
+
+// Every section serialized: the first start of a session.
+void BM_ConfigBuilderFresh(benchmark::State& state) {
+  ConfigSettings settings = Settings();
+  std::string config;
+  for (auto _ : state) {
+    ConfigBuilder builder;
+    Build(&builder, settings, kLinkA, &config);
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(config.size()));
+}
+BENCHMARK(BM_ConfigBuilderFresh)->Unit(benchmark::kMicrosecond);
+
+// Nothing changed, as when the same server is started again.
+void BM_ConfigBuilderUnchanged(benchmark::State& state) {
+  ConfigSettings settings = Settings();
+  ConfigBuilder builder;
+  std::string config;
+  Build(&builder, settings, kLinkA, &config);
+  for (auto _ : state) {
+    Build(&builder, settings, kLinkA, &config);
+  }
+}
+BENCHMARK(BM_ConfigBuilderUnchanged)->Unit(benchmark::kMicrosecond);
+
+// One setting flipped back and forth. The whole-config cache would hide
+// the section cache, so every iteration uses a port not seen before and
+// only the inbounds are serialized again.
+void BM_ConfigBuilderOneSettingChanged(benchmark::State& state) {
+  ConfigSettings settings = Settings();
+  ConfigBuilder builder;
+  std::string config;
+  Build(&builder, settings, kLinkA, &config);
+  int64_t port = 10000;
+  for (auto _ : state) {
+    settings.mixed_inbound_listen_port = port++;
+    Build(&builder, settings, kLinkA, &config);
+  }
+}
+BENCHMARK(BM_ConfigBuilderOneSettingChanged)->Unit(benchmark::kMicrosecond);
+
+// Switching between two servers, which the whole-config cache answers.
+void BM_ConfigBuilderServerSwitch(benchmark::State& state) {
+  ConfigSettings settings = Settings();
+  ConfigBuilder builder;
+  std::string config;
+  bool first = true;
+  for (auto _ : state) {
+    Build(&builder, settings, first ? kLinkA : kLinkB, &config);
+    first = !first;
+  }
+}
+BENCHMARK(BM_ConfigBuilderServerSwitch)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
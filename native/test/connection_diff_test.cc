@@ -0,0 +1,351 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "connection_table.h"
+#include "event_frame.h"
+
+namespace {
+
+uint16_t ReadU16(const std::vector<uint8_t>& buffer, size_t at) {
+  return static_cast<uint16_t>(buffer[at] | buffer[at + 1] << 8);
+}
+
+uint32_t ReadU32(const std::vector<uint8_t>& buffer, size_t at) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(buffer[at + i]) << (i * 8);
+  }
+  return value;
+}
+
+uint64_t ReadU64(const std::vector<uint8_t>& buffer, size_t at) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= static_cast<uint64_t>(buffer[at + i]) << (i * 8);
+  }
+  return value;
+}
+
+// A connection as the Dart side ends up seeing it.
+struct SeenConnection {
+  std::vector<std::string> fields;
+  int64_t upload = 0;
+  int64_t download = 0;
+};
+
+// Applies kConnectionDiff frames the way ActiveConnectionTable.apply in
+// lib/models/active_connection.dart does, but fails the test where Dart
+// would quietly drop a frame.
+class DartView {
+ public:
+  static constexpr size_t kHeaderSize = 32;
+  static constexpr size_t kOpenedFixedSize = 24;
+  static constexpr size_t kChangedSize = 24;
+  static constexpr int kFields = 10;
+
+  void Apply(const std::vector<uint8_t>& message) {
+    ASSERT_GE(message.size(), kEventHeaderSize);
+    ASSERT_EQ(message[0], static_cast<uint8_t>(EventKind::kConnectionDiff));
+    size_t size = ReadU32(message, 4);
+    ASSERT_EQ(message.size(), kEventHeaderSize + size);
+    ASSERT_GE(size, kHeaderSize);
+    size_t offset = kEventHeaderSize;
+    size_t end = offset + size;
+
+    uint64_t seq = ReadU64(message, offset);
+    bool reset = message[offset + 8] != 0;
+    if (!reset) {
+      ASSERT_NE(seq_, 0u);
+      ASSERT_EQ(seq, seq_ + 1);
+    }
+    uint32_t total = ReadU32(message, offset + 12);
+    uint32_t opened = ReadU32(message, offset + 16);
+    uint32_t closed = ReadU32(message, offset + 20);
+    uint32_t changed = ReadU32(message, offset + 24);
+    size_t at = offset + kHeaderSize;
+
+    if (reset) {
+      by_handle_.clear();
+    }
+    for (uint32_t i = 0; i < opened; i++) {
+      ASSERT_LE(at + 8, end);
+      uint32_t handle = ReadU32(message, at);
+      size_t record_end = at + 8 + ReadU32(message, at + 4);
+      ASSERT_LE(record_end, end);
+      ASSERT_GE(record_end, at + kOpenedFixedSize);
+      SeenConnection& seen = by_handle_[handle];
+      seen.upload = static_cast<int64_t>(ReadU64(message, at + 8));
+      seen.download = static_cast<int64_t>(ReadU64(message, at + 16));
+      seen.fields.clear();
+      size_t field = at + kOpenedFixedSize;
+      for (int k = 0; k < kFields; k++) {
+        ASSERT_LE(field + 2, record_end);
+        uint16_t length = ReadU16(message, field);
+        ASSERT_LE(field + 2 + length, record_end);
+        seen.fields.emplace_back(reinterpret_cast<const char*>(message.data() + field + 2), length);
+        field += 2 + length;
+      }
+      EXPECT_EQ(field, record_end);
+      at = record_end;
+    }
+    ASSERT_LE(at + closed * 4 + changed * kChangedSize, end);
+    for (uint32_t i = 0; i < closed; i++) {
+      EXPECT_EQ(by_handle_.erase(ReadU32(message, at)), 1u);
+      at += 4;
+    }
+    for (uint32_t i = 0; i < changed; i++) {
+      auto it = by_handle_.find(ReadU32(message, at));
+      ASSERT_NE(it, by_handle_.end());
+      EXPECT_EQ(ReadU32(message, at + 4), 0u);
+      it->second.upload += static_cast<int64_t>(ReadU64(message, at + 8));
+      it->second.download += static_cast<int64_t>(ReadU64(message, at + 16));
+      at += kChangedSize;
+    }
+    EXPECT_EQ(at, end);
+    EXPECT_EQ(total, by_handle_.size());
+    seq_ = seq;
+  }
+
+  const std::map<uint32_t, SeenConnection>& by_handle() const { return by_handle_; }
+
+ private:
+  uint64_t seq_ = 0;
+  std::map<uint32_t, SeenConnection> by_handle_;
+};
+
+// A connection in a synthetic /connections snapshot.
+struct LiveConnection {
+  std::string id;
+  std::string host;
+  uint64_t upload = 0;
+  uint64_t download = 0;
+};
+
+std::string Snapshot(const std::vector<LiveConnection>& connections) {
+  std::string json = "{\"downloadTotal\":1,\"uploadTotal\":2,\"connections\":[";
+  for (size_t i = 0; i < connections.size(); i++) {
+    const LiveConnection& connection = connections[i];
+    json += (i > 0 ? "," : "");
+    json += "{\"id\":\"" + connection.id +
+            "\",\"metadata\":{\"network\":\"tcp\",\"type\":\"tun/tun-in\",\"sourceIP\":\"172.20.10.1\","
+            "\"destinationIP\":\"2001:db8::1\",\"sourcePort\":\"5000\",\"destinationPort\":\"443\",\"host\":\"" +
+            connection.host + "\",\"processPath\":\"/usr/bin/firefox\"},\"upload\":" +
+            std::to_string(connection.upload) + ",\"download\":" + std::to_string(connection.download) +
+            ",\"start\":\"2026-10-17T10:00:00.123+03:00\",\"chains\":[\"vless-out\",\"proxy\"],"
+            "\"rule\":\"rule_set=geosite-ru\",\"rulePayload\":\"direct\"}";
+  }
+  return json + "]}";
+}
+
+std::string Uuid(int n) {
+  char id[40];
+  snprintf(id, sizeof(id), "%08x-0000-4000-8000-%012x", n, n * 7919);
+  return id;
+}
+
+// Checks that |view| holds exactly |live|, with every byte counted.
+void ExpectSame(const DartView& view, const std::vector<LiveConnection>& live) {
+  ASSERT_EQ(view.by_handle().size(), live.size());
+  std::map<std::string, const LiveConnection*> by_id;
+  for (const LiveConnection& connection : live) {
+    by_id[connection.id] = &connection;
+  }
+  for (const auto& entry : view.by_handle()) {
+    const SeenConnection& seen = entry.second;
+    ASSERT_EQ(seen.fields.size(), 10u);
+    auto it = by_id.find(seen.fields[0]);
+    ASSERT_NE(it, by_id.end()) << seen.fields[0];
+    EXPECT_EQ(seen.fields[6], it->second->host);
+    EXPECT_EQ(seen.upload, static_cast<int64_t>(it->second->upload));
+    EXPECT_EQ(seen.download, static_cast<int64_t>(it->second->download));
+  }
+}
+
+TEST(ConnectionDiffFrameTest, LaysOutTheHeaderAndOpenedRecords) {
+  ConnectionDiff diff;
+  diff.sequence = 0x0102030405060708;
+  diff.reset = true;
+  diff.total = 1;
+  OpenedConnection opened;
+  opened.handle = 7;
+  opened.upload = 1000;
+  opened.download = 0x100000000;
+  opened.id = "id";
+  opened.start = "2026-10-17T10:00:00Z";
+  opened.network = "tcp";
+  opened.inbound = "tun/tun-in";
+  opened.source = "172.20.10.1:5000";
+  opened.destination = "[2001:db8::1]:443";
+  opened.host = "example.com";
+  opened.process = "/usr/bin/firefox";
+  opened.rule = "final";
+  opened.chain = "proxy";
+  diff.opened.push_back(opened);
+
+  EventFrameWriter writer;
+  writer.AppendConnectionDiff(diff);
+  const std::vector<uint8_t>& buffer = writer.buffer();
+  ASSERT_GE(buffer.size(), kEventHeaderSize + DartView::kHeaderSize);
+  EXPECT_EQ(buffer[0], static_cast<uint8_t>(EventKind::kConnectionDiff));
+  EXPECT_EQ(ReadU32(buffer, 4), buffer.size() - kEventHeaderSize);
+
+  size_t payload = kEventHeaderSize;
+  EXPECT_EQ(ReadU64(buffer, payload), diff.sequence);
+  EXPECT_EQ(buffer[payload + 8], 1);
+  for (size_t i = 9; i < 12; i++) {
+    EXPECT_EQ(buffer[payload + i], 0) << i;
+  }
+  EXPECT_EQ(ReadU32(buffer, payload + 12), 1u);
+  EXPECT_EQ(ReadU32(buffer, payload + 16), 1u);
+  EXPECT_EQ(ReadU32(buffer, payload + 20), 0u);
+  EXPECT_EQ(ReadU32(buffer, payload + 24), 0u);
+  EXPECT_EQ(ReadU32(buffer, payload + 28), 0u);
+
+  size_t record = payload + DartView::kHeaderSize;
+  EXPECT_EQ(ReadU32(buffer, record), 7u);
+  // The size covers everything after itself, to the end of the frame here.
+  EXPECT_EQ(record + 8 + ReadU32(buffer, record + 4), buffer.size());
+  EXPECT_EQ(ReadU64(buffer, record + 8), 1000u);
+  EXPECT_EQ(ReadU64(buffer, record + 16), 0x100000000u);
+  size_t field = record + DartView::kOpenedFixedSize;
+  for (const std::string* expected : {&opened.id, &opened.start, &opened.network, &opened.inbound, &opened.source,
+                                      &opened.destination, &opened.host, &opened.process, &opened.rule,
+                                      &opened.chain}) {
+    uint16_t length = ReadU16(buffer, field);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(buffer.data() + field + 2), length), *expected);
+    field += 2 + length;
+  }
+  EXPECT_EQ(field, buffer.size());
+}
+
+TEST(ConnectionDiffFrameTest, LaysOutClosedAndChangedRecords) {
+  ConnectionDiff diff;
+  diff.sequence = 5;
+  diff.total = 4;
+  diff.closed = {3, 9};
+  diff.changed = {{4, 10, -1}, {8, 0, 1 << 20}};
+
+  EventFrameWriter writer;
+  writer.AppendConnectionDiff(diff);
+  const std::vector<uint8_t>& buffer = writer.buffer();
+  size_t payload = kEventHeaderSize;
+  ASSERT_EQ(buffer.size(), payload + DartView::kHeaderSize + 2 * 4 + 2 * DartView::kChangedSize);
+  EXPECT_EQ(buffer[payload + 8], 0);
+  EXPECT_EQ(ReadU32(buffer, payload + 12), 4u);
+  EXPECT_EQ(ReadU32(buffer, payload + 16), 0u);
+  EXPECT_EQ(ReadU32(buffer, payload + 20), 2u);
+  EXPECT_EQ(ReadU32(buffer, payload + 24), 2u);
+
+  size_t closed = payload + DartView::kHeaderSize;
+  EXPECT_EQ(ReadU32(buffer, closed), 3u);
+  EXPECT_EQ(ReadU32(buffer, closed + 4), 9u);
+  size_t changed = closed + 8;
+  EXPECT_EQ(ReadU32(buffer, changed), 4u);
+  EXPECT_EQ(ReadU32(buffer, changed + 4), 0u);
+  EXPECT_EQ(static_cast<int64_t>(ReadU64(buffer, changed + 8)), 10);
+  EXPECT_EQ(static_cast<int64_t>(ReadU64(buffer, changed + 16)), -1);
+  changed += DartView::kChangedSize;
+  EXPECT_EQ(ReadU32(buffer, changed), 8u);
+  EXPECT_EQ(static_cast<int64_t>(ReadU64(buffer, changed + 8)), 0);
+  EXPECT_EQ(static_cast<int64_t>(ReadU64(buffer, changed + 16)), 1 << 20);
+}
+
+TEST(ConnectionDiffFrameTest, CutsALongFieldAtACharacterBoundary) {
+  ConnectionDiff diff;
+  diff.reset = true;
+  diff.total = 1;
+  OpenedConnection opened;
+  opened.handle = 1;
+  // Two-byte characters, so byte 65535 is the middle of one.
+  opened.host.reserve(70000);
+  while (opened.host.size() < 70000) {
+    opened.host += "\xd0\xb6";
+  }
+  diff.opened.push_back(opened);
+  EventFrameWriter writer;
+  writer.AppendConnectionDiff(diff);
+  DartView view;
+  view.Apply(writer.buffer());
+  ASSERT_EQ(view.by_handle().size(), 1u);
+  const std::string& host = view.by_handle().at(1).fields[6];
+  EXPECT_EQ(host.size(), 65534u);
+  EXPECT_EQ(host, opened.host.substr(0, 65534));
+}
+
+TEST(ConnectionDiffFrameTest, RoundTripsSnapshotsThroughTheTable) {
+  ConnectionTable table;
+  ConnectionDiff diff;
+  EventFrameWriter writer;
+  DartView view;
+  std::vector<LiveConnection> live;
+  for (int i = 0; i < 200; i++) {
+    live.push_back({Uuid(i), "host" + std::to_string(i) + ".example", static_cast<uint64_t>(i), 0});
+  }
+
+  // The first diff is a reset listing everything.
+  ASSERT_TRUE(table.Apply(Snapshot(live), &diff));
+  EXPECT_TRUE(diff.reset);
+  EXPECT_EQ(diff.opened.size(), live.size());
+  writer.AppendConnectionDiff(diff);
+  view.Apply(writer.Take());
+  ExpectSame(view, live);
+  const SeenConnection& first = view.by_handle().begin()->second;
+  EXPECT_EQ(first.fields[1], "2026-10-17T10:00:00.123+03:00");
+  EXPECT_EQ(first.fields[2], "tcp");
+  EXPECT_EQ(first.fields[3], "tun/tun-in");
+  EXPECT_EQ(first.fields[4], "172.20.10.1:5000");
+  EXPECT_EQ(first.fields[5], "[2001:db8::1]:443");
+  EXPECT_EQ(first.fields[7], "/usr/bin/firefox");
+  EXPECT_EQ(first.fields[8], "rule_set=geosite-ru (direct)");
+  EXPECT_EQ(first.fields[9], "proxy > vless-out");
+
+  // Then opened, closed and changed connections in every round.
+  int next = static_cast<int>(live.size());
+  for (int round = 0; round < 20; round++) {
+    SCOPED_TRACE(round);
+    std::vector<LiveConnection> kept;
+    for (size_t i = 0; i < live.size(); i++) {
+      if ((i + round) % 7 == 0) {
+        continue;
+      }
+      LiveConnection connection = live[i];
+      if ((i + round) % 3 == 0) {
+        connection.upload += 100 + i;
+        connection.download += 1000 * (round + 1);
+      }
+      kept.push_back(connection);
+    }
+    for (int i = 0; i < 15; i++, next++) {
+      kept.push_back({Uuid(next), "new" + std::to_string(next) + ".example", 5, 7});
+    }
+    live = kept;
+    ASSERT_TRUE(table.Apply(Snapshot(live), &diff));
+    EXPECT_FALSE(diff.reset);
+    EXPECT_FALSE(diff.closed.empty());
+    EXPECT_FALSE(diff.changed.empty());
+    EXPECT_EQ(diff.opened.size(), 15u);
+    writer.AppendConnectionDiff(diff);
+    view.Apply(writer.Take());
+    ExpectSame(view, live);
+  }
+
+  // A stopped tunnel is a reset with nothing in it.
+  table.Reset(&diff);
+  writer.AppendConnectionDiff(diff);
+  view.Apply(writer.Take());
+  EXPECT_TRUE(view.by_handle().empty());
+
+  // And the next snapshot starts over with a reset.
+  ASSERT_TRUE(table.Apply(Snapshot(live), &diff));
+  EXPECT_TRUE(diff.reset);
+  writer.AppendConnectionDiff(diff);
+  view.Apply(writer.Take());
+  ExpectSame(view, live);
+}
+
+}  // namespace
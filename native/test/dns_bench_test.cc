@@ -0,0 +1,214 @@
+#include "dns_bench.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+DnsBenchResult FakeResult(const char* provider, DnsTransport transport, DnsRoute route, int64_t p50_us,
+                          int64_t p95_us, size_t failures = 0, size_t queries = 20) {
+  DnsBenchResult result;
+  result.run.target = {provider, DnsProviderAddress(provider), 53};
+  result.run.transport = transport;
+  result.run.route = route;
+  result.queries = queries;
+  result.failures = failures;
+  result.p50_us = p50_us;
+  result.p95_us = p95_us;
+  return result;
+}
+
+// |query| answered with |rcode|.
+std::string Answer(const std::string& query, uint8_t rcode = 0) {
+  std::string answer = query;
+  answer[2] = static_cast<char>(answer[2] | 0x80);
+  answer[3] = static_cast<char>((answer[3] & 0xf0) | rcode);
+  return answer;
+}
+
+TEST(PickDnsProviderTest, PicksTheLowestScore) {
+  std::vector<DnsBenchResult> results = {
+      FakeResult("google", DnsTransport::kTcp, DnsRoute::kDirect, 30000, 60000),
+      FakeResult("cloudflare", DnsTransport::kTcp, DnsRoute::kDirect, 20000, 50000),
+      FakeResult("adguard", DnsTransport::kTcp, DnsRoute::kDirect, 10000, 90000),
+  };
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(2000)), "cloudflare");
+  // A tie goes to the provider tested first.
+  results[2].p95_us = 60000;
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(2000)), "cloudflare");
+}
+
+TEST(PickDnsProviderTest, PrefersTunnelRunsAndTcp) {
+  std::vector<DnsBenchResult> results = {
+      FakeResult("google", DnsTransport::kTcp, DnsRoute::kDirect, 1000, 2000),
+      FakeResult("google", DnsTransport::kUdp, DnsRoute::kTunnel, 1000, 2000),
+      FakeResult("google", DnsTransport::kTcp, DnsRoute::kTunnel, 90000, 90000),
+      FakeResult("adguard", DnsTransport::kUdp, DnsRoute::kTunnel, 50000, 50000),
+      FakeResult("adguard", DnsTransport::kTcp, DnsRoute::kTunnel, 40000, 40000),
+  };
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(2000)), "adguard");
+
+  // Tunnel runs that got no answer at all leave the direct ones to decide.
+  for (DnsBenchResult& result : results) {
+    if (result.run.route == DnsRoute::kTunnel) {
+      result.p50_us = -1;
+      result.p95_us = -1;
+    }
+  }
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(2000)), "google");
+}
+
+TEST(PickDnsProviderTest, CountsFailuresAsTimeouts) {
+  // Half of google's queries timing out at 2 s cost it 2 s of score,
+  // against cloudflare's 0.4 s.
+  std::vector<DnsBenchResult> results = {
+      FakeResult("google", DnsTransport::kTcp, DnsRoute::kDirect, 5000, 5000, 10),
+      FakeResult("cloudflare", DnsTransport::kTcp, DnsRoute::kDirect, 150000, 250000),
+  };
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(2000)), "cloudflare");
+  // With a short timeout the failures weigh less.
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(100)), "google");
+}
+
+TEST(PickDnsProviderTest, NeedsAnAnswer) {
+  EXPECT_EQ(PickDnsProvider({}, milliseconds(2000)), "");
+  std::vector<DnsBenchResult> results = {
+      FakeResult("google", DnsTransport::kUdp, DnsRoute::kDirect, -1, -1, 20),
+      FakeResult("adguard", DnsTransport::kTcp, DnsRoute::kTunnel, -1, -1, 20),
+  };
+  EXPECT_EQ(PickDnsProvider(results, milliseconds(2000)), "");
+}
+
+TEST(DnsBenchProbeTest, CountsUnansweredQueriesAsFailures) {
+  DnsBenchOptions options;
+  options.domains = {"a.example", "b.example"};
+  options.repeat = 2;
+  DnsBenchRun run{{"cloudflare", "1.1.1.1", 53}, DnsTransport::kUdp, DnsRoute::kDirect};
+  DnsBenchProbe probe(run, options);
+  EXPECT_FALSE(probe.uses_stream());
+  ASSERT_TRUE(probe.datagram_ready());
+  EXPECT_EQ(probe.datagram_ip(), "1.1.1.1");
+
+  DnsBenchClock::time_point start;
+  std::vector<std::string> queries;
+  std::string datagram;
+  while (probe.NextDatagram(start, &datagram)) {
+    queries.push_back(datagram);
+  }
+  ASSERT_EQ(queries.size(), 4u);
+
+  // Two answers, one of them SERVFAIL, a duplicate and a stray; the rest
+  // are still out when the run times out.
+  std::string first = Answer(queries[0]);
+  std::string failed = Answer(queries[1], 2);
+  std::string stray = Answer(queries[2]);
+  stray[0] = static_cast<char>(stray[0] ^ 0x55);
+  probe.OnDatagram(first.data(), first.size(), start + microseconds(3000));
+  probe.OnDatagram(first.data(), first.size(), start + microseconds(9000));
+  probe.OnDatagram(failed.data(), failed.size(), start + microseconds(4000));
+  probe.OnDatagram(stray.data(), stray.size(), start + microseconds(5000));
+  probe.OnDatagram(queries[3].data(), queries[3].size(), start + microseconds(6000));
+  EXPECT_FALSE(probe.complete());
+
+  DnsBenchResult result = probe.Finish();
+  EXPECT_EQ(result.queries, 4u);
+  EXPECT_EQ(result.failures, 3u);
+  EXPECT_DOUBLE_EQ(result.failure_rate(), 0.75);
+  EXPECT_EQ(result.p50_us, 3000);
+  EXPECT_EQ(result.p95_us, 3000);
+  EXPECT_TRUE(result.error.empty());
+}
+
+TEST(DnsBenchProbeTest, TimesTcpQueriesFromWhenTheyWereSent) {
+  DnsBenchOptions options;
+  options.domains = {"a.example", "b.example", "c.example"};
+  options.repeat = 1;
+  DnsBenchRun run{{"google", "8.8.8.8", 53}, DnsTransport::kTcp, DnsRoute::kDirect};
+  DnsBenchProbe probe(run, options);
+  ASSERT_TRUE(probe.uses_stream());
+  EXPECT_EQ(probe.stream_ip(), "8.8.8.8");
+  EXPECT_EQ(probe.stream_port(), 53);
+
+  // Split the length-prefixed queries back up.
+  std::string output(probe.output());
+  std::vector<std::string> queries;
+  for (size_t at = 0; at + 2 <= output.size();) {
+    size_t length = static_cast<uint8_t>(output[at]) << 8 | static_cast<uint8_t>(output[at + 1]);
+    queries.push_back(output.substr(at + 2, length));
+    at += 2 + length;
+  }
+  ASSERT_EQ(queries.size(), 3u);
+
+  // The first query and a half go out at 0 ms, the rest at 10 ms.
+  DnsBenchClock::time_point start;
+  size_t first_part = queries[0].size() + 2 + queries[1].size() / 2;
+  probe.OnSent(first_part, start);
+  probe.OnSent(output.size() - first_part, start + milliseconds(10));
+  EXPECT_TRUE(probe.output().empty());
+
+  // Answered out of order, the frames split across reads.
+  std::string stream;
+  for (size_t index : {2, 0, 1}) {
+    std::string answer = Answer(queries[index]);
+    stream.push_back(static_cast<char>(answer.size() >> 8));
+    stream.push_back(static_cast<char>(answer.size() & 0xff));
+    stream += answer;
+  }
+  ASSERT_TRUE(probe.OnReceived(stream.data(), 5, start + milliseconds(20)));
+  ASSERT_TRUE(probe.OnReceived(stream.data() + 5, stream.size() - 5, start + milliseconds(40)));
+  EXPECT_TRUE(probe.complete());
+
+  // 40, 30 and 30 ms.
+  DnsBenchResult result = probe.Finish();
+  EXPECT_EQ(result.failures, 0u);
+  EXPECT_EQ(result.p50_us, 30000);
+  EXPECT_EQ(result.p95_us, 40000);
+}
+
+TEST(DnsBenchProbeTest, FailsWhenTheServerHangsUp) {
+  DnsBenchOptions options;
+  options.domains = {"a.example"};
+  DnsBenchRun run{{"google", "8.8.8.8", 53}, DnsTransport::kTcp, DnsRoute::kDirect};
+  DnsBenchProbe probe(run, options);
+  probe.OnSent(probe.output().size(), DnsBenchClock::time_point());
+  probe.OnClosed();
+  EXPECT_TRUE(probe.failed());
+  DnsBenchResult result = probe.Finish();
+  EXPECT_EQ(result.error, "The server closed the connection.");
+  EXPECT_EQ(result.failures, result.queries);
+  EXPECT_EQ(result.p50_us, -1);
+}
+
+TEST(DnsAutoSelectorTest, RemembersAWinnerPerNetwork) {
+  std::string home = DnsNetworkKey("wlan0", "192.168.1.1");
+  std::string office = DnsNetworkKey("wlan0", "10.0.0.1");
+  std::string cable = DnsNetworkKey("eth0", "");
+  EXPECT_EQ(home, "wlan0 via 192.168.1.1");
+  EXPECT_EQ(cable, "eth0");
+
+  DnsAutoSelector selector;
+  EXPECT_EQ(selector.Winner(home), "");
+  selector.Record(home, "cloudflare");
+  selector.Record(office, "adguard");
+  EXPECT_EQ(selector.Winner(home), "cloudflare");
+  EXPECT_EQ(selector.Winner(office), "adguard");
+  EXPECT_EQ(selector.Winner(cable), "");
+
+  // A benchmark without any answer keeps the earlier winner.
+  selector.Record(home, "");
+  EXPECT_EQ(selector.Winner(home), "cloudflare");
+  selector.Record(home, "google");
+  EXPECT_EQ(selector.Winner(home), "google");
+
+  // Before any winner "auto" resolves to Google's server.
+  EXPECT_STREQ(DnsProviderAddress(kAutoDnsProvider), "8.8.8.8");
+  EXPECT_STREQ(DnsProviderAddress("adguard"), "94.140.14.14");
+}
+
+}  // namespace
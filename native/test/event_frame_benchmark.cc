@@ -0,0 +1,141 @@
+#include "event_frame.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A typical sing-box line, colours and all.
+const char kLine[] =
+    "\x1b[36mINFO\x1b[0m [3021554837 12ms] outbound/vless[proxy]: "
+    "outbound connection to www.example.com:443\n";
+
+uint64_t ReadU64(const uint8_t* data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= static_cast<uint64_t>(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+// Walks the frames as NativeEvents does and sums what it reads, so the
+// decode cannot be optimized away.
+uint64_t Decode(const std::vector<uint8_t>& message) {
+  uint64_t sum = 0;
+  size_t offset = 0;
+  while (offset + kEventHeaderSize <= message.size()) {
+    const uint8_t* header = message.data() + offset;
+    size_t size = header[4] | header[5] << 8 | header[6] << 16 | static_cast<size_t>(header[7]) << 24;
+    const uint8_t* payload = header + kEventHeaderSize;
+    switch (static_cast<EventKind>(header[0])) {
+      case EventKind::kTrafficSample:
+        sum += ReadU64(payload) + payload[8] + ReadU64(payload + 16) + ReadU64(payload + 24) + ReadU64(payload + 32);
+        break;
+      case EventKind::kProbeResult:
+        sum += ReadU64(payload) + std::string(reinterpret_cast<const char*>(payload + 8), size - 8).size();
+        break;
+      default:
+        sum += size;
+        break;
+    }
+    offset += kEventHeaderSize + size;
+  }
+  return sum;
+}
+
+// A second of traffic per frame, batched as the loop flushes them.
+void BM_EventFrameTrafficSamples(benchmark::State& state) {
+  EventFrameWriter writer;
+  uint64_t sum = 0;
+  uint64_t sequence = 0;
+  for (auto _ : state) {
+    writer.Clear();
+    for (int i = 0; i < 100; i++, sequence++) {
+      writer.AppendTrafficSample({sequence, sequence % 30 == 0, 1200, 48000, 3});
+    }
+    sum += Decode(writer.buffer());
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * 100);
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(writer.buffer().size()));
+}
+BENCHMARK(BM_EventFrameTrafficSamples);
+
+// One latency round over a subscription's servers.
+void BM_EventFrameProbeResults(benchmark::State& state) {
+  std::vector<std::string> ids;
+  for (int i = 0; i < 200; i++) {
+    ids.push_back("vless-reality-" + std::to_string(i) + "-de.example.net");
+  }
+  EventFrameWriter writer;
+  uint64_t sum = 0;
+  for (auto _ : state) {
+    writer.Clear();
+    for (size_t i = 0; i < ids.size(); i++) {
+      writer.AppendProbeResult(ids[i], i % 17 == 0 ? -1 : static_cast<int64_t>(i * 1000));
+    }
+    sum += Decode(writer.buffer());
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(ids.size()));
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(writer.buffer().size()));
+}
+BENCHMARK(BM_EventFrameProbeResults);
+
+// A drained ring of state.range(0) lines in one log batch, line by line as
+// FlushLogs copies them.
+void BM_EventFrameLogBatch(benchmark::State& state) {
+  const size_t line_size = sizeof(kLine) - 1;
+  const int64_t lines = state.range(0);
+  EventFrameWriter writer;
+  uint64_t sum = 0;
+  for (auto _ : state) {
+    writer.Clear();
+    writer.BeginFrame(EventKind::kLogBatch);
+    for (int64_t i = 0; i < lines; i++) {
+      writer.PutBytes(kLine, line_size);
+    }
+    writer.EndFrame();
+    sum += Decode(writer.buffer());
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * lines);
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(writer.buffer().size()));
+}
+BENCHMARK(BM_EventFrameLogBatch)->Arg(16)->Arg(1024)->Arg(16384);
+
+// A reset diff listing state.range(0) connections, as a new listener gets.
+void BM_EventFrameConnectionDiff(benchmark::State& state) {
+  ConnectionDiff diff;
+  diff.reset = true;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    OpenedConnection opened;
+    opened.handle = static_cast<uint32_t>(i);
+    opened.id = "3f2a9c1e-0000-4000-8000-" + std::to_string(100000000000 + i);
+    opened.start = "2024-05-01T12:00:00.123456789Z";
+    opened.network = "tcp";
+    opened.inbound = "tun/tun-in";
+    opened.source = "172.19.0.1:" + std::to_string(40000 + i);
+    opened.destination = "142.250.74.110:443";
+    opened.host = "www.google.com";
+    opened.process = "/usr/lib/firefox/firefox";
+    opened.rule = "rule_set=geosite-ru => direct";
+    opened.chain = "proxy";
+    diff.opened.push_back(opened);
+  }
+  diff.total = static_cast<uint32_t>(diff.opened.size());
+  EventFrameWriter writer;
+  for (auto _ : state) {
+    writer.Clear();
+    writer.AppendConnectionDiff(diff);
+    benchmark::DoNotOptimize(writer.buffer().data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(writer.buffer().size()));
+}
+BENCHMARK(BM_EventFrameConnectionDiff)->Arg(100)->Arg(5000);
+
+}  // namespace
@@ -0,0 +1,223 @@
+#include "event_frame.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+uint32_t ReadU32(const uint8_t* data) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+uint64_t ReadU64(const uint8_t* data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= static_cast<uint64_t>(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+// One frame as NativeEvents hands it on.
+struct Event {
+  EventKind kind;
+  std::string lines;
+  TrafficDelta traffic;
+  std::string probe_id;
+  int64_t rtt_us = 0;
+};
+
+// Splits a message the way NativeEvents._decode in
+// lib/services/native_events.dart does: unknown kinds and payloads too
+// short for their kind are skipped by their size, and a frame that runs
+// past the end stops the walk.
+std::vector<Event> Decode(const std::vector<uint8_t>& message) {
+  std::vector<Event> events;
+  size_t offset = 0;
+  while (offset + kEventHeaderSize <= message.size()) {
+    const uint8_t* header = message.data() + offset;
+    size_t size = ReadU32(header + 4);
+    size_t start = offset + kEventHeaderSize;
+    if (start + size > message.size()) {
+      break;
+    }
+    const uint8_t* payload = message.data() + start;
+    Event event;
+    event.kind = static_cast<EventKind>(header[0]);
+    if (event.kind == EventKind::kLogBatch) {
+      event.lines.assign(reinterpret_cast<const char*>(payload), size);
+      events.push_back(event);
+    } else if (event.kind == EventKind::kTrafficSample && size >= kTrafficSampleSize) {
+      event.traffic.sequence = ReadU64(payload);
+      event.traffic.key = payload[8] != 0;
+      event.traffic.up = static_cast<int64_t>(ReadU64(payload + 16));
+      event.traffic.down = static_cast<int64_t>(ReadU64(payload + 24));
+      event.traffic.connections = static_cast<int64_t>(ReadU64(payload + 32));
+      events.push_back(event);
+    } else if (event.kind == EventKind::kProbeResult && size >= 8) {
+      event.rtt_us = static_cast<int64_t>(ReadU64(payload));
+      event.probe_id.assign(reinterpret_cast<const char*>(payload + 8), size - 8);
+      events.push_back(event);
+    }
+    offset = start + size;
+  }
+  return events;
+}
+
+void ExpectSameTraffic(const TrafficDelta& actual, const TrafficDelta& expected) {
+  EXPECT_EQ(actual.sequence, expected.sequence);
+  EXPECT_EQ(actual.key, expected.key);
+  EXPECT_EQ(actual.up, expected.up);
+  EXPECT_EQ(actual.down, expected.down);
+  EXPECT_EQ(actual.connections, expected.connections);
+}
+
+TEST(EventFrameTest, RoundTripsALogBatch) {
+  EventFrameWriter writer;
+  writer.BeginFrame(EventKind::kLogBatch);
+  std::string lines;
+  for (int i = 0; i < 100; i++) {
+    std::string line = "INFO[" + std::to_string(i) + "] router: found process path: /usr/bin/стрим\n";
+    writer.PutBytes(line.data(), line.size());
+    lines += line;
+  }
+  EXPECT_EQ(writer.frame_size(), lines.size());
+  writer.EndFrame();
+
+  std::vector<uint8_t> message = writer.Take();
+  EXPECT_TRUE(writer.empty());
+  ASSERT_EQ(message.size(), kEventHeaderSize + lines.size());
+  EXPECT_EQ(message[0], static_cast<uint8_t>(EventKind::kLogBatch));
+  EXPECT_EQ(message[1] | message[2] | message[3], 0);
+  std::vector<Event> events = Decode(message);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].lines, lines);
+}
+
+TEST(EventFrameTest, CancelDropsOnlyTheOpenFrame) {
+  EventFrameWriter writer;
+  writer.AppendProbeResult("before", 10);
+  writer.BeginFrame(EventKind::kLogBatch);
+  writer.PutBytes("dropped\n", 8);
+  writer.CancelFrame();
+  // An empty batch, as FlushLogs cancels it when the ring had nothing.
+  writer.BeginFrame(EventKind::kLogBatch);
+  EXPECT_EQ(writer.frame_size(), 0u);
+  writer.CancelFrame();
+  writer.AppendProbeResult("after", 20);
+
+  std::vector<Event> events = Decode(writer.buffer());
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[0].probe_id, "before");
+  EXPECT_EQ(events[1].probe_id, "after");
+  EXPECT_EQ(events[1].rtt_us, 20);
+}
+
+TEST(EventFrameTest, RoundTripsTrafficSamples) {
+  constexpr int64_t kMin = std::numeric_limits<int64_t>::min();
+  constexpr int64_t kMax = std::numeric_limits<int64_t>::max();
+  std::vector<TrafficDelta> deltas = {
+      {1, true, 1200, 48000, 3},
+      {2, false, -1200, 0, -3},
+      {3, false, kMax, kMin, 0},
+      {std::numeric_limits<uint64_t>::max(), true, 0, 0, kMax},
+  };
+  EventFrameWriter writer;
+  for (const TrafficDelta& delta : deltas) {
+    writer.AppendTrafficSample(delta);
+  }
+  ASSERT_EQ(writer.buffer().size(), deltas.size() * (kEventHeaderSize + kTrafficSampleSize));
+  // The key byte is followed by seven reserved ones.
+  for (size_t i = 0; i < deltas.size(); i++) {
+    const uint8_t* payload = writer.buffer().data() + i * (kEventHeaderSize + kTrafficSampleSize) + kEventHeaderSize;
+    EXPECT_EQ(ReadU64(payload + 8), deltas[i].key ? 1u : 0u);
+  }
+
+  std::vector<Event> events = Decode(writer.buffer());
+  ASSERT_EQ(events.size(), deltas.size());
+  for (size_t i = 0; i < deltas.size(); i++) {
+    SCOPED_TRACE(i);
+    EXPECT_EQ(events[i].kind, EventKind::kTrafficSample);
+    ExpectSameTraffic(events[i].traffic, deltas[i]);
+  }
+}
+
+TEST(EventFrameTest, RoundTripsProbeResults) {
+  EventFrameWriter writer;
+  writer.AppendProbeResult("server-1", 23456);
+  writer.AppendProbeResult("Нидерланды 🇳🇱", -1);
+  writer.AppendProbeResult("", 0);
+
+  std::vector<Event> events = Decode(writer.buffer());
+  ASSERT_EQ(events.size(), 3u);
+  EXPECT_EQ(events[0].probe_id, "server-1");
+  EXPECT_EQ(events[0].rtt_us, 23456);
+  EXPECT_EQ(events[1].probe_id, "Нидерланды 🇳🇱");
+  EXPECT_EQ(events[1].rtt_us, -1);
+  EXPECT_EQ(events[2].probe_id, "");
+  EXPECT_EQ(events[2].rtt_us, 0);
+}
+
+TEST(EventFrameTest, RoundTripsMixedFramesInOrder) {
+  EventFrameWriter writer;
+  writer.BeginFrame(EventKind::kLogBatch);
+  writer.PutBytes("one\n", 4);
+  writer.EndFrame();
+  writer.AppendTrafficSample({7, false, 1, 2, 3});
+  writer.AppendProbeResult("a", 5);
+  // A kind a newer runner might send.
+  writer.BeginFrame(static_cast<EventKind>(200));
+  writer.PutU64(42);
+  writer.EndFrame();
+  ConnectionDiff diff;
+  diff.sequence = 1;
+  diff.reset = true;
+  writer.AppendConnectionDiff(diff);
+  writer.BeginFrame(EventKind::kLogBatch);
+  writer.PutBytes("two\n", 4);
+  writer.EndFrame();
+
+  std::vector<Event> events = Decode(writer.buffer());
+  ASSERT_EQ(events.size(), 4u);
+  EXPECT_EQ(events[0].lines, "one\n");
+  ExpectSameTraffic(events[1].traffic, {7, false, 1, 2, 3});
+  EXPECT_EQ(events[2].probe_id, "a");
+  EXPECT_EQ(events[3].lines, "two\n");
+}
+
+TEST(EventFrameTest, StopsAtAFrameCutShort) {
+  EventFrameWriter writer;
+  writer.AppendProbeResult("whole", 1);
+  writer.AppendTrafficSample({1, true, 1, 1, 1});
+  std::vector<uint8_t> message = writer.Take();
+  message.resize(message.size() - 1);
+
+  std::vector<Event> events = Decode(message);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].probe_id, "whole");
+}
+
+TEST(EventFrameTest, StartsANewMessageAfterTakeAndClear) {
+  EventFrameWriter writer;
+  writer.AppendProbeResult("first", 1);
+  std::vector<uint8_t> first = writer.Take();
+  writer.AppendProbeResult("second", 2);
+  std::vector<Event> events = Decode(writer.buffer());
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].probe_id, "second");
+  EXPECT_EQ(Decode(first)[0].probe_id, "first");
+
+  writer.Clear();
+  EXPECT_TRUE(writer.empty());
+  writer.AppendTrafficSample({9, true, 0, 0, 0});
+  EXPECT_EQ(writer.buffer().size(), kEventHeaderSize + kTrafficSampleSize);
+}
+
+}  // namespace
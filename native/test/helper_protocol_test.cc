@@ -0,0 +1,221 @@
+#include "helper_protocol.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+// One frame of |kind| with |payload|, header and all.
+std::string Frame(HelperMessage kind, const std::string& payload) {
+  HelperFrameWriter writer;
+  writer.BeginFrame(kind);
+  writer.PutBytes(payload.data(), payload.size());
+  writer.EndFrame();
+  return writer.buffer();
+}
+
+TEST(HelperFrameReaderTest, WaitsForTheRestOfATruncatedFrame) {
+  std::string stream = Frame(HelperMessage::kLog, "first") + Frame(HelperMessage::kState, "xy");
+  HelperFrameReader reader;
+  HelperMessage kind;
+  std::string payload;
+  // Byte by byte, so every cut through a header and a payload is seen.
+  std::vector<std::string> payloads;
+  for (char byte : stream) {
+    reader.Append(&byte, 1);
+    while (reader.Next(&kind, &payload)) {
+      payloads.push_back(payload);
+    }
+  }
+  EXPECT_EQ(payloads, (std::vector<std::string>{"first", "xy"}));
+  EXPECT_EQ(kind, HelperMessage::kState);
+  EXPECT_FALSE(reader.broken());
+}
+
+TEST(HelperFrameReaderTest, HoldsBackAHeaderWithoutItsPayload) {
+  std::string frame = Frame(HelperMessage::kLog, "payload");
+  HelperFrameReader reader;
+  reader.Append(frame.data(), frame.size() - 1);
+  HelperMessage kind;
+  std::string payload;
+  EXPECT_FALSE(reader.Next(&kind, &payload));
+  EXPECT_FALSE(reader.broken());
+  reader.Append(frame.data() + frame.size() - 1, 1);
+  ASSERT_TRUE(reader.Next(&kind, &payload));
+  EXPECT_EQ(payload, "payload");
+}
+
+TEST(HelperFrameReaderTest, PassesOnFramesOfUnknownKinds) {
+  std::string stream = Frame(static_cast<HelperMessage>(200), "later") + Frame(HelperMessage::kStop, "");
+  HelperFrameReader reader;
+  reader.Append(stream.data(), stream.size());
+  HelperMessage kind;
+  std::string payload;
+  ASSERT_TRUE(reader.Next(&kind, &payload));
+  EXPECT_EQ(static_cast<uint8_t>(kind), 200);
+  EXPECT_EQ(payload, "later");
+  ASSERT_TRUE(reader.Next(&kind, &payload));
+  EXPECT_EQ(kind, HelperMessage::kStop);
+  EXPECT_TRUE(payload.empty());
+}
+
+TEST(HelperFrameReaderTest, BreaksOnAnOversizedFrame) {
+  HelperFrameWriter writer;
+  writer.BeginFrame(HelperMessage::kLog);
+  writer.EndFrame();
+  std::string header = writer.buffer();
+  uint32_t size = kHelperMaxFrameSize + 1;
+  for (int i = 0; i < 4; i++) {
+    header[4 + i] = static_cast<char>(size >> (i * 8));
+  }
+  // Only the header has arrived; the size alone condemns the stream.
+  HelperFrameReader reader;
+  reader.Append(header.data(), header.size());
+  HelperMessage kind;
+  std::string payload;
+  EXPECT_FALSE(reader.Next(&kind, &payload));
+  EXPECT_TRUE(reader.broken());
+
+  // Nothing after it is read either.
+  std::string next = Frame(HelperMessage::kStop, "");
+  reader.Append(next.data(), next.size());
+  EXPECT_FALSE(reader.Next(&kind, &payload));
+  EXPECT_TRUE(reader.broken());
+}
+
+TEST(HelperFrameReaderTest, TakesAFrameOfTheMaximumSize) {
+  std::string stream = Frame(HelperMessage::kLog, std::string(kHelperMaxFrameSize, 'x'));
+  HelperFrameReader reader;
+  reader.Append(stream.data(), stream.size());
+  HelperMessage kind;
+  std::string payload;
+  ASSERT_TRUE(reader.Next(&kind, &payload));
+  EXPECT_EQ(payload.size(), kHelperMaxFrameSize);
+  EXPECT_FALSE(reader.broken());
+}
+
+TEST(HelperPayloadReaderTest, FailsAndStaysFailedPastTheEnd) {
+  HelperFrameWriter writer;
+  writer.PutU32(7);
+  writer.PutU8(1);
+  HelperPayloadReader reader(writer.buffer());
+  EXPECT_EQ(reader.ReadU32(), 7u);
+  EXPECT_EQ(reader.ReadU64(), 0u);
+  EXPECT_FALSE(reader.ok());
+  // The byte that is left is not handed out after the failure.
+  EXPECT_EQ(reader.ReadU8(), 0);
+  EXPECT_TRUE(reader.Rest().empty());
+  EXPECT_FALSE(reader.ok());
+}
+
+TEST(HelperPayloadReaderTest, FailsOnAStringLongerThanThePayload) {
+  HelperFrameWriter writer;
+  writer.PutU32(100);
+  writer.PutBytes("short", 5);
+  HelperPayloadReader reader(writer.buffer());
+  EXPECT_TRUE(reader.ReadString().empty());
+  EXPECT_FALSE(reader.ok());
+}
+
+TEST(HelperPayloadReaderTest, FailsFastOnABogusListCount) {
+  HelperFrameWriter writer;
+  writer.PutU32(0xffffffff);
+  writer.PutString("one");
+  HelperPayloadReader reader(writer.buffer());
+  std::vector<std::string> items = reader.ReadStringList();
+  EXPECT_FALSE(reader.ok());
+  EXPECT_LE(items.size(), 2u);
+}
+
+TEST(HelperProtocolTest, RoundTripsATunnelRequest) {
+  HelperTunnelRequest tunnel;
+  tunnel.auto_restart = false;
+  tunnel.memory_high = 100 << 20;
+  tunnel.memory_max = 200 << 20;
+  tunnel.cpu_max_percent = 150;
+  tunnel.split_mode = "bypass";
+  tunnel.split_apps = {"firefox", "/usr/bin/steam"};
+  tunnel.link = "vless://id@example.com:443?security=reality#Server";
+  tunnel.settings.dns_provider = "cloudflare";
+  tunnel.settings.enable_logging = true;
+  tunnel.settings.use_mixed_inbound = true;
+  tunnel.settings.mixed_inbound_listen_address = "127.0.0.1";
+  tunnel.settings.mixed_inbound_listen_port = 2080;
+  tunnel.settings.excluded_domains = {"example.org"};
+  tunnel.settings.excluded_domain_suffixes = {".ru", ".local"};
+  tunnel.settings.clash_api_port = 9090;
+  tunnel.settings.rule_set_directory = "/home/user/rule-sets";
+
+  HelperFrameWriter writer;
+  writer.AppendTunnelRequest(HelperMessage::kPrepare, 42, tunnel);
+  HelperFrameReader frames;
+  frames.Append(writer.buffer().data(), writer.size());
+  HelperMessage kind;
+  std::string payload;
+  ASSERT_TRUE(frames.Next(&kind, &payload));
+  EXPECT_EQ(kind, HelperMessage::kPrepare);
+
+  HelperPayloadReader reader(payload);
+  EXPECT_EQ(reader.ReadU32(), 42u);
+  HelperTunnelRequest read;
+  ASSERT_TRUE(ReadTunnelRequest(&reader, &read));
+  EXPECT_TRUE(reader.Rest().empty());
+  EXPECT_EQ(read.auto_restart, tunnel.auto_restart);
+  EXPECT_EQ(read.memory_high, tunnel.memory_high);
+  EXPECT_EQ(read.memory_max, tunnel.memory_max);
+  EXPECT_EQ(read.cpu_max_percent, tunnel.cpu_max_percent);
+  EXPECT_EQ(read.split_mode, tunnel.split_mode);
+  EXPECT_EQ(read.split_apps, tunnel.split_apps);
+  EXPECT_EQ(read.link, tunnel.link);
+  EXPECT_EQ(read.settings.dns_provider, tunnel.settings.dns_provider);
+  EXPECT_EQ(read.settings.enable_logging, tunnel.settings.enable_logging);
+  EXPECT_EQ(read.settings.use_mixed_inbound, tunnel.settings.use_mixed_inbound);
+  EXPECT_EQ(read.settings.mixed_inbound_listen_address, tunnel.settings.mixed_inbound_listen_address);
+  EXPECT_EQ(read.settings.mixed_inbound_listen_port, tunnel.settings.mixed_inbound_listen_port);
+  EXPECT_EQ(read.settings.excluded_domains, tunnel.settings.excluded_domains);
+  EXPECT_EQ(read.settings.excluded_domain_suffixes, tunnel.settings.excluded_domain_suffixes);
+  EXPECT_EQ(read.settings.clash_api_port, tunnel.settings.clash_api_port);
+  // The helper picks where rule-sets go, never the client.
+  EXPECT_TRUE(read.settings.rule_set_directory.empty());
+}
+
+TEST(HelperProtocolTest, RejectsATruncatedTunnelRequest) {
+  HelperTunnelRequest tunnel;
+  tunnel.link = "vless://id@example.com:443";
+  tunnel.settings.excluded_domains = {"example.org"};
+  HelperFrameWriter writer;
+  writer.AppendTunnelRequest(HelperMessage::kStart, 1, tunnel);
+  std::string payload = writer.buffer().substr(kHelperHeaderSize);
+  // Every cut short of the whole payload loses a field.
+  for (size_t size = 4; size < payload.size(); size++) {
+    SCOPED_TRACE(size);
+    HelperPayloadReader reader(std::string_view(payload).substr(0, size));
+    reader.ReadU32();
+    HelperTunnelRequest read;
+    EXPECT_FALSE(ReadTunnelRequest(&reader, &read));
+  }
+}
+
+TEST(HelperProtocolTest, RoundTripsAResult) {
+  HelperResult result;
+  result.ok = true;
+  result.path = ReloadPath::kSignal;
+  result.elapsed_ms = 180;
+  result.sections = {"dns", "route"};
+  result.text = "reloaded";
+  HelperFrameWriter writer;
+  writer.AppendResult(9, result);
+  HelperPayloadReader reader(std::string_view(writer.buffer()).substr(kHelperHeaderSize));
+  EXPECT_EQ(reader.ReadU32(), 9u);
+  HelperResult read;
+  ASSERT_TRUE(ReadResult(&reader, &read));
+  EXPECT_TRUE(read.ok);
+  EXPECT_EQ(read.path, ReloadPath::kSignal);
+  EXPECT_EQ(read.elapsed_ms, 180);
+  EXPECT_EQ(read.sections, result.sections);
+  EXPECT_EQ(read.text, "reloaded");
+}
+
+}  // namespace
@@ -0,0 +1,222 @@
+#include "log_journal.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t kSegmentSize = 64 * 1024;
+// What a segment holds after its 64-byte header.
+constexpr size_t kCapacity = kSegmentSize - 64;
+
+// Line |id|, 100 bytes with the newline.
+std::string Line(int id) {
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "line %06d ", id);
+  std::string line(prefix);
+  line.resize(99, '.');
+  return line + "\n";
+}
+
+// Splits |text| into lines and checks they are Line(first), Line(first + 1)
+// and so on. Returns the id after the last one.
+int ExpectConsecutive(const std::string& text, int first) {
+  int id = first;
+  for (size_t start = 0; start < text.size(); start += 100, id++) {
+    EXPECT_EQ(text.substr(start, 100), Line(id)) << "at byte " << start;
+    if (text.compare(start, 100, Line(id)) != 0) {
+      break;
+    }
+  }
+  return id;
+}
+
+class LogJournalTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("hwl-log-journal-test-" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+    std::filesystem::remove_all(directory_);
+  }
+  void TearDown() override { std::filesystem::remove_all(directory_); }
+
+  static std::string ReadAll(const LogJournal& journal, uint64_t position = 0) {
+    std::string text;
+    journal.Read(position, [&text](const char* data, size_t size) { text.append(data, size); });
+    return text;
+  }
+
+  static std::string ReadAll(LogJournalReader* reader, uint64_t* position) {
+    std::string text;
+    *position = reader->Read(*position, [&text](const char* data, size_t size) { text.append(data, size); });
+    return text;
+  }
+
+  size_t SegmentFiles() const {
+    size_t count = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+      count += entry.path().extension() == ".log" ? 1 : 0;
+    }
+    return count;
+  }
+
+  std::filesystem::path directory_;
+};
+
+TEST_F(LogJournalTest, RecoversWholeLinesAndDropsATornLastLine) {
+  {
+    LogJournal journal(kSegmentSize, 4);
+    ASSERT_TRUE(journal.Open(directory_));
+    journal.Append("one\ntwo\n", 8);
+    journal.Commit();
+    // Written but never committed, and the last line is cut short, as when
+    // the process dies mid-write. Destroying without Close() commits
+    // nothing more.
+    journal.Append("three\nfour\nfiv", 14);
+    EXPECT_EQ(journal.end_position(), 8u);
+  }
+
+  LogJournal journal(kSegmentSize, 4);
+  ASSERT_TRUE(journal.Open(directory_));
+  EXPECT_EQ(ReadAll(journal), "one\ntwo\nthree\nfour\n");
+  EXPECT_EQ(journal.end_position(), 19u);
+
+  // The torn bytes were cleared, so they do not run into the next line.
+  journal.Append("six\n", 4);
+  journal.Commit();
+  EXPECT_EQ(ReadAll(journal), "one\ntwo\nthree\nfour\nsix\n");
+  journal.Close();
+
+  ASSERT_TRUE(journal.Open(directory_));
+  EXPECT_EQ(ReadAll(journal), "one\ntwo\nthree\nfour\nsix\n");
+}
+
+TEST_F(LogJournalTest, RotatesOutTheOldestSegment) {
+  LogJournal journal(kSegmentSize, 3);
+  ASSERT_TRUE(journal.Open(directory_));
+  const int lines_per_segment = static_cast<int>(kCapacity / 100);
+  const int total = 5 * lines_per_segment + 10;
+  for (int id = 0; id < total; id++) {
+    std::string line = Line(id);
+    journal.Append(line.data(), line.size());
+  }
+  journal.Commit();
+
+  // Segments 3, 4 and 5 are left; lines never straddle two of them.
+  EXPECT_EQ(SegmentFiles(), 3u);
+  EXPECT_EQ(journal.begin_position(), 3 * kCapacity);
+  EXPECT_EQ(journal.end_position(), 5 * kCapacity + 10 * 100);
+  std::string text;
+  uint64_t end = journal.Read(0, [&text](const char* data, size_t size) {
+    EXPECT_EQ(size % 100, 0u);
+    text.append(data, size);
+  });
+  EXPECT_EQ(end, journal.end_position());
+  EXPECT_EQ(ExpectConsecutive(text, 3 * lines_per_segment), total);
+
+  // Positions carry on across a reopen.
+  journal.Close();
+  ASSERT_TRUE(journal.Open(directory_));
+  EXPECT_EQ(journal.begin_position(), 3 * kCapacity);
+  EXPECT_EQ(journal.end_position(), end);
+}
+
+TEST_F(LogJournalTest, ReaderSeesOnlyCommittedLines) {
+  LogJournal journal(kSegmentSize, 3);
+  ASSERT_TRUE(journal.Open(directory_));
+  LogJournalReader reader(directory_);
+  uint64_t position = 0;
+  EXPECT_EQ(ReadAll(&reader, &position), "");
+
+  journal.Append("first\n", 6);
+  EXPECT_EQ(ReadAll(&reader, &position), "");
+  journal.Commit();
+  EXPECT_EQ(ReadAll(&reader, &position), "first\n");
+  EXPECT_EQ(position, 6u);
+  EXPECT_EQ(ReadAll(&reader, &position), "");
+
+  journal.Append("second\n", 7);
+  journal.Commit();
+  EXPECT_EQ(ReadAll(&reader, &position), "second\n");
+  EXPECT_EQ(position, journal.end_position());
+}
+
+TEST_F(LogJournalTest, ReaderFollowsRotationFromItsCursor) {
+  LogJournal journal(kSegmentSize, 2);
+  ASSERT_TRUE(journal.Open(directory_));
+  LogJournalReader reader(directory_);
+  uint64_t position = 0;
+  const int lines_per_segment = static_cast<int>(kCapacity / 100);
+
+  // Read a little at a time while the writer moves through four segments,
+  // deleting the ones the reader has mapped.
+  int next = 0;
+  int written = 0;
+  while (written < 4 * lines_per_segment) {
+    for (int i = 0; i < 97; i++, written++) {
+      std::string line = Line(written);
+      journal.Append(line.data(), line.size());
+    }
+    journal.Commit();
+    next = ExpectConsecutive(ReadAll(&reader, &position), next);
+    ASSERT_EQ(next, written);
+  }
+  EXPECT_EQ(position, journal.end_position());
+}
+
+TEST_F(LogJournalTest, ReaderSkipsWhatItFellBehindOn) {
+  LogJournal journal(kSegmentSize, 2);
+  ASSERT_TRUE(journal.Open(directory_));
+  const int lines_per_segment = static_cast<int>(kCapacity / 100);
+  for (int id = 0; id < 3 * lines_per_segment + 1; id++) {
+    std::string line = Line(id);
+    journal.Append(line.data(), line.size());
+  }
+  journal.Commit();
+
+  // Position 0 is long gone; reading resumes at the oldest retained line.
+  LogJournalReader reader(directory_);
+  uint64_t position = 0;
+  std::string text = ReadAll(&reader, &position);
+  EXPECT_EQ(ExpectConsecutive(text, 2 * lines_per_segment), 3 * lines_per_segment + 1);
+  EXPECT_EQ(position, journal.end_position());
+}
+
+TEST_F(LogJournalTest, ReaderContinuesAfterClear) {
+  LogJournal journal(kSegmentSize, 3);
+  ASSERT_TRUE(journal.Open(directory_));
+  LogJournalReader reader(directory_);
+  uint64_t position = 0;
+  journal.Append("before\n", 7);
+  journal.Commit();
+  EXPECT_EQ(ReadAll(&reader, &position), "before\n");
+
+  journal.Clear();
+  EXPECT_EQ(ReadAll(&reader, &position), "");
+  journal.Append("after\n", 6);
+  journal.Commit();
+  EXPECT_EQ(ReadAll(&reader, &position), "after\n");
+  EXPECT_EQ(position, kCapacity + 6);
+}
+
+TEST_F(LogJournalTest, ReaderIgnoresASegmentWithoutAHeader) {
+  LogJournal journal(kSegmentSize, 3);
+  ASSERT_TRUE(journal.Open(directory_));
+  journal.Append("kept\n", 5);
+  journal.Commit();
+  // A segment as it looks between its creation and its header write.
+  {
+    MappedFile blank;
+    ASSERT_TRUE(blank.Open(directory_ / "segment-0000000000000001.log", kSegmentSize));
+  }
+  LogJournalReader reader(directory_);
+  uint64_t position = 0;
+  EXPECT_EQ(ReadAll(&reader, &position), "kept\n");
+  EXPECT_EQ(ReadAll(&reader, &position), "");
+}
+
+}  // namespace
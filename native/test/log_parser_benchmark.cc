@@ -0,0 +1,40 @@
+#include "log_parser.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+// A mix like a busy session's: mostly connection lines, some DNS, colours on.
+std::vector<std::string> SampleLines() {
+  return {
+      "+0300 2024-05-01 12:00:00 INFO [3021554837 12ms] outbound/vless[proxy]: "
+      "outbound connection to www.example.com:443",
+      "+0300 2024-05-01 12:00:00 INFO [3021554838 0ms] inbound/tun[tun-in]: "
+      "inbound connection from 172.19.0.1:51514",
+      "+0300 2024-05-01 12:00:01 DEBUG [3021554838 3ms] dns: exchanged A www.example.com 300",
+      "\x1b[36m+0300 2024-05-01 12:00:01\x1b[0m \x1b[33mWARN\x1b[0m "
+      "[\x1b[38;5;32m3021554839\x1b[0m 5.01s] router: process not found",
+      "+0300 2024-05-01 12:00:02 ERROR [3021554840 30s] outbound/vless[proxy]: "
+      "connection upload closed: raw-read tcp 10.0.0.2:41122->203.0.113.7:443: i/o timeout",
+  };
+}
+
+void BM_ParseLogLine(benchmark::State& state) {
+  std::vector<std::string> lines = SampleLines();
+  LogModuleTable modules;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    for (const std::string& line : lines) {
+      benchmark::DoNotOptimize(ParseLogLine(line.data(), line.data(), line.size(), &modules));
+      bytes += line.size() + 1;
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(lines.size()));
+}
+BENCHMARK(BM_ParseLogLine);
+
+}  // namespace
@@ -0,0 +1,146 @@
+#include "log_parser.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace {
+
+// 2024-05-01 12:00:00 +0300 as Unix milliseconds.
+constexpr int64_t kNoonMoscow = 1714554000000;
+
+struct Parsed {
+  LogRecord record;
+  std::string module;
+  std::string message;
+};
+
+Parsed Parse(const std::string& line, LogModuleTable* modules) {
+  Parsed parsed;
+  parsed.record = ParseLogLine(line.data(), line.data(), line.size(), modules);
+  parsed.module = modules->names()[parsed.record.module];
+  parsed.message = line.substr(parsed.record.message_offset, parsed.record.message_length);
+  return parsed;
+}
+
+TEST(LogParserTest, ParsesAFullLine) {
+  LogModuleTable modules;
+  Parsed parsed = Parse(
+      "+0300 2024-05-01 12:00:00 INFO [3141592653 12ms] outbound/vless[proxy]: outbound connection to x:443",
+      &modules);
+  EXPECT_EQ(parsed.record.level, kLogLevelInfo);
+  EXPECT_EQ(parsed.record.timestamp_ms, kNoonMoscow);
+  EXPECT_EQ(parsed.record.connection_id, 3141592653u);
+  EXPECT_EQ(parsed.module, "outbound/vless[proxy]");
+  EXPECT_EQ(parsed.message, "outbound connection to x:443");
+}
+
+TEST(LogParserTest, ReadsEveryLevel) {
+  const std::pair<const char*, LogLevel> cases[] = {
+      {"TRACE", kLogLevelTrace}, {"DEBUG", kLogLevelDebug}, {"INFO", kLogLevelInfo},
+      {"WARN", kLogLevelWarn},   {"ERROR", kLogLevelError}, {"FATAL", kLogLevelFatal},
+      {"PANIC", kLogLevelPanic},
+  };
+  LogModuleTable modules;
+  for (const auto& [name, level] : cases) {
+    SCOPED_TRACE(name);
+    Parsed parsed = Parse(std::string("+0000 2024-05-01 12:00:00 ") + name + " dns: lookup", &modules);
+    EXPECT_EQ(parsed.record.level, level);
+    EXPECT_EQ(parsed.message, "lookup");
+  }
+}
+
+TEST(LogParserTest, ConvertsTheZoneAndFraction) {
+  LogModuleTable modules;
+  Parsed parsed = Parse("-0130 2024-05-01 12:00:00.5 WARN late", &modules);
+  EXPECT_EQ(parsed.record.timestamp_ms, kNoonMoscow + (3 * 60 + 90) * 60 * 1000 + 500);
+  parsed = Parse("+0300 2024-05-01 12:00:00.123456 WARN late", &modules);
+  EXPECT_EQ(parsed.record.timestamp_ms, kNoonMoscow + 123);
+}
+
+TEST(LogParserTest, TakesLinesWithoutOptionalParts) {
+  LogModuleTable modules;
+  // No timestamp.
+  Parsed parsed = Parse("WARN dns: slow upstream", &modules);
+  EXPECT_EQ(parsed.record.level, kLogLevelWarn);
+  EXPECT_EQ(parsed.record.timestamp_ms, 0);
+  EXPECT_EQ(parsed.module, "dns");
+  EXPECT_EQ(parsed.message, "slow upstream");
+
+  // No connection and no module: a word not followed by ": " is message.
+  parsed = Parse("+0300 2024-05-01 12:00:00 ERROR start service: bad config", &modules);
+  EXPECT_EQ(parsed.record.level, kLogLevelError);
+  EXPECT_EQ(parsed.record.connection_id, 0u);
+  EXPECT_EQ(parsed.record.module, 0);
+  EXPECT_EQ(parsed.message, "start service: bad config");
+}
+
+TEST(LogParserTest, SkipsAnsiColours) {
+  LogModuleTable modules;
+  Parsed parsed = Parse(
+      "\x1b[36m+0300 2024-05-01 12:00:00\x1b[0m \x1b[36mINFO\x1b[0m "
+      "[\x1b[38;5;32m3021554837\x1b[0m 12ms] inbound/tun[tun-in]: accepted",
+      &modules);
+  EXPECT_EQ(parsed.record.level, kLogLevelInfo);
+  EXPECT_EQ(parsed.record.timestamp_ms, kNoonMoscow);
+  EXPECT_EQ(parsed.record.connection_id, 3021554837u);
+  EXPECT_EQ(parsed.module, "inbound/tun[tun-in]");
+  EXPECT_EQ(parsed.message, "accepted");
+}
+
+TEST(LogParserTest, InternsModules) {
+  LogModuleTable modules;
+  Parsed first = Parse("INFO dns: a", &modules);
+  Parsed other = Parse("INFO router: b", &modules);
+  Parsed again = Parse("DEBUG dns: c", &modules);
+  EXPECT_NE(first.record.module, 0);
+  EXPECT_NE(first.record.module, other.record.module);
+  EXPECT_EQ(first.record.module, again.record.module);
+  EXPECT_EQ(modules.names().size(), 3u);
+  EXPECT_EQ(modules.names()[0], "");
+}
+
+TEST(LogParserTest, KeepsMalformedLinesWhole) {
+  const char* cases[] = {
+      "",
+      "sing-box started",
+      "INF dns: close but no",
+      // A bad month voids the timestamp, and nothing else is a level.
+      "+0300 2024-13-01 12:00:00 INFO dns: x",
+      "+0300 2024-05-01 12:00 INFO dns: x",
+      "\x1b[31m",
+  };
+  LogModuleTable modules;
+  for (const char* line : cases) {
+    SCOPED_TRACE(line);
+    Parsed parsed = Parse(line, &modules);
+    EXPECT_EQ(parsed.record.level, kLogLevelUnknown);
+    EXPECT_EQ(parsed.record.timestamp_ms, 0);
+    EXPECT_EQ(parsed.record.module, 0);
+    EXPECT_EQ(parsed.message, line);
+  }
+  EXPECT_EQ(modules.names().size(), 1u);
+}
+
+TEST(LogParserTest, StopsAtTheEndOfATruncatedLine) {
+  LogModuleTable modules;
+  Parsed parsed = Parse("INFO [12345", &modules);
+  EXPECT_EQ(parsed.record.level, kLogLevelInfo);
+  EXPECT_EQ(parsed.record.connection_id, 12345u);
+  EXPECT_EQ(parsed.message, "");
+
+  parsed = Parse("ERROR [", &modules);
+  EXPECT_EQ(parsed.record.level, kLogLevelError);
+  EXPECT_EQ(parsed.record.connection_id, 0u);
+  EXPECT_EQ(parsed.message, "[");
+}
+
+TEST(LogParserTest, OffsetsAreRelativeToTheArena) {
+  std::string arena = "previous line\nINFO dns: hello";
+  LogModuleTable modules;
+  const char* line = arena.data() + 14;
+  LogRecord record = ParseLogLine(arena.data(), line, arena.size() - 14, &modules);
+  EXPECT_EQ(arena.substr(record.message_offset, record.message_length), "hello");
+}
+
+}  // namespace
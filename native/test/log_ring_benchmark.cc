@@ -0,0 +1,65 @@
+#include "log_ring.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace {
+
+// A typical sing-box line, colours and all.
+const char kLine[] =
+    "\x1b[36mINFO\x1b[0m [3021554837 12ms] outbound/vless[proxy]: "
+    "outbound connection to www.example.com:443\n";
+
+// Producer and consumer on one thread: the cost of the ring itself.
+void BM_LogRingWriteDrain(benchmark::State& state) {
+  LogRing ring;
+  size_t line_size = sizeof(kLine) - 1;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < 1000; i++) {
+      ring.Write(kLine, line_size);
+    }
+    ring.Drain([&bytes](const char*, size_t size) { bytes += size; });
+  }
+  benchmark::DoNotOptimize(bytes);
+  state.SetItemsProcessed(state.iterations() * 1000);
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  state.counters["dropped"] = static_cast<double>(ring.dropped_bytes());
+}
+BENCHMARK(BM_LogRingWriteDrain);
+
+// A consumer thread drains while the benchmark thread writes, as the event
+// loop and the Dart isolate do. Lines that find the ring full are dropped,
+// so "lines/s" counts only what arrived.
+void BM_LogRingConcurrent(benchmark::State& state) {
+  LogRing ring;
+  size_t line_size = sizeof(kLine) - 1;
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> drained{0};
+  std::thread consumer([&]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      size_t lines = ring.Drain([](const char*, size_t) {});
+      if (lines == 0) {
+        std::this_thread::yield();
+      }
+      drained.fetch_add(lines, std::memory_order_relaxed);
+    }
+  });
+  for (auto _ : state) {
+    for (int i = 0; i < 1000; i++) {
+      ring.Write(kLine, line_size);
+    }
+  }
+  stop.store(true);
+  consumer.join();
+  drained.fetch_add(ring.Drain([](const char*, size_t) {}));
+  state.counters["lines/s"] =
+      benchmark::Counter(static_cast<double>(drained.load()), benchmark::Counter::kIsRate);
+  state.counters["dropped"] = static_cast<double>(ring.dropped_bytes());
+}
+BENCHMARK(BM_LogRingConcurrent)->UseRealTime();
+
+}  // namespace
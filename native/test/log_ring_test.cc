@@ -0,0 +1,221 @@
+#include "log_ring.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Drains |ring| into one string.
+std::string DrainAll(LogRing* ring, size_t* lines = nullptr, size_t* chunks = nullptr) {
+  std::string out;
+  size_t calls = 0;
+  size_t drained = ring->Drain([&](const char* data, size_t size) {
+    out.append(data, size);
+    calls++;
+  });
+  if (lines != nullptr) {
+    *lines = drained;
+  }
+  if (chunks != nullptr) {
+    *chunks = calls;
+  }
+  return out;
+}
+
+// Writes through PrepareWrite and CommitWrite in pieces of at most |piece|
+// bytes, as ProcessManager does with pipe reads.
+void WriteInPieces(LogRing* ring, const std::string& data, size_t piece) {
+  size_t written = 0;
+  while (written < data.size()) {
+    LogRing::Span span = ring->PrepareWrite();
+    ASSERT_GT(span.size, 0u);
+    size_t size = std::min({span.size, piece, data.size() - written});
+    memcpy(span.data, data.data() + written, size);
+    ring->CommitWrite(size);
+    written += size;
+  }
+}
+
+TEST(LogRingTest, PublishesOnlyWholeLines) {
+  LogRing ring(4096);
+  ring.Write("first\nsec", 9);
+  EXPECT_TRUE(ring.HasPendingLines());
+  size_t lines;
+  EXPECT_EQ(DrainAll(&ring, &lines), "first\n");
+  EXPECT_EQ(lines, 1u);
+
+  // The partial line waits for its newline.
+  EXPECT_FALSE(ring.HasPendingLines());
+  EXPECT_EQ(DrainAll(&ring, &lines), "");
+  EXPECT_EQ(lines, 0u);
+  ring.Write("ond\nthird\nfou", 13);
+  EXPECT_EQ(DrainAll(&ring, &lines), "second\nthird\n");
+  EXPECT_EQ(lines, 2u);
+
+  ring.TerminateLine();
+  EXPECT_EQ(DrainAll(&ring, &lines), "fou\n");
+  EXPECT_EQ(lines, 1u);
+  // Nothing pending, so nothing to terminate.
+  ring.TerminateLine();
+  EXPECT_FALSE(ring.HasPendingLines());
+}
+
+TEST(LogRingTest, DrainsAcrossTheWrapInTwoChunks) {
+  LogRing ring(4096);
+  ASSERT_EQ(ring.capacity(), 4096u);
+  std::string filler(3000, 'a');
+  filler.back() = '\n';
+  ring.Write(filler.data(), filler.size());
+  DrainAll(&ring);
+
+  // Starts 3000 bytes in, so it runs over the end of the buffer.
+  std::string lines;
+  for (int i = 0; i < 200; i++) {
+    lines += "line " + std::to_string(i) + "\n";
+  }
+  ASSERT_GT(lines.size(), 4096u - 3000u);
+  WriteInPieces(&ring, lines, 64);
+  size_t count;
+  size_t chunks;
+  EXPECT_EQ(DrainAll(&ring, &count, &chunks), lines);
+  EXPECT_EQ(count, 200u);
+  EXPECT_EQ(chunks, 2u);
+}
+
+TEST(LogRingTest, CountsWhatDoesNotFit) {
+  LogRing ring(4096);
+  std::string line(1000, 'x');
+  line.back() = '\n';
+  size_t written = 0;
+  for (int i = 0; i < 5; i++) {
+    written += ring.Write(line.data(), line.size());
+  }
+  EXPECT_EQ(written, 4096u);
+  EXPECT_EQ(ring.dropped_bytes(), 5 * 1000u - 4096u);
+  size_t lines;
+  EXPECT_EQ(DrainAll(&ring, &lines).size(), 4000u);
+  EXPECT_EQ(lines, 4u);
+}
+
+TEST(LogRingTest, TruncatesAnOverlongLineAtACharacterBoundary) {
+  LogRing ring(4096);
+  constexpr size_t kMarkerSize = sizeof(LogRing::kTruncatedMarker) - 1;
+  // Three-byte characters, so the cut lands inside one unless it backs up.
+  std::string overlong;
+  while (overlong.size() < 3 * ring.max_line()) {
+    overlong += "\xe2\x82\xac";
+  }
+  std::string input = "before\n" + overlong + "\nafter\n";
+  WriteInPieces(&ring, input, 100);
+
+  size_t lines;
+  std::string out = DrainAll(&ring, &lines);
+  EXPECT_EQ(lines, 3u);
+  ASSERT_EQ(out.substr(0, 7), "before\n");
+  std::string cut = out.substr(7, out.size() - 7 - 6);
+  EXPECT_EQ(out.substr(out.size() - 6), "after\n");
+  ASSERT_GT(cut.size(), kMarkerSize);
+  EXPECT_LE(cut.size(), ring.max_line());
+  EXPECT_EQ(cut.substr(cut.size() - kMarkerSize), LogRing::kTruncatedMarker);
+  std::string kept = cut.substr(0, cut.size() - kMarkerSize);
+  EXPECT_EQ(kept.size() % 3, 0u);
+  EXPECT_EQ(kept, overlong.substr(0, kept.size()));
+  EXPECT_EQ(ring.dropped_bytes(), overlong.size() + 1 - kept.size());
+}
+
+TEST(LogRingTest, KeepsTheLineAfterATruncatedOneInTheSameWrite) {
+  LogRing ring(4096);
+  std::string overlong(ring.max_line() + 10, 'x');
+  ring.Write(overlong.data(), overlong.size());
+  // Still dropping: the end of the long line and the next line arrive in
+  // one piece.
+  std::string rest = "yyyy\nnext line\n";
+  ring.Write(rest.data(), rest.size());
+  size_t lines;
+  std::string out = DrainAll(&ring, &lines);
+  EXPECT_EQ(lines, 2u);
+  ASSERT_GT(out.size(), 10u);
+  EXPECT_EQ(out.substr(out.size() - 10), "next line\n");
+  EXPECT_EQ(out.find('y'), std::string::npos);
+}
+
+TEST(LogRingTest, WakesOnceAtTheHighWaterMark) {
+  LogRing ring(4096);
+  int wakes = 0;
+  ring.SetWakeCallback(100, [&wakes]() { wakes++; });
+  std::string line(60, 'x');
+  line.back() = '\n';
+  ring.Write(line.data(), line.size());
+  EXPECT_EQ(wakes, 0);
+  ring.Write(line.data(), line.size());
+  EXPECT_EQ(wakes, 1);
+  ring.Write(line.data(), line.size());
+  EXPECT_EQ(wakes, 1);
+  DrainAll(&ring);
+  ring.Write(line.data(), line.size());
+  ring.Write(line.data(), line.size());
+  EXPECT_EQ(wakes, 2);
+}
+
+TEST(LogRingTest, DeliversEveryLineWhileDrainingDuringWrites) {
+  LogRing ring(8192);
+  constexpr int kLines = 200000;
+  std::atomic<bool> done{false};
+  std::thread producer([&]() {
+    std::string line;
+    for (int i = 0; i < kLines; i++) {
+      line = std::to_string(i) + " " + std::string(i % 50, 'z') + "\n";
+      size_t written = 0;
+      // Wait for room rather than drop, so every line can be checked.
+      while (written < line.size()) {
+        LogRing::Span span = ring.PrepareWrite();
+        if (span.size == 0) {
+          std::this_thread::yield();
+          continue;
+        }
+        size_t size = std::min(span.size, line.size() - written);
+        memcpy(span.data, line.data() + written, size);
+        ring.CommitWrite(size);
+        written += size;
+      }
+    }
+    done.store(true);
+  });
+
+  std::string pending;
+  int next = 0;
+  size_t counted = 0;
+  bool failed = false;
+  auto consume = [&]() {
+    counted += ring.Drain([&](const char* data, size_t size) { pending.append(data, size); });
+    // Every batch ends on a line boundary.
+    if (!pending.empty() && pending.back() != '\n') {
+      failed = true;
+    }
+    size_t start = 0;
+    for (size_t newline; (newline = pending.find('\n', start)) != std::string::npos; start = newline + 1) {
+      std::string expected = std::to_string(next) + " " + std::string(next % 50, 'z');
+      if (pending.compare(start, newline - start, expected) != 0) {
+        failed = true;
+      }
+      next++;
+    }
+    pending.erase(0, start);
+  };
+  while (!done.load()) {
+    consume();
+  }
+  producer.join();
+  consume();
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(next, kLines);
+  EXPECT_EQ(counted, static_cast<size_t>(kLines));
+  EXPECT_EQ(ring.dropped_bytes(), 0u);
+}
+
+}  // namespace
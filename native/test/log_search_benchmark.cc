@@ -0,0 +1,67 @@
+#include "log_index.h"
+#include "log_store.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+// A full default-sized store with one line naming a rare host.
+const LogStore& FullStore() {
+  static const LogStore* store = []() {
+    auto* filled = new LogStore();
+    const char* levels[] = {"INFO", "INFO", "DEBUG", "WARN", "INFO", "ERROR"};
+    for (uint64_t i = 0; filled->evicted_lines() < 10000; i++) {
+      filled->AppendLine("+0300 2024-05-01 12:00:00 " + std::string(levels[i % 6]) + " [" + std::to_string(i) +
+                         " 12ms] outbound/vless[proxy]: outbound connection to host" + std::to_string(i % 997) +
+                         ".example.com:443");
+      if (i == 50000) {
+        filled->AppendLine("+0300 2024-05-01 12:00:00 WARN dns: lookup rare-host.example.org timed out");
+      }
+    }
+    return filled;
+  }();
+  return *store;
+}
+
+void BM_SearchIndexed(benchmark::State& state, const std::string& query, uint32_t level_mask) {
+  const LogStore& store = FullStore();
+  size_t found = 0;
+  for (auto _ : state) {
+    store.Search(query, level_mask, 500, [&found](uint64_t, const char*, size_t) { found++; });
+  }
+  state.counters["lines"] = static_cast<double>(store.next_line() - store.first_line());
+  state.counters["found"] = static_cast<double>(found) / static_cast<double>(state.iterations());
+}
+
+// What Search() would cost without the index: fold and scan every line.
+void BM_SearchLinear(benchmark::State& state, const std::string& query) {
+  const LogStore& store = FullStore();
+  std::string folded(query);
+  std::transform(folded.begin(), folded.end(), folded.begin(), FoldLogChar);
+  size_t found = 0;
+  for (auto _ : state) {
+    store.Read(store.first_line(), SIZE_MAX, [&](const char* data, size_t size) {
+      const char* end = data + size;
+      for (const char* p = data; p < end;) {
+        p = std::search(p, end, folded.begin(), folded.end(), [](char a, char b) { return FoldLogChar(a) == b; });
+        if (p == end) {
+          break;
+        }
+        found++;
+        p = std::find(p, end, '\n');
+      }
+    });
+  }
+  state.counters["found"] = static_cast<double>(found) / static_cast<double>(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_SearchIndexed, rare_phrase, "rare-host.example", ~0u);
+BENCHMARK_CAPTURE(BM_SearchLinear, rare_phrase, "rare-host.example");
+BENCHMARK_CAPTURE(BM_SearchIndexed, common_host, "host42.example", ~0u);
+BENCHMARK_CAPTURE(BM_SearchLinear, common_host, "host42.example");
+BENCHMARK_CAPTURE(BM_SearchIndexed, latest_errors, "", 1u << kLogLevelError);
+
+}  // namespace
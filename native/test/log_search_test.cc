@@ -0,0 +1,183 @@
+#include "log_index.h"
+#include "log_store.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kAllLevels = (1u << kLogLevelCount) - 1;
+
+struct Match {
+  uint64_t line;
+  std::string text;
+
+  bool operator==(const Match& other) const { return line == other.line && text == other.text; }
+};
+
+std::vector<Match> Search(const LogStore& store, const std::string& query, uint32_t level_mask = kAllLevels,
+                          size_t limit = 1000) {
+  std::vector<Match> matches;
+  store.Search(query, level_mask, limit, [&matches](uint64_t line, const char* data, size_t size) {
+    matches.push_back({line, std::string(data, size)});
+  });
+  return matches;
+}
+
+// What Search() should return, by scanning every retained line.
+std::vector<Match> ScanAll(const LogStore& store, const std::string& query, size_t limit = 1000) {
+  std::string folded(query);
+  std::transform(folded.begin(), folded.end(), folded.begin(), FoldLogChar);
+  LogStore::Page page = store.ReadPage(static_cast<int64_t>(store.first_line()), SIZE_MAX);
+  std::vector<Match> matches;
+  uint64_t line = page.first;
+  size_t start = 0;
+  for (size_t i = 0; i < page.data.size(); i++) {
+    if (page.data[i] != '\n') {
+      continue;
+    }
+    std::string text(page.data.begin() + static_cast<ptrdiff_t>(start), page.data.begin() + static_cast<ptrdiff_t>(i));
+    std::string lowered(text);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), FoldLogChar);
+    if (lowered.find(folded) != std::string::npos) {
+      matches.push_back({line, text});
+    }
+    line++;
+    start = i + 1;
+  }
+  std::reverse(matches.begin(), matches.end());
+  if (matches.size() > limit) {
+    matches.resize(limit);
+  }
+  return matches;
+}
+
+// Fills |store| with lines naming hosts and levels in a repeating pattern.
+void Fill(LogStore* store, uint64_t count) {
+  const char* levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+  for (uint64_t i = 0; i < count; i++) {
+    store->AppendLine(std::string(levels[i % 4]) + " [" + std::to_string(i) + " 1ms] outbound/direct: host" +
+                      std::to_string(i % 37) + ".Example.com port " + std::to_string(i % 7));
+  }
+}
+
+TEST(LogSearchTest, MatchesALinearScan) {
+  LogStore store(4096, 4);
+  Fill(&store, 400);
+  ASSERT_GT(store.evicted_lines(), 0u);
+  for (const char* query : {"host12.", "EXAMPLE.COM", "port 3", "outbound/direct: host3", "absent", "1ms] o"}) {
+    SCOPED_TRACE(query);
+    EXPECT_EQ(Search(store, query), ScanAll(store, query));
+  }
+}
+
+TEST(LogSearchTest, HandlesQueriesShorterThanATrigram) {
+  LogStore store(4096, 4);
+  Fill(&store, 200);
+  // No trigram to look up, so every block is a candidate.
+  for (const char* query : {"", "x", "h", "E", "9", "t1"}) {
+    SCOPED_TRACE(query);
+    std::vector<Match> matches = Search(store, query);
+    EXPECT_EQ(matches, ScanAll(store, query));
+  }
+  EXPECT_EQ(Search(store, "").size(), store.next_line() - store.first_line());
+  EXPECT_TRUE(Search(store, "#").empty());
+}
+
+TEST(LogSearchTest, ReturnsTheNewestMatchesFirstUpToTheLimit) {
+  LogStore store(4096, 4);
+  Fill(&store, 200);
+  std::vector<Match> matches = Search(store, "host5.", kAllLevels, 3);
+  ASSERT_EQ(matches.size(), 3u);
+  EXPECT_EQ(matches, ScanAll(store, "host5.", 3));
+  EXPECT_GT(matches[0].line, matches[1].line);
+  EXPECT_GT(matches[1].line, matches[2].line);
+}
+
+TEST(LogSearchTest, FiltersByLevel) {
+  LogStore store(4096, 4);
+  Fill(&store, 200);
+  std::vector<Match> matches = Search(store, "host", 1u << kLogLevelError);
+  ASSERT_FALSE(matches.empty());
+  for (const Match& match : matches) {
+    EXPECT_EQ(match.text.rfind("ERROR", 0), 0u) << match.text;
+    EXPECT_EQ(match.line % 4, 3u);
+  }
+  EXPECT_TRUE(Search(store, "host", 1u << kLogLevelPanic).empty());
+}
+
+TEST(LogSearchTest, FindsMatchesOnBothSidesOfAnEviction) {
+  LogStore store(4096, 2);
+  // Unique markers, so each line is found by exactly one query.
+  uint64_t line = 0;
+  while (store.evicted_lines() == 0) {
+    store.AppendLine("entry marker" + std::to_string(line++) + "z " + std::string(40, '-'));
+  }
+  uint64_t first = store.first_line();
+  ASSERT_GT(first, 0u);
+
+  // The newest evicted line is gone, the oldest retained one is found in the
+  // sealed arena, and the newest in the one being filled.
+  EXPECT_TRUE(Search(store, "marker" + std::to_string(first - 1) + "z").empty());
+  std::vector<Match> matches = Search(store, "marker" + std::to_string(first) + "z");
+  ASSERT_EQ(matches.size(), 1u);
+  EXPECT_EQ(matches[0].line, first);
+  matches = Search(store, "marker" + std::to_string(line - 1) + "z");
+  ASSERT_EQ(matches.size(), 1u);
+  EXPECT_EQ(matches[0].line, line - 1);
+
+  // A common query runs from the arena being filled into the sealed one.
+  matches = Search(store, "entry");
+  EXPECT_EQ(matches.size(), line - first);
+  EXPECT_EQ(matches, ScanAll(store, "entry"));
+}
+
+TEST(LogSearchTest, ForgetsEverythingOnClear) {
+  LogStore store(4096, 3);
+  Fill(&store, 300);
+  ASSERT_FALSE(Search(store, "host1").empty());
+  store.Clear();
+  EXPECT_TRUE(Search(store, "host1").empty());
+  EXPECT_TRUE(Search(store, "").empty());
+
+  // A reused store indexes its new lines only.
+  store.AppendLine("INFO dns: fresh lookup");
+  std::vector<Match> matches = Search(store, "LOOKUP");
+  ASSERT_EQ(matches.size(), 1u);
+  EXPECT_EQ(matches[0].line, 300u);
+  EXPECT_TRUE(Search(store, "host1").empty());
+}
+
+TEST(LogArenaIndexTest, IntersectsTrigramsPerBlock) {
+  LogArenaIndex index;
+  std::vector<uint32_t> pending;
+  // Block 0 has "abc" and "xyz" on different lines; block 1 has neither.
+  index.AddLine(0, kLogLevelInfo, "abc", 3, &pending);
+  index.AddLine(1, kLogLevelWarn, "xyz", 3, &pending);
+  for (size_t line = LogArenaIndex::kLinesPerBlock; line < 2 * LogArenaIndex::kLinesPerBlock; line++) {
+    index.AddLine(line, kLogLevelInfo, "abd", 3, &pending);
+  }
+  index.Seal(&pending);
+  EXPECT_TRUE(pending.empty());
+
+  std::vector<uint32_t> blocks;
+  index.CandidateBlocks(LogTrigrams("abc", 3), kAllLevels, &blocks);
+  EXPECT_EQ(blocks, (std::vector<uint32_t>{0}));
+  index.CandidateBlocks(LogTrigrams("ABCXYZ", 6), kAllLevels, &blocks);
+  EXPECT_TRUE(blocks.empty());
+  std::vector<uint32_t> both = LogTrigrams("abc", 3);
+  both.push_back(LogTrigrams("xyz", 3)[0]);
+  std::sort(both.begin(), both.end());
+  index.CandidateBlocks(both, kAllLevels, &blocks);
+  EXPECT_EQ(blocks, (std::vector<uint32_t>{0}));
+  index.CandidateBlocks({}, 1u << kLogLevelInfo, &blocks);
+  EXPECT_EQ(blocks, (std::vector<uint32_t>{0, 1}));
+  index.CandidateBlocks({}, 1u << kLogLevelWarn, &blocks);
+  EXPECT_EQ(blocks, (std::vector<uint32_t>{0}));
+}
+
+}  // namespace
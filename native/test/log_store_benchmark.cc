@@ -0,0 +1,64 @@
+#include "log_store.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <string>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Resident set size in bytes, or 0 where it is not measured.
+double ResidentBytes() {
+#if defined(__linux__)
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (file == nullptr) {
+    return 0;
+  }
+  long pages = 0;
+  long resident = 0;
+  if (fscanf(file, "%ld %ld", &pages, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(file);
+  return static_cast<double>(resident) * static_cast<double>(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+// Feeds 10M lines through a default-sized store, as a long session would.
+// RSS is sampled once the store is full and again at the end; the two
+// should match, since evicted arenas are reused rather than reallocated.
+void BM_LogStoreTenMillionLines(benchmark::State& state) {
+  constexpr int kLines = 10'000'000;
+  constexpr int kBatch = 64;
+  std::string batch;
+  for (int i = 0; i < kBatch; i++) {
+    batch +=
+        "+0300 2024-05-01 12:00:00 INFO [3021554837 12ms] outbound/vless[proxy]: "
+        "outbound connection to www.example.com:443\n";
+  }
+  for (auto _ : state) {
+    LogStore store;
+    double full_rss = 0;
+    size_t full_lines = LogStore::kDefaultArenaSize * LogStore::kDefaultMaxArenas / (batch.size() / kBatch);
+    for (int lines = 0; lines < kLines; lines += kBatch) {
+      store.Append(batch.data(), batch.size());
+      if (full_rss == 0 && static_cast<size_t>(lines) >= 2 * full_lines) {
+        full_rss = ResidentBytes();
+      }
+    }
+    double end_rss = ResidentBytes();
+    state.counters["rss_full_MB"] = full_rss / (1 << 20);
+    state.counters["rss_end_MB"] = end_rss / (1 << 20);
+    state.counters["evicted"] = static_cast<double>(store.evicted_lines());
+  }
+  state.SetItemsProcessed(state.iterations() * kLines);
+}
+BENCHMARK(BM_LogStoreTenMillionLines)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+}  // namespace
@@ -0,0 +1,134 @@
+#include "log_store.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+
+namespace {
+
+constexpr size_t kArenaSize = 4096;
+constexpr size_t kLineSize = 64;
+constexpr size_t kLinesPerArena = kArenaSize / kLineSize;
+
+// Line |id|, kLineSize bytes with the newline, so arenas fill evenly.
+std::string Line(uint64_t id) {
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "line %06llu ", static_cast<unsigned long long>(id));
+  std::string line(prefix);
+  line.resize(kLineSize - 1, '.');
+  return line + "\n";
+}
+
+std::string Lines(uint64_t first, uint64_t end) {
+  std::string lines;
+  for (uint64_t id = first; id < end; id++) {
+    lines += Line(id);
+  }
+  return lines;
+}
+
+std::string Text(const LogStore::Page& page) {
+  return std::string(page.data.begin(), page.data.end());
+}
+
+TEST(LogStoreTest, HoldsBackAPartialLine) {
+  LogStore store(kArenaSize, 2);
+  std::string line = Line(0);
+  store.Append(line.data(), 10);
+  EXPECT_EQ(store.next_line(), 0u);
+  store.Append(line.data() + 10, line.size() - 10);
+  EXPECT_EQ(store.next_line(), 1u);
+  EXPECT_EQ(Text(store.ReadPage(0, 10)), line);
+}
+
+TEST(LogStoreTest, EvictsTheOldestArenaExactlyWhenFull) {
+  LogStore store(kArenaSize, 2);
+  std::string lines = Lines(0, 2 * kLinesPerArena);
+  store.Append(lines.data(), lines.size());
+  // Both arenas are exactly full; nothing is gone yet.
+  EXPECT_EQ(store.first_line(), 0u);
+  EXPECT_EQ(store.evicted_lines(), 0u);
+  EXPECT_EQ(store.level_counts()[kLogLevelUnknown], 2 * kLinesPerArena);
+
+  std::string next = Line(2 * kLinesPerArena);
+  store.Append(next.data(), next.size());
+  EXPECT_EQ(store.first_line(), kLinesPerArena);
+  EXPECT_EQ(store.evicted_lines(), kLinesPerArena);
+  EXPECT_EQ(store.level_counts()[kLogLevelUnknown], kLinesPerArena + 1);
+
+  // A read from an evicted id starts at the oldest retained line.
+  LogStore::Page page = store.ReadPage(0, 3);
+  EXPECT_EQ(page.first, kLinesPerArena);
+  EXPECT_EQ(page.next, kLinesPerArena + 3);
+  EXPECT_EQ(Text(page), Lines(kLinesPerArena, kLinesPerArena + 3));
+}
+
+TEST(LogStoreTest, ReadsAPageAcrossArenas) {
+  LogStore store(kArenaSize, 4);
+  std::string lines = Lines(0, 3 * kLinesPerArena);
+  store.Append(lines.data(), lines.size());
+
+  // From the last two lines of the first arena through the whole second one
+  // into the third.
+  uint64_t first = kLinesPerArena - 2;
+  LogStore::Page page = store.ReadPage(static_cast<int64_t>(first), kLinesPerArena + 4);
+  EXPECT_EQ(page.first, first);
+  EXPECT_EQ(page.next, first + kLinesPerArena + 4);
+  EXPECT_EQ(Text(page), Lines(first, first + kLinesPerArena + 4));
+
+  size_t chunks = 0;
+  store.Read(first, kLinesPerArena + 4, [&chunks](const char*, size_t) { chunks++; });
+  EXPECT_EQ(chunks, 3u);
+
+  // The latest page spans the boundary between the last two arenas.
+  page = store.ReadPage(-static_cast<int64_t>(kLinesPerArena + 1), kLinesPerArena + 1);
+  EXPECT_EQ(page.first, 2 * kLinesPerArena - 1);
+  EXPECT_EQ(page.next, 3 * kLinesPerArena);
+  EXPECT_EQ(Text(page), Lines(2 * kLinesPerArena - 1, 3 * kLinesPerArena));
+
+  // Past the end there is nothing, and the page says where to resume.
+  page = store.ReadPage(static_cast<int64_t>(3 * kLinesPerArena), 10);
+  EXPECT_TRUE(page.data.empty());
+  EXPECT_EQ(page.first, 3 * kLinesPerArena);
+  EXPECT_EQ(page.next, 3 * kLinesPerArena);
+}
+
+TEST(LogStoreTest, KeepsTheHeadOfAnOverlongLine) {
+  LogStore store(kArenaSize, 2);
+  std::string line(kArenaSize * 2, 'x');
+  store.AppendLine(line);
+  LogStore::Page page = store.ReadPage(0, 1);
+  ASSERT_EQ(page.data.size(), kArenaSize);
+  EXPECT_EQ(page.data.back(), '\n');
+  EXPECT_EQ(page.data.front(), 'x');
+}
+
+TEST(LogStoreTest, ClearDropsEverythingButKeepsIdsIncreasing) {
+  LogStore store(kArenaSize, 2);
+  std::string lines = Lines(0, kLinesPerArena + 5);
+  store.Append(lines.data(), lines.size());
+  store.Append("partial", 7);
+  store.Clear();
+
+  EXPECT_EQ(store.first_line(), store.next_line());
+  EXPECT_TRUE(store.ReadPage(0, 100).data.empty());
+  EXPECT_TRUE(store.ReadPage(-100, 100).data.empty());
+  for (size_t level = 0; level < kLogLevelCount; level++) {
+    EXPECT_EQ(store.level_counts()[level], 0u);
+  }
+  size_t found = 0;
+  store.Search("line", ~0u, 100, [&found](uint64_t, const char*, size_t) { found++; });
+  EXPECT_EQ(found, 0u);
+
+  // The partial line went with the rest, and new lines get fresh ids so a
+  // reader paging by id never sees an old id reused.
+  uint64_t next = store.next_line();
+  EXPECT_EQ(next, kLinesPerArena + 5);
+  store.AppendLine("after");
+  LogStore::Page page = store.ReadPage(-1, 1);
+  EXPECT_EQ(page.first, next);
+  EXPECT_EQ(Text(page), "after\n");
+}
+
+}  // namespace
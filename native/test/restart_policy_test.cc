@@ -0,0 +1,95 @@
+#include "restart_policy.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+class RestartPolicyTest : public ::testing::Test {
+ protected:
+  RestartPolicy policy_;
+  RestartPolicy::Clock::time_point now_ = RestartPolicy::Clock::now();
+};
+
+TEST_F(RestartPolicyTest, BacksOffExponentiallyWithJitter) {
+  int64_t step = RestartPolicy::kInitialDelay.count();
+  for (uint32_t crash = 1; crash < RestartPolicy::kCrashLimit; crash++) {
+    SCOPED_TRACE(crash);
+    RestartEvent event;
+    ASSERT_TRUE(policy_.OnCrash(now_, &event));
+    EXPECT_EQ(event.kind, RestartEvent::Kind::kScheduled);
+    EXPECT_EQ(event.crashes, crash);
+    EXPECT_EQ(event.attempt, crash);
+    EXPECT_GE(event.delay_ms, step / 2);
+    EXPECT_LE(event.delay_ms, step);
+    now_ += milliseconds(event.delay_ms) + seconds(1);
+    step *= 2;
+  }
+}
+
+TEST_F(RestartPolicyTest, GivesUpOnACrashLoop) {
+  RestartEvent event;
+  for (uint32_t crash = 1; crash < RestartPolicy::kCrashLimit; crash++) {
+    ASSERT_TRUE(policy_.OnCrash(now_, &event));
+    now_ += seconds(1);
+  }
+  event.exit_status = "exited with code 2";
+  EXPECT_FALSE(policy_.OnCrash(now_, &event));
+  EXPECT_EQ(event.kind, RestartEvent::Kind::kGaveUp);
+  EXPECT_EQ(event.crashes, RestartPolicy::kCrashLimit);
+  EXPECT_EQ(DescribeRestartEvent(event),
+            "❌ sing-box crashed 5 times within 120 s, last exited with code 2. Not restarting it; the log above "
+            "shows why it fails.\n");
+
+  // A loop ends the outage; the next crash starts over.
+  ASSERT_TRUE(policy_.OnCrash(now_ + seconds(1), &event));
+  EXPECT_EQ(event.crashes, 1u);
+  EXPECT_EQ(event.attempt, 1u);
+}
+
+TEST_F(RestartPolicyTest, ForgetsCrashesOutsideTheWindow) {
+  RestartEvent event;
+  for (uint32_t crash = 1; crash < RestartPolicy::kCrashLimit; crash++) {
+    ASSERT_TRUE(policy_.OnCrash(now_, &event));
+    ASSERT_TRUE(policy_.OnReady(now_ + seconds(1), &event));
+    now_ += RestartPolicy::kCrashWindow / RestartPolicy::kCrashLimit;
+  }
+  // The first crash is exactly one window old by now.
+  now_ += RestartPolicy::kCrashWindow / RestartPolicy::kCrashLimit;
+  ASSERT_TRUE(policy_.OnCrash(now_, &event));
+  EXPECT_EQ(event.crashes, RestartPolicy::kCrashLimit - 1);
+}
+
+TEST_F(RestartPolicyTest, MeasuresRecoveryFromTheFirstCrash) {
+  RestartEvent event;
+  EXPECT_FALSE(policy_.OnReady(now_, &event));
+  EXPECT_EQ(policy_.stats().last_recovery_ms, -1);
+
+  // Two crashes before the restarted process came up are one outage.
+  ASSERT_TRUE(policy_.OnCrash(now_, &event));
+  ASSERT_TRUE(policy_.OnCrash(now_ + milliseconds(700), &event));
+  EXPECT_EQ(event.attempt, 2u);
+  ASSERT_TRUE(policy_.OnReady(now_ + milliseconds(1900), &event));
+  EXPECT_EQ(event.kind, RestartEvent::Kind::kRecovered);
+  EXPECT_EQ(event.recovery_ms, 1900);
+  EXPECT_EQ(event.attempt, 2u);
+  EXPECT_EQ(DescribeRestartEvent(event), "✅ sing-box recovered in 1.9 s after 2 restarts.\n");
+  EXPECT_FALSE(policy_.OnReady(now_ + milliseconds(2000), &event));
+
+  now_ += seconds(10);
+  ASSERT_TRUE(policy_.OnCrash(now_, &event));
+  ASSERT_TRUE(policy_.OnReady(now_ + milliseconds(600), &event));
+  EXPECT_EQ(event.attempt, 1u);
+  EXPECT_EQ(event.stats.restarts, 3u);
+  EXPECT_EQ(event.stats.recoveries, 2u);
+  EXPECT_EQ(event.stats.last_recovery_ms, 600);
+  EXPECT_EQ(event.stats.max_recovery_ms, 1900);
+  EXPECT_EQ(event.stats.total_recovery_ms, 2500);
+  EXPECT_EQ(DescribeRestartEvent(event), "✅ sing-box recovered in 0.6 s after 1 restart (mean 1.2 s, slowest 1.9 s).\n");
+}
+
+}  // namespace
@@ -0,0 +1,411 @@
+#include "rule_set.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Reads back what CompileDomainRuleSet writes and matches domains the way
+// sing-box does with a loaded rule-set.
+class RuleSetReader {
+ public:
+  bool Load(const std::string& srs) {
+    if (srs.size() < 4 || srs.compare(0, 3, "SRS") != 0 || srs[3] != 1) {
+      return false;
+    }
+    if (!Inflate(std::string_view(srs).substr(4), &payload_)) {
+      return false;
+    }
+    offset_ = 0;
+    uint64_t rule_count;
+    if (!ReadUvarint(&rule_count)) {
+      return false;
+    }
+    for (uint64_t i = 0; i < rule_count; i++) {
+      if (!ReadByte(0)) {
+        return false;
+      }
+      uint8_t item;
+      while (ReadItem(&item)) {
+        if (item == 0xff) {
+          break;
+        }
+        if (item == 2) {
+          if (!ReadByte(0) || !ReadWords(&leaves_) || !ReadWords(&label_bitmap_) || !ReadBytes(&labels_)) {
+            return false;
+          }
+          has_domains_ = true;
+        } else if (item == 3) {
+          uint64_t count;
+          if (!ReadUvarint(&count)) {
+            return false;
+          }
+          for (uint64_t k = 0; k < count; k++) {
+            std::string keyword;
+            if (!ReadBytes(&keyword)) {
+              return false;
+            }
+            keywords_.push_back(keyword);
+          }
+        } else {
+          return false;
+        }
+      }
+      // invert
+      if (item != 0xff || !ReadByte(0)) {
+        return false;
+      }
+    }
+    return offset_ == payload_.size();
+  }
+
+  bool Match(const std::string& domain) const {
+    for (const std::string& keyword : keywords_) {
+      if (domain.find(keyword) != std::string::npos) {
+        return true;
+      }
+    }
+    return has_domains_ && Has(Reverse(domain));
+  }
+
+  const std::vector<std::string>& keywords() const { return keywords_; }
+
+ private:
+  static constexpr char kPrefixLabel = '\r';
+
+  // By code point, as sing-box's reverseDomain does.
+  static std::string Reverse(const std::string& domain) {
+    std::string reversed;
+    for (size_t end = domain.size(); end > 0;) {
+      size_t begin = end - 1;
+      while (begin > 0 && (static_cast<uint8_t>(domain[begin]) & 0xc0) == 0x80) {
+        begin--;
+      }
+      reversed.append(domain, begin, end - begin);
+      end = begin;
+    }
+    return reversed;
+  }
+
+  // Only the stored blocks CompileDomainRuleSet writes, checksum included.
+  static bool Inflate(std::string_view zlib, std::string* out) {
+    if (zlib.size() < 6 || static_cast<uint8_t>(zlib[0]) != 0x78 ||
+        ((static_cast<uint8_t>(zlib[0]) << 8) | static_cast<uint8_t>(zlib[1])) % 31 != 0) {
+      return false;
+    }
+    size_t at = 2;
+    out->clear();
+    for (bool final = false; !final;) {
+      if (at + 5 > zlib.size() || (zlib[at] & 0x06) != 0) {
+        return false;
+      }
+      final = (zlib[at] & 1) != 0;
+      size_t size = static_cast<uint8_t>(zlib[at + 1]) | static_cast<uint8_t>(zlib[at + 2]) << 8;
+      size_t inverse = static_cast<uint8_t>(zlib[at + 3]) | static_cast<uint8_t>(zlib[at + 4]) << 8;
+      if ((size ^ inverse) != 0xffff || at + 5 + size > zlib.size()) {
+        return false;
+      }
+      out->append(zlib.substr(at + 5, size));
+      at += 5 + size;
+    }
+    if (at + 4 != zlib.size()) {
+      return false;
+    }
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (char c : *out) {
+      a = (a + static_cast<uint8_t>(c)) % 65521;
+      b = (b + a) % 65521;
+    }
+    uint32_t stored = 0;
+    for (size_t i = 0; i < 4; i++) {
+      stored = stored << 8 | static_cast<uint8_t>(zlib[at + i]);
+    }
+    return stored == (b << 16 | a);
+  }
+
+  bool ReadByte(uint8_t expected) {
+    uint8_t value;
+    return ReadItem(&value) && value == expected;
+  }
+  bool ReadItem(uint8_t* value) {
+    if (offset_ >= payload_.size()) {
+      return false;
+    }
+    *value = static_cast<uint8_t>(payload_[offset_++]);
+    return true;
+  }
+  bool ReadUvarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && offset_ < payload_.size(); shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(payload_[offset_++]);
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) {
+        return true;
+      }
+    }
+    return false;
+  }
+  bool ReadWords(std::vector<uint64_t>* words) {
+    uint64_t count;
+    if (!ReadUvarint(&count) || count > (payload_.size() - offset_) / 8) {
+      return false;
+    }
+    words->clear();
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t word = 0;
+      for (int k = 0; k < 8; k++) {
+        word = word << 8 | static_cast<uint8_t>(payload_[offset_++]);
+      }
+      words->push_back(word);
+    }
+    return true;
+  }
+  bool ReadBytes(std::string* bytes) {
+    uint64_t size;
+    if (!ReadUvarint(&size) || size > payload_.size() - offset_) {
+      return false;
+    }
+    bytes->assign(payload_, offset_, static_cast<size_t>(size));
+    offset_ += static_cast<size_t>(size);
+    return true;
+  }
+
+  static bool Bit(const std::vector<uint64_t>& words, size_t index) {
+    return index / 64 < words.size() && ((words[index / 64] >> (index % 64)) & 1) != 0;
+  }
+  size_t Rank0(size_t end) const {
+    size_t zeros = 0;
+    for (size_t i = 0; i < end; i++) {
+      zeros += Bit(label_bitmap_, i) ? 0 : 1;
+    }
+    return zeros;
+  }
+  size_t Select1(size_t n) const {
+    for (size_t i = 0, ones = 0; i < label_bitmap_.size() * 64; i++) {
+      if (Bit(label_bitmap_, i) && ++ones == n) {
+        return i;
+      }
+    }
+    return label_bitmap_.size() * 64;
+  }
+
+  // The succinct set's lookup: a prefix label under the current node
+  // matches whatever follows.
+  bool Has(const std::string& key) const {
+    size_t node = 0;
+    size_t index = 0;
+    for (char c : key) {
+      for (;; index++) {
+        if (Bit(label_bitmap_, index) || index - node >= labels_.size()) {
+          return false;
+        }
+        char label = labels_[index - node];
+        if (label == kPrefixLabel) {
+          return true;
+        }
+        if (label == c) {
+          break;
+        }
+      }
+      node = Rank0(index + 1);
+      index = Select1(node) + 1;
+    }
+    if (Bit(leaves_, node)) {
+      return true;
+    }
+    for (; !Bit(label_bitmap_, index) && index - node < labels_.size(); index++) {
+      if (labels_[index - node] == kPrefixLabel) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::string payload_;
+  size_t offset_ = 0;
+  bool has_domains_ = false;
+  std::vector<uint64_t> leaves_;
+  std::vector<uint64_t> label_bitmap_;
+  std::string labels_;
+  std::vector<std::string> keywords_;
+};
+
+// What the inline domain_keyword and domain_suffix rules of ConfigGenerator
+// match: a suffix with a leading dot only matches names below it.
+bool MatchInline(const std::vector<std::string>& keywords, const std::vector<std::string>& suffixes,
+                 const std::string& domain) {
+  auto ends_with = [&domain](const std::string& suffix) {
+    return domain.size() >= suffix.size() && domain.compare(domain.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  for (const std::string& keyword : keywords) {
+    if (domain.find(keyword) != std::string::npos) {
+      return true;
+    }
+  }
+  for (const std::string& suffix : suffixes) {
+    if (suffix.empty()) {
+      continue;
+    }
+    if (suffix[0] == '.' ? ends_with(suffix) : domain == suffix || ends_with("." + suffix)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ExpectSameMatches(const std::vector<std::string>& keywords, const std::vector<std::string>& suffixes,
+                       const std::vector<std::string>& domains) {
+  std::string srs;
+  ASSERT_TRUE(CompileDomainRuleSet(keywords, suffixes, &srs));
+  RuleSetReader reader;
+  ASSERT_TRUE(reader.Load(srs));
+  EXPECT_EQ(reader.keywords(), keywords);
+  for (const std::string& domain : domains) {
+    EXPECT_EQ(reader.Match(domain), MatchInline(keywords, suffixes, domain)) << domain;
+  }
+}
+
+TEST(RuleSetTest, MatchesInlineRules) {
+  std::vector<std::string> keywords = {"bank", "gosuslugi"};
+  std::vector<std::string> suffixes = {"vk.com", ".ru", "example.org", ".a.example.org", "co.uk",
+                                       "\xd1\x80\xd1\x84", "xn--p1ai", "m"};
+  ExpectSameMatches(keywords, suffixes,
+                    {"vk.com", "m.vk.com", "a.b.vk.com", "xvk.com", "vk.com.evil", "ru", "mail.ru", "xru",
+                     "example.org", "a.example.org", "b.a.example.org", "xa.example.org", "example.org.uk",
+                     "bbc.co.uk", "co.uk", "uk", "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xbc\xd0\xb5\xd1\x80.\xd1\x80\xd1\x84",
+                     "\xd1\x80\xd1\x84", "xn--p1ai", "test.xn--p1ai", "m", "x.m", "mm", "mybank.com",
+                     "gosuslugi.example", "", "."});
+}
+
+TEST(RuleSetTest, MatchesInlineRulesOnGeneratedLists) {
+  std::mt19937 random(20260417);
+  const char* labels[] = {"a", "b", "ab", "ba", "com", "ru", "net", "co", "uk", "x"};
+  auto make_domain = [&](int max_labels) {
+    std::string domain;
+    int count = 1 + static_cast<int>(random() % static_cast<unsigned>(max_labels));
+    for (int i = 0; i < count; i++) {
+      if (i > 0) {
+        domain += '.';
+      }
+      domain += labels[random() % (sizeof(labels) / sizeof(labels[0]))];
+    }
+    return domain;
+  };
+  for (int round = 0; round < 20; round++) {
+    std::vector<std::string> keywords;
+    std::vector<std::string> suffixes;
+    for (int i = 0; i < 40; i++) {
+      std::string suffix = make_domain(3);
+      suffixes.push_back(random() % 3 == 0 ? "." + suffix : suffix);
+    }
+    if (round % 2 == 0) {
+      keywords.push_back(labels[random() % 4] + std::string("x"));
+    }
+    std::vector<std::string> domains;
+    for (int i = 0; i < 400; i++) {
+      domains.push_back(make_domain(5));
+    }
+    SCOPED_TRACE(round);
+    ExpectSameMatches(keywords, suffixes, domains);
+  }
+}
+
+TEST(RuleSetTest, SpansSeveralStoredBlocks) {
+  std::vector<std::string> suffixes;
+  for (int i = 0; i < 20000; i++) {
+    suffixes.push_back("domain" + std::to_string(i) + ".example.com");
+  }
+  std::string srs;
+  ASSERT_TRUE(CompileDomainRuleSet({}, suffixes, &srs));
+  ASSERT_GT(srs.size(), 0x20000u);
+  RuleSetReader reader;
+  ASSERT_TRUE(reader.Load(srs));
+  EXPECT_TRUE(reader.Match("domain19999.example.com"));
+  EXPECT_TRUE(reader.Match("www.domain0.example.com"));
+  EXPECT_FALSE(reader.Match("domain20000.example.com"));
+  EXPECT_FALSE(reader.Match("example.com"));
+}
+
+TEST(RuleSetTest, NeedsSomethingToCompile) {
+  std::string srs;
+  EXPECT_FALSE(CompileDomainRuleSet({}, {}, &srs));
+  EXPECT_FALSE(CompileDomainRuleSet({}, {""}, &srs));
+  EXPECT_TRUE(CompileDomainRuleSet({"bank"}, {}, &srs));
+}
+
+class EnsureDomainRuleSetTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() / "hwl-rule-set-test";
+    std::filesystem::remove_all(directory_);
+  }
+  void TearDown() override { std::filesystem::remove_all(directory_); }
+
+  std::vector<std::string> Files() const {
+    std::vector<std::string> names;
+    for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+      names.push_back(entry.path().filename().u8string());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  std::filesystem::path directory_;
+};
+
+TEST_F(EnsureDomainRuleSetTest, KeysFilesByTheLists) {
+  std::filesystem::path first;
+  std::filesystem::path again;
+  std::filesystem::path swapped;
+  std::string error;
+  ASSERT_TRUE(EnsureDomainRuleSet(directory_, {"bank"}, {"vk.com"}, &first, &error)) << error;
+  ASSERT_TRUE(EnsureDomainRuleSet(directory_, {"bank"}, {"vk.com"}, &again, &error)) << error;
+  EXPECT_EQ(first, again);
+  // The same strings in the other list are a different rule-set.
+  ASSERT_TRUE(EnsureDomainRuleSet(directory_, {"bank", "vk.com"}, {}, &swapped, &error)) << error;
+  EXPECT_NE(first, swapped);
+
+  std::ifstream in(swapped, std::ios::binary);
+  std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::string compiled;
+  ASSERT_TRUE(CompileDomainRuleSet({"bank", "vk.com"}, {}, &compiled));
+  EXPECT_EQ(written, compiled);
+}
+
+TEST_F(EnsureDomainRuleSetTest, RemovesEarlierRuleSetsOnly) {
+  std::filesystem::create_directories(directory_);
+  std::ofstream(directory_ / "notes.txt") << "kept";
+  std::filesystem::path first;
+  std::filesystem::path second;
+  std::string error;
+  ASSERT_TRUE(EnsureDomainRuleSet(directory_, {}, {"vk.com"}, &first, &error)) << error;
+  ASSERT_TRUE(EnsureDomainRuleSet(directory_, {}, {"vk.com", "ok.ru"}, &second, &error)) << error;
+  EXPECT_EQ(Files(), (std::vector<std::string>{second.filename().u8string(), "notes.txt"}));
+
+  // A file that is already there is trusted and not compiled again.
+  std::ofstream(second, std::ios::trunc) << "stale";
+  ASSERT_TRUE(EnsureDomainRuleSet(directory_, {}, {"vk.com", "ok.ru"}, &second, &error)) << error;
+  std::ifstream in(second);
+  std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  EXPECT_EQ(text, "stale");
+}
+
+TEST_F(EnsureDomainRuleSetTest, FailsWithNothingToCompile) {
+  std::filesystem::path path;
+  std::string error;
+  EXPECT_FALSE(EnsureDomainRuleSet(directory_, {}, {}, &path, &error));
+  EXPECT_FALSE(error.empty());
+}
+
+}  // namespace
@@ -0,0 +1,184 @@
+#include "traffic_stats.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "clash_api.h"
+
+namespace {
+
+// What sing-box's API sends on the two connections a sampler keeps: a
+// /traffic response that streams a chunked document per second, and
+// /connections snapshots with a Content-Length.
+std::string TrafficHead() {
+  return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n";
+}
+
+std::string TrafficChunk(uint64_t up, uint64_t down) {
+  std::string line = "{\"up\":" + std::to_string(up) + ",\"down\":" + std::to_string(down) + "}\n";
+  char size[16];
+  snprintf(size, sizeof(size), "%zx", line.size());
+  return size + std::string("\r\n") + line + "\r\n";
+}
+
+std::string ConnectionsResponse(int count) {
+  std::string body = "{\"downloadTotal\":0,\"uploadTotal\":0,\"connections\":";
+  if (count == 0) {
+    body += "null";
+  } else {
+    body += "[";
+    for (int i = 0; i < count; i++) {
+      body += i == 0 ? "" : ",";
+      body += "{\"id\":\"" + std::to_string(i) + "\",\"upload\":1,\"download\":2,\"chains\":[\"direct\"]}";
+    }
+    body += "]";
+  }
+  body += "}\n";
+  return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+         "\r\n\r\n" + body;
+}
+
+// A sampler's recorder fed by two API streams, |split| bytes at a time.
+class TrafficStatsTest : public ::testing::Test {
+ protected:
+  void FeedTraffic(const std::string& data, size_t split = 1 << 20) {
+    for (size_t i = 0; i < data.size(); i += split) {
+      ASSERT_TRUE(traffic_.Feed(std::string_view(data).substr(i, split), [this](std::string_view document) {
+        TrafficDelta delta;
+        ASSERT_TRUE(recorder_.OnTrafficDocument(document, &delta));
+        deltas_.push_back(delta);
+      })) << traffic_.error();
+    }
+  }
+
+  void FeedConnections(const std::string& data, size_t split = 1 << 20) {
+    for (size_t i = 0; i < data.size(); i += split) {
+      ASSERT_TRUE(connections_.Feed(std::string_view(data).substr(i, split), [this](std::string_view document) {
+        EXPECT_TRUE(recorder_.OnConnectionsDocument(document));
+      })) << connections_.error();
+    }
+  }
+
+  TrafficRecorder recorder_;
+  ClashApiStream traffic_;
+  ClashApiStream connections_;
+  std::vector<TrafficDelta> deltas_;
+};
+
+TEST_F(TrafficStatsTest, RecordsASamplePerTrafficDocument) {
+  FeedTraffic(TrafficHead());
+  FeedTraffic(TrafficChunk(100, 2000));
+  FeedConnections(ConnectionsResponse(3));
+  FeedTraffic(TrafficChunk(150, 1000));
+  EXPECT_TRUE(connections_.idle());
+  FeedConnections(ConnectionsResponse(0));
+  FeedTraffic(TrafficChunk(0, 0));
+
+  std::vector<TrafficSample> samples = recorder_.history().Snapshot();
+  ASSERT_EQ(samples.size(), 3u);
+  EXPECT_EQ(recorder_.history().sequence(), 3u);
+  EXPECT_EQ(samples[0].up, 100u);
+  EXPECT_EQ(samples[0].down, 2000u);
+  // The count comes from the latest snapshot when the second closes.
+  EXPECT_EQ(samples[0].connections, 0u);
+  EXPECT_EQ(samples[1].up, 150u);
+  EXPECT_EQ(samples[1].connections, 3u);
+  EXPECT_EQ(samples[2].connections, 0u);
+
+  ASSERT_EQ(deltas_.size(), 3u);
+  EXPECT_TRUE(deltas_[0].key);
+  EXPECT_EQ(deltas_[0].down, 2000);
+  EXPECT_FALSE(deltas_[1].key);
+  EXPECT_EQ(deltas_[1].up, 50);
+  EXPECT_EQ(deltas_[1].down, -1000);
+  EXPECT_EQ(deltas_[1].connections, 3);
+  EXPECT_EQ(deltas_[2].connections, -3);
+  EXPECT_EQ(deltas_[2].sequence, 3u);
+}
+
+TEST_F(TrafficStatsTest, ReadsResponsesSplitAnywhere) {
+  std::string traffic = TrafficHead();
+  for (uint64_t i = 1; i <= 20; i++) {
+    traffic += TrafficChunk(i, i * 1000);
+  }
+  std::string connections;
+  for (int i = 0; i < 5; i++) {
+    connections += ConnectionsResponse(i);
+  }
+  for (size_t split : {1, 2, 3, 7, 64}) {
+    SCOPED_TRACE(split);
+    recorder_.Reset();
+    traffic_ = ClashApiStream();
+    connections_ = ClashApiStream();
+    deltas_.clear();
+    FeedConnections(connections, split);
+    FeedTraffic(traffic, split);
+    std::vector<TrafficSample> samples = recorder_.history().Snapshot();
+    ASSERT_EQ(samples.size(), 20u);
+    for (uint64_t i = 0; i < 20; i++) {
+      EXPECT_EQ(samples[i].up, i + 1);
+      EXPECT_EQ(samples[i].down, (i + 1) * 1000);
+      EXPECT_EQ(samples[i].connections, 4u);
+    }
+  }
+}
+
+TEST_F(TrafficStatsTest, RefusesAnUnauthorizedResponse) {
+  std::string response = "HTTP/1.1 401 Unauthorized\r\nContent-Length: 27\r\n\r\n{\"message\":\"Unauthorized\"}\n";
+  EXPECT_FALSE(traffic_.Feed(response, [](std::string_view) { ADD_FAILURE(); }));
+  EXPECT_EQ(traffic_.error(), "The API answered 401 Unauthorized.");
+  // The connection stays unusable.
+  EXPECT_FALSE(traffic_.Feed(TrafficHead() + TrafficChunk(1, 1), [](std::string_view) { ADD_FAILURE(); }));
+}
+
+TEST_F(TrafficStatsTest, IgnoresDocumentsOfTheWrongKind) {
+  TrafficDelta delta;
+  EXPECT_FALSE(recorder_.OnTrafficDocument("{\"connections\":[]}", &delta));
+  EXPECT_FALSE(recorder_.OnConnectionsDocument("{\"up\":1,\"down\":2}"));
+  EXPECT_EQ(recorder_.history().size(), 0u);
+}
+
+TEST_F(TrafficStatsTest, ResetStartsANewHistoryWithAKeyFrame) {
+  FeedTraffic(TrafficHead() + TrafficChunk(1, 2) + TrafficChunk(3, 4));
+  FeedConnections(ConnectionsResponse(2));
+  recorder_.Reset();
+  EXPECT_EQ(recorder_.history().size(), 0u);
+  EXPECT_EQ(recorder_.history().sequence(), 0u);
+
+  TrafficDelta delta;
+  ASSERT_TRUE(recorder_.OnTrafficDocument("{\"up\":5,\"down\":6}", &delta));
+  EXPECT_TRUE(delta.key);
+  EXPECT_EQ(delta.sequence, 1u);
+  EXPECT_EQ(delta.up, 5);
+  EXPECT_EQ(delta.connections, 0);
+}
+
+TEST(TrafficHistoryTest, KeepsTheNewestSamples) {
+  TrafficHistory history;
+  const uint64_t total = TrafficHistory::kCapacity + 25;
+  for (uint64_t i = 0; i < total; i++) {
+    history.Push({i, 0, 0});
+  }
+  EXPECT_EQ(history.size(), TrafficHistory::kCapacity);
+  EXPECT_EQ(history.sequence(), total);
+  std::vector<TrafficSample> samples = history.Snapshot();
+  ASSERT_EQ(samples.size(), TrafficHistory::kCapacity);
+  EXPECT_EQ(samples.front().up, 25u);
+  EXPECT_EQ(samples.back().up, total - 1);
+}
+
+TEST(TrafficDeltaEncoderTest, SendsAKeyFrameEveryInterval) {
+  TrafficDeltaEncoder encoder;
+  TrafficSample sample{10, 20, 1};
+  for (uint64_t sequence = 1; sequence <= 2 * TrafficDeltaEncoder::kKeyInterval; sequence++) {
+    TrafficDelta delta = encoder.Encode(sequence, sample);
+    bool key = sequence == 1 || sequence % TrafficDeltaEncoder::kKeyInterval == 0;
+    EXPECT_EQ(delta.key, key) << sequence;
+    EXPECT_EQ(delta.up, key ? 10 : 0) << sequence;
+  }
+}
+
+}  // namespace
@@ -0,0 +1,62 @@
+#include "traffic_stats.h"
+
+#include "clash_api.h"
+
+void TrafficHistory::Push(const TrafficSample& sample) {
+  samples_[next_] = sample;
+  next_ = (next_ + 1) % kCapacity;
+  if (size_ < kCapacity) {
+    size_++;
+  }
+  sequence_++;
+}
+
+void TrafficHistory::Clear() {
+  next_ = 0;
+  size_ = 0;
+  sequence_ = 0;
+}
+
+std::vector<TrafficSample> TrafficHistory::Snapshot() const {
+  std::vector<TrafficSample> samples;
+  samples.reserve(size_);
+  size_t first = (next_ + kCapacity - size_) % kCapacity;
+  for (size_t i = 0; i < size_; i++) {
+    samples.push_back(samples_[(first + i) % kCapacity]);
+  }
+  return samples;
+}
+
+TrafficDelta TrafficDeltaEncoder::Encode(uint64_t sequence, const TrafficSample& sample) {
+  TrafficDelta delta;
+  delta.sequence = sequence;
+  delta.key = !has_previous_ || sequence % kKeyInterval == 0;
+  TrafficSample base = delta.key ? TrafficSample() : previous_;
+  delta.up = static_cast<int64_t>(sample.up - base.up);
+  delta.down = static_cast<int64_t>(sample.down - base.down);
+  delta.connections = static_cast<int64_t>(sample.connections) - static_cast<int64_t>(base.connections);
+  previous_ = sample;
+  has_previous_ = true;
+  return delta;
+}
+
+bool TrafficRecorder::OnTrafficDocument(std::string_view document, TrafficDelta* delta) {
+  TrafficSample sample;
+  if (!ParseTrafficDocument(document, &sample.up, &sample.down)) {
+    return false;
+  }
+  sample.connections = connections_;
+  history_.Push(sample);
+  *delta = encoder_.Encode(history_.sequence(), sample);
+  return true;
+}
+
+bool TrafficRecorder::OnConnectionsDocument(std::string_view document) {
+  return CountConnections(document, &connections_);
+}
+
+void TrafficRecorder::Reset() {
+  history_.Clear();
+  encoder_.Reset();
+  connections_ = 0;
+}
@@ -0,0 +1,91 @@
+#ifndef NATIVE_TRAFFIC_STATS_H_
+#define NATIVE_TRAFFIC_STATS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Per-second tunnel statistics read from sing-box's Clash API, shared by
+// the runners' traffic samplers. The runners own the two API connections;
+// TrafficRecorder turns their documents into samples.
+
+// One second of tunnel traffic.
+struct TrafficSample {
+  // Bytes sent and received during the second.
+  uint64_t up = 0;
+  uint64_t down = 0;
+  // Connections open when the second ended.
+  uint32_t connections = 0;
+};
+
+// The last kCapacity samples, in a fixed array that never reallocates.
+class TrafficHistory {
+ public:
+  // Ten minutes.
+  static constexpr size_t kCapacity = 600;
+
+  void Push(const TrafficSample& sample);
+  void Clear();
+
+  size_t size() const { return size_; }
+  // Sequence number of the newest sample, counting from 1; 0 when empty.
+  uint64_t sequence() const { return sequence_; }
+  // Oldest first.
+  std::vector<TrafficSample> Snapshot() const;
+
+ private:
+  std::array<TrafficSample, kCapacity> samples_ = {};
+  // Slot the next sample goes to.
+  size_t next_ = 0;
+  size_t size_ = 0;
+  uint64_t sequence_ = 0;
+};
+
+// A sample as sent to Dart: differences from the previous sample, or
+// absolute values when |key| is set.
+struct TrafficDelta {
+  uint64_t sequence = 0;
+  bool key = false;
+  int64_t up = 0;
+  int64_t down = 0;
+  int64_t connections = 0;
+};
+
+// Delta-encodes consecutive samples, with a key frame first and every
+// kKeyInterval samples so a listener that missed one catches up.
+class TrafficDeltaEncoder {
+ public:
+  static constexpr uint64_t kKeyInterval = 30;
+
+  TrafficDelta Encode(uint64_t sequence, const TrafficSample& sample);
+  // Makes the next sample a key frame.
+  void Reset() { has_previous_ = false; }
+
+ private:
+  bool has_previous_ = false;
+  TrafficSample previous_;
+};
+
+// Builds samples from the API: each /traffic document closes a second, and
+// the connection count comes from the latest /connections snapshot.
+class TrafficRecorder {
+ public:
+  // Records the second a /traffic document describes into |delta|.
+  // Returns false for a document that is not one.
+  bool OnTrafficDocument(std::string_view document, TrafficDelta* delta);
+  // Returns false for a document that is not a snapshot.
+  bool OnConnectionsDocument(std::string_view document);
+  // Starts over for a new sing-box process.
+  void Reset();
+
+  const TrafficHistory& history() const { return history_; }
+
+ private:
+  TrafficHistory history_;
+  TrafficDeltaEncoder encoder_;
+  uint32_t connections_ = 0;
+};
+
+#endif  // NATIVE_TRAFFIC_STATS_H_
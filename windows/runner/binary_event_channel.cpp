@@ -0,0 +1,15 @@
+#include "binary_event_channel.h"
+
+namespace {
+    constexpr char kChannelName[] = "com.hwl_vpn.app/events";
+}
+
+BinaryEventChannel::BinaryEventChannel(flutter::BinaryMessenger* messenger) : messenger_(messenger) {}
+
+void BinaryEventChannel::Flush() {
+    if (frames_.empty()) {
+        return;
+    }
+    messenger_->Send(kChannelName, frames_.buffer().data(), frames_.buffer().size());
+    frames_.Clear();
+}
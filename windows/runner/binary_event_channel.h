@@ -0,0 +1,28 @@
+#pragma once
+
+#include <flutter/binary_messenger.h>
+
+#include "event_frame.h"
+
+// Sends high-frequency events to Dart on the raw "com.hwl_vpn.app/events"
+// channel in the framing of event_frame.h, with no codec in between.
+// Platform thread only.
+//
+// Producers append frames to frames(); everything appended since the last
+// Flush() goes out as one message. The engine copies the message while
+// sending it, so the buffer is kept and reused.
+class BinaryEventChannel {
+public:
+    explicit BinaryEventChannel(flutter::BinaryMessenger* messenger);
+
+    BinaryEventChannel(const BinaryEventChannel&) = delete;
+    BinaryEventChannel& operator=(const BinaryEventChannel&) = delete;
+
+    EventFrameWriter* frames() { return &frames_; }
+    // Sends the pending frames, if any.
+    void Flush();
+
+private:
+    flutter::BinaryMessenger* messenger_;
+    EventFrameWriter frames_;
+};
@@ -0,0 +1,244 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "dns_benchmarker.h"
+#include <algorithm>
+#include <climits>
+
+namespace {
+    constexpr size_t kReadBufferSize = 16 * 1024;
+    constexpr size_t kMaxDatagram = 4096;
+
+    // Fills |address| from an IPv4 or IPv6 literal.
+    bool ParseAddress(const std::string& ip, uint16_t port, sockaddr_storage* address, int* length) {
+        auto* v4 = reinterpret_cast<sockaddr_in*>(address);
+        if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port = htons(port);
+            *length = sizeof(sockaddr_in);
+            return true;
+        }
+        auto* v6 = reinterpret_cast<sockaddr_in6*>(address);
+        if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = htons(port);
+            *length = sizeof(sockaddr_in6);
+            return true;
+        }
+        return false;
+    }
+
+    // A non-blocking socket of |type| connected, or connecting, to
+    // |ip|:|port|; INVALID_SOCKET when that fails straight away.
+    SOCKET OpenSocket(const std::string& ip, uint16_t port, int type, int protocol) {
+        sockaddr_storage address = {};
+        int length = 0;
+        if (port == 0 || !ParseAddress(ip, port, &address, &length)) {
+            return INVALID_SOCKET;
+        }
+        SOCKET s = socket(address.ss_family, type, protocol);
+        if (s == INVALID_SOCKET) {
+            return INVALID_SOCKET;
+        }
+        u_long non_blocking = 1;
+        ioctlsocket(s, FIONBIO, &non_blocking);
+        if (connect(s, reinterpret_cast<sockaddr*>(&address), length) != 0 &&
+            WSAGetLastError() != WSAEWOULDBLOCK) {
+            closesocket(s);
+            return INVALID_SOCKET;
+        }
+        return s;
+    }
+}
+
+DnsBenchmarker::DnsBenchmarker() {
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+}
+
+DnsBenchmarker::~DnsBenchmarker() {
+    cancelled_ = true;
+    if (worker_.joinable()) worker_.join();
+    WSACleanup();
+}
+
+void DnsBenchmarker::SetMainWindowHandle(HWND hwnd) {
+    main_window_handle_ = hwnd;
+}
+
+bool DnsBenchmarker::Start(DnsBenchOptions options) {
+    if (running_.exchange(true)) {
+        return false;
+    }
+    // The previous worker has posted its event and is exiting.
+    if (worker_.joinable()) worker_.join();
+    cancelled_ = false;
+    worker_ = std::thread(&DnsBenchmarker::Run, this, std::move(options));
+    return true;
+}
+
+void DnsBenchmarker::Cancel() {
+    cancelled_ = true;
+}
+
+void DnsBenchmarker::Run(DnsBenchOptions options) {
+    auto done = std::make_unique<DnsBenchEvent>();
+    std::vector<DnsBenchRun> runs = PlannedDnsBenchRuns(options);
+    if (runs.empty()) {
+        done->error = "Nothing to test.";
+    }
+    for (const DnsBenchRun& run : runs) {
+        DnsBenchResult result = RunOne(run, options);
+        if (cancelled_) {
+            done->error = "Cancelled.";
+            break;
+        }
+        done->results.push_back(std::move(result));
+    }
+    DnsBenchEvent* raw = done.release();
+    if (!main_window_handle_ || !PostMessage(main_window_handle_, WM_DNS_BENCH_DONE, 0, reinterpret_cast<LPARAM>(raw))) {
+        delete raw;
+    }
+    running_ = false;
+}
+
+DnsBenchResult DnsBenchmarker::RunOne(const DnsBenchRun& run, const DnsBenchOptions& options) {
+    DnsBenchProbe probe(run, options);
+    std::string peer = probe.stream_ip() + ":" + std::to_string(probe.stream_port());
+    if (probe.stream_ip() == options.proxy_ip && probe.stream_port() == options.proxy_port) {
+        peer = "the mixed inbound at " + peer;
+    }
+    // Why the run stopped short, when the probe does not know.
+    std::string run_error;
+
+    SOCKET stream = INVALID_SOCKET;
+    bool connected = false;
+    if (probe.uses_stream()) {
+        stream = OpenSocket(probe.stream_ip(), probe.stream_port(), SOCK_STREAM, IPPROTO_TCP);
+        if (stream == INVALID_SOCKET) {
+            run_error = "Could not reach " + peer + ".";
+        }
+    }
+    SOCKET udp = INVALID_SOCKET;
+    // A datagram the socket had no room for.
+    std::string pending;
+
+    auto deadline = DnsBenchClock::now() + options.timeout;
+    char buffer[kReadBufferSize];
+    std::vector<WSAPOLLFD> poll_fds;
+    bool ended = !run_error.empty();
+    while (!ended && !cancelled_ && !probe.complete() && !probe.failed()) {
+        auto now = DnsBenchClock::now();
+        if (now >= deadline) {
+            // Whatever is still unanswered counts as failed.
+            break;
+        }
+        if (probe.datagram_ready() && udp == INVALID_SOCKET) {
+            // Connected, so only the server's or relay's datagrams arrive
+            // and an unreachable one shows up as WSAECONNRESET.
+            udp = OpenSocket(probe.datagram_ip(), probe.datagram_port(), SOCK_DGRAM, IPPROTO_UDP);
+            if (udp == INVALID_SOCKET) {
+                run_error = "Could not reach " + probe.datagram_ip() + ":" + std::to_string(probe.datagram_port()) + ".";
+                break;
+            }
+        }
+        if (udp != INVALID_SOCKET) {
+            while (!pending.empty() || probe.NextDatagram(now, &pending)) {
+                if (send(udp, pending.data(), static_cast<int>(pending.size()), 0) == SOCKET_ERROR &&
+                    WSAGetLastError() == WSAEWOULDBLOCK) {
+                    break;
+                }
+                pending.clear();
+            }
+        }
+
+        poll_fds.clear();
+        if (stream != INVALID_SOCKET) {
+            short events = connected ? static_cast<short>(POLLRDNORM | (probe.output().empty() ? 0 : POLLWRNORM))
+                                     : static_cast<short>(POLLWRNORM);
+            poll_fds.push_back({stream, events, 0});
+        }
+        if (udp != INVALID_SOCKET) {
+            poll_fds.push_back({udp, static_cast<short>(POLLRDNORM | (pending.empty() ? 0 : POLLWRNORM)), 0});
+        }
+        int wait_ms = static_cast<int>(std::clamp<int64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1, 0, kMaxPollMs));
+        WSAPoll(poll_fds.data(), static_cast<ULONG>(poll_fds.size()), wait_ms);
+
+        now = DnsBenchClock::now();
+        short stream_events = stream != INVALID_SOCKET ? poll_fds.front().revents : 0;
+        if (stream_events != 0) {
+            if (!connected) {
+                if ((stream_events & (POLLERR | POLLHUP)) != 0) {
+                    run_error = "Could not reach " + peer + ".";
+                    break;
+                }
+                connected = true;
+            }
+            if ((stream_events & (POLLRDNORM | POLLHUP | POLLERR)) != 0) {
+                for (int n = 0; n < kMaxIoPerEvent && !ended; n++) {
+                    int received = recv(stream, buffer, static_cast<int>(sizeof(buffer)), 0);
+                    if (received == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+                        break;
+                    }
+                    if (received <= 0) {
+                        probe.OnClosed();
+                        if (received < 0 && probe.error().empty()) {
+                            run_error = "The connection to " + peer + " failed.";
+                        }
+                        ended = true;
+                    } else if (!probe.OnReceived(buffer, static_cast<size_t>(received), now)) {
+                        ended = true;
+                    } else if (static_cast<size_t>(received) < sizeof(buffer)) {
+                        break;
+                    }
+                }
+            }
+            for (int n = 0; n < kMaxIoPerEvent && !ended; n++) {
+                std::string_view output = probe.output();
+                if (output.empty()) {
+                    break;
+                }
+                int sent = send(stream, output.data(), static_cast<int>(std::min<size_t>(output.size(), INT_MAX)), 0);
+                if (sent == SOCKET_ERROR) {
+                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                        run_error = "The connection to " + peer + " failed.";
+                        ended = true;
+                    }
+                    break;
+                }
+                probe.OnSent(static_cast<size_t>(sent), now);
+                if (static_cast<size_t>(sent) < output.size()) {
+                    break;
+                }
+            }
+        }
+        if (!ended && udp != INVALID_SOCKET && (poll_fds.back().revents & (POLLRDNORM | POLLERR)) != 0) {
+            char datagram[kMaxDatagram];
+            for (int n = 0; n < kMaxIoPerEvent; n++) {
+                int received = recv(udp, datagram, static_cast<int>(sizeof(datagram)), 0);
+                if (received == SOCKET_ERROR) {
+                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                        run_error = probe.datagram_ip() + ":" + std::to_string(probe.datagram_port()) +
+                                    " is unreachable over UDP.";
+                        ended = true;
+                    }
+                    break;
+                }
+                probe.OnDatagram(datagram, static_cast<size_t>(received), now);
+            }
+        }
+    }
+
+    if (stream != INVALID_SOCKET) {
+        closesocket(stream);
+    }
+    if (udp != INVALID_SOCKET) {
+        closesocket(udp);
+    }
+    DnsBenchResult result = probe.Finish();
+    if (result.error.empty()) {
+        result.error = run_error;
+    }
+    return result;
+}
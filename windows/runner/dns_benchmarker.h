@@ -0,0 +1,57 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns_bench.h"
+
+// Posted once when a benchmark ends. lParam is a DnsBenchEvent* the window
+// owns from then on.
+#define WM_DNS_BENCH_DONE (WM_APP + 10)
+
+struct DnsBenchEvent {
+    // A result per finished run and, when the benchmark stopped early, why.
+    std::vector<DnsBenchResult> results;
+    std::string error;
+};
+
+// Measures DNS provider latency.
+//
+// A worker thread makes the planned runs one after another. Each opens a
+// non-blocking TCP connection to the server or the mixed inbound and, for
+// UDP, a connected datagram socket to the server or the proxy's relay,
+// fires all of its queries at once and ends when every one is answered or
+// options.timeout passes. Everything is waited on with WSAPoll.
+class DnsBenchmarker {
+public:
+    DnsBenchmarker();
+    ~DnsBenchmarker();
+
+    DnsBenchmarker(const DnsBenchmarker&) = delete;
+    DnsBenchmarker& operator=(const DnsBenchmarker&) = delete;
+
+    void SetMainWindowHandle(HWND hwnd);
+    // Returns false while another benchmark runs.
+    bool Start(DnsBenchOptions options);
+    // Stops a running benchmark with "Cancelled.".
+    void Cancel();
+
+private:
+    // Upper bound on a WSAPoll wait, so a cancel is noticed promptly.
+    static constexpr int kMaxPollMs = 50;
+    static constexpr int kMaxIoPerEvent = 16;
+
+    void Run(DnsBenchOptions options);
+    DnsBenchResult RunOne(const DnsBenchRun& run, const DnsBenchOptions& options);
+
+    HWND main_window_handle_ = nullptr;
+    std::thread worker_;
+    std::atomic<bool> running_ = false;
+    std::atomic<bool> cancelled_ = false;
+};
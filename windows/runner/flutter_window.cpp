@@ -1,117 +1,309 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
-#include <iphlpapi.h>
+#include <shlobj.h>
 
 #include "flutter_window.h"
 
+#include <chrono>
 #include <optional>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <filesystem>
 
 #include "flutter/generated_plugin_registrant.h"
 #include <flutter/method_channel.h>
 #include <flutter/standard_method_codec.h>
 
 namespace {
-  std::string GetLocalIpAddress() {
-    std::string hotspot_ip = "";
-    std::string gateway_ip = "";
+  constexpr UINT_PTR kLogFlushTimerId = 1;
+  constexpr UINT kLogFlushIntervalMs = 100;
+  constexpr UINT_PTR kNetworkSettleTimerId = 2;
+  // Quiet time after the last notification before a change is reported.
+  constexpr UINT kNetworkSettleMs = 150;
+  constexpr size_t kLogHighWaterBytes = 64 * 1024;
+  constexpr int64_t kDefaultLogPageLines = 500;
+  constexpr int64_t kDefaultSearchLimit = 1000;
+  constexpr int64_t kDefaultProbeTimeoutMs = 2000;
+  constexpr int64_t kDefaultSpeedTestMs = 10000;
+  constexpr UINT_PTR kStartupTraceTimerId = 3;
+  // How long a HWL_STARTUP_TRACE run waits for the first Dart call after
+  // the first frame.
+  constexpr UINT kStartupTraceWaitMs = 10000;
 
-    ULONG buffer_size = 15000;
-    std::unique_ptr<char[]> buffer(new char[buffer_size]);
-    PIP_ADAPTER_ADDRESSES p_adapters = reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.get());
-
-    DWORD flags = GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER | GAA_FLAG_INCLUDE_GATEWAYS;
-    DWORD result = GetAdaptersAddresses(AF_INET, flags, NULL, p_adapters, &buffer_size);
+  // Returns environment variable |name|, or an empty string when unset.
+  std::wstring GetEnvironmentString(const wchar_t* name) {
+    DWORD size = GetEnvironmentVariableW(name, nullptr, 0);
+    if (size == 0) {
+      return std::wstring();
+    }
+    std::wstring value(size, L'\0');
+    size = GetEnvironmentVariableW(name, value.data(), size);
+    value.resize(size);
+    return value;
+  }
 
-    if (result == ERROR_BUFFER_OVERFLOW) {
-        buffer.reset(new char[buffer_size]);
-        p_adapters = reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.get());
-        result = GetAdaptersAddresses(AF_INET, flags, NULL, p_adapters, &buffer_size);
+  // Returns the integer |key| from |map|, or |fallback|.
+  int64_t LookupInt(const flutter::EncodableMap& map, const char* key, int64_t fallback) {
+    auto it = map.find(flutter::EncodableValue(key));
+    if (it == map.end()) {
+      return fallback;
+    }
+    if (const auto* value = std::get_if<int32_t>(&it->second)) {
+      return *value;
     }
+    if (const auto* value = std::get_if<int64_t>(&it->second)) {
+      return *value;
+    }
+    return fallback;
+  }
+
+  // Returns the integer argument |key| from |args|, or |fallback|.
+  int64_t LookupIntArg(const flutter::EncodableValue* args, const char* key, int64_t fallback) {
+    const auto* map = std::get_if<flutter::EncodableMap>(args);
+    return map ? LookupInt(*map, key, fallback) : fallback;
+  }
 
-    if (result != NO_ERROR) {
-        return "";
+  // Returns the string |key| from |map|, or nullptr.
+  const std::string* LookupString(const flutter::EncodableMap& map, const char* key) {
+    auto it = map.find(flutter::EncodableValue(key));
+    return it == map.end() ? nullptr : std::get_if<std::string>(&it->second);
+  }
+
+  bool LookupBool(const flutter::EncodableMap& map, const char* key) {
+    auto it = map.find(flutter::EncodableValue(key));
+    if (it == map.end()) {
+      return false;
     }
+    const auto* value = std::get_if<bool>(&it->second);
+    return value && *value;
+  }
 
-    for (PIP_ADAPTER_ADDRESSES p_curr_adapter = p_adapters; p_curr_adapter != NULL; p_curr_adapter = p_curr_adapter->Next) {
-        if (p_curr_adapter->OperStatus != IfOperStatusUp) {
-            continue;
+  // Returns the strings in the list |key| from |map|; other entries are
+  // skipped.
+  std::vector<std::string> LookupStringList(const flutter::EncodableMap& map, const char* key) {
+    std::vector<std::string> items;
+    auto it = map.find(flutter::EncodableValue(key));
+    if (it == map.end()) {
+      return items;
+    }
+    if (const auto* list = std::get_if<flutter::EncodableList>(&it->second)) {
+      for (const auto& item : *list) {
+        if (const auto* value = std::get_if<std::string>(&item)) {
+          items.push_back(*value);
         }
+      }
+    }
+    return items;
+  }
 
-        if (wcsstr(p_curr_adapter->Description, L"Microsoft Wi-Fi Direct Virtual Adapter") != nullptr) {
-            for (IP_ADAPTER_UNICAST_ADDRESS* p_unicast = p_curr_adapter->FirstUnicastAddress; p_unicast != NULL; p_unicast = p_unicast->Next) {
-                if (p_unicast->Address.lpSockaddr->sa_family == AF_INET) {
-                    char ip_str[INET_ADDRSTRLEN];
-                    sockaddr_in* sai = reinterpret_cast<sockaddr_in*>(p_unicast->Address.lpSockaddr);
-                    if (inet_ntop(AF_INET, &(sai->sin_addr), ip_str, INET_ADDRSTRLEN) != NULL) {
-                        hotspot_ip = ip_str;
-                        break;
-                    }
-                }
-            }
-        }
-        else if (p_curr_adapter->IfType != IF_TYPE_TUNNEL && p_curr_adapter->FirstGatewayAddress != NULL) {
-             for (IP_ADAPTER_UNICAST_ADDRESS* p_unicast = p_curr_adapter->FirstUnicastAddress; p_unicast != NULL; p_unicast = p_unicast->Next) {
-                if (p_unicast->Address.lpSockaddr->sa_family == AF_INET) {
-                     char ip_str[INET_ADDRSTRLEN];
-                    sockaddr_in* sai = reinterpret_cast<sockaddr_in*>(p_unicast->Address.lpSockaddr);
-                    if (inet_ntop(AF_INET, &(sai->sin_addr), ip_str, INET_ADDRSTRLEN) != NULL) {
-                        if (gateway_ip.empty()) {
-                           gateway_ip = ip_str;
-                        }
-                    }
-                }
-            }
-        }
+  // Reads the runSpeedTest arguments into |options|. Returns false with
+  // |error| set when they are unusable or leave nothing to test.
+  bool ReadSpeedTestOptions(const flutter::EncodableMap& args, SpeedTestOptions* options, std::string* error) {
+    const std::string* proxy_host = LookupString(args, "proxyHost");
+    options->proxy_ip = MixedInboundDialAddress(proxy_host ? *proxy_host : "");
+    options->proxy_port = static_cast<uint16_t>(std::clamp<int64_t>(LookupInt(args, "proxyPort", 0), 0, 65535));
+    const std::string* download_url = LookupString(args, "downloadUrl");
+    const std::string* upload_url = LookupString(args, "uploadUrl");
+    if ((download_url && !ParseHttpUrl(*download_url, &options->download_url)) ||
+        (upload_url && !ParseHttpUrl(*upload_url, &options->upload_url))) {
+      *error = "Speed test URLs must be http:// URLs.";
+      return false;
+    }
+    const std::string* udp_echo_host = LookupString(args, "udpEchoHost");
+    options->udp_echo_host = udp_echo_host ? *udp_echo_host : "";
+    options->udp_echo_port = static_cast<uint16_t>(std::clamp<int64_t>(LookupInt(args, "udpEchoPort", 0), 0, 65535));
+    options->streams = static_cast<size_t>(
+        std::clamp<int64_t>(LookupInt(args, "streams", 4), 1, static_cast<int64_t>(kMaxSpeedTestStreams)));
+    options->phase_duration =
+        std::chrono::milliseconds(std::clamp<int64_t>(LookupInt(args, "durationMs", kDefaultSpeedTestMs), 1000, 60000));
+    options->upload_size = static_cast<uint64_t>(std::max<int64_t>(LookupInt(args, "uploadBytes", 16 << 20), 1));
+    if (options->proxy_port == 0 || PlannedSpeedTestPhases(*options).empty()) {
+      *error = "Nothing to test.";
+      return false;
+    }
+    return true;
+  }
+
+  // onVpnRestart {kind, exitStatus, crashes, attempt, delayMs, recoveryMs,
+  // restarts, recoveries, lastRecoveryMs, maxRecoveryMs, totalRecoveryMs}.
+  flutter::EncodableValue RestartEventValue(const RestartEvent& event) {
+    flutter::EncodableMap value;
+    value[flutter::EncodableValue("kind")] = flutter::EncodableValue(RestartEventKindName(event.kind));
+    value[flutter::EncodableValue("exitStatus")] = flutter::EncodableValue(event.exit_status);
+    value[flutter::EncodableValue("crashes")] = flutter::EncodableValue(static_cast<int64_t>(event.crashes));
+    value[flutter::EncodableValue("attempt")] = flutter::EncodableValue(static_cast<int64_t>(event.attempt));
+    value[flutter::EncodableValue("delayMs")] = flutter::EncodableValue(event.delay_ms);
+    value[flutter::EncodableValue("recoveryMs")] = flutter::EncodableValue(event.recovery_ms);
+    value[flutter::EncodableValue("restarts")] = flutter::EncodableValue(static_cast<int64_t>(event.stats.restarts));
+    value[flutter::EncodableValue("recoveries")] = flutter::EncodableValue(static_cast<int64_t>(event.stats.recoveries));
+    value[flutter::EncodableValue("lastRecoveryMs")] = flutter::EncodableValue(event.stats.last_recovery_ms);
+    value[flutter::EncodableValue("maxRecoveryMs")] = flutter::EncodableValue(event.stats.max_recovery_ms);
+    value[flutter::EncodableValue("totalRecoveryMs")] = flutter::EncodableValue(event.stats.total_recovery_ms);
+    return flutter::EncodableValue(std::move(value));
+  }
+
+  flutter::EncodableValue SpeedTestResultValue(const SpeedTestResult& result) {
+    flutter::EncodableMap value;
+    value[flutter::EncodableValue("phase")] = flutter::EncodableValue(SpeedTestPhaseName(result.phase));
+    value[flutter::EncodableValue("bytes")] = flutter::EncodableValue(static_cast<int64_t>(result.bytes));
+    value[flutter::EncodableValue("goodputBps")] = flutter::EncodableValue(result.goodput_bps);
+    value[flutter::EncodableValue("rttSamples")] = flutter::EncodableValue(static_cast<int64_t>(result.rtt_samples));
+    value[flutter::EncodableValue("rttP50Us")] = flutter::EncodableValue(result.rtt_p50_us);
+    value[flutter::EncodableValue("rttP99Us")] = flutter::EncodableValue(result.rtt_p99_us);
+    value[flutter::EncodableValue("jitterUs")] = flutter::EncodableValue(result.jitter_us);
+    value[flutter::EncodableValue("datagramsSent")] = flutter::EncodableValue(static_cast<int64_t>(result.datagrams_sent));
+    value[flutter::EncodableValue("datagramsLost")] = flutter::EncodableValue(static_cast<int64_t>(result.datagrams_lost));
+    value[flutter::EncodableValue("failedStreams")] = flutter::EncodableValue(static_cast<int64_t>(result.failed_streams));
+    return flutter::EncodableValue(std::move(value));
+  }
+
+  flutter::EncodableValue DnsBenchResultValue(const DnsBenchResult& result) {
+    flutter::EncodableMap value;
+    value[flutter::EncodableValue("provider")] = flutter::EncodableValue(result.run.target.provider);
+    value[flutter::EncodableValue("address")] = flutter::EncodableValue(result.run.target.address);
+    value[flutter::EncodableValue("transport")] = flutter::EncodableValue(DnsTransportName(result.run.transport));
+    value[flutter::EncodableValue("route")] = flutter::EncodableValue(DnsRouteName(result.run.route));
+    value[flutter::EncodableValue("queries")] = flutter::EncodableValue(static_cast<int64_t>(result.queries));
+    value[flutter::EncodableValue("failures")] = flutter::EncodableValue(static_cast<int64_t>(result.failures));
+    value[flutter::EncodableValue("failureRate")] = flutter::EncodableValue(result.failure_rate());
+    value[flutter::EncodableValue("p50Us")] = flutter::EncodableValue(result.p50_us);
+    value[flutter::EncodableValue("p95Us")] = flutter::EncodableValue(result.p95_us);
+    value[flutter::EncodableValue("error")] =
+        result.error.empty() ? flutter::EncodableValue() : flutter::EncodableValue(result.error);
+    return flutter::EncodableValue(std::move(value));
+  }
+
+  flutter::EncodableValue ReloadResultValue(const ReloadResult& result) {
+    flutter::EncodableList sections;
+    for (const std::string& section : result.sections) {
+      sections.push_back(flutter::EncodableValue(section));
     }
+    flutter::EncodableMap value;
+    value[flutter::EncodableValue("path")] = flutter::EncodableValue(ReloadPathName(result.path));
+    value[flutter::EncodableValue("sections")] = flutter::EncodableValue(std::move(sections));
+    value[flutter::EncodableValue("elapsedMs")] = flutter::EncodableValue(result.elapsed_ms);
+    value[flutter::EncodableValue("error")] =
+        result.error.empty() ? flutter::EncodableValue() : flutter::EncodableValue(result.error);
+    return flutter::EncodableValue(std::move(value));
+  }
 
-    if (!hotspot_ip.empty()) {
-        return hotspot_ip;
+  // %LOCALAPPDATA%\com.hwl_vpn\HWL VPN, where the app keeps its data.
+  std::filesystem::path GetAppDataDirectory() {
+    PWSTR local_app_data = nullptr;
+    if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &local_app_data))) {
+      return {};
     }
-    if (!gateway_ip.empty()) {
-        return gateway_ip;
+    std::filesystem::path directory(local_app_data);
+    CoTaskMemFree(local_app_data);
+    return directory / L"com.hwl_vpn" / L"HWL VPN";
+  }
+
+  // The mapped country list, next to the log journal.
+  std::filesystem::path GetServerCachePath() {
+    std::filesystem::path directory = GetAppDataDirectory();
+    return directory.empty() ? directory : directory / L"servers.bin";
+  }
+
+  // Reads the ServerCache::kKeySize byte "key" from |map|.
+  bool LookupServerCacheKey(const flutter::EncodableMap& map, std::string* key) {
+    auto it = map.find(flutter::EncodableValue("key"));
+    const auto* bytes = it == map.end() ? nullptr : std::get_if<std::vector<uint8_t>>(&it->second);
+    if (!bytes || bytes->size() != ServerCache::kKeySize) {
+      return false;
     }
+    key->assign(bytes->begin(), bytes->end());
+    return true;
+  }
 
-    for (PIP_ADAPTER_ADDRESSES p_curr_adapter = p_adapters; p_curr_adapter != NULL; p_curr_adapter = p_curr_adapter->Next) {
-        if (p_curr_adapter->OperStatus == IfOperStatusUp && 
-            (p_curr_adapter->IfType == IF_TYPE_ETHERNET_CSMACD || p_curr_adapter->IfType == IF_TYPE_IEEE80211)) {
-            
-            if (wcsstr(p_curr_adapter->Description, L"VMware") != nullptr ||
-                wcsstr(p_curr_adapter->Description, L"VirtualBox") != nullptr ||
-                wcsstr(p_curr_adapter->FriendlyName, L"vEthernet (WSL)") != nullptr) {
-                continue;
-            }
+  // Reads the string |key| of |map| into |out|; false when it is null or
+  // missing.
+  bool LookupOptionalString(const flutter::EncodableMap& map, const char* key, std::string* out) {
+    const std::string* value = LookupString(map, key);
+    *out = value ? *value : "";
+    return value != nullptr;
+  }
 
-            for (IP_ADAPTER_UNICAST_ADDRESS* p_unicast = p_curr_adapter->FirstUnicastAddress; p_unicast != NULL; p_unicast = p_unicast->Next) {
-                if (p_unicast->Address.lpSockaddr->sa_family == AF_INET) {
-                    char ip_str[INET_ADDRSTRLEN];
-                    sockaddr_in* sai = reinterpret_cast<sockaddr_in*>(p_unicast->Address.lpSockaddr);
-                    if (inet_ntop(AF_INET, &(sai->sin_addr), ip_str, INET_ADDRSTRLEN) != NULL) {
-                        return std::string(ip_str);
-                    }
-                }
-            }
+  // Reads a list in the shape of the Dart Country model's toJson.
+  bool ReadCachedCountries(const flutter::EncodableList& list, std::vector<CachedCountry>* countries) {
+    for (const auto& item : list) {
+      const auto* fields = std::get_if<flutter::EncodableMap>(&item);
+      CachedCountry country;
+      if (!fields || !LookupOptionalString(*fields, "name", &country.name)) {
+        return false;
+      }
+      LookupOptionalString(*fields, "code", &country.code);
+      auto servers_it = fields->find(flutter::EncodableValue("servers"));
+      const auto* servers = servers_it == fields->end() ? nullptr : std::get_if<flutter::EncodableList>(&servers_it->second);
+      if (!servers) {
+        return false;
+      }
+      for (const auto& entry : *servers) {
+        const auto* server_fields = std::get_if<flutter::EncodableMap>(&entry);
+        CachedServer server;
+        if (!server_fields || !LookupOptionalString(*server_fields, "uuid", &server.uuid) ||
+            !LookupOptionalString(*server_fields, "name", &server.name)) {
+          return false;
+        }
+        if (!LookupOptionalString(*server_fields, "status", &server.status)) {
+          server.status = "subscribe";
         }
+        server.has_ip = LookupOptionalString(*server_fields, "ip", &server.ip);
+        server.has_vless = LookupBool(*server_fields, "has_vless");
+        server.has_ssh = LookupBool(*server_fields, "has_ssh");
+        server.has_hysteria2 = LookupBool(*server_fields, "has_hysteria2");
+        server.has_vless_link = LookupOptionalString(*server_fields, "vless_link", &server.vless_link);
+        server.has_ssh_link = LookupOptionalString(*server_fields, "ssh_link", &server.ssh_link);
+        server.has_hysteria2_link = LookupOptionalString(*server_fields, "hysteria2_link", &server.hysteria2_link);
+        country.servers.push_back(std::move(server));
+      }
+      countries->push_back(std::move(country));
     }
+    return true;
+  }
 
-    return "";
+  // Builds a map in the shape of the Dart Server model's toJson.
+  flutter::EncodableValue CachedServerValue(const CachedServer& server) {
+    auto optional = [](bool present, const std::string& text) {
+      return present ? flutter::EncodableValue(text) : flutter::EncodableValue();
+    };
+    flutter::EncodableMap value;
+    value[flutter::EncodableValue("name")] = flutter::EncodableValue(server.name);
+    value[flutter::EncodableValue("uuid")] = flutter::EncodableValue(server.uuid);
+    value[flutter::EncodableValue("ip")] = optional(server.has_ip, server.ip);
+    value[flutter::EncodableValue("has_vless")] = flutter::EncodableValue(server.has_vless);
+    value[flutter::EncodableValue("has_ssh")] = flutter::EncodableValue(server.has_ssh);
+    value[flutter::EncodableValue("has_hysteria2")] = flutter::EncodableValue(server.has_hysteria2);
+    value[flutter::EncodableValue("status")] = flutter::EncodableValue(server.status);
+    value[flutter::EncodableValue("vless_link")] = optional(server.has_vless_link, server.vless_link);
+    value[flutter::EncodableValue("ssh_link")] = optional(server.has_ssh_link, server.ssh_link);
+    value[flutter::EncodableValue("hysteria2_link")] = optional(server.has_hysteria2_link, server.hysteria2_link);
+    return flutter::EncodableValue(std::move(value));
   }
 }
 
 FlutterWindow::FlutterWindow(const flutter::DartProject& project)
     : project_(project) {}
 
-FlutterWindow::~FlutterWindow() {}
+FlutterWindow::~FlutterWindow() {
+  if (server_cache_writer_.joinable()) {
+    server_cache_writer_.join();
+  }
+}
 
 bool FlutterWindow::OnCreate() {
   if (!Win32Window::OnCreate()) {
     return false;
   }
+  ProcessStartupTrace().Mark(StartupStage::kWindowCreated);
 
   process_manager_.SetMainWindowHandle(GetHandle());
+  latency_prober_.SetMainWindowHandle(GetHandle());
+  speed_tester_.SetMainWindowHandle(GetHandle());
+  dns_benchmarker_.SetMainWindowHandle(GetHandle());
+  traffic_sampler_.SetMainWindowHandle(GetHandle());
 
   RECT frame = GetClientArea();
 
@@ -120,7 +312,9 @@ bool FlutterWindow::OnCreate() {
   if (!flutter_controller_->engine() || !flutter_controller_->view()) {
     return false;
   }
+  ProcessStartupTrace().Mark(StartupStage::kEngineStarted);
   RegisterPlugins(flutter_controller_->engine());
+  ProcessStartupTrace().Mark(StartupStage::kPluginsRegistered);
 
   // Set up method channel.
   channel_ = std::make_unique<flutter::MethodChannel<flutter::EncodableValue>>(
@@ -130,18 +324,25 @@ bool FlutterWindow::OnCreate() {
   channel_->SetMethodCallHandler(
       [this](const flutter::MethodCall<flutter::EncodableValue>& call,
              std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
-        if (call.method_name().compare("startService") == 0) {
+        if (ProcessStartupTrace().Mark(StartupStage::kFirstDartCall) &&
+            ProcessStartupTrace().reached(StartupStage::kFirstFrame)) {
+          KillTimer(GetHandle(), kStartupTraceTimerId);
+          DumpStartupTrace(false);
+        }
+
+        if (call.method_name().compare("startService") == 0 ||
+            call.method_name().compare("switchService") == 0) {
           const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
           if (!args) {
             result->Error("ARG_ERROR", "Invalid arguments");
             return;
           }
-          auto config_json_it = args->find(flutter::EncodableValue("config"));
-          if (config_json_it == args->end()) {
-            result->Error("ARG_ERROR", "Missing 'config' argument.");
+          std::string config_json;
+          std::string error;
+          if (!ResolveConfig(*args, &config_json, &error)) {
+            result->Error("ARG_ERROR", error);
             return;
           }
-          const std::string config_json = std::get<std::string>(config_json_it->second);
 
           auto hide_console_it = args->find(flutter::EncodableValue("hideSingboxConsole"));
           bool hide_console = true; // Default to hiding
@@ -151,21 +352,400 @@ bool FlutterWindow::OnCreate() {
               }
           }
 
-          bool success = this->process_manager_.Start(config_json, hide_console);
+          auto auto_restart_it = args->find(flutter::EncodableValue("disableAutoRestart"));
+          const bool* disable_auto_restart =
+              auto_restart_it == args->end() ? nullptr : std::get_if<bool>(&auto_restart_it->second);
+          this->process_manager_.SetAutoRestart(!(disable_auto_restart && *disable_auto_restart));
+
+          bool success = call.method_name().compare("switchService") == 0
+              ? this->process_manager_.Switch(config_json, hide_console)
+              : this->process_manager_.Start(config_json, hide_console);
           
+          // "Started" follows from WM_PROCESS_READY.
           if (success) {
             result->Success();
-            channel_->InvokeMethod("updateStatus", std::make_unique<flutter::EncodableValue>("Started"));
           } else {
             result->Error("START_FAILED", "Failed to start sing-box.exe process.");
             channel_->InvokeMethod("updateStatus", std::make_unique<flutter::EncodableValue>("Error starting process"));
           }
+        } else if (call.method_name().compare("reloadConfig") == 0) {
+          // Answers {path, sections, elapsedMs, error} once the new config
+          // is running; on error the current one keeps running.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          if (!args) {
+            result->Error("ARG_ERROR", "Invalid arguments");
+            return;
+          }
+          std::string config_json;
+          std::string error;
+          if (!ResolveConfig(*args, &config_json, &error)) {
+            result->Error("ARG_ERROR", error);
+            return;
+          }
+          if (!process_manager_.IsRunning()) {
+            result->Error("NOT_RUNNING", "sing-box is not running.");
+            return;
+          }
+          ReloadResult reload;
+          if (pending_reload_) {
+            reload.error = "another reload is in progress.";
+            result->Success(ReloadResultValue(reload));
+            return;
+          }
+          reload_begin_ = std::chrono::steady_clock::now();
+          if (!process_manager_.Reload(config_json, &reload)) {
+            reload.error = "sing-box could not be switched to it.";
+          }
+          if (!reload.error.empty() || reload.path == ReloadPath::kUnchanged) {
+            if (log_handler_) {
+              log_handler_->SendLog(DescribeReloadResult(reload));
+            }
+            result->Success(ReloadResultValue(reload));
+            return;
+          }
+          pending_reload_ = std::move(result);
+          reload_result_ = std::move(reload);
         } else if (call.method_name().compare("stopService") == 0) {
+          FinishReload("the service was stopped.");
           this->process_manager_.Stop();
+          traffic_sampler_.Stop();
           result->Success();
           channel_->InvokeMethod("updateStatus", std::make_unique<flutter::EncodableValue>("Stopped"));
+        } else if (call.method_name().compare("getLogs") == 0) {
+          // A negative offset counts back from the newest line.
+          if (log_handler_) {
+            log_handler_->FlushLogs();
+          }
+          int64_t limit = LookupIntArg(call.arguments(), "limit", kDefaultLogPageLines);
+          int64_t offset = LookupIntArg(call.arguments(), "offset", -limit);
+          LogStore::Page page = log_store_.ReadPage(offset, static_cast<size_t>(std::max(limit, int64_t{0})));
+
+          flutter::EncodableMap response;
+          response[flutter::EncodableValue("first")] = flutter::EncodableValue(static_cast<int64_t>(page.first));
+          response[flutter::EncodableValue("next")] = flutter::EncodableValue(static_cast<int64_t>(page.next));
+          response[flutter::EncodableValue("oldest")] = flutter::EncodableValue(static_cast<int64_t>(log_store_.first_line()));
+          response[flutter::EncodableValue("newest")] = flutter::EncodableValue(static_cast<int64_t>(log_store_.next_line()));
+          response[flutter::EncodableValue("evicted")] = flutter::EncodableValue(static_cast<int64_t>(log_store_.evicted_lines()));
+          response[flutter::EncodableValue("droppedBytes")] = flutter::EncodableValue(static_cast<int64_t>(log_ring_.dropped_bytes()));
+          response[flutter::EncodableValue("data")] = flutter::EncodableValue(std::move(page.data));
+          result->Success(flutter::EncodableValue(std::move(response)));
+        } else if (call.method_name().compare("getLogRecords") == 0) {
+          // Binary blob, layout documented on LogStore::ReadRecords.
+          if (log_handler_) {
+            log_handler_->FlushLogs();
+          }
+          int64_t limit = LookupIntArg(call.arguments(), "limit", kDefaultLogPageLines);
+          int64_t offset = LookupIntArg(call.arguments(), "offset", -1);
+          int64_t level_mask = LookupIntArg(call.arguments(), "levelMask", 0xffffffff);
+          int64_t module = LookupIntArg(call.arguments(), "module", -1);
+          LogStore::Page page = log_store_.ReadRecords(offset, static_cast<size_t>(std::max(limit, int64_t{0})),
+                                                       static_cast<uint32_t>(level_mask), static_cast<int>(module));
+          result->Success(flutter::EncodableValue(std::move(page.data)));
+        } else if (call.method_name().compare("searchLogs") == 0) {
+          // Ids of the newest matching lines, oldest first, and their text.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          const std::string* query = nullptr;
+          if (args) {
+            auto query_it = args->find(flutter::EncodableValue("query"));
+            if (query_it != args->end()) {
+              query = std::get_if<std::string>(&query_it->second);
+            }
+          }
+          if (!query) {
+            result->Error("ARG_ERROR", "Missing 'query' argument.");
+            return;
+          }
+          if (log_handler_) {
+            log_handler_->FlushLogs();
+          }
+          int64_t level_mask = LookupIntArg(call.arguments(), "levelMask", 0xffffffff);
+          int64_t limit = LookupIntArg(call.arguments(), "limit", kDefaultSearchLimit);
+
+          struct Match {
+            int64_t line;
+            const char* data;
+            size_t size;
+          };
+          std::vector<Match> matches;
+          log_store_.Search(*query, static_cast<uint32_t>(level_mask), static_cast<size_t>(std::max(limit, int64_t{0})),
+                            [&matches](uint64_t line, const char* data, size_t size) {
+                              matches.push_back({static_cast<int64_t>(line), data, size});
+                            });
+
+          std::vector<int64_t> lines;
+          std::vector<uint8_t> data;
+          for (auto it = matches.rbegin(); it != matches.rend(); ++it) {
+            lines.push_back(it->line);
+            data.insert(data.end(), it->data, it->data + it->size);
+            data.push_back('\n');
+          }
+
+          flutter::EncodableMap response;
+          response[flutter::EncodableValue("lines")] = flutter::EncodableValue(std::move(lines));
+          response[flutter::EncodableValue("data")] = flutter::EncodableValue(std::move(data));
+          result->Success(flutter::EncodableValue(std::move(response)));
+        } else if (call.method_name().compare("getLogStats") == 0) {
+          if (log_handler_) {
+            log_handler_->FlushLogs();
+          }
+          const uint64_t* counts = log_store_.level_counts();
+          std::vector<int64_t> levels;
+          for (size_t i = 0; i < kLogLevelCount; i++) {
+            levels.push_back(static_cast<int64_t>(counts[i]));
+          }
+
+          flutter::EncodableMap response;
+          response[flutter::EncodableValue("levels")] = flutter::EncodableValue(std::move(levels));
+          response[flutter::EncodableValue("oldest")] = flutter::EncodableValue(static_cast<int64_t>(log_store_.first_line()));
+          response[flutter::EncodableValue("newest")] = flutter::EncodableValue(static_cast<int64_t>(log_store_.next_line()));
+          result->Success(flutter::EncodableValue(std::move(response)));
+        } else if (call.method_name().compare("probeServers") == 0) {
+          // Results are queued for Dart as kProbeResult frames as they come
+          // in; the call completes after the last one.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          const flutter::EncodableList* list = nullptr;
+          if (args) {
+            auto targets_it = args->find(flutter::EncodableValue("targets"));
+            if (targets_it != args->end()) {
+              list = std::get_if<flutter::EncodableList>(&targets_it->second);
+            }
+          }
+          if (!list) {
+            result->Error("ARG_ERROR", "Missing 'targets' argument.");
+            return;
+          }
+          std::vector<ProbeTarget> targets;
+          for (const auto& item : *list) {
+            const auto* fields = std::get_if<flutter::EncodableMap>(&item);
+            const std::string* id = fields ? LookupString(*fields, "id") : nullptr;
+            const std::string* ip = fields ? LookupString(*fields, "ip") : nullptr;
+            const std::string* proto = fields ? LookupString(*fields, "proto") : nullptr;
+            ProbeTarget target;
+            if (!id || !ip || !ParseProbeProtocol(proto ? *proto : "tcp", &target.protocol)) {
+              result->Error("ARG_ERROR", "Invalid probe target.");
+              return;
+            }
+            target.id = *id;
+            target.ip = *ip;
+            target.port = static_cast<uint16_t>(std::clamp<int64_t>(LookupInt(*fields, "port", 0), 0, 65535));
+            const std::string* sni = LookupString(*fields, "sni");
+            target.sni = sni ? *sni : "";
+            targets.push_back(std::move(target));
+          }
+          if (targets.empty()) {
+            result->Success();
+            return;
+          }
+          int64_t timeout_ms = std::max<int64_t>(LookupIntArg(call.arguments(), "timeoutMs", kDefaultProbeTimeoutMs), 1);
+          uint64_t batch = latency_prober_.Probe(std::move(targets), std::chrono::milliseconds(timeout_ms));
+          pending_probes_[batch] = std::move(result);
+        } else if (call.method_name().compare("runSpeedTest") == 0) {
+          // Progress goes to Dart as onSpeedTestProgress {phase, elapsedMs,
+          // bytes, bps} every quarter second; the call completes with
+          // {phases, error} after the last phase.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          SpeedTestOptions options;
+          std::string error = "Missing speed test arguments.";
+          if (!args || !ReadSpeedTestOptions(*args, &options, &error)) {
+            result->Error("ARG_ERROR", error);
+            return;
+          }
+          if (!speed_tester_.Start(std::move(options))) {
+            result->Error("BUSY", "A speed test is already running.");
+            return;
+          }
+          pending_speed_test_ = std::move(result);
+        } else if (call.method_name().compare("cancelSpeedTest") == 0) {
+          speed_tester_.Cancel();
+          result->Success();
+        } else if (call.method_name().compare("benchmarkDns") == 0) {
+          // Times "repeat" pipelined queries for each of "domains" at every
+          // known provider over the "transports" given, UDP and TCP by
+          // default: directly while disconnected, through the mixed inbound
+          // at "proxyHost":"proxyPort" while connected. Completes with
+          // {results, winner, network, error}; the winner becomes the "auto"
+          // provider on that network.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          if (!args) {
+            result->Error("ARG_ERROR", "Missing benchmark arguments.");
+            return;
+          }
+          DnsBenchOptions options;
+          options.domains = LookupStringList(*args, "domains");
+          options.repeat = static_cast<size_t>(std::clamp<int64_t>(LookupInt(*args, "repeat", 2), 1, 10));
+          options.timeout =
+              std::chrono::milliseconds(std::clamp<int64_t>(LookupInt(*args, "timeoutMs", 2000), 100, 10000));
+          std::vector<std::string> transports = LookupStringList(*args, "transports");
+          if (!transports.empty()) {
+            options.udp = std::find(transports.begin(), transports.end(), "udp") != transports.end();
+            options.tcp = std::find(transports.begin(), transports.end(), "tcp") != transports.end();
+          }
+          const std::string* proxy_host = LookupString(*args, "proxyHost");
+          options.proxy_ip = MixedInboundDialAddress(proxy_host ? *proxy_host : "");
+          options.proxy_port = static_cast<uint16_t>(std::clamp<int64_t>(LookupInt(*args, "proxyPort", 0), 0, 65535));
+          if (!StartDnsBenchmark(std::move(options))) {
+            result->Error("BUSY", "A DNS benchmark is already running.");
+            return;
+          }
+          pending_dns_bench_ = std::move(result);
+        } else if (call.method_name().compare("saveServerCache") == 0) {
+          // Encrypting a large list takes a while, so the file is written
+          // on a thread and swapped in once WM_SERVER_CACHE_WRITTEN arrives.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          std::string key;
+          const flutter::EncodableList* list = nullptr;
+          if (args) {
+            auto countries_it = args->find(flutter::EncodableValue("countries"));
+            if (countries_it != args->end()) {
+              list = std::get_if<flutter::EncodableList>(&countries_it->second);
+            }
+          }
+          std::vector<CachedCountry> countries;
+          if (!args || !list || !LookupServerCacheKey(*args, &key) || !ReadCachedCountries(*list, &countries)) {
+            result->Error("ARG_ERROR", "Missing or invalid 'key' or 'countries' argument.");
+            return;
+          }
+          std::filesystem::path path = GetServerCachePath();
+          if (path.empty()) {
+            result->Success(flutter::EncodableValue(false));
+            return;
+          }
+          auto save = std::make_unique<ServerCacheWrite>();
+          save->id = next_server_cache_write_++;
+          save->file = path;
+          save->file += L"." + std::to_wstring(save->id) + L".tmp";
+          save->key = key;
+          pending_server_cache_writes_[save->id] = std::move(result);
+          if (server_cache_writer_.joinable()) {
+            server_cache_writer_.join();
+          }
+          server_cache_writer_ = std::thread(
+              [hwnd = GetHandle(), save = std::move(save), countries = std::move(countries)]() mutable {
+                save->written = ServerCache::Write(save->file, countries, save->key);
+                if (PostMessage(hwnd, WM_SERVER_CACHE_WRITTEN, 0, reinterpret_cast<LPARAM>(save.get()))) {
+                  save.release();
+                }
+              });
+        } else if (call.method_name().compare("listCountries") == 0) {
+          // [{name, code, servers}] with each country's server count, or
+          // null when there is no cache readable with "key".
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          std::string key;
+          if (!args || !LookupServerCacheKey(*args, &key)) {
+            result->Error("ARG_ERROR", "Missing 'key' argument.");
+            return;
+          }
+          if (!server_cache_.Open(GetServerCachePath(), key)) {
+            result->Success();
+            return;
+          }
+          flutter::EncodableList countries;
+          for (const CountrySummary& country : server_cache_.ListCountries()) {
+            flutter::EncodableMap value;
+            value[flutter::EncodableValue("name")] = flutter::EncodableValue(country.name);
+            value[flutter::EncodableValue("code")] = flutter::EncodableValue(country.code);
+            value[flutter::EncodableValue("servers")] = flutter::EncodableValue(static_cast<int64_t>(country.server_count));
+            countries.push_back(flutter::EncodableValue(std::move(value)));
+          }
+          result->Success(flutter::EncodableValue(std::move(countries)));
+        } else if (call.method_name().compare("listCountry") == 0) {
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          std::string key;
+          const std::string* name = args ? LookupString(*args, "name") : nullptr;
+          if (!args || !name || !LookupServerCacheKey(*args, &key)) {
+            result->Error("ARG_ERROR", "Missing 'key' or 'name' argument.");
+            return;
+          }
+          std::vector<CachedServer> servers;
+          if (!server_cache_.Open(GetServerCachePath(), key) || !server_cache_.ListCountry(*name, &servers)) {
+            result->Success();
+            return;
+          }
+          flutter::EncodableList values;
+          for (const CachedServer& server : servers) {
+            values.push_back(CachedServerValue(server));
+          }
+          result->Success(flutter::EncodableValue(std::move(values)));
+        } else if (call.method_name().compare("lookupServer") == 0) {
+          // {country, server} for the server with "uuid", or null.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          std::string key;
+          const std::string* uuid = args ? LookupString(*args, "uuid") : nullptr;
+          if (!args || !uuid || !LookupServerCacheKey(*args, &key)) {
+            result->Error("ARG_ERROR", "Missing 'key' or 'uuid' argument.");
+            return;
+          }
+          CachedServer server;
+          std::string country;
+          if (!server_cache_.Open(GetServerCachePath(), key) || !server_cache_.LookupServer(*uuid, &server, &country)) {
+            result->Success();
+            return;
+          }
+          flutter::EncodableMap value;
+          value[flutter::EncodableValue("country")] = flutter::EncodableValue(country);
+          value[flutter::EncodableValue("server")] = CachedServerValue(server);
+          result->Success(flutter::EncodableValue(std::move(value)));
+        } else if (call.method_name().compare("clearServerCache") == 0) {
+          if (server_cache_writer_.joinable()) {
+            server_cache_writer_.join();
+          }
+          server_cache_.Remove(GetServerCachePath());
+          result->Success();
+        } else if (call.method_name().compare("getStartupTrace") == 0) {
+          result->Success(flutter::EncodableValue(
+              ProcessStartupTrace().ToChromeTraceJson(static_cast<int64_t>(GetCurrentProcessId()))));
+        } else if (call.method_name().compare("getStartTimeline") == 0) {
+          // Phase values are microseconds after startedAt, -1 if not reached.
+          StartTimeline::Snapshot snapshot = process_manager_.timeline().snapshot();
+          flutter::EncodableMap phases;
+          for (size_t i = 0; i < kStartPhaseCount; i++) {
+            phases[flutter::EncodableValue(StartPhaseName(static_cast<StartPhase>(i)))] =
+                flutter::EncodableValue(snapshot.phase_us[i]);
+          }
+
+          flutter::EncodableMap response;
+          response[flutter::EncodableValue("startedAt")] = flutter::EncodableValue(snapshot.started_at_ms);
+          response[flutter::EncodableValue("phases")] = flutter::EncodableValue(std::move(phases));
+          result->Success(flutter::EncodableValue(std::move(response)));
+        } else if (call.method_name().compare("getTrafficHistory") == 0) {
+          // {seq, up, down, connections} with the recorded samples oldest
+          // first, seq numbering the newest.
+          uint64_t sequence = 0;
+          std::vector<TrafficSample> samples = traffic_sampler_.History(&sequence);
+          std::vector<int64_t> up;
+          std::vector<int64_t> down;
+          std::vector<int64_t> connections;
+          for (const TrafficSample& sample : samples) {
+            up.push_back(static_cast<int64_t>(sample.up));
+            down.push_back(static_cast<int64_t>(sample.down));
+            connections.push_back(sample.connections);
+          }
+          flutter::EncodableMap response;
+          response[flutter::EncodableValue("seq")] = flutter::EncodableValue(static_cast<int64_t>(sequence));
+          response[flutter::EncodableValue("up")] = flutter::EncodableValue(std::move(up));
+          response[flutter::EncodableValue("down")] = flutter::EncodableValue(std::move(down));
+          response[flutter::EncodableValue("connections")] = flutter::EncodableValue(std::move(connections));
+          result->Success(flutter::EncodableValue(std::move(response)));
+        } else if (call.method_name().compare("watchConnections") == 0) {
+          // {enabled}: while on, kConnectionDiff frames carry what changed
+          // in the open connections, starting with a reset that lists them
+          // all, at most once a second.
+          const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+          if (!args) {
+            result->Error("ARG_ERROR", "Invalid arguments");
+            return;
+          }
+          traffic_sampler_.TrackConnections(LookupBool(*args, "enabled"));
+          result->Success();
+        } else if (call.method_name().compare("clearLogs") == 0) {
+          if (log_handler_) {
+            log_handler_->FlushLogs();
+          }
+          log_store_.Clear();
+          log_journal_.Clear();
+          result->Success();
         } else if (call.method_name().compare("getIpAddress") == 0) {
-          std::string ip = GetLocalIpAddress();
+          const std::string& ip = network_monitor_.state().local_ip;
           if (!ip.empty()) {
             result->Success(flutter::EncodableValue(ip));
           } else {
@@ -178,23 +758,50 @@ bool FlutterWindow::OnCreate() {
       });
   
   // Set up log event channel
-  auto log_stream_handler = std::make_unique<LogStreamHandler>();
+  std::filesystem::path app_data_directory = GetAppDataDirectory();
+  if (!app_data_directory.empty() && log_journal_.Open(app_data_directory / L"logs")) {
+    // Bring back the previous sessions' logs.
+    log_journal_.Read(0, [this](const char* data, size_t size) { log_store_.Append(data, size); });
+  }
+  events_ = std::make_unique<BinaryEventChannel>(flutter_controller_->engine()->messenger());
+  auto log_stream_handler = std::make_unique<LogStreamHandler>(events_.get(), &log_ring_, &log_store_, &log_journal_);
   log_handler_ = log_stream_handler.get();
   log_channel_ = std::make_unique<flutter::EventChannel<flutter::EncodableValue>>(
       flutter_controller_->engine()->messenger(), "com.hwl.hwl-vpn/logs",
       &flutter::StandardMethodCodec::GetInstance());
   log_channel_->SetStreamHandler(std::move(log_stream_handler));
 
-  process_manager_.SetLogCallback([hwnd = GetHandle()](const std::string& log) {
-    char* log_str = new char[log.length() + 1];
-    strcpy_s(log_str, log.length() + 1, log.c_str());
-    PostMessage(hwnd, WM_LOG_MESSAGE, reinterpret_cast<WPARAM>(log_str), 0);
+  // Batches go out on a timer, or as soon as the ring passes the high-water
+  // mark during a burst of debug output.
+  process_manager_.SetLogRing(&log_ring_);
+  log_ring_.SetWakeCallback(kLogHighWaterBytes, [hwnd = GetHandle()]() {
+    PostMessage(hwnd, WM_LOG_MESSAGE, 0, 0);
+  });
+  SetTimer(GetHandle(), kLogFlushTimerId, kLogFlushIntervalMs, nullptr);
+
+  network_monitor_.Start(GetHandle());
+
+  process_manager_.SetLogCallback([this](const std::string& log) {
+    if (log_handler_) {
+      log_handler_->SendLog(log);
+    }
   });
 
+  ProcessStartupTrace().Mark(StartupStage::kChannelReady);
+
   SetChildContent(flutter_controller_->view()->GetNativeWindow());
 
   flutter_controller_->engine()->SetNextFrameCallback([&]() {
     this->Show();
+
+    StartupTrace& trace = ProcessStartupTrace();
+    if (!trace.Mark(StartupStage::kFirstFrame)) {
+      return;
+    }
+    DumpStartupTrace(false);
+    if (!trace.complete() && !GetEnvironmentString(L"HWL_STARTUP_TRACE").empty()) {
+      SetTimer(GetHandle(), kStartupTraceTimerId, kStartupTraceWaitMs, nullptr);
+    }
   });
 
   flutter_controller_->ForceRedraw();
@@ -203,6 +810,14 @@ bool FlutterWindow::OnCreate() {
 }
 
 void FlutterWindow::OnDestroy() {
+  KillTimer(GetHandle(), kLogFlushTimerId);
+  KillTimer(GetHandle(), kNetworkSettleTimerId);
+  KillTimer(GetHandle(), kStartupTraceTimerId);
+  if (server_cache_writer_.joinable()) {
+    server_cache_writer_.join();
+  }
+  network_monitor_.Stop();
+  traffic_sampler_.Stop();
   process_manager_.Stop();
   if (flutter_controller_) {
     flutter_controller_ = nullptr;
@@ -211,6 +826,141 @@ void FlutterWindow::OnDestroy() {
   Win32Window::OnDestroy();
 }
 
+void FlutterWindow::InvokeNetworkChanged(uint32_t changes) {
+  const NetworkState& state = network_monitor_.state();
+  flutter::EncodableList kinds;
+  if (changes & kNetworkAddressChanged) {
+    kinds.push_back(flutter::EncodableValue("address"));
+  }
+  if (changes & kNetworkGatewayChanged) {
+    kinds.push_back(flutter::EncodableValue("gateway"));
+  }
+  if (changes & kNetworkLinkChanged) {
+    kinds.push_back(flutter::EncodableValue("link"));
+  }
+  flutter::EncodableMap args;
+  args[flutter::EncodableValue("ip")] = flutter::EncodableValue(state.local_ip);
+  args[flutter::EncodableValue("gateway")] = flutter::EncodableValue(state.gateway);
+  args[flutter::EncodableValue("interface")] = flutter::EncodableValue(state.interface_name);
+  args[flutter::EncodableValue("changes")] = flutter::EncodableValue(std::move(kinds));
+  channel_->InvokeMethod("onNetworkChanged", std::make_unique<flutter::EncodableValue>(std::move(args)));
+}
+
+bool FlutterWindow::ResolveConfig(const flutter::EncodableMap& args, std::string* config, std::string* error) {
+  if (const std::string* ready = LookupString(args, "config")) {
+    *config = *ready;
+    return true;
+  }
+  const std::string* link = LookupString(args, "link");
+  auto settings_it = args.find(flutter::EncodableValue("settings"));
+  const auto* settings_map =
+      link && settings_it != args.end() ? std::get_if<flutter::EncodableMap>(&settings_it->second) : nullptr;
+  if (!settings_map) {
+    *error = "Missing 'config' argument.";
+    return false;
+  }
+
+  ConfigSettings settings;
+  const std::string* dns_provider = LookupString(*settings_map, "dns_provider");
+  settings.dns_provider = dns_provider ? *dns_provider : "";
+  dns_auto_ = settings.dns_provider == kAutoDnsProvider;
+  if (dns_auto_) {
+    // Google's until a benchmark picks a winner for this network.
+    settings.dns_provider = dns_auto_selector_.Winner(CurrentDnsNetwork());
+  }
+  settings.enable_logging = LookupBool(*settings_map, "enable_logging");
+  settings.use_mixed_inbound = LookupBool(*settings_map, "use_mixed_inbound");
+  const std::string* listen_address = LookupString(*settings_map, "mixed_inbound_listen_address");
+  settings.mixed_inbound_listen_address = listen_address ? *listen_address : "";
+  settings.mixed_inbound_listen_port = LookupInt(*settings_map, "mixed_inbound_listen_port", 0);
+  dns_proxy_ip_.clear();
+  dns_proxy_port_ = 0;
+  if (settings.use_mixed_inbound) {
+    dns_proxy_ip_ = MixedInboundDialAddress(settings.mixed_inbound_listen_address);
+    dns_proxy_port_ = static_cast<uint16_t>(std::clamp<int64_t>(settings.mixed_inbound_listen_port, 0, 65535));
+  }
+  RefreshDnsAuto();
+  settings.excluded_domains = LookupStringList(*settings_map, "excluded_domains");
+  settings.excluded_domain_suffixes = LookupStringList(*settings_map, "excluded_domain_suffixes");
+  settings.clash_api_port = LookupInt(*settings_map, "clash_api_port", 0);
+  settings.clash_api_secret = clash_api_secret_;
+  std::filesystem::path app_data_directory = GetAppDataDirectory();
+  if (!app_data_directory.empty()) {
+    settings.rule_set_directory = app_data_directory / L"rule-sets";
+  }
+  return config_builder_.Build(settings, *link, config, error);
+}
+
+std::string FlutterWindow::CurrentDnsNetwork() {
+  const NetworkState& state = network_monitor_.state();
+  return DnsNetworkKey(state.interface_name, state.gateway);
+}
+
+bool FlutterWindow::StartDnsBenchmark(DnsBenchOptions options) {
+  bool connected = process_manager_.IsRunning();
+  options.direct = !connected;
+  if (!connected) {
+    options.proxy_port = 0;
+  }
+  std::chrono::milliseconds timeout = options.timeout;
+  if (!dns_benchmarker_.Start(std::move(options))) {
+    return false;
+  }
+  dns_bench_network_ = CurrentDnsNetwork();
+  dns_bench_connected_ = connected;
+  dns_bench_timeout_ = timeout;
+  return true;
+}
+
+void FlutterWindow::RefreshDnsAuto() {
+  if (!dns_auto_ || !dns_auto_selector_.Winner(CurrentDnsNetwork()).empty()) {
+    return;
+  }
+  DnsBenchOptions options;
+  // sing-box asks its server over TCP.
+  options.udp = false;
+  options.proxy_ip = dns_proxy_ip_;
+  options.proxy_port = dns_proxy_port_;
+  if (process_manager_.IsRunning() && options.proxy_port == 0) {
+    // Nothing can be measured until the next disconnect.
+    return;
+  }
+  // A busy benchmarker is fine; the next change asks again.
+  StartDnsBenchmark(std::move(options));
+}
+
+void FlutterWindow::FinishReload(const std::string& error) {
+  if (!pending_reload_) {
+    return;
+  }
+  ReloadResult reload = std::move(reload_result_);
+  reload.error = error;
+  reload.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - reload_begin_).count();
+  if (log_handler_) {
+    log_handler_->SendLog(DescribeReloadResult(reload));
+  }
+  pending_reload_->Success(ReloadResultValue(reload));
+  pending_reload_ = nullptr;
+}
+
+void FlutterWindow::DumpStartupTrace(bool give_up) {
+  std::wstring path = GetEnvironmentString(L"HWL_STARTUP_TRACE");
+  if (path.empty()) {
+    return;
+  }
+  StartupTrace& trace = ProcessStartupTrace();
+  std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+  file << trace.ToChromeTraceJson(static_cast<int64_t>(GetCurrentProcessId()));
+  file.close();
+  if (!file && log_handler_) {
+    log_handler_->SendLog("⚠️ Could not write the startup trace.\n");
+  }
+  if ((trace.complete() || give_up) && GetEnvironmentString(L"HWL_STARTUP_TRACE_QUIT") == L"1") {
+    PostMessage(GetHandle(), WM_CLOSE, 0, 0);
+  }
+}
+
 LRESULT
 FlutterWindow::MessageHandler(HWND hwnd, UINT const message,
                               WPARAM const wparam,
@@ -226,16 +976,167 @@ FlutterWindow::MessageHandler(HWND hwnd, UINT const message,
 
   switch (message) {
     case WM_PROCESS_TERMINATED:
+      FinishReload("sing-box exited.");
+      traffic_sampler_.Stop();
       channel_->InvokeMethod("onVpnStopped", nullptr);
       return 0;
-    case WM_LOG_MESSAGE: {
-      char* log_str = reinterpret_cast<char*>(wparam);
+    case WM_PROCESS_READY:
+      if (log_handler_) {
+        std::string timeline = process_manager_.timeline().Describe();
+        log_handler_->SendLog(wparam ? "⏱️ sing-box is ready: " + timeline + "\n"
+                                     : "⚠️ No readiness signal from sing-box: " + timeline + "\n");
+      }
+      traffic_sampler_.Start(process_manager_.api_port(), process_manager_.api_secret());
+      channel_->InvokeMethod("updateStatus", std::make_unique<flutter::EncodableValue>("Started"));
+      RefreshDnsAuto();
+      FinishReload(std::string());
+      return 0;
+    case WM_PROCESS_RESTART: {
+      std::unique_ptr<RestartEvent> event(reinterpret_cast<RestartEvent*>(lparam));
       if (log_handler_) {
-          log_handler_->SendLog(log_str);
+        log_handler_->SendLog(DescribeRestartEvent(*event));
       }
-      delete[] log_str;
+      if (event->kind == RestartEvent::Kind::kScheduled) {
+        traffic_sampler_.Stop();
+      }
+      channel_->InvokeMethod("onVpnRestart", std::make_unique<flutter::EncodableValue>(RestartEventValue(*event)));
       return 0;
     }
+    case WM_PROBE_RESULT: {
+      std::unique_ptr<ProbeResult> probe(reinterpret_cast<ProbeResult*>(lparam));
+      events_->frames()->AppendProbeResult(probe->id, probe->rtt_us);
+      if (probe->batch_done) {
+        // Dart has every result by the time the call completes.
+        events_->Flush();
+        auto pending = pending_probes_.find(probe->batch);
+        if (pending != pending_probes_.end()) {
+          pending->second->Success();
+          pending_probes_.erase(pending);
+        }
+      }
+      return 0;
+    }
+    case WM_NETWORK_CHANGED:
+      // Restarting the timer coalesces a burst, such as a Wi-Fi reconnect,
+      // into one refresh.
+      SetTimer(hwnd, kNetworkSettleTimerId, kNetworkSettleMs, nullptr);
+      return 0;
+    case WM_SERVER_CACHE_WRITTEN: {
+      std::unique_ptr<ServerCacheWrite> save(reinterpret_cast<ServerCacheWrite*>(lparam));
+      bool saved = save->written && server_cache_.Replace(save->file, GetServerCachePath(), save->key);
+      auto pending = pending_server_cache_writes_.find(save->id);
+      if (pending != pending_server_cache_writes_.end()) {
+        pending->second->Success(flutter::EncodableValue(saved));
+        pending_server_cache_writes_.erase(pending);
+      }
+      return 0;
+    }
+    case WM_TRAFFIC_SAMPLE: {
+      // Differences from the previous sample, or absolute values when key
+      // is set. It goes out with the next log flush.
+      std::unique_ptr<TrafficDelta> delta(reinterpret_cast<TrafficDelta*>(lparam));
+      events_->frames()->AppendTrafficSample(*delta);
+      return 0;
+    }
+    case WM_CONNECTION_DIFF: {
+      // It goes out with the next log flush.
+      std::unique_ptr<ConnectionDiff> diff(reinterpret_cast<ConnectionDiff*>(lparam));
+      events_->frames()->AppendConnectionDiff(*diff);
+      return 0;
+    }
+    case WM_SPEED_TEST_EVENT: {
+      std::unique_ptr<SpeedTestEvent> event(reinterpret_cast<SpeedTestEvent*>(lparam));
+      if (!event->done) {
+        flutter::EncodableMap progress;
+        progress[flutter::EncodableValue("phase")] = flutter::EncodableValue(SpeedTestPhaseName(event->phase));
+        progress[flutter::EncodableValue("elapsedMs")] = flutter::EncodableValue(event->elapsed_ms);
+        progress[flutter::EncodableValue("bytes")] = flutter::EncodableValue(static_cast<int64_t>(event->bytes));
+        progress[flutter::EncodableValue("bps")] = flutter::EncodableValue(event->bps);
+        channel_->InvokeMethod("onSpeedTestProgress", std::make_unique<flutter::EncodableValue>(std::move(progress)));
+        return 0;
+      }
+      if (!pending_speed_test_) {
+        return 0;
+      }
+      if (event->results.empty() && !event->error.empty()) {
+        pending_speed_test_->Error("SPEED_TEST_FAILED", event->error);
+      } else {
+        flutter::EncodableList phases;
+        for (const SpeedTestResult& phase : event->results) {
+          phases.push_back(SpeedTestResultValue(phase));
+        }
+        flutter::EncodableMap response;
+        response[flutter::EncodableValue("phases")] = flutter::EncodableValue(std::move(phases));
+        response[flutter::EncodableValue("error")] =
+            event->error.empty() ? flutter::EncodableValue() : flutter::EncodableValue(event->error);
+        pending_speed_test_->Success(flutter::EncodableValue(std::move(response)));
+      }
+      pending_speed_test_ = nullptr;
+      return 0;
+    }
+    case WM_DNS_BENCH_DONE: {
+      std::unique_ptr<DnsBenchEvent> event(reinterpret_cast<DnsBenchEvent*>(lparam));
+      std::string winner = PickDnsProvider(event->results, dns_bench_timeout_);
+      if (dns_bench_connected_ != process_manager_.IsRunning()) {
+        // sing-box started or stopped underneath, so some runs went a
+        // different way than planned. Try again as things are now.
+        RefreshDnsAuto();
+      } else if (!winner.empty()) {
+        dns_auto_selector_.Record(dns_bench_network_, winner);
+        if (log_handler_) {
+          log_handler_->SendLog("🧭 Fastest DNS on " + dns_bench_network_ + ": " + winner + ".\n");
+        }
+      }
+      if (!pending_dns_bench_) {
+        return 0;
+      }
+      if (event->results.empty() && !event->error.empty()) {
+        pending_dns_bench_->Error("DNS_BENCH_FAILED", event->error);
+      } else {
+        flutter::EncodableList results;
+        for (const DnsBenchResult& run : event->results) {
+          results.push_back(DnsBenchResultValue(run));
+        }
+        flutter::EncodableMap response;
+        response[flutter::EncodableValue("results")] = flutter::EncodableValue(std::move(results));
+        response[flutter::EncodableValue("winner")] =
+            winner.empty() ? flutter::EncodableValue() : flutter::EncodableValue(winner);
+        response[flutter::EncodableValue("network")] = flutter::EncodableValue(dns_bench_network_);
+        response[flutter::EncodableValue("error")] =
+            event->error.empty() ? flutter::EncodableValue() : flutter::EncodableValue(event->error);
+        pending_dns_bench_->Success(flutter::EncodableValue(std::move(response)));
+      }
+      pending_dns_bench_ = nullptr;
+      return 0;
+    }
+    case WM_LOG_MESSAGE:
+      if (log_handler_) {
+          log_handler_->FlushLogs();
+      }
+      return 0;
+    case WM_TIMER:
+      if (wparam == kLogFlushTimerId) {
+        if (log_handler_) {
+            log_handler_->FlushLogs();
+        }
+        return 0;
+      }
+      if (wparam == kNetworkSettleTimerId) {
+        KillTimer(hwnd, kNetworkSettleTimerId);
+        uint32_t changes = network_monitor_.Refresh();
+        if (changes != 0) {
+          InvokeNetworkChanged(changes);
+          RefreshDnsAuto();
+        }
+        return 0;
+      }
+      if (wparam == kStartupTraceTimerId) {
+        // The first Dart call never came.
+        KillTimer(hwnd, kStartupTraceTimerId);
+        DumpStartupTrace(true);
+        return 0;
+      }
+      break;
     case WM_FONTCHANGE:
       flutter_controller_->engine()->ReloadSystemFonts();
       break;
@@ -7,14 +7,44 @@
 #include <flutter/event_channel.h>
 #include <flutter/standard_method_codec.h>
 
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 #include "win32_window.h"
+#include "binary_event_channel.h"
+#include "clash_api.h"
+#include "config_builder.h"
+#include "dns_bench.h"
+#include "dns_benchmarker.h"
+#include "latency_prober.h"
+#include "network_monitor.h"
 #include "process_manager.h"
 #include "log_stream_handler.h"
+#include "server_cache.h"
+#include "speed_tester.h"
+#include "startup_trace.h"
+#include "traffic_sampler.h"
 
+// Posted by the stdout thread when the log ring passes its high-water mark.
 #define WM_LOG_MESSAGE (WM_APP + 2)
 
+// Posted by the server cache writer thread. lParam is a ServerCacheWrite*
+// the window owns from then on.
+#define WM_SERVER_CACHE_WRITTEN (WM_APP + 6)
+
+struct ServerCacheWrite {
+  uint64_t id = 0;
+  // Whether the temporary |file| was written completely.
+  bool written = false;
+  std::filesystem::path file;
+  std::string key;
+};
+
 // A window that does nothing but host a Flutter view.
 class FlutterWindow : public Win32Window {
  public:
@@ -30,18 +60,108 @@ class FlutterWindow : public Win32Window {
                          LPARAM const lparam) noexcept override;
 
  private:
+  // Sends onNetworkChanged {ip, gateway, interface, changes}.
+  void InvokeNetworkChanged(uint32_t changes);
+  // Reads the sing-box config from |args|: either a ready "config" string
+  // or a "link" with the "settings" map VpnService builds, turned into a
+  // config by the config builder. Returns false with |error| set when
+  // neither is usable.
+  bool ResolveConfig(const flutter::EncodableMap& args, std::string* config, std::string* error);
+  // The network "auto" DNS winners are kept for.
+  std::string CurrentDnsNetwork();
+  // Benchmarks the DNS providers; WM_DNS_BENCH_DONE keeps the winner for
+  // the current network. While sing-box runs the TUN would hijack direct
+  // queries, so only tunnel runs are made then, and those need the mixed
+  // inbound in |options|. Returns false while another benchmark runs.
+  bool StartDnsBenchmark(DnsBenchOptions options);
+  // Benchmarks in the background when "auto" is in use and the current
+  // network has no winner yet. The winner takes effect with the next start
+  // or switch.
+  void RefreshDnsAuto();
+  // Answers the pending reloadConfig call.
+  void FinishReload(const std::string& error);
+  // Writes the startup trace to the file named by HWL_STARTUP_TRACE, if
+  // set, and closes the window when HWL_STARTUP_TRACE_QUIT is 1 and the
+  // trace is complete or |give_up|, so CI can time cold starts.
+  void DumpStartupTrace(bool give_up);
+
   // The project to run.
   flutter::DartProject project_;
 
   // The Flutter instance hosted by this window.
   std::unique_ptr<flutter::FlutterViewController> flutter_controller_;
 
+  // sing-box output, drained in batches on the platform thread. Declared
+  // before the process manager so it outlives the stdout thread.
+  LogRing log_ring_;
+
+  // Bounded history Dart pages through with getLogs.
+  LogStore log_store_;
+
+  // On-disk copy of the history that survives restarts.
+  LogJournal log_journal_;
+
   // The process manager for sing-box.
   ProcessManager process_manager_;
 
+  // A reloadConfig that replaced the process, answered on WM_PROCESS_READY.
+  std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> pending_reload_;
+  ReloadResult reload_result_;
+  std::chrono::steady_clock::time_point reload_begin_;
+
+  // Builds sing-box configs from a share link and the user settings.
+  ConfigBuilder config_builder_;
+  // Required by the Clash API of every config built; random per run.
+  std::string clash_api_secret_ = RandomClashApiSecret();
+
+  // Measures server round trips for probeServers, which completes once the
+  // batch's last WM_PROBE_RESULT arrives.
+  LatencyProber latency_prober_;
+  std::unordered_map<uint64_t, std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>>> pending_probes_;
+
+  // Cached address for getIpAddress, refreshed once WM_NETWORK_CHANGED
+  // notifications settle.
+  NetworkMonitor network_monitor_;
+
+  // The mapped country list behind listCountries, listCountry and
+  // lookupServer. saveServerCache completes once WM_SERVER_CACHE_WRITTEN
+  // has moved the new file into place.
+  ServerCache server_cache_;
+  std::thread server_cache_writer_;
+  uint64_t next_server_cache_write_ = 0;
+  std::unordered_map<uint64_t, std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>>> pending_server_cache_writes_;
+
+  // Measures throughput through the mixed inbound for runSpeedTest, which
+  // completes once the final WM_SPEED_TEST_EVENT arrives.
+  SpeedTester speed_tester_;
+  std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> pending_speed_test_;
+
+  // Measures DNS providers for benchmarkDns, which completes once
+  // WM_DNS_BENCH_DONE arrives, and in the background for the "auto"
+  // provider. The dns_bench_ fields describe the running benchmark.
+  DnsBenchmarker dns_benchmarker_;
+  DnsAutoSelector dns_auto_selector_;
+  std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> pending_dns_bench_;
+  std::string dns_bench_network_;
+  bool dns_bench_connected_ = false;
+  std::chrono::milliseconds dns_bench_timeout_{0};
+  // From the latest resolved settings: whether they asked for "auto", and
+  // where their mixed inbound listens (port 0 without one).
+  bool dns_auto_ = false;
+  std::string dns_proxy_ip_;
+  uint16_t dns_proxy_port_ = 0;
+
+  // Follows the running sing-box's Clash API from readiness until it stops
+  // and queues each WM_TRAFFIC_SAMPLE as a frame on |events_|.
+  TrafficSampler traffic_sampler_;
+
   // The method channel for communication with Dart.
   std::unique_ptr<flutter::MethodChannel<flutter::EncodableValue>> channel_;
 
+  // The raw channel for log batches, traffic samples and probe results.
+  // Flushed with every log flush.
+  std::unique_ptr<BinaryEventChannel> events_;
+
   // The event channel for logs.
   std::unique_ptr<flutter::EventChannel<flutter::EncodableValue>> log_channel_;
   LogStreamHandler* log_handler_ = nullptr;
@@ -0,0 +1,233 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "latency_prober.h"
+#include <algorithm>
+
+namespace {
+    // Upper bound on a WSAPoll wait, so new batches start promptly.
+    constexpr int kIdlePollMs = 20;
+    constexpr size_t kMaxResponse = 64;
+
+    int64_t MicrosecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Fills |address| from an IPv4 or IPv6 literal.
+    bool ParseAddress(const std::string& ip, uint16_t port, sockaddr_storage* address, int* length) {
+        auto* v4 = reinterpret_cast<sockaddr_in*>(address);
+        if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port = htons(port);
+            *length = sizeof(sockaddr_in);
+            return true;
+        }
+        auto* v6 = reinterpret_cast<sockaddr_in6*>(address);
+        if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = htons(port);
+            *length = sizeof(sockaddr_in6);
+            return true;
+        }
+        return false;
+    }
+}
+
+LatencyProber::LatencyProber() {
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+}
+
+LatencyProber::~LatencyProber() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    if (worker_.joinable()) worker_.join();
+    WSACleanup();
+}
+
+void LatencyProber::SetMainWindowHandle(HWND hwnd) {
+    main_window_handle_ = hwnd;
+}
+
+uint64_t LatencyProber::Probe(std::vector<ProbeTarget> targets, std::chrono::milliseconds timeout) {
+    uint64_t batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch = next_batch_++;
+        remaining_[batch] = targets.size();
+        for (ProbeTarget& target : targets) {
+            Attempt attempt;
+            attempt.target = std::move(target);
+            attempt.batch = batch;
+            attempt.timeout = timeout;
+            queued_.push_back(std::move(attempt));
+        }
+        if (!worker_.joinable()) {
+            worker_ = std::thread(&LatencyProber::Run, this);
+        }
+    }
+    wake_.notify_one();
+    return batch;
+}
+
+void LatencyProber::Run() {
+    std::vector<Attempt> in_flight;
+    std::vector<WSAPOLLFD> poll_fds;
+    while (!stopping_) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (in_flight.empty()) {
+                wake_.wait(lock, [this]() { return stopping_ || !queued_.empty(); });
+            }
+            while (!queued_.empty() && in_flight.size() < kMaxInFlight) {
+                Attempt attempt = std::move(queued_.front());
+                queued_.pop_front();
+                lock.unlock();
+                if (Begin(&attempt)) {
+                    in_flight.push_back(std::move(attempt));
+                } else {
+                    Report(attempt, kProbeFailed);
+                }
+                lock.lock();
+            }
+        }
+        if (in_flight.empty()) {
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto earliest = std::min_element(in_flight.begin(), in_flight.end(), [](const Attempt& a, const Attempt& b) {
+            return a.deadline < b.deadline;
+        })->deadline;
+        int wait_ms = static_cast<int>(std::clamp<int64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(earliest - now).count(), 0, kIdlePollMs));
+        poll_fds.clear();
+        for (const Attempt& attempt : in_flight) {
+            bool connecting = attempt.target.protocol != ProbeProtocol::kQuic && attempt.connect_us == kProbeFailed;
+            poll_fds.push_back({attempt.socket, static_cast<short>(connecting ? POLLWRNORM : POLLRDNORM), 0});
+        }
+        WSAPoll(poll_fds.data(), static_cast<ULONG>(poll_fds.size()), wait_ms);
+
+        // Failed connects are only reported by WSAPoll on Windows 10 2004
+        // and later; on older systems they run into the deadline instead.
+        now = std::chrono::steady_clock::now();
+        size_t kept = 0;
+        for (size_t i = 0; i < in_flight.size(); i++) {
+            Attempt& attempt = in_flight[i];
+            int64_t rtt_us = kProbeFailed;
+            bool finished = attempt.deadline <= now;
+            if (!finished && poll_fds[i].revents != 0) {
+                finished = OnReady(&attempt, poll_fds[i].revents, &rtt_us);
+            }
+            if (finished) {
+                closesocket(attempt.socket);
+                Report(attempt, rtt_us);
+            } else if (kept != i) {
+                in_flight[kept++] = std::move(attempt);
+            } else {
+                kept++;
+            }
+        }
+        in_flight.resize(kept);
+    }
+    for (Attempt& attempt : in_flight) {
+        closesocket(attempt.socket);
+    }
+}
+
+bool LatencyProber::Begin(Attempt* attempt) {
+    sockaddr_storage address = {};
+    int length = 0;
+    if (attempt->target.port == 0 || !ParseAddress(attempt->target.ip, attempt->target.port, &address, &length)) {
+        return false;
+    }
+    bool datagram = attempt->target.protocol == ProbeProtocol::kQuic;
+    SOCKET probe = socket(address.ss_family, datagram ? SOCK_DGRAM : SOCK_STREAM, datagram ? IPPROTO_UDP : IPPROTO_TCP);
+    if (probe == INVALID_SOCKET) {
+        return false;
+    }
+    u_long non_blocking = 1;
+    ioctlsocket(probe, FIONBIO, &non_blocking);
+    attempt->started = std::chrono::steady_clock::now();
+    attempt->deadline = attempt->started + attempt->timeout;
+    if (connect(probe, reinterpret_cast<sockaddr*>(&address), length) != 0 && WSAGetLastError() != WSAEWOULDBLOCK) {
+        closesocket(probe);
+        return false;
+    }
+    if (datagram) {
+        // A connected UDP socket turns an ICMP port unreachable into
+        // WSAECONNRESET on the next recv.
+        std::string packet = BuildQuicVersionProbe();
+        if (send(probe, packet.data(), static_cast<int>(packet.size()), 0) == SOCKET_ERROR) {
+            closesocket(probe);
+            return false;
+        }
+    }
+    attempt->socket = probe;
+    return true;
+}
+
+bool LatencyProber::OnReady(Attempt* attempt, short revents, int64_t* rtt_us) {
+    bool connecting = attempt->target.protocol != ProbeProtocol::kQuic && attempt->connect_us == kProbeFailed;
+    if (connecting) {
+        if ((revents & (POLLERR | POLLHUP)) != 0) {
+            return true;
+        }
+        attempt->connect_us = MicrosecondsSince(attempt->started);
+        if (attempt->target.protocol == ProbeProtocol::kTcp) {
+            *rtt_us = attempt->connect_us;
+            return true;
+        }
+        // The ClientHello is far below the socket buffer, so one send does it.
+        std::string hello = BuildTlsClientHello(attempt->target.sni);
+        return send(attempt->socket, hello.data(), static_cast<int>(hello.size()), 0) !=
+               static_cast<int>(hello.size());
+    }
+
+    uint8_t buffer[kMaxResponse];
+    int received = recv(attempt->socket, reinterpret_cast<char*>(buffer), static_cast<int>(sizeof(buffer)), 0);
+    if (received == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+        return false;
+    }
+    if (received <= 0) {
+        return true;
+    }
+    size_t size = static_cast<size_t>(received);
+    if (attempt->target.protocol == ProbeProtocol::kQuic) {
+        // Other datagrams are not an answer to the probe; keep waiting.
+        if (!IsQuicVersionNegotiation(buffer, size)) {
+            return false;
+        }
+        *rtt_us = MicrosecondsSince(attempt->started);
+        return true;
+    }
+    attempt->response.append(reinterpret_cast<const char*>(buffer), size);
+    if (attempt->response.size() < 3) {
+        return false;
+    }
+    if (IsTlsRecord(reinterpret_cast<const uint8_t*>(attempt->response.data()), attempt->response.size())) {
+        *rtt_us = attempt->connect_us;
+    }
+    return true;
+}
+
+void LatencyProber::Report(const Attempt& attempt, int64_t rtt_us) {
+    bool batch_done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch_done = --remaining_[attempt.batch] == 0;
+        if (batch_done) {
+            remaining_.erase(attempt.batch);
+        }
+    }
+    if (!main_window_handle_) {
+        return;
+    }
+    auto* result = new ProbeResult{attempt.batch, attempt.target.id, rtt_us, batch_done};
+    if (!PostMessage(main_window_handle_, WM_PROBE_RESULT, 0, reinterpret_cast<LPARAM>(result))) {
+        delete result;
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "latency_probe.h"
+
+// Posted once per probed target. lParam is a ProbeResult* the window owns
+// from then on.
+#define WM_PROBE_RESULT (WM_APP + 4)
+
+struct ProbeResult {
+    uint64_t batch;
+    std::string id;
+    // Microseconds, or kProbeFailed.
+    int64_t rtt_us;
+    // Whether this was the last result of |batch|.
+    bool batch_done;
+};
+
+// Measures round trips to many servers at once.
+//
+// One worker thread keeps up to kMaxInFlight non-blocking sockets open and
+// waits on all of them with WSAPoll, so a country's servers are probed in
+// parallel and each result is posted as soon as it is known.
+class LatencyProber {
+public:
+    LatencyProber();
+    ~LatencyProber();
+
+    void SetMainWindowHandle(HWND hwnd);
+    // Queues |targets|, which must not be empty, and returns the batch id
+    // their results carry. Target addresses must be IP literals; names are
+    // reported as failed.
+    uint64_t Probe(std::vector<ProbeTarget> targets, std::chrono::milliseconds timeout);
+
+private:
+    static constexpr size_t kMaxInFlight = 256;
+
+    struct Attempt {
+        ProbeTarget target;
+        uint64_t batch = 0;
+        std::chrono::milliseconds timeout{0};
+        SOCKET socket = INVALID_SOCKET;
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point deadline;
+        // TCP connect time, the result of a TLS probe once the server answers.
+        int64_t connect_us = kProbeFailed;
+        std::string response;
+    };
+
+    void Run();
+    // Opens the socket for |attempt|; false when it cannot be probed.
+    bool Begin(Attempt* attempt);
+    // Handles readiness on |attempt|; true once it has a result in |rtt_us|.
+    bool OnReady(Attempt* attempt, short revents, int64_t* rtt_us);
+    void Report(const Attempt& attempt, int64_t rtt_us);
+
+    HWND main_window_handle_ = nullptr;
+    std::thread worker_;
+    std::atomic<bool> stopping_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Attempt> queued_;
+    uint64_t next_batch_ = 1;
+    // Results still owed per batch.
+    std::unordered_map<uint64_t, size_t> remaining_;
+};
@@ -1,21 +1,43 @@
 #include "log_stream_handler.h"
 
-LogStreamHandler::LogStreamHandler() : sink_(nullptr) {}
+LogStreamHandler::LogStreamHandler(BinaryEventChannel* events, LogRing* ring, LogStore* store, LogJournal* journal)
+    : sink_(nullptr), events_(events), ring_(ring), store_(store), journal_(journal) {}
 
 LogStreamHandler::~LogStreamHandler() {}
 
 void LogStreamHandler::SendLog(const std::string& log) {
+    FlushLogs();
+    store_->AppendLine(log);
+    std::string line = log.empty() || log.back() != '\n' ? log + "\n" : log;
+    journal_->Append(line.data(), line.size());
+    journal_->Commit();
     if (sink_) {
-        // The event sink must be used on the platform thread
-        // We can't directly call it from our logging thread.
-        // A more robust solution would use a message queue,
-        // but for this case, we'll assume the caller (FlutterWindow)
-        // handles the thread switching if necessary. In our case,
-        // we'll post a message to the window.
         sink_->Success(flutter::EncodableValue(log));
     }
 }
 
+void LogStreamHandler::FlushLogs() {
+    // Lines go straight from the ring into the outgoing message.
+    EventFrameWriter* frames = events_->frames();
+    frames->BeginFrame(EventKind::kLogBatch);
+    size_t lines = ring_->Drain([this, frames](const char* data, size_t size) {
+        store_->Append(data, size);
+        journal_->Append(data, size);
+        if (sink_) {
+            frames->PutBytes(data, size);
+        }
+    });
+    if (lines > 0) {
+        journal_->Commit();
+    }
+    if (frames->frame_size() > 0) {
+        frames->EndFrame();
+    } else {
+        frames->CancelFrame();
+    }
+    events_->Flush();
+}
+
 std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>> LogStreamHandler::OnListenInternal(
     const flutter::EncodableValue* arguments,
     std::unique_ptr<flutter::EventSink<flutter::EncodableValue>>&& events) {
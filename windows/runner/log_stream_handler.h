@@ -4,13 +4,30 @@
 #include <flutter/event_stream_handler.h>
 #include <flutter/standard_method_codec.h>
 
+#include "binary_event_channel.h"
+#include "log_journal.h"
+#include "log_ring.h"
+#include "log_store.h"
+
+// sing-box output is sent in batches: every line published to the ring since
+// the last flush goes out as one kLogBatch frame on the |BinaryEventChannel|,
+// which is flushed with it; the event channel itself carries the runner's
+// status messages. Everything sent is also kept in the bounded |LogStore| and
+// written to the |LogJournal|, whether or not Dart is listening. Platform
+// thread only.
 class LogStreamHandler : public flutter::StreamHandler<flutter::EncodableValue> {
 public:
-    LogStreamHandler();
+    LogStreamHandler(BinaryEventChannel* events, LogRing* ring, LogStore* store, LogJournal* journal);
     ~LogStreamHandler() override;
 
+    // Sends a runner status message. Pending ring output is flushed first so
+    // ordering is preserved.
     void SendLog(const std::string& log);
 
+    // Drains the ring into the store and a single frame, and flushes the
+    // event channel.
+    void FlushLogs();
+
 protected:
     std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>> OnListenInternal(
         const flutter::EncodableValue* arguments,
@@ -21,4 +38,8 @@ protected:
 
 private:
     std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> sink_;
+    BinaryEventChannel* events_;
+    LogRing* ring_;
+    LogStore* store_;
+    LogJournal* journal_;
 };
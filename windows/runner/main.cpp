@@ -3,10 +3,13 @@
 #include <windows.h>
 
 #include "flutter_window.h"
+#include "startup_trace.h"
 #include "utils.h"
 
 int APIENTRY wWinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE prev,
                       _In_ wchar_t *command_line, _In_ int show_command) {
+  ProcessStartupTrace().Mark(StartupStage::kMainEntry);
+
   // Attach to console when present (e.g., 'flutter run') or create a
   // new console when running with a debugger.
   if (!::AttachConsole(ATTACH_PARENT_PROCESS) && ::IsDebuggerPresent()) {
@@ -0,0 +1,193 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+
+#include "network_monitor.h"
+#include <algorithm>
+#include <climits>
+#include <memory>
+
+#include "utils.h"
+
+namespace {
+    // Runs on an IP Helper thread; the window does the work.
+    void PostChange(HWND hwnd) {
+        if (hwnd) {
+            PostMessage(hwnd, WM_NETWORK_CHANGED, 0, 0);
+        }
+    }
+
+    VOID NETIOAPI_API_ OnAddressChange(PVOID context, PMIB_UNICASTIPADDRESS_ROW, MIB_NOTIFICATION_TYPE) {
+        PostChange(static_cast<HWND>(context));
+    }
+
+    VOID NETIOAPI_API_ OnRouteChange(PVOID context, PMIB_IPFORWARD_ROW2, MIB_NOTIFICATION_TYPE) {
+        PostChange(static_cast<HWND>(context));
+    }
+
+    VOID NETIOAPI_API_ OnInterfaceChange(PVOID context, PMIB_IPINTERFACE_ROW, MIB_NOTIFICATION_TYPE) {
+        PostChange(static_cast<HWND>(context));
+    }
+
+    // The first IPv4 address in |addresses|, or empty.
+    std::string FirstIpv4(const IP_ADAPTER_UNICAST_ADDRESS* addresses) {
+        for (const IP_ADAPTER_UNICAST_ADDRESS* p_unicast = addresses; p_unicast != NULL; p_unicast = p_unicast->Next) {
+            if (p_unicast->Address.lpSockaddr->sa_family == AF_INET) {
+                char ip_str[INET_ADDRSTRLEN];
+                sockaddr_in* sai = reinterpret_cast<sockaddr_in*>(p_unicast->Address.lpSockaddr);
+                if (inet_ntop(AF_INET, &(sai->sin_addr), ip_str, INET_ADDRSTRLEN) != NULL) {
+                    return ip_str;
+                }
+            }
+        }
+        return "";
+    }
+
+    std::string FirstIpv4Gateway(const IP_ADAPTER_GATEWAY_ADDRESS_LH* gateways) {
+        for (const IP_ADAPTER_GATEWAY_ADDRESS_LH* gateway = gateways; gateway != NULL; gateway = gateway->Next) {
+            if (gateway->Address.lpSockaddr->sa_family == AF_INET) {
+                char ip_str[INET_ADDRSTRLEN];
+                sockaddr_in* sai = reinterpret_cast<sockaddr_in*>(gateway->Address.lpSockaddr);
+                if (inet_ntop(AF_INET, &(sai->sin_addr), ip_str, INET_ADDRSTRLEN) != NULL) {
+                    return ip_str;
+                }
+            }
+        }
+        return "";
+    }
+}
+
+NetworkMonitor::~NetworkMonitor() {
+    Stop();
+}
+
+void NetworkMonitor::Start(HWND hwnd) {
+    main_window_handle_ = hwnd;
+    // The baseline the first notification is compared against.
+    Refresh();
+    if (NotifyUnicastIpAddressChange(AF_UNSPEC, OnAddressChange, hwnd, FALSE, &address_notification_) != NO_ERROR) {
+        address_notification_ = nullptr;
+    }
+    if (NotifyRouteChange2(AF_INET, OnRouteChange, hwnd, FALSE, &route_notification_) != NO_ERROR) {
+        route_notification_ = nullptr;
+    }
+    if (NotifyIpInterfaceChange(AF_UNSPEC, OnInterfaceChange, hwnd, FALSE, &interface_notification_) != NO_ERROR) {
+        interface_notification_ = nullptr;
+    }
+}
+
+void NetworkMonitor::Stop() {
+    // CancelMibChangeNotify2 waits for callbacks in progress, so none can
+    // post to the window after this returns.
+    for (HANDLE* notification : {&address_notification_, &route_notification_, &interface_notification_}) {
+        if (*notification) {
+            CancelMibChangeNotify2(*notification);
+            *notification = nullptr;
+        }
+    }
+    main_window_handle_ = nullptr;
+}
+
+uint32_t NetworkMonitor::Refresh() {
+    NetworkState next = Read();
+    uint32_t changes = 0;
+    if (next.local_ip != state_.local_ip) {
+        changes |= kNetworkAddressChanged;
+    }
+    if (next.gateway != state_.gateway || next.interface_name != state_.interface_name) {
+        changes |= kNetworkGatewayChanged;
+    }
+    if (next.up_interfaces != state_.up_interfaces) {
+        changes |= kNetworkLinkChanged;
+    }
+    state_ = std::move(next);
+    loaded_ = true;
+    return changes;
+}
+
+const NetworkState& NetworkMonitor::state() {
+    if (!loaded_) {
+        Refresh();
+    }
+    return state_;
+}
+
+NetworkState NetworkMonitor::Read() {
+    NetworkState state;
+    std::string hotspot_ip = "";
+    std::string gateway_ip = "";
+
+    ULONG buffer_size = 15000;
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+    PIP_ADAPTER_ADDRESSES p_adapters = reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.get());
+
+    DWORD flags = GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER | GAA_FLAG_INCLUDE_GATEWAYS;
+    DWORD result = GetAdaptersAddresses(AF_INET, flags, NULL, p_adapters, &buffer_size);
+
+    if (result == ERROR_BUFFER_OVERFLOW) {
+        buffer.reset(new char[buffer_size]);
+        p_adapters = reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.get());
+        result = GetAdaptersAddresses(AF_INET, flags, NULL, p_adapters, &buffer_size);
+    }
+
+    if (result != NO_ERROR) {
+        return state;
+    }
+
+    ULONG best_metric = ULONG_MAX;
+    for (PIP_ADAPTER_ADDRESSES p_curr_adapter = p_adapters; p_curr_adapter != NULL; p_curr_adapter = p_curr_adapter->Next) {
+        if (p_curr_adapter->OperStatus != IfOperStatusUp) {
+            continue;
+        }
+        state.up_interfaces.push_back(p_curr_adapter->IfIndex);
+
+        if (wcsstr(p_curr_adapter->Description, L"Microsoft Wi-Fi Direct Virtual Adapter") != nullptr) {
+            std::string ip = FirstIpv4(p_curr_adapter->FirstUnicastAddress);
+            if (!ip.empty()) {
+                hotspot_ip = ip;
+            }
+        }
+        else if (p_curr_adapter->IfType != IF_TYPE_TUNNEL && p_curr_adapter->FirstGatewayAddress != NULL) {
+            std::string ip = FirstIpv4(p_curr_adapter->FirstUnicastAddress);
+            if (gateway_ip.empty()) {
+                gateway_ip = ip;
+            }
+            // sing-box's TUN adapter has no gateway, so the preferred
+            // adapter here is the physical one.
+            if (p_curr_adapter->Ipv4Metric < best_metric) {
+                best_metric = p_curr_adapter->Ipv4Metric;
+                state.gateway = FirstIpv4Gateway(p_curr_adapter->FirstGatewayAddress);
+                state.interface_name = Utf8FromUtf16(p_curr_adapter->FriendlyName);
+            }
+        }
+    }
+    std::sort(state.up_interfaces.begin(), state.up_interfaces.end());
+
+    if (!hotspot_ip.empty()) {
+        state.local_ip = hotspot_ip;
+        return state;
+    }
+    if (!gateway_ip.empty()) {
+        state.local_ip = gateway_ip;
+        return state;
+    }
+
+    for (PIP_ADAPTER_ADDRESSES p_curr_adapter = p_adapters; p_curr_adapter != NULL; p_curr_adapter = p_curr_adapter->Next) {
+        if (p_curr_adapter->OperStatus == IfOperStatusUp &&
+            (p_curr_adapter->IfType == IF_TYPE_ETHERNET_CSMACD || p_curr_adapter->IfType == IF_TYPE_IEEE80211)) {
+
+            if (wcsstr(p_curr_adapter->Description, L"VMware") != nullptr ||
+                wcsstr(p_curr_adapter->Description, L"VirtualBox") != nullptr ||
+                wcsstr(p_curr_adapter->FriendlyName, L"vEthernet (WSL)") != nullptr) {
+                continue;
+            }
+
+            state.local_ip = FirstIpv4(p_curr_adapter->FirstUnicastAddress);
+            if (!state.local_ip.empty()) {
+                return state;
+            }
+        }
+    }
+
+    return state;
+}
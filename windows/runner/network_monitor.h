@@ -0,0 +1,57 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "network_table.h"
+
+// Posted from IP Helper's notification threads whenever an address, route
+// or interface changes. The window settles a burst of them before calling
+// NetworkMonitor::Refresh.
+#define WM_NETWORK_CHANGED (WM_APP + 5)
+
+struct NetworkState {
+    // The address other devices on the LAN reach this host at.
+    std::string local_ip;
+    // The next hop and friendly name of the preferred physical adapter.
+    std::string gateway;
+    std::string interface_name;
+    // Indexes of the adapters that are up, sorted.
+    std::vector<ULONG> up_interfaces;
+};
+
+// Caches the host's network state and keeps it current from IP Helper
+// change notifications, so getIpAddress does not walk the adapter list on
+// every call.
+class NetworkMonitor {
+public:
+    NetworkMonitor() = default;
+    ~NetworkMonitor();
+
+    NetworkMonitor(const NetworkMonitor&) = delete;
+    NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+    // Loads the current state and registers for notifications that are
+    // posted to |hwnd|.
+    void Start(HWND hwnd);
+    void Stop();
+
+    // Re-reads the adapters and returns the NetworkChange bits that differ
+    // from the cached state. Platform thread only.
+    uint32_t Refresh();
+    const NetworkState& state();
+
+private:
+    static NetworkState Read();
+
+    HWND main_window_handle_ = nullptr;
+    HANDLE address_notification_ = nullptr;
+    HANDLE route_notification_ = nullptr;
+    HANDLE interface_notification_ = nullptr;
+    bool loaded_ = false;
+    NetworkState state_;
+};
@@ -1,10 +1,41 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
 #include "process_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <shellapi.h>
 #include <string>
+#include <string_view>
+
+#include "clash_api.h"
+
+namespace {
+    // Longer than any real start; past it the runner stops waiting for a
+    // readiness signal.
+    constexpr auto kReadyTimeout = std::chrono::seconds(15);
+    constexpr DWORD kProbeIntervalMs = 50;
+
+    // How sing-box ended. Crashes show as NTSTATUS codes, which read best
+    // in hex.
+    std::string DescribeExitCode(DWORD exit_code) {
+        if (exit_code >= 0xC0000000) {
+            char code[16];
+            snprintf(code, sizeof(code), "0x%08lX", static_cast<unsigned long>(exit_code));
+            return std::string("crashed with status ") + code;
+        }
+        return "exited with code " + std::to_string(exit_code);
+    }
+}
 
 ProcessManager::ProcessManager() {
     stop_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+    ready_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
     hJobObject_ = CreateJobObject(NULL, NULL);
     if (hJobObject_ != NULL) {
         JOBOBJECT_EXTENDED_LIMIT_INFORMATION jeli = { 0 };
@@ -15,12 +46,17 @@ ProcessManager::ProcessManager() {
 
 ProcessManager::~ProcessManager() {
     Stop();
+    if (config_thread_.joinable()) config_thread_.join();
     if (stop_event_) {
         CloseHandle(stop_event_);
     }
+    if (ready_event_) {
+        CloseHandle(ready_event_);
+    }
     if (hJobObject_) {
         CloseHandle(hJobObject_);
     }
+    WSACleanup();
 }
 
 void ProcessManager::SetMainWindowHandle(HWND hwnd) {
@@ -31,47 +67,216 @@ void ProcessManager::SetLogCallback(std::function<void(const std::string&)> call
     log_callback_ = callback;
 }
 
-void ProcessManager::MonitorProcess() {
-    if (hProcess_ == NULL || stop_event_ == NULL) {
+void ProcessManager::SetLogRing(LogRing* ring) {
+    log_ring_ = ring;
+}
+
+void ProcessManager::Log(const std::string& message) {
+    // Restarts run on the monitor thread, which may write to the ring while
+    // no stdout thread is running.
+    if (std::this_thread::get_id() == monitor_thread_.get_id()) {
+        if (log_ring_) log_ring_->Write(message.data(), message.size());
         return;
     }
+    if (log_callback_) log_callback_(message);
+}
+
+void ProcessManager::SetAutoRestart(bool enabled) {
+    auto_restart_ = enabled;
+}
+
+void ProcessManager::PostRestartEvent(const RestartEvent& event) {
+    if (!main_window_handle_) {
+        return;
+    }
+    auto* message = new RestartEvent(event);
+    if (!PostMessage(main_window_handle_, WM_PROCESS_RESTART, 0, reinterpret_cast<LPARAM>(message))) {
+        delete message;
+    }
+}
+
+void ProcessManager::MonitorProcess() {
+    // Whether this start has been ready; one that never came up is not
+    // restarted.
+    bool supervised = false;
+    while (hProcess_ != NULL && stop_event_ != NULL) {
+        WaitForReady();
+        if (ready_reported_.load()) {
+            supervised = true;
+            RestartEvent event;
+            if (restart_policy_.OnReady(std::chrono::steady_clock::now(), &event)) {
+                PostRestartEvent(event);
+            }
+        }
+
+        HANDLE handles[] = {hProcess_, stop_event_};
+        DWORD wait_result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        // An exit that races Stop() is Stop()'s to clean up.
+        if (wait_result != WAIT_OBJECT_0 + 0 || WaitForSingleObject(stop_event_, 0) == WAIT_OBJECT_0) {
+            return;
+        }
+        DWORD exit_code = 0;
+        GetExitCodeProcess(hProcess_, &exit_code);
+        // Set first so Start() and Stop() never see neither flag.
+        restarting_ = true;
+        is_running_ = false;
+        CloseHandle(hProcess_);
+        hProcess_ = NULL;
+
+        std::string exit_status = DescribeExitCode(exit_code);
+        for (;;) {
+            RestartEvent event;
+            event.exit_status = exit_status;
+            if (!supervised || !auto_restart_.load() ||
+                !restart_policy_.OnCrash(std::chrono::steady_clock::now(), &event)) {
+                restarting_ = false;
+                if (event.kind == RestartEvent::Kind::kGaveUp) {
+                    PostRestartEvent(event);
+                }
+                if (main_window_handle_) {
+                    PostMessage(main_window_handle_, WM_PROCESS_TERMINATED, 0, 0);
+                }
+                return;
+            }
+            PostRestartEvent(event);
+            // Stop() ends the backoff early.
+            if (WaitForSingleObject(stop_event_, static_cast<DWORD>(event.delay_ms)) != WAIT_TIMEOUT) {
+                restarting_ = false;
+                return;
+            }
+
+            // The old process's output thread ends at its pipe's EOF.
+            if (stdout_thread_.joinable()) stdout_thread_.join();
+            if (hStdOutRead_ != NULL) {
+                CloseHandle(hStdOutRead_);
+                hStdOutRead_ = NULL;
+            }
+            timeline_.Begin();
+            if (Launch()) {
+                restarting_ = false;
+                break;
+            }
+            exit_status = "could not be started";
+        }
+    }
+}
 
-    HANDLE handles[] = {hProcess_, stop_event_};
-    DWORD wait_result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+void ProcessManager::WriteConfig(HANDLE pipe, std::string config_content) {
+    const char* data = config_content.data();
+    size_t remaining = config_content.size();
+    while (remaining > 0) {
+        DWORD written = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(remaining, MAXDWORD));
+        if (!WriteFile(pipe, data, chunk, &written, NULL)) {
+            break;
+        }
+        data += written;
+        remaining -= written;
+    }
+    CloseHandle(pipe);
+    if (remaining == 0) {
+        timeline_.Mark(StartPhase::kConfigWritten);
+    }
+}
 
-    if (wait_result == WAIT_OBJECT_0 + 0) {
-        if (is_running_.load()) {
-            is_running_ = false;
-            CloseHandle(hProcess_);
-            hProcess_ = NULL;
-            if (main_window_handle_) {
-                PostMessage(main_window_handle_, WM_PROCESS_TERMINATED, 0, 0);
+void ProcessManager::WaitForReady() {
+    HANDLE handles[] = {hProcess_, stop_event_, ready_event_};
+    const auto deadline = std::chrono::steady_clock::now() + kReadyTimeout;
+    for (;;) {
+        DWORD wait_result = WaitForMultipleObjects(3, handles, FALSE, kProbeIntervalMs);
+        if (wait_result != WAIT_TIMEOUT) {
+            // Exited, stopping, or the log already said so.
+            return;
+        }
+        if (api_port_ != 0 && ProbeClashApi()) {
+            timeline_.Mark(StartPhase::kReady);
+            ReportReady(true);
+            return;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            if (!timeline_.reached(StartPhase::kConfigWritten)) {
+                // It never took its config; the exit is reported as usual.
+                TerminateProcess(hProcess_, 1);
+                return;
             }
+            ReportReady(false);
+            return;
         }
     }
 }
 
+bool ProcessManager::ProbeClashApi() {
+    SOCKET probe = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (probe == INVALID_SOCKET) {
+        return false;
+    }
+    // Connecting to a closed port on Windows retries for seconds instead of
+    // failing, so the connect is bounded by the probe interval.
+    u_long non_blocking = 1;
+    ioctlsocket(probe, FIONBIO, &non_blocking);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(api_port_);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(probe, &writable);
+    timeval timeout = {0, static_cast<long>(kProbeIntervalMs) * 1000};
+    bool answered = false;
+    if (select(0, nullptr, &writable, nullptr, &timeout) == 1) {
+        u_long blocking = 0;
+        ioctlsocket(probe, FIONBIO, &blocking);
+        DWORD receive_timeout = kProbeIntervalMs * 10;
+        setsockopt(probe, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&receive_timeout),
+                   sizeof(receive_timeout));
+        std::string request = ClashApiProbeRequest(api_secret_);
+        int request_length = static_cast<int>(request.size());
+        if (send(probe, request.data(), request_length, 0) == request_length) {
+            char response[64];
+            int received = recv(probe, response, sizeof(response), 0);
+            answered = received > 0 && IsHttpResponse(std::string_view(response, static_cast<size_t>(received)));
+        }
+    }
+    closesocket(probe);
+    return answered;
+}
+
+void ProcessManager::ReportReady(bool confirmed) {
+    if (ready_reported_.exchange(true)) {
+        return;
+    }
+    if (main_window_handle_) {
+        PostMessage(main_window_handle_, WM_PROCESS_READY, confirmed ? 1 : 0, 0);
+    }
+}
+
 void ProcessManager::ReadFromPipe(HANDLE pipe) {
-    char buffer[4096];
+    char scratch[4096];
     DWORD bytesRead;
-    std::string line_buffer;
-
-    while (ReadFile(pipe, buffer, sizeof(buffer) - 1, &bytesRead, NULL) && bytesRead > 0) {
-        if (log_callback_) {
-            buffer[bytesRead] = '\0';
-            line_buffer += buffer;
-            size_t EOL_pos;
-            while ((EOL_pos = line_buffer.find('\n')) != std::string::npos) {
-                std::string line = line_buffer.substr(0, EOL_pos + 1);
-                // This is a simple way to add an emoji, assuming logs from sing-box
-                // are what we want to decorate.
-                log_callback_("📦 " + line);
-                line_buffer.erase(0, EOL_pos + 1);
-            }
+
+    for (;;) {
+        LogRing::Span span = log_ring_ ? log_ring_->PrepareWrite() : LogRing::Span{nullptr, 0};
+        bool into_ring = span.size > 0;
+        char* target = into_ring ? span.data : scratch;
+        DWORD capacity = into_ring ? static_cast<DWORD>(std::min<size_t>(span.size, MAXDWORD)) : sizeof(scratch);
+
+        if (!ReadFile(pipe, target, capacity, &bytesRead, NULL) || bytesRead == 0) {
+            break;
+        }
+        if (timeline_.Scan(target, bytesRead)) {
+            ReportReady(true);
+            SetEvent(ready_event_);
+        }
+        if (into_ring) {
+            log_ring_->CommitWrite(bytesRead);
+        } else if (log_ring_) {
+            log_ring_->CountDropped(bytesRead);
         }
     }
-    if (!line_buffer.empty() && log_callback_) {
-        log_callback_("📦 " + line_buffer + "\n");
+    if (log_ring_) {
+        log_ring_->TerminateLine();
     }
 }
 
@@ -80,9 +285,32 @@ bool ProcessManager::Start(const std::string& config_content, bool hide_console)
         std::cout << "[ProcessManager] Process is already running." << std::endl;
         return true;
     }
+    if (restarting_.load()) {
+        // Cancels the pending restart.
+        Stop();
+    }
 
     if (log_callback_) log_callback_("🚀 Starting VPN service...\n");
+    timeline_.Begin();
+
+    // The previous monitor has returned or was stopped, so the policy is
+    // free to reset.
+    if (monitor_thread_.joinable()) monitor_thread_.join();
+    restart_policy_.Reset();
+    last_config_ = config_content;
+    hide_console_ = hide_console;
+    if (!Launch()) {
+        return false;
+    }
 
+    ResetEvent(stop_event_);
+    monitor_thread_ = std::thread(&ProcessManager::MonitorProcess, this);
+
+    if (log_callback_) log_callback_("✅ Process started successfully.\n");
+    return true;
+}
+
+bool ProcessManager::Launch() {
     char exe_path[MAX_PATH];
     GetModuleFileNameA(NULL, exe_path, MAX_PATH);
     std::string::size_type pos = std::string(exe_path).find_last_of("/\\");
@@ -98,14 +326,14 @@ bool ProcessManager::Start(const std::string& config_content, bool hide_console)
 
     HANDLE hStdInRead, hStdInWrite;
     if (!CreatePipe(&hStdInRead, &hStdInWrite, &sa, 0)) {
-        if (log_callback_) log_callback_("❌ CreatePipe (stdin) failed.\n");
+        Log("❌ CreatePipe (stdin) failed.\n");
         return false;
     }
     SetHandleInformation(hStdInWrite, HANDLE_FLAG_INHERIT, 0);
 
     HANDLE hStdOutRead, hStdOutWrite;
     if (!CreatePipe(&hStdOutRead, &hStdOutWrite, &sa, 0)) {
-        if (log_callback_) log_callback_("❌ CreatePipe (stdout) failed.\n");
+        Log("❌ CreatePipe (stdout) failed.\n");
         CloseHandle(hStdInRead);
         CloseHandle(hStdInWrite);
         return false;
@@ -123,11 +351,11 @@ bool ProcessManager::Start(const std::string& config_content, bool hide_console)
 
     ZeroMemory(&pi, sizeof(pi));
 
-    DWORD creation_flags = hide_console ? CREATE_NO_WINDOW : 0;
+    DWORD creation_flags = hide_console_ ? CREATE_NO_WINDOW : 0;
 
     if (!CreateProcessA(NULL, &command[0], NULL, NULL, TRUE, creation_flags, NULL, app_dir.c_str(), &si, &pi)) {
         DWORD error = GetLastError();
-        if (log_callback_) log_callback_("❌ CreateProcess failed with error: " + std::to_string(error) + "\n");
+        Log("❌ CreateProcess failed with error: " + std::to_string(error) + "\n");
         CloseHandle(hStdInRead);
         CloseHandle(hStdInWrite);
         CloseHandle(hStdOutRead);
@@ -137,7 +365,7 @@ bool ProcessManager::Start(const std::string& config_content, bool hide_console)
 
     if (hJobObject_ != NULL) {
         if (!AssignProcessToJobObject(hJobObject_, pi.hProcess)) {
-            if (log_callback_) log_callback_("❌ AssignProcessToJobObject failed. Error: " + std::to_string(GetLastError()) + "\n");
+            Log("❌ AssignProcessToJobObject failed. Error: " + std::to_string(GetLastError()) + "\n");
             TerminateProcess(pi.hProcess, 1);
             CloseHandle(pi.hProcess);
             CloseHandle(pi.hThread);
@@ -151,38 +379,32 @@ bool ProcessManager::Start(const std::string& config_content, bool hide_console)
 
     CloseHandle(hStdInRead);
     CloseHandle(hStdOutWrite);
+    timeline_.Mark(StartPhase::kSpawned);
 
-    DWORD bytesWritten;
-    if (!WriteFile(hStdInWrite, config_content.c_str(), static_cast<DWORD>(config_content.length()), &bytesWritten, NULL)) {
-        if (log_callback_) log_callback_("❌ WriteFile to pipe failed.\n");
-        CloseHandle(hStdInWrite);
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
-        CloseHandle(hStdOutRead);
-        return false;
-    }
-
-    CloseHandle(hStdInWrite);
+    // WriteFile blocks until sing-box reads its config, which for a config
+    // larger than the pipe buffer only happens once its runtime is up, so the
+    // write gets its own thread. Terminating the child ends a stuck write.
+    if (config_thread_.joinable()) config_thread_.join();
+    config_thread_ = std::thread(&ProcessManager::WriteConfig, this, hStdInWrite, last_config_);
 
     hProcess_ = pi.hProcess;
     hStdOutRead_ = hStdOutRead;
     is_running_ = true;
 
-    if (monitor_thread_.joinable()) monitor_thread_.join();
-    ResetEvent(stop_event_);
-    monitor_thread_ = std::thread(&ProcessManager::MonitorProcess, this);
+    api_port_ = FindClashApiPort(last_config_);
+    api_secret_ = FindClashApiSecret(last_config_);
+    ready_reported_ = false;
+    ResetEvent(ready_event_);
 
     if (stdout_thread_.joinable()) stdout_thread_.join();
     stdout_thread_ = std::thread(&ProcessManager::ReadFromPipe, this, hStdOutRead_);
     
     CloseHandle(pi.hThread);
-
-    if (log_callback_) log_callback_("✅ Process started successfully.\n");
     return true;
 }
 
 void ProcessManager::Stop() {
-    if (!is_running_.load()) {
+    if (!is_running_.load() && !restarting_.load()) {
         return;
     }
     if (log_callback_) log_callback_("🛑 Stopping VPN service...\n");
@@ -202,21 +424,33 @@ void ProcessManager::Stop() {
     }
     
     if (stdout_thread_.joinable()) stdout_thread_.join();
+    if (config_thread_.joinable()) config_thread_.join();
 
     is_running_ = false;
+    restarting_ = false;
 }
 
-bool ProcessManager::IsRunning() {
-    if (!is_running_.load() || hProcess_ == NULL) {
-        return false;
+bool ProcessManager::Switch(const std::string& config_content, bool hide_console) {
+    if (is_running_.load()) {
+        if (log_callback_) log_callback_("🔁 Switching VPN service...\n");
+        Stop();
     }
-    DWORD exit_code;
-    if (GetExitCodeProcess(hProcess_, &exit_code)) {
-        if (exit_code == STILL_ACTIVE) {
-            return true;
-        }
+    return Start(config_content, hide_console);
+}
+
+bool ProcessManager::Reload(const std::string& config_content, ReloadResult* result) {
+    ConfigDiff diff = DiffConfigs(last_config_, config_content);
+    result->sections = diff.changed;
+    if (diff.identical()) {
+        result->path = ReloadPath::kUnchanged;
+        return true;
     }
-    is_running_ = false;
-    hProcess_ = NULL;
-    return false;
+    result->path = ReloadPath::kRestart;
+    return Switch(config_content, hide_console_);
+}
+
+bool ProcessManager::IsRunning() {
+    // The monitor thread notices the exit and owns the handle; a process
+    // that just exited reads as running until it has.
+    return is_running_.load();
 }
@@ -1,13 +1,29 @@
 #pragma once
 
+#include <winsock2.h>
 #include <string>
 #include <windows.h>
 #include <thread>
 #include <atomic>
 #include <functional>
 
-// Custom message for process termination
+#include "config_diff.h"
+#include "log_ring.h"
+#include "restart_policy.h"
+#include "start_timeline.h"
+
+// Posted when sing-box exited on its own and is not restarted.
 #define WM_PROCESS_TERMINATED (WM_APP + 1)
+// Posted once per start when sing-box is ready. wParam is 1 when it said so,
+// 0 when the readiness timeout ran out first.
+#define WM_PROCESS_READY (WM_APP + 3)
+// Posted at each step of the restart supervisor. lParam is a RestartEvent*
+// owned by the receiver.
+#define WM_PROCESS_RESTART (WM_APP + 9)
+
+// Once a start has been ready, a sing-box that exits on its own is
+// restarted by the monitor thread with the same config after a
+// RestartPolicy backoff. A crash loop ends the restarts.
 
 class ProcessManager {
 public:
@@ -15,24 +31,78 @@ public:
     ~ProcessManager();
 
     void SetMainWindowHandle(HWND hwnd);
+    // Status messages from Start() and Stop(), on the calling thread.
     void SetLogCallback(std::function<void(const std::string&)> callback);
+    // sing-box output is read straight into |ring| by the stdout thread.
+    void SetLogRing(LogRing* ring);
+    // Whether crashed processes are restarted. On by default.
+    void SetAutoRestart(bool enabled);
     bool Start(const std::string& config_content, bool hide_console);
     void Stop();
+    // Restarts sing-box with |config_content|, or starts it if not running.
+    bool Switch(const std::string& config_content, bool hide_console);
+    // Applies |config_content| to the running sing-box and fills in how.
+    // sing-box has no SIGHUP reload on Windows and its Clash API cannot
+    // replace the config, so any change is a Switch() with the current
+    // console setting. Returns false if that failed.
+    bool Reload(const std::string& config_content, ReloadResult* result);
+    // Whether sing-box is up. False during a restart's backoff. Safe from
+    // any thread; it changes no state.
     bool IsRunning();
 
+    // Phases of the latest start. Readiness comes from the "sing-box
+    // started" log line or the first answer of the Clash API.
+    const StartTimeline& timeline() const { return timeline_; }
+    // The Clash API port of the latest start, or 0 when its config has none.
+    uint16_t api_port() const { return api_port_; }
+    // The Clash API secret of the latest start, or empty.
+    const std::string& api_secret() const { return api_secret_; }
+
 private:
+    // Sends a status message to the log callback, or to the ring on the
+    // monitor thread.
+    void Log(const std::string& message);
+    // Spawns sing-box with |last_config_| and starts its config and stdout
+    // threads.
+    bool Launch();
     void MonitorProcess();
+    void PostRestartEvent(const RestartEvent& event);
+    // Waits until sing-box is ready, has exited or is being stopped.
+    void WaitForReady();
+    bool ProbeClashApi();
+    void ReportReady(bool confirmed);
     void ReadFromPipe(HANDLE pipe);
+    // Writes the config to sing-box's stdin and closes it.
+    void WriteConfig(HANDLE pipe, std::string config_content);
 
+    // Owned by the monitor thread while it runs; Start() and Stop() only
+    // touch it before starting that thread or after joining it.
     HANDLE hProcess_ = NULL;
     HANDLE hJobObject_ = NULL;
     std::atomic<bool> is_running_ = false;
+    // Set from an unexpected exit until the monitor thread has restarted
+    // sing-box or given up.
+    std::atomic<bool> restarting_ = false;
+    std::atomic<bool> auto_restart_ = true;
+    std::string last_config_;
+    bool hide_console_ = true;
+    // Monitor thread only, apart from Start().
+    RestartPolicy restart_policy_;
     
     std::thread monitor_thread_;
     HANDLE stop_event_ = NULL;
+    // Set by the stdout thread when the log announces readiness.
+    HANDLE ready_event_ = NULL;
     HWND main_window_handle_ = nullptr;
 
+    StartTimeline timeline_;
+    uint16_t api_port_ = 0;
+    std::string api_secret_;
+    std::atomic<bool> ready_reported_ = false;
+
     std::function<void(const std::string&)> log_callback_;
+    LogRing* log_ring_ = nullptr;
     HANDLE hStdOutRead_ = NULL;
     std::thread stdout_thread_;
+    std::thread config_thread_;
 };
@@ -0,0 +1,352 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "speed_tester.h"
+#include <algorithm>
+#include <climits>
+
+namespace {
+    constexpr size_t kReadBufferSize = 64 * 1024;
+    constexpr size_t kMaxDatagram = 2048;
+
+    // Fills |address| from an IPv4 or IPv6 literal.
+    bool ParseAddress(const std::string& ip, uint16_t port, sockaddr_storage* address, int* length) {
+        auto* v4 = reinterpret_cast<sockaddr_in*>(address);
+        if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port = htons(port);
+            *length = sizeof(sockaddr_in);
+            return true;
+        }
+        auto* v6 = reinterpret_cast<sockaddr_in6*>(address);
+        if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = htons(port);
+            *length = sizeof(sockaddr_in6);
+            return true;
+        }
+        return false;
+    }
+
+    struct Connection {
+        SOCKET socket = INVALID_SOCKET;
+        bool connected = false;
+        bool closed = false;
+        bool failed = false;
+        std::unique_ptr<SpeedTestStream> stream;
+    };
+}
+
+SpeedTester::SpeedTester() {
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+}
+
+SpeedTester::~SpeedTester() {
+    cancelled_ = true;
+    if (worker_.joinable()) worker_.join();
+    WSACleanup();
+}
+
+void SpeedTester::SetMainWindowHandle(HWND hwnd) {
+    main_window_handle_ = hwnd;
+}
+
+bool SpeedTester::Start(SpeedTestOptions options) {
+    if (running_.exchange(true)) {
+        return false;
+    }
+    // The previous worker has posted its last event and is exiting.
+    if (worker_.joinable()) worker_.join();
+    cancelled_ = false;
+    worker_ = std::thread(&SpeedTester::Run, this, std::move(options));
+    return true;
+}
+
+void SpeedTester::Cancel() {
+    cancelled_ = true;
+}
+
+void SpeedTester::Run(SpeedTestOptions options) {
+    auto done = std::make_unique<SpeedTestEvent>();
+    done->done = true;
+    std::vector<SpeedTestPhase> phases = PlannedSpeedTestPhases(options);
+    if (phases.empty()) {
+        done->error = "Nothing to test.";
+    }
+    for (SpeedTestPhase phase : phases) {
+        auto warmup = std::min<SpeedTestClock::duration>(std::chrono::seconds(1), options.phase_duration / 4);
+        SpeedTestMeter meter(phase, SpeedTestClock::now(), warmup);
+        bool completed = RunPhase(options, phase, &meter, &done->error);
+        if (cancelled_) {
+            done->error = "Cancelled.";
+            break;
+        }
+        done->results.push_back(meter.Finish(SpeedTestClock::now()));
+        if (!completed) {
+            break;
+        }
+    }
+    Post(std::move(done));
+    running_ = false;
+}
+
+bool SpeedTester::RunPhase(const SpeedTestOptions& options, SpeedTestPhase phase, SpeedTestMeter* meter,
+                           std::string* error) {
+    const std::string unreachable = "Could not reach the mixed inbound at " + options.proxy_ip + ":" +
+                                    std::to_string(options.proxy_port) + ".";
+    sockaddr_storage proxy = {};
+    int proxy_length = 0;
+    if (options.proxy_port == 0 || !ParseAddress(options.proxy_ip, options.proxy_port, &proxy, &proxy_length)) {
+        *error = unreachable;
+        return false;
+    }
+
+    std::vector<Connection> connections;
+    auto open = [&]() {
+        SOCKET stream_socket = socket(proxy.ss_family, SOCK_STREAM, IPPROTO_TCP);
+        if (stream_socket == INVALID_SOCKET) {
+            return false;
+        }
+        u_long non_blocking = 1;
+        ioctlsocket(stream_socket, FIONBIO, &non_blocking);
+        if (connect(stream_socket, reinterpret_cast<sockaddr*>(&proxy), proxy_length) != 0 &&
+            WSAGetLastError() != WSAEWOULDBLOCK) {
+            closesocket(stream_socket);
+            return false;
+        }
+        Connection connection;
+        connection.socket = stream_socket;
+        connection.stream = std::make_unique<SpeedTestStream>(
+            phase, phase == SpeedTestPhase::kUpload ? options.upload_url : options.download_url, options.upload_size,
+            meter);
+        connections.push_back(std::move(connection));
+        return true;
+    };
+
+    SOCKET udp = INVALID_SOCKET;
+    std::unique_ptr<SpeedTestUdpFlow> flow;
+    // A datagram the socket had no room for.
+    std::string pending;
+    std::string last_error;
+    size_t failed = 0;
+    bool completed = true;
+    auto close_all = [&]() {
+        for (Connection& connection : connections) {
+            closesocket(connection.socket);
+        }
+        connections.clear();
+        if (udp != INVALID_SOCKET) {
+            closesocket(udp);
+            udp = INVALID_SOCKET;
+        }
+    };
+
+    size_t streams = phase == SpeedTestPhase::kUdp ? 1 : options.streams;
+    for (size_t i = 0; i < streams; i++) {
+        if (!open()) {
+            close_all();
+            *error = unreachable;
+            return false;
+        }
+    }
+
+    auto deadline = meter->start() + options.phase_duration;
+    auto last_tick = meter->start();
+    auto next_tick = last_tick + kProgressInterval;
+    uint64_t last_bytes = 0;
+    std::vector<char> buffer(kReadBufferSize);
+    std::vector<WSAPOLLFD> poll_fds;
+    while (!cancelled_ && !connections.empty()) {
+        auto now = SpeedTestClock::now();
+        if (now >= next_tick) {
+            if (flow) {
+                flow->Expire(now);
+            }
+            auto progress = std::make_unique<SpeedTestEvent>();
+            progress->phase = phase;
+            progress->elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - meter->start()).count();
+            progress->bytes = meter->bytes();
+            double seconds = std::chrono::duration<double>(now - last_tick).count();
+            progress->bps = seconds > 0 ? static_cast<double>(progress->bytes - last_bytes) * 8 / seconds : 0;
+            last_tick = now;
+            last_bytes = progress->bytes;
+            next_tick = std::max(next_tick + kProgressInterval, now);
+            Post(std::move(progress));
+            if (now >= deadline) {
+                break;
+            }
+        }
+
+        poll_fds.clear();
+        for (const Connection& connection : connections) {
+            short events = connection.connected
+                               ? static_cast<short>(POLLRDNORM | (connection.stream->output().empty() ? 0 : POLLWRNORM))
+                               : static_cast<short>(POLLWRNORM);
+            poll_fds.push_back({connection.socket, events, 0});
+        }
+        bool udp_polled = udp != INVALID_SOCKET;
+        if (udp_polled) {
+            poll_fds.push_back({udp, static_cast<short>(POLLRDNORM | (pending.empty() ? 0 : POLLWRNORM)), 0});
+        }
+        int wait_ms = static_cast<int>(std::clamp<int64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - now).count(), 0, kMaxPollMs));
+        WSAPoll(poll_fds.data(), static_cast<ULONG>(poll_fds.size()), wait_ms);
+
+        now = SpeedTestClock::now();
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection& connection = connections[i];
+            short revents = poll_fds[i].revents;
+            if (revents == 0) {
+                continue;
+            }
+            SpeedTestStream* stream = connection.stream.get();
+            if (!connection.connected) {
+                if ((revents & (POLLERR | POLLHUP)) != 0) {
+                    connection.closed = connection.failed = true;
+                    last_error = unreachable;
+                    continue;
+                }
+                connection.connected = true;
+            }
+            if ((revents & (POLLRDNORM | POLLHUP | POLLERR)) != 0) {
+                for (int n = 0; n < kMaxIoPerEvent; n++) {
+                    int received = recv(connection.socket, buffer.data(), static_cast<int>(buffer.size()), 0);
+                    if (received == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+                        break;
+                    }
+                    if (received <= 0) {
+                        connection.closed = true;
+                        connection.failed = !(received == 0 && stream->OnClosed());
+                        break;
+                    }
+                    if (!stream->OnReceived(buffer.data(), static_cast<size_t>(received), now)) {
+                        connection.closed = connection.failed = true;
+                        break;
+                    }
+                    if (static_cast<size_t>(received) < buffer.size()) {
+                        break;
+                    }
+                }
+            }
+            if (connection.closed || stream->finished()) {
+                connection.closed = true;
+                continue;
+            }
+            for (int n = 0; n < kMaxIoPerEvent; n++) {
+                std::string_view output = stream->output();
+                if (output.empty()) {
+                    break;
+                }
+                int sent = send(connection.socket, output.data(),
+                                static_cast<int>(std::min<size_t>(output.size(), INT_MAX)), 0);
+                if (sent == SOCKET_ERROR) {
+                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                        connection.closed = connection.failed = true;
+                    }
+                    break;
+                }
+                stream->OnSent(static_cast<size_t>(sent), now);
+                if (static_cast<size_t>(sent) < output.size()) {
+                    break;
+                }
+            }
+            if (!connection.closed && stream->associated() && udp == INVALID_SOCKET) {
+                const std::string& relay_ip = stream->relay_ip().empty() ? options.proxy_ip : stream->relay_ip();
+                sockaddr_storage relay = {};
+                int relay_length = 0;
+                if (ParseAddress(relay_ip, stream->relay_port(), &relay, &relay_length)) {
+                    udp = socket(relay.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+                }
+                // Connected, so only the relay's datagrams arrive and an
+                // unreachable relay shows up as WSAECONNRESET.
+                if (udp != INVALID_SOCKET) {
+                    u_long non_blocking = 1;
+                    ioctlsocket(udp, FIONBIO, &non_blocking);
+                    if (connect(udp, reinterpret_cast<sockaddr*>(&relay), relay_length) != 0) {
+                        closesocket(udp);
+                        udp = INVALID_SOCKET;
+                    }
+                }
+                if (udp == INVALID_SOCKET) {
+                    connection.closed = connection.failed = true;
+                    last_error = "Could not reach the UDP relay of the mixed inbound.";
+                } else {
+                    flow = std::make_unique<SpeedTestUdpFlow>(options.udp_echo_host, options.udp_echo_port, meter);
+                }
+            }
+        }
+
+        if (udp != INVALID_SOCKET) {
+            if (udp_polled && (poll_fds.back().revents & (POLLRDNORM | POLLERR)) != 0) {
+                char datagram[kMaxDatagram];
+                for (int n = 0; n < kMaxIoPerEvent; n++) {
+                    int received = recv(udp, datagram, static_cast<int>(sizeof(datagram)), 0);
+                    if (received == SOCKET_ERROR) {
+                        if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                            last_error = "The UDP relay of the mixed inbound is unreachable.";
+                            connections.front().closed = connections.front().failed = true;
+                        }
+                        break;
+                    }
+                    flow->OnDatagram(datagram, static_cast<size_t>(received), now);
+                }
+            }
+            // With the window full the next echo or expiry sends more.
+            while (!pending.empty() || flow->NextDatagram(now, &pending)) {
+                if (send(udp, pending.data(), static_cast<int>(pending.size()), 0) == SOCKET_ERROR &&
+                    WSAGetLastError() == WSAEWOULDBLOCK) {
+                    break;
+                }
+                pending.clear();
+            }
+        }
+
+        size_t replacements = 0;
+        for (size_t i = 0; i < connections.size();) {
+            Connection& connection = connections[i];
+            if (!connection.closed) {
+                i++;
+                continue;
+            }
+            closesocket(connection.socket);
+            if (connection.failed) {
+                failed++;
+                meter->AddFailedStream();
+                if (!connection.stream->error().empty()) {
+                    last_error = connection.stream->error();
+                }
+            } else {
+                replacements++;
+            }
+            connections.erase(connections.begin() + static_cast<ptrdiff_t>(i));
+        }
+        // The association ends with its control connection.
+        if (phase == SpeedTestPhase::kUdp && connections.empty()) {
+            break;
+        }
+        for (size_t i = 0; i < replacements; i++) {
+            if (!open()) {
+                failed++;
+                meter->AddFailedStream();
+            }
+        }
+    }
+    close_all();
+
+    if (meter->bytes() == 0 && failed > 0) {
+        *error = last_error.empty() ? unreachable : last_error;
+        completed = false;
+    }
+    return completed;
+}
+
+void SpeedTester::Post(std::unique_ptr<SpeedTestEvent> event) {
+    if (!main_window_handle_) {
+        return;
+    }
+    SpeedTestEvent* raw = event.release();
+    if (!PostMessage(main_window_handle_, WM_SPEED_TEST_EVENT, 0, reinterpret_cast<LPARAM>(raw))) {
+        delete raw;
+    }
+}
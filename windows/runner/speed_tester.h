@@ -0,0 +1,70 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "speed_test.h"
+
+// Posted for every progress tick and once when the test ends. lParam is a
+// SpeedTestEvent* the window owns from then on.
+#define WM_SPEED_TEST_EVENT (WM_APP + 7)
+
+struct SpeedTestEvent {
+    bool done = false;
+    // Progress: the running phase, milliseconds since it started, its bytes
+    // so far and the bits per second over the last tick.
+    SpeedTestPhase phase = SpeedTestPhase::kDownload;
+    int64_t elapsed_ms = 0;
+    uint64_t bytes = 0;
+    double bps = 0;
+    // Done: every finished phase and, when the test stopped early, why.
+    std::vector<SpeedTestResult> results;
+    std::string error;
+};
+
+// Measures tunnel throughput through the mixed inbound.
+//
+// A worker thread runs the phases one after another. A TCP phase keeps
+// options.streams non-blocking connections to the proxy busy, opening a
+// new one whenever the server ends a response on a connection it will not
+// reuse; the UDP phase holds one SOCKS5 association and a connected
+// datagram socket. Everything is waited on with WSAPoll.
+class SpeedTester {
+public:
+    SpeedTester();
+    ~SpeedTester();
+
+    SpeedTester(const SpeedTester&) = delete;
+    SpeedTester& operator=(const SpeedTester&) = delete;
+
+    void SetMainWindowHandle(HWND hwnd);
+    // Returns false while another test runs.
+    bool Start(SpeedTestOptions options);
+    // Stops a running test with "Cancelled.".
+    void Cancel();
+
+private:
+    static constexpr std::chrono::milliseconds kProgressInterval{250};
+    // Upper bound on a WSAPoll wait, so a cancel is noticed promptly.
+    static constexpr int kMaxPollMs = 50;
+    static constexpr int kMaxIoPerEvent = 16;
+
+    void Run(SpeedTestOptions options);
+    // Runs one phase into |meter|. Returns false with |error| set when it
+    // stopped early.
+    bool RunPhase(const SpeedTestOptions& options, SpeedTestPhase phase, SpeedTestMeter* meter, std::string* error);
+    void Post(std::unique_ptr<SpeedTestEvent> event);
+
+    HWND main_window_handle_ = nullptr;
+    std::thread worker_;
+    std::atomic<bool> running_ = false;
+    std::atomic<bool> cancelled_ = false;
+};
@@ -0,0 +1,219 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "traffic_sampler.h"
+#include <memory>
+
+namespace {
+    constexpr size_t kReadBufferSize = 64 * 1024;
+}
+
+TrafficSampler::TrafficSampler() {
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+}
+
+TrafficSampler::~TrafficSampler() {
+    Stop();
+    WSACleanup();
+}
+
+void TrafficSampler::SetMainWindowHandle(HWND hwnd) {
+    main_window_handle_ = hwnd;
+}
+
+void TrafficSampler::Start(uint16_t port, const std::string& secret) {
+    Stop();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        recorder_.Reset();
+    }
+    connection_table_.Reset();
+    if (port == 0) {
+        return;
+    }
+    secret_ = secret;
+    stopping_ = false;
+    worker_ = std::thread(&TrafficSampler::Run, this, port);
+}
+
+void TrafficSampler::Stop() {
+    stopping_ = true;
+    if (worker_.joinable()) worker_.join();
+    // The connections are gone with the tunnel. The worker is done with
+    // the table.
+    if (connection_table_.size() > 0) {
+        auto diff = std::make_unique<ConnectionDiff>();
+        connection_table_.Reset(diff.get());
+        if (tracking_connections_) {
+            PostConnectionDiff(std::move(diff));
+        }
+    }
+}
+
+void TrafficSampler::TrackConnections(bool enabled) {
+    tracking_connections_ = enabled;
+    // A new listener starts from the full list.
+    connections_reset_ = true;
+}
+
+void TrafficSampler::PostConnectionDiff(std::unique_ptr<ConnectionDiff> diff) {
+    if (main_window_handle_ &&
+        PostMessage(main_window_handle_, WM_CONNECTION_DIFF, 0, reinterpret_cast<LPARAM>(diff.get()))) {
+        diff.release();
+    }
+}
+
+std::vector<TrafficSample> TrafficSampler::History(uint64_t* sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *sequence = recorder_.history().sequence();
+    return recorder_.history().Snapshot();
+}
+
+void TrafficSampler::Run(uint16_t port) {
+    auto wait_to_retry = [this]() {
+        auto until = std::chrono::steady_clock::now() + kRetryInterval;
+        while (!stopping_ && std::chrono::steady_clock::now() < until) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kMaxPollMs));
+        }
+    };
+    while (!stopping_) {
+        if (traffic_.socket == INVALID_SOCKET) {
+            if (!Open(&traffic_, port, "/traffic") || !Open(&connections_, port, "/connections")) {
+                Close(&traffic_);
+                Close(&connections_);
+                wait_to_retry();
+                continue;
+            }
+            awaiting_connections_ = true;
+        }
+        WSAPOLLFD poll_fds[2];
+        Connection* polled[2] = {&traffic_, &connections_};
+        for (int i = 0; i < 2; i++) {
+            short events = static_cast<short>(polled[i]->connected && polled[i]->output.empty() ? POLLRDNORM
+                                                                                                 : POLLRDNORM | POLLWRNORM);
+            poll_fds[i] = {polled[i]->socket, events, 0};
+        }
+        WSAPoll(poll_fds, 2, kMaxPollMs);
+        if (!Service(&traffic_, poll_fds[0].revents) || !Service(&connections_, poll_fds[1].revents)) {
+            Close(&traffic_);
+            Close(&connections_);
+            awaiting_connections_ = false;
+            wait_to_retry();
+        }
+    }
+    Close(&traffic_);
+    Close(&connections_);
+    awaiting_connections_ = false;
+}
+
+bool TrafficSampler::Open(Connection* connection, uint16_t port, std::string_view path) {
+    connection->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (connection->socket == INVALID_SOCKET) {
+        return false;
+    }
+    u_long non_blocking = 1;
+    ioctlsocket(connection->socket, FIONBIO, &non_blocking);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(connection->socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 &&
+        WSAGetLastError() != WSAEWOULDBLOCK) {
+        Close(connection);
+        return false;
+    }
+    connection->connected = false;
+    connection->output = ClashApiRequest(path, secret_);
+    connection->stream = ClashApiStream();
+    return true;
+}
+
+void TrafficSampler::Close(Connection* connection) {
+    if (connection->socket != INVALID_SOCKET) {
+        closesocket(connection->socket);
+        connection->socket = INVALID_SOCKET;
+    }
+    connection->output.clear();
+}
+
+bool TrafficSampler::Service(Connection* connection, short revents) {
+    if (revents == 0) {
+        return true;
+    }
+    if (!connection->connected) {
+        if ((revents & (POLLERR | POLLHUP)) != 0) {
+            return false;
+        }
+        connection->connected = true;
+    }
+
+    bool is_traffic = connection == &traffic_;
+    auto on_document = [this, is_traffic](std::string_view document) {
+        if (!is_traffic) {
+            awaiting_connections_ = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                recorder_.OnConnectionsDocument(document);
+            }
+            if (connections_reset_.exchange(false)) {
+                connection_table_.Reset();
+            }
+            if (tracking_connections_) {
+                auto diff = std::make_unique<ConnectionDiff>();
+                if (connection_table_.Apply(document, diff.get()) && !diff->empty()) {
+                    PostConnectionDiff(std::move(diff));
+                }
+            }
+            return;
+        }
+        auto delta = std::make_unique<TrafficDelta>();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!recorder_.OnTrafficDocument(document, delta.get())) {
+                return;
+            }
+        }
+        if (main_window_handle_ &&
+            PostMessage(main_window_handle_, WM_TRAFFIC_SAMPLE, 0, reinterpret_cast<LPARAM>(delta.get()))) {
+            delta.release();
+        }
+        if (!awaiting_connections_ && connections_.connected) {
+            awaiting_connections_ = true;
+            connections_.output = ClashApiRequest("/connections", secret_);
+            // A send error also shows up when the connection is polled.
+            Flush(&connections_);
+        }
+    };
+    if ((revents & (POLLRDNORM | POLLHUP | POLLERR)) != 0) {
+        char buffer[kReadBufferSize];
+        for (int i = 0; i < kMaxReadsPerEvent; i++) {
+            int received = recv(connection->socket, buffer, static_cast<int>(sizeof(buffer)), 0);
+            if (received == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+                break;
+            }
+            if (received <= 0) {
+                connection->stream.OnClosed(on_document);
+                return false;
+            }
+            if (!connection->stream.Feed(std::string_view(buffer, static_cast<size_t>(received)), on_document)) {
+                return false;
+            }
+            if (static_cast<size_t>(received) < sizeof(buffer)) {
+                break;
+            }
+        }
+    }
+    return Flush(connection);
+}
+
+bool TrafficSampler::Flush(Connection* connection) {
+    while (!connection->output.empty()) {
+        int sent = send(connection->socket, connection->output.data(), static_cast<int>(connection->output.size()), 0);
+        if (sent == SOCKET_ERROR) {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        connection->output.erase(0, static_cast<size_t>(sent));
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "clash_api.h"
+#include "connection_table.h"
+#include "traffic_stats.h"
+
+// Posted for every traffic sample. lParam is a TrafficDelta* the window
+// owns from then on.
+#define WM_TRAFFIC_SAMPLE (WM_APP + 8)
+// Posted with what changed in the open connections while they are
+// tracked. lParam is a ConnectionDiff* the window owns from then on.
+#define WM_CONNECTION_DIFF (WM_APP + 11)
+
+// Follows sing-box's traffic through its Clash API on 127.0.0.1.
+//
+// A worker thread keeps one persistent connection streaming /traffic,
+// which sends a document per second; the second it closes becomes a
+// sample. Since that response never ends, the connection count is polled
+// on a second keep-alive connection, with one /connections request per
+// traffic document. If either connection drops, both are reopened after
+// kRetryInterval.
+//
+// While connections are tracked, each of those snapshots is also diffed
+// against the previous one, so the window gets at most one diff a second
+// however many connections there are.
+class TrafficSampler {
+public:
+    TrafficSampler();
+    ~TrafficSampler();
+
+    TrafficSampler(const TrafficSampler&) = delete;
+    TrafficSampler& operator=(const TrafficSampler&) = delete;
+
+    void SetMainWindowHandle(HWND hwnd);
+    // Starts a new history for the API at |port|, sending |secret| with
+    // every request unless it is empty.
+    void Start(uint16_t port, const std::string& secret);
+    // Keeps the history.
+    void Stop();
+    // Posts WM_CONNECTION_DIFF for every snapshot from now on, starting
+    // with a reset that lists every connection, or stops.
+    void TrackConnections(bool enabled);
+
+    // The recorded samples, oldest first, and the sequence number of the
+    // newest.
+    std::vector<TrafficSample> History(uint64_t* sequence);
+
+private:
+    static constexpr std::chrono::seconds kRetryInterval{1};
+    // Upper bound on a WSAPoll wait, so Stop() is noticed promptly.
+    static constexpr int kMaxPollMs = 100;
+    static constexpr int kMaxReadsPerEvent = 16;
+
+    struct Connection {
+        SOCKET socket = INVALID_SOCKET;
+        bool connected = false;
+        std::string output;
+        ClashApiStream stream;
+    };
+
+    void Run(uint16_t port);
+    bool Open(Connection* connection, uint16_t port, std::string_view path);
+    static void Close(Connection* connection);
+    // Reads and writes after WSAPoll; false when the connection is done.
+    bool Service(Connection* connection, short revents);
+    // Sends what is queued; false on a socket error.
+    static bool Flush(Connection* connection);
+    void PostConnectionDiff(std::unique_ptr<ConnectionDiff> diff);
+
+    HWND main_window_handle_ = nullptr;
+    std::thread worker_;
+    std::atomic<bool> stopping_ = false;
+
+    // Set by Start() before the worker runs, then read by it alone.
+    std::string secret_;
+
+    // Worker thread only.
+    Connection traffic_;
+    Connection connections_;
+    // A /connections request is out.
+    bool awaiting_connections_ = false;
+    ConnectionTable connection_table_;
+
+    std::atomic<bool> tracking_connections_ = false;
+    // Set by TrackConnections() for the worker to start over.
+    std::atomic<bool> connections_reset_ = false;
+
+    std::mutex mutex_;
+    // Guarded by |mutex_|.
+    TrafficRecorder recorder_;
+};